@@ -0,0 +1,92 @@
+/*
+ * date_bench.cc - Measure the throughput of our date-parsing.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "approxidate.h"
+
+
+/*
+ * Typical `Date:` header values, all of which the fast-path accepts.
+ */
+static const char *rfc_dates[] =
+{
+    "Tue, 14 Oct 2026 09:12:33 +0200",
+    "Mon, 3 Jan 2011 10:00:00 GMT",
+    "14 Oct 2026 09:12 -0700",
+    "Fri, 31 Dec 2049 12:00:00 +0530 (IST)",
+    "Wed, 2 Jun 2004 08:01:02 EDT",
+};
+
+/*
+ * Dates which only the general-purpose parser understands.
+ */
+static const char *other_dates[] =
+{
+    "2026-10-14 09:12:33",
+    "Tuesday, October 14th 2026 9:12am",
+    "14/10/2026 09:12",
+};
+
+
+/*
+ * Parse `count` dates from the given set with the given function,
+ * reporting the throughput.
+ */
+static void bench(const char *name, int (*parse)(const char *, struct timeval *),
+                  const char **dates, size_t n, long count)
+{
+    struct timeval tv;
+    long checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (long i = 0; i < count; i++)
+    {
+        if (parse(dates[i % n], &tv) == 0)
+            checksum += tv.tv_sec;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end - start).count();
+
+    printf("%-28s %8.3f s per million dates  (%10.0f dates/s)  [%ld]\n",
+           name, secs * 1000000.0 / count, count / secs, checksum % 1000);
+}
+
+
+int main(int argc, char *argv[])
+{
+    long count = (argc > 1) ? atol(argv[1]) : 1000000;
+
+    if (count <= 0)
+        count = 1000000;
+
+    size_t rfc_n   = sizeof(rfc_dates) / sizeof(rfc_dates[0]);
+    size_t other_n = sizeof(other_dates) / sizeof(other_dates[0]);
+
+    bench("parse_rfc2822_date", parse_rfc2822_date, rfc_dates, rfc_n, count);
+    bench("approxidate (RFC 5322)", approxidate, rfc_dates, rfc_n, count);
+    bench("approxidate (other)", approxidate, other_dates, other_n, count);
+
+    return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * lumail_bench.cc - Time the expensive operations, end-to-end.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <chrono>
+#include <getopt.h>
+#include <gmime/gmime.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "colour_string.h"
+#include "config.h"
+#include "file.h"
+#include "global_state.h"
+#include "lua.h"
+#include "maildir.h"
+#include "message.h"
+#include "message_sort.h"
+#include "message_threader.h"
+
+
+/*
+ * The results of each phase, printed as JSON once we're done.
+ */
+static std::vector < std::string > results;
+
+
+/*
+ * Record that the named phase processed `count` items in `secs` seconds.
+ */
+static void record(const char *phase, size_t count, double secs)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "  \"%s\": { \"count\": %zu, \"seconds\": %.6f, \"per_second\": %.1f }",
+             phase, count, secs, (secs > 0) ? (count / secs) : 0.0);
+
+    results.push_back(buf);
+}
+
+
+/*
+ * The number of seconds since the given time.
+ */
+static double since(std::chrono::steady_clock::time_point start)
+{
+    auto end = std::chrono::steady_clock::now();
+    return (std::chrono::duration<double>(end - start).count());
+}
+
+
+/*
+ * Render the given view, as the screen would, returning the number of
+ * lines drawn.
+ */
+static size_t render(const char *view)
+{
+    CLua *lua = CLua::instance();
+    std::vector < std::string > lines = lua->function2table(view);
+
+    for (const std::string &line : lines)
+    {
+        COLOURED_LINE out;
+        CColourString::parse_line(line, 8, out);
+    }
+
+    return (lines.size());
+}
+
+
+/*
+ * Show our usage.
+ */
+static void usage()
+{
+    printf("Usage: lumail_bench [options]\n\n");
+    printf("  --maildir DIR      The directory holding our maildirs.\n");
+    printf("  --config FILE      The configuration file used to render our views.\n");
+    printf("  --no-render        Don't render any views.\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::string prefix = "bench/Maildir";
+    std::string config_file = "global.config.lua";
+    bool rendering = true;
+
+    static struct option long_options[] =
+    {
+        {"config", required_argument, 0, 'c'},
+        {"help", no_argument, 0, 'h'},
+        {"maildir", required_argument, 0, 'm'},
+        {"no-render", no_argument, 0, 'n'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+
+    while ((c = getopt_long(argc, argv, "c:hm:n", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'c':
+            config_file = optarg;
+            break;
+
+        case 'm':
+            prefix = optarg;
+            break;
+
+        case 'n':
+            rendering = false;
+            break;
+
+        default:
+            usage();
+            return (c == 'h') ? 0 : 1;
+        }
+    }
+
+    g_mime_init(GMIME_ENABLE_RFC2047_WORKAROUNDS);
+
+    /*
+     * Find the maildirs.
+     */
+    auto start = std::chrono::steady_clock::now();
+    std::vector < std::string > maildirs = CFile::get_all_maildirs(prefix);
+    record("get_all_maildirs", maildirs.size(), since(start));
+
+    if (maildirs.empty())
+    {
+        fprintf(stderr, "No maildirs found beneath %s - run bench/maildir_gen first.\n", prefix.c_str());
+        return 1;
+    }
+
+    /*
+     * Find the messages within them.
+     */
+    CMessageList messages;
+
+    start = std::chrono::steady_clock::now();
+
+    for (std::string path : maildirs)
+    {
+        CMaildir maildir(path);
+        CMessageList found = maildir.getMessages();
+        messages.insert(messages.end(), found.begin(), found.end());
+    }
+
+    record("get_messages", messages.size(), since(start));
+
+    /*
+     * Parse the headers of each message.
+     */
+    start = std::chrono::steady_clock::now();
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        msg->header("From");
+        msg->header("Subject");
+        msg->header("Date");
+    }
+
+    record("parse_headers", messages.size(), since(start));
+
+    /*
+     * Sort them by date.
+     */
+    CMessageList sorted = messages;
+    start = std::chrono::steady_clock::now();
+    CMessageSort::sort(sorted, "date");
+    record("sort_date", sorted.size(), since(start));
+
+    /*
+     * Thread them.
+     */
+    start = std::chrono::steady_clock::now();
+    CThreadResult threads = CMessageThreader::instance()->thread(messages, "date");
+    record("thread", threads.order.size(), since(start));
+
+    /*
+     * Render the maildir and index views of the first folder, as the
+     * screen would, by way of our configuration file.
+     */
+    if (rendering && CFile::exists(config_file))
+    {
+        CLua *lua = CLua::instance();
+        lua->append_to_package_path("lib/?.lua");
+
+        CGlobalState *global = CGlobalState::instance();
+        global->update("there.is.no.match.here", NULL);
+
+        start = std::chrono::steady_clock::now();
+        lua->load_file(config_file);
+        record("load_config", 1, since(start));
+
+        CConfig *config = CConfig::instance();
+        config->set("index.async", 0);
+        config->set("maildir.prefix", prefix);
+
+        start = std::chrono::steady_clock::now();
+        config->set("global.mode", "maildir");
+        record("render_maildir", render("maildir_view"), since(start));
+
+        std::vector<std::shared_ptr<CMaildir>> folders = global->get_maildirs();
+
+        if (! folders.empty())
+        {
+            start = std::chrono::steady_clock::now();
+            global->set_maildir(folders[0]);
+            record("select_maildir", global->get_messages()->size(), since(start));
+
+            start = std::chrono::steady_clock::now();
+            config->set("global.mode", "index");
+            record("render_index", render("index_view"), since(start));
+        }
+    }
+
+    printf("{\n");
+
+    for (size_t i = 0; i < results.size(); i++)
+        printf("%s%s\n", results[i].c_str(), (i + 1 < results.size()) ? "," : "");
+
+    printf("}\n");
+
+    CGlobalState::destroy_instance();
+    CMessageThreader::destroy_instance();
+    CLua::destroy_instance();
+    CConfig::destroy_instance();
+
+    g_mime_shutdown();
+
+    return 0;
+}
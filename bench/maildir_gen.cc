@@ -0,0 +1,373 @@
+/*
+ * maildir_gen.cc - Generate a synthetic tree of maildirs to benchmark with.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+
+/*
+ * Words we build subjects and bodies from.
+ */
+static const char *words[] =
+{
+    "release", "notes", "patch", "review", "meeting", "lunch", "invoice",
+    "server", "backup", "kernel", "mailing", "list", "holiday", "update",
+    "question", "urgent", "report", "weekly", "status", "draft", "build",
+    "failure", "success", "deploy", "config", "lumail", "thread", "reply",
+};
+
+/*
+ * The people who send our messages.
+ */
+static const char *people[] =
+{
+    "Steve Kemp <steve@example.com>",
+    "Alice Smith <alice@example.org>",
+    "Bob Jones <bob@example.net>",
+    "=?UTF-8?B?SsO8cmdlbiBNw7xsbGVy?= <juergen@example.de>",
+    "Carol <carol@example.com>",
+    "dave@example.org",
+};
+
+
+/*
+ * Our settings, and their defaults.
+ */
+struct settings
+{
+    std::string output;
+    int folders;
+    int messages;
+    int size;
+    int attachments;
+    int html;
+    int depth;
+    unsigned int seed;
+};
+
+
+/*
+ * Pick an entry of the given array at random.
+ */
+#define PICK(array) ( array[ rand() % ( sizeof(array) / sizeof(array[0]) ) ] )
+
+
+/*
+ * Make a directory, which may already exist.
+ */
+static bool make_dir(const std::string &path)
+{
+    if ((mkdir(path.c_str(), 0755) != 0) && (errno != EEXIST))
+    {
+        fprintf(stderr, "Failed to create %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Return a line of random words, of roughly the given length.
+ */
+static std::string random_text(int length)
+{
+    std::string result;
+
+    while ((int)result.size() < length)
+    {
+        if (! result.empty())
+            result += " ";
+
+        result += PICK(words);
+    }
+
+    return (result);
+}
+
+
+/*
+ * Return a body of the given size, wrapped at 72 columns.
+ */
+static std::string random_body(int size)
+{
+    std::string body;
+
+    while ((int)body.size() < size)
+        body += random_text(72) + "\n";
+
+    return (body);
+}
+
+
+/*
+ * Return `size` bytes of base64-encoded noise, wrapped at 76 columns.
+ */
+static std::string random_base64(int size)
+{
+    static const char *alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string result;
+
+    for (int i = 0; i < size; i++)
+    {
+        result += alphabet[rand() % 64];
+
+        if ((i % 76) == 75)
+            result += "\n";
+    }
+
+    return (result + "\n");
+}
+
+
+/*
+ * The Message-ID of the given message.
+ */
+static std::string message_id(int folder, int message)
+{
+    return ("<" + std::to_string(folder) + "." + std::to_string(message) + "@bench.lumail.org>");
+}
+
+
+/*
+ * Write a single message.
+ *
+ * Messages form threads `depth` deep, each replying to the one before.
+ */
+static bool write_message(const settings &s, const std::string &dir, int folder, int message)
+{
+    time_t when = 1400000000 + (folder * 86400) + (message * 600);
+
+    /*
+     * Most messages are read, and in `cur/`, the rest are new.
+     */
+    bool unread = (rand() % 5) == 0;
+
+    std::string path = dir + (unread ? "/new/" : "/cur/") +
+                       std::to_string(when) + ".M" + std::to_string(message) +
+                       "P" + std::to_string(folder) + ".bench";
+
+    if (! unread)
+        path += ":2,S";
+
+    FILE *fp = fopen(path.c_str(), "w");
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Failed to create %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char date[64];
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S +0000", gmtime(&when));
+
+    int position = (s.depth > 1) ? (message % s.depth) : 0;
+
+    fprintf(fp, "From: %s\n", PICK(people));
+    fprintf(fp, "To: %s\n", PICK(people));
+    fprintf(fp, "Date: %s\n", date);
+    fprintf(fp, "Message-ID: %s\n", message_id(folder, message).c_str());
+
+    if (position > 0)
+    {
+        std::string refs;
+
+        for (int i = message - position; i < message; i++)
+            refs += (refs.empty() ? "" : " ") + message_id(folder, i);
+
+        fprintf(fp, "Subject: Re: thread %d\n", message - position);
+        fprintf(fp, "In-Reply-To: %s\n", message_id(folder, message - 1).c_str());
+        fprintf(fp, "References: %s\n", refs.c_str());
+    }
+    else
+        fprintf(fp, "Subject: %s\n", random_text(40).c_str());
+
+    fprintf(fp, "MIME-Version: 1.0\n");
+
+    std::string body = random_body(s.size);
+
+    bool attach = (rand() % 100) < s.attachments;
+    bool html   = (rand() % 100) < s.html;
+
+    if (! attach && ! html)
+    {
+        fprintf(fp, "Content-Type: text/plain; charset=utf-8\n\n%s", body.c_str());
+        fclose(fp);
+        return true;
+    }
+
+    fprintf(fp, "Content-Type: multipart/%s; boundary=\"bench-outer\"\n\n",
+            attach ? "mixed" : "alternative");
+
+    if (attach && html)
+    {
+        fprintf(fp, "--bench-outer\n");
+        fprintf(fp, "Content-Type: multipart/alternative; boundary=\"bench-inner\"\n\n");
+    }
+
+    const char *boundary = (attach && html) ? "bench-inner" : "bench-outer";
+
+    fprintf(fp, "--%s\nContent-Type: text/plain; charset=utf-8\n\n%s\n", boundary, body.c_str());
+
+    if (html)
+    {
+        fprintf(fp, "--%s\nContent-Type: text/html; charset=utf-8\n\n", boundary);
+        fprintf(fp, "<html><body><p>%s</p></body></html>\n", body.c_str());
+    }
+
+    if (attach && html)
+        fprintf(fp, "--bench-inner--\n");
+
+    if (attach)
+    {
+        fprintf(fp, "--bench-outer\n");
+        fprintf(fp, "Content-Type: application/octet-stream; name=\"data.bin\"\n");
+        fprintf(fp, "Content-Disposition: attachment; filename=\"data.bin\"\n");
+        fprintf(fp, "Content-Transfer-Encoding: base64\n\n%s", random_base64(s.size * 4).c_str());
+    }
+
+    fprintf(fp, "--bench-outer--\n");
+    fclose(fp);
+    return true;
+}
+
+
+/*
+ * Show our usage.
+ */
+static void usage()
+{
+    printf("Usage: maildir_gen [options]\n\n");
+    printf("  --output DIR       The directory to create maildirs beneath.\n");
+    printf("  --folders N        The number of maildirs to create.\n");
+    printf("  --messages N       The number of messages in each maildir.\n");
+    printf("  --size N           The approximate size of each body, in bytes.\n");
+    printf("  --attachments N    The percentage of messages with an attachment.\n");
+    printf("  --html N           The percentage of messages with an HTML part.\n");
+    printf("  --depth N          The number of messages in each thread.\n");
+    printf("  --seed N           The seed for our random numbers.\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    settings s;
+    s.output      = "bench/Maildir";
+    s.folders     = 20;
+    s.messages    = 500;
+    s.size        = 2048;
+    s.attachments = 10;
+    s.html        = 20;
+    s.depth       = 4;
+    s.seed        = 1;
+
+    static struct option long_options[] =
+    {
+        {"attachments", required_argument, 0, 'a'},
+        {"depth", required_argument, 0, 'd'},
+        {"folders", required_argument, 0, 'f'},
+        {"help", no_argument, 0, 'h'},
+        {"html", required_argument, 0, 'H'},
+        {"messages", required_argument, 0, 'm'},
+        {"output", required_argument, 0, 'o'},
+        {"seed", required_argument, 0, 'S'},
+        {"size", required_argument, 0, 's'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+
+    while ((c = getopt_long(argc, argv, "a:d:f:hH:m:o:S:s:", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'a':
+            s.attachments = atoi(optarg);
+            break;
+
+        case 'd':
+            s.depth = atoi(optarg);
+            break;
+
+        case 'f':
+            s.folders = atoi(optarg);
+            break;
+
+        case 'H':
+            s.html = atoi(optarg);
+            break;
+
+        case 'm':
+            s.messages = atoi(optarg);
+            break;
+
+        case 'o':
+            s.output = optarg;
+            break;
+
+        case 'S':
+            s.seed = atoi(optarg);
+            break;
+
+        case 's':
+            s.size = atoi(optarg);
+            break;
+
+        default:
+            usage();
+            return (c == 'h') ? 0 : 1;
+        }
+    }
+
+    srand(s.seed);
+
+    if (! make_dir(s.output))
+        return 1;
+
+    for (int f = 0; f < s.folders; f++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/folder-%04d", f);
+
+        std::string dir = s.output + name;
+
+        if (! make_dir(dir) || ! make_dir(dir + "/cur") ||
+                ! make_dir(dir + "/new") || ! make_dir(dir + "/tmp"))
+            return 1;
+
+        for (int m = 0; m < s.messages; m++)
+        {
+            if (! write_message(s, dir, f, m))
+                return 1;
+        }
+    }
+
+    printf("Created %d maildirs, of %d messages each, beneath %s\n",
+           s.folders, s.messages, s.output.c_str());
+    return 0;
+}
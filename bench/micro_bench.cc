@@ -0,0 +1,420 @@
+/*
+ * micro_bench.cc - Microbenchmarks of our core containers and helpers.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <chrono>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "cache.h"
+#include "colour_string.h"
+#include "config.h"
+#include "history.h"
+#include "logger.h"
+#include "util.h"
+
+
+/*
+ * Our settings.
+ */
+static size_t iterations = 1000000;
+static size_t entries    = 1000000;
+static size_t runs       = 3;
+static std::string filter;
+
+
+/*
+ * Results are accumulated here, so that the compiler can't discard the
+ * work we're timing.
+ */
+static volatile size_t sink = 0;
+
+
+/*
+ * Should the named benchmark run?
+ */
+static bool wanted(const char *name)
+{
+    return (filter.empty() || (std::string(name).find(filter) != std::string::npos));
+}
+
+
+/*
+ * Report the time taken for the given number of operations.
+ */
+static void report(const char *name, size_t ops, double secs)
+{
+    printf("%-28s %10zu ops  %12.1f ns/op\n", name, ops, (secs * 1e9) / ops);
+}
+
+
+/*
+ * Time `body(i)` for each of `count` iterations, after a warmup of a
+ * tenth as many.
+ */
+template < typename F > static void bench(const char *name, size_t count, F body)
+{
+    if (! wanted(name))
+        return;
+
+    for (size_t i = 0; i < count / 10; i++)
+        body(i);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < count; i++)
+        body(i);
+
+    auto end = std::chrono::steady_clock::now();
+    report(name, count, std::chrono::duration<double>(end - start).count());
+}
+
+
+/*
+ * Time `body()`, which processes `items` items at once, over a number of
+ * runs after one warmup run, reporting the time per item.
+ */
+template < typename F > static void bench_batch(const char *name, size_t items, F body)
+{
+    if (! wanted(name))
+        return;
+
+    body();
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < runs; i++)
+        body();
+
+    auto end = std::chrono::steady_clock::now();
+    report(name, items * runs, std::chrono::duration<double>(end - start).count());
+}
+
+
+/*
+ * Benchmark getting and setting configuration values.
+ */
+static void bench_config()
+{
+    CConfig *config = CConfig::instance();
+
+    config->set("index.max", 1234, false);
+    config->set("global.mode", "index", false);
+
+    bench("CConfig::get_integer", iterations, [&](size_t)
+    {
+        sink += config->get_integer("index.max");
+    });
+
+    bench("CConfig::get_string", iterations, [&](size_t)
+    {
+        sink += config->get_string("global.mode").size();
+    });
+
+    CConfigKey max_key("index.max");
+
+    bench("CConfig::get_integer (key)", iterations, [&](size_t)
+    {
+        sink += config->get_integer(max_key);
+    });
+
+    bench("CConfig::set(int) unchanged", iterations, [&](size_t)
+    {
+        config->set(max_key, 1234);
+    });
+
+    bench("CConfig::set(int)", iterations, [&](size_t i)
+    {
+        config->set("index.current", (int)i);
+    });
+
+    bench("CConfig::set(string)", iterations, [&](size_t i)
+    {
+        config->set("global.mode", (i & 1) ? "index" : "maildir");
+    });
+}
+
+
+/*
+ * Benchmark our input-history, as populated with 100,000 entries.
+ */
+static void bench_history()
+{
+    CHistory *history = CHistory::instance();
+    history->set_max(100000);
+
+    for (size_t i = 0; i < 100000; i++)
+        history->add("search " + std::to_string(i));
+
+    history->add("open INBOX");
+
+    bench("CHistory::add (duplicate)", iterations / 100, [&](size_t i)
+    {
+        history->add("search " + std::to_string(i % 1000));
+    });
+
+    bench("CHistory::search", iterations, [&](size_t)
+    {
+        sink += history->search("open", history->size(), true);
+    });
+}
+
+
+/*
+ * Benchmark logging messages, both of a level which is discarded and of
+ * one which is written.
+ */
+static void bench_logger()
+{
+    char path[] = "/tmp/micro_bench.XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd == -1)
+        return;
+
+    close(fd);
+
+    CLogger *logger = CLogger::instance();
+    logger->set_level("lua|maildir|startup");
+    logger->set_path(path);
+
+    bench("CLogger::log (discarded)", iterations, [&](size_t i)
+    {
+        logger->log("debug", "Message %zu", i);
+    });
+
+    bench("CLogger::log", iterations, [&](size_t i)
+    {
+        logger->log("maildir", "Found %zu message(s).", i);
+    });
+
+    logger->set_path("");
+    unlink(path);
+}
+
+
+/*
+ * Benchmark our cache, as populated with `entries` keys.
+ */
+static void bench_cache()
+{
+    std::vector < std::string > keys;
+
+    for (size_t i = 0; i < entries; i++)
+        keys.push_back("/home/user/Maildir/INBOX/cur/" + std::to_string(1400000000 + i) + ".host:2,S|Subject");
+
+    CCache cache;
+    std::string value = "Re: Your weekly status report";
+
+    bench_batch("CCache::set", entries, [&]()
+    {
+        for (const std::string &key : keys)
+            cache.set(key, value);
+    });
+
+    bench("CCache::get", iterations, [&](size_t i)
+    {
+        sink += cache.get(keys[i % keys.size()]).size();
+    });
+
+    /*
+     * Numbers, as the sorting functions store, are fetched without being
+     * converted from strings.
+     */
+    for (size_t i = 0; i < keys.size(); i++)
+        cache.set_integer("compare_by_date" + keys[i], 1400000000 + i);
+
+    bench("CCache::get_number", iterations, [&](size_t i)
+    {
+        double value;
+
+        if (cache.get_number("compare_by_date" + keys[i % keys.size()], value))
+            sink += (size_t) value;
+    });
+
+    char path[] = "/tmp/micro_bench.XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd == -1)
+        return;
+
+    close(fd);
+
+    bench_batch("CCache::save", entries, [&]()
+    {
+        cache.save(path);
+    });
+
+    bench_batch("CCache::load", entries, [&]()
+    {
+        cache.load(path);
+    });
+
+    /*
+     * Entries are copied from a loaded file the first time they're used.
+     */
+    bench("CCache::get (loaded)", iterations, [&](size_t i)
+    {
+        sink += cache.get(keys[i % keys.size()]).size();
+    });
+
+    /*
+     * Setting entries with a journal appends a record for each.
+     */
+    CCache journalled;
+
+    if (journalled.open_journal(path))
+    {
+        bench_batch("CCache::set (journal)", entries, [&]()
+        {
+            for (const std::string &key : keys)
+                journalled.set(key, value);
+        });
+
+        journalled.close_journal();
+    }
+
+    unlink(path);
+    unlink((std::string(path) + ".journal").c_str());
+    unlink((std::string(path) + ".journal.compacting").c_str());
+}
+
+
+/*
+ * Benchmark parsing the colour-markup of typical index lines.
+ */
+static void bench_colour()
+{
+    std::vector < std::string > lines =
+    {
+        "$[RED]N  $[YELLOW|BOLD]14 Oct$[WHITE] Steve Kemp            $[GREEN]Re: Your weekly status report",
+        "$[WHITE]   $[YELLOW]13 Oct$[WHITE] Alice Smith           Release notes for 2.0, please review",
+        "$[WHITE]A  $[YELLOW]12 Oct$[WHITE] \xc3\x93lafur Arnalds        $[CYAN|UNDERLINE]\xe2\x98\x83 Holiday plans\t(draft)",
+        "$[WHITE]   $[YELLOW]01 Jan$[WHITE] dave@example.org      A fairly long subject line, without any colours at all within it",
+    };
+
+    COLOURED_LINE out;
+
+    bench("CColourString::parse_line", iterations, [&](size_t i)
+    {
+        CColourString::parse_line(lines[i % lines.size()], 8, out);
+        sink += out.chars.size();
+    });
+
+    bench("CColourString::parse_cached", iterations, [&](size_t i)
+    {
+        sink += CColourString::parse_cached(lines[i % lines.size()], 8)->chars.size();
+    });
+}
+
+
+/*
+ * Benchmark our string utilities.
+ */
+static void bench_util()
+{
+    std::string flags = "\\Seen,\\Answered,\\Flagged,\\Deleted,\\Draft,$Forwarded,$Junk";
+    std::string path  = "imaps://imap.example.com/INBOX/Lists/lumail-dev";
+
+    bench("split", iterations, [&](size_t)
+    {
+        sink += split(flags, ',').size();
+    });
+
+    bench("escape_filename", iterations, [&](size_t)
+    {
+        sink += escape_filename(path).size();
+    });
+}
+
+
+/*
+ * Show our usage.
+ */
+static void usage()
+{
+    printf("Usage: micro_bench [options]\n\n");
+    printf("  --iterations N     The number of operations of each benchmark.\n");
+    printf("  --entries N        The number of entries to fill our cache with.\n");
+    printf("  --runs N           The number of runs of each batch benchmark.\n");
+    printf("  --filter STRING    Only run benchmarks whose name contains STRING.\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] =
+    {
+        {"entries", required_argument, 0, 'e'},
+        {"filter", required_argument, 0, 'f'},
+        {"help", no_argument, 0, 'h'},
+        {"iterations", required_argument, 0, 'i'},
+        {"runs", required_argument, 0, 'r'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+
+    while ((c = getopt_long(argc, argv, "e:f:hi:r:", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'e':
+            entries = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'f':
+            filter = optarg;
+            break;
+
+        case 'i':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            runs = strtoul(optarg, NULL, 10);
+            break;
+
+        default:
+            usage();
+            return (c == 'h') ? 0 : 1;
+        }
+    }
+
+    if ((iterations < 1) || (entries < 1) || (runs < 1))
+    {
+        usage();
+        return 1;
+    }
+
+    bench_config();
+    bench_cache();
+    bench_colour();
+    bench_history();
+    bench_logger();
+    bench_util();
+
+    CConfig::destroy_instance();
+    CHistory::destroy_instance();
+    CLogger::destroy_instance();
+    return 0;
+}
@@ -70,12 +70,12 @@
 --
 -- Load libraries
 --
+Columns = require "columns"
 Fun = require "functional"
 Life = require "life"
 Stack = require "stack"
 keymap = require "keymap"
 Progress = require "progress_bar"
-Hcache = require "header_cache"
 Threader = require "threader"
 
 --
@@ -99,6 +99,12 @@ end
 --
 cache = Cache.new()
 
+--
+-- Write the cache's journal periodically, so little is lost on a crash.
+--
+cache_journalled = false
+Timer.every(5, function() cache:flush() end)
+
 --
 -- If the user changes the index-limit we'll try to keep the same
 -- maildir selected.  We do that by caching the old value here.
@@ -115,6 +121,16 @@ local prev_maildir = nil
 
 local global_msgs = nil
 
+--
+-- The selections we've made from the messages of the folders we've
+-- visited recently, keyed by path, and the order we visited them in.
+--
+-- Returning to a folder whose messages haven't changed reuses its
+-- selection, rather than filtering, sorting, and threading again.
+--
+local folder_msgs = {}
+local folder_order = {}
+
 
 --
 -- Define some utility functions
@@ -250,10 +266,12 @@ function os.exit (code)
 
 
   --
-  -- Get the cache-prefix
+  -- If our cache is journalled then its changes are already on disk,
+  -- and emptying it flushes any that are buffered.  Otherwise save it
+  -- beneath the cache-prefix.
   --
   local dir = Config:get "cache.prefix"
-  if dir then
+  if dir and not cache_journalled then
     --
     -- Ensure the directory exists.
     --
@@ -331,81 +349,102 @@ end
 
 
 --
--- If this function is defined it will be invoked any time
--- a configuration-key has its value changed.
+-- Functions subscribed to a key are invoked any time that
+-- configuration-key has its value changed.
+--
+-- The arguments will be the name of the key which has been
+-- updated, and its previous value - the new value can be retrieved
+-- via Config:get, but remember that the value might be a string, an
+-- integer, or a table.
 --
--- The single argument will be the name of the key which has
--- been updated - the value can be retrieved via Config:get, but
--- remember that the value might be a string, an integer, or a table.
+-- (Defining `Config.key_changed` instead gets every change to every
+-- key, which is much more expensive.)
 --
-function Config.key_changed (name, old)
 
-  --
-  -- Obsolete setting?
-  --
-  if name == "message.cache" then
-    warning_msg "The configuration key 'message.cache' is obsolete!"
-    return
-  end
+--
+-- Obsolete setting?
+--
+Config:subscribe("message.cache", function (name, old)
+  warning_msg "The configuration key 'message.cache' is obsolete!"
+end)
 
-  --
-  -- If the cache-prefix has changed load the cache
-  --
-  if name == "cache.prefix" then
-    local cache_prefix = Config:get "cache.prefix"
-    local file = cache_prefix .. "/" .. Config:get "global.version"
-    if file and File:exists(file) then
-      info_msg("Loading cache " .. file)
-      cache:load(file)
-    end
-    return
+--
+-- If the cache-prefix has changed load the cache
+--
+Config:subscribe("cache.prefix", function (name, old)
+  local cache_prefix = Config:get "cache.prefix"
+  if not Directory:exists(cache_prefix) then
+    Directory:mkdir(cache_prefix)
   end
 
   --
-  -- If index.limit changes then we must flush our message cache.
+  -- Load the cache, and journal any changes to it beside the file
+  -- it was loaded from.
   --
-  if name == "index.limit" then
-    global_msgs = nil
-    return
+  local file = cache_prefix .. "/" .. Config:get "global.version"
+  if File:exists(file) then
+    info_msg("Loading cache " .. file)
   end
+  cache_journalled = cache:journal(file)
+end)
 
-  --
-  -- If the index-limit changes then we'll try to preserve the
-  -- previously selected maildir.
-  --
-  if name == "maildir.limit" then
+--
+-- If the lifetime of cache-entries has changed then apply it.
+--
+Config:subscribe("cache.ttl", function (name, old)
+  cache:set_ttl(Config:get "cache.ttl" or (5 * 24 * 60 * 60))
+end)
 
-    -- Get the current index, if that fails we're done
-    local x = Config.get_with_default("maildir.current", -1)
-    if x == -1 then
-      return
-    end
+--
+-- If the size-limit of the cache has changed then apply it.
+--
+Config:subscribe("cache.max_bytes", function (name, old)
+  cache:set_max_bytes(Config:get "cache.max_bytes" or 0)
+end)
 
-    -- Get all known maildirs - filtered by the limit which was
-    -- PREVIOUSLY in place, using the value of old.
-    local m = maildirs(old)
+--
+-- If index.limit changes then we must flush our message cache.
+--
+Config:subscribe("index.limit", function (name, old)
+  global_msgs = nil
+end)
 
-    -- Now we can find the folder at the point
-    if m and (x + 1 <= #m) then
-      prev_maildir = m[x + 1]:path()
-    end
+--
+-- If the index-limit changes then we'll try to preserve the
+-- previously selected maildir.
+--
+Config:subscribe("maildir.limit", function (name, old)
+
+  -- Get the current index, if that fails we're done
+  local x = Config.get_with_default("maildir.current", -1)
+  if x == -1 then
+    return
   end
 
+  -- Get all known maildirs - filtered by the limit which was
+  -- PREVIOUSLY in place, using the value of old.
+  local m = maildirs(old)
 
-  --
-  -- If the sorting method has changed we need to resort our messages.
-  -- But only If we are in index view. Otherwise the messages get resorted when
-  -- index view is selected.
-  --
-  -- NOTE: We explicitly avoid re-reading the maildir, so we're
-  -- just changing the order of the existing messages not refreshing
-  -- them 100%.
-  --
-  if name == "index.sort" and Config:get "global.mode" == "index" then
+  -- Now we can find the folder at the point
+  if m and (x + 1 <= #m) then
+    prev_maildir = m[x + 1]:path()
+  end
+end)
+
+--
+-- If the sorting method has changed we need to resort our messages.
+-- But only If we are in index view. Otherwise the messages get resorted when
+-- index view is selected.
+--
+-- NOTE: We explicitly avoid re-reading the maildir, so we're
+-- just changing the order of the existing messages not refreshing
+-- them 100%.
+--
+Config:subscribe("index.sort", function (name, old)
+  if Config:get "global.mode" == "index" then
     global_msgs = sort_messages(global_msgs)
-    return
   end
-end
+end)
 
 
 --
@@ -470,10 +509,6 @@ do
 
   -- Restore to the previous mode
   function previous_mode ()
-    if Config:get("global.mode") == "index" then
-      -- Write the header cache of this maildir to disk
-      Hcache.save()
-    end
     local prev = mode_stack:pop()
     if prev == nil then
       prev = "maildir"
@@ -540,35 +575,20 @@ end
 -- headers.
 --
 function Message:to_ctime ()
-  local p = self:path()
-
-  --
-  -- Lookup value in the cache, if we can.
-  --
-  if cache:get(p .. "to_ctime") then
-    return (tonumber(cache:get(p .. "to_ctime")))
-  end
-
-
   --
   -- Look for the ctime in the message filename.
   --
-  local f = File:basename(p)
+  local f = File:basename(self:path())
   local num = string.match(f, "^([0-9]+)%.")
   if num then
-    -- Set the value in the cache, and return it.
-    cache:set(p .. "to_ctime", num)
     return (tonumber(num))
   end
 
   --
-  -- Otherwise parse the Received-Date + Date headers.
+  -- Otherwise use the Received-Date + Date headers, which are
+  -- parsed once and cached by the message itself.
   --
-  local seconds = self:ctime()
-
-  -- Set the value in the cache, and return it.
-  cache:set(p .. "to_ctime", seconds)
-  return seconds
+  return (self:ctime())
 end
 
 
@@ -618,6 +638,22 @@ function sort_messages (input)
     --
     local func = "compare_by_" .. method
 
+    --
+    -- If the method is one of our built-in ones, and the user hasn't
+    -- replaced its comparison function, use the native sort which
+    -- is much faster.
+    --
+    if _G[func] and (_G[func] == builtin_comparisons[method]) then
+      local t_start = os.time()
+      local sorted  = Global:sort_messages(input, method)
+      local t_end   = os.time()
+
+      if sorted then
+        Panel:append("Sort method $[WHITE|BOLD]" .. method .. "$[WHITE] took $[WHITE|BOLD]" .. (t_end - t_start) .. "$[WHITE] seconds with " .. "$[WHITE|BOLD]" .. #input .. "$[WHITE] messages")
+        return sorted
+      end
+    end
+
     --
     -- Is the desired sort-method defined?
     --
@@ -647,8 +683,9 @@ end
 --
 -- Compare two messages, based upon the modification-time of their filenames.
 --
--- We make sure we compare numbers, as these might have been cached and
--- saved as strings.
+-- Each message remembers its modification-time, which is taken from the
+-- index of its folder, or found by a single stat, so comparing them
+-- doesn't touch the filesystem.
 --
 -- Invoked when `index.sort` is set to `file`.
 --
@@ -658,33 +695,15 @@ end
 function compare_by_file (a, b)
   Progress:step "Sorting messages"
 
-
-  local a_path = a:path()
-  local a_time = cache:get("compare_by_file" .. a_path)
-
-  if a_time == nil then
-    a_time = File:stat(a_path)['mtime']
-    cache:set("compare_by_file" .. a_path, a_time)
-  end
-
-
-  local b_path = b:path()
-  local b_time = cache:get("compare_by_file" .. b_path)
-
-  if b_time == nil then
-    b_time = File:stat(b_path)['mtime']
-    cache:set("compare_by_file" .. b_path, b_time)
-  end
-
-  return tonumber(a_time) < tonumber(b_time)
+  return a:mtime() < b:mtime()
 end
 
 
 --
 -- Compare two messages, based upon their date-headers.
 --
--- We make sure we compare numbers, as these might have been cached and
--- saved as strings.
+-- The dates are cached as numbers, so that comparing them doesn't involve
+-- converting strings.
 --
 -- Invoked when `index.sort` is set to `date`.
 --
@@ -693,25 +712,25 @@ function compare_by_date (a, b)
 
 
   local a_path = a:path()
-  local a_date = cache:get("compare_by_date" .. a_path)
+  local a_date = cache:get_number("compare_by_date" .. a_path)
 
   if a_date == nil then
     a_date = a:to_ctime()
-    cache:set("compare_by_date" .. a_path, a_date)
+    cache:set_number("compare_by_date" .. a_path, a_date)
   end
 
   local b_path = b:path()
-  local b_date = cache:get("compare_by_date" .. b_path)
+  local b_date = cache:get_number("compare_by_date" .. b_path)
 
   if b_date == nil then
     b_date = b:to_ctime()
-    cache:set("compare_by_date" .. b_path, b_date)
+    cache:set_number("compare_by_date" .. b_path, b_date)
   end
 
   --
   -- Actually compare
   --
-  return tonumber(a_date) < tonumber(b_date)
+  return a_date < b_date
 end
 
 --
@@ -737,6 +756,18 @@ function compare_by_subject (a, b)
 end
 
 
+--
+-- The comparison functions which `Global:sort_messages` implements
+-- natively.  If you redefine one of these your version will be used.
+--
+builtin_comparisons = {
+  date    = compare_by_date,
+  file    = compare_by_file,
+  from    = compare_by_from,
+  subject = compare_by_subject,
+}
+
+
 --
 -- Utility method to change the sorting method, and flush our caches
 --
@@ -748,20 +779,29 @@ function sorting_method (value)
 end
 
 
+--
+-- The maildirs selected by the "all" and "new" limits, which are kept
+-- until the summaries they were selected from change.
+--
+local maildir_selections = {}
+local maildir_generation = nil
+
+
 --
 -- Return our maildirs
 --
 function maildirs (limit)
 
   --
-  -- Get all maildirs
+  -- Get the summaries of all maildirs, which are already sorted by
+  -- path, case-insensitively.
   --
-  local all = Global:maildirs()
+  local all, generation = Global:maildir_summaries()
 
-  --
-  -- The return value.
-  --
-  local ret = {}
+  if generation ~= maildir_generation then
+    maildir_selections = {}
+    maildir_generation = generation
+  end
 
   --
   -- Filter them according to the limit - if we don't have a limit
@@ -771,21 +811,28 @@ function maildirs (limit)
     limit = Config.get_with_default("maildir.limit", "all")
   end
 
+  local ret = maildir_selections[limit]
+  if ret then
+    Config:set("maildir.max", #ret)
+    return ret
+  end
+
+  ret = {}
+
   if limit == "all" then
     --
     -- All
     --
     for i, o in ipairs(all) do
-      table.insert(ret, o)
+      table.insert(ret, o.maildir)
     end
   elseif limit == "new" then
     --
     -- New
     --
     for i, o in ipairs(all) do
-      local unread = o:unread_messages()
-      if unread > 0 then
-        table.insert(ret, o)
+      if o.unread > 0 then
+        table.insert(ret, o.maildir)
       end
     end
   elseif limit == "today" then
@@ -796,12 +843,9 @@ function maildirs (limit)
     local today = time - (60 * 60 * 24)
 
     for i, o in ipairs(all) do
-      -- get modification-time of the maildir
-      local mtime = o:mtime()
-
-      -- if it was within the past 24 hours then add it
-      if mtime > today then
-        table.insert(ret, o)
+      -- if the maildir was modified within the past 24 hours then add it
+      if o.mtime > today then
+        table.insert(ret, o.maildir)
       end
     end
   else
@@ -809,19 +853,20 @@ function maildirs (limit)
     -- "Pattern"
     --
     for i, o in ipairs(all) do
-      local fmt = o:format()
+      local fmt = o.maildir:format()
       if string.find(fmt, limit) then
-        table.insert(ret, o)
+        table.insert(ret, o.maildir)
       end
     end
   end
 
   --
-  -- Sort them, case-insensitively
+  -- Folders leave "today" as time passes, and patterns match the
+  -- formatted folder, so only the other selections may be kept.
   --
-  table.sort(ret, function (a, b)
-      return a:path():lower() < b:path():lower()
-    end)
+  if limit == "all" or limit == "new" then
+    maildir_selections[limit] = ret
+  end
 
   Config:set("maildir.max", #ret)
   return ret
@@ -845,6 +890,27 @@ function get_messages ()
     return global_msgs
   end
 
+  --
+  -- If we made a selection from these same messages, with the same
+  -- limit and sorting, then we'll reuse it.  Only limits which don't
+  -- depend upon the time, or the flags of messages, survive changes
+  -- to those.
+  --
+  local generation, flags = Global:generations()
+  local limit = Config.get_with_default("index.limit", "all")
+  local method = Config:get "index.sort"
+  local folder = Global:current_maildir()
+  local path = folder and folder:path() or ""
+
+  local saved = folder_msgs[path]
+  if saved and saved.generation == generation and saved.limit == limit and
+     saved.method == method and
+     (limit == "all" or (limit ~= "today" and saved.flags == flags)) then
+    global_msgs = saved.msgs
+    threads_indentation = saved.indentation
+    return global_msgs
+  end
+
   global_msgs = {}
 
   --
@@ -872,7 +938,15 @@ function get_messages ()
   --
   local limit = Config.get_with_default("index.limit", "all")
 
-  if limit == "all" then
+  --
+  -- The built-in limits are applied natively, which is much faster,
+  -- only a pattern is tested here.
+  --
+  local filtered = Global:filter_messages(msgs, limit)
+
+  if filtered then
+    global_msgs = filtered
+  elseif limit == "all" then
     --
     -- "All"
     --
@@ -962,10 +1036,59 @@ function get_messages ()
   -- Sort and return the set
   --
   global_msgs = sort_messages(global_msgs)
+
+  --
+  -- Remember the selection, forgetting those of the folders we left
+  -- longest ago.
+  --
+  folder_msgs[path] = { generation = generation, flags = flags,
+                        limit = limit, method = method, msgs = global_msgs,
+                        indentation = threads_indentation }
+
+  for i, p in ipairs(folder_order) do
+    if p == path then
+      table.remove(folder_order, i)
+      break
+    end
+  end
+  table.insert(folder_order, 1, path)
+
+  local max = Config.get_with_default("index.folder_cache", 4) + 1
+  while #folder_order > max do
+    folder_msgs[table.remove(folder_order)] = nil
+  end
+
   return global_msgs
 end
 
 
+--
+-- Called once messages have been deleted, and removed from our cached
+-- selection too, so that the selection we keep for this folder is still
+-- reused.
+--
+function keep_selection ()
+  local folder = Global:current_maildir()
+  local saved = folder and folder_msgs[folder:path()]
+
+  if saved and saved.msgs == global_msgs then
+    saved.generation = Global:generations()
+  end
+end
+
+
+--
+-- Called when a batch of messages, for the currently selected maildir,
+-- has been loaded in the background.
+--
+-- We flush our cached selection so that the next redraw filters and
+-- sorts the complete set of messages we have so far.
+--
+function on_messages_loaded (complete)
+  global_msgs = nil
+end
+
+
 --
 --  Get the `parts` of a message as a table, handling all sub-parts too.
 --
@@ -1633,11 +1756,15 @@ function Message.delete (self)
   --
   local msg_index = Config.get_with_default("index.current", 0) + 1
 
-  -- Delete the message.
+  -- Delete the message, which removes it from the current messages
+  -- without reading the folder again.
   msg:unlink()
 
   -- Delete the message from the cache.
-  table.remove(global_msgs, msg_index)
+  if global_msgs then
+    table.remove(global_msgs, msg_index)
+    keep_selection()
+  end
 
   local mode = Config:get "global.mode"
 
@@ -2014,30 +2141,31 @@ function Maildir.select (desired, change_mode_too)
     local path = object:path()
     if string.ends(path, desired) then
 
-      -- Save the header cache of the previous selected maildir if possible.
-      Hcache.save()
-
-      -- Select the maildir, to make it current.
-      Global:select_maildir(object)
-
-      -- Load the header cache of the new selected maildir.
-      Hcache.load()
+      --
+      -- Make our changes together, so that the messages of the
+      -- folder are only read once.
+      --
+      Config:batch(function()
 
-      -- And update the current selection.
-      Config:set("maildir.current", index - 1)
+        -- Select the maildir, to make it current.
+        Global:select_maildir(object)
 
-      -- If we're supposed to change mode, do so.
-      if change_mode_too then
+        -- And update the current selection.
+        Config:set("maildir.current", index - 1)
 
-        change_mode "index"
+        -- If we're supposed to change mode, do so.
+        if change_mode_too then
 
-        -- Flush the cached message-list
-        global_msgs = nil
+          change_mode "index"
 
-        -- Invoke the per-user hook, if present.
-        if type(on_folder_changed) == "function" then
-          on_folder_changed(object)
+          -- Flush the cached message-list
+          global_msgs = nil
         end
+      end)
+
+      -- Invoke the per-user hook, if present.
+      if change_mode_too and type(on_folder_changed) == "function" then
+        on_folder_changed(object)
       end
 
       -- The first match wins, so we return after updating.
@@ -2081,12 +2209,10 @@ function write_mime_part( path )
   --  If we found the part.
   if found then
 
-     -- Open the file for writing
-     local file = assert(io.open(path, "w"))
-
-     -- save the content there
-     file:write(found['object']:content())
-     file:close()
+     -- Stream the decoded content to the file.
+     if not found['object']:save(path) then
+        return false
+     end
 
      return found
   else
@@ -2296,6 +2422,15 @@ end
 -- it is called by the `index_view()` function defined next.
 --
 function Message:format (thread_indent, index)
+
+  --
+  -- Unless the user cleans up the names of senders in Lua the row
+  -- is formatted natively, from a compiled copy of `index.format`.
+  --
+  if type(on_clean_name) ~= "function" then
+    return self:format_index(thread_indent or "", index)
+  end
+
   local path = self:path()
   local time = self:mtime()
 
@@ -2308,8 +2443,9 @@ function Message:format (thread_indent, index)
   local ckey = path .. "message:" .. Config.get_with_default("index.sort", "index.sort") .. Config.get_with_default("index.format", "index.format") .. time
 
   -- Do we have this cached?  If so return it
-  if cache:get(ckey) then
-    return (cache:get(ckey))
+  local cached = cache:get(ckey)
+  if cached then
+    return cached
   end
 
   if not thread_indent then
@@ -2424,17 +2560,28 @@ function Message:format (thread_indent, index)
 end
 
 
+--
+-- Views which are listed in this table are "windowed": rather than
+-- returning every row they're called with the (zero-based) offset of
+-- the first row to be drawn, and the number of rows, and return just
+-- those rows along with the total number of rows they have.
+--
+-- That keeps the cost of drawing independent of the number of rows.
+--
+windowed_views = windowed_views or {}
+
+
 --
 -- This function displays the screen when in `index`-mode.
 --
 -- It fetches the list of current messages, and calls `Message:format()`
--- on each one.
+-- on each one which is visible, when called with a window.
 --
--- As an optimization, primarily useful for large Maildirs, or when
--- using IMAP we can instead elect to only format the visible messages
--- if the setting `index.fast` is enabled.
+-- If called without a window every message is formatted, unless the
+-- setting `index.fast` is enabled in which case only the messages near
+-- the current one are.
 --
-function index_view ()
+function index_view (offset, count)
   local result = {}
 
   -- Get the available messages.
@@ -2442,7 +2589,25 @@ function index_view ()
 
   if (messages == nil) or (#messages == 0) then
     Screen:draw(10, 10, "There are no visible messages.")
-    return result
+    return result, 0
+  end
+
+  --
+  -- If we've been given a window then only format those messages.
+  --
+  if offset then
+    local last = math.min(#messages, offset + count)
+
+    -- Fetch the headers of any visible IMAP messages in one go, rather
+    -- than one at a time as each is formatted.
+    Global:prefetch_messages(messages, offset, count)
+
+    for i = offset + 1, last do
+      local object = messages[i]
+      table.insert(result, object:format(threads_indentation[object], i))
+    end
+
+    return add_colours(result, 'index'), #messages
   end
 
   -- Get the current offset
@@ -2500,6 +2665,7 @@ function index_view ()
   result = add_colours(result, 'index')
   return result
 end
+windowed_views[index_view] = true
 
 
 --
@@ -2748,8 +2914,9 @@ function Maildir:format (index)
   local ckey = path .. "maildir:" .. trunc .. src .. time .. Config.get_with_default("maildir.format", "maildir.format")
 
   -- Do we have this cached?  If so return it
-  if cache:get(ckey) then
-    return (cache:get(ckey))
+  local cached = cache:get(ckey)
+  if cached then
+    return cached
   end
 
   local total = self:total_messages()
@@ -2830,7 +2997,7 @@ end
 -- It retrieves the list of Maildirs, and calls `Maildir:format` on
 -- each one.
 --
-function maildir_view ()
+function maildir_view (offset, count)
   local result = {}
 
   -- Get the maildirs
@@ -2846,7 +3013,20 @@ function maildir_view ()
 
   if (folders == nil) or (#folders == 0) then
     Screen:draw(10, 10, "There are no visible folders.")
-    return result
+    return result, 0
+  end
+
+  --
+  -- If we've been given a window then only format those folders.
+  --
+  if offset then
+    local last = math.min(#folders, offset + count)
+
+    for i = offset + 1, last do
+      table.insert(result, folders[i]:format(i))
+    end
+
+    return add_colours(result, 'maildir'), #folders
   end
 
   -- For each one add the output
@@ -2861,6 +3041,7 @@ function maildir_view ()
   result = add_colours(result, 'maildir')
   return result
 end
+windowed_views[maildir_view] = true
 
 
 --
@@ -2893,38 +3074,21 @@ end
 
 
 --
--- This method returns the text which is displayed in message-mode.
---
--- First of all the current-message is retrieved, then that is
--- formatted into an array of lines which are displayed to the user.
+-- The text of the message we last showed, so that it needn't be built
+-- again each time we draw.  `key` identifies the message, and those
+-- settings which change how it is shown.
 --
--- The scrolling is handled on the C++ side.
---
-function message_view (msg)
-
-  --
-  -- If we're called in `message`-mode then we'll not have an
-  -- argument, so we need to find the message.
-  --
-  if not msg then
-    msg = Global:current_message()
-  end
-
-  if not msg then
-    return {
-      "No message selected!",
+local message_text = {}
 
 
-
-    }
-  end
-
-  --
-  -- Change the message to being read, if it is new.
-  --
-  if msg:is_new() then
-    msg:mark_read()
-  end
+--
+-- Build the text of the given message, returning a table of the lines
+-- of its header-area, and its body held natively by `Text`.
+--
+-- Neither has been coloured, nor has the body been escaped, as that is
+-- left until the lines are drawn.
+--
+function message_text_build (msg)
 
   local output = ""
 
@@ -3013,6 +3177,12 @@ function message_view (msg)
   --
   output = output .. "\n"
 
+  --
+  -- The body begins upon the (empty) last line of the header-area.
+  --
+  local header = string.to_table(output)
+  table.remove(header)
+
   --
   -- Now we're going to build up the body of the mail.
   --
@@ -3047,12 +3217,12 @@ function message_view (msg)
     -- Size
     local sz = part['size']
 
-    -- Content
-    local con = part['object']:content()
-
     -- If this is a text/BLAH part, which is not empty.
     if (string.find(ct, "text/")) and (sz > 0) then
 
+      -- Content, which is only decoded when we ask for it.
+      local con = part['object']:content()
+
       -- If we're showing all parts ..
       if all == 1 then
         if content[ct] then
@@ -3083,27 +3253,119 @@ function message_view (msg)
   --
   local txt = content["text/plain"] or content["text/html"] or "Failed to find suitable text/plain or text/html content."
 
+  return header, Text.new(txt)
+end
+
+
+--
+-- Get the text of the given message, building it unless we've done so
+-- already.
+--
+function message_text_get (msg)
+  local key = msg:path() .. "|" ..
+    Config.get_with_default("message.headers", 0) .. "|" ..
+    Config.get_with_default("message.all_parts", 0) .. "|" ..
+    Config.get_with_default("message.prepend", 0)
+
+  if message_text.key ~= key then
+    message_text.header, message_text.body = message_text_build(msg)
+    message_text.key = key
+  end
+
+  return message_text.header, message_text.body
+end
+
+
+--
+-- This method returns the text which is displayed in message-mode.
+--
+-- First of all the current-message is retrieved, then that is
+-- formatted into an array of lines which are displayed to the user.
+--
+-- In message-mode we're called with the (zero-based) offset of the
+-- first line to be drawn, and the number of lines.  The body is held
+-- natively, and only the lines we return are escaped and coloured, so
+-- that scrolling through even a huge message is cheap.
+--
+-- If we're instead called with a message every line is returned, for
+-- those who'd reply to, or forward, it.
+--
+-- The scrolling is handled on the C++ side.
+--
+function message_view (msg, count)
+
+  local offset = nil
+
   --
-  -- Escape the colours in the body
+  -- If we're called in `message`-mode then we'll not have a
+  -- message, so we need to find it.
   --
-  txt = escape_message_colours(txt)
+  if type(msg) == "number" then
+    offset = msg
+    msg = nil
+  end
+
+  if not msg then
+    msg = Global:current_message()
+  end
+
+  if not msg then
+    return {
+      "No message selected!",
+
+
+
+    }, 1
+  end
+
+  --
+  -- Change the message to being read, if it is new.
+  --
+  if msg:is_new() then
+    msg:mark_read()
+  end
 
   --
-  -- Now add to the body.
+  -- When viewing a message parse those either side of it, in the
+  -- background, so that moving to them is immediate.
   --
-  output = output .. txt
+  if offset then
+    Global:prepare_adjacent(get_messages(), Config.get_with_default("index.current", 0))
+  end
+
+  local header, body = message_text_get(msg)
+  local total = #header + body:count()
+
+  if not offset then
+    offset = 0
+    count = total
+  end
+
+  local result = {}
+
+  for i = offset + 1, math.min(offset + count, #header) do
+    table.insert(result, header[i])
+  end
 
   --
-  -- The command output is now split into rows.
+  -- Escape the colours in those lines of the body we're returning.
   --
-  local result = string.to_table(output)
+  local first = math.max(offset - #header, 0)
+  local want = offset + count - #header - first
+
+  if want > 0 then
+    for i, line in ipairs(body:lines(first, want)) do
+      table.insert(result, escape_message_colours(line))
+    end
+  end
 
   --
   -- Update the colours
   --
   result = add_colours(result, 'message')
-  return result
+  return result, total
 end
+windowed_views[message_view] = true
 
 
 --
@@ -3157,36 +3419,40 @@ function select ()
     end
 
     --
-    -- Select the folder and flush the message-cache.
+    -- Make our changes together, so that the messages of the
+    -- folder are only read once.
     --
-    Global:select_maildir(folder)
-    global_msgs = nil
+    Config:batch(function()
 
-    --
-    -- Call the user-function, if it exists.
-    --
-    if type(on_folder_changed) == "function" then
-      on_folder_changed(folder)
-    else
       --
-      -- Just show the folder we selected and the number of messages.
+      -- Select the folder and flush the message-cache.
+      --
+      Global:select_maildir(folder)
+      global_msgs = nil
+
+      --
+      -- Call the user-function, if it exists.
       --
-      local size = #get_messages()
-      if size == 1 then
-        info_msg("Selected " .. folder:path() .. " with 1 message.")
+      if type(on_folder_changed) == "function" then
+        on_folder_changed(folder)
       else
-        info_msg("Selected " .. folder:path() .. " with " .. size .. " messages.")
+        --
+        -- Just show the folder we selected and the number of messages.
+        --
+        local size = #get_messages()
+        if size == 1 then
+          info_msg("Selected " .. folder:path() .. " with 1 message.")
+        else
+          info_msg("Selected " .. folder:path() .. " with " .. size .. " messages.")
+        end
       end
-    end
 
-    -- Populate the header cache for this maildir
-    Hcache.load()
-
-    --
-    -- Change to the index-mode, so we can see the messages in
-    -- the folder.
-    --
-    change_mode "index"
+      --
+      -- Change to the index-mode, so we can see the messages in
+      -- the folder.
+      --
+      change_mode "index"
+    end)
     return
   end
 
@@ -3814,7 +4080,7 @@ do
     if #completions == 1 then
        choice = completions[1]
     else
-      choice = Screen:choose_string(completions)
+      choice = Screen:choose_fuzzy(completions)
     end
 
     if choice ~= "" then
@@ -4093,75 +4359,37 @@ end
 -- The only caveat here is that you can only define one function
 -- for any given frequency.
 --
+-- These functions are scheduled with `Timer.every()`, the first time
+-- we're idle, which you can also use directly:
+--
+--   Timer.every( 300, function() Panel:append( "Five minutes" ) end )
+--
 --
 do
 
   --
-  -- Table to hold the idle-timers the user has defined.
-  --
-  --  Key: The number of seconds between invocations.
+  -- Have we scheduled the user's on_XX functions yet?
   --
-  --  Val: A hash containing the function to invoke, and the last time
-  --       it was invoked.
-  --
-  local idle_timers = nil
+  local scheduled = false
 
 
   function on_idle ()
 
-    --
-    -- Initialize our callback-table, if it is empty.
-    --
-    if idle_timers == nil then
-
-      -- Ensure the timer-list is a table.
-      idle_timers = {}
-
-      -- Get the current time
-      local now = os.time()
-
-      -- Loop over all the things in the global scope.
-      for n, o in pairs(_G) do
-
-        -- Is it a function?
-        if type(o) == "function" then
-
-          -- Is the name of the function "on_NNN" ?
-          local period = string.match(n, "^on%_(%d+)$")
-          if period then
-            -- Save the result away.
-            idle_timers[period] = {
-              callback = o,
-              last = now,
-
-
-
-            }
-          end
-        end
-      end
+    if scheduled then
+      return
     end
 
-    --
-    -- Now we're in the routine that will run every second.
-    --
-    ct = os.time()
-
-    -- Iterate over our timer-table
-    for i, o in pairs(idle_timers) do
+    scheduled = true
 
-      -- Get the function to invoke.
-      local func = idle_timers[i]['callback']
+    -- Loop over all the things in the global scope.
+    for n, o in pairs(_G) do
 
-      -- Get the last time this function was last called.
-      local last = idle_timers[i]['last']
-
-      -- If the threshold has passed then..
-      if (tonumber(ct) - tonumber(last)) >= tonumber(i) then
-        -- Update the last-called time
-        idle_timers[i]['last'] = ct
-        -- Invoke the function.
-        func()
+      -- Is it a function named "on_NNN"?
+      if type(o) == "function" then
+        local period = string.match(n, "^on%_(%d+)$")
+        if period then
+          Timer.every( tonumber(period), o )
+        end
       end
     end
   end
@@ -0,0 +1,164 @@
+--
+-- Arrays of the fields of the current messages.
+--
+-- Under LuaJIT these are read directly from lumail, via the FFI, so
+-- loops over them avoid calling a method upon each message.  Elsewhere
+-- they're built from `Global:current_messages()`, once per change.
+--
+-----------------------------------------------------------------------------
+-----------------------------------------------------------------------------
+
+local Columns = {}
+
+
+--
+-- Load the FFI, and declare the functions lumail exports to it.
+--
+local ok, ffi = pcall(require, "ffi")
+
+if ok then
+  ok = pcall(function ()
+    ffi.cdef [[
+      typedef struct lumail_columns {
+        double generation;
+        uint32_t count;
+        const uint32_t *flags;
+        const double *ctime;
+        const double *size;
+        const uint32_t *from;
+        const uint32_t *subject;
+        const uint32_t *folder;
+      } lumail_columns;
+
+      const lumail_columns *lumail_message_columns(void);
+      const char *lumail_column_string(uint32_t id, size_t *len);
+    ]]
+
+    -- Ensure the binary exports our symbols.
+    return ffi.C.lumail_message_columns
+  end)
+end
+
+Columns.ffi = ok
+
+
+if Columns.ffi then
+
+  local bit = require "bit"
+  local len = ffi.new("size_t[1]")
+
+  --
+  -- Get the columns of the current messages.
+  --
+  function Columns.current ()
+    return ffi.C.lumail_message_columns()
+  end
+
+  --
+  -- Get the string with the given ID.
+  --
+  function Columns.string (id)
+    local str = ffi.C.lumail_column_string(id, len)
+    return ffi.string(str, len[0])
+  end
+
+  --
+  -- Does the given flags-mask contain the given flag?
+  --
+  function Columns.has_flag (mask, flag)
+    return bit.band(mask, bit.lshift(1, string.byte(flag) - 65)) ~= 0
+  end
+
+else
+
+  local cache = {}
+  local strings = {}
+
+  --
+  -- Convert the flags of a message into a mask.
+  --
+  local function flags_mask (flags)
+    local mask = 0
+    for c in flags:gmatch("%u") do
+      local b = 2 ^ (string.byte(c) - 65)
+      if math.floor(mask / b) % 2 == 0 then
+        mask = mask + b
+      end
+    end
+    return mask
+  end
+
+  --
+  -- Get the columns of the current messages.
+  --
+  -- These are only rebuilt when the table of messages, or the flags
+  -- of any message, has changed.
+  --
+  function Columns.current ()
+    local msgs = Global:current_messages()
+    local flags = {}
+
+    for i, msg in ipairs(msgs) do
+      flags[i - 1] = flags_mask(msg:flags())
+    end
+
+    if cache.msgs == msgs then
+      cache.flags = flags
+      return cache
+    end
+
+    local ids = { [""] = 0 }
+    strings = { [0] = "" }
+
+    local function intern (value)
+      local id = ids[value]
+      if id == nil then
+        id = #strings + 1
+        ids[value] = id
+        strings[id] = value
+      end
+      return id
+    end
+
+    cache = {
+      msgs = msgs,
+      generation = (cache.generation or 0) + 1,
+      count = #msgs,
+      flags = flags,
+      ctime = {},
+      size = {},
+      from = {},
+      subject = {},
+      folder = {}
+    }
+
+    for i, msg in ipairs(msgs) do
+      local folder = msg:path():gsub("/[^/]*$", ""):gsub("/cur$", ""):gsub("/new$", "")
+      cache.folder[i - 1] = intern(folder)
+      cache.ctime[i - 1] = msg:ctime()
+      cache.size[i - 1] = msg:size()
+      cache.from[i - 1] = intern(msg:header("From") or "")
+      cache.subject[i - 1] = intern(msg:header("Subject") or "")
+    end
+
+    return cache
+  end
+
+  --
+  -- Get the string with the given ID.
+  --
+  function Columns.string (id)
+    return strings[id] or ""
+  end
+
+  --
+  -- Does the given flags-mask contain the given flag?
+  --
+  function Columns.has_flag (mask, flag)
+    local b = 2 ^ (string.byte(flag) - 65)
+    return math.floor(mask / b) % 2 == 1
+  end
+
+end
+
+return Columns
@@ -218,11 +218,10 @@ end
 
 
 --
--- Helper to lookup the binding of a given key, in the specified mode.
+-- The helper to lookup the binding of a given key, in the specified
+-- mode, is `lookup_key (mode, key)`.  It is implemented in C++, which
+-- reads these tables directly unless it is replaced.
 --
-function lookup_key (mode, key)
-  return keymap[mode][key]
-end
 
 
 return keymap
@@ -300,7 +300,37 @@ Threader.roots = {}
 -- Return a flat list of messages and a list of thread indentation.
 -- Also generate the information in Threader.roots.
 --
+-- The threading is done natively, by `Global:thread_messages`, unless
+-- the threads are to be sorted by a comparison function which isn't
+-- one of the built-in ones.
+--
 function Threader.thread (messages)
+  local sort_method = Config:get("threads.sort")
+  local native = true
+
+  if sort_method then
+    local func = _G["compare_by_" .. sort_method]
+    if type(func) == "function" then
+      native = builtin_comparisons and (func == builtin_comparisons[sort_method])
+    else
+      sort_method = nil
+    end
+  end
+
+  if not native or not Global.thread_messages then
+    return Threader.thread_lua(messages)
+  end
+
+  local flat_list, indentation, roots = Global:thread_messages(messages, sort_method)
+  Threader.roots = roots
+  return flat_list, indentation
+end
+
+--
+-- Thread messages in Lua, used if the threads are sorted by a
+-- user-defined comparison function.
+--
+function Threader.thread_lua (messages)
   -- build up the threads
   -- hash table message-id:container
   local id_table = {}
@@ -477,6 +507,7 @@ function Threader.thread (messages)
   --
   -- Populate Threader.roots
   --
+  Threader.roots = {}
   for i,c in ipairs(roots) do
     local msg = c.message
     if not msg then
@@ -698,14 +729,14 @@ end
 -- Mark current thread as read
 --
 function Threader.thread_mark_read()
-  Threader.iterate_thread(Message.mark_read)
+  Global:mark_read(Threader.collect_thread())
 end
 
 --
 -- Mark current thread as unread
 --
 function Threader.thread_mark_unread()
-  Threader.iterate_thread(Message.mark_unread)
+  Global:mark_unread(Threader.collect_thread())
 end
 
 --
@@ -0,0 +1,172 @@
+/*
+ * allocations.cc - Counting the heap allocations made by each thread.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <new>
+#include <stdlib.h>
+
+#include "allocations.h"
+
+
+#ifdef DEBUG
+
+
+/*
+ * The allocations made by this thread, and the bytes they requested.
+ */
+static thread_local uint64_t g_count = 0;
+static thread_local uint64_t g_bytes = 0;
+
+
+/*
+ * The number of allocations made by this thread.
+ */
+uint64_t CAllocations::count()
+{
+    return (g_count);
+}
+
+
+/*
+ * The number of bytes requested by this thread.
+ */
+uint64_t CAllocations::bytes()
+{
+    return (g_bytes);
+}
+
+
+/*
+ * Allocate memory, counting it, as the standard `operator new` would.
+ */
+static void *allocate(size_t size)
+{
+    g_count++;
+    g_bytes += size;
+
+    if (size == 0)
+        size = 1;
+
+    while (true)
+    {
+        void *p = malloc(size);
+
+        if (p != NULL)
+            return (p);
+
+        std::new_handler handler = std::get_new_handler();
+
+        if (handler == NULL)
+            return (NULL);
+
+        handler();
+    }
+}
+
+
+void *operator new (size_t size)
+{
+    void *p = allocate(size);
+
+    if (p == NULL)
+        throw std::bad_alloc();
+
+    return (p);
+}
+
+
+void *operator new[](size_t size)
+{
+    void *p = allocate(size);
+
+    if (p == NULL)
+        throw std::bad_alloc();
+
+    return (p);
+}
+
+
+void *operator new (size_t size, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return (allocate(size));
+    }
+    catch (...)
+    {
+        return (NULL);
+    }
+}
+
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return (allocate(size));
+    }
+    catch (...)
+    {
+        return (NULL);
+    }
+}
+
+
+void operator delete (void *p) noexcept
+{
+    free(p);
+}
+
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+
+void operator delete (void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+
+#else
+
+
+/*
+ * Allocations are only counted in the debug build.
+ */
+uint64_t CAllocations::count()
+{
+    return 0;
+}
+
+
+uint64_t CAllocations::bytes()
+{
+    return 0;
+}
+
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * allocations.h - Counting the heap allocations made by each thread.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>
+
+
+/**
+ * We replace the global `operator new`, counting the allocations made by
+ * each thread, and the bytes they requested, so that the test suite can
+ * hold code to a budget of allocations.
+ *
+ * The counts are kept per-thread, so they cost no more than an increment
+ * each, and a test measures only its own work - the difference between
+ * two readings taken upon the same thread.  Allocations made directly
+ * with `malloc`, such as those of GMime and Lua, aren't counted.
+ *
+ * This is only done in the debug build, which runs our tests; in the
+ * release build the standard allocator is used, and the counts remain
+ * zero.
+ */
+class CAllocations
+{
+public:
+
+    /**
+     * The number of allocations made by this thread so far.
+     */
+    static uint64_t count();
+
+    /**
+     * The number of bytes requested by this thread so far.
+     */
+    static uint64_t bytes();
+};
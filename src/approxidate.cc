@@ -1070,10 +1070,253 @@ static int approxidate_str(const char *date, struct timeval *tv)
     return 0;
 }
 
+/*
+ * Skip folding whitespace, as permitted between the tokens of an
+ * RFC 5322 date.
+ */
+static inline const char *rfc_skip_space(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+        p++;
+
+    return p;
+}
+
+/*
+ * Read between `min` and `max` decimal digits, returning the number of
+ * digits read, and zero if there were too few or too many.
+ */
+static inline int rfc_digits(const char **pp, int min, int max, int *value)
+{
+    const char *p = *pp;
+    int n = 0, v = 0;
+
+    while (*p >= '0' && *p <= '9')
+    {
+        if (++n > max)
+            return 0;
+
+        v = v * 10 + (*p++ - '0');
+    }
+
+    if (n < min)
+        return 0;
+
+    *pp = p;
+    *value = v;
+    return n;
+}
+
+/*
+ * Pack three letters into an integer, case-insensitively, so that
+ * names can be matched with a single comparison.
+ */
+#define RFC_NAME(a, b, c) ((((a) | 0x20) << 16) | (((b) | 0x20) << 8) | ((c) | 0x20))
+
+static inline int rfc_name(const char *p)
+{
+    if (!isalpha(p[0]) || !isalpha(p[1]) || !isalpha(p[2]))
+        return -1;
+
+    return RFC_NAME(p[0], p[1], p[2]);
+}
+
+/*
+ * Convert a civil date to days since the epoch, without consulting the
+ * timezone database.  `month` is 1-12.
+ */
+static inline long rfc_days_from_civil(int year, int month, int day)
+{
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long yoe = year - era * 400;
+    long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+/*
+ * Parse a well-formed RFC 5322 (or RFC 2822/822) date in a single
+ * pass, without allocating, such as:
+ *
+ *    Tue, 14 Oct 2026 09:12:33 +0200
+ *
+ * The day-name, seconds, and a trailing comment are optional, as are
+ * the obsolete two-digit years and named zones.  Anything else is
+ * rejected, leaving it to the general-purpose parser.
+ */
+int parse_rfc2822_date(const char *date, struct timeval *tv)
+{
+    static const int month_days[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    const char *p = rfc_skip_space(date);
+    int day, month, year, hour, min, sec = 0, zone = 0, n;
+
+    /*
+     * Optional day-name, followed by a comma.
+     */
+    if (isalpha(*p))
+    {
+        switch (rfc_name(p))
+        {
+        case RFC_NAME('m', 'o', 'n'):
+        case RFC_NAME('t', 'u', 'e'):
+        case RFC_NAME('w', 'e', 'd'):
+        case RFC_NAME('t', 'h', 'u'):
+        case RFC_NAME('f', 'r', 'i'):
+        case RFC_NAME('s', 'a', 't'):
+        case RFC_NAME('s', 'u', 'n'):
+            break;
+
+        default:
+            return -1;
+        }
+
+        p = rfc_skip_space(p + 3);
+
+        if (*p++ != ',')
+            return -1;
+
+        p = rfc_skip_space(p);
+    }
+
+    if (!rfc_digits(&p, 1, 2, &day))
+        return -1;
+
+    p = rfc_skip_space(p);
+
+    switch (rfc_name(p))
+    {
+    case RFC_NAME('j', 'a', 'n'): month = 1;  break;
+    case RFC_NAME('f', 'e', 'b'): month = 2;  break;
+    case RFC_NAME('m', 'a', 'r'): month = 3;  break;
+    case RFC_NAME('a', 'p', 'r'): month = 4;  break;
+    case RFC_NAME('m', 'a', 'y'): month = 5;  break;
+    case RFC_NAME('j', 'u', 'n'): month = 6;  break;
+    case RFC_NAME('j', 'u', 'l'): month = 7;  break;
+    case RFC_NAME('a', 'u', 'g'): month = 8;  break;
+    case RFC_NAME('s', 'e', 'p'): month = 9;  break;
+    case RFC_NAME('o', 'c', 't'): month = 10; break;
+    case RFC_NAME('n', 'o', 'v'): month = 11; break;
+    case RFC_NAME('d', 'e', 'c'): month = 12; break;
+
+    default:
+        return -1;
+    }
+
+    p = rfc_skip_space(p + 3);
+
+    /*
+     * Two and three digit years are obsolete, but still seen.
+     */
+    if (!(n = rfc_digits(&p, 2, 4, &year)))
+        return -1;
+
+    if (n == 2)
+        year += (year < 50) ? 2000 : 1900;
+    else if (n == 3)
+        year += 1900;
+
+    if (day < 1 || day > month_days[month - 1] ||
+            (month == 2 && day == 29 && !((year % 4 == 0 && year % 100 != 0) || year % 400 == 0)))
+        return -1;
+
+    p = rfc_skip_space(p);
+
+    if (rfc_digits(&p, 2, 2, &hour) == 0 || *p++ != ':' || rfc_digits(&p, 2, 2, &min) == 0)
+        return -1;
+
+    if (*p == ':')
+    {
+        p++;
+
+        if (!rfc_digits(&p, 2, 2, &sec))
+            return -1;
+    }
+
+    if (hour > 23 || min > 59 || sec > 60)
+        return -1;
+
+    p = rfc_skip_space(p);
+
+    if (*p == '+' || *p == '-')
+    {
+        int sign = (*p++ == '-') ? -1 : 1, hhmm;
+
+        if (rfc_digits(&p, 4, 4, &hhmm) != 4 || (hhmm % 100) > 59)
+            return -1;
+
+        zone = sign * ((hhmm / 100) * 60 + (hhmm % 100));
+    }
+    else if (*p == 'Z' || *p == 'z')
+    {
+        p++;
+    }
+    else if (isalpha(*p))
+    {
+        /*
+         * The obsolete named zones.
+         */
+        if ((p[0] | 0x20) == 'u' && (p[1] | 0x20) == 't' && !isalpha(p[2]))
+        {
+            p += 2;
+        }
+        else
+        {
+            switch (rfc_name(p))
+            {
+            case RFC_NAME('g', 'm', 't'):
+            case RFC_NAME('u', 't', 'c'): zone = 0;        break;
+            case RFC_NAME('e', 'd', 't'): zone = -4 * 60;  break;
+            case RFC_NAME('e', 's', 't'):
+            case RFC_NAME('c', 'd', 't'): zone = -5 * 60;  break;
+            case RFC_NAME('c', 's', 't'):
+            case RFC_NAME('m', 'd', 't'): zone = -6 * 60;  break;
+            case RFC_NAME('m', 's', 't'):
+            case RFC_NAME('p', 'd', 't'): zone = -7 * 60;  break;
+            case RFC_NAME('p', 's', 't'): zone = -8 * 60;  break;
+
+            default:
+                return -1;
+            }
+
+            if (isalpha(p[3]))
+                return -1;
+
+            p += 3;
+        }
+    }
+    else
+    {
+        return -1;
+    }
+
+    /*
+     * Only whitespace, or a comment such as "(CEST)", may follow.
+     */
+    p = rfc_skip_space(p);
+
+    if (*p != '\0' && *p != '(')
+        return -1;
+
+    long days = rfc_days_from_civil(year, month, day);
+
+    tv->tv_sec  = days * 86400 + hour * 3600 + min * 60 + sec - zone * 60;
+    tv->tv_usec = 0;
+    return 0;
+}
+
+#undef RFC_NAME
+
 int approxidate(const char *date, struct timeval *tv)
 {
     int offset;
 
+    if (!parse_rfc2822_date(date, tv))
+    {
+        return 0;
+    }
+
     if (!parse_date_basic(date, tv, &offset))
     {
         return 0;
@@ -12,4 +12,18 @@
  */
 int approxidate(const char *date, struct timeval *tv);
 
+/**
+ * Parse a well-formed RFC 5322 date, as found in most `Date:` headers.
+ *
+ * This is the strict, single-pass, parser which `approxidate` tries
+ * before falling back to its general-purpose parsing.
+ *
+ * @param date The date string
+ * @param tv Where the time will be placed.
+ *
+ * @return 0 on success
+ * @return -1 on error
+ */
+int parse_rfc2822_date(const char *date, struct timeval *tv);
+
 #endif
\ No newline at end of file
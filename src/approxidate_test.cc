@@ -0,0 +1,106 @@
+/*
+ * approxidate_test.cc - Test-cases for our date-parsing.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+
+#include <stddef.h>
+#include <sys/time.h>
+
+#include "approxidate.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Helper for our date tests.
+ */
+typedef struct _date_test_case
+{
+    const char *input;
+    long expected;
+} date_test_case;
+
+
+/**
+ * Test that well-formed dates are handled by the fast-path parser.
+ */
+void TestRFC2822Date(CuTest * tc)
+{
+    date_test_case tests[] =
+    {
+        {"Tue, 14 Oct 2026 09:12:33 +0200", 1791961953},
+        {"14 Oct 2026 09:12 +0200", 1791961920},
+        {"Sat, 29 Feb 2020 23:59:59 -0800", 1583049599},
+        {"Thu, 1 Jan 1970 00:00:00 +0000", 0},
+        {"Mon, 3 Jan 99 10:00:00 GMT", 915357600},
+        {"Wed, 2 Jun 2004 08:01:02 EDT", 1086177662},
+        {"Fri, 31 Dec 2049 12:00:00 +0530 (IST)", 2524545000},
+        {"  tue,14 oct 2026 09:12:33 +0200\r\n", 1791961953},
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        struct timeval tv;
+
+        CuAssertIntEquals(tc, 0, parse_rfc2822_date(tests[i].input, &tv));
+        CuAssertTrue(tc, tv.tv_sec == tests[i].expected);
+
+        /*
+         * As must approxidate, which tries it first.
+         */
+        CuAssertIntEquals(tc, 0, approxidate(tests[i].input, &tv));
+        CuAssertTrue(tc, tv.tv_sec == tests[i].expected);
+    }
+}
+
+
+/**
+ * Test that anything unusual is left to the general-purpose parser.
+ */
+void TestRFC2822DateRejects(CuTest * tc)
+{
+    const char *tests[] =
+    {
+        "",
+        "yesterday",
+        "2026-10-14 09:12:33",
+        "Tuesday, 14 Oct 2026 09:12:33 +0200",
+        "Tue, 14 October 2026 09:12:33 +0200",
+        "Tue, 30 Feb 2026 09:12:33 +0200",
+        "Fri, 29 Feb 2019 09:12:33 +0200",
+        "Tue, 14 Oct 2026 24:12:33 +0200",
+        "Tue, 14 Oct 2026 09:12:33 +02",
+        "Tue, 14 Oct 2026 09:12:33 +0200 trailing",
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        struct timeval tv;
+        CuAssertIntEquals(tc, -1, parse_rfc2822_date(tests[i], &tv));
+    }
+}
+
+
+CuSuite *
+approxidate_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestRFC2822Date);
+    SUITE_ADD_TEST(suite, TestRFC2822DateRejects);
+    return suite;
+}
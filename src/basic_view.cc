@@ -17,9 +17,12 @@
  */
 
 
+#include <algorithm>
+
 #include "config.h"
 #include "lua.h"
 #include "basic_view.h"
+#include "statuspanel.h"
 
 
 
@@ -43,24 +46,77 @@ CBasicView::~CBasicView()
 
 
 /*
- * Get the text to display by calling the specified lua-function.
+ * Work out which rows could be visible, if the given row is selected.
+ *
+ * In simple modes the selection is the first row drawn.  Otherwise the
+ * highlighted row might be drawn anywhere upon the screen, so we ask for
+ * a screenful either side of it.
  */
-std::vector<std::string> CBasicView::get_text(std::string function)
+void CBasicView::visible_window(int cur, int &offset, int &count)
 {
+    int height = CScreen::height();
+
+    CStatusPanel *panel = CStatusPanel::instance();
+
+    if (panel->hidden() == false)
+        height -= panel->height();
+
     /*
-     * Call the view-function.
+     * `draw_text_lines` draws one more row than our height, plus one.
      */
+    height += 2;
+
+    if (m_simple)
+    {
+        offset = cur;
+        count  = height;
+    }
+    else
+    {
+        offset = std::max(cur - height, 0);
+        count  = (cur - offset) + height + 1;
+    }
+
+    if (offset < 0)
+        offset = 0;
+}
+
+
+/*
+ * Get the text to display by calling the specified lua-function.
+ *
+ * The function is asked for only the rows which could be visible, and
+ * it returns the total number of rows separately.  `first` is set to
+ * the number of the first row returned, which is zero for views which
+ * return every row.
+ */
+void CBasicView::get_text(std::string function, int &cur, int &first, CLuaRows &result)
+{
     CLua *lua = CLua::instance();
-    std::vector<std::string> result = lua->function2table(function);
+
+    int offset, count, max;
+    visible_window(cur, offset, count);
+
+    bool windowed = lua->function2window(function, offset, count, result, max);
 
     /*
-     * Store the number of lines we've retrieved.
+     * If the selection is beyond the rows which exist then we'll have
+     * asked for the wrong window, so try again once it is corrected.
      */
-    CConfig *config = CConfig::instance();
-    config->set(m_name + ".max", result.size());
+    if (windowed && (cur >= max) && (max > 0))
+    {
+        cur = max - 1;
+        visible_window(cur, offset, count);
+        windowed = lua->function2window(function, offset, count, result, max);
+    }
 
-    return (result);
+    first = windowed ? offset : 0;
 
+    /*
+     * Store the number of lines there are.
+     */
+    CConfig *config = CConfig::instance();
+    config->set(m_max_key, max);
 }
 
 
@@ -87,11 +143,19 @@ void CBasicView::draw()
     if (m_name.empty())
         return;
 
+    /*
+     * Get the currently-selected item.
+     */
+    CConfig *config = CConfig::instance();
+    int cur = config->get_integer(m_current_key);
+
     /*
      * Get the text we're supposed to display, by invoking our
      * lua function.
      */
-    std::vector<std::string> txt = get_text(m_function);
+    int first = 0;
+    CLuaRows txt;
+    get_text(m_function, cur, first, txt);
 
     /*
      * No text was output?  Return.
@@ -101,27 +165,22 @@ void CBasicView::draw()
 
 
     /*
-     * Get the currently-selected item, and the size of the lines.
+     * Get the size of the lines.
      */
-    CConfig *config = CConfig::instance();
-    int cur = config->get_integer(m_name + ".current");
-    int max = config->get_integer(m_name + ".max");
+    int max = config->get_integer(m_max_key);
 
 
     /*
      * Ensure our highlight isn't outside reasonable bounds.
      */
     if (cur >= max)
-    {
-        config->set(m_name + ".current", max - 1, false);
         cur = max - 1;
-    }
 
     if (cur < 0)
-    {
-        config->set(m_name + ".current", 0, false);
         cur = 0;
-    }
+
+    if (cur != config->get_integer(m_current_key))
+        config->set(m_current_key, cur, false);
 
 
     /*
@@ -133,7 +192,7 @@ void CBasicView::draw()
      * do the opposite.
      */
     CScreen *screen = CScreen::instance();
-    screen->draw_text_lines(txt, cur, max, m_simple);
+    screen->draw_text_lines(txt, cur, max, m_simple, first);
 
     /**
      * Free the text we have.
@@ -162,4 +221,7 @@ void CBasicView::set_data(std::string name, std::string function, bool simple)
     m_name     = name;
     m_function = function;
     m_simple   = simple;
+
+    m_current_key = CConfigKey(name + ".current");
+    m_max_key     = CConfigKey(name + ".max");
 }
@@ -21,6 +21,7 @@
 
 #include <vector>
 #include <string>
+#include "config.h"
 #include "screen.h"
 
 
@@ -85,14 +86,32 @@ private:
 
     /**
      * Get the display text by calling the specified lua-function.
+     *
+     * Only the rows which might be visible, with `cur` selected, are
+     * requested.  `cur` is corrected if it lies beyond the last row,
+     * and `first` is set to the number of the first row returned.
+     *
+     * The rows are borrowed from Lua, rather than copied, into `rows`.
+     */
+    void get_text(std::string function, int &cur, int &first, CLuaRows &rows);
+
+    /**
+     * Work out the offset, and count, of the rows which might be
+     * visible with the given row selected.
      */
-    std::vector<std::string> get_text(std::string function);
+    void visible_window(int cur, int &offset, int &count);
 
     /**
      * The name of this mode.  e.g. "lua", "index", etc.
      */
     std::string m_name;
 
+    /**
+     * Handles upon the `$mode.current` and `$mode.max` keys.
+     */
+    CConfigKey m_current_key;
+    CConfigKey m_max_key;
+
     /**
      * The lua-function that will generate our output.
      */
@@ -0,0 +1,246 @@
+/*
+ * bytecode_cache.cc - Cache the compiled form of our Lua files.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <iterator>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern "C"
+{
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+#include "bytecode_cache.h"
+#include "config.h"
+#include "directory.h"
+#include "util.h"
+
+
+/*
+ * The header of each cached chunk.
+ */
+typedef struct _bytecode_header
+{
+    char magic[8];
+    int32_t version;
+    int32_t number_size;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint64_t length;
+} bytecode_header;
+
+#define BYTECODE_MAGIC "LUMBC002"
+
+
+/*
+ * Constructor.
+ */
+CBytecodeCache::CBytecodeCache()
+{
+    m_hits = 0;
+    m_misses = 0;
+}
+
+
+/*
+ * The file in which the given source is cached.
+ */
+std::string CBytecodeCache::cache_file(std::string path)
+{
+    CConfig *config = CConfig::instance();
+
+    if (config->get_integer("lua.bytecode", 1) == 0)
+        return "";
+
+    std::string dir = config->get_string("lua.bytecode_cache");
+
+    if (dir.empty())
+    {
+        dir = config->get_string("cache.prefix");
+
+        /*
+         * Our global configuration is loaded before the user has
+         * had the chance to set a prefix, so default to theirs.
+         */
+        if (dir.empty())
+        {
+            const char *xdg  = getenv("XDG_CACHE_HOME");
+            const char *home = getenv("HOME");
+
+            if (xdg != NULL && *xdg != '\0')
+                dir = std::string(xdg) + "/lumail";
+            else if (home != NULL && *home != '\0')
+                dir = std::string(home) + "/.cache/lumail";
+            else
+                return "";
+        }
+
+        dir += "/bytecode";
+    }
+
+    /*
+     * The same file may be named in many ways.
+     */
+    char resolved[PATH_MAX];
+
+    if (realpath(path.c_str(), resolved) != NULL)
+        path = resolved;
+
+    return (dir + "/" + escape_filename(path) + ".luac");
+}
+
+
+/*
+ * Load the given file, via our cache.
+ */
+int CBytecodeCache::load(lua_State * l, std::string path)
+{
+    std::string cached = cache_file(path);
+    struct stat sb;
+
+    if (cached.empty() || (stat(path.c_str(), &sb) != 0))
+        return (luaL_loadfile(l, path.c_str()));
+
+    if (read_cached(l, path, cached, sb))
+    {
+        m_hits++;
+        return 0;
+    }
+
+    m_misses++;
+
+    int status = luaL_loadfile(l, path.c_str());
+
+    if (status == 0)
+        write_cached(l, cached, sb);
+
+    return (status);
+}
+
+
+/*
+ * Load the chunk cached for the given source, if it is current.
+ */
+bool CBytecodeCache::read_cached(lua_State * l, const std::string &path,
+                                 const std::string &cached, struct stat &sb)
+{
+    std::ifstream in(cached, std::ios::in | std::ios::binary);
+
+    if (! in.is_open())
+        return false;
+
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    bytecode_header header;
+
+    if (data.size() < sizeof(header))
+        return false;
+
+    memcpy(&header, data.data(), sizeof(header));
+
+    if ((memcmp(header.magic, BYTECODE_MAGIC, sizeof(header.magic)) != 0) ||
+            (header.version != LUA_VERSION_NUM) ||
+            (header.number_size != (int32_t) sizeof(lua_Number)) ||
+            (header.mtime != (int64_t) sb.st_mtim.tv_sec) ||
+            (header.mtime_nsec != (int64_t) sb.st_mtim.tv_nsec) ||
+            (header.size != (int64_t) sb.st_size) ||
+            (header.length != data.size() - sizeof(header)))
+        return false;
+
+    std::string name = "@" + path;
+
+#if LUA_VERSION_NUM == 501
+    int status = luaL_loadbuffer(l, data.data() + sizeof(header), header.length, name.c_str());
+#else
+    int status = luaL_loadbufferx(l, data.data() + sizeof(header), header.length, name.c_str(), "b");
+#endif
+
+    if (status != 0)
+    {
+        lua_pop(l, 1);
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Append each piece of a dumped chunk to a string.
+ */
+static int bytecode_writer(lua_State * l, const void *p, size_t sz, void *ud)
+{
+    (void)l;
+
+    std::string *out = (std::string *) ud;
+    out->append((const char *) p, sz);
+    return 0;
+}
+
+
+/*
+ * Cache the chunk upon the top of the stack.
+ */
+void CBytecodeCache::write_cached(lua_State * l, const std::string &cached, struct stat &sb)
+{
+    std::string chunk;
+
+#if LUA_VERSION_NUM >= 503
+    int status = lua_dump(l, bytecode_writer, &chunk, 0);
+#else
+    int status = lua_dump(l, bytecode_writer, &chunk);
+#endif
+
+    if (status != 0 || chunk.empty())
+        return;
+
+    bytecode_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+    header.version     = LUA_VERSION_NUM;
+    header.number_size = (int32_t) sizeof(lua_Number);
+    header.mtime       = (int64_t) sb.st_mtim.tv_sec;
+    header.mtime_nsec  = (int64_t) sb.st_mtim.tv_nsec;
+    header.size        = (int64_t) sb.st_size;
+    header.length      = chunk.size();
+
+    CDirectory::mkdir_p(cached.substr(0, cached.rfind('/')));
+
+    /*
+     * Write to a temporary file, and rename it into place, so that
+     * nobody reads a partial chunk.
+     */
+    std::string tmp = cached + ".tmp." + std::to_string(getpid());
+    std::ofstream out(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (! out.is_open())
+        return;
+
+    out.write((const char *) &header, sizeof(header));
+    out.write(chunk.data(), chunk.size());
+    out.close();
+
+    if (out.fail() || (rename(tmp.c_str(), cached.c_str()) != 0))
+        unlink(tmp.c_str());
+}
@@ -0,0 +1,98 @@
+/*
+ * bytecode_cache.h - Cache the compiled form of our Lua files.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+
+#include "singleton.h"
+
+
+struct lua_State;
+
+
+/**
+ * This singleton loads Lua files via a cache of their compiled chunks,
+ * so that our configuration, and libraries, needn't be parsed and
+ * compiled each time we start.
+ *
+ * Each file is cached beneath the directory named by `lua.bytecode_cache`,
+ * or `cache.prefix`, along with the size and modification time of the
+ * source it was compiled from.  A cached chunk is only used while those
+ * match, and it was compiled by the same version of Lua.
+ *
+ * Setting `lua.bytecode` to zero disables the cache.
+ */
+class CBytecodeCache : public Singleton<CBytecodeCache>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CBytecodeCache();
+
+    /**
+     * Load the given file as luaL_loadfile would, pushing either the
+     * compiled chunk or an error-message, and returning the status.
+     */
+    int load(lua_State * l, std::string path);
+
+    /**
+     * The file in which the chunk of the given source is cached, or
+     * the empty string if caching is disabled.
+     */
+    std::string cache_file(std::string path);
+
+    /**
+     * The number of files loaded from our cache, and compiled.
+     */
+    uint64_t hits()
+    {
+        return (m_hits);
+    };
+    uint64_t misses()
+    {
+        return (m_misses);
+    };
+
+private:
+
+    /**
+     * Load the chunk cached for the given source, if it is current.
+     */
+    bool read_cached(lua_State * l, const std::string &path,
+                     const std::string &cached, struct stat &sb);
+
+    /**
+     * Cache the chunk upon the top of the stack.
+     */
+    void write_cached(lua_State * l, const std::string &cached, struct stat &sb);
+
+private:
+
+    /**
+     * Our statistics.
+     */
+    uint64_t m_hits;
+    uint64_t m_misses;
+};
@@ -0,0 +1,145 @@
+/*
+ * bytecode_cache_test.cc - Test-cases for our bytecode cache.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytecode_cache.h"
+#include "config.h"
+#include "lua.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Write the given source to the given file.
+ */
+static void write_source(std::string path, const char *source)
+{
+    FILE *fp = fopen(path.c_str(), "w");
+
+    if (fp != NULL)
+    {
+        fputs(source, fp);
+        fclose(fp);
+    }
+}
+
+
+/**
+ * Load and run the given file, returning the number it returns.
+ */
+static int run_file(lua_State * l, std::string path)
+{
+    if (CBytecodeCache::instance()->load(l, path) != 0)
+    {
+        lua_pop(l, 1);
+        return -1;
+    }
+
+    lua_call(l, 0, 1);
+    int result = lua_tointeger(l, -1);
+    lua_pop(l, 1);
+    return (result);
+}
+
+
+/**
+ * Test that files are compiled once, and recompiled once changed.
+ */
+void TestBytecodeCache(CuTest * tc)
+{
+    char tmpl[] = "/tmp/bytecode.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string dir = tmpl;
+    std::string source = dir + "/test.lua";
+
+    CConfig *config = CConfig::instance();
+    config->set("lua.bytecode_cache", dir + "/cache", false);
+
+    lua_State *l = luaL_newstate();
+    luaL_openlibs(l);
+
+    CBytecodeCache *cache = CBytecodeCache::instance();
+    uint64_t hits = cache->hits();
+    uint64_t misses = cache->misses();
+
+    write_source(source, "return 40 + 2\n");
+
+    CuAssertIntEquals(tc, 42, run_file(l, source));
+    CuAssertIntEquals(tc, 1, cache->misses() - misses);
+
+    CuAssertIntEquals(tc, 42, run_file(l, source));
+    CuAssertIntEquals(tc, 1, cache->hits() - hits);
+
+    /*
+     * A change of size is noticed, even within the same second.
+     */
+    write_source(source, "return 100 + 100\n");
+    CuAssertIntEquals(tc, 200, run_file(l, source));
+    CuAssertIntEquals(tc, 2, cache->misses() - misses);
+
+    /*
+     * As is a change which leaves the size alone, within the same
+     * second.
+     */
+    struct timespec times[2];
+    times[0].tv_sec  = 1500000000;
+    times[0].tv_nsec = 1000;
+    times[1] = times[0];
+    CuAssertIntEquals(tc, 0, utimensat(AT_FDCWD, source.c_str(), times, 0));
+    CuAssertIntEquals(tc, 200, run_file(l, source));
+    CuAssertIntEquals(tc, 3, cache->misses() - misses);
+
+    write_source(source, "return 100 + 101\n");
+    times[0].tv_nsec = times[1].tv_nsec = 2000;
+    CuAssertIntEquals(tc, 0, utimensat(AT_FDCWD, source.c_str(), times, 0));
+    CuAssertIntEquals(tc, 201, run_file(l, source));
+    CuAssertIntEquals(tc, 4, cache->misses() - misses);
+
+    /*
+     * Syntax errors are reported, and not cached.
+     */
+    write_source(source, "return return\n");
+    CuAssertIntEquals(tc, -1, run_file(l, source));
+
+    std::string cached = cache->cache_file(source);
+    CuAssertTrue(tc, cached.find(dir + "/cache/") == 0);
+
+    lua_close(l);
+    config->delete_key("lua.bytecode_cache");
+
+    unlink(cached.c_str());
+    unlink(source.c_str());
+    rmdir((dir + "/cache").c_str());
+    rmdir(tmpl);
+}
+
+
+CuSuite *
+bytecode_cache_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestBytecodeCache);
+    return suite;
+}
@@ -0,0 +1,166 @@
+/*
+ * bytecode_lua.cc - Load Lua files via our bytecode cache.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <string>
+#include <unistd.h>
+
+#include "bytecode_cache.h"
+#include "lua.h"
+#include "util.h"
+
+
+/**
+ * @file bytecode_lua.cc
+ *
+ * This file replaces `dofile`, and adds a searcher for `require`, so
+ * that the Lua files which make up our configuration are loaded via
+ * the CBytecodeCache.  Neither changes how files are found, or run.
+ *
+ */
+
+
+/**
+ * Find the named module upon `package.path`, as Lua's own searcher does,
+ * returning the empty string if it isn't found.  The files we tried are
+ * appended to `tried`.
+ */
+static std::string search_path(lua_State * l, std::string name, std::string &tried)
+{
+    lua_getglobal(l, "package");
+    lua_getfield(l, -1, "path");
+
+    std::string path = lua_isstring(l, -1) ? lua_tostring(l, -1) : "";
+    lua_pop(l, 2);
+
+    std::replace(name.begin(), name.end(), '.', '/');
+
+    for (std::string pattern : split(path, ';'))
+    {
+        if (pattern.empty())
+            continue;
+
+        std::string file;
+
+        for (char c : pattern)
+        {
+            if (c == '?')
+                file += name;
+            else
+                file += c;
+        }
+
+        if (access(file.c_str(), R_OK) == 0)
+            return (file);
+
+        tried += "\n\tno file '" + file + "'";
+    }
+
+    return "";
+}
+
+
+/**
+ * Our searcher for `require`, which finds modules as Lua's own searcher
+ * for Lua files does, but loads them via our cache.
+ */
+static int l_bytecode_searcher(lua_State * l)
+{
+    std::string name = luaL_checkstring(l, 1);
+    std::string tried;
+    std::string file = search_path(l, name, tried);
+
+    if (file.empty())
+    {
+        lua_pushstring(l, tried.c_str());
+        return 1;
+    }
+
+    if (CBytecodeCache::instance()->load(l, file) != 0)
+    {
+        return luaL_error(l, "error loading module '%s' from file '%s':\n\t%s",
+                          name.c_str(), file.c_str(), lua_tostring(l, -1));
+    }
+
+    lua_pushstring(l, file.c_str());
+    return 2;
+}
+
+
+/**
+ * Our replacement for `dofile`.
+ *
+ * Reading from stdin, when no file is named, is left to the original
+ * which is our upvalue.
+ */
+static int l_bytecode_dofile(lua_State * l)
+{
+    if (lua_isnoneornil(l, 1))
+    {
+        lua_pushvalue(l, lua_upvalueindex(1));
+        lua_insert(l, 1);
+        lua_call(l, lua_gettop(l) - 1, LUA_MULTRET);
+        return (lua_gettop(l));
+    }
+
+    const char *file = luaL_checkstring(l, 1);
+    lua_settop(l, 1);
+
+    if (CBytecodeCache::instance()->load(l, file) != 0)
+        return (lua_error(l));
+
+    lua_call(l, 0, LUA_MULTRET);
+    return (lua_gettop(l) - 1);
+}
+
+
+/**
+ * Install our replacement for `dofile`, and our searcher, which runs
+ * before the searchers Lua provides.
+ */
+void InitBytecode(lua_State * l)
+{
+    lua_getglobal(l, "dofile");
+    lua_pushcclosure(l, l_bytecode_dofile, 1);
+    lua_setglobal(l, "dofile");
+
+    lua_getglobal(l, "package");
+
+#if LUA_VERSION_NUM == 501
+    lua_getfield(l, -1, "loaders");
+    int n = (int) lua_objlen(l, -1);
+#else
+    lua_getfield(l, -1, "searchers");
+    int n = (int) lua_rawlen(l, -1);
+#endif
+
+    if (lua_istable(l, -1))
+    {
+        for (int i = n; i >= 2; i--)
+        {
+            lua_rawgeti(l, -1, i);
+            lua_rawseti(l, -2, i + 1);
+        }
+
+        lua_pushcfunction(l, l_bytecode_searcher);
+        lua_rawseti(l, -2, 2);
+    }
+
+    lua_pop(l, 2);
+}
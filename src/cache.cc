@@ -18,171 +18,1425 @@
 
 
 #include <algorithm>
-#include <fstream>
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mutex>
+#include <unistd.h>
+#include <unordered_set>
 
 #include "cache.h"
 
 
+/*
+ * Every cache which exists, so that their totals may be reported.
+ */
+static std::unordered_set<CCache *> g_caches;
+static std::mutex g_caches_lock;
+
+
+/*
+ * Keys are stored without any whitespace, since that would have confused
+ * the text format we used to save to.  Return the given key in that form, copying it into
+ * `buf` only if it needs to change.
+ */
+static const std::string &normalize(const std::string &key, std::string &buf)
+{
+    if (std::none_of(key.begin(), key.end(), ::isspace))
+        return key;
+
+    buf = key;
+    buf.erase(std::remove_if(buf.begin(), buf.end(), ::isspace), buf.end());
+    return buf;
+}
+
+
 /*
  * Constructor.
  */
-CCache::CCache()
+CCache::CCache() : m_hashes(CACHE_INITIAL_SLOTS), m_slots(CACHE_INITIAL_SLOTS)
+{
+    m_count        = 0;
+    m_bytes        = 0;
+    m_max_bytes    = 0;
+    m_head         = CACHE_NIL;
+    m_tail         = CACHE_NIL;
+    m_map          = NULL;
+    m_map_size     = 0;
+    m_records      = NULL;
+    m_index        = NULL;
+    m_strings      = NULL;
+    m_strings_size = 0;
+    m_index_slots  = 0;
+    m_mapped       = 0;
+
+    m_default_ttl     = CACHE_DEFAULT_TTL;
+
+    m_journal_fd      = -1;
+    m_journal_size    = 0;
+    m_journal_flushed = 0;
+    m_snapshot_size   = 0;
+    m_compacting      = false;
+
+    reset_stats();
+
+    std::lock_guard<std::mutex> guard(g_caches_lock);
+    g_caches.insert(this);
+}
+
+/*
+ * Destructor
+ */
+CCache::~CCache()
+{
+    close_journal();
+    unmap();
+
+    std::lock_guard<std::mutex> guard(g_caches_lock);
+    g_caches.erase(this);
+}
+
+
+/*
+ * Empty the cache, removing all keys/values
+ */
+void CCache::empty()
+{
+    close_journal();
+    unmap();
+
+    /*
+     * Swap in a new table, so that the memory is really released.
+     */
+    std::vector < uint64_t > (CACHE_INITIAL_SLOTS).swap(m_hashes);
+    std::vector < cache_slot > (CACHE_INITIAL_SLOTS).swap(m_slots);
+
+    m_count = 0;
+    m_bytes = 0;
+    m_head  = CACHE_NIL;
+    m_tail  = CACHE_NIL;
+}
+
+
+/*
+ * Remove all of our entries, keeping the table they were held in.
+ */
+void CCache::clear()
+{
+    for (size_t i = m_head; i != CACHE_NIL; i = m_slots[i].next)
+    {
+        m_hashes[i] = 0;
+        std::string().swap(m_slots[i].key);
+        std::string().swap(m_slots[i].value);
+    }
+
+    m_count = 0;
+    m_bytes = 0;
+    m_head  = CACHE_NIL;
+    m_tail  = CACHE_NIL;
+}
+
+
+/*
+ * Hash the given key - the result is never zero, as that marks an empty
+ * slot.
+ *
+ * Hashes are saved to disk, so we use FNV-1a rather than `std::hash`,
+ * which may differ between builds.
+ */
+uint64_t CCache::hash(const std::string &key)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (unsigned char c : key)
+    {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+
+    return (h ? h : 1);
+}
+
+
+/*
+ * The approximate cost, in bytes, of storing the given slot.
+ */
+size_t CCache::cost(const cache_slot &slot)
+{
+    return (sizeof(cache_slot) + slot.key.size() + slot.value.size());
+}
+
+
+/*
+ * Find the slot holding the given key, or the empty slot at which it
+ * should be inserted.
+ *
+ * Our load-factor is kept below 3/4, so there is always an empty slot.
+ */
+size_t CCache::probe(const std::string &key, uint64_t h)
+{
+    size_t mask = m_slots.size() - 1;
+    size_t i    = h & mask;
+
+    while (m_hashes[i] != 0)
+    {
+        if ((m_hashes[i] == h) && (m_slots[i].key == key))
+            break;
+
+        i = (i + 1) & mask;
+    }
+
+    return (i);
+}
+
+
+/*
+ * Get the value of a cache-key.
+ */
+std::string CCache::get(const std::string &key)
+{
+    const std::string *value = find(key);
+
+    if (value != NULL)
+        return (*value);
+    else
+        return "";
+}
+
+
+/*
+ * Find the value of a cache-key, returning NULL if it isn't set.
+ */
+const std::string *CCache::find(const std::string &key)
+{
+    size_t slot = lookup(key);
+
+    if (slot == CACHE_NIL)
+        return NULL;
+
+    return (&m_slots[slot].value);
+}
+
+
+/*
+ * Find the numeric value of a cache-key.
+ */
+bool CCache::get_number(const std::string &key, double &value, bool *integer)
+{
+    size_t slot = lookup(key);
+
+    if (slot == CACHE_NIL)
+        return false;
+
+    cache_slot &entry = m_slots[slot];
+
+    /*
+     * A string which holds a number, perhaps because it was set before
+     * we supported numbers, becomes one - so we only convert it once.
+     */
+    if (entry.type == CACHE_STRING)
+    {
+        entry.type = parse_number(entry.value, entry.number);
+
+        if (entry.type == CACHE_STRING)
+            return false;
+    }
+
+    value = entry.number;
+
+    if (integer != NULL)
+        *integer = (entry.type == CACHE_INTEGER);
+
+    return true;
+}
+
+
+/*
+ * Find the slot holding the given key, copying it from our mapped file
+ * if necessary, and marking it as the most recently used.
+ */
+size_t CCache::lookup(const std::string &key)
+{
+    std::string buf;
+    const std::string &k = normalize(key, buf);
+
+    uint64_t h  = hash(k);
+    size_t slot = probe(k, h);
+    time_t now  = time(NULL);
+
+    if ((m_hashes[slot] == 0) && (m_map != NULL))
+    {
+        /*
+         * Copy the entry from our mapped file, if it is present there and
+         * hasn't expired.
+         */
+        size_t index = probe_mapped(k, h);
+
+        if (index != CACHE_NIL)
+        {
+            const cache_file_record &r = m_records[m_index[index] - 1];
+
+            if ((r.expires == 0) || (r.expires > now))
+            {
+                insert(k, std::string(m_strings + r.value, r.value_len), r.expires, (cacheType) r.type);
+                slot = probe(k, h);
+            }
+            else
+            {
+                m_index[index] = CACHE_FILE_REMOVED;
+                m_mapped--;
+            }
+        }
+    }
+
+    if ((m_hashes[slot] != 0) && (m_slots[slot].expires != 0) && (m_slots[slot].expires <= now))
+    {
+        erase(slot);
+        slot = probe(k, h);
+    }
+
+    if (m_hashes[slot] == 0)
+    {
+        m_misses++;
+        return CACHE_NIL;
+    }
+
+    m_hits++;
+
+    if (slot != m_head)
+    {
+        unlink(slot);
+        push_front(slot);
+    }
+
+    return (slot);
+}
+
+
+/*
+ * Store a value in the cache.
+ */
+void CCache::set(const std::string &key, const std::string &value, int ttl)
+{
+    store(key, value, ttl, CACHE_STRING);
+}
+
+
+/*
+ * Store an integer in the cache.
+ */
+void CCache::set_integer(const std::string &key, int64_t value, int ttl)
+{
+    store(key, std::to_string(value), ttl, CACHE_INTEGER);
+}
+
+
+/*
+ * Store a number in the cache.
+ */
+void CCache::set_number(const std::string &key, double value, int ttl)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", value);
+    store(key, buf, ttl, CACHE_NUMBER);
+}
+
+
+/*
+ * Store a value of the given type, journalling it if we should.
+ */
+void CCache::store(const std::string &key, const std::string &value, int ttl, cacheType type)
+{
+    std::string buf;
+    const std::string &k = normalize(key, buf);
+    time_t expires = expiry(k, ttl);
+
+    insert(k, value, expires, type);
+
+    if (m_journal_fd >= 0)
+        append_journal(k, value, expires, type);
+}
+
+
+/*
+ * Set the default lifetime of our entries.
+ */
+void CCache::set_ttl(int ttl)
+{
+    m_default_ttl = ttl;
+}
+
+
+/*
+ * Set the lifetime of entries whose keys begin with the given prefix.
+ */
+void CCache::set_ttl(const std::string &prefix, int ttl)
+{
+    for (auto &rule : m_ttls)
+    {
+        if (rule.first == prefix)
+        {
+            rule.second = ttl;
+            return;
+        }
+    }
+
+    m_ttls.push_back(std::make_pair(prefix, ttl));
+}
+
+
+/*
+ * The time at which an entry with the given key, and lifetime, expires.
+ */
+time_t CCache::expiry(const std::string &key, int ttl)
+{
+    /*
+     * Use the lifetime of the longest prefix which matches, if any, or
+     * our default.
+     */
+    if (ttl == CACHE_TTL_DEFAULT)
+    {
+        size_t longest = 0;
+        ttl = m_default_ttl;
+
+        for (const auto &rule : m_ttls)
+        {
+            if ((rule.first.size() >= longest) && (key.compare(0, rule.first.size(), rule.first) == 0))
+            {
+                longest = rule.first.size();
+                ttl     = rule.second;
+            }
+        }
+    }
+
+    if (ttl <= 0)
+        return 0;
+
+    return (time(NULL) + ttl);
+}
+
+
+/*
+ * Parse the given string as a number, returning its type.
+ */
+cacheType CCache::parse_number(const std::string &value, double &number)
+{
+    if (value.empty())
+        return CACHE_STRING;
+
+    char *end = NULL;
+    number = strtod(value.c_str(), &end);
+
+    if (end != value.c_str() + value.size())
+        return CACHE_STRING;
+
+    if ((fabs(number) < 9e18) && (number == floor(number)) &&
+            (value.find_first_of(".eEnN") == std::string::npos))
+        return CACHE_INTEGER;
+
+    return CACHE_NUMBER;
+}
+
+
+/*
+ * Store an entry, with the given expiry-time and type.
+ */
+void CCache::insert(const std::string &key, const std::string &value, time_t expires, cacheType type)
+{
+    uint64_t h = hash(key);
+    size_t slot = probe(key, h);
+
+    if (m_hashes[slot] == 0)
+    {
+        /*
+         * Grow before we'd pass our load-factor, and find the new home
+         * of this key.
+         */
+        if ((m_count + 1) * 4 > m_slots.size() * 3)
+        {
+            grow();
+            slot = probe(key, h);
+        }
+
+        m_hashes[slot]    = h;
+        m_slots[slot].key = key;
+        m_count++;
+
+        /*
+         * Any copy of this key in our mapped file is now stale.
+         */
+        if (m_map != NULL)
+        {
+            size_t index = probe_mapped(key, h);
+
+            if (index != CACHE_NIL)
+            {
+                m_index[index] = CACHE_FILE_REMOVED;
+                m_mapped--;
+            }
+        }
+    }
+    else
+    {
+        m_bytes -= cost(m_slots[slot]);
+        unlink(slot);
+    }
+
+    push_front(slot);
+
+    cache_slot &entry = m_slots[slot];
+    entry.value   = value;
+    entry.expires = expires;
+    entry.type    = CACHE_STRING;
+    entry.number  = 0;
+
+    if (type != CACHE_STRING)
+        entry.type = parse_number(value, entry.number);
+
+    m_bytes += cost(entry);
+
+    if (m_max_bytes > 0)
+        evict();
+}
+
+
+/*
+ * Remove the given slot from our list of recently used entries.
+ */
+void CCache::unlink(size_t slot)
+{
+    cache_slot &entry = m_slots[slot];
+
+    if (entry.prev != CACHE_NIL)
+        m_slots[entry.prev].next = entry.next;
+    else
+        m_head = entry.next;
+
+    if (entry.next != CACHE_NIL)
+        m_slots[entry.next].prev = entry.prev;
+    else
+        m_tail = entry.prev;
+}
+
+
+/*
+ * Add the given slot to the front of our list of recently used entries.
+ */
+void CCache::push_front(size_t slot)
+{
+    m_slots[slot].prev = CACHE_NIL;
+    m_slots[slot].next = m_head;
+
+    if (m_head != CACHE_NIL)
+        m_slots[m_head].prev = slot;
+    else
+        m_tail = slot;
+
+    m_head = slot;
+}
+
+
+/*
+ * Remove the entry in the given slot.
+ *
+ * Rather than leaving a tombstone we move back any following entries
+ * which would otherwise be unreachable from their home slot.
+ */
+void CCache::erase(size_t slot)
+{
+    size_t mask = m_slots.size() - 1;
+
+    m_bytes -= cost(m_slots[slot]);
+    m_count--;
+
+    unlink(slot);
+
+    size_t i = slot;
+    size_t j = slot;
+
+    while (true)
+    {
+        j = (j + 1) & mask;
+
+        if (m_hashes[j] == 0)
+            break;
+
+        size_t home = m_hashes[j] & mask;
+
+        /*
+         * If the home of this entry lies cyclically within (i, j] then
+         * it can still be found, and stays where it is.
+         */
+        if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j)))
+            continue;
+
+        /*
+         * Move the entry, and point its neighbours at its new home.
+         */
+        m_hashes[i] = m_hashes[j];
+        m_slots[i]  = std::move(m_slots[j]);
+
+        if (m_slots[i].prev != CACHE_NIL)
+            m_slots[m_slots[i].prev].next = i;
+        else
+            m_head = i;
+
+        if (m_slots[i].next != CACHE_NIL)
+            m_slots[m_slots[i].next].prev = i;
+        else
+            m_tail = i;
+
+        i = j;
+    }
+
+    m_hashes[i] = 0;
+    std::string().swap(m_slots[i].key);
+    std::string().swap(m_slots[i].value);
+}
+
+
+/*
+ * Double the size of our table.
+ */
+void CCache::grow()
+{
+    rehash(m_slots.size() * 2);
+}
+
+
+/*
+ * Grow our table until it can hold the given number of entries.
+ */
+void CCache::reserve(size_t count)
+{
+    size_t size = m_slots.size();
+
+    while (count * 4 > size * 3)
+        size *= 2;
+
+    if (size != m_slots.size())
+        rehash(size);
+}
+
+
+/*
+ * Move our entries into a table of the given size.
+ *
+ * Entries are moved in the order of their old slots, then our list of
+ * recently used entries is rebuilt from where each of them ended up.
+ */
+void CCache::rehash(size_t size)
+{
+    std::vector < uint64_t > old_hashes(size);
+    std::vector < cache_slot > old(size);
+    old_hashes.swap(m_hashes);
+    old.swap(m_slots);
+
+    size_t mask = size - 1;
+    std::vector < size_t > moved(old.size(), CACHE_NIL);
+
+    for (size_t from = 0; from < old.size(); from++)
+    {
+        if (old_hashes[from] == 0)
+            continue;
+
+        size_t i = old_hashes[from] & mask;
+
+        while (m_hashes[i] != 0)
+            i = (i + 1) & mask;
+
+        m_hashes[i] = old_hashes[from];
+        m_slots[i]  = std::move(old[from]);
+        moved[from] = i;
+    }
+
+    for (size_t i : moved)
+    {
+        if (i == CACHE_NIL)
+            continue;
+
+        cache_slot &entry = m_slots[i];
+
+        if (entry.prev != CACHE_NIL)
+            entry.prev = moved[entry.prev];
+
+        if (entry.next != CACHE_NIL)
+            entry.next = moved[entry.next];
+    }
+
+    if (m_head != CACHE_NIL)
+    {
+        m_head = moved[m_head];
+        m_tail = moved[m_tail];
+    }
+}
+
+
+/*
+ * Evict entries until we're within our size-limit.
+ *
+ * We always keep the most recent entry, even if it alone is larger than
+ * the limit.
+ */
+void CCache::evict()
+{
+    while ((m_bytes > m_max_bytes) && (m_count > 1))
+    {
+        erase(m_tail);
+        m_evictions++;
+    }
+}
+
+
+/*
+ * Limit the cache to approximately the given number of bytes.
+ */
+void CCache::set_max_bytes(size_t max)
+{
+    m_max_bytes = max;
+
+    if (m_max_bytes > 0)
+        evict();
+}
+
+
+/*
+ * Get statistics about our use.
+ */
+cache_stats CCache::stats()
+{
+    cache_stats result;
+    result.hits      = m_hits;
+    result.misses    = m_misses;
+    result.evictions = m_evictions;
+    result.entries   = m_count;
+    result.mapped    = m_mapped;
+    result.journal   = m_journal_size + m_journal_buf.size();
+    result.bytes     = m_bytes;
+    result.max_bytes = m_max_bytes;
+    return (result);
+}
+
+
+/*
+ * Get the totals of every cache.
+ */
+void CCache::totals(size_t &caches, size_t &entries, size_t &bytes)
+{
+    std::lock_guard<std::mutex> guard(g_caches_lock);
+
+    caches  = g_caches.size();
+    entries = 0;
+    bytes   = 0;
+
+    for (CCache *cache : g_caches)
+    {
+        entries += cache->m_count;
+        bytes   += cache->m_bytes;
+    }
+}
+
+
+/*
+ * Reset our hit, miss, and eviction counters.
+ */
+void CCache::reset_stats()
+{
+    m_hits      = 0;
+    m_misses    = 0;
+    m_evictions = 0;
+}
+
+
+/*
+ * Find the slot of our mapped index which refers to the given key.
+ */
+size_t CCache::probe_mapped(const std::string &key, uint64_t h)
 {
+    size_t mask = m_index_slots - 1;
+    size_t i    = h & mask;
+
+    /*
+     * The index always has an empty slot, but a corrupt file might not,
+     * so we give up after looking at every slot.
+     */
+    for (size_t n = 0; (n < m_index_slots) && (m_index[i] != 0); n++)
+    {
+        if (m_index[i] != CACHE_FILE_REMOVED)
+        {
+            const cache_file_record &r = m_records[m_index[i] - 1];
+
+            if ((r.hash == h) && (r.key_len == key.size()) &&
+                    (memcmp(m_strings + r.key, key.data(), r.key_len) == 0))
+                return (i);
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    return (CACHE_NIL);
 }
 
+
 /*
- * Destructor
+ * Is the given mapped record valid?
  */
-CCache::~CCache()
+bool CCache::valid_record(const cache_file_record &r)
 {
-    empty();
+    return ((r.key_len > 0) &&
+            ((uint64_t) r.key + r.key_len <= m_strings_size) &&
+            ((uint64_t) r.value + r.value_len <= m_strings_size));
 }
 
 
 /*
- * Empty the cache, removing all keys/values
+ * Map the given file, if it is a valid cache.
  */
-void CCache::empty()
+bool CCache::map_file(int fd, size_t size)
 {
-    for (auto it = m_cache.begin(); it != m_cache.end(); ++it)
+    /*
+     * The index is updated as entries are copied from it, so we map the
+     * file writeable - but privately, so the file itself isn't changed.
+     */
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    m_map      = map;
+    m_map_size = size;
+
+    /*
+     * Validate the header, and the size of the file.
+     */
+    const cache_file_header *header = (const cache_file_header *)m_map;
+
+    if ((header->version != CACHE_FILE_VERSION) ||
+            (header->slots == 0) ||
+            ((header->slots & (header->slots - 1)) != 0) ||
+            (header->slots <= header->count) ||
+            (m_map_size != sizeof(cache_file_header) +
+             (uint64_t) header->count * sizeof(cache_file_record) +
+             (uint64_t) header->slots * sizeof(uint32_t) +
+             header->strings))
+    {
+        unmap();
+        return false;
+    }
+
+    m_records      = (const cache_file_record *)(header + 1);
+    m_index        = (uint32_t *)(m_records + header->count);
+    m_strings      = (const char *)(m_index + header->slots);
+    m_strings_size = header->strings;
+    m_index_slots  = header->slots;
+
+    /*
+     * Drop any index-entries which refer to invalid records, so we need
+     * not check them again.
+     */
+    for (uint32_t i = 0; i < m_index_slots; i++)
     {
-        CacheEntry *val = it->second;
+        if ((m_index[i] == 0) || (m_index[i] == CACHE_FILE_REMOVED))
+            continue;
 
-        if (val != NULL)
-            delete(val);
+        if ((m_index[i] > header->count) || ! valid_record(m_records[m_index[i] - 1]))
+            m_index[i] = CACHE_FILE_REMOVED;
+        else
+            m_mapped++;
     }
 
-    m_cache.clear();
+    return true;
 }
 
 
 /*
- * Get the value of a cache-key.
+ * Unmap any file we've loaded.
  */
-std::string CCache::get(std::string key)
+void CCache::unmap()
 {
-    //
-    // Remove spaces from key-names to avoid issues when
-    // saving/loading.
-    //
-    key.erase(std::remove_if(key.begin(), key.end(), ::isspace), key.end());
+    if (m_map != NULL)
+        munmap(m_map, m_map_size);
 
-    CacheEntry *e = m_cache[key];
-
-    if (e != NULL)
-        return (e->value);
-    else
-        return "";
+    m_map          = NULL;
+    m_map_size     = 0;
+    m_records      = NULL;
+    m_index        = NULL;
+    m_strings      = NULL;
+    m_strings_size = 0;
+    m_index_slots  = 0;
+    m_mapped       = 0;
 }
 
 
 /*
- * Store a value in the cache.
+ * Load the cache from disk.
+ *
+ * Files in our binary format are mapped, others are assumed to be in our
+ * older text format and are read immediately.
  */
-void CCache::set(std::string key, std::string value)
+void CCache::load(std::string path)
 {
-    CacheEntry *e = m_cache[key];
+    /*
+     * Remove any existing members, keeping our table.
+     */
+    close_journal();
+    unmap();
+    clear();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return;
+
+    struct stat sb;
+
+    if (fstat(fd, &sb) != 0)
+    {
+        ::close(fd);
+        return;
+    }
 
-    if (e != NULL)
-        delete(e);
+    char magic[4];
 
-    //
-    // Remove spaces from key-names to avoid issues when
-    // saving/loading.
-    //
-    key.erase(std::remove_if(key.begin(), key.end(), ::isspace), key.end());
+    if ((sb.st_size >= (off_t)sizeof(cache_file_header)) &&
+            (pread(fd, magic, sizeof(magic), 0) == sizeof(magic)) &&
+            (memcmp(magic, "LMCA", 4) == 0))
+    {
+        map_file(fd, sb.st_size);
+        ::close(fd);
+        return;
+    }
+
+    std::string data(sb.st_size, '\0');
+    size_t done = 0;
+
+    while (done < data.size())
+    {
+        ssize_t n = read(fd, &data[done], data.size() - done);
+
+        if (n <= 0)
+            break;
+
+        done += n;
+    }
 
-    e = new CacheEntry();
-    e->value   = value;
-    e->created = time(NULL);
-    m_cache[ key ] = e;
+    ::close(fd);
+
+    data.resize(done);
+    load_text(data);
 }
 
 
 /*
- * Load the map from disk.
+ * Load the given contents of a cache saved in our older text format.
+ *
+ * Each line holds the creation-time of an entry, its key, and its value,
+ * separated by single spaces.
  */
-void CCache::load(std::string path)
+void CCache::load_text(const std::string &data)
 {
     /*
-     * Empty any existing members.
-     */
-    empty();
-
-    /*
-     * Open the file.
+     * Size our table for the number of lines up front, rather than
+     * growing it repeatedly.
      */
-    std::fstream fs;
-    fs.open(path,  std::fstream::in);
+    reserve(std::count(data.begin(), data.end(), '\n'));
 
     /*
      * Process each line.
      */
-    for (std::string line; getline(fs, line);)
+    size_t start = 0;
+    time_t now   = time(NULL);
+
+    while (start < data.size())
     {
-        size_t ctime = line.find(" ");
+        size_t end = data.find('\n', start);
+
+        if (end == std::string::npos)
+            end = data.size();
 
-        if (ctime != std::string::npos)
+        size_t ctime = data.find(' ', start);
+
+        if (ctime < end)
         {
-            size_t kname = line.find(" ", ctime + 1);
+            size_t kname = data.find(' ', ctime + 1);
 
-            if (kname != std::string::npos)
+            if ((kname < end) && (kname > ctime + 1))
             {
-                std::string c_time  = line.substr(0, ctime);
-                std::string k_name  = line.substr(ctime + 1, kname - ctime - 1);
-                std::string k_value = line.substr(kname + 1);
+                char *last = NULL;
+                time_t expires = strtol(data.c_str() + start, &last, 10);
 
-                CacheEntry *e = new CacheEntry();
+                /*
+                 * The text format recorded when entries were created, so
+                 * expire them after our default lifetime.
+                 */
+                if (m_default_ttl > 0)
+                    expires += m_default_ttl;
+                else
+                    expires = 0;
 
-                try
-                {
-                    e->value   = k_value;
-                    e->created = std::stoi(c_time);
-                    m_cache[ k_name ] = e;
-                }
-                catch (std::invalid_argument& exception)
+                if ((last == data.c_str() + ctime) && ((expires == 0) || (expires > now)))
                 {
-                    delete(e);
+                    insert(data.substr(ctime + 1, kname - ctime - 1),
+                           data.substr(kname + 1, end - kname - 1), expires, CACHE_STRING);
                 }
             }
         }
+
+        start = end + 1;
     }
+}
+
+
+/*
+ * Save the cache to disk.
+ */
+bool CCache::save(std::string path)
+{
+    cache_image image;
 
-    fs.close();
+    if (! serialize(image))
+        return false;
+
+    return (write_image(image, path, path + ".tmp", false));
 }
 
 
 /*
- * Save the map to disk.
+ * Build an image of the file we'd save.
  *
- * NOTE: We drop entries that are more than five days old.
+ * NOTE: We drop entries which have expired.
  */
-void CCache::save(std::string path)
+bool CCache::serialize(cache_image &image)
 {
-    std::fstream fs;
-    fs.open(path,  std::fstream::out);
+    time_t now = time(NULL);
+
+    std::vector < cache_file_record > &records = image.records;
+    std::string &strings = image.strings;
 
     /*
-     * Get the current time, and work out five days ago.
+     * Add a record for the given entry, if it is to be kept.
      */
-    time_t now = time(NULL);
-    now -= (60 * 60 * 24 * 5);
+    auto add = [&](uint64_t h, time_t expires, uint32_t type, const char *key, size_t key_len, const char *value, size_t value_len)
+    {
+        if ((key_len == 0) || ((expires != 0) && (expires <= now)))
+            return;
+
+        cache_file_record r;
+        r.hash      = h;
+        r.expires   = expires;
+        r.type      = type;
+        r.reserved  = 0;
+        r.key       = strings.size();
+        r.key_len   = key_len;
+        strings.append(key, key_len);
+        r.value     = strings.size();
+        r.value_len = value_len;
+        strings.append(value, value_len);
+
+        records.push_back(r);
+    };
+
+    /*
+     * The entries of our mapped file which haven't been used come first,
+     * then those of our table from the least to the most recently used.
+     */
+    for (uint32_t i = 0; i < m_index_slots; i++)
+    {
+        if ((m_index[i] == 0) || (m_index[i] == CACHE_FILE_REMOVED))
+            continue;
+
+        const cache_file_record &r = m_records[m_index[i] - 1];
+        add(r.hash, r.expires, r.type, m_strings + r.key, r.key_len, m_strings + r.value, r.value_len);
+    }
+
+    for (size_t i = m_tail; i != CACHE_NIL; i = m_slots[i].prev)
+    {
+        const cache_slot &entry = m_slots[i];
+        add(m_hashes[i], entry.expires, entry.type, entry.key.data(), entry.key.size(), entry.value.data(), entry.value.size());
+    }
+
+    /*
+     * Our string-table is addressed by 32-bit offsets.
+     */
+    if (strings.size() > UINT32_MAX)
+        return false;
+
+    /*
+     * Build the index, which is kept below a load-factor of 3/4.
+     */
+    uint32_t slots = 16;
+
+    while (records.size() * 4 >= (uint64_t) slots * 3)
+        slots *= 2;
+
+    image.index.assign(slots, 0);
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        size_t j = records[i].hash & (slots - 1);
+
+        while (image.index[j] != 0)
+            j = (j + 1) & (slots - 1);
+
+        image.index[j] = i + 1;
+    }
+
+    cache_file_header &header = image.header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "LMCA", 4);
+    header.version = CACHE_FILE_VERSION;
+    header.count   = records.size();
+    header.slots   = slots;
+    header.strings = strings.size();
+
+    return true;
+}
+
+
+/*
+ * The size of the file the given image would be saved as.
+ */
+size_t CCache::image_size(const cache_image &image)
+{
+    return (sizeof(cache_file_header) +
+            image.records.size() * sizeof(cache_file_record) +
+            image.index.size() * sizeof(uint32_t) +
+            image.strings.size());
+}
+
+
+/*
+ * Write the given image to a temporary file, and rename it into place.
+ *
+ * That keeps any mapping of the old file valid, and readers never see
+ * a partial cache.
+ */
+bool CCache::write_image(const cache_image &image, std::string path, std::string tmp, bool sync)
+{
+    FILE *fp = fopen(tmp.c_str(), "wb");
+
+    if (fp == NULL)
+        return false;
+
+    bool ok = (fwrite(&image.header, sizeof(image.header), 1, fp) == 1);
+
+    if (ok && ! image.records.empty())
+        ok = (fwrite(&image.records[0], sizeof(cache_file_record), image.records.size(), fp) == image.records.size());
+
+    ok = ok && (fwrite(&image.index[0], sizeof(uint32_t), image.index.size(), fp) == image.index.size());
+    ok = ok && (fwrite(image.strings.data(), 1, image.strings.size(), fp) == image.strings.size());
+    ok = ok && (fflush(fp) == 0);
+
+    if (ok && sync)
+        ok = (fsync(fileno(fp)) == 0);
+
+    ok = (fclose(fp) == 0) && ok;
+
+    if (! ok || (rename(tmp.c_str(), path.c_str()) != 0))
+    {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Load the cache from the given file, and its journal, then append any
+ * further changes to that journal.
+ */
+bool CCache::open_journal(std::string path)
+{
+    load(path);
+
+    /*
+     * Replay the journal of any compaction which was interrupted, then
+     * the current journal.
+     */
+    std::string journal    = path + ".journal";
+    std::string compacting = path + ".journal.compacting";
+
+    bool interrupted = (access(compacting.c_str(), F_OK) == 0);
+
+    if (interrupted)
+        replay_journal(compacting);
+
+    off_t valid = replay_journal(journal);
+
+    int fd = ::open(journal.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+
+    if (fd < 0)
+        return false;
+
+    /*
+     * Discard anything following the last complete record, which a
+     * crash might have left behind, and write a header to a new file.
+     */
+    bool ok = (ftruncate(fd, valid) == 0) && (lseek(fd, 0, SEEK_END) == valid);
+
+    if (ok && (valid == 0))
+        ok = (::write(fd, CACHE_JOURNAL_MAGIC, 4) == 4);
+
+    if (! ok)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    m_journal_fd   = fd;
+    m_journal_path = path;
+    m_journal_size = (valid == 0) ? 4 : valid;
+
+    struct stat sb;
+    m_snapshot_size = (stat(path.c_str(), &sb) == 0) ? sb.st_size : 0;
 
     /*
-     * Iterate over our cache-map.
+     * If we were interrupted then the file we just loaded might not hold
+     * the entries of the journal we replayed.  Write a new one, so that
+     * we can remove that journal, before we carry on.
      */
-    for (auto it = m_cache.begin(); it != m_cache.end(); ++it)
+    if (interrupted)
+    {
+        cache_image image;
+
+        if (serialize(image) && write_image(image, path, path + ".tmp", true))
+        {
+            ::unlink(compacting.c_str());
+            m_snapshot_size = image_size(image);
+        }
+    }
+
+    return true;
+}
+
+
+/*
+ * Replay the given journal, returning the length of its valid prefix.
+ */
+off_t CCache::replay_journal(std::string path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return 0;
+
+    std::string data;
+    char buf[65536];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        data.append(buf, n);
+
+    ::close(fd);
+
+    if ((data.size() < 4) || (memcmp(data.data(), CACHE_JOURNAL_MAGIC, 4) != 0))
+        return 0;
+
+    size_t offset = 4;
+
+    while (offset + sizeof(cache_journal_record) <= data.size())
+    {
+        cache_journal_record r;
+        memcpy(&r, data.data() + offset, sizeof(r));
+
+        size_t end = offset + sizeof(r) + r.key_len + r.value_len;
+
+        if ((r.key_len == 0) || (end > data.size()) || (end < offset))
+            break;
+
+        std::string key(data, offset + sizeof(r), r.key_len);
+        std::string value(data, offset + sizeof(r) + r.key_len, r.value_len);
+
+        if (r.check != journal_check(key, value))
+            break;
+
+        insert(key, value, r.expires, (cacheType) r.type);
+        offset = end;
+    }
+
+    return (offset);
+}
+
+
+/*
+ * The check-value of a journal record.
+ */
+uint32_t CCache::journal_check(const std::string &key, const std::string &value)
+{
+    uint64_t h = hash(key) ^ (hash(value) * 31);
+    return ((uint32_t)(h ^ (h >> 32)));
+}
+
+
+/*
+ * Write all of the given data to the given file.
+ */
+static bool write_all(int fd, const std::string &data)
+{
+    size_t done = 0;
+
+    while (done < data.size())
     {
-        std::string key = it->first;
-        CacheEntry *val = it->second;
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+
+        if ((n < 0) && (errno == EINTR))
+            continue;
 
+        if (n <= 0)
+            return false;
+
+        done += n;
+    }
+
+    return true;
+}
+
+
+/*
+ * Append a record of the given entry to our journal.
+ */
+void CCache::append_journal(const std::string &key, const std::string &value, time_t expires, cacheType type)
+{
+    cache_journal_record r;
+    memset(&r, 0, sizeof(r));
+    r.expires   = expires;
+    r.type      = type;
+    r.key_len   = key.size();
+    r.value_len = value.size();
+    r.check     = journal_check(key, value);
+
+    m_journal_buf.append((const char *)&r, sizeof(r));
+    m_journal_buf += key;
+    m_journal_buf += value;
+
+    /*
+     * Write the buffer once it is full, or once a second, so that little
+     * is lost if we crash.
+     */
+    time_t now = time(NULL);
+
+    if ((m_journal_buf.size() >= CACHE_JOURNAL_BUFFER) || (now != m_journal_flushed))
+        flush();
+}
+
+
+/*
+ * Write any buffered journal records.
+ */
+bool CCache::flush()
+{
+    if (m_journal_fd < 0)
+        return false;
+
+    m_journal_flushed = time(NULL);
+
+    if (! write_all(m_journal_fd, m_journal_buf))
+    {
         /*
-         * If the key and value are non-empty AND the cache-key was
-         * set then the past week then persist it.
+         * Stop journalling, rather than writing records after a partial
+         * one, where they'd be ignored.
          */
-        if (!key.empty() && (val != NULL) && (val->created > now))
-            fs << val->created << " " << key << " " << val->value << std::endl;
+        m_journal_buf.clear();
+        close_journal();
+        return false;
+    }
+
+    m_journal_size += m_journal_buf.size();
+    m_journal_buf.clear();
+
+    /*
+     * Compact the journal once it is larger than the file it applies to.
+     */
+    if ((m_journal_size > CACHE_JOURNAL_MIN) && (m_journal_size > m_snapshot_size))
+        compact();
+
+    return true;
+}
+
+
+/*
+ * Write a new copy of our file, in the background, and start a new
+ * journal.
+ */
+void CCache::compact()
+{
+    if (m_compacting)
+        return;
+
+    if (m_compactor.joinable())
+        m_compactor.join();
+
+    /*
+     * The image is built here, as it needs our entries, but it is written
+     * by another thread.
+     */
+    std::shared_ptr<cache_image> image(new cache_image());
+
+    if (! serialize(*image))
+        return;
+
+    /*
+     * Move the journal aside, it is only removed once the new file is
+     * in place, and start a new one.
+     */
+    std::string journal    = m_journal_path + ".journal";
+    std::string compacting = m_journal_path + ".journal.compacting";
+
+    int fd = -1;
+
+    if (rename(journal.c_str(), compacting.c_str()) == 0)
+        fd = ::open(journal.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+    if ((fd < 0) || (::write(fd, CACHE_JOURNAL_MAGIC, 4) != 4))
+    {
+        if (fd >= 0)
+            ::close(fd);
+
+        close_journal();
+        return;
+    }
+
+    ::close(m_journal_fd);
+    m_journal_fd   = fd;
+    m_journal_size = 4;
+
+    m_snapshot_size = image_size(*image);
+    m_compacting    = true;
+
+    std::string path = m_journal_path;
+
+    m_compactor = std::thread([this, image, path, compacting]()
+    {
+        if (write_image(*image, path, path + ".compact.tmp", true))
+            ::unlink(compacting.c_str());
+
+        m_compacting = false;
+    });
+}
+
+
+/*
+ * Flush, and stop appending to, our journal.
+ */
+void CCache::close_journal()
+{
+    if (m_journal_fd >= 0)
+    {
+        write_all(m_journal_fd, m_journal_buf);
+        ::close(m_journal_fd);
+        m_journal_fd = -1;
     }
 
-    fs.close();
+    if (m_compactor.joinable())
+        m_compactor.join();
+
+    m_journal_buf.clear();
+    m_journal_path.clear();
+    m_journal_size  = 0;
+    m_snapshot_size = 0;
 }
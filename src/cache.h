@@ -20,27 +20,209 @@
 #pragma once
 
 
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdint.h>
 #include <string>
-#include <unordered_map>
+#include <sys/types.h>
+#include <thread>
+#include <time.h>
+#include <vector>
 
 
 /**
- * A cached entry.
+ * The number of slots a new, or emptied, cache starts with.
  *
- * This structure contains a cache-value, along with the time that
- * it was inserted into the cache.
+ * This must be a power of two.
  */
-class CacheEntry
+#define CACHE_INITIAL_SLOTS 64
+
+
+/**
+ * The index used to terminate the list of recently used entries.
+ */
+#define CACHE_NIL ((size_t) -1)
+
+
+/**
+ * The types of value a cache-entry may hold.
+ *
+ * Numbers are stored as strings too, so that they may be fetched as
+ * either.
+ */
+typedef enum
+{ CACHE_STRING, CACHE_INTEGER, CACHE_NUMBER } cacheType;
+
+
+/**
+ * The lifetime given to entries when none is specified, and no prefix
+ * matches their key: five days.
+ */
+#define CACHE_DEFAULT_TTL (60 * 60 * 24 * 5)
+
+
+/**
+ * The lifetime which asks for the default to be used.
+ */
+#define CACHE_TTL_DEFAULT -1
+
+
+/**
+ * The version of our on-disk format.
+ */
+#define CACHE_FILE_VERSION 2
+
+
+/**
+ * The value of an index-slot whose record has been copied into memory,
+ * or replaced.  Empty slots hold zero, others hold the record-number
+ * plus one.
+ */
+#define CACHE_FILE_REMOVED 0xffffffff
+
+
+/**
+ * The on-disk header of a saved cache.
+ *
+ * This is followed by `count` records, an index of `slots` record
+ * numbers, and then `strings` bytes of keys and values.
+ */
+typedef struct _cache_file_header
 {
-public:
-    std::string value;
-    time_t      created;
-};
+    char     magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t slots;
+    uint64_t strings;
+} cache_file_header;
+
+
+/**
+ * The on-disk record for a single entry.
+ *
+ * The key and value are stored as offsets into the string-table.
+ */
+typedef struct _cache_file_record
+{
+    uint64_t hash;
+    int64_t  expires;
+    uint32_t key;
+    uint32_t key_len;
+    uint32_t value;
+    uint32_t value_len;
+    uint32_t type;
+    uint32_t reserved;
+} cache_file_record;
+
+
+/**
+ * The magic at the start of a journal, which includes its version.
+ */
+#define CACHE_JOURNAL_MAGIC "LMJ2"
+
+
+/**
+ * The number of bytes of journal records we buffer before writing them.
+ */
+#define CACHE_JOURNAL_BUFFER (64 * 1024)
+
+
+/**
+ * The size a journal must reach before it is compacted, which happens
+ * once it is also larger than the file it applies to.
+ */
+#define CACHE_JOURNAL_MIN (1024 * 1024)
+
+
+/**
+ * The header of a single journal record, which is followed by the key
+ * and value of the entry.
+ */
+typedef struct _cache_journal_record
+{
+    int64_t  expires;
+    uint32_t key_len;
+    uint32_t value_len;
+    uint32_t check;
+    uint32_t type;
+} cache_journal_record;
+
+
+/**
+ * Statistics about the use of a single cache.
+ */
+typedef struct _cache_stats
+{
+    /**
+     * The number of lookups which found a value.
+     */
+    uint64_t hits;
+
+    /**
+     * The number of lookups which didn't.
+     */
+    uint64_t misses;
+
+    /**
+     * The number of entries discarded to stay within our size-limit.
+     */
+    uint64_t evictions;
+
+    /**
+     * The number of entries currently held in memory.
+     */
+    size_t entries;
+
+    /**
+     * The number of entries only present in the file we loaded, which
+     * haven't been used since.
+     */
+    size_t mapped;
+
+    /**
+     * The approximate number of bytes those entries occupy.
+     */
+    size_t bytes;
+
+    /**
+     * The size-limit, in bytes, or zero if there is none.
+     */
+    size_t max_bytes;
+
+    /**
+     * The size of our journal, in bytes, or zero if we're not
+     * journalling.
+     */
+    size_t journal;
+} cache_stats;
+
 
 /**
  *
  * A simple in-RAM cache.
  *
+ * Entries are stored inline in an open-addressed hash-table, using linear
+ * probing, so a lookup is a hash and a short scan of adjacent slots with
+ * no allocation - and a lookup which misses doesn't add anything.
+ *
+ * The cache may optionally be limited in size, in which case the least
+ * recently used entries are evicted.  To find them the slots in use are
+ * linked together, by index, in the order they were last used.
+ *
+ * Caches are saved in a binary format, holding a hash-index of their
+ * entries, and loading one merely maps the file into memory.  Entries
+ * are copied into our table the first time they're used, so the cost
+ * of loading is proportional to the number of entries used, rather than
+ * to the size of the cache.  Caches saved in the older text format, of
+ * one entry per line, may still be loaded.
+ *
+ * Rather than being saved in full, a cache may keep a journal: each
+ * `set()` appends a record to a file beside the one loaded, and those
+ * records are replayed when it is next opened.  Once the journal grows
+ * larger than that file the file is rewritten, by a background thread,
+ * and the journal begins again.
+ *
  */
 class CCache
 {
@@ -66,30 +248,389 @@ public:
     void empty();
 
     /**
-     * Get the value of a cache-key.
+     * Get the value of a cache-key, or an empty string if it isn't set.
+     */
+    std::string get(const std::string &key);
+
+    /**
+     * Find the value of a cache-key, returning NULL if it isn't set.
+     *
+     * The pointer is only valid until the cache is next modified.
      */
-    std::string get(std::string key);
+    const std::string *find(const std::string &key);
 
     /**
-     * Load the map from disk.
+     * Load the cache from disk, replacing our current contents.
      */
     void load(std::string path);
 
     /**
-     * Save the map to disk.
+     * Save the cache to disk, omitting any entries which have expired.
+     *
+     * Returns false on failure.
+     */
+    bool save(std::string path);
+
+    /**
+     * Find the numeric value of a cache-key.
+     *
+     * Returns false if the key isn't set, or doesn't hold a number.  If
+     * `integer` is given it records whether the value is an integer.
+     */
+    bool get_number(const std::string &key, double &value, bool *integer = NULL);
+
+    /**
+     * Store a value in the cache, which expires after `ttl` seconds.
+     *
+     * A lifetime of zero means the entry never expires, and the default
+     * uses that of the longest prefix set via `set_ttl` which matches
+     * the key, or our default.
+     */
+    void set(const std::string &key, const std::string &value, int ttl = CACHE_TTL_DEFAULT);
+
+    /**
+     * Store an integer in the cache.
+     */
+    void set_integer(const std::string &key, int64_t value, int ttl = CACHE_TTL_DEFAULT);
+
+    /**
+     * Store a number in the cache.
+     */
+    void set_number(const std::string &key, double value, int ttl = CACHE_TTL_DEFAULT);
+
+    /**
+     * Set the default lifetime of our entries, in seconds.  Zero means
+     * they don't expire.
+     */
+    void set_ttl(int ttl);
+
+    /**
+     * Set the lifetime of entries whose keys begin with the given prefix.
+     */
+    void set_ttl(const std::string &prefix, int ttl);
+
+    /**
+     * Load the cache from the given file, replaying its journal, and
+     * append further changes to that journal.
+     *
+     * Returns false if the journal couldn't be opened.
+     */
+    bool open_journal(std::string path);
+
+    /**
+     * Write any buffered journal records.
+     *
+     * Returns false if we're not journalling, or the write failed.
+     */
+    bool flush();
+
+    /**
+     * Flush, and stop appending to, our journal.
+     */
+    void close_journal();
+
+    /**
+     * Limit the cache to approximately the given number of bytes,
+     * evicting entries if it is already larger.  Zero means no limit.
+     */
+    void set_max_bytes(size_t max);
+
+    /**
+     * Get statistics about our use.
+     */
+    cache_stats stats();
+
+    /**
+     * Get the number of caches which exist, and the entries, and bytes,
+     * they hold between them.
+     */
+    static void totals(size_t &caches, size_t &entries, size_t &bytes);
+
+    /**
+     * Reset our hit, miss, and eviction counters.
      */
-    void save(std::string path);
+    void reset_stats();
+
+private:
+
+    /**
+     * A single slot of our table.
+     */
+    typedef struct _cache_slot
+    {
+        /**
+         * The slots of the entries used immediately before, and after,
+         * this one - or CACHE_NIL.
+         */
+        size_t prev;
+        size_t next;
+
+        /**
+         * The time at which this entry expires, or zero.
+         */
+        time_t expires;
+
+        /**
+         * The type of this entry, and its value if that is numeric.
+         */
+        cacheType type;
+        double number;
+
+        std::string key;
+        std::string value;
+    } cache_slot;
+
+    /**
+     * Remove all of our entries, keeping the table they were held in.
+     */
+    void clear();
+
+    /**
+     * Load the given contents of a cache saved in our older text format.
+     */
+    void load_text(const std::string &data);
+
+    /**
+     * Map the given file, if it is a valid cache.
+     */
+    bool map_file(int fd, size_t size);
+
+    /**
+     * Unmap any file we've loaded.
+     */
+    void unmap();
+
+    /**
+     * Find the slot of our mapped index which refers to the given key,
+     * or CACHE_NIL if it isn't present.
+     */
+    size_t probe_mapped(const std::string &key, uint64_t h);
+
+    /**
+     * Is the given mapped record valid?
+     */
+    bool valid_record(const cache_file_record &record);
+
+    /**
+     * The contents of a file we're about to save.
+     */
+    typedef struct _cache_image
+    {
+        cache_file_header header;
+        std::vector < cache_file_record > records;
+        std::vector < uint32_t > index;
+        std::string strings;
+    } cache_image;
+
+    /**
+     * Build an image of the file we'd save.  Returns false if it would
+     * be too large.
+     */
+    bool serialize(cache_image &image);
+
+    /**
+     * The size of the file the given image would be saved as.
+     */
+    static size_t image_size(const cache_image &image);
+
+    /**
+     * Write the given image to the named temporary file, optionally
+     * syncing it to disk, then rename it to the given path.
+     */
+    static bool write_image(const cache_image &image, std::string path, std::string tmp, bool sync);
+
+    /**
+     * Replay the given journal, returning the length of its valid
+     * prefix - any following partial, or corrupt, records are ignored.
+     */
+    off_t replay_journal(std::string path);
+
+    /**
+     * The check-value of a journal record.
+     */
+    static uint32_t journal_check(const std::string &key, const std::string &value);
+
+    /**
+     * Append a record of the given entry to our journal buffer.
+     */
+    void append_journal(const std::string &key, const std::string &value, time_t expires, cacheType type);
+
+    /**
+     * Rewrite the file our journal applies to, in the background, and
+     * start a new journal.
+     */
+    void compact();
+
+    /**
+     * Hash the given key - the result is never zero.
+     */
+    static uint64_t hash(const std::string &key);
+
+    /**
+     * Find the slot holding the given key, or the empty slot at which
+     * it should be inserted.
+     */
+    size_t probe(const std::string &key, uint64_t h);
+
+    /**
+     * Find the slot holding the given key, copying it from our mapped
+     * file if necessary, and marking it as the most recently used.
+     *
+     * Returns CACHE_NIL if it isn't set, or has expired.
+     */
+    size_t lookup(const std::string &key);
+
+    /**
+     * Store a value of the given type, journalling it if we should.
+     */
+    void store(const std::string &key, const std::string &value, int ttl, cacheType type);
+
+    /**
+     * The time at which an entry with the given key, and lifetime,
+     * expires - or zero if it doesn't.
+     */
+    time_t expiry(const std::string &key, int ttl);
 
     /**
-     * Store a value in the cache.
+     * Parse the given string as a number, returning its type - which is
+     * CACHE_STRING if it isn't one.
      */
-    void set(std::string key, std::string value);
+    static cacheType parse_number(const std::string &value, double &number);
+
+    /**
+     * Store an entry, with the given expiry-time and type.
+     */
+    void insert(const std::string &key, const std::string &value, time_t expires, cacheType type);
+
+    /**
+     * Remove the given slot from our list of recently used entries.
+     */
+    void unlink(size_t slot);
+
+    /**
+     * Add the given slot to the front of our list of recently used
+     * entries.
+     */
+    void push_front(size_t slot);
+
+    /**
+     * Remove the entry in the given slot, shifting back any entries which
+     * follow it so that they remain reachable.
+     */
+    void erase(size_t slot);
+
+    /**
+     * Double the size of our table.
+     */
+    void grow();
+
+    /**
+     * Grow our table until it can hold the given number of entries.
+     */
+    void reserve(size_t count);
+
+    /**
+     * Move our entries into a table of the given size.
+     */
+    void rehash(size_t size);
+
+    /**
+     * Evict entries until we're within our size-limit.
+     */
+    void evict();
+
+    /**
+     * The approximate cost, in bytes, of storing the given slot.
+     */
+    static size_t cost(const cache_slot &slot);
 
 private:
 
     /**
-     * The actual map which stores our cached data.
+     * The hash of the key in each slot of our table, or zero if it is
+     * unused.  These are kept apart from the slots themselves so that
+     * probing touches as little memory as possible.
+     */
+    std::vector < uint64_t > m_hashes;
+
+    /**
+     * The slots of our table, the number of which is a power of two.
+     */
+    std::vector < cache_slot > m_slots;
+
+    /**
+     * The number of slots in use.
      */
-    std::unordered_map <std::string, CacheEntry * >m_cache;
+    size_t m_count;
 
+    /**
+     * The approximate size of our entries.
+     */
+    size_t m_bytes;
+
+    /**
+     * Our size-limit, or zero.
+     */
+    size_t m_max_bytes;
+
+    /**
+     * The slots of the most, and least, recently used entries.
+     */
+    size_t m_head;
+    size_t m_tail;
+
+    /**
+     * The file we've mapped, and its size.
+     */
+    void *m_map;
+    size_t m_map_size;
+
+    /**
+     * The records, index, and string-table of our mapped file.
+     */
+    const cache_file_record *m_records;
+    uint32_t *m_index;
+    const char *m_strings;
+    uint64_t m_strings_size;
+    uint32_t m_index_slots;
+
+    /**
+     * The number of mapped records which haven't been copied into our
+     * table, or replaced.
+     */
+    size_t m_mapped;
+
+    /**
+     * The default lifetime of our entries, and those of the entries with
+     * particular prefixes.
+     */
+    int m_default_ttl;
+    std::vector < std::pair < std::string, int > > m_ttls;
+
+    /**
+     * Our journal, the file it applies to, and the size of each.
+     */
+    int m_journal_fd;
+    std::string m_journal_path;
+    size_t m_journal_size;
+    size_t m_snapshot_size;
+
+    /**
+     * Journal records we've yet to write, and when we last wrote them.
+     */
+    std::string m_journal_buf;
+    time_t m_journal_flushed;
+
+    /**
+     * The thread rewriting our file, and whether it is still running.
+     */
+    std::thread m_compactor;
+    std::atomic < bool > m_compacting;
+
+    /**
+     * Our counters.
+     */
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_evictions;
 };
@@ -17,8 +17,11 @@
  */
 
 
+#include <cmath>
+
 #include "lua.h"
 #include "cache.h"
+#include "config.h"
 
 
 /**
@@ -34,6 +37,9 @@
  *   print( c:get( "foo" ) ) <br/>
  *</code>
  *
+ * New caches are limited to the size given by `cache.max_bytes`, and
+ * their entries expire after `cache.ttl` seconds, if those are set.
+ *
  */
 
 
@@ -107,7 +113,20 @@ std::shared_ptr<CCache> l_CheckCCache(lua_State * l, int n)
 int l_CCache_constructor(lua_State * l)
 {
     CLuaLog("l_CCache_constructor");
-    push_ccache(l, std::shared_ptr<CCache>(new CCache()));
+
+    std::shared_ptr<CCache> cache(new CCache());
+
+    int max = CConfig::instance()->get_integer("cache.max_bytes");
+
+    if (max > 0)
+        cache->set_max_bytes(max);
+
+    CConfigEntry *ttl = CConfig::instance()->get("cache.ttl");
+
+    if ((ttl != NULL) && (ttl->type == CONFIG_INTEGER))
+        cache->set_ttl(*ttl->value.value);
+
+    push_ccache(l, cache);
     return 1;
 }
 
@@ -136,23 +155,77 @@ int l_CCache_get(lua_State * l)
 
     std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
 
-    const char *key = luaL_checkstring(l, 2);
-    std::string value = foo->get(key);
+    size_t len;
+    const char *key = luaL_checklstring(l, 2, &len);
+    const std::string *value = foo->find(std::string(key, len));
 
-    if (value.empty())
+    if ((value == NULL) || value->empty())
     {
         lua_pushnil(l);
     }
     else
     {
-        lua_pushstring(l, value.c_str());
-
+        lua_pushlstring(l, value->data(), value->size());
     }
 
     return 1;
 }
 
 
+/**
+ * Implementation of Cache:flush()
+ */
+int l_CCache_flush(lua_State * l)
+{
+    CLuaLog("l_CCache_flush");
+
+    std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
+    lua_pushboolean(l, foo->flush());
+    return 1;
+}
+
+
+/**
+ * Implementation of Cache:get_number()
+ */
+int l_CCache_get_number(lua_State * l)
+{
+    CLuaLog("l_CCache_get_number");
+
+    std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
+
+    size_t len;
+    const char *key = luaL_checklstring(l, 2, &len);
+
+    double value;
+    bool integer;
+
+    if (! foo->get_number(std::string(key, len), value, &integer))
+        lua_pushnil(l);
+    else if (integer)
+        lua_pushinteger(l, (lua_Integer) value);
+    else
+        lua_pushnumber(l, value);
+
+    return 1;
+}
+
+
+/**
+ * Implementation of Cache:journal()
+ */
+int l_CCache_journal(lua_State * l)
+{
+    CLuaLog("l_CCache_journal");
+
+    std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
+
+    const char *path = luaL_checkstring(l, 2);
+    lua_pushboolean(l, foo->open_journal(path));
+    return 1;
+}
+
+
 /**
  * Implementation of Cache:load()
  */
@@ -178,11 +251,119 @@ int l_CCache_save(lua_State * l)
     std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
 
     const char *path = luaL_checkstring(l, 2);
-    foo->save(path);
+    lua_pushboolean(l, foo->save(path));
+    return 1;
+}
+
+
+/**
+ * Implementation of Cache:set_max_bytes()
+ */
+int l_CCache_set_max_bytes(lua_State * l)
+{
+    CLuaLog("l_CCache_set_max_bytes");
+
+    std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
+
+    int max = luaL_checkinteger(l, 2);
+    foo->set_max_bytes((max > 0) ? max : 0);
+    return 0;
+}
+
+
+/**
+ * Implementation of Cache:set_number()
+ */
+int l_CCache_set_number(lua_State * l)
+{
+    CLuaLog("l_CCache_set_number");
+
+    size_t len;
+    const char *key = luaL_checklstring(l, 2, &len);
+    double value = luaL_checknumber(l, 3);
+    int ttl = luaL_optinteger(l, 4, CACHE_TTL_DEFAULT);
+
+    std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
+
+    if ((fabs(value) < 9e18) && (value == floor(value)))
+        foo->set_integer(std::string(key, len), (int64_t) value, ttl);
+    else
+        foo->set_number(std::string(key, len), value, ttl);
+
+    return 0;
+}
+
+
+/**
+ * Implementation of Cache:set_ttl()
+ *
+ * This may be called with a number of seconds, to set the default
+ * lifetime of entries, or with a key-prefix and a number of seconds.
+ */
+int l_CCache_set_ttl(lua_State * l)
+{
+    CLuaLog("l_CCache_set_ttl");
+
+    std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
+
+    if (lua_gettop(l) >= 3)
+    {
+        const char *prefix = luaL_checkstring(l, 2);
+        foo->set_ttl(prefix, luaL_checkinteger(l, 3));
+    }
+    else
+        foo->set_ttl(luaL_checkinteger(l, 2));
+
     return 0;
 }
 
 
+/**
+ * Implementation of Cache:stats()
+ */
+int l_CCache_stats(lua_State * l)
+{
+    CLuaLog("l_CCache_stats");
+
+    std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
+    cache_stats stats = foo->stats();
+
+    /*
+     * Reset the counters, if we were asked to.
+     */
+    if (lua_toboolean(l, 2))
+        foo->reset_stats();
+
+    lua_newtable(l);
+
+    lua_pushinteger(l, stats.hits);
+    lua_setfield(l, -2, "hits");
+
+    lua_pushinteger(l, stats.misses);
+    lua_setfield(l, -2, "misses");
+
+    lua_pushinteger(l, stats.evictions);
+    lua_setfield(l, -2, "evictions");
+
+    lua_pushinteger(l, stats.entries);
+    lua_setfield(l, -2, "entries");
+
+    lua_pushinteger(l, stats.mapped);
+    lua_setfield(l, -2, "mapped");
+
+    lua_pushinteger(l, stats.bytes);
+    lua_setfield(l, -2, "bytes");
+
+    lua_pushinteger(l, stats.max_bytes);
+    lua_setfield(l, -2, "max_bytes");
+
+    lua_pushinteger(l, stats.journal);
+    lua_setfield(l, -2, "journal");
+
+    return 1;
+}
+
+
 /**
  * Implementation of Cache:set()
  */
@@ -190,11 +371,13 @@ int l_CCache_set(lua_State * l)
 {
     CLuaLog("l_CCache_set");
 
-    const char *key = luaL_checkstring(l, 2);
-    const char *val = luaL_checkstring(l, 3);
+    size_t klen, vlen;
+    const char *key = luaL_checklstring(l, 2, &klen);
+    const char *val = luaL_checklstring(l, 3, &vlen);
+    int ttl = luaL_optinteger(l, 4, CACHE_TTL_DEFAULT);
 
     std::shared_ptr<CCache> foo = l_CheckCCache(l, 1);
-    foo->set(key, val);
+    foo->set(std::string(key, klen), std::string(val, vlen), ttl);
     return 0;
 }
 
@@ -233,11 +416,18 @@ void InitCache(lua_State * l)
     luaL_Reg sFooRegs[] =
     {
         {"empty", l_CCache_empty},
+        {"flush", l_CCache_flush},
         {"get", l_CCache_get},
+        {"get_number", l_CCache_get_number},
+        {"journal", l_CCache_journal},
         {"load", l_CCache_load},
         {"new", l_CCache_constructor},
         {"save", l_CCache_save},
         {"set", l_CCache_set},
+        {"set_max_bytes", l_CCache_set_max_bytes},
+        {"set_number", l_CCache_set_number},
+        {"set_ttl", l_CCache_set_ttl},
+        {"stats", l_CCache_stats},
         {"__gc", l_CCache_destructor},
         {NULL, NULL}
     };
@@ -0,0 +1,430 @@
+/*
+ * cache_test.cc - Test our in-RAM cache.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test setting, getting, and overwriting values - and that lookups which
+ * miss don't add entries.
+ */
+void TestCacheGetSet(CuTest * tc)
+{
+    CCache cache;
+
+    CuAssertTrue(tc, cache.find("missing") == NULL);
+    CuAssertStrEquals(tc, "", cache.get("missing").c_str());
+    CuAssertIntEquals(tc, 0, cache.stats().entries);
+    CuAssertIntEquals(tc, 2, cache.stats().misses);
+
+    cache.set("foo", "bar");
+    cache.set("foo", "baz");
+    cache.set("white space", "ok");
+
+    CuAssertStrEquals(tc, "baz", cache.get("foo").c_str());
+    CuAssertStrEquals(tc, "ok", cache.get("whitespace").c_str());
+    CuAssertStrEquals(tc, "ok", cache.get(" white space ").c_str());
+    CuAssertIntEquals(tc, 2, cache.stats().entries);
+    CuAssertIntEquals(tc, 3, cache.stats().hits);
+
+    cache.reset_stats();
+    CuAssertIntEquals(tc, 0, cache.stats().hits);
+
+    /*
+     * Grow the table well beyond its initial size.
+     */
+    for (int i = 0; i < 10000; i++)
+        cache.set("key" + std::to_string(i), std::to_string(i));
+
+    for (int i = 0; i < 10000; i++)
+        CuAssertStrEquals(tc, std::to_string(i).c_str(), cache.get("key" + std::to_string(i)).c_str());
+
+    CuAssertIntEquals(tc, 10002, cache.stats().entries);
+
+    cache.empty();
+    CuAssertIntEquals(tc, 0, cache.stats().entries);
+    CuAssertIntEquals(tc, 0, cache.stats().bytes);
+    CuAssertTrue(tc, cache.find("foo") == NULL);
+}
+
+
+/**
+ * Test that a size-limited cache evicts the least-recently used entries.
+ */
+void TestCacheEviction(CuTest * tc)
+{
+    CCache cache;
+
+    cache.set("keep", "me");
+
+    for (int i = 0; i < 100; i++)
+        cache.set("key" + std::to_string(i), std::string(100, 'x'));
+
+    size_t bytes = cache.stats().bytes;
+
+    /*
+     * Limit the cache to half its size, having used one entry.
+     */
+    cache.get("keep");
+    cache.set_max_bytes(bytes / 2);
+
+    cache_stats stats = cache.stats();
+    CuAssertTrue(tc, stats.bytes <= bytes / 2);
+    CuAssertTrue(tc, stats.evictions > 0);
+    CuAssertIntEquals(tc, 101 - stats.evictions, stats.entries);
+    CuAssertStrEquals(tc, "me", cache.get("keep").c_str());
+
+    /*
+     * New entries keep it within the limit, and everything left over
+     * is still reachable.
+     */
+    for (int i = 100; i < 1000; i++)
+        cache.set("key" + std::to_string(i), std::string(100, 'x'));
+
+    stats = cache.stats();
+    CuAssertTrue(tc, stats.bytes <= bytes / 2);
+
+    size_t found = 0;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        if (cache.find("key" + std::to_string(i)) != NULL)
+            found++;
+    }
+
+    if (cache.find("keep") != NULL)
+        found++;
+
+    CuAssertIntEquals(tc, stats.entries, found);
+    CuAssertTrue(tc, cache.find("key999") != NULL);
+}
+
+
+/**
+ * Test numeric values.
+ */
+void TestCacheNumbers(CuTest * tc)
+{
+    CCache cache;
+
+    cache.set_integer("int", 1234567890123LL);
+    cache.set_number("pi", 3.25);
+    cache.set("text", "hello");
+    cache.set("numeric", "42");
+
+    double value = 0;
+    bool integer = false;
+
+    CuAssertTrue(tc, cache.get_number("int", value, &integer));
+    CuAssertTrue(tc, integer);
+    CuAssertTrue(tc, value == 1234567890123.0);
+    CuAssertStrEquals(tc, "1234567890123", cache.get("int").c_str());
+
+    CuAssertTrue(tc, cache.get_number("pi", value, &integer));
+    CuAssertTrue(tc, ! integer);
+    CuAssertTrue(tc, value == 3.25);
+
+    /*
+     * Strings are numbers only if they hold one.
+     */
+    CuAssertTrue(tc, ! cache.get_number("text", value));
+    CuAssertTrue(tc, ! cache.get_number("missing", value));
+    CuAssertTrue(tc, cache.get_number("numeric", value, &integer));
+    CuAssertTrue(tc, integer);
+    CuAssertTrue(tc, value == 42);
+
+    /*
+     * Types survive saving and loading.
+     */
+    char path[] = "/tmp/cache.XXXXXX";
+    int fd = mkstemp(path);
+    CuAssertTrue(tc, fd != -1);
+    close(fd);
+
+    CuAssertTrue(tc, cache.save(path));
+
+    CCache loaded;
+    loaded.load(path);
+    CuAssertTrue(tc, loaded.get_number("pi", value, &integer));
+    CuAssertTrue(tc, ! integer);
+    CuAssertTrue(tc, value == 3.25);
+    CuAssertTrue(tc, loaded.get_number("int", value, &integer));
+    CuAssertTrue(tc, integer);
+
+    unlink(path);
+}
+
+
+/**
+ * Test that entries expire.
+ */
+void TestCacheTTL(CuTest * tc)
+{
+    CCache cache;
+
+    cache.set_ttl("short:", 1);
+    cache.set_ttl("never:", 0);
+
+    cache.set("short:one", "1");
+    cache.set("never:two", "2");
+    cache.set("default", "3");
+    cache.set("explicit", "4", 1);
+
+    /*
+     * Entries which have expired are neither found, nor saved.
+     */
+    sleep(2);
+
+    CuAssertTrue(tc, cache.find("short:one") == NULL);
+    CuAssertTrue(tc, cache.find("explicit") == NULL);
+    CuAssertStrEquals(tc, "2", cache.get("never:two").c_str());
+    CuAssertStrEquals(tc, "3", cache.get("default").c_str());
+    CuAssertIntEquals(tc, 2, cache.stats().entries);
+
+    cache.set_ttl(1);
+    cache.set("default", "5");
+    cache.set("explicit", "6", 1);
+
+    char path[] = "/tmp/cache.XXXXXX";
+    int fd = mkstemp(path);
+    CuAssertTrue(tc, fd != -1);
+    close(fd);
+
+    sleep(2);
+    CuAssertTrue(tc, cache.save(path));
+
+    CCache loaded;
+    loaded.load(path);
+    CuAssertIntEquals(tc, 1, loaded.stats().mapped);
+    CuAssertStrEquals(tc, "2", loaded.get("never:two").c_str());
+
+    unlink(path);
+}
+
+
+/**
+ * Test saving and loading.
+ */
+void TestCacheSaveLoad(CuTest * tc)
+{
+    char path[] = "/tmp/cache.XXXXXX";
+    int fd = mkstemp(path);
+    CuAssertTrue(tc, fd != -1);
+    close(fd);
+
+    CCache cache;
+    cache.set("one", "1");
+    cache.set("two", "two words");
+    cache.set("three", "3");
+    CuAssertTrue(tc, cache.save(path));
+
+    CCache loaded;
+    loaded.set("stale", "value");
+    loaded.load(path);
+
+    /*
+     * Nothing is read from the file until it is used.
+     */
+    CuAssertIntEquals(tc, 0, loaded.stats().entries);
+    CuAssertIntEquals(tc, 3, loaded.stats().mapped);
+    CuAssertTrue(tc, loaded.find("stale") == NULL);
+
+    CuAssertStrEquals(tc, "1", loaded.get("one").c_str());
+    CuAssertStrEquals(tc, "two words", loaded.get("two").c_str());
+    CuAssertIntEquals(tc, 2, loaded.stats().entries);
+    CuAssertIntEquals(tc, 1, loaded.stats().mapped);
+
+    /*
+     * Replacing a mapped entry hides the old value, even once the new
+     * one has been evicted.
+     */
+    loaded.set("three", "three");
+    CuAssertIntEquals(tc, 0, loaded.stats().mapped);
+    loaded.set_max_bytes(1);
+    loaded.set("four", "4");
+    CuAssertTrue(tc, loaded.find("three") == NULL);
+    loaded.set_max_bytes(0);
+
+    /*
+     * Saving over the file we've loaded keeps the entries we haven't
+     * used, and our new ones.
+     */
+    CCache again;
+    again.load(path);
+    again.get("one");
+    again.set("five", "5");
+    CuAssertTrue(tc, again.save(path));
+
+    CCache reloaded;
+    reloaded.load(path);
+    CuAssertIntEquals(tc, 4, reloaded.stats().mapped);
+    CuAssertStrEquals(tc, "1", reloaded.get("one").c_str());
+    CuAssertStrEquals(tc, "two words", reloaded.get("two").c_str());
+    CuAssertStrEquals(tc, "3", reloaded.get("three").c_str());
+    CuAssertStrEquals(tc, "5", reloaded.get("five").c_str());
+
+    unlink(path);
+}
+
+
+/**
+ * Test loading caches saved in our older text format, and ignoring
+ * corrupt ones.
+ */
+void TestCacheLoadText(CuTest * tc)
+{
+    char path[] = "/tmp/cache.XXXXXX";
+    int fd = mkstemp(path);
+    CuAssertTrue(tc, fd != -1);
+
+    std::string now  = std::to_string(time(NULL));
+    std::string text = now + " one 1\n" + now + " two two words\nbogus\nx y z\n" + now + " three 3";
+    CuAssertIntEquals(tc, text.size(), write(fd, text.data(), text.size()));
+    close(fd);
+
+    CCache cache;
+    cache.load(path);
+
+    CuAssertIntEquals(tc, 3, cache.stats().entries);
+    CuAssertStrEquals(tc, "1", cache.get("one").c_str());
+    CuAssertStrEquals(tc, "two words", cache.get("two").c_str());
+    CuAssertStrEquals(tc, "3", cache.get("three").c_str());
+    CuAssertTrue(tc, cache.find("y") == NULL);
+
+    /*
+     * A truncated binary file is ignored.
+     */
+    CuAssertTrue(tc, cache.save(path));
+    CuAssertIntEquals(tc, 0, truncate(path, 40));
+
+    CCache broken;
+    broken.load(path);
+    CuAssertIntEquals(tc, 0, broken.stats().entries);
+    CuAssertIntEquals(tc, 0, broken.stats().mapped);
+    CuAssertTrue(tc, broken.find("one") == NULL);
+
+    unlink(path);
+}
+
+
+/**
+ * Test that changes are journalled, and replayed, and that a partial
+ * record left by a crash is ignored.
+ */
+void TestCacheJournal(CuTest * tc)
+{
+    char dir[] = "/tmp/cache.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(dir) != NULL);
+
+    std::string path    = std::string(dir) + "/cache";
+    std::string journal = path + ".journal";
+
+    {
+        CCache cache;
+        CuAssertTrue(tc, ! cache.flush());
+        CuAssertTrue(tc, cache.open_journal(path));
+
+        cache.set("one", "1");
+        cache.set("two", "2");
+        cache.set("one", "uno");
+        CuAssertTrue(tc, cache.flush());
+        CuAssertTrue(tc, cache.stats().journal > 0);
+    }
+
+    /*
+     * Append part of a record, as a crash might.
+     */
+    FILE *fp = fopen(journal.c_str(), "ab");
+    CuAssertTrue(tc, fp != NULL);
+    fwrite("\x01\x02\x03", 1, 3, fp);
+    fclose(fp);
+
+    {
+        CCache cache;
+        CuAssertTrue(tc, cache.open_journal(path));
+        CuAssertStrEquals(tc, "uno", cache.get("one").c_str());
+        CuAssertStrEquals(tc, "2", cache.get("two").c_str());
+
+        cache.set("three", "3");
+    }
+
+    {
+        CCache cache;
+        CuAssertTrue(tc, cache.open_journal(path));
+        CuAssertIntEquals(tc, 3, cache.stats().entries);
+        CuAssertStrEquals(tc, "3", cache.get("three").c_str());
+        cache.empty();
+        CuAssertIntEquals(tc, 0, cache.stats().journal);
+    }
+
+    /*
+     * Write enough that the journal is compacted, more than once, into
+     * the file it applies to.
+     */
+    {
+        CCache cache;
+        CuAssertTrue(tc, cache.open_journal(path));
+
+        std::string value(1000, 'x');
+
+        for (int i = 0; i < 5000; i++)
+            cache.set("key" + std::to_string(i % 2000), value + std::to_string(i));
+    }
+
+    CuAssertTrue(tc, access((path + ".journal.compacting").c_str(), F_OK) != 0);
+
+    CCache cache;
+    cache.load(path);
+    CuAssertTrue(tc, cache.stats().mapped > 0);
+
+    CuAssertTrue(tc, cache.open_journal(path));
+    CuAssertStrEquals(tc, "uno", cache.get("one").c_str());
+
+    for (int i = 3000; i < 5000; i++)
+        CuAssertStrEquals(tc, (std::string(1000, 'x') + std::to_string(i)).c_str(), cache.get("key" + std::to_string(i % 2000)).c_str());
+
+    cache.close_journal();
+
+    unlink(path.c_str());
+    unlink(journal.c_str());
+    rmdir(dir);
+}
+
+
+CuSuite *
+cache_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestCacheGetSet);
+    SUITE_ADD_TEST(suite, TestCacheEviction);
+    SUITE_ADD_TEST(suite, TestCacheNumbers);
+    SUITE_ADD_TEST(suite, TestCacheTTL);
+    SUITE_ADD_TEST(suite, TestCacheSaveLoad);
+    SUITE_ADD_TEST(suite, TestCacheLoadText);
+    SUITE_ADD_TEST(suite, TestCacheJournal);
+    return suite;
+}
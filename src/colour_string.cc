@@ -17,280 +17,364 @@
  */
 
 
-#include <algorithm>
-#include <assert.h>
 #include <malloc.h>
-#include <pcrecpp.h>
+#include <string.h>
+#include <unordered_map>
+#include <wchar.h>
 
 #include "colour_string.h"
 #include "util.h"
 
 
 /*
- * Parse a string into an array of "string + colour" pairs,
- * which will be useful for drawing strings.
- *
- * The output of this routine will be an array of COLOUR_STRING
- * objects - each object will contain a colour and ONE CHARACTER
- * of text to draw.
- *
- * This needs re-emphasising:  The entries will contain one character
- * which may be displayed, even if that character might be made from
- * multiple *BYTES*.
+ * The number of lines, and the number of bytes of text, we'll cache before
+ * starting afresh.  The lines visible upon the screen are re-parsed, and
+ * so cached again, by the next redraw.
  */
-std::vector<COLOUR_STRING *> CColourString::parse_coloured_string(std::string input, int offset, int tab_width)
+#define COLOUR_CACHE_LINES 4096
+#define COLOUR_CACHE_BYTES (4 * 1024 * 1024)
+
+
+/*
+ * Our cache of parsed lines, keyed upon the tab-width and the input.
+ */
+static std::unordered_map < std::string, std::shared_ptr<const COLOURED_LINE> > g_cache;
+static size_t g_cache_bytes  = 0;
+static size_t g_cache_hits   = 0;
+static size_t g_cache_misses = 0;
+
+
+/*
+ * Return the offset of the named colour within the line, adding it if
+ * it isn't already present.
+ */
+static uint32_t colour_index(COLOURED_LINE &out, const char *name, size_t len)
 {
-    /**
-     * Vector we use while building.
-     */
-    std::vector<COLOUR_STRING *> temp;
+    for (size_t i = 0; i < out.colours.size(); i++)
+    {
+        if (out.colours[i].compare(0, std::string::npos, name, len) == 0)
+            return (i);
+    }
 
-    /**
-     * Returned to the caller.
-     */
-    std::vector<COLOUR_STRING *> results;
+    out.colours.push_back(std::string(name, len));
+    return (out.colours.size() - 1);
+}
 
-    /*
-     * I know this is horrid.
-     *
-     * NOTE: We're trying to be greedy but searching from the
-     * back of the string forward.  This is definitely the simpler
-     * of the approaches I trialled.
-     */
-    pcrecpp::RE re("^(.*)\\$\\[([#a-zA-Z|]+)\\](.*)$");
 
-    std::string pre;
-    std::string col;
-    std::string txt;
+/*
+ * The number of columns the given (multi-byte) character occupies.
+ */
+static uint16_t char_width(const char *text, size_t size)
+{
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+
+    wchar_t wc;
+    size_t got = mbrtowc(&wc, text, size, &state);
+
+    if ((got == (size_t) - 1) || (got == (size_t) - 2))
+        return 1;
+
+    int width = wcwidth(wc);
+
+    return (width < 0) ? 1 : width;
+}
+
 
-    while (re.FullMatch(input, &pre, &col, &txt))
+/*
+ * Append the characters of the given text to the line, in the specified
+ * colour.
+ */
+static void add_text(COLOURED_LINE &out, const char *text, size_t max, uint32_t colour, int tab_width)
+{
+    COLOUR_CHAR chr;
+    chr.colour = colour;
+
+    size_t i = 0;
+
+    while (i < max)
     {
         /*
-         * Allocate a structure to hold this match.
+         * Most text is plain ASCII, which needn't be decoded.
          */
-        COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
+        size_t end = i + dsutil_ascii_span(text + i, max - i);
+
+        chr.length = 1;
+        chr.width  = 1;
+
+        for (; i < end; i++)
+        {
+            /*
+             * TAB is a special-case - it becomes a number of spaces, each
+             * of which is a character in its own right.
+             */
+            if (text[i] == '\t')
+            {
+                for (int j = 0; j < tab_width ; j++)
+                {
+                    chr.offset = out.text.size();
+                    out.text.push_back(' ');
+                    out.chars.push_back(chr);
+                }
+
+                continue;
+            }
+
+            chr.offset = out.text.size();
+            out.text.push_back(text[i]);
+            out.chars.push_back(chr);
+        }
+
+        if (i >= max)
+            break;
 
         /*
-         * Save our match away.
+         * Lookup the size of the UTF-character, in bytes.
          */
-        tmp->colour = new std::string(col);
-        tmp->string = new std::string(txt);
-        temp.push_back(tmp);
+        size_t size = dsutil_utf8_charlen(text[i]);
 
-        input = pre;
-    }
+        chr.offset = out.text.size();
 
-    /*
-     * If input is non-empty then we have leading match.  Handle that
-     * as a special case.
-     */
-    if (! input.empty())
-    {
         /*
-         * Allocate a structure to hold this match.
+         * If that failed because the UTF-8 is invalid we're
+         * gonna have to fake it.
          */
-        COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
-        tmp->colour = new std::string("white");
-        tmp->string = new std::string(input);
-        temp.push_back(tmp);
+        if (size == 0)
+        {
+            out.text.push_back('?');
+            size = 1;
+        }
+        else
+        {
+            if (i + size > max)
+                size = max - i;
+
+            out.text.append(text + i, size);
+            chr.length = size;
+            chr.width  = char_width(text + i, size);
+        }
+
+        out.chars.push_back(chr);
+        i += size;
     }
+}
 
-    /*
-     * Remember we searched backwards?  Reverse so all makes sense.
-     */
-    std::reverse(temp.begin(), temp.end());
-
-
-    /**
-     * At this point we're half done.
-     *
-     * We've turned this input:
-     *
-     *   $[RED]This is red $[BLUE]This is blue
-     *
-     * Into this intermediary step:
-     *
-     *  [colour:RED, text:"This is red "],
-     *  [colour:BLUE, text:"This is blue"],
-     *
-     * We now need to turn that middle-step into:
-     *
-     *  [colour:RED, text:T]
-     *  [colour:RED, text:h]
-     *  [colour:RED, text:i]
-     *  [colour:RED, text:s]
-     *  [colour:RED, text: ]
-     *  [colour:RED, text:i]
-     *  [colour:RED, text:s]
-     *  [colour:RED, text: ]
-     *  [colour:RED, text:r]
-     *  [colour:RED, text:e]
-     *  [colour:RED, text:d]
-     *  [colour:RED, text: ]
-     *  [colour:BLUE, text:T]
-     *  [colour:BLUE, text:h]
-     *  [colour:BLUE, text:i]
-     *  ..
-     *
-     * We do this because it is significantly more efficient to handle
-     * scrolling when we have a set of characters, since we just remove
-     * the ones to the left of the scroll-index.
-     */
 
+/*
+ * Group the characters of the line into runs of the same colour, each of
+ * which is either plain ASCII or not, and total their widths.
+ */
+static void add_runs(COLOURED_LINE &out)
+{
+    out.width = 0;
 
-    /*
-     * Starting/Previous colour.
-     */
-    std::string prev_colour = "white";
+    for (size_t i = 0; i < out.chars.size(); i++)
+    {
+        const COLOUR_CHAR &chr = out.chars[i];
+        bool ascii = (chr.length == 1) && ((unsigned char) out.text[chr.offset] < 0x80);
+
+        out.width += chr.width;
+
+        if (! out.runs.empty())
+        {
+            COLOUR_RUN &last = out.runs.back();
+
+            if ((last.colour == chr.colour) && (last.ascii == ascii))
+            {
+                last.count += 1;
+                continue;
+            }
+        }
+
+        COLOUR_RUN run;
+        run.first  = i;
+        run.count  = 1;
+        run.colour = chr.colour;
+        run.ascii  = ascii;
+        out.runs.push_back(run);
+    }
+}
+
+
+/*
+ * Is the given character valid within the name of a colour?
+ */
+static bool colour_char(char c)
+{
+    return (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+            (c == '#') || (c == '|'));
+}
+
+
+/*
+ * Parse a string into its characters, and their colours.
+ *
+ * Colours are specified via `$[NAME]`, which persists until the next
+ * colour.  `$[#NAME]` is an escape - it is drawn literally, as `$[NAME]`,
+ * in the current colour.  Text before any colour is drawn in white.
+ */
+void CColourString::parse_line(const std::string &input, int tab_width, COLOURED_LINE &out)
+{
+    out.text.clear();
+    out.colours.clear();
+    out.chars.clear();
+    out.runs.clear();
+    out.width = 0;
+
+    const char *data = input.data();
+    size_t len = input.size();
 
     /*
-     * Iterate over the entries.
+     * The colour we're drawing in, and the start of the text which is
+     * to be drawn in it.
      */
-    for (std::vector<COLOUR_STRING *>::iterator it = temp.begin(); it != temp.end() ; ++it)
+    uint32_t colour = colour_index(out, "white", 5);
+    size_t start = 0;
+
+    for (size_t i = 0; i + 1 < len; i++)
     {
-        std::string *colour = (*it)->colour;
-        std::string *text   = (*it)->string;
+        if ((data[i] != '$') || (data[i + 1] != '['))
+            continue;
 
-        /**
-         * Expand "$[#RED]", appropriately.
+        /*
+         * Find the end of the colour-name.  Names can't contain `$`, `[`,
+         * or `]`, so markup never overlaps and we needn't backtrack.
          */
-        if ((colour->size() > 0) && (colour->at(0) == '#'))
-        {
-            /* Rewrite the text - i.e escape the whole damn thing. */
-            *text = "$[" + colour->substr(1) + "]" + *text;
+        size_t end = i + 2;
 
-            /* avoid using the selected colour */
-            delete(colour);
+        while ((end < len) && colour_char(data[end]))
+            end++;
 
-            (*it)->colour = new std::string(prev_colour);
-            colour        = (*it)->colour;
-        }
-        else
-        {
-            /*
-             * Record the previous colour, to handle the case of a future
-             * string not updating itself because it is escaped.
-             */
-            prev_colour = *colour;
-        }
+        if ((end == i + 2) || (end >= len) || (data[end] != ']'))
+            continue;
 
+        add_text(out, data + start, i - start, colour, tab_width);
 
-        /*
-         * Copy the colour, and the one-character string.
-         */
-        int max = (int)text->length();
+        const char *name = data + i + 2;
+        size_t name_len  = end - i - 2;
 
-        for (int i = 0; i < max; i++)
+        if (name[0] == '#')
         {
             /*
-             * The "single character" we'll draw, which might
-             * actually be comprised of multiple bytes.
+             * Draw the escaped markup literally, in the current colour.
              */
-            std::string chr;
+            std::string escaped = "$[" + std::string(name + 1, name_len - 1) + "]";
+            add_text(out, escaped.data(), escaped.size(), colour, tab_width);
+        }
+        else
+        {
+            colour = colour_index(out, name, name_len);
+        }
 
-            /*
-             * Get the single byte at the position.
-             * We'll test this to see if it is a multi-byte chacter
-             * and if it is we'll bump it up.
-             */
-            const char byte = text->at(i);
+        start = end + 1;
+        i = end;
+    }
 
-            /*
-             * TAB is a special-case.
-             */
-            if (byte == '\t')
-            {
-                /*
-                 * Width of a TAB is 8 characters by default, but
-                 * the user might have changed it.
-                 *
-                 * NOTE: We could improve things here by counting
-                 * the width of our parts, and using that to snap
-                 * to boundaries - for the moment we're just replacing
-                 * the TAB => "    ".
-                 *
-                 * TODO: Improve this :)
-                 *
-                 */
-                for (int j = 0; j < tab_width ; j++)
-                {
-                    COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
-                    tmp->colour = new std::string(*colour);
-                    tmp->string = new std::string(" ");
-                    results.push_back(tmp);
-                }
+    if (start < len)
+        add_text(out, data + start, len - start, colour, tab_width);
 
-                continue;
+    add_runs(out);
+}
 
-            }
 
-            /*
-             * Lookup the size of the UTF-character, in bytes.
-             */
-            int size = dsutil_utf8_charlen(byte);
+/*
+ * Return the parsed form of the given string, from our cache if possible.
+ */
+std::shared_ptr<const COLOURED_LINE> CColourString::parse_cached(const std::string &input, int tab_width)
+{
+    return (parse_cached(input.data(), input.size(), tab_width));
+}
 
-            /*
-             * If that failed because the UTF-8 is invalid we're
-             * gonna have to fake it.
-             */
-            if (size == 0)
-            {
-                chr = "?";
-            }
-            else
-            {
-                /*
-                 * Otherwise add each byte
-                 */
-                for (int j = 0; j < size; j++)
-                {
-                    if (i + j < max)
-                        chr += text->at(i + j);
-                }
 
-                /*
-                 * Bump past the bytes we've added
-                 */
-                i += (size - 1);
-            }
+/*
+ * Return the parsed form of the given text, from our cache if possible.
+ */
+std::shared_ptr<const COLOURED_LINE> CColourString::parse_cached(const char *data, size_t len, int tab_width)
+{
+    std::string key = std::to_string(tab_width) + ":";
+    key.append(data, len);
 
-            COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
-            tmp->colour = new std::string(*colour);
-            tmp->string = new std::string(chr);
-            results.push_back(tmp);
+    auto it = g_cache.find(key);
 
-        }
+    if (it != g_cache.end())
+    {
+        g_cache_hits++;
+        return (it->second);
     }
 
+    g_cache_misses++;
+
+    std::shared_ptr<COLOURED_LINE> line = std::make_shared<COLOURED_LINE>();
+    parse_line(std::string(data, len), tab_width, *line);
 
     /*
-     * Free the array we built in the middle.
+     * Start afresh if we've grown too large.
      */
-    for (std::vector<COLOUR_STRING *>::iterator it = temp.begin(); it != temp.end() ; ++it)
+    if ((g_cache.size() >= COLOUR_CACHE_LINES) || (g_cache_bytes >= COLOUR_CACHE_BYTES))
     {
-        COLOUR_STRING *i = (*it);
-        delete(i->string);
-        delete(i->colour);
-        free(i);
+        g_cache.clear();
+        g_cache_bytes = 0;
     }
 
+    g_cache_bytes += key.size() + line->text.size() + line->chars.size() * sizeof(COLOUR_CHAR) +
+                     line->runs.size() * sizeof(COLOUR_RUN);
+    g_cache[key] = line;
+
+    return (line);
+}
 
 
-    /*
-     * Now remove the parts that we should skip because we have
-     * scrolling in effect.
-     */
-    for (int i = 0; i < offset && ((int)results.size() >= 1); i++)
+/*
+ * The number of lookups satisfied by our cache.
+ */
+size_t CColourString::cache_hits()
+{
+    return (g_cache_hits);
+}
+
+
+/*
+ * The number of lookups which required parsing.
+ */
+size_t CColourString::cache_misses()
+{
+    return (g_cache_misses);
+}
+
+
+/*
+ * Parse a string into an array of "string + colour" pairs,
+ * which will be useful for drawing strings.
+ *
+ * The output of this routine will be an array of COLOUR_STRING
+ * objects - each object will contain a colour and ONE CHARACTER
+ * of text to draw.
+ *
+ * This needs re-emphasising:  The entries will contain one character
+ * which may be displayed, even if that character might be made from
+ * multiple *BYTES*.
+ *
+ * This is built upon `parse_line`; the caller must free the results.
+ */
+std::vector<COLOUR_STRING *> CColourString::parse_coloured_string(std::string input, int offset, int tab_width)
+{
+    COLOURED_LINE line;
+    parse_line(input, tab_width, line);
+
+    std::vector<COLOUR_STRING *> results;
+
+    if (offset < 0)
+        offset = 0;
+
+    for (size_t i = offset; i < line.chars.size(); i++)
     {
-        COLOUR_STRING *x = results.at(0);
-        delete(x->string);
-        delete(x->colour);
-        free(x);
-        results.erase(results.begin(), results.begin() + 1);
+        const COLOUR_CHAR &chr = line.chars[i];
+
+        COLOUR_STRING *tmp = (COLOUR_STRING *)malloc(sizeof(COLOUR_STRING));
+        tmp->colour = new std::string(line.colours[chr.colour]);
+        tmp->string = new std::string(line.text, chr.offset, chr.length);
+        results.push_back(tmp);
     }
 
-    /*
-     * Return the results.
-     */
     return results;
 }
@@ -22,6 +22,8 @@
  */
 #pragma once
 
+#include <memory>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -62,11 +64,131 @@ typedef struct _COLOUR_STRING
 } COLOUR_STRING;
 
 
+/**
+ * A single drawable character of a parsed line, which may be made up of
+ * several bytes.
+ */
+typedef struct _COLOUR_CHAR
+{
+    /**
+     * The offset, and length, of the character within the `text` of
+     * the line, and the number of columns it occupies on the screen.
+     */
+    uint32_t offset;
+    uint16_t length;
+    uint16_t width;
+
+    /**
+     * The offset of the character's colour within the `colours` of
+     * the line.
+     */
+    uint32_t colour;
+
+} COLOUR_CHAR;
+
+
+/**
+ * A run of consecutive characters of a parsed line, all drawn in the same
+ * colour.  A run of plain ASCII characters occupies consecutive bytes of
+ * the `text` of the line, a column each, so it may be drawn at once.
+ */
+typedef struct _COLOUR_RUN
+{
+    /**
+     * The offset of the first character of the run within the `chars`
+     * of the line, and the number of characters.
+     */
+    uint32_t first;
+    uint32_t count;
+
+    /**
+     * The offset of the run's colour within the `colours` of the line.
+     */
+    uint32_t colour;
+
+    /**
+     * Is every character of the run plain ASCII?
+     */
+    bool ascii;
+
+} COLOUR_RUN;
+
+
+/**
+ * A line of text which has been parsed into characters, and their colours.
+ *
+ * Rather than allocating a string for each character the bytes of every
+ * character are held, consecutively, in `text`, and each colour used
+ * upon the line is stored just once in `colours`.  A line may be cleared
+ * and parsed into again, reusing the memory it already holds.
+ */
+typedef struct _COLOURED_LINE
+{
+    /**
+     * The text of every character, with tabs expanded.
+     */
+    std::string text;
+
+    /**
+     * The distinct colours used by the line.
+     */
+    std::vector < std::string > colours;
+
+    /**
+     * The characters of the line, in order.
+     */
+    std::vector < COLOUR_CHAR > chars;
+
+    /**
+     * The characters of the line, grouped into runs.
+     */
+    std::vector < COLOUR_RUN > runs;
+
+    /**
+     * The number of columns the whole line occupies.
+     */
+    uint32_t width;
+
+} COLOURED_LINE;
+
+
 
 class CColourString
 {
 public:
 
+    /**
+     * Parse a string into its characters, and their colours, in a single
+     * pass over the input.
+     *
+     * The result replaces the previous content of `out`.
+     */
+    static void parse_line(const std::string &input, int tab_width, COLOURED_LINE &out);
+
+    /**
+     * Return the parsed form of the given string, from our cache of
+     * recently parsed lines if possible.
+     *
+     * Lines are redrawn unchanged far more often than they change, so
+     * most of the time this avoids parsing entirely.
+     */
+    static std::shared_ptr<const COLOURED_LINE> parse_cached(const std::string &input, int tab_width);
+
+    /**
+     * Return the parsed form of the given text, which needn't be
+     * terminated, from our cache if possible.
+     *
+     * The text is only copied into a string if it isn't cached.
+     */
+    static std::shared_ptr<const COLOURED_LINE> parse_cached(const char *data, size_t len, int tab_width);
+
+    /**
+     * The number of lookups which were satisfied by our cache, and
+     * which weren't.
+     */
+    static size_t cache_hits();
+    static size_t cache_misses();
+
     /**
      * Parse a string into an array of "string + colour" pairs,
      * which will be useful for drawing strings.
@@ -193,6 +193,127 @@ void TestTabWidth(CuTest * tc)
     }
 }
 
+
+/**
+ * Format a parsed line as "colour:text" runs, for easy comparison.
+ */
+static std::string runs(const std::string &input)
+{
+    COLOURED_LINE line;
+    CColourString::parse_line(input, 8, line);
+
+    std::string out;
+    std::string prev;
+
+    for (COLOUR_CHAR chr : line.chars)
+    {
+        std::string colour = line.colours[chr.colour];
+
+        if (out.empty() || colour != prev)
+        {
+            if (! out.empty())
+                out += ",";
+
+            out += colour + ":";
+            prev = colour;
+        }
+
+        out += line.text.substr(chr.offset, chr.length);
+    }
+
+    return (out);
+}
+
+
+/**
+ * Test colour markup is split into runs.
+ */
+void TestColourMarkup(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "", runs("$[RED]").c_str());
+    CuAssertStrEquals(tc, "RED:red", runs("$[RED]red").c_str());
+    CuAssertStrEquals(tc, "white:plain,RED:red,blue|bold:blue",
+                      runs("plain$[RED]red$[blue|bold]blue").c_str());
+
+    /*
+     * Escaped markup is drawn literally, in the current colour.
+     */
+    CuAssertStrEquals(tc, "RED:a$[BLUE]b", runs("$[RED]a$[#BLUE]b").c_str());
+    CuAssertStrEquals(tc, "white:$[BLUE]b", runs("$[#BLUE]b").c_str());
+
+    /*
+     * Things which aren't markup are left alone.
+     */
+    CuAssertStrEquals(tc, "white:$[] $[RED $[1]", runs("$[] $[RED $[1]").c_str());
+    CuAssertStrEquals(tc, "white:$[a,RED:b]", runs("$[a$[RED]b]").c_str());
+    CuAssertStrEquals(tc, "white:cost $5", runs("cost $5").c_str());
+
+    /*
+     * A colour may be used more than once, but is only stored once.
+     */
+    COLOURED_LINE line;
+    CColourString::parse_line("$[RED]a$[BLUE]b$[RED]c", 8, line);
+    CuAssertIntEquals(tc, 3, line.chars.size());
+    CuAssertIntEquals(tc, 3, line.colours.size());
+    CuAssertIntEquals(tc, line.chars[0].colour, line.chars[2].colour);
+}
+
+
+/**
+ * Test the cache of parsed lines.
+ */
+void TestColourCache(CuTest * tc)
+{
+    size_t misses = CColourString::cache_misses();
+    size_t hits   = CColourString::cache_hits();
+
+    std::shared_ptr<const COLOURED_LINE> one = CColourString::parse_cached("$[RED]cached", 8);
+    std::shared_ptr<const COLOURED_LINE> two = CColourString::parse_cached("$[RED]cached", 8);
+
+    CuAssertTrue(tc, one == two);
+    CuAssertIntEquals(tc, misses + 1, CColourString::cache_misses());
+    CuAssertIntEquals(tc, hits + 1, CColourString::cache_hits());
+
+    /*
+     * The tab-width forms part of the key.
+     */
+    std::shared_ptr<const COLOURED_LINE> tab = CColourString::parse_cached("$[RED]cached", 4);
+    CuAssertTrue(tc, one != tab);
+    CuAssertIntEquals(tc, 6, one->chars.size());
+}
+
+
+/**
+ * Test characters are grouped into runs of ASCII, and other, text.
+ */
+void TestColourRuns(CuTest * tc)
+{
+    COLOURED_LINE line;
+    CColourString::parse_line("ab\tc$[RED]d\xc3\xa9" "f", 2, line);
+
+    CuAssertIntEquals(tc, 8, line.chars.size());
+    CuAssertIntEquals(tc, 4, line.runs.size());
+    CuAssertIntEquals(tc, 8, line.width);
+
+    CuAssertIntEquals(tc, 0, line.runs[0].first);
+    CuAssertIntEquals(tc, 5, line.runs[0].count);
+    CuAssertTrue(tc, line.runs[0].ascii);
+
+    CuAssertIntEquals(tc, 5, line.runs[1].first);
+    CuAssertIntEquals(tc, 1, line.runs[1].count);
+    CuAssertTrue(tc, line.runs[1].ascii);
+    CuAssertTrue(tc, line.runs[0].colour != line.runs[1].colour);
+
+    CuAssertIntEquals(tc, 6, line.runs[2].first);
+    CuAssertIntEquals(tc, 1, line.runs[2].count);
+    CuAssertTrue(tc, ! line.runs[2].ascii);
+    CuAssertIntEquals(tc, 2, line.chars[6].length);
+
+    CuAssertIntEquals(tc, 7, line.runs[3].first);
+    CuAssertTrue(tc, line.runs[3].ascii);
+}
+
+
 CuSuite *
 coloured_string_getsuite()
 {
@@ -203,5 +324,8 @@ coloured_string_getsuite()
     SUITE_ADD_TEST(suite, TestStringPartLength);
     SUITE_ADD_TEST(suite, TestSimpleMultiByte);
     SUITE_ADD_TEST(suite, TestTabWidth);
+    SUITE_ADD_TEST(suite, TestColourMarkup);
+    SUITE_ADD_TEST(suite, TestColourCache);
+    SUITE_ADD_TEST(suite, TestColourRuns);
     return suite;
 }
@@ -0,0 +1,188 @@
+/*
+ * compression.cc - Reading, and writing, compressed message-files.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+#include "compression.h"
+
+
+/*
+ * Is the file open upon the given descriptor compressed?
+ */
+bool CCompression::is_compressed(int fd)
+{
+    unsigned char magic[2];
+
+    if (pread(fd, magic, sizeof(magic), 0) != (ssize_t) sizeof(magic))
+        return false;
+
+    return ((magic[0] == 0x1f) && (magic[1] == 0x8b));
+}
+
+
+/*
+ * Is the given file compressed?
+ */
+bool CCompression::is_compressed(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return false;
+
+    bool compressed = is_compressed(fd);
+    close(fd);
+    return (compressed);
+}
+
+
+/*
+ * Read, and decompress, the given file.
+ */
+bool CCompression::read(int fd, std::string &out, size_t max)
+{
+    z_stream zs = z_stream();
+
+    /*
+     * Adding 16 to the window-size accepts only a gzip header.
+     */
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+        return false;
+
+    std::vector<unsigned char> in(64 * 1024);
+    std::vector<unsigned char> buf(64 * 1024);
+    size_t wanted = (max == 0) ? (size_t) - 1 : out.size() + max;
+    off_t offset = 0;
+    bool ok = true;
+    bool done = false;
+
+    while (! done && (out.size() < wanted))
+    {
+        ssize_t len = pread(fd, &in[0], in.size(), offset);
+
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            ok = false;
+            break;
+        }
+
+        if (len == 0)
+            break;
+
+        offset += len;
+        zs.next_in  = &in[0];
+        zs.avail_in = len;
+
+        while ((zs.avail_in > 0) && (out.size() < wanted))
+        {
+            zs.next_out  = &buf[0];
+            zs.avail_out = buf.size();
+
+            int ret = inflate(&zs, Z_NO_FLUSH);
+
+            if ((ret != Z_OK) && (ret != Z_STREAM_END) && (ret != Z_BUF_ERROR))
+            {
+                ok = false;
+                done = true;
+                break;
+            }
+
+            out.append((const char *) &buf[0], buf.size() - zs.avail_out);
+
+            /*
+             * A file may hold several compressed members, one after
+             * another, whose contents are concatenated.
+             */
+            if (ret == Z_STREAM_END)
+            {
+                if (zs.avail_in == 0)
+                    break;
+
+                inflateReset(&zs);
+            }
+        }
+    }
+
+    inflateEnd(&zs);
+    return (ok);
+}
+
+
+/*
+ * Write a compressed copy of the given file.
+ */
+bool CCompression::compress(const std::string &src, const std::string &dst, int level)
+{
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (in == -1)
+        return false;
+
+    std::string mode = "wb" + std::to_string(level);
+    gzFile out = gzopen(dst.c_str(), mode.c_str());
+
+    if (out == NULL)
+    {
+        close(in);
+        return false;
+    }
+
+    std::vector<char> buf(64 * 1024);
+    bool ok = true;
+
+    while (true)
+    {
+        ssize_t len = ::read(in, &buf[0], buf.size());
+
+        if (len == 0)
+            break;
+
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            ok = false;
+            break;
+        }
+
+        if (gzwrite(out, &buf[0], len) != len)
+        {
+            ok = false;
+            break;
+        }
+    }
+
+    close(in);
+
+    if (gzclose(out) != Z_OK)
+        ok = false;
+
+    if (! ok)
+        unlink(dst.c_str());
+
+    return (ok);
+}
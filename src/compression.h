@@ -0,0 +1,74 @@
+/*
+ * compression.h - Reading, and writing, compressed message-files.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stddef.h>
+#include <string>
+
+
+/**
+ * The compression level used when none is configured.
+ */
+#define COMPRESSION_LEVEL 6
+
+
+/**
+ * Messages within maildirs may be stored gzip-compressed, as they are
+ * by Dovecot's zlib plugin.
+ *
+ * Compressed messages are recognized by their content, rather than by
+ * their names, as a message can never begin with the gzip magic.  So
+ * their names, and flags, are those of any other message, and they may
+ * be renamed, or copied between maildirs, without being decompressed.
+ *
+ * GMime decompresses messages as they're parsed, so this class holds
+ * only what is needed elsewhere - all of which is safe to call from
+ * any thread.
+ */
+class CCompression
+{
+public:
+
+    /**
+     * Is the file open upon the given descriptor compressed?
+     *
+     * The position of the descriptor is unchanged.
+     */
+    static bool is_compressed(int fd);
+
+    /**
+     * Is the given file compressed?
+     */
+    static bool is_compressed(const std::string &path);
+
+    /**
+     * Read, and decompress, the file open upon the given descriptor,
+     * appending at least `max` bytes of its content to `out`, or all of
+     * it if `max` is zero.  The descriptor is not closed.
+     */
+    static bool read(int fd, std::string &out, size_t max = 0);
+
+    /**
+     * Write a compressed copy of the file `src` to `dst`.
+     */
+    static bool compress(const std::string &src, const std::string &dst,
+                         int level = COMPRESSION_LEVEL);
+};
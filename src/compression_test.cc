@@ -0,0 +1,120 @@
+/*
+ * compression_test.cc - Test-cases for our compressed message-files.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fcntl.h>
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "compression.h"
+#include "CuTest.h"
+
+
+/**
+ * Create a file.
+ */
+static void create(std::string path, std::string content)
+{
+    std::fstream fs;
+    fs.open(path, std::fstream::out);
+    fs << content;
+    fs.close();
+}
+
+
+/**
+ * Read the given file, decompressing it.
+ */
+static std::string decompress(std::string path, size_t max = 0)
+{
+    std::string out;
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd != -1)
+    {
+        CCompression::read(fd, out, max);
+        close(fd);
+    }
+
+    return (out);
+}
+
+
+/**
+ * Test compressing, and decompressing, files.
+ */
+void TestCompressionRoundTrip(CuTest * tc)
+{
+    char tmpl[] = "/tmp/compress.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(tmpl) != NULL);
+
+    std::string prefix = tmpl;
+    std::string plain  = prefix + "/plain";
+    std::string packed = prefix + "/packed";
+
+    std::string message = "Subject: test\n\n";
+
+    for (int i = 0; i < 20000; i++)
+        message += "Line " + std::to_string(i) + " of the body.\n";
+
+    create(plain, message);
+
+    CuAssertTrue(tc, ! CCompression::is_compressed(plain));
+    CuAssertTrue(tc, ! CCompression::is_compressed(prefix + "/missing"));
+
+    CuAssertTrue(tc, CCompression::compress(plain, packed));
+    CuAssertTrue(tc, CCompression::is_compressed(packed));
+    CuAssertTrue(tc, decompress(packed) == message);
+
+    /*
+     * Part of the content may be read, such as the headers.
+     */
+    std::string head = decompress(packed, 16);
+    CuAssertTrue(tc, head.size() >= 16);
+    CuAssertTrue(tc, head.size() < message.size());
+    CuAssertTrue(tc, message.compare(0, head.size(), head) == 0);
+
+    /*
+     * Files holding several compressed members are read entirely.
+     */
+    std::string cmd = "cat " + packed + " " + packed + " > " + prefix + "/twice";
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+    CuAssertTrue(tc, decompress(prefix + "/twice") == message + message);
+
+    /*
+     * Empty files are neither compressed, nor fail to compress.
+     */
+    create(prefix + "/empty", "");
+    CuAssertTrue(tc, ! CCompression::is_compressed(prefix + "/empty"));
+    CuAssertTrue(tc, CCompression::compress(prefix + "/empty", prefix + "/empty.gz"));
+    CuAssertTrue(tc, decompress(prefix + "/empty.gz").empty());
+
+    cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+CuSuite *
+compression_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestCompressionRoundTrip);
+    return suite;
+}
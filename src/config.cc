@@ -23,6 +23,23 @@
 
 
 
+/*
+ * The generation of the next CConfig instance.
+ */
+static uint64_t g_config_generation = 0;
+
+
+/*
+ * Constructor.
+ */
+CConfigKey::CConfigKey(std::string name)
+{
+    m_name       = name;
+    m_slot       = NULL;
+    m_generation = 0;
+}
+
+
 /*
  * The constructor for the singleton CConfig class.
  *
@@ -32,6 +49,13 @@
  */
 CConfig::CConfig()
 {
+    m_generation = ++g_config_generation;
+    m_changes    = 0;
+
+    m_batch_depth = 0;
+    m_delivering  = false;
+    m_batch_id    = 0;
+
     set("global.mode", "maildir", false);
 
     set("index.limit", "all", false);
@@ -140,6 +164,37 @@ std::vector < std::string > CConfig::keys()
 }
 
 
+/*
+ * Find where the value of the given key-handle is stored.
+ */
+CConfigEntry *&CConfig::slot(CConfigKey &key)
+{
+    if ((key.m_slot == NULL) || (key.m_generation != m_generation))
+    {
+        key.m_slot       = &m_entries[key.m_name];
+        key.m_generation = m_generation;
+    }
+
+    return (*key.m_slot);
+}
+
+
+/*
+ * Allocate a new entry, of the given type, for the named key.
+ */
+CConfigEntry *CConfig::new_entry(const std::string &name, configType type)
+{
+    CConfigEntry *x = (CConfigEntry *) malloc(sizeof(CConfigEntry));
+
+    if (x == NULL)
+        throw "Memory allocation failure";
+
+    x->name = new std::string(name);
+    x->type = type;
+    return (x);
+}
+
+
 /*
  * Set the given key to the single string-value.
  *
@@ -147,30 +202,89 @@ std::vector < std::string > CConfig::keys()
  */
 void CConfig::set(std::string name, std::string val, bool notify)
 {
-    /*
-     * Keep a reference to the old value.
-     */
-    CConfigEntry *old = m_entries[name] ;
+    set_string(m_entries[name], name, val, notify);
+}
+
+
+/*
+ * Set the given key to the single int-value.
+ *
+ * This replaces any prior value which might have been stored under that key.
+ */
+void CConfig::set(std::string name, int val, bool notify)
+{
+    set_integer(m_entries[name], name, val, notify);
+}
+
+
+/*
+ * Set the given key to the array of strings.
+ *
+ * This replaces any prior value which might have been stored under that key.
+ */
+void CConfig::set(std::string name, std::vector < std::string > entries, bool notify)
+{
+    set_array(m_entries[name], name, entries, notify);
+}
+
+
+/*
+ * Set the given key-handle to the single string-value.
+ */
+void CConfig::set(CConfigKey &key, const std::string &val, bool notify)
+{
+    set_string(slot(key), key.m_name, val, notify);
+}
+
+
+/*
+ * Set the given key-handle to the single int-value.
+ */
+void CConfig::set(CConfigKey &key, int val, bool notify)
+{
+    set_integer(slot(key), key.m_name, val, notify);
+}
+
+
+/*
+ * Store a string-value in the given slot.
+ */
+void CConfig::set_string(CConfigEntry *&slot, const std::string &name, const std::string &val, bool notify)
+{
+    CConfigEntry *old = slot;
 
     /*
-     * Create the new the new entry.
+     * If the type is unchanged update the value in-place, unless it is
+     * unchanged too.  Watchers are shown a copy of the old entry.
      */
-    CConfigEntry *x = (CConfigEntry *) malloc(sizeof(CConfigEntry));
+    if (old && (old->type == CONFIG_STRING))
+    {
+        if (*old->value.str == val)
+            return;
 
-    if (x == NULL)
-        throw "Memory allocation failure";
+        std::string previous(val);
+        previous.swap(*old->value.str);
+
+        if (notify)
+        {
+            CConfigEntry copy = *old;
+            copy.value.str = &previous;
+            notify_watchers(name, &copy);
+        }
+
+        return;
+    }
 
     /*
-     * Store the data
+     * Create the new the new entry.
      */
-    x->name = new std::string(name);
-    x->type = CONFIG_STRING;
+    CConfigEntry *x = new_entry(name, CONFIG_STRING);
     x->value.str = new std::string(val);
 
     /*
      * Store the entry.
      */
-    m_entries[name] = x;
+    slot = x;
 
     /*
      * Notify our global state of the variable change.
@@ -185,38 +299,45 @@ void CConfig::set(std::string name, std::string val, bool notify)
 }
 
 
-
 /*
- * Set the given key to the single int-value.
- *
- * This replaces any prior value which might have been stored under that key.
+ * Store an integer-value in the given slot.
  */
-void CConfig::set(std::string name, int val, bool notify)
+void CConfig::set_integer(CConfigEntry *&slot, const std::string &name, int val, bool notify)
 {
-    /*
-     * Keep a reference to the old value.
-     */
-    CConfigEntry *old = m_entries[name] ;
+    CConfigEntry *old = slot;
 
     /*
-     * Create the new the new entry.
+     * If the type is unchanged update the value in-place, unless it is
+     * unchanged too.  Watchers are shown a copy of the old entry.
      */
-    CConfigEntry *x = (CConfigEntry *) malloc(sizeof(CConfigEntry));
+    if (old && (old->type == CONFIG_INTEGER))
+    {
+        if (*old->value.value == val)
+            return;
 
-    if (x == NULL)
-        throw "Memory allocation failure";
+        int previous = *old->value.value;
+        *old->value.value = val;
+
+        if (notify)
+        {
+            CConfigEntry copy = *old;
+            copy.value.value = &previous;
+            notify_watchers(name, &copy);
+        }
+
+        return;
+    }
 
     /*
-     * Store the data
+     * Create the new the new entry.
      */
-    x->name = new std::string(name);
-    x->type = CONFIG_INTEGER;
+    CConfigEntry *x = new_entry(name, CONFIG_INTEGER);
     x->value.value = new int(val);
 
     /*
      * Store the entry.
      */
-    m_entries[name] = x;
+    slot = x;
 
     /*
      * Notify our global state of the variable change.
@@ -232,45 +353,44 @@ void CConfig::set(std::string name, int val, bool notify)
 
 
 /*
- * Set the given key to the array of strings.
- *
- * This replaces any prior value which might have been stored under that key.
+ * Store an array-value in the given slot.
  */
-void CConfig::set(std::string name, std::vector < std::string > entries, bool notify)
+void CConfig::set_array(CConfigEntry *&slot, const std::string &name, const std::vector < std::string > &entries, bool notify)
 {
+    CConfigEntry *old = slot;
 
     /*
-     * Keep a reference to the old value.
+     * If the type is unchanged update the value in-place, unless it is
+     * unchanged too.  Watchers are shown a copy of the old entry.
      */
-    CConfigEntry *old = m_entries[name] ;
+    if (old && (old->type == CONFIG_ARRAY))
+    {
+        if (*old->value.array == entries)
+            return;
 
-    /*
-     * Create the new entry.
-     */
-    CConfigEntry *x = (CConfigEntry *) malloc(sizeof(CConfigEntry));
+        std::vector < std::string > previous(entries);
+        previous.swap(*old->value.array);
 
-    if (x == NULL)
-        throw "Memory allocation failure";
+        if (notify)
+        {
+            CConfigEntry copy = *old;
+            copy.value.array = &previous;
+            notify_watchers(name, &copy);
+        }
 
-    /*
-     * Store the data.
-     */
-    x->name = new std::string(name);
-    x->type = CONFIG_ARRAY;
-    x->value.array = new std::vector < std::string >;
+        return;
+    }
 
     /*
-     * Copy the string-values.
+     * Create the new entry.
      */
-    for (auto it = entries.begin(); it != entries.end(); ++it)
-    {
-        x->value.array->push_back((*it));
-    }
+    CConfigEntry *x = new_entry(name, CONFIG_ARRAY);
+    x->value.array = new std::vector < std::string >(entries);
 
     /*
      * Add the entry.
      */
-    m_entries[name] = x;
+    slot = x;
 
     /*
      * Notify our global state of the variable change.
@@ -336,10 +456,198 @@ std::vector<std::string> CConfig::get_array(std::string name)
 }
 
 
-void CConfig::notify_watchers(std::string key_name, CConfigEntry *old_value)
+/*
+ * Get the value of the given key-handle, returning NULL on failure.
+ */
+CConfigEntry *CConfig::get(CConfigKey &key)
+{
+    return (slot(key));
+}
+
+
+/*
+ * Helper to get the integer-value of the given key-handle.
+ */
+int CConfig::get_integer(CConfigKey &key, int default_value)
 {
-    int max = views.size();
+    CConfigEntry *tmp = slot(key);
+
+    if (tmp && (tmp->type == CONFIG_INTEGER))
+        return (*tmp->value.value);
+
+    return (default_value);
+}
+
+
+/*
+ * Helper to get the string-value of the given key-handle.
+ */
+std::string CConfig::get_string(CConfigKey &key, std::string default_value)
+{
+    CConfigEntry *tmp = slot(key);
+
+    if (tmp && (tmp->type == CONFIG_STRING))
+        return (*tmp->value.str);
+
+    return (default_value);
+}
+
+
+/*
+ * Begin a batch of changes.
+ */
+void CConfig::begin_batch()
+{
+    if (m_batch_depth == 0)
+        m_batch_id += 1;
+
+    m_batch_depth += 1;
+}
+
+
+/*
+ * Commit a batch of changes, telling our observers of them.
+ */
+void CConfig::commit_batch()
+{
+    if (m_batch_depth == 0)
+        return;
+
+    m_batch_depth -= 1;
+
+    if (m_batch_depth > 0)
+        return;
+
+    /*
+     * Observers may begin batches of their own, so take the changes.
+     */
+    std::vector < std::pair < std::string, CConfigEntry * > > changes;
+    changes.swap(m_batch);
+    m_batch_keys.clear();
+
+    /*
+     * Drop the keys which were changed back, and find everything which
+     * is interested in the rest, in the order that they subscribed.
+     */
+    std::vector < std::pair < std::string, CConfigEntry * > > changed;
+    std::vector < Observer * > interested;
+
+    for (auto &change : changes)
+    {
+        if (same_value(change.second, get(change.first)))
+        {
+            delete_entry(change.second);
+            continue;
+        }
+
+        changed.push_back(change);
+        m_changes += 1;
+
+        for (Observer *obs : observers(change.first))
+        {
+            if (std::find(interested.begin(), interested.end(), obs) == interested.end())
+                interested.push_back(obs);
+        }
+    }
+
+    /*
+     * Each observer is told of all its changes, and completes whatever
+     * work they require, before the next.
+     */
+    m_delivering = true;
+
+    for (Observer *obs : interested)
+    {
+        for (auto &change : changed)
+        {
+            const std::vector < Observer * > &current = observers(change.first);
+
+            if (std::find(current.begin(), current.end(), obs) != current.end())
+                obs->update(change.first, change.second);
+        }
+
+        obs->batch_complete();
+    }
+
+    m_delivering = false;
+
+    for (auto &change : changed)
+        delete_entry(change.second);
+}
+
+
+/*
+ * Return a copy of the given entry.
+ */
+CConfigEntry *CConfig::copy_entry(CConfigEntry *entry)
+{
+    if (entry == NULL)
+        return (NULL);
+
+    CConfigEntry *x = new_entry(*entry->name, entry->type);
+
+    if (entry->type == CONFIG_STRING)
+        x->value.str = new std::string(*entry->value.str);
+    else if (entry->type == CONFIG_INTEGER)
+        x->value.value = new int(*entry->value.value);
+    else if (entry->type == CONFIG_ARRAY)
+        x->value.array = new std::vector < std::string >(*entry->value.array);
+    else
+        throw "Unknown config-type!";
+
+    return (x);
+}
+
+
+/*
+ * Do the given entries hold the same value?
+ */
+bool CConfig::same_value(CConfigEntry *a, CConfigEntry *b)
+{
+    if ((a == NULL) || (b == NULL))
+        return (a == b);
+
+    if (a->type != b->type)
+        return false;
+
+    if (a->type == CONFIG_STRING)
+        return (*a->value.str == *b->value.str);
+
+    if (a->type == CONFIG_INTEGER)
+        return (*a->value.value == *b->value.value);
+
+    return (*a->value.array == *b->value.array);
+}
+
+
+/*
+ * Notify each of our watchers of the change to the given key.
+ */
+void CConfig::notify_watchers(const std::string &key_name, CConfigEntry *old_value)
+{
+    /*
+     * Within a batch we only record the value the key held before the
+     * batch began.
+     */
+    if (m_batch_depth > 0)
+    {
+        if (m_batch_keys.find(key_name) == m_batch_keys.end())
+        {
+            m_batch_keys[key_name] = m_batch.size();
+            m_batch.push_back(std::make_pair(key_name, copy_entry(old_value)));
+        }
+
+        return;
+    }
+
+    m_changes += 1;
+
+    /*
+     * Observers may subscribe to more keys as they're updated, which
+     * would invalidate the list we're given, so take a copy.
+     */
+    std::vector < Observer * > interested = observers(key_name);
 
-    for (int i = 0; i < max; i++)
-        views[i]->update(key_name, old_value);
+    for (Observer *obs : interested)
+        obs->update(key_name, old_value);
 }
@@ -19,8 +19,10 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "observer.h"
 #include "singleton.h"
@@ -66,14 +68,69 @@ struct CConfigEntry
 
 
 
+/**
+ * A handle upon a single configuration key, for keys which are read,
+ * or set, frequently - such as those used each time the screen is drawn.
+ *
+ * The key is found the first time the handle is used, thereafter it is
+ * used without hashing its name, or constructing any strings.  Handles
+ * remain valid if their key is deleted, or the CConfig instance is
+ * replaced.
+ */
+class CConfigKey
+{
+public:
+    /**
+     * Constructor.
+     */
+    CConfigKey(std::string name = "");
+
+    /**
+     * The name of our key.
+     */
+    const std::string &name() const
+    {
+        return (m_name);
+    };
+
+private:
+
+    friend class CConfig;
+
+    /**
+     * The name of our key.
+     */
+    std::string m_name;
+
+    /**
+     * Where the value of our key is stored, once we've found it.
+     */
+    CConfigEntry **m_slot;
+
+    /**
+     * The generation of the CConfig instance `m_slot` belongs to.
+     */
+    uint64_t m_generation;
+};
+
+
+
 /**
  * This is a singleton class which is used to get/set configuration
  * values.
  *
  * It also implements the Subject interface of the Observer design-pattern,
- * allowing other objects to listen to changes.  We broadcast change events
- * when the value of a given key has changed.  Each broadcast contains only
- * the name of the key which has been set/updated.
+ * allowing other objects to listen to changes.  We send change events
+ * when the value of a given key has changed, to the observers which have
+ * subscribed to that key, or to a prefix of it, or to every key.  Each
+ * event contains only the name of the key which has been set/updated.
+ *
+ * Setting a key to the value it already holds broadcasts nothing, and
+ * values of an unchanged type are updated in-place.
+ *
+ * Changes may be batched, between `begin_batch` and `commit_batch`, in
+ * which case observers are told of each changed key once the batch is
+ * committed, with the value it held before the batch began.
  */
 class CConfig : public Singleton<CConfig>, public Subject
 {
@@ -115,6 +172,35 @@ public:
      */
     void set(std::string name, std::vector < std::string > entries, bool notify  = true);
 
+    /**
+     * Get the value associated with the given key-handle.
+     */
+    CConfigEntry *get(CConfigKey &key);
+
+    /**
+     * Set the given key-handle to contain the specified string value.
+     */
+    void set(CConfigKey &key, const std::string &value, bool notify = true);
+
+    /**
+     * Set the given key-handle to contain the specified integer value.
+     */
+    void set(CConfigKey &key, int value, bool notify = true);
+
+    /**
+     * Helper to get the integer-value of the given key-handle.
+     *
+     * If the value is not found the supplied default will be used instead.
+     */
+    int get_integer(CConfigKey &key, int default_value = 0);
+
+    /**
+     * Helper to get the string-value of the given key-handle.
+     *
+     * If the value is not found the supplied default will be used instead.
+     */
+    std::string get_string(CConfigKey &key, std::string default_value = "");
+
     /**
      * Helper to get the array-value of a named key.
      */
@@ -139,6 +225,54 @@ public:
      */
     void remove_all();
 
+    /**
+     * Begin a batch of changes.  Batches may be nested, observers are
+     * told of the changes once the outermost is committed.
+     */
+    void begin_batch();
+
+    /**
+     * Commit a batch of changes.
+     *
+     * Each observer is told of each changed key it is interested in,
+     * once, and then has its `batch_complete` method called.  Keys
+     * which were changed, and then changed back, are not reported.
+     */
+    void commit_batch();
+
+    /**
+     * Are changes being batched?
+     */
+    bool in_batch()
+    {
+        return (m_batch_depth > 0);
+    };
+
+    /**
+     * An ID for the current, or most recent, batch.
+     */
+    uint64_t batch_id()
+    {
+        return (m_batch_id);
+    };
+
+    /**
+     * Are we telling observers about the changes of a batch?
+     */
+    bool delivering_batch()
+    {
+        return (m_delivering);
+    };
+
+    /**
+     * The number of changes we've broadcast, so that callers may tell
+     * when something has changed without subscribing to every key.
+     */
+    uint64_t changes()
+    {
+        return (m_changes);
+    };
+
 
 
     /**
@@ -154,14 +288,106 @@ public:
 
 private:
 
+    /**
+     * Find where the value of the given key-handle is stored.
+     */
+    CConfigEntry *&slot(CConfigKey &key);
+
+    /**
+     * Allocate a new entry, of the given type, for the named key.
+     */
+    CConfigEntry *new_entry(const std::string &name, configType type);
+
+    /**
+     * Store the given string, integer, or array, value in the given
+     * slot.  If the value is unchanged nothing happens, if the type is
+     * unchanged the existing entry is updated.
+     */
+    void set_string(CConfigEntry *&slot, const std::string &name, const std::string &value, bool notify);
+    void set_integer(CConfigEntry *&slot, const std::string &name, int value, bool notify);
+    void set_array(CConfigEntry *&slot, const std::string &name, const std::vector < std::string > &value, bool notify);
+
+    /**
+     * Return a copy of the given entry, which may be NULL.
+     */
+    CConfigEntry *copy_entry(CConfigEntry *entry);
+
+    /**
+     * Do the given entries, either of which may be NULL, hold the same
+     * value?
+     */
+    static bool same_value(CConfigEntry *a, CConfigEntry *b);
+
     /**
      * Notify any watchers that the value of a configuration-key
      * has changed.  This is implemented via the Observer pattern.
      */
-    void notify_watchers(std::string key_name, CConfigEntry *old_value);
+    void notify_watchers(const std::string &key_name, CConfigEntry *old_value);
 
     /**
      * The actual map which stores our configured names & value pairs.
+     *
+     * Entries are never erased, deleted keys hold NULL, because key-handles
+     * refer to them directly.
      */
     std::unordered_map <std::string, CConfigEntry * >m_entries;
+
+    /**
+     * Distinguishes this instance from any before it, so that key-handles
+     * can tell when they need to find their key again.
+     */
+    uint64_t m_generation;
+
+    /**
+     * The number of changes we've broadcast.
+     */
+    uint64_t m_changes;
+
+    /**
+     * The depth of nested batches, and whether we're delivering the
+     * changes of one.
+     */
+    int m_batch_depth;
+    bool m_delivering;
+
+    /**
+     * The ID of the current, or most recent, batch.
+     */
+    uint64_t m_batch_id;
+
+    /**
+     * The keys changed by the current batch, in the order they were
+     * first changed, with copies of the values they held beforehand.
+     */
+    std::vector < std::pair < std::string, CConfigEntry * > > m_batch;
+
+    /**
+     * The position of each key within `m_batch`.
+     */
+    std::unordered_map < std::string, size_t > m_batch_keys;
+};
+
+
+/**
+ * Batch the configuration changes made during the lifetime of this
+ * object, committing them when it is destroyed.
+ */
+class CConfigBatch
+{
+public:
+    /**
+     * Constructor.
+     */
+    CConfigBatch()
+    {
+        CConfig::instance()->begin_batch();
+    };
+
+    /**
+     * Destructor.
+     */
+    ~CConfigBatch()
+    {
+        CConfig::instance()->commit_batch();
+    };
 };
@@ -17,6 +17,12 @@
  */
 
 
+#include <algorithm>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "config.h"
 #include "lua.h"
 
@@ -32,40 +38,46 @@
  *   Config:set( "global.from", "Steve Kemp <steve@example.com>" )
  *</code>
  *
+ * Several changes may be made together, so that whatever they require
+ * only happens once:
+ *
+ *<code>
+ *   Config:batch( function() Config:set("a", 1) Config:set("b", 2) end )
+ *</code>
+ *
+ * Functions may be subscribed to changes of a key, or of every key
+ * beginning with a prefix ending in ".":
+ *
+ *<code>
+ *   Config:subscribe( "index.sort", function(name, old) ... end )<br/>
+ *   Config:subscribe( "imap.", function(name, old) ... end )
+ *</code>
+ *
  */
 
 
 /**
- * Implementation of `Config:get`
+ * The functions subscribed to each key, or prefix, as references into
+ * the registry.
  */
-int l_Config_get(lua_State * l)
-{
-    CLuaLog("l_Config_get");
-
-    /*
-     * The key to get.
-     */
-    const char *name = luaL_checkstring(l, 2);
+static std::unordered_map < std::string, std::vector < int > > g_subscriptions;
 
-    /*
-     * Get the entry - and test it has a value.
-     */
-    CConfig *foo = CConfig::instance();
-    CConfigEntry *x = foo->get(name);
 
+/**
+ * Push the value of the given entry onto the stack, or nil.
+ */
+static void push_entry(lua_State * l, CConfigEntry *x)
+{
     if (x == NULL)
     {
         lua_pushnil(l);
-        return 1;
     }
-
-    /*
-     * Does this configuration value hold a string?
-     */
-    if (x->type == CONFIG_STRING)
+    else if (x->type == CONFIG_STRING)
     {
+        /*
+         * Does this configuration value hold a string?
+         */
         lua_pushstring(l, x->value.str->c_str());
-        return 1;
     }
     else if (x->type == CONFIG_INTEGER)
     {
@@ -73,7 +85,6 @@ int l_Config_get(lua_State * l)
          * Does this configuration value hold an integer?
          */
         lua_pushnumber(l, *x->value.value);
-        return 1;
     }
     else if (x->type == CONFIG_ARRAY)
     {
@@ -96,17 +107,63 @@ int l_Config_get(lua_State * l)
 
             i += 1;
         }
-
-        return 1;
     }
     else
     {
         throw ("Invalid get-type");
-        return 0;
     }
 }
 
 
+/**
+ * Implementation of `Config:batch`
+ *
+ * Call the given function, deferring the notification of the changes it
+ * makes until it returns.  Errors it raises are raised again, once the
+ * changes have been committed.
+ */
+int l_Config_batch(lua_State * l)
+{
+    CLuaLog("l_Config_batch");
+
+    luaL_checktype(l, 2, LUA_TFUNCTION);
+
+    CConfig *foo = CConfig::instance();
+    foo->begin_batch();
+
+    lua_pushvalue(l, 2);
+    int erred = lua_pcall(l, 0, 0, 0);
+
+    foo->commit_batch();
+
+    if (erred)
+        return (lua_error(l));
+
+    return 0;
+}
+
+
+/**
+ * Implementation of `Config:get`
+ */
+int l_Config_get(lua_State * l)
+{
+    CLuaLog("l_Config_get");
+
+    /*
+     * The key to get.
+     */
+    const char *name = luaL_checkstring(l, 2);
+
+    /*
+     * Get the entry, and return its value.
+     */
+    CConfig *foo = CConfig::instance();
+    push_entry(l, foo->get(name));
+    return 1;
+}
+
+
 /**
  * Implementation of `Config:keys`
  */
@@ -203,6 +260,125 @@ int l_Config_set(lua_State * l)
 }
 
 
+/**
+ * Implementation of `Config:subscribe`
+ *
+ * Call the given function, with the name and previous value of the key,
+ * whenever the named key changes.  If the name ends with "." then the
+ * function is called when any key which begins with it changes.
+ *
+ * If the function returns false it is unsubscribed.
+ */
+int l_Config_subscribe(lua_State * l)
+{
+    CLuaLog("l_Config_subscribe");
+
+    std::string name = luaL_checkstring(l, 2);
+    luaL_checktype(l, 3, LUA_TFUNCTION);
+
+    lua_pushvalue(l, 3);
+    g_subscriptions[name].push_back(luaL_ref(l, LUA_REGISTRYINDEX));
+
+    /*
+     * Have our interpreter told of changes to the key.
+     */
+    CConfig *foo = CConfig::instance();
+    CLua *lua    = CLua::instance();
+
+    if ((! name.empty()) && (name.back() == '.'))
+        foo->subscribe_prefix(lua, name);
+    else
+        foo->subscribe(lua, name);
+
+    return 0;
+}
+
+
+/**
+ * Call the functions subscribed to the given key, or to a prefix of it.
+ *
+ * Errors raised by a function are passed to `on_error`.
+ */
+void RunConfigSubscribers(lua_State * l, const std::string &key, CConfigEntry *old)
+{
+    if (g_subscriptions.empty())
+        return;
+
+    /*
+     * The functions subscribed to the whole key, and to each of the
+     * prefixes it has.
+     */
+    std::vector < std::string > names;
+
+    for (size_t dot = key.find('.'); dot != std::string::npos; dot = key.find('.', dot + 1))
+        names.push_back(key.substr(0, dot + 1));
+
+    names.push_back(key);
+
+    for (const std::string &name : names)
+    {
+        auto it = g_subscriptions.find(name);
+
+        if (it == g_subscriptions.end())
+            continue;
+
+        /*
+         * Functions might subscribe, or unsubscribe, as we call them.
+         */
+        std::vector < int > refs = it->second;
+
+        for (int ref : refs)
+        {
+            lua_rawgeti(l, LUA_REGISTRYINDEX, ref);
+            lua_pushstring(l, key.c_str());
+            push_entry(l, old);
+
+            if (lua_pcall(l, 2, 1, 0) != 0)
+            {
+                std::string err = lua_tostring(l, -1);
+                lua_pop(l, 1);
+
+                CLua *lua = CLua::instance();
+                lua->on_error(err);
+                continue;
+            }
+
+            if (lua_isboolean(l, -1) && ! lua_toboolean(l, -1))
+            {
+                std::vector < int > &current = g_subscriptions[name];
+                current.erase(std::remove(current.begin(), current.end(), ref), current.end());
+                luaL_unref(l, LUA_REGISTRYINDEX, ref);
+            }
+
+            lua_pop(l, 1);
+        }
+    }
+}
+
+
+/**
+ * Implementation of assignment to fields of `Config`.
+ *
+ * Defining `Config.key_changed` means it must be told of changes to
+ * every key, so we watch for that.
+ */
+int l_Config_newindex(lua_State * l)
+{
+    CLuaLog("l_Config_newindex");
+
+    const char *name = lua_tostring(l, 2);
+
+    if ((name != NULL) && (strcmp(name, "key_changed") == 0) && lua_isfunction(l, 3))
+    {
+        CLua *lua = CLua::instance();
+        lua->watch_all_keys();
+    }
+
+    lua_rawset(l, 1);
+    return 0;
+}
+
+
 /**
  * Register the global `Config` object to the Lua environment, and
  * setup our public methods upon which the user may operate.
@@ -211,9 +387,11 @@ void InitConfig(lua_State * l)
 {
     luaL_Reg sFooRegs[] =
     {
+        {"batch", l_Config_batch},
         {"get", l_Config_get},
         {"keys", l_Config_keys},
         {"set", l_Config_set},
+        {"subscribe", l_Config_subscribe},
         {NULL, NULL}
     };
     luaL_newmetatable(l, "luaL_CConfig");
@@ -228,6 +406,15 @@ void InitConfig(lua_State * l)
 
     lua_pushvalue(l, -1);
     lua_setfield(l, -1, "__index");
+
+    /*
+     * Watch for the definition of `Config.key_changed`.
+     */
+    lua_newtable(l);
+    lua_pushcfunction(l, l_Config_newindex);
+    lua_setfield(l, -2, "__newindex");
+    lua_setmetatable(l, -2);
+
     lua_setglobal(l, "Config");
 
 }
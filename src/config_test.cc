@@ -18,6 +18,7 @@
 
 
 
+#include <algorithm>
 #include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
@@ -145,6 +146,253 @@ void TestKeyDeletion(CuTest * tc)
 }
 
 
+/**
+ * Count the changes we're notified of.
+ */
+class CCountingObserver : public Observer
+{
+public:
+    CCountingObserver(Subject *subject) : Observer(subject)
+    {
+        count     = 0;
+        completed = 0;
+    };
+
+    CCountingObserver()
+    {
+        count     = 0;
+        completed = 0;
+    };
+
+    void update(std::string name, CConfigEntry *old)
+    {
+        count += 1;
+
+        last_name = name;
+        last_old  = "";
+
+        if (old && (old->type == CONFIG_STRING))
+            last_old = *old->value.str;
+    };
+
+    void batch_complete()
+    {
+        completed += 1;
+    };
+
+    int count;
+    int completed;
+    std::string last_name;
+    std::string last_old;
+};
+
+
+/**
+ * Test that key-handles read, and write, the keys they name.
+ */
+void TestConfigKey(CuTest * tc)
+{
+    CConfig *config = CConfig::instance();
+    CuAssertPtrNotNull(tc, config);
+
+    CConfigKey key("handle.test");
+    CuAssertStrEquals(tc, "handle.test", key.name().c_str());
+
+    /*
+     * Missing keys give the default.
+     */
+    CuAssertIntEquals(tc, 17, config->get_integer(key, 17));
+    CuAssertPtrEquals(tc, NULL, config->get(key));
+
+    /*
+     * Values set by name are seen via the handle, and vice versa.
+     */
+    config->set("handle.test", 3);
+    CuAssertIntEquals(tc, 3, config->get_integer(key));
+
+    config->set(key, 4);
+    CuAssertIntEquals(tc, 4, config->get_integer("handle.test"));
+
+    config->set(key, "four");
+    CuAssertStrEquals(tc, "four", config->get_string(key).c_str());
+    CuAssertIntEquals(tc, 0, config->get_integer(key));
+    CuAssertStrEquals(tc, "four", config->get_string("handle.test").c_str());
+
+    /*
+     * Handles survive the deletion of their key.
+     */
+    config->delete_key("handle.test");
+    CuAssertPtrEquals(tc, NULL, config->get(key));
+
+    config->set("handle.test", "back");
+    CuAssertStrEquals(tc, "back", config->get_string(key).c_str());
+}
+
+
+/**
+ * Test that only real changes are broadcast.
+ */
+void TestConfigNotify(CuTest * tc)
+{
+    CConfig *config = CConfig::instance();
+    CuAssertPtrNotNull(tc, config);
+
+    /*
+     * There's no way to detach an observer, so it must outlive us.
+     */
+    static CCountingObserver *observer = new CCountingObserver(config);
+    observer->count = 0;
+
+    config->set("notify.test", 1);
+    CuAssertIntEquals(tc, 1, observer->count);
+
+    config->set("notify.test", 1);
+    CuAssertIntEquals(tc, 1, observer->count);
+
+    config->set("notify.test", 2);
+    CuAssertIntEquals(tc, 2, observer->count);
+
+    /*
+     * Changing the type is a change, even to the "same" value.
+     */
+    config->set("notify.test", "2");
+    CuAssertIntEquals(tc, 3, observer->count);
+
+    config->set("notify.test", "2");
+    CuAssertIntEquals(tc, 3, observer->count);
+
+    std::vector<std::string> array = { "a", "b" };
+    config->set("notify.test", array);
+    config->set("notify.test", array);
+    CuAssertIntEquals(tc, 4, observer->count);
+
+    array.push_back("c");
+    config->set("notify.test", array);
+    CuAssertIntEquals(tc, 5, observer->count);
+    CuAssertIntEquals(tc, 3, config->get_array("notify.test").size());
+
+    /*
+     * Silent changes are silent.
+     */
+    config->set("notify.test", 9, false);
+    config->set("notify.test", 10, false);
+    CuAssertIntEquals(tc, 5, observer->count);
+    CuAssertIntEquals(tc, 10, config->get_integer("notify.test"));
+
+    config->delete_key("notify.test");
+}
+
+
+/**
+ * Test that observers are told only of the keys they subscribe to.
+ */
+void TestConfigSubscribe(CuTest * tc)
+{
+    CConfig *config = CConfig::instance();
+    CuAssertPtrNotNull(tc, config);
+
+    static CCountingObserver *key    = new CCountingObserver();
+    static CCountingObserver *prefix = new CCountingObserver();
+
+    config->subscribe(key, "subscribe.one");
+    config->subscribe_prefix(prefix, "subscribe.");
+
+    config->set("subscribe.one", 1);
+    config->set("subscribe.two", 1);
+    config->set("unsubscribed", 1);
+
+    CuAssertIntEquals(tc, 1, key->count);
+    CuAssertIntEquals(tc, 2, prefix->count);
+
+    /*
+     * Observers which match more than once are told once.
+     */
+    config->subscribe(prefix, "subscribe.one");
+    config->set("subscribe.one", 2);
+
+    CuAssertIntEquals(tc, 2, key->count);
+    CuAssertIntEquals(tc, 3, prefix->count);
+
+    /*
+     * Observers are told in the order they first subscribed.
+     */
+    const std::vector < Observer * > &observers = config->observers("subscribe.one");
+    auto first  = std::find(observers.begin(), observers.end(), key);
+    auto second = std::find(observers.begin(), observers.end(), prefix);
+
+    CuAssertTrue(tc, first != observers.end());
+    CuAssertTrue(tc, second != observers.end());
+    CuAssertTrue(tc, first < second);
+}
+
+
+/**
+ * Test that batched changes are delivered once, when committed.
+ */
+void TestConfigBatch(CuTest * tc)
+{
+    CConfig *config = CConfig::instance();
+    CuAssertPtrNotNull(tc, config);
+
+    static CCountingObserver *observer = new CCountingObserver();
+    config->subscribe_prefix(observer, "batch.");
+
+    config->set("batch.one", "before");
+    config->set("batch.two", "before");
+    CuAssertIntEquals(tc, 2, observer->count);
+
+    observer->count = 0;
+
+    config->begin_batch();
+    CuAssertTrue(tc, config->in_batch());
+
+    config->set("batch.one", "during");
+    config->set("batch.one", "after");
+
+    /*
+     * A key changed, then changed back, isn't a change.
+     */
+    config->set("batch.two", "during");
+    config->set("batch.two", "before");
+
+    /*
+     * Nested batches are committed with the outermost.
+     */
+    {
+        CConfigBatch nested;
+        config->set("batch.three", "new");
+    }
+
+    CuAssertIntEquals(tc, 0, observer->count);
+    CuAssertStrEquals(tc, "after", config->get_string("batch.one").c_str());
+
+    config->commit_batch();
+    CuAssertTrue(tc, ! config->in_batch());
+
+    CuAssertIntEquals(tc, 2, observer->count);
+    CuAssertIntEquals(tc, 1, observer->completed);
+
+    /*
+     * Changes are delivered in the order keys first changed, each with
+     * the value from before the batch.
+     */
+    CuAssertStrEquals(tc, "batch.three", observer->last_name.c_str());
+    CuAssertStrEquals(tc, "", observer->last_old.c_str());
+
+    observer->count = 0;
+
+    {
+        CConfigBatch batch;
+        config->set("batch.one", "later");
+    }
+
+    CuAssertIntEquals(tc, 1, observer->count);
+    CuAssertStrEquals(tc, "batch.one", observer->last_name.c_str());
+    CuAssertStrEquals(tc, "after", observer->last_old.c_str());
+    CuAssertIntEquals(tc, 2, observer->completed);
+}
+
+
 CuSuite *
 config_getsuite()
 {
@@ -152,5 +400,9 @@ config_getsuite()
     SUITE_ADD_TEST(suite, TestEmptyConfig);
     SUITE_ADD_TEST(suite, TestKeynames);
     SUITE_ADD_TEST(suite, TestKeyDeletion);
+    SUITE_ADD_TEST(suite, TestConfigKey);
+    SUITE_ADD_TEST(suite, TestConfigNotify);
+    SUITE_ADD_TEST(suite, TestConfigSubscribe);
+    SUITE_ADD_TEST(suite, TestConfigBatch);
     return suite;
 }
@@ -21,6 +21,7 @@
 #include <dirent.h>
 
 #include "directory.h"
+#include "syscalls.h"
 #include "util.h"
 
 /*
@@ -30,7 +31,7 @@ bool CDirectory::exists(std::string path)
 {
     struct stat sb;
 
-    if ((stat(path.c_str(), &sb) == 0))
+    if ((CSyscalls::stat(path.c_str(), &sb) == 0))
         return true;
     else
         return false;
@@ -47,7 +48,7 @@ std::vector < std::string > CDirectory::entries(std::string prefix)
     dirent *de;
     DIR *dp;
 
-    if ((dp = opendir(prefix.c_str())) != NULL)
+    if ((dp = CSyscalls::opendir(prefix.c_str())) != NULL)
     {
         result.push_back(prefix);
 
@@ -72,6 +73,60 @@ std::vector < std::string > CDirectory::entries(std::string prefix)
 }
 
 
+/*
+ * Is this entry a directory?
+ */
+bool CDirectoryEntry::is_directory() const
+{
+    return (type == DT_DIR);
+}
+
+
+/*
+ * Is the type of this entry unknown?
+ */
+bool CDirectoryEntry::is_unknown() const
+{
+    return (type == DT_UNKNOWN);
+}
+
+
+/*
+ * Append the entries of the given directory, excluding "." and "..",
+ * to the specified vector.
+ */
+bool CDirectory::list(std::string path, std::vector < CDirectoryEntry > &out, size_t hint)
+{
+    DIR *dp = CSyscalls::opendir(path.c_str());
+
+    if (dp == NULL)
+        return false;
+
+    out.reserve(out.size() + hint);
+
+    dirent *de;
+
+    while ((de = readdir(dp)) != NULL)
+    {
+        const char *name = de->d_name;
+
+        if ((name[0] == '.') &&
+                ((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0'))))
+            continue;
+
+        CDirectoryEntry entry;
+        entry.name  = name;
+        entry.type  = de->d_type;
+        entry.inode = de->d_ino;
+
+        out.push_back(std::move(entry));
+    }
+
+    closedir(dp);
+    return true;
+}
+
+
 /*
  * Make the directory, including any parents.
  */
@@ -22,6 +22,46 @@
 
 #include <vector>
 #include <string>
+#include <sys/types.h>
+
+
+/**
+ * A single entry from a directory-listing, as returned by `readdir`.
+ */
+class CDirectoryEntry
+{
+public:
+
+    /**
+     * The name of the entry, relative to the directory.
+     */
+    std::string name;
+
+    /**
+     * The type of the entry, as one of the `DT_*` constants.
+     *
+     * **NOTE**: Some filesystems always report `DT_UNKNOWN`, in which
+     * case the caller must `stat` the entry if the type matters.
+     */
+    unsigned char type;
+
+    /**
+     * The inode number of the entry.
+     */
+    ino_t inode;
+
+    /**
+     * Is this entry a directory?
+     *
+     * Returns false for `DT_UNKNOWN`.
+     */
+    bool is_directory() const;
+
+    /**
+     * Is the type of this entry unknown?
+     */
+    bool is_unknown() const;
+};
 
 /**
  *
@@ -46,6 +86,16 @@ public:
      */
     static std::vector < std::string > entries(std::string prefix);
 
+    /**
+     * Append the entries of the given directory, excluding "." and "..",
+     * to the specified vector - in the order the kernel returns them.
+     *
+     * No system-calls beyond those of `readdir` are made, and
+     * storage for `hint` entries is reserved up-front.  Returns false
+     * if the directory could not be opened.
+     */
+    static bool list(std::string path, std::vector < CDirectoryEntry > &out, size_t hint = 0);
+
     /**
      * Make the directory, including any parents.
      */
@@ -18,13 +18,17 @@
 
 
 
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "allocations.h"
 #include "directory.h"
 #include "file.h"
+#include "syscalls.h"
 #include "CuTest.h"
 
 
@@ -64,6 +68,105 @@ void TestDirectoryEntries(CuTest * tc)
 }
 
 
+/**
+ * Test CDirectory::list()
+ */
+void TestDirectoryList(CuTest * tc)
+{
+#ifdef DEBUG
+    char *tmpl = strdup("blahXXXXXX");
+    std::string prefix = tmpnam(tmpl);
+
+    /*
+     * Listing a missing directory fails.
+     */
+    std::vector<CDirectoryEntry> entries;
+    CuAssertTrue(tc, !CDirectory::list(prefix, entries));
+    CuAssertIntEquals(tc, 0, entries.size());
+
+    /*
+     * Create a directory with a single file, and a single subdirectory.
+     */
+    CDirectory::mkdir_p(prefix + "/sub");
+
+    std::fstream fs;
+    fs.open(prefix + "/file",  std::fstream::out | std::fstream::app);
+    fs << "Gordon's alive!" << "\n";
+    fs.close();
+
+    CuAssertTrue(tc, CDirectory::list(prefix, entries, 16));
+    CuAssertIntEquals(tc, 2, entries.size());
+    CuAssertTrue(tc, entries.capacity() >= 16);
+
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        CDirectoryEntry entry = (*it);
+        CuAssertTrue(tc, (entry.name == "file") || (entry.name == "sub"));
+        CuAssertTrue(tc, entry.inode != 0);
+
+        if (!entry.is_unknown())
+            CuAssertTrue(tc, entry.is_directory() == (entry.name == "sub"));
+    }
+
+    /*
+     * Cleanup
+     */
+    CFile::delete_file(prefix + "/file");
+    rmdir(std::string(prefix + "/sub").c_str());
+    rmdir(prefix.c_str());
+    CuAssertTrue(tc, !CDirectory::exists(prefix));
+#endif
+}
+
+
+/**
+ * Test that listing a large directory stays within its budget of calls,
+ * and allocations, whatever the number of entries.
+ */
+void TestDirectoryListBudget(CuTest * tc)
+{
+    char tmpl[] = "/tmp/budget.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string prefix = tmpl;
+    const int count = 10000;
+
+    for (int i = 0; i < count; i++)
+    {
+        std::string name = prefix + "/" + std::to_string(1450000000 + i) + ".M1P1.example.com:2,S";
+        int fd = ::open(name.c_str(), O_WRONLY | O_CREAT, 0644);
+        CuAssertTrue(tc, fd != -1);
+        close(fd);
+    }
+
+    std::vector<CDirectoryEntry> entries;
+
+    uint64_t calls  = CSyscalls::total();
+    uint64_t allocs = CAllocations::count();
+
+    CuAssertTrue(tc, CDirectory::list(prefix, entries, count));
+    CuAssertIntEquals(tc, count, entries.size());
+
+    /*
+     * The directory is opened once, and nothing is stat'd.
+     */
+    CuAssertIntEquals(tc, 1, CSyscalls::total() - calls);
+
+    /*
+     * One allocation for each name, beyond the list itself - which are
+     * only counted in the debug build.
+     */
+#ifdef DEBUG
+    CuAssertTrue(tc, CAllocations::count() - allocs <= (uint64_t) count + 4);
+#else
+    (void) allocs;
+#endif
+
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
 /**
  * Test CDirectory::exists()
  */
@@ -168,6 +271,8 @@ directory_getsuite()
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, TestDirectoryEntries);
     SUITE_ADD_TEST(suite, TestDirectoryExists);
+    SUITE_ADD_TEST(suite, TestDirectoryList);
+    SUITE_ADD_TEST(suite, TestDirectoryListBudget);
     SUITE_ADD_TEST(suite, TestDirectoryMkdir);
     return suite;
 }
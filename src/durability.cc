@@ -0,0 +1,353 @@
+/*
+ * durability.cc - Making changes to our maildirs reach the disk.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "durability.h"
+
+
+/*
+ * Constructor.
+ */
+CDurability::CDurability()
+{
+    m_stop     = false;
+    m_interval = DURABILITY_INTERVAL;
+    m_holds    = 0;
+    m_syncing  = 0;
+    m_syncs    = 0;
+}
+
+
+/*
+ * Destructor.
+ */
+CDurability::~CDurability()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stop = true;
+    }
+
+    m_wake.notify_all();
+
+    if (m_thread.joinable())
+        m_thread.join();
+
+    flush();
+}
+
+
+/*
+ * The mode configured by `maildir.durability`.
+ */
+int CDurability::mode()
+{
+    std::string mode = CConfig::instance()->get_string("maildir.durability", "group");
+
+    if (mode == "none")
+        return (DURABILITY_NONE);
+
+    if (mode == "strict")
+        return (DURABILITY_STRICT);
+
+    return (DURABILITY_GROUP);
+}
+
+
+/*
+ * The content of the given file has been written.
+ */
+void CDurability::written(const std::string &file)
+{
+    record(file, false);
+}
+
+
+/*
+ * The entries of the given directory have changed.
+ */
+void CDurability::changed(const std::string &dir)
+{
+    record(dir, true);
+}
+
+
+/*
+ * The given file has been renamed.
+ */
+void CDurability::renamed(const std::string &src, const std::string &dst)
+{
+    std::string from = src.substr(0, src.rfind('/'));
+    std::string to   = dst.substr(0, dst.rfind('/'));
+
+    changed(to);
+
+    if (from != to)
+        changed(from);
+}
+
+
+/*
+ * Note that the given path must be synced.
+ */
+void CDurability::record(const std::string &path, bool directory)
+{
+    int m = mode();
+
+    if (m == DURABILITY_NONE)
+        return;
+
+    CConfig *config = CConfig::instance();
+    int interval = config->get_integer("maildir.durability_interval", DURABILITY_INTERVAL);
+    size_t batch = config->get_integer("maildir.durability_batch", DURABILITY_BATCH);
+
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    if (directory)
+        m_dirs.insert(path);
+    else
+        m_files.insert(path);
+
+    /*
+     * Strict syncs are made now, unless a bulk operation is holding
+     * them until it is done.
+     */
+    if (m == DURABILITY_STRICT)
+    {
+        if (m_holds > 0)
+            return;
+
+        lock.unlock();
+        flush();
+        return;
+    }
+
+    /*
+     * A group which is large enough is synced by whoever filled it,
+     * which also holds back bulk operations which outpace the disk.
+     */
+    if (m_files.size() + m_dirs.size() >= batch)
+    {
+        lock.unlock();
+        flush();
+        return;
+    }
+
+    m_interval = (interval > 0) ? interval : DURABILITY_INTERVAL;
+
+    if (! m_thread.joinable())
+        m_thread = std::thread(&CDurability::run, this);
+
+    m_wake.notify_one();
+}
+
+
+/*
+ * Delay strict syncs.
+ */
+void CDurability::hold()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_holds++;
+}
+
+
+/*
+ * End a hold, syncing what waited for it.
+ */
+void CDurability::release()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        if (m_holds > 0)
+            m_holds--;
+
+        if (m_holds > 0)
+            return;
+    }
+
+    if (mode() == DURABILITY_STRICT)
+        flush();
+}
+
+
+/*
+ * Sync everything which is waiting.
+ */
+bool CDurability::flush()
+{
+    std::unordered_set<std::string> files;
+    std::unordered_set<std::string> dirs;
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        take(files, dirs);
+    }
+
+    return (sync(files, dirs));
+}
+
+
+/*
+ * Wait until everything recorded has been synced.
+ */
+void CDurability::wait()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while ((m_files.size() + m_dirs.size() + m_syncing) > 0)
+    {
+        /*
+         * Nothing else will sync paths which are held, or which were
+         * recorded without our thread running, so we do.
+         */
+        if ((m_syncing == 0) && ((m_holds > 0) || ! m_thread.joinable() || m_stop))
+        {
+            lock.unlock();
+            flush();
+            lock.lock();
+            continue;
+        }
+
+        m_synced.wait(lock);
+    }
+}
+
+
+/*
+ * The number of paths waiting, or being synced.
+ */
+size_t CDurability::pending()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return (m_files.size() + m_dirs.size() + m_syncing);
+}
+
+
+/*
+ * The number of syncs made.
+ */
+uint64_t CDurability::syncs()
+{
+    return (m_syncs);
+}
+
+
+/*
+ * Take the paths waiting to be synced, counting them as being synced.
+ */
+void CDurability::take(std::unordered_set<std::string> &files,
+                       std::unordered_set<std::string> &dirs)
+{
+    files.swap(m_files);
+    dirs.swap(m_dirs);
+
+    m_syncing += files.size() + dirs.size();
+}
+
+
+/*
+ * Sync the given files, then directories.
+ *
+ * Paths which have gone since they were recorded, such as those of
+ * messages renamed again, or deleted, need no sync.
+ */
+bool CDurability::sync(const std::unordered_set<std::string> &files,
+                       const std::unordered_set<std::string> &dirs)
+{
+    bool ok = true;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const std::unordered_set<std::string> &paths = (pass == 0) ? files : dirs;
+        int flags = (pass == 0) ? O_RDONLY : (O_RDONLY | O_DIRECTORY);
+
+        for (const std::string &path : paths)
+        {
+            int fd = open(path.c_str(), flags | O_CLOEXEC);
+
+            if (fd == -1)
+            {
+                if (errno != ENOENT)
+                    ok = false;
+
+                continue;
+            }
+
+            if (fsync(fd) != 0)
+                ok = false;
+
+            close(fd);
+            m_syncs++;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_syncing -= files.size() + dirs.size();
+    }
+
+    m_synced.notify_all();
+
+    return (ok);
+}
+
+
+/*
+ * Sync each group, once it has waited for our interval.
+ */
+void CDurability::run()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (! m_stop)
+    {
+        if (m_files.empty() && m_dirs.empty())
+        {
+            m_wake.wait(lock);
+            continue;
+        }
+
+        /*
+         * Let the group gather, unless we're stopping - in which case
+         * our destructor syncs it.
+         */
+        auto stopping = [this]()
+        {
+            return (m_stop);
+        };
+
+        if (m_wake.wait_for(lock, std::chrono::milliseconds(m_interval), stopping))
+            break;
+
+        std::unordered_set<std::string> files;
+        std::unordered_set<std::string> dirs;
+        take(files, dirs);
+
+        lock.unlock();
+        sync(files, dirs);
+        lock.lock();
+    }
+}
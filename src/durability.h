@@ -0,0 +1,224 @@
+/*
+ * durability.h - Making changes to our maildirs reach the disk.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+#include "singleton.h"
+
+
+/**
+ * The modes of `maildir.durability`.
+ */
+#define DURABILITY_NONE   0
+#define DURABILITY_GROUP  1
+#define DURABILITY_STRICT 2
+
+
+/**
+ * The defaults for `maildir.durability_interval`, in milliseconds, and
+ * `maildir.durability_batch`.
+ */
+#define DURABILITY_INTERVAL 100
+#define DURABILITY_BATCH    1000
+
+
+/**
+ * This singleton is told of the files we write, and the directories
+ * whose entries we change - by renaming messages as their flags change,
+ * or saving them - and makes sure those changes reach the disk, as
+ * `maildir.durability` asks:
+ *
+ * * `none` leaves it to the kernel.
+ *
+ * * `group`, the default, collects the files and directories changed
+ *   and syncs each once, `maildir.durability_interval` milliseconds
+ *   after the first change, or as soon as `maildir.durability_batch`
+ *   are waiting.  The syncs are made upon a thread of our own.
+ *
+ * * `strict` syncs each change before returning - or, within a bulk
+ *   operation which holds a `CDurableBatch`, once the operation ends.
+ *
+ * Files are always synced before directories, so that a message never
+ * appears with its content missing.
+ */
+class CDurability : public Singleton<CDurability>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CDurability();
+
+    /**
+     * Destructor, syncing anything still waiting.
+     */
+    ~CDurability();
+
+    /**
+     * The mode configured by `maildir.durability`.
+     */
+    static int mode();
+
+    /**
+     * The content of the given file has been written.
+     */
+    void written(const std::string &file);
+
+    /**
+     * The entries of the given directory have changed.
+     */
+    void changed(const std::string &dir);
+
+    /**
+     * The given file has been renamed, changing the entries of the
+     * directory of each name.
+     */
+    void renamed(const std::string &src, const std::string &dst);
+
+    /**
+     * Delay strict syncs until a matching `release()`.
+     */
+    void hold();
+
+    /**
+     * End a `hold()`, syncing what waited for it.
+     */
+    void release();
+
+    /**
+     * Sync everything which is waiting, now, returning false if any
+     * sync failed.
+     */
+    bool flush();
+
+    /**
+     * Wait until every file and directory recorded so far has been
+     * synced, syncing those which are held, or have no thread to sync
+     * them, ourselves.
+     */
+    void wait();
+
+    /**
+     * The number of files and directories waiting to be synced, or
+     * being synced.
+     */
+    size_t pending();
+
+    /**
+     * The number of syncs we've made.
+     */
+    uint64_t syncs();
+
+private:
+
+    /**
+     * Note that the given path must be synced.
+     */
+    void record(const std::string &path, bool directory);
+
+    /**
+     * Take the paths waiting to be synced, counting them as being
+     * synced.  The caller holds `m_lock`.
+     */
+    void take(std::unordered_set<std::string> &files,
+              std::unordered_set<std::string> &dirs);
+
+    /**
+     * Sync the given files, then directories.
+     */
+    bool sync(const std::unordered_set<std::string> &files,
+              const std::unordered_set<std::string> &dirs);
+
+    /**
+     * The body of our thread, which syncs each group.
+     */
+    void run();
+
+private:
+
+    /**
+     * The files and directories waiting to be synced.
+     */
+    std::unordered_set<std::string> m_files;
+    std::unordered_set<std::string> m_dirs;
+
+    /**
+     * Guards the above, and the state of our thread.
+     */
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+
+    /**
+     * The number of paths taken to be synced whose syncs haven't yet
+     * completed, and the signal that some have.
+     */
+    size_t m_syncing;
+    std::condition_variable m_synced;
+
+    /**
+     * Our thread, started once a group is first waiting, and whether it
+     * should stop.
+     */
+    std::thread m_thread;
+    bool m_stop;
+
+    /**
+     * How long a group waits, in milliseconds.
+     */
+    int m_interval;
+
+    /**
+     * The number of `hold()`s outstanding.
+     */
+    int m_holds;
+
+    /**
+     * The number of syncs made.
+     */
+    std::atomic<uint64_t> m_syncs;
+};
+
+
+/**
+ * Holds strict syncs for the duration of a bulk operation, so that each
+ * directory it changes is synced once.
+ */
+class CDurableBatch
+{
+public:
+    CDurableBatch()
+    {
+        CDurability::instance()->hold();
+    };
+
+    ~CDurableBatch()
+    {
+        CDurability::instance()->release();
+    };
+};
@@ -0,0 +1,123 @@
+/*
+ * durability_test.cc - Test-cases for our syncing of changes.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "config.h"
+#include "durability.h"
+#include "CuTest.h"
+
+
+/**
+ * Test each of our modes.
+ */
+void TestDurabilityModes(CuTest * tc)
+{
+    char tmpl[] = "/tmp/durable.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string dir  = tmpl;
+    std::string file = dir + "/message";
+
+    std::fstream fs;
+    fs.open(file, std::fstream::out);
+    fs << "Subject: test\n\nBody\n";
+    fs.close();
+
+    CConfig *config = CConfig::instance();
+    CDurability *durability = CDurability::instance();
+
+    /*
+     * Nothing is synced, or even remembered, without durability.
+     */
+    config->set("maildir.durability", "none", false);
+    uint64_t syncs = durability->syncs();
+
+    durability->written(file);
+    durability->changed(dir);
+    CuAssertIntEquals(tc, 0, durability->pending());
+    CuAssertIntEquals(tc, 0, durability->syncs() - syncs);
+
+    /*
+     * Strict syncs are made at once, unless held.
+     */
+    config->set("maildir.durability", "strict", false);
+
+    durability->written(file);
+    durability->changed(dir);
+    CuAssertIntEquals(tc, 0, durability->pending());
+    CuAssertIntEquals(tc, 2, durability->syncs() - syncs);
+
+    {
+        CDurableBatch batch;
+
+        for (int i = 0; i < 10; i++)
+            durability->renamed(file, dir + "/other");
+
+        CuAssertIntEquals(tc, 1, durability->pending());
+        CuAssertIntEquals(tc, 2, durability->syncs() - syncs);
+    }
+
+    CuAssertIntEquals(tc, 0, durability->pending());
+    CuAssertIntEquals(tc, 3, durability->syncs() - syncs);
+
+    /*
+     * Groups are synced after their interval, or once they're large
+     * enough.
+     */
+    config->set("maildir.durability", "group", false);
+    config->set("maildir.durability_interval", 20, false);
+    config->set("maildir.durability_batch", 3, false);
+
+    durability->written(file);
+    durability->changed(dir);
+    durability->changed(dir);
+    CuAssertIntEquals(tc, 2, durability->pending());
+
+    durability->wait();
+    CuAssertIntEquals(tc, 0, durability->pending());
+    CuAssertIntEquals(tc, 5, durability->syncs() - syncs);
+
+    config->set("maildir.durability_interval", 10000, false);
+
+    durability->written(file);
+    durability->written(dir + "/missing");
+    durability->changed(dir);
+    CuAssertIntEquals(tc, 0, durability->pending());
+    CuAssertIntEquals(tc, 7, durability->syncs() - syncs);
+
+    config->delete_key("maildir.durability");
+    config->delete_key("maildir.durability_interval");
+    config->delete_key("maildir.durability_batch");
+
+    unlink(file.c_str());
+    rmdir(tmpl);
+}
+
+
+CuSuite *
+durability_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestDurabilityModes);
+    return suite;
+}
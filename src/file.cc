@@ -19,16 +19,30 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
 #include <wordexp.h>
 
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
 #include "file.h"
+#include "syscalls.h"
 
 
 
@@ -39,7 +53,7 @@ bool CFile::exists(std::string path)
 {
     struct stat sb;
 
-    if ((stat(path.c_str(), &sb) == 0))
+    if ((CSyscalls::stat(path.c_str(), &sb) == 0))
         return true;
     else
         return false;
@@ -53,7 +67,7 @@ bool CFile::is_directory(std::string path)
 {
     struct stat sb;
 
-    if (stat(path.c_str(), &sb) < 0)
+    if (CSyscalls::stat(path.c_str(), &sb) < 0)
         return false;
 
     return (S_ISDIR(sb.st_mode));
@@ -102,31 +116,156 @@ std::string CFile::basename(std::string path)
  */
 bool CFile::copy(std::string src, std::string dst)
 {
-    std::ifstream isrc(src, std::ios::binary);
-    std::ofstream odst(dst, std::ios::binary);
+    int in = CSyscalls::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (in == -1)
+        return false;
+
+    struct stat sb;
+
+    if (fstat(in, &sb) != 0)
+    {
+        close(in);
+        return false;
+    }
+
+    int out = CSyscalls::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if (out == -1)
+    {
+        close(in);
+        return false;
+    }
+
+    bool ok = copy_fd(in, out, sb.st_size);
+
+    close(in);
+
+    if (close(out) != 0)
+        ok = false;
+
+    return (ok);
+}
+
+
+/*
+ * Copy the contents of one descriptor to another.
+ *
+ * We try the quickest way first: sharing the source's blocks if the
+ * filesystem supports reflinks, then having the kernel copy the data
+ * without it passing through us, and only then reading and writing it
+ * ourselves.  Each later method continues from wherever the previous
+ * one stopped.
+ */
+bool CFile::copy_fd(int in, int out, off_t size)
+{
+    off_t done = 0;
+
+#ifdef FICLONE
+
+    if (ioctl(out, FICLONE, in) == 0)
+        return true;
+
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 27)
+
+    while (done < size)
+    {
+        ssize_t n = copy_file_range(in, NULL, out, NULL, size - done, 0);
+
+        if (n <= 0)
+            break;
+
+        done += n;
+    }
+
+#endif
+#endif
+
+#ifdef __linux__
+
+    while (done < size)
+    {
+        off_t offset = done;
+        ssize_t n = sendfile(out, in, &offset, size - done);
+
+        if (n <= 0)
+            break;
+
+        done += n;
+    }
+
+#endif
+
+    /*
+     * The file might have grown since we looked, so read until the end.
+     */
+    if (lseek(in, done, SEEK_SET) == (off_t) - 1 ||
+            lseek(out, done, SEEK_SET) == (off_t) - 1)
+        return false;
+
+    static const size_t buffer_size = 1024 * 1024;
+    std::vector<char> buffer(buffer_size);
+
+    while (true)
+    {
+        ssize_t n = read(in, &buffer[0], buffer_size);
+
+        if (n == 0)
+            break;
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
 
-    std::istreambuf_iterator<char> begin_source(isrc);
-    std::istreambuf_iterator<char> end_source;
-    std::ostreambuf_iterator<char> begin_dest(odst);
+            return false;
+        }
 
-    std::copy(begin_source, end_source, begin_dest);
+        ssize_t written = 0;
 
-    isrc.close();
-    odst.close();
+        while (written < n)
+        {
+            ssize_t w = write(out, &buffer[written], n - written);
 
-    return (CFile::exists(dst));
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                return false;
+            }
+
+            written += w;
+        }
+    }
+
+    return true;
 }
 
 
 /*
  * Move a file.
+ *
+ * Files on different filesystems can't be renamed, so they are copied
+ * and the original removed.
  */
 bool CFile::move(std::string src, std::string dst)
 {
-    int ret = rename(src.c_str(), dst.c_str());
+    int ret = CSyscalls::rename(src.c_str(), dst.c_str());
 
-    assert(CFile::exists(dst));
-    assert(!CFile::exists(src));
+    if ((ret != 0) && (errno == EXDEV))
+    {
+        if (! CFile::copy(src, dst))
+        {
+            CFile::delete_file(dst);
+            return false;
+        }
+
+        return (CFile::delete_file(src));
+    }
 
     return (ret == 0);
 }
@@ -139,7 +278,7 @@ int CFile::size(std::string path)
 {
     struct stat sb;
 
-    if ((stat(path.c_str(), &sb) == 0))
+    if ((CSyscalls::stat(path.c_str(), &sb) == 0))
         return sb.st_size;
     else
         return -1;
@@ -147,65 +286,311 @@ int CFile::size(std::string path)
 
 
 /*
- * Return a sorted list of maildirs beneath the given prefix.
+ * A single pending directory in our maildir-discovery walk.
+ *
+ * We carry the directory handle along with the path where we can, so
+ * that children are opened relative to their parent via `openat`.  When
+ * too many handles are outstanding the `fd` is left as -1, and the path
+ * is opened from scratch once a worker gets around to it.
  */
-std::vector < std::string > CFile::get_all_maildirs(std::string prefix)
+typedef struct _scan_item
 {
-    std::vector < std::string > result;
+    std::string path;
+    int fd;
+} scan_item;
 
-    dirent *de;
-    DIR *dp;
 
-    dp = opendir(prefix.c_str());
+/*
+ * The state shared between the threads of a maildir-discovery walk.
+ *
+ * Each worker owns a deque, it pushes and pops work at the back of its
+ * own queue, and steals from the front of its siblings' queues when it
+ * runs dry.  `pending` counts directories which are queued or being
+ * processed, once it reaches zero the walk is complete.
+ *
+ * A worker which finds nothing to steal sleeps upon `idle` until more
+ * directories are `queued`, or the walk is complete.
+ */
+typedef struct _scan_state
+{
+    std::vector < std::deque < scan_item > > queues;
+    std::vector < std::mutex * > locks;
+    std::vector < std::vector < std::string > > found;
+    std::atomic < int > pending;
+    std::atomic < int > queued;
+    std::atomic < int > open_fds;
+    std::mutex idle_lock;
+    std::condition_variable idle;
+} scan_state;
+
+
+/*
+ * The maximum number of directory handles we'll hold open in queued items.
+ */
+#define SCAN_MAX_OPEN_FDS 256
+
+
+/*
+ * Is the directory `name`, relative to `dfd`, a maildir?
+ *
+ * The caller already knows `name` is a directory, so we only need to
+ * test for the three subdirectories.
+ */
+static bool scan_is_maildir(int dfd, std::string name)
+{
+    const char *subdirs[] = { "/cur", "/new", "/tmp" };
+    struct stat sb;
+
+    for (int i = 0; i < 3; i++)
+    {
+        std::string sub = name + subdirs[i];
+
+        if (CSyscalls::fstatat(dfd, sub.c_str(), &sb, 0) != 0)
+            return false;
+
+        if (!S_ISDIR(sb.st_mode))
+            return false;
+    }
+
+    return true;
+}
+
 
-    if (dp)
+/*
+ * Queue a directory for processing, by the given worker.
+ */
+static void scan_push(scan_state *state, int worker, scan_item item)
+{
+    state->pending++;
+
+    {
+        std::lock_guard < std::mutex > guard(*state->locks[worker]);
+        state->queues[worker].push_back(item);
+    }
+
+    {
+        std::lock_guard < std::mutex > guard(state->idle_lock);
+        state->queued++;
+    }
+
+    state->idle.notify_one();
+}
+
+
+/*
+ * Fetch some work for the given worker - first from its own queue, then
+ * by stealing from the other workers.
+ */
+static bool scan_pop(scan_state *state, int worker, scan_item &item)
+{
+    int count = state->queues.size();
+
+    for (int i = 0; i < count; i++)
+    {
+        int victim = (worker + i) % count;
+
+        std::lock_guard < std::mutex > guard(*state->locks[victim]);
+        std::deque < scan_item > &q = state->queues[victim];
+
+        if (q.empty())
+            continue;
+
+        if (victim == worker)
+        {
+            item = q.back();
+            q.pop_back();
+        }
+        else
+        {
+            item = q.front();
+            q.pop_front();
+        }
+
+        state->queued--;
+        return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Process a single directory: record each child-maildir we find, and
+ * queue every other subdirectory for further processing.
+ */
+static void scan_directory(scan_state *state, int worker, scan_item item)
+{
+    int dfd = item.fd;
+
+    if (dfd < 0)
+        dfd = CSyscalls::open(item.path.c_str(), O_RDONLY | O_DIRECTORY);
+    else
+        state->open_fds--;
+
+    if (dfd < 0)
+        return;
+
+    DIR *dp = fdopendir(dfd);
+
+    if (dp == NULL)
+    {
+        close(dfd);
+        return;
+    }
+
+    dirent *de;
+
+    while ((de = readdir(dp)) != NULL)
     {
-        if (CFile::is_maildir(prefix))
-            result.push_back(prefix);
+        if ((strcmp(de->d_name, ".") == 0) ||
+                (strcmp(de->d_name, "..") == 0))
+            continue;
+
+        /*
+         * Symlinks, files, and devices are skipped without a syscall,
+         * we only need to stat when the filesystem didn't tell us.
+         */
+        if (de->d_type == DT_UNKNOWN)
+        {
+            struct stat sb;
+
+            if ((CSyscalls::fstatat(dfd, de->d_name, &sb, 0) != 0) ||
+                    !S_ISDIR(sb.st_mode))
+                continue;
+        }
+        else if (de->d_type != DT_DIR)
+            continue;
+
+        std::string subdir_path = item.path + "/" + de->d_name;
 
-        while (true)
+        if (scan_is_maildir(dfd, de->d_name))
         {
-            de = readdir(dp);
+            state->found[worker].push_back(subdir_path);
+            continue;
+        }
+
+        scan_item child;
+        child.path = subdir_path;
+        child.fd   = -1;
+
+        /*
+         * The handle is counted before it is opened, so that workers
+         * racing for the last of them can't exceed our limit.
+         */
+        if (state->open_fds.fetch_add(1) < SCAN_MAX_OPEN_FDS)
+            child.fd = CSyscalls::openat(dfd, de->d_name, O_RDONLY | O_DIRECTORY);
 
-            if (de == NULL)
-                break;
+        if (child.fd < 0)
+            state->open_fds--;
 
-            if ((strcmp(de->d_name, ".") != 0) &&
-                    (strcmp(de->d_name, "..") != 0) &&
-                    ((de->d_type == DT_UNKNOWN) || (de->d_type == DT_DIR)))
+        scan_push(state, worker, child);
+    }
+
+    closedir(dp);
+}
+
+
+/*
+ * The body of each worker-thread in our discovery walk.
+ */
+static void scan_worker(scan_state *state, int worker)
+{
+    scan_item item;
+
+    while (true)
+    {
+        if (scan_pop(state, worker, item))
+        {
+            scan_directory(state, worker, item);
+
+            if (--state->pending == 0)
             {
-                std::string subdir_name = std::string(de->d_name);
-                std::string subdir_path =
-                    std::string(prefix + "/" + subdir_name);
-
-                if (CFile::is_maildir(subdir_path))
-                    result.push_back(subdir_path);
-                else
-                {
-                    if (subdir_name != "." && subdir_name != "..")
-                    {
-                        DIR *sdp = opendir(subdir_path.c_str());
-
-                        if (sdp)
-                        {
-                            closedir(sdp);
-                            std::vector < std::string > sub_maildirs;
-                            sub_maildirs = CFile::get_all_maildirs(subdir_path);
-
-                            for (std::string sub_maildir : sub_maildirs)
-                            {
-                                result.push_back(sub_maildir);
-                            }
-                        }
-                    }
-                }
+                std::lock_guard < std::mutex > guard(state->idle_lock);
+                state->idle.notify_all();
             }
+
+            continue;
         }
 
-        closedir(dp);
-        std::sort(result.begin(), result.end());
+        std::unique_lock < std::mutex > lock(state->idle_lock);
+
+        state->idle.wait(lock, [state]()
+        {
+            return ((state->queued > 0) || (state->pending == 0));
+        });
+
+        if (state->pending == 0)
+            return;
+    }
+}
+
+
+/*
+ * Return a sorted list of maildirs beneath the given prefix.
+ *
+ * The walk is shared between `threads` workers, if that is zero we
+ * pick a value based upon the number of CPUs available.
+ */
+std::vector < std::string > CFile::get_all_maildirs(std::string prefix, int threads)
+{
+    std::vector < std::string > result;
+
+    int dfd = CSyscalls::open(prefix.c_str(), O_RDONLY | O_DIRECTORY);
+
+    if (dfd < 0)
+        return result;
+
+    if (CFile::is_maildir(prefix))
+        result.push_back(prefix);
+
+    if (threads < 1)
+    {
+        threads = std::thread::hardware_concurrency();
+
+        if (threads < 1)
+            threads = 1;
+
+        if (threads > 16)
+            threads = 16;
+    }
+
+    scan_state state;
+    state.pending  = 0;
+    state.queued   = 0;
+    state.open_fds = 0;
+    state.queues.resize(threads);
+    state.found.resize(threads);
+
+    for (int i = 0; i < threads; i++)
+        state.locks.push_back(new std::mutex());
+
+    scan_item root;
+    root.path = prefix;
+    root.fd   = dfd;
+    state.open_fds++;
+    scan_push(&state, 0, root);
+
+    /*
+     * The calling thread is worker zero, so a single-threaded walk
+     * never spawns anything.
+     */
+    std::vector < std::thread > workers;
+
+    for (int i = 1; i < threads; i++)
+        workers.push_back(std::thread(scan_worker, &state, i));
+
+    scan_worker(&state, 0);
+
+    for (auto it = workers.begin(); it != workers.end(); ++it)
+        (*it).join();
+
+    for (int i = 0; i < threads; i++)
+    {
+        result.insert(result.end(), state.found[i].begin(), state.found[i].end());
+        delete state.locks[i];
     }
 
+    std::sort(result.begin(), result.end());
     return result;
 }
 
@@ -214,7 +599,7 @@ std::vector < std::string > CFile::get_all_maildirs(std::string prefix)
  */
 bool CFile::delete_file(std::string path)
 {
-    bool result = ::unlink(path.c_str());
+    bool result = CSyscalls::unlink(path.c_str());
     return (result);
 }
 
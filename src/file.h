@@ -22,6 +22,7 @@
 
 #include <vector>
 #include <string>
+#include <sys/types.h>
 
 
 /**
@@ -70,11 +71,14 @@ public:
 
     /**
      * Copy the given file.
+     *
+     * Where the kernel supports it the copy is a reflink, or is made
+     * without the data passing through our process.
      */
     static bool copy(std::string src, std::string dst);
 
     /**
-     * Move the given file.
+     * Move the given file, copying it if it must cross filesystems.
      */
     static bool move(std::string src, std::string dst);
 
@@ -86,7 +90,17 @@ public:
 
     /**
      * Return a sorted list of maildirs beneath the given prefix.
+     *
+     * The directory tree is walked by a pool of `threads` workers, if
+     * this is zero the pool is sized by the number of available CPUs.
      */
-    static std::vector < std::string > get_all_maildirs(std::string prefix);
+    static std::vector < std::string > get_all_maildirs(std::string prefix, int threads = 0);
+
+private:
+
+    /**
+     * Copy the contents of one descriptor, of the given size, to another.
+     */
+    static bool copy_fd(int in, int out, off_t size);
 
 };
@@ -73,9 +73,18 @@ int l_CFile_copy(lua_State * l)
     const char *src = lua_tostring(l, 2);
     const char *dst = lua_tostring(l, 3);
 
-    CFile::copy(src, dst);
+    if (src == NULL || dst == NULL)
+    {
+        lua_pushnil(l);
+        return 1;
+    }
 
-    return 0;
+    if (CFile::copy(src, dst))
+        lua_pushboolean(l , 1);
+    else
+        lua_pushboolean(l , 0);
+
+    return 1;
 }
 
 
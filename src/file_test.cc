@@ -20,12 +20,15 @@
 
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
 #include "directory.h"
 #include "file.h"
+#include "syscalls.h"
 #include "CuTest.h"
 
 
@@ -158,6 +161,57 @@ void TestFileCopy(CuTest * tc)
 }
 
 
+/**
+ * Test CFile::copy() with a file larger than our buffer, over the top
+ * of a longer file.
+ */
+void TestFileCopyLarge(CuTest * tc)
+{
+#ifdef DEBUG
+    char src[] = "/tmp/srcXXXXXX";
+    char dst[] = "/tmp/dstXXXXXX";
+
+    close(mkstemp(src));
+    close(mkstemp(dst));
+
+    /*
+     * The source is a little over three megabytes, the destination
+     * a little more than that.
+     */
+    std::string data;
+
+    for (int i = 0; data.size() < 3 * 1024 * 1024 + 17; i++)
+        data += std::to_string(i) + "\n";
+
+    std::fstream fs;
+    fs.open(src, std::fstream::out | std::fstream::binary);
+    fs << data;
+    fs.close();
+
+    fs.open(dst, std::fstream::out | std::fstream::binary);
+    fs << data << "Trailing data";
+    fs.close();
+
+    CuAssertTrue(tc, CFile::copy(src, dst));
+    CuAssertIntEquals(tc, (int)data.size(), CFile::size(dst));
+
+    std::ifstream in(dst, std::ios::binary);
+    std::string copied((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+
+    CuAssertTrue(tc, copied == data);
+
+    /*
+     * Copying a missing file fails.
+     */
+    CFile::delete_file(src);
+    CuAssertTrue(tc, ! CFile::copy(src, dst));
+
+    CFile::delete_file(dst);
+#endif
+}
+
+
 /**
  * Test CFile::exists()
  */
@@ -428,6 +482,94 @@ void TestFileMaildir(CuTest * tc)
 }
 
 
+/**
+ * Test CFile::get_all_maildirs() finds nested maildirs, regardless of
+ * the number of threads used.
+ */
+void TestFileAllMaildirs(CuTest * tc)
+{
+#ifdef DEBUG
+    /**
+     * Generate a temporary directory-name.
+     */
+    char *tmpl = strdup("blahXXXXXX");
+    char *filename = tmpnam(tmpl);
+    std::string p = std::string(filename);
+
+    /**
+     * Create some maildirs, one of which is nested beneath a
+     * plain directory.
+     */
+    const char *maildirs[] = { "/inbox", "/lists/debian", "/lists/lua", "/work" };
+
+    for (int i = 0; i < 4; i++)
+    {
+        std::string path = p + maildirs[i];
+        CDirectory::mkdir_p(path + "/cur");
+        CDirectory::mkdir_p(path + "/new");
+        CDirectory::mkdir_p(path + "/tmp");
+    }
+
+    /**
+     * A directory which is not a maildir shouldn't be returned.
+     */
+    CDirectory::mkdir_p(p + "/lists/empty");
+
+    for (int threads = 1; threads <= 4; threads++)
+    {
+        std::vector < std::string > found = CFile::get_all_maildirs(p, threads);
+        CuAssertIntEquals(tc, 4, found.size());
+
+        for (int i = 0; i < 4; i++)
+            CuAssertStrEquals(tc, (p + maildirs[i]).c_str(), found[i].c_str());
+    }
+
+    /**
+     * Cleanup.
+     */
+    std::string cmd = "rm -rf " + p;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+    CuAssertTrue(tc, !CFile::is_directory(p));
+#endif
+}
+
+
+/**
+ * Test that finding maildirs stays within its budget of calls for each
+ * directory found.
+ */
+void TestFileAllMaildirsBudget(CuTest * tc)
+{
+    char tmpl[] = "/tmp/budget.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string p = tmpl;
+    const int count = 200;
+
+    for (int i = 0; i < count; i++)
+    {
+        std::string path = p + "/folder" + std::to_string(i);
+        CDirectory::mkdir_p(path + "/cur");
+        CDirectory::mkdir_p(path + "/new");
+        CDirectory::mkdir_p(path + "/tmp");
+    }
+
+    uint64_t calls = CSyscalls::total();
+
+    std::vector < std::string > found = CFile::get_all_maildirs(p, 1);
+    CuAssertIntEquals(tc, count, found.size());
+
+    /*
+     * Each maildir costs a stat() of each of its three subdirectories,
+     * beyond the few calls made for their parent.
+     */
+    CuAssertTrue(tc, CSyscalls::total() - calls <= (uint64_t)(3 * count + 4));
+
+    std::string cmd = "rm -rf " + p;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
 /**
  * Test CFile::expand_path()
  */
@@ -474,8 +616,11 @@ CuSuite *
 file_getsuite()
 {
     CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestFileAllMaildirs);
+    SUITE_ADD_TEST(suite, TestFileAllMaildirsBudget);
     SUITE_ADD_TEST(suite, TestFileBasename);
     SUITE_ADD_TEST(suite, TestFileCopy);
+    SUITE_ADD_TEST(suite, TestFileCopyLarge);
     SUITE_ADD_TEST(suite, TestFileDirectory);
     SUITE_ADD_TEST(suite, TestFileExists);
     SUITE_ADD_TEST(suite, TestFileMaildir);
@@ -0,0 +1,241 @@
+/*
+ * format_template.cc - Compiled `string.interp`-style templates.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <stdlib.h>
+
+#include "format_template.h"
+#include "util.h"
+
+
+/*
+ * Is the given string non-empty, and made up only of digits?
+ */
+static bool all_digits(const std::string &s)
+{
+    if (s.empty())
+        return false;
+
+    for (char c : s)
+    {
+        if ((c < '0') || (c > '9'))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Constructor.
+ */
+CFormatTemplate::CFormatTemplate()
+{
+}
+
+
+/*
+ * Compile the given template.
+ */
+void CFormatTemplate::compile(const std::string &tmpl, const std::vector < std::string > &fields)
+{
+    m_ops.clear();
+    m_used.assign(fields.size(), false);
+
+    std::string literal;
+    size_t i = 0;
+
+    while (i < tmpl.size())
+    {
+        /*
+         * Find the end of a `${...}` sequence, allowing for nested
+         * braces as Lua's `%b{}` does.
+         */
+        size_t end = std::string::npos;
+
+        if ((tmpl[i] == '$') && (i + 1 < tmpl.size()) && (tmpl[i + 1] == '{'))
+        {
+            int depth = 0;
+
+            for (size_t j = i + 1; j < tmpl.size(); j++)
+            {
+                if (tmpl[j] == '{')
+                    depth += 1;
+                else if ((tmpl[j] == '}') && (--depth == 0))
+                {
+                    end = j;
+                    break;
+                }
+            }
+        }
+
+        if (end == std::string::npos)
+        {
+            literal += tmpl[i++];
+            continue;
+        }
+
+        if (! literal.empty())
+        {
+            op o;
+            o.field    = -1;
+            o.text     = literal;
+            o.fixed    = false;
+            o.width    = 0;
+            o.left_pad = true;
+            o.pad      = ' ';
+            m_ops.push_back(o);
+            literal.clear();
+        }
+
+        op o;
+        o.field    = -1;
+        o.text     = tmpl.substr(i, end - i + 1);
+        o.fixed    = false;
+        o.width    = 0;
+        o.left_pad = true;
+        o.pad      = ' ';
+
+        /*
+         * Split the name from any width, which may precede or follow
+         * it.
+         */
+        std::string key = tmpl.substr(i + 2, end - i - 2);
+        std::string name = key;
+        std::string len;
+
+        size_t bar = key.rfind('|');
+
+        if ((bar != std::string::npos) && all_digits(key.substr(bar + 1)))
+        {
+            name       = key.substr(0, bar);
+            len        = key.substr(bar + 1);
+            o.left_pad = false;
+        }
+        else if (((bar = key.find('|')) != std::string::npos) && all_digits(key.substr(0, bar)))
+        {
+            name = key.substr(bar + 1);
+            len  = key.substr(0, bar);
+        }
+
+        if (! len.empty())
+        {
+            o.fixed = true;
+            o.width = strtoul(len.c_str(), NULL, 10);
+            o.pad   = (len[0] == '0') ? '0' : ' ';
+        }
+
+        for (size_t f = 0; f < fields.size(); f++)
+        {
+            if (fields[f] == name)
+            {
+                o.field   = f;
+                m_used[f] = true;
+                break;
+            }
+        }
+
+        /*
+         * An unknown field without a width is just literal text.
+         */
+        if ((o.field == -1) && ! o.fixed)
+            literal += o.text;
+        else
+            m_ops.push_back(o);
+
+        i = end + 1;
+    }
+
+    if (! literal.empty())
+    {
+        op o;
+        o.field    = -1;
+        o.text     = literal;
+        o.fixed    = false;
+        o.width    = 0;
+        o.left_pad = true;
+        o.pad      = ' ';
+        m_ops.push_back(o);
+    }
+}
+
+
+/*
+ * Is the given field used by the template?
+ */
+bool CFormatTemplate::uses(size_t field) const
+{
+    return ((field < m_used.size()) && m_used[field]);
+}
+
+
+/*
+ * Append `value` to `out`, truncated or padded to the width of the
+ * opcode.
+ */
+void CFormatTemplate::append_fitted(const op &o, const std::string &value, std::string &out)
+{
+    /*
+     * Find the byte-offset of the character after the last which
+     * fits, counting the characters as we go.
+     */
+    size_t chars = 0;
+    size_t bytes = 0;
+
+    while ((bytes < value.size()) && (chars < o.width))
+    {
+        int len = dsutil_utf8_charlen((unsigned char)value[bytes]);
+
+        if (len < 1)
+            len = 1;
+
+        bytes += len;
+        chars += 1;
+    }
+
+    if (bytes > value.size())
+        bytes = value.size();
+
+    if (o.left_pad)
+        out.append(o.width - chars, o.pad);
+
+    out.append(value, 0, bytes);
+
+    if (! o.left_pad)
+        out.append(o.width - chars, o.pad);
+}
+
+
+/*
+ * Append the expansion of the template to `out`.
+ */
+void CFormatTemplate::render(const std::vector < const std::string * > &values, std::string &out) const
+{
+    for (const op &o : m_ops)
+    {
+        const std::string *value = &o.text;
+
+        if ((o.field >= 0) && ((size_t)o.field < values.size()) && (values[o.field] != NULL))
+            value = values[o.field];
+
+        if (o.fixed)
+            append_fitted(o, *value, out);
+        else
+            out += *value;
+    }
+}
@@ -0,0 +1,118 @@
+/*
+ * format_template.h - Compiled `string.interp`-style templates.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <string>
+#include <vector>
+
+
+/**
+ * A template, such as `index.format`, compiled into a list of opcodes.
+ *
+ * The syntax is that of `string.interp` in `lib/string_utilities.lua`:
+ *
+ *  - `${name}` expands to the value of the named field.
+ *  - `${10|name}` expands the field, truncated or left-padded to ten
+ *    characters.
+ *  - `${name|10}` expands the field, truncated or right-padded.
+ *  - A width with a leading zero, such as `${04|number}`, pads with
+ *    zeros rather than spaces.
+ *
+ * Widths are measured in UTF-8 characters.  A field which is unknown,
+ * or has no value, expands to its own text, such as `${name}`.
+ */
+class CFormatTemplate
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CFormatTemplate();
+
+    /**
+     * Compile the given template, where `fields` are the names of the
+     * fields which may be expanded, and a field's position within it is
+     * its index when rendering.
+     */
+    void compile(const std::string &tmpl, const std::vector < std::string > &fields);
+
+    /**
+     * Is the given field used by the template?
+     */
+    bool uses(size_t field) const;
+
+    /**
+     * Append the expansion of the template to `out`.
+     *
+     * `values` holds the value of each field, by index, where NULL
+     * means the field has no value.
+     */
+    void render(const std::vector < const std::string * > &values, std::string &out) const;
+
+private:
+
+    /**
+     * A single opcode: either literal text, or a field to expand.
+     */
+    struct op
+    {
+        /**
+         * The index of the field, or -1 for literal text.
+         */
+        int field;
+
+        /**
+         * The literal text, or the text a field expands to if it has no
+         * value.
+         */
+        std::string text;
+
+        /**
+         * Is the field truncated, or padded, to a width?
+         */
+        bool fixed;
+        size_t width;
+
+        /**
+         * Pad on the left?  And with which character?
+         */
+        bool left_pad;
+        char pad;
+    };
+
+    /**
+     * Append `value` to `out`, truncated or padded to `o.width`.
+     */
+    static void append_fitted(const op &o, const std::string &value, std::string &out);
+
+private:
+
+    /**
+     * Our opcodes.
+     */
+    std::vector < op > m_ops;
+
+    /**
+     * The fields which are used.
+     */
+    std::vector < bool > m_used;
+};
@@ -0,0 +1,121 @@
+/*
+ * format_template_test.cc - Test-cases for our compiled templates.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "format_template.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Render the given template with some fixed values.
+ */
+static std::string render(const char *tmpl)
+{
+    std::vector < std::string > fields = {"name", "number", "missing", "utf"};
+
+    std::string name = "Steve";
+    std::string number = "17";
+    std::string utf = "\xc3\xa9t\xc3\xa9";
+
+    std::vector < const std::string * > values = {&name, &number, NULL, &utf};
+
+    CFormatTemplate t;
+    t.compile(tmpl, fields);
+
+    std::string out;
+    t.render(values, out);
+    return (out);
+}
+
+
+/**
+ * Test the expansion of fields, as `string.interp` does.
+ */
+void TestFormatTemplate(CuTest * tc)
+{
+    typedef struct _format_test_case
+    {
+        const char *input;
+        const char *output;
+    } format_test_case;
+
+    format_test_case tests[] =
+    {
+        {"", ""},
+        {"no fields", "no fields"},
+        {"Hello ${name}!", "Hello Steve!"},
+        {"${name}${number}", "Steve17"},
+        {"[${8|name}]", "[   Steve]"},
+        {"[${name|8}]", "[Steve   ]"},
+        {"[${3|name}]", "[Ste]"},
+        {"[${name|3}]", "[Ste]"},
+        {"[${04|number}]", "[0017]"},
+        {"[${0|name}]", "[]"},
+        {"[${4|utf}]", "[ \xc3\xa9t\xc3\xa9]"},
+        {"[${2|utf}]", "[\xc3\xa9t]"},
+        {"${unknown} ${missing}", "${unknown} ${missing}"},
+        {"[${15|missing}]", "[  ${15|missing}]"},
+        {"$name ${name", "$name ${name"},
+        {"${a{b}c}", "${a{b}c}"},
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+        CuAssertStrEquals(tc, tests[i].output, render(tests[i].input).c_str());
+}
+
+
+/**
+ * Test that we know which fields a template uses.
+ */
+void TestFormatTemplateUses(CuTest * tc)
+{
+    std::vector < std::string > fields = {"a", "b", "c"};
+
+    CFormatTemplate t;
+    t.compile("${a} and ${4|c}", fields);
+
+    CuAssertTrue(tc, t.uses(0));
+    CuAssertTrue(tc, ! t.uses(1));
+    CuAssertTrue(tc, t.uses(2));
+    CuAssertTrue(tc, ! t.uses(3));
+
+    /*
+     * Recompiling replaces everything.
+     */
+    t.compile("${b}", fields);
+
+    CuAssertTrue(tc, ! t.uses(0));
+    CuAssertTrue(tc, t.uses(1));
+    CuAssertTrue(tc, ! t.uses(2));
+}
+
+
+CuSuite *
+format_template_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestFormatTemplate);
+    SUITE_ADD_TEST(suite, TestFormatTemplateUses);
+    return suite;
+}
@@ -0,0 +1,170 @@
+/*
+ * frame_stats.cc - Timings of the phases of each frame we draw.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+#include "frame_stats.h"
+
+
+/*
+ * Format a number of microseconds as milliseconds, for humans.
+ */
+static std::string format_usec(uint64_t usec)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f", usec / 1000.0);
+    return (buf);
+}
+
+
+/*
+ * Record that the named phase took the given number of microseconds.
+ */
+void CFrameStats::record(const std::string &phase, uint64_t usec)
+{
+    frame_samples &s = m_phases[phase];
+
+    if (s.samples.size() < FRAME_STATS_SAMPLES)
+    {
+        s.samples.push_back(usec);
+        return;
+    }
+
+    s.samples[s.next] = usec;
+    s.next = (s.next + 1) % FRAME_STATS_SAMPLES;
+}
+
+
+/*
+ * Summarise the recent timings of the given phase.
+ */
+bool CFrameStats::summary(const std::string &phase, frame_summary &out)
+{
+    auto it = m_phases.find(phase);
+
+    if ((it == m_phases.end()) || it->second.samples.empty())
+        return false;
+
+    std::vector < uint64_t > sorted = it->second.samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    size_t n = sorted.size();
+
+    out.p50   = sorted[(n - 1) * 50 / 100];
+    out.p99   = sorted[(n - 1) * 99 / 100];
+    out.max   = sorted[n - 1];
+    out.count = n;
+    return true;
+}
+
+
+/*
+ * The names of all the phases which have been recorded.
+ */
+std::vector < std::string > CFrameStats::phases()
+{
+    std::vector < std::string > names;
+
+    for (auto it : m_phases)
+        names.push_back(it.first);
+
+    return (names);
+}
+
+
+/*
+ * Record the current value of the named counter.
+ */
+void CFrameStats::set_counter(const std::string &name, uint64_t value)
+{
+    m_counters[name] = value;
+}
+
+
+/*
+ * Our counters.
+ */
+std::map < std::string, uint64_t > CFrameStats::counters()
+{
+    return (m_counters);
+}
+
+
+/*
+ * Discard all timings.
+ *
+ * Counters hold current values, rather than history, so they're kept.
+ */
+void CFrameStats::reset()
+{
+    m_phases.clear();
+}
+
+
+/*
+ * A one-line summary of our frame timings.
+ */
+std::string CFrameStats::overlay()
+{
+    static const char *shown[] = { "frame", "draw" };
+
+    std::string result;
+
+    for (const char *phase : shown)
+    {
+        frame_summary s;
+
+        if (! summary(phase, s))
+            continue;
+
+        if (! result.empty())
+            result += "  ";
+
+        result += std::string(phase) + " " + format_usec(s.p50) + "/" +
+                  format_usec(s.p99) + "/" + format_usec(s.max);
+    }
+
+    if (result.empty())
+        return (result);
+
+    result += " ms";
+
+    auto heap = m_counters.find("lua_heap");
+
+    if (heap != m_counters.end())
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "  lua %.1fMb", heap->second / (1024.0 * 1024.0));
+        result += buf;
+    }
+
+    return (result);
+}
+
+
+/*
+ * The current time, in microseconds, from a monotonic clock.
+ */
+uint64_t CFrameStats::now()
+{
+    auto since = std::chrono::steady_clock::now().time_since_epoch();
+    return (std::chrono::duration_cast<std::chrono::microseconds>(since).count());
+}
@@ -0,0 +1,151 @@
+/*
+ * frame_stats.h - Timings of the phases of each frame we draw.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "singleton.h"
+
+
+/**
+ * The number of recent timings we keep for each phase.
+ */
+#define FRAME_STATS_SAMPLES 256
+
+
+/**
+ * A summary of the recent timings of a single phase, in microseconds.
+ */
+typedef struct _frame_summary
+{
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t max;
+    size_t count;
+} frame_summary;
+
+
+/**
+ * This singleton records how long each phase of our event-loop takes -
+ * handling input, running key-bindings, having the view draw itself, and
+ * so on - so that slow frames can be attributed to their cause.
+ *
+ * The most recent `FRAME_STATS_SAMPLES` timings of each phase are kept in
+ * a ring, from which we report percentiles.  Phases are recorded with a
+ * `CFrameTimer`.
+ */
+class CFrameStats : public Singleton<CFrameStats>
+{
+public:
+
+    /**
+     * Record that the named phase took the given number of microseconds.
+     */
+    void record(const std::string &phase, uint64_t usec);
+
+    /**
+     * Summarise the recent timings of the given phase, returning false
+     * if it has never been recorded.
+     */
+    bool summary(const std::string &phase, frame_summary &out);
+
+    /**
+     * The names of all the phases which have been recorded, in order.
+     */
+    std::vector < std::string > phases();
+
+    /**
+     * Record the current value of the named counter, such as the size of
+     * the Lua heap, which is reported alongside our timings.
+     */
+    void set_counter(const std::string &name, uint64_t value);
+
+    /**
+     * Our counters, and their values.
+     */
+    std::map < std::string, uint64_t > counters();
+
+    /**
+     * Discard all timings.
+     */
+    void reset();
+
+    /**
+     * A one-line summary of the times taken by whole frames, and by the
+     * view drawing them, suitable for showing in the status-panel.
+     */
+    std::string overlay();
+
+    /**
+     * The current time, in microseconds, from a monotonic clock.
+     */
+    static uint64_t now();
+
+private:
+
+    /**
+     * The recent timings of a phase, oldest overwritten first.
+     */
+    typedef struct _frame_samples
+    {
+        std::vector < uint64_t > samples;
+        size_t next;
+    } frame_samples;
+
+    /**
+     * Our timings, by phase.
+     */
+    std::map < std::string, frame_samples > m_phases;
+
+    /**
+     * Our counters, by name.
+     */
+    std::map < std::string, uint64_t > m_counters;
+};
+
+
+/**
+ * Time the scope this object lives within, recording the result as the
+ * given phase with `CFrameStats` when it is destroyed.
+ */
+class CFrameTimer
+{
+public:
+    CFrameTimer(const char *phase)
+    {
+        m_phase = phase;
+        m_start = CFrameStats::now();
+    };
+
+    ~CFrameTimer()
+    {
+        CFrameStats *stats = CFrameStats::instance();
+        stats->record(m_phase, CFrameStats::now() - m_start);
+    };
+
+private:
+    const char *m_phase;
+    uint64_t m_start;
+};
@@ -0,0 +1,107 @@
+/*
+ * frame_stats_test.cc - Test-cases for our frame-timings.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <cstddef>
+#include <string>
+
+#include "frame_stats.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test the percentiles we report.
+ */
+void TestFrameStatsSummary(CuTest * tc)
+{
+    CFrameStats stats;
+    frame_summary s;
+
+    CuAssertTrue(tc, ! stats.summary("draw", s));
+    CuAssertStrEquals(tc, "", stats.overlay().c_str());
+
+    for (int i = 100; i >= 1; i--)
+        stats.record("draw", i);
+
+    CuAssertTrue(tc, stats.summary("draw", s));
+    CuAssertIntEquals(tc, 100, s.count);
+    CuAssertIntEquals(tc, 50, s.p50);
+    CuAssertIntEquals(tc, 99, s.p99);
+    CuAssertIntEquals(tc, 100, s.max);
+
+    stats.record("frame", 2500);
+    CuAssertIntEquals(tc, 2, stats.phases().size());
+    CuAssertStrEquals(tc, "frame 2.5/2.5/2.5  draw 0.1/0.1/0.1 ms", stats.overlay().c_str());
+
+    stats.reset();
+    CuAssertIntEquals(tc, 0, stats.phases().size());
+}
+
+
+/**
+ * Test only the most recent timings are kept.
+ */
+void TestFrameStatsRing(CuTest * tc)
+{
+    CFrameStats stats;
+    frame_summary s;
+
+    for (int i = 0; i < FRAME_STATS_SAMPLES; i++)
+        stats.record("frame", 1000000);
+
+    for (int i = 0; i < FRAME_STATS_SAMPLES; i++)
+        stats.record("frame", 10);
+
+    CuAssertTrue(tc, stats.summary("frame", s));
+    CuAssertIntEquals(tc, FRAME_STATS_SAMPLES, s.count);
+    CuAssertIntEquals(tc, 10, s.max);
+}
+
+
+/**
+ * Test our counters are reported, and survive a reset.
+ */
+void TestFrameStatsCounters(CuTest * tc)
+{
+    CFrameStats stats;
+
+    stats.set_counter("lua_heap", 3 * 1024 * 1024);
+    stats.set_counter("lua_gc_cycles", 1);
+    stats.set_counter("lua_gc_cycles", 2);
+
+    CuAssertIntEquals(tc, 2, stats.counters().size());
+    CuAssertIntEquals(tc, 2, stats.counters()["lua_gc_cycles"]);
+
+    stats.record("frame", 2500);
+    CuAssertStrEquals(tc, "frame 2.5/2.5/2.5 ms  lua 3.0Mb", stats.overlay().c_str());
+
+    stats.reset();
+    CuAssertIntEquals(tc, 0, stats.phases().size());
+    CuAssertIntEquals(tc, 2, stats.counters().size());
+}
+
+
+CuSuite *
+frame_stats_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestFrameStatsSummary);
+    SUITE_ADD_TEST(suite, TestFrameStatsRing);
+    SUITE_ADD_TEST(suite, TestFrameStatsCounters);
+    return suite;
+}
@@ -0,0 +1,195 @@
+/*
+ * fuzzy_matcher.cc - Narrow a list of candidates as a query is typed.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+
+#include "fuzzy_matcher.h"
+
+
+/*
+ * The score of each matched character, and the bonuses for those which
+ * follow the previous match, or begin a word.  Each skipped character
+ * costs a point.
+ */
+#define FUZZY_MATCH       16
+#define FUZZY_CONSECUTIVE 16
+#define FUZZY_WORD_START  12
+
+
+/*
+ * Return the lower-case version of the given string.
+ */
+static std::string lower(const std::string &str)
+{
+    std::string out = str;
+
+    for (char &c : out)
+        c = tolower((unsigned char) c);
+
+    return (out);
+}
+
+
+/*
+ * Constructor.
+ */
+CFuzzyMatcher::CFuzzyMatcher(const std::vector<std::string> &candidates, bool fuzzy)
+{
+    m_fuzzy = fuzzy;
+    m_candidates.reserve(candidates.size());
+
+    std::vector<size_t> all;
+    all.reserve(candidates.size());
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        m_candidates.push_back(lower(candidates[i]));
+        all.push_back(i);
+    }
+
+    m_levels.push_back(all);
+    m_ranked = all;
+}
+
+
+/*
+ * Score the given candidate against the query.
+ *
+ * Each character of the query is matched against the first occurrence
+ * which follows the previous match.
+ */
+bool CFuzzyMatcher::score(const std::string &candidate, const std::string &query, int &result)
+{
+    result = 0;
+
+    size_t pos  = 0;
+    size_t prev = std::string::npos;
+
+    for (char q : query)
+    {
+        size_t found = candidate.find(q, pos);
+
+        if (found == std::string::npos)
+            return false;
+
+        result += FUZZY_MATCH;
+
+        if ((prev != std::string::npos) && (found == prev + 1))
+            result += FUZZY_CONSECUTIVE;
+        else if ((found == 0) || ! isalnum((unsigned char) candidate[found - 1]))
+            result += FUZZY_WORD_START;
+
+        result -= (int)(found - pos);
+
+        prev = found;
+        pos  = found + 1;
+    }
+
+    return true;
+}
+
+
+/*
+ * Change the query.
+ */
+void CFuzzyMatcher::set_query(const std::string &query)
+{
+    std::string updated = lower(query);
+
+    /*
+     * Forget the matches of those prefixes of our old query which
+     * aren't prefixes of the new one.
+     */
+    size_t common = 0;
+
+    while ((common < m_query.size()) && (common < updated.size()) &&
+            (m_query[common] == updated[common]))
+        common++;
+
+    m_levels.resize(std::min(m_levels.size(), common + 1));
+    m_query = updated;
+
+    /*
+     * Narrow the matches a character at a time.  Whatever matches a
+     * query matched each of its prefixes too.
+     */
+    while (m_levels.size() <= m_query.size())
+    {
+        std::string prefix = m_query.substr(0, m_levels.size());
+        std::vector<size_t> next;
+        int s;
+
+        for (size_t i : m_levels.back())
+        {
+            bool found = m_fuzzy ? score(m_candidates[i], prefix, s) :
+                         (m_candidates[i].find(prefix) != std::string::npos);
+
+            if (found)
+                next.push_back(i);
+        }
+
+        m_levels.push_back(next);
+    }
+
+    rank(m_levels.back());
+}
+
+
+/*
+ * Rank the given matches of our query.
+ */
+void CFuzzyMatcher::rank(const std::vector<size_t> &from)
+{
+    if (! m_fuzzy || m_query.empty())
+    {
+        m_ranked = from;
+        return;
+    }
+
+    std::vector<fuzzy_match> scored;
+    scored.reserve(from.size());
+
+    for (size_t i : from)
+    {
+        fuzzy_match m;
+        m.offset = i;
+        score(m_candidates[i], m_query, m.score);
+        scored.push_back(m);
+    }
+
+    std::stable_sort(scored.begin(), scored.end(), [](const fuzzy_match & a, const fuzzy_match & b)
+    {
+        return (a.score > b.score);
+    });
+
+    m_ranked.clear();
+
+    for (const fuzzy_match &m : scored)
+        m_ranked.push_back(m.offset);
+}
+
+
+/*
+ * The offsets of the candidates which match the query, best first.
+ */
+const std::vector<size_t> &CFuzzyMatcher::matches()
+{
+    return (m_ranked);
+}
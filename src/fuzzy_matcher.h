@@ -0,0 +1,113 @@
+/*
+ * fuzzy_matcher.h - Narrow a list of candidates as a query is typed.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+/**
+ * This class finds those of a list of candidates which match a query, as
+ * the query is typed a character at a time.
+ *
+ * As the query grows only the candidates which matched its previous form
+ * are examined, and the results for each shorter form are kept, so that
+ * deleting a character costs nothing.  The cost of each keystroke is
+ * therefore proportional to the number of candidates which still match,
+ * rather than to the size of the list.
+ *
+ * In fuzzy mode a candidate matches if it contains the characters of the
+ * query in order, ignoring case, and matches are ranked by a score which
+ * favours consecutive characters, and those at the start of words.
+ * Otherwise a candidate matches if it contains the query, and matches
+ * are kept in their original order.
+ */
+class CFuzzyMatcher
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CFuzzyMatcher(const std::vector<std::string> &candidates, bool fuzzy = true);
+
+    /**
+     * Change the query.
+     */
+    void set_query(const std::string &query);
+
+    /**
+     * The offsets of the candidates which match the query, best first.
+     */
+    const std::vector<size_t> &matches();
+
+    /**
+     * Score the given candidate against the query, returning false if
+     * it doesn't match.  Both should be lower-case.
+     */
+    static bool score(const std::string &candidate, const std::string &query, int &result);
+
+private:
+
+    /**
+     * Rank the given matches of the query, best first.
+     */
+    void rank(const std::vector<size_t> &from);
+
+private:
+
+    /**
+     * A match, and its score.
+     */
+    typedef struct _fuzzy_match
+    {
+        size_t offset;
+        int score;
+    } fuzzy_match;
+
+    /**
+     * Our candidates, in lower-case.
+     */
+    std::vector<std::string> m_candidates;
+
+    /**
+     * Are we matching fuzzily?
+     */
+    bool m_fuzzy;
+
+    /**
+     * The query, in lower-case.
+     */
+    std::string m_query;
+
+    /**
+     * The matches of each prefix of the query, the first being those of
+     * the empty query - every candidate.  They're kept in their original
+     * order, so that each may be narrowed to the next.
+     */
+    std::vector < std::vector<size_t> > m_levels;
+
+    /**
+     * The matches of the whole query, ranked.
+     */
+    std::vector<size_t> m_ranked;
+};
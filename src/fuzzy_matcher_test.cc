@@ -0,0 +1,110 @@
+/*
+ * fuzzy_matcher_test.cc - Test-cases for our incremental matcher.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "fuzzy_matcher.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test fuzzy matches are found, and ranked.
+ */
+void TestFuzzyMatcher(CuTest * tc)
+{
+    std::vector<std::string> folders = { "lumail-dev", "Inbox", "bills", "lists.debian" };
+
+    CFuzzyMatcher matcher(folders);
+    CuAssertIntEquals(tc, 4, matcher.matches().size());
+
+    /*
+     * "li" is consecutive in one folder, which is ranked first.
+     */
+    matcher.set_query("li");
+    CuAssertIntEquals(tc, 2, matcher.matches().size());
+    CuAssertIntEquals(tc, 3, matcher.matches()[0]);
+    CuAssertIntEquals(tc, 0, matcher.matches()[1]);
+
+    matcher.set_query("lid");
+    CuAssertIntEquals(tc, 2, matcher.matches().size());
+
+    matcher.set_query("LUD");
+    CuAssertIntEquals(tc, 1, matcher.matches().size());
+    CuAssertIntEquals(tc, 0, matcher.matches()[0]);
+
+    matcher.set_query("xyz");
+    CuAssertIntEquals(tc, 0, matcher.matches().size());
+
+    /*
+     * Deleting characters restores the earlier matches.
+     */
+    matcher.set_query("");
+    CuAssertIntEquals(tc, 4, matcher.matches().size());
+    CuAssertIntEquals(tc, 0, matcher.matches()[0]);
+}
+
+
+/**
+ * Test substring matches keep their order.
+ */
+void TestSubstringMatcher(CuTest * tc)
+{
+    std::vector<std::string> words = { "banana", "nab", "Ban", "cab" };
+
+    CFuzzyMatcher matcher(words, false);
+
+    matcher.set_query("ba");
+    CuAssertIntEquals(tc, 2, matcher.matches().size());
+    CuAssertIntEquals(tc, 0, matcher.matches()[0]);
+    CuAssertIntEquals(tc, 2, matcher.matches()[1]);
+
+    matcher.set_query("ab");
+    CuAssertIntEquals(tc, 2, matcher.matches().size());
+    CuAssertIntEquals(tc, 1, matcher.matches()[0]);
+    CuAssertIntEquals(tc, 3, matcher.matches()[1]);
+}
+
+
+/**
+ * Test the scores of candidates.
+ */
+void TestFuzzyScore(CuTest * tc)
+{
+    int a, b;
+
+    CuAssertTrue(tc, CFuzzyMatcher::score("inbox", "ibx", a));
+    CuAssertTrue(tc, ! CFuzzyMatcher::score("inbox", "xi", a));
+
+    CuAssertTrue(tc, CFuzzyMatcher::score("inbox", "inb", a));
+    CuAssertTrue(tc, CFuzzyMatcher::score("in-box", "inb", b));
+    CuAssertTrue(tc, a > b);
+}
+
+
+CuSuite *
+fuzzy_matcher_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestFuzzyMatcher);
+    SUITE_ADD_TEST(suite, TestSubstringMatcher);
+    SUITE_ADD_TEST(suite, TestFuzzyScore);
+    return suite;
+}
@@ -16,33 +16,69 @@
  * General Public License can be found in `/usr/share/common-licenses/GPL-2'
  */
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <map>
 
 
 #include "config.h"
 #include "directory.h"
+#include "durability.h"
 #include "file.h"
 #include "global_state.h"
 #include "history.h"
+#include "imap_cache.h"
 #include "imap_proxy.h"
+#include "job_queue.h"
 #include "json/json.h"
+#include "json_stream.h"
 #include "logger.h"
 #include "lua.h"
 #include "maildir.h"
+#include "mbox.h"
 #include "message.h"
+#include "message_arena.h"
+#include "startup_timings.h"
 #include "util.h"
 
 /*
  * Constructor
  */
-CGlobalState::CGlobalState() : Observer(CConfig::instance())
+CGlobalState::CGlobalState()
 {
-    m_messages = NULL;
+    /*
+     * The keys our `update` method handles.
+     */
+    static const char *keys[] =
+    {
+        "global.history", "global.history_size", "global.mode",
+        "imap.password", "imap.server", "imap.username", "imap.workers",
+        "log.level", "log.path", "log.trace", "maildir.prefix"
+    };
+
+    CConfig *config = CConfig::instance();
+
+    for (const char *key : keys)
+        config->subscribe(this, key);
+
+    m_messages = new CMessageList;
     m_current_message = NULL;
-    update_messages();
-    update_maildirs();
+    m_pending_messages = false;
+    m_maildirs_stale   = true;
+    m_messages_batch   = 0;
+    m_messages_generation = 0;
+    m_generations      = 0;
+    m_folders_request  = 0;
+    m_messages_request = 0;
+    m_imap_syncing     = false;
+    m_imap_changed     = false;
 
+    /*
+     * We don't scan for maildirs here, as our configuration has yet to
+     * be loaded, and would only change them.  They're found once they're
+     * first asked for, and until a maildir is selected we've no messages.
+     */
 }
 
 
@@ -52,11 +88,18 @@ CGlobalState::CGlobalState() : Observer(CConfig::instance())
 CGlobalState::~CGlobalState()
 {
     /*
-     * If we have items already then free each of them.
+     * If we have items already then free each of them, after
+     * writing the index of their maildir.
      */
+    m_loader.cancel();
+    save_index();
+
     if (m_messages != NULL)
         delete(m_messages);
 
+    for (folder_messages &folder : m_folder_cache)
+        delete(folder.messages);
+
     /*
      * If we have items already then remove them.
      */
@@ -116,13 +159,13 @@ void CGlobalState::update(std::string key_name, CConfigEntry *old)
          * Update our cached list of messages in this maildir.
          */
         if (! new_mode.empty() && (new_mode == "index"))
-            update_messages();
+            refresh_messages();
 
         /*
          * Update the list of maildirs.
          */
         if (!new_mode.empty() && (new_mode == "maildir"))
-            update_maildirs();
+            refresh_maildirs();
 
         /*
          * Reset the horizontal scroll to be zero.
@@ -142,6 +185,19 @@ void CGlobalState::update(std::string key_name, CConfigEntry *old)
         CHistory *history = CHistory::instance();
         history->set_file(path);
     }
+    else if (key_name == "global.history_size")
+    {
+        /*
+         * The number of history entries to keep.
+         */
+        int max = config->get_integer("global.history_size", HISTORY_SIZE);
+
+        if (max < 1)
+            return;
+
+        CHistory *history = CHistory::instance();
+        history->set_max(max);
+    }
     else if (key_name == "log.level")
     {
         /*
@@ -152,6 +208,16 @@ void CGlobalState::update(std::string key_name, CConfigEntry *old)
         CLogger *logger = CLogger::instance();
         logger->set_level(log);
     }
+    else if (key_name == "log.trace")
+    {
+        /*
+         * The file to write trace-events to, if any.
+         */
+        std::string path = config->get_string("log.trace");
+
+        CLogger *logger = CLogger::instance();
+        logger->set_trace_path(path);
+    }
     else if (key_name == "log.path")
     {
         /*
@@ -167,44 +233,35 @@ void CGlobalState::update(std::string key_name, CConfigEntry *old)
         /*
          * Otherwise if the maildir-prefix has changed update things.
          */
-        update_maildirs();
+        refresh_maildirs();
     }
-    else if (key_name == "imap.username")
+    else if ((key_name == "imap.username") || (key_name == "imap.password") ||
+             (key_name == "imap.server") || (key_name == "imap.workers"))
     {
-        setenv("imap_username", config->get_string("imap.username").c_str(), 1);
+        /*
+         * These are read by the proxy when it is launched.
+         */
+        std::string variable = "imap_" + key_name.substr(key_name.find('.') + 1);
 
-        if ((config->get_string("imap.username", "") != "") &&
-                (config->get_string("imap.password", "") != "") &&
-                (config->get_string("imap.server", "") != ""))
-            update_maildirs();
+        if (key_name == "imap.workers")
+            setenv(variable.c_str(), std::to_string(config->get_integer(key_name, 4)).c_str(), 1);
         else
-        {
-            CIMAPProxy *proxy = CIMAPProxy::instance();
-            proxy->terminate();
-        }
-    }
-    else if (key_name == "imap.password")
-    {
-        setenv("imap_password", config->get_string("imap.password").c_str(), 1);
+            setenv(variable.c_str(), config->get_string(key_name).c_str(), 1);
 
         if ((config->get_string("imap.username", "") != "") &&
                 (config->get_string("imap.password", "") != "") &&
                 (config->get_string("imap.server", "") != ""))
-            update_maildirs();
-        else
         {
+            refresh_maildirs();
+
+            /*
+             * Have the proxy log in while the rest of our configuration
+             * is loaded, and the screen set up.  One which was launched
+             * with other details is replaced.
+             */
             CIMAPProxy *proxy = CIMAPProxy::instance();
-            proxy->terminate();
+            proxy->launch();
         }
-    }
-    else if (key_name == "imap.server")
-    {
-        setenv("imap_server", config->get_string("imap.server").c_str(), 1);
-
-        if ((config->get_string("imap.username", "") != "") &&
-                (config->get_string("imap.password", "") != "") &&
-                (config->get_string("imap.server", "") != ""))
-            update_maildirs();
         else
         {
             CIMAPProxy *proxy = CIMAPProxy::instance();
@@ -214,6 +271,48 @@ void CGlobalState::update(std::string key_name, CConfigEntry *old)
 }
 
 
+/*
+ * Update our messages, once the current batch of configuration changes
+ * has been delivered if there is one.
+ */
+void CGlobalState::refresh_messages()
+{
+    if (CConfig::instance()->delivering_batch())
+        m_pending_messages = true;
+    else
+        update_messages();
+}
+
+
+/*
+ * Note that our maildirs must be found again, the next time they're
+ * asked for.  However many settings change before then, the whole
+ * configuration phase included, we scan just once.
+ */
+void CGlobalState::refresh_maildirs()
+{
+    m_maildirs_stale = true;
+}
+
+
+/*
+ * Called once each batch of configuration changes has been delivered.
+ */
+void CGlobalState::batch_complete()
+{
+    CConfig *config = CConfig::instance();
+
+    /*
+     * If our messages were updated during the batch, typically by
+     * selecting a maildir, there's no need to do so again.
+     */
+    if (m_pending_messages && (m_messages_batch != config->batch_id()))
+        update_messages();
+
+    m_pending_messages = false;
+}
+
+
 /*
  * Get the messages from the currently selected folder.
  */
@@ -223,20 +322,64 @@ CMessageList * CGlobalState::get_messages()
 }
 
 
+/*
+ * The generation of our messages.
+ */
+uint64_t CGlobalState::messages_generation()
+{
+    return (m_messages_generation);
+}
+
+
 /*
  * Get the available maildirs.
  */
 std::vector<std::shared_ptr<CMaildir>> CGlobalState::get_maildirs()
 {
+    if (m_maildirs_stale)
+        update_maildirs();
+
     return (m_maildirs);
 }
 
 
+/*
+ * Get the summaries of our maildirs.
+ */
+const std::vector<maildir_summary> &CGlobalState::maildir_summaries()
+{
+    if (m_maildirs_stale)
+        update_maildirs();
+
+    int interval = CConfig::instance()->get_integer("maildir.summary_interval", 2);
+    return (m_summaries.summaries(interval));
+}
+
+
+/*
+ * The generation of our maildir summaries.
+ */
+uint64_t CGlobalState::summaries_generation()
+{
+    return (m_summaries.generation());
+}
+
+
 /*
  * Update our cached maildir-list.
  */
 void CGlobalState::update_maildirs()
 {
+    CTraceSpan span("update_maildirs");
+    CStartupTimer timer("first update_maildirs", true);
+
+    m_maildirs_stale = false;
+
+    /*
+     * Any reply to an earlier request for IMAP folders is now stale.
+     */
+    m_folders_request++;
+
     /*
      * If we have items already then remove them.
      */
@@ -257,51 +400,19 @@ void CGlobalState::update_maildirs()
             (config->get_string("imap.server", "") != ""))
     {
         /*
-         * Read the output from our IMAP proxy.
-         */
-        CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string json  = proxy->read_imap_output("list_folders\n");
-
-        /*
-         * Now parse the JSON into objects.
+         * Ask our IMAP proxy for the folders, which we'll have once it
+         * replies.
          */
-        Json::Value root;
-        Json::Reader reader;
-        bool parsingSuccessful = reader.parse(json, root);
-
-        if (!parsingSuccessful)
-        {
-            CLua *lua = CLua::instance();
-            lua->on_error("Failed to parse JSON response to 'list_folders': " + json);
-
-            config->set("maildir.max", 0);
-            return;
-        }
-
-        Json::Value folders = root["folders"];
-
-        int count  = 0;
+        uint64_t request = m_folders_request;
 
-        for (Json::ValueConstIterator it = folders.begin(); it != folders.end(); ++it)
+        CIMAPProxy *proxy = CIMAPProxy::instance();
+        proxy->request("list_folders\n", [this, request](std::string json)
         {
-            /*
-             * Get the values from the JSON array.
-             */
-            Json::Value single = (*it);
-            int unread       = single["unread"].asInt();
-            int total        = single["total"].asInt();
-            std::string path = single["name"].asString();
-
-            std::shared_ptr<CMaildir> m = std::shared_ptr<CMaildir>(new CMaildir(path, false));
-            m->set_total(total);
-            m->set_unread(unread);
-
-            m_maildirs.push_back(m);
-
-            count += 1;
-        }
+            imap_folders_loaded(request, json);
+        });
 
-        config->set("maildir.max", count);
+        m_summaries.set_maildirs(m_maildirs);
+        config->set("maildir.max", 0);
         return;
     }
 
@@ -329,7 +440,7 @@ void CGlobalState::update_maildirs()
          * We'll store each maildir here.
          */
         std::vector<std::string> folders;
-        folders = CFile::get_all_maildirs(prefix);
+        folders = CFile::get_all_maildirs(prefix, config->get_integer("maildir.scan_threads", 0));
 
         /*
          * Construct the Maildir object.
@@ -342,6 +453,36 @@ void CGlobalState::update_maildirs()
         }
     }
 
+    /*
+     * mbox-files are opened as read-only folders of their own.
+     */
+    for (std::string path : config->get_array("maildir.mbox"))
+    {
+        path = CFile::expand_path(path);
+
+        if (CMbox::is_mbox(path))
+            m_maildirs.push_back(std::make_shared<CMaildir>(path));
+    }
+
+    /*
+     * Each virtual folder searches those of the maildirs it matches.
+     */
+    if (! m_virtual_folders.empty())
+    {
+        std::vector<std::string> paths;
+
+        for (std::shared_ptr<CMaildir> m : m_maildirs)
+            paths.push_back(m->path());
+
+        for (std::shared_ptr<CVirtualFolder> folder : m_virtual_folders)
+        {
+            folder->set_maildirs(paths);
+            m_maildirs.push_back(std::make_shared<CMaildir>(folder));
+        }
+    }
+
+    m_summaries.set_maildirs(m_maildirs);
+
     /*
      * Setup the size.
      */
@@ -349,11 +490,181 @@ void CGlobalState::update_maildirs()
 }
 
 
+/*
+ * Define a virtual folder.
+ */
+bool CGlobalState::add_virtual_folder(std::string name, std::string folders,
+                                      std::string query, std::string &error)
+{
+    std::vector<virtual_term> terms;
+
+    if (! CVirtualFolder::parse(query, terms, error))
+        return false;
+
+    remove_virtual_folder(name);
+
+    m_virtual_folders.push_back(std::make_shared<CVirtualFolder>(name, folders, query));
+    m_maildirs_stale = true;
+    return true;
+}
+
+
+/*
+ * Remove a virtual folder.
+ */
+void CGlobalState::remove_virtual_folder(std::string name)
+{
+    auto found = std::find_if(m_virtual_folders.begin(), m_virtual_folders.end(),
+                              [&name](std::shared_ptr<CVirtualFolder> folder)
+    {
+        return (folder->name() == name);
+    });
+
+    if (found == m_virtual_folders.end())
+        return;
+
+    m_virtual_folders.erase(found);
+    m_maildirs_stale = true;
+}
+
+
+/*
+ * Builds a maildir for each folder in the IMAP proxy's reply to
+ * `list_folders` as it is parsed, without building a tree of the reply.
+ */
+class CFolderReply : public CJSONHandler
+{
+public:
+    CFolderReply(std::vector<std::shared_ptr<CMaildir> > &maildirs) : m_maildirs(maildirs)
+    {
+        m_depth  = 0;
+        m_unread = m_total = 0;
+        m_folder = false;
+    };
+
+    bool start_object()
+    {
+        m_depth++;
+
+        if ((m_depth == 3) && (m_member == "folders"))
+        {
+            m_folder = true;
+            m_name.clear();
+            m_unread = m_total = 0;
+        }
+
+        return true;
+    };
+
+    bool end_object()
+    {
+        if ((m_depth == 3) && m_folder)
+        {
+            std::shared_ptr<CMaildir> m = std::shared_ptr<CMaildir>(new CMaildir(m_name, false));
+            m->set_total(m_total);
+            m->set_unread(m_unread);
+
+            m_maildirs.push_back(m);
+            m_folder = false;
+        }
+
+        m_depth--;
+        return true;
+    };
+
+    bool start_array()
+    {
+        m_depth++;
+        return true;
+    };
+
+    bool end_array()
+    {
+        m_depth--;
+        return true;
+    };
+
+    bool key(const std::string &name)
+    {
+        if (m_depth == 1)
+            m_member = name;
+        else if (m_depth == 3)
+            m_field = name;
+
+        return true;
+    };
+
+    bool value(json_type type, const std::string &text)
+    {
+        if ((m_depth != 3) || ! m_folder)
+            return true;
+
+        if (m_field == "name")
+            m_name = (type == JSON_STRING) ? text : "";
+        else if (m_field == "unread")
+            m_unread = atoi(text.c_str());
+        else if (m_field == "total")
+            m_total = atoi(text.c_str());
+
+        return true;
+    };
+
+private:
+    std::vector<std::shared_ptr<CMaildir> > &m_maildirs;
+
+    int m_depth;
+    std::string m_member;
+    std::string m_field;
+
+    bool m_folder;
+    std::string m_name;
+    int m_unread;
+    int m_total;
+};
+
+
+/*
+ * Populate our maildirs from the IMAP proxy's reply to `list_folders`,
+ * unless we've asked for them again since.
+ */
+void CGlobalState::imap_folders_loaded(uint64_t request, std::string json)
+{
+    if (request != m_folders_request)
+        return;
+
+    CConfig *config = CConfig::instance();
+    m_maildirs.clear();
+
+    /*
+     * Now parse the JSON into objects.
+     */
+    CFolderReply reply(m_maildirs);
+
+    if (! CJSONStream::parse(json, reply))
+    {
+        m_maildirs.clear();
+
+        CLua *lua = CLua::instance();
+        lua->on_error("Failed to parse JSON response to 'list_folders': " + json);
+
+        m_summaries.set_maildirs(m_maildirs);
+        config->set("maildir.max", 0);
+        return;
+    }
+
+    m_summaries.set_maildirs(m_maildirs);
+    config->set("maildir.max", m_maildirs.size());
+}
+
+
 /*
  * Update the cached list of messages.
  */
 void CGlobalState::update_messages(bool force)
 {
+    CTraceSpan span("update_messages");
+    CStartupTimer timer("first update_messages", true);
+
     CLogger *logger = CLogger::instance();
     logger->log("CGlobalState", "Updating list of messages.");
 
@@ -377,6 +688,47 @@ void CGlobalState::update_messages(bool force)
     if (force == true)
         old_val = -2;
 
+    CConfig *config = CConfig::instance();
+
+    /*
+     * Note when we're updated within a batch of configuration changes,
+     * so that the batch needn't update us again.
+     */
+    if (config->in_batch())
+        m_messages_batch = config->batch_id();
+
+    /*
+     * If we're watching the current maildir we can apply the
+     * changes which have happened, rather than rebuilding the
+     * list from scratch.  This keeps any surviving messages, and
+     * their parsed headers, intact.
+     */
+    if ((force == false) && current && current->is_maildir() &&
+            m_watcher.is_watching() && (m_watcher.path() == current->path()))
+    {
+        /*
+         * While the folder is still loading the kernel holds on to
+         * our changes, they're applied once every message has arrived.
+         */
+        if (m_loader.is_loading())
+        {
+            poll_messages();
+            return;
+        }
+
+        std::vector<maildir_change> changes;
+
+        if (m_watcher.poll(changes))
+            apply_message_changes(changes);
+        else
+            merge_messages(current);
+
+        old_val = current->last_modified();
+
+        config->set("index.max", m_messages->size());
+        return;
+    }
+
     if (current)
     {
         if ((old_path == current->path()) &&
@@ -392,9 +744,16 @@ void CGlobalState::update_messages(bool force)
     }
 
     /*
-     * If we have items already then free each of them.
+     * If we have items already then keep, or free, them after writing
+     * the index of their maildir.  A list which is still loading, or
+     * which we're forced to rebuild, isn't kept.
      */
-    if (m_messages != NULL)
+    bool loading = m_loader.is_loading();
+
+    m_loader.cancel();
+    save_index();
+
+    if ((m_messages != NULL) && (force || loading || ! stash_messages()))
         delete(m_messages);
 
 
@@ -402,6 +761,16 @@ void CGlobalState::update_messages(bool force)
      * create a new store.
      */
     m_messages = new CMessageList;
+    m_messages_generation = ++m_generations;
+    m_message_index.clear();
+    m_index_maildir = "";
+    m_index.close();
+
+    /*
+     * Any reply to an earlier request for IMAP messages is now stale.
+     */
+    m_messages_request++;
+    m_imap_state = NULL;
 
     /*
      *
@@ -409,13 +778,12 @@ void CGlobalState::update_messages(bool force)
      * then retrieve the list of available folders via IMAP.
      *
      */
-    CConfig *config = CConfig::instance();
-
     if ((config->get_string("imap.username", "") != "") &&
             (config->get_string("imap.password", "") != "") &&
             (config->get_string("imap.server", "") != ""))
     {
         logger->log("imap", "IMAP is in use.");
+        m_watcher.unwatch();
 
         /*
          * If we don't have a currently-selected folder then return.
@@ -424,155 +792,1118 @@ void CGlobalState::update_messages(bool force)
             return;
 
         /*
-         * Get the path of the currently selected folder.
+         * Show the messages as of our last visit to the folder straight
+         * away, then ask our IMAP proxy for what has changed since, and
+         * update them once it replies.
          */
-        std::string folder = current->path();
+        m_imap_state = std::make_shared<CIMAPSync>();
 
-        /*
-         * The server name is part of the cache.
-         */
-        CConfig *config = CConfig::instance();
-        std::string imap_server = config->get_string("imap.server");
-        std::string imap_cache  = config->get_string("imap.cache");
+        if (m_imap_state->load(imap_sync_path(current)))
+            imap_messages_populate(current, m_imap_state);
+
+        config->set("index.max", m_messages->size());
 
-        if (imap_cache.empty())
-            imap_cache = "/tmp";
+        imap_messages_sync(current);
 
         /*
-         * Use our IMAP-proxy to get the message ID of each message
-         * in the currently selected folder, as well as the flags of
-         * the associated message.
-         *
-         * The retrival of the body will happen on-demand inside the
-         * CMessage object.
-         *
+         * Have the proxy tell us when the folder changes, rather than
+         * waiting for us to look again.
          */
         CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string json  = proxy->read_imap_output("get_message_ids " + folder + "\n");
+        proxy->on_event([this](std::string json)
+        {
+            imap_folder_changed(json);
+        });
+        proxy->idle(current->path());
 
-        int count = 0;
+        return;
+    }
 
-        /*
-         * Now parse the JSON into objects.
-         */
-        Json::Value root;
-        Json::Reader reader;
-        bool parsingSuccessful = reader.parse(json, root);
 
-        if (!parsingSuccessful)
-        {
-            CLua *lua = CLua::instance();
-            lua->on_error("Failed to parse JSON response to 'get_messages'.");
+    /*
+     * A virtual folder holds the messages of other folders, which it
+     * keeps up to date itself.
+     */
+    if (current && current->is_virtual())
+    {
+        m_watcher.unwatch();
 
-            config->set("index.max", 0);
-            return;
-        }
+        CMessageList contents = current->getMessages();
+        m_messages->insert(m_messages->end(), contents.begin(), contents.end());
 
-        Json::Value messages = root["messages"];
+        m_messages_generation = ++m_generations;
+        index_messages();
+    }
+    /*
+     * Get the messages from the maildir.
+     */
+    else if (current)
+    {
+        /*
+         * Seed the headers of each message from our index, if we have one.
+         */
+        std::string index = CMaildirIndex::index_file(current->path());
+
+        if ((! index.empty()) && m_index.open(index, current->path()))
+            logger->log("maildir", "Loaded index %s.", index.c_str());
+
+        m_index_maildir = current->path();
+
+        /*
+         * Watch before listing, so nothing which changes while we're
+         * reading the directory is missed.
+         */
+        if (! m_watcher.watch(current->path()))
+            logger->log("maildir", "Failed to watch %s.", current->path().c_str());
+
+        /*
+         * If we've been here recently we can reuse our messages.
+         */
+        if (restore_messages(current))
+        {
+            logger->log("maildir", "Reusing %d message(s).", m_messages->size());
+            config->set("index.max", m_messages->size());
+            return;
+        }
+
+        /*
+         * If we're loading in the background wait for the first
+         * batch, the remainder is collected from the main-loop via
+         * `poll_messages()`.
+         */
+        if (config->get_integer("index.async", 1) == 1)
+        {
+            logger->log("maildir", "%s", "Fetching messages in the background.");
+            m_loader.start(current->path());
+            m_loader.wait();
+            poll_messages();
+            return;
+        }
+
+        logger->log("maildir", "%s", "Fetching messages.");
+        CMessageList contents = current->getMessages();
+
+        for (std::shared_ptr<CMessage> content : contents)
+        {
+            seed_message(content);
+            m_messages->push_back(content) ;
+        }
+
+        m_messages_generation = ++m_generations;
+
+        index_messages();
+    }
+    else
+        m_watcher.unwatch();
+
+    logger->log("maildir", "Found %d message(s).", m_messages->size());
+
+    config->set("index.max", m_messages->size());
+}
+
+
+/*
+ * Collect any messages our background loader has found since we
+ * last looked.
+ */
+bool CGlobalState::poll_messages()
+{
+    if (! m_loader.is_loading())
+        return false;
+
+    CMessageList batch;
+    bool done = m_loader.poll(batch);
+
+    if (batch.empty() && ! done)
+        return false;
+
+    /*
+     * If the selection was upon the last message, as `set_maildir`
+     * leaves it, we'll keep it there as the list grows.
+     */
+    CConfig *config = CConfig::instance();
+    int current     = config->get_integer("index.current");
+    bool at_end     = (current + 1 >= (int)m_messages->size());
+
+    for (std::shared_ptr<CMessage> msg : batch)
+    {
+        std::string path = msg->path();
+
+        /*
+         * Our watcher may have told us about this message already.
+         */
+        if (m_message_index.find(path) != m_message_index.end())
+            continue;
+
+        seed_message(msg);
+        m_messages->push_back(msg);
+        m_message_index[path] = msg;
+    }
+
+    m_messages_generation = ++m_generations;
+
+    CLogger *logger = CLogger::instance();
+
+    if (done)
+        logger->log("maildir", "Found %d message(s).", m_messages->size());
+
+    int max = m_messages->size();
+    config->set("index.max", max);
+
+    if (at_end)
+        config->set("index.current", max > 0 ? max - 1 : 0, false);
+
+    /*
+     * Let Lua know, so it can refresh any sorted copy of our list.
+     */
+    CLua *lua = CLua::instance();
+
+    if (lua->function_exists("on_messages_loaded"))
+        lua->execute(done ? "on_messages_loaded(true)" : "on_messages_loaded(false)");
+
+    return true;
+}
+
+
+/*
+ * The path of the directory beneath `imap.cache` which holds the given
+ * IMAP folder's messages, created if necessary.
+ */
+static std::string imap_cache_dir(std::shared_ptr<CMaildir> folder)
+{
+    /*
+     * The path will be $cache/$server/$folder
+     */
+    std::string path = CIMAPCache::root();
+    path += "/";
+    path += escape_filename(folder->path());
+
+    CDirectory::mkdir_p(path);
+    return (path);
+}
+
+
+/*
+ * The path of the file holding our state of the given IMAP folder.
+ */
+std::string CGlobalState::imap_sync_path(std::shared_ptr<CMaildir> folder)
+{
+    return (imap_cache_dir(folder) + "/.sync");
+}
+
+
+/*
+ * Merge the IMAP proxy's reply to `sync_messages` into our state of the
+ * folder, and repopulate our messages from it - unless the folder, or its
+ * messages, have changed since we asked.
+ */
+void CGlobalState::imap_messages_loaded(uint64_t request, std::shared_ptr<CMaildir> current,
+                                        std::shared_ptr<CIMAPSync> state, std::string json)
+{
+    if ((request != m_messages_request) || (current != current_maildir()))
+        return;
+
+    m_imap_syncing = false;
+
+    bool applied = state->apply(json);
+
+    /*
+     * If the folder changed while we were waiting then ask again, now
+     * that our state is as current as it can be.
+     */
+    if (m_imap_changed)
+        imap_messages_sync(current);
+
+    if (! applied)
+    {
+        CLua *lua = CLua::instance();
+        lua->on_error("Failed to parse JSON response to 'sync_messages'.");
+        return;
+    }
+
+    if (! state->save(imap_sync_path(current)))
+    {
+        CLogger *logger = CLogger::instance();
+        logger->log("imap", "Failed to save the state of %s.", current->path().c_str());
+    }
+
+    imap_messages_populate(current, state);
+
+    CConfig *config = CConfig::instance();
+    config->set("index.max", m_messages->size());
+
+    /*
+     * Let Lua know, so it can refresh any sorted copy of our list.
+     */
+    CLua *lua = CLua::instance();
+
+    if (lua->function_exists("on_messages_loaded"))
+        lua->execute("on_messages_loaded(true)");
+}
+
+
+/*
+ * Ask the IMAP proxy for the changes to the current folder.
+ */
+void CGlobalState::imap_messages_sync(std::shared_ptr<CMaildir> current)
+{
+    uint64_t request = m_messages_request;
+    std::shared_ptr<CIMAPSync> state = m_imap_state;
+
+    m_imap_syncing = true;
+    m_imap_changed = false;
+
+    CIMAPProxy *proxy = CIMAPProxy::instance();
+    proxy->request(state->request(current->path()), [this, request, current, state](std::string json)
+    {
+        imap_messages_loaded(request, current, state, json);
+    });
+}
+
+
+/*
+ * Handle an event from the IMAP proxy.
+ *
+ * Events tell us that a folder has changed, and we resynchronise if it
+ * is the current one - once any synchronisation we're waiting for has
+ * completed, so that a burst of events costs us at most two requests.
+ */
+void CGlobalState::imap_folder_changed(std::string json)
+{
+    Json::Value root;
+    Json::Reader reader;
+
+    if (! reader.parse(json, root) || ! root.isObject() ||
+            (root["event"].asString() != "changed"))
+        return;
+
+    std::shared_ptr<CMaildir> current = current_maildir();
+
+    if (! current || ! m_imap_state || (root["folder"].asString() != current->path()))
+        return;
+
+    CLogger *logger = CLogger::instance();
+    logger->log("imap", "Folder %s has changed.", current->path().c_str());
+
+    if (m_imap_syncing)
+        m_imap_changed = true;
+    else
+        imap_messages_sync(current);
+}
+
+
+/*
+ * Populate our messages from our state of the given IMAP folder.
+ *
+ * Messages we already hold are updated in place, rather than replaced,
+ * so that they keep any headers, or bodies, we've read.
+ */
+void CGlobalState::imap_messages_populate(std::shared_ptr<CMaildir> current, std::shared_ptr<CIMAPSync> state)
+{
+    std::string dir = imap_cache_dir(current);
+    std::shared_ptr<CMessageArena> arena = CMessageArena::folder(current->path());
+
+    std::unordered_map < int, std::shared_ptr<CMessage> > existing;
+
+    for (std::shared_ptr<CMessage> msg : *m_messages)
+    {
+        if (msg->parent() == current)
+            existing[msg->imap_id()] = msg;
+    }
+
+    m_messages->clear();
+    int unread = 0;
+
+    /*
+     * We know the ID of each message in the folder, as well as the flags
+     * of the associated message.
+     *
+     * The retrival of the body will happen on-demand inside the
+     * CMessage object.
+     */
+    const std::map < int, std::string > &messages = state->messages();
+
+    for (auto it = messages.begin(); it != messages.end(); ++it)
+    {
+        int id_val = it->first;
+
+        /*
+         * Create the message-object, pointing to the path which will hold
+         * it, making sure that it is marked as non-local.
+         */
+        std::shared_ptr < CMessage > t;
+        auto found = existing.find(id_val);
+
+        if (found != existing.end())
+            t = found->second;
+        else
+        {
+            std::string path = dir + "/" + std::to_string(id_val);
+
+            t = arena->message(path, false);
+            t->path(path);
+        }
+
+        /*
+         * Split the flags into sane things.
+         */
+        std::string f;
+        std::vector<std::string> flags = split(it->second, ',');
+
+        for (auto flag = flags.begin() ; flag != flags.end(); ++flag)
+        {
+            if (*flag == "\\Seen")
+                f += "S";
+
+            if (*flag == "\\Unseen")
+                f += "N";
+
+            if (*flag == "\\Answered")
+                f += "R";
+        }
+
+        /*
+         * Empty flag == new message.
+         */
+        if (f.empty())
+            f = "N";
+
+        if (f.find('S') == std::string::npos)
+            unread += 1;
+
+        /*
+         * Set the flags and ID to the message.  The flags will be
+         * usable as-is.
+         *
+         * The ID means that the message-object can fetch its own
+         * body on-demand when it wants to.
+         */
+        t->parent(current);
+        t->set_imap_flags(f);
+        t->set_imap_id(id_val);
+
+        m_messages->push_back(t);
+    }
+
+    m_messages_generation = ++m_generations;
+
+    current->set_total(m_messages->size());
+    current->set_unread(unread);
+}
+
+
+/*
+ * Add, and remove, the given flags upon each of the given messages.
+ */
+int CGlobalState::apply_flags(CMessageList &messages, std::string add, std::string remove)
+{
+    /*
+     * The IMAP messages which changed, grouped by folder, along with
+     * the change to the number of unread messages in each.
+     */
+    std::map < std::shared_ptr<CMaildir>, std::pair < std::string, int > > imap;
+    int changed = 0;
+
+    /*
+     * Each folder whose messages are renamed need reach the disk once.
+     */
+    CDurableBatch batch;
+
+    std::transform(add.begin(), add.end(), add.begin(), ::toupper);
+    std::transform(remove.begin(), remove.end(), remove.begin(), ::toupper);
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if (! msg)
+            continue;
+
+        bool was_new = msg->is_new();
+
+        if (! msg->update_flags(add, remove))
+            continue;
+
+        changed += 1;
+
+        if (msg->is_imap() && msg->parent())
+        {
+            std::pair < std::string, int > &folder = imap[msg->parent()];
+
+            if (! folder.first.empty())
+                folder.first += ",";
+
+            folder.first  += std::to_string(msg->imap_id());
+            folder.second += (int)msg->is_new() - (int)was_new;
+        }
+    }
+
+    /*
+     * For each IMAP folder send one command to update all of its
+     * messages, then update the folder once.
+     *
+     * We don't wait for the replies, as the proxy carries out requests
+     * in the order they're sent - so any later request which reads the
+     * folder will see the change.
+     */
+    CIMAPProxy *proxy = CIMAPProxy::instance();
+
+    for (auto it = imap.begin(); it != imap.end(); ++it)
+    {
+        std::shared_ptr<CMaildir> folder = it->first;
+
+        std::string cmd = "store_flags " + it->second.first + " " +
+                          (add.empty() ? "-" : add) + " " +
+                          (remove.empty() ? "-" : remove) + " " +
+                          folder->path() + "\n";
+
+        proxy->request(cmd, nullptr);
+
+        folder->bump_mtime();
+
+        int unread = folder->unread_messages() + it->second.second;
+        folder->set_unread(unread < 0 ? 0 : unread);
+    }
+
+    if (changed > 0)
+        m_summaries.invalidate();
+
+    return (changed);
+}
+
+
+/*
+ * Delete the given messages, updating our list of them in place.
+ */
+int CGlobalState::remove_messages(CMessageList &messages)
+{
+    /*
+     * The counts of the current local maildir, taken before we change
+     * it, so that they're current.
+     */
+    std::shared_ptr<CMaildir> current = current_maildir();
+    bool local = current && current->is_maildir();
+    int total  = local ? current->total_messages() : 0;
+    int unread = local ? current->unread_messages() : 0;
+
+    std::string prefix = local ? current->path() : "";
+
+    while ((prefix.size() > 1) && (prefix[prefix.size() - 1] == '/'))
+        prefix.erase(prefix.size() - 1);
+
+    prefix += "/";
+
+    /*
+     * The messages removed from each IMAP folder, and how many of them
+     * were unread.
+     */
+    std::map < std::shared_ptr<CMaildir>, std::pair < int, int > > imap;
+    std::unordered_set<std::shared_ptr<CMessage> > removed;
+    std::vector<std::string> paths;
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if (! msg || (removed.find(msg) != removed.end()))
+            continue;
+
+        bool was_new = msg->is_new();
+        std::string path = msg->path();
+
+        if (! msg->unlink())
+            continue;
+
+        removed.insert(msg);
+
+        if (msg->is_imap())
+        {
+            if (msg->parent())
+            {
+                std::pair < int, int > &folder = imap[msg->parent()];
+                folder.first  += 1;
+                folder.second += was_new ? 1 : 0;
+            }
+
+            continue;
+        }
+
+        paths.push_back(path);
+
+        if (local && (path.compare(0, prefix.size(), prefix) == 0))
+        {
+            total  -= 1;
+            unread -= was_new ? 1 : 0;
+        }
+    }
+
+    if (removed.empty())
+        return 0;
+
+    /*
+     * Update the counts of each folder, rather than counting again.
+     */
+    for (auto it = imap.begin(); it != imap.end(); ++it)
+    {
+        std::shared_ptr<CMaildir> folder = it->first;
+
+        int count = folder->total_messages() - it->second.first;
+        folder->set_total(count < 0 ? 0 : count);
+
+        count = folder->unread_messages() - it->second.second;
+        folder->set_unread(count < 0 ? 0 : count);
+    }
+
+    if (local)
+        current->set_counts(CMaildir::modified(current->path()),
+                            total < 0 ? 0 : total, unread < 0 ? 0 : unread);
+
+    m_summaries.invalidate();
+
+    /*
+     * Remove them from our list with a single pass.
+     */
+    if (m_messages != NULL)
+    {
+        for (const std::string &path : paths)
+            m_message_index.erase(path);
+
+        size_t count = m_messages->size();
+
+        m_messages->erase(std::remove_if(m_messages->begin(), m_messages->end(),
+                                         [&removed](const std::shared_ptr<CMessage> &msg)
+        {
+            return (removed.find(msg) != removed.end());
+        }), m_messages->end());
+
+        if (m_messages->size() != count)
+        {
+            m_messages_generation = ++m_generations;
+
+            CConfig *config = CConfig::instance();
+            config->set("index.max", m_messages->size());
+        }
+    }
+
+    if (m_current_message && (removed.find(m_current_message) != removed.end()))
+        m_current_message = NULL;
+
+    return ((int) removed.size());
+}
+
+
+/*
+ * Fetch the headers of the messages about to be drawn, and start
+ * fetching those of the messages which follow them.
+ */
+void CGlobalState::prefetch_messages(CMessageList &visible, CMessageList &following)
+{
+    request_headers(visible, true);
+    request_headers(following, false);
+}
+
+
+/*
+ * Parse, and decode, the given message upon one of our workers, giving
+ * the results to the message once that's done.
+ */
+static void prepare_message(std::shared_ptr<CMessage> msg, int iconv, CJobToken token)
+{
+    std::string file = msg->path();
+    std::shared_ptr<std::shared_ptr<CParsedMessage>> parsed =
+                std::make_shared<std::shared_ptr<CParsedMessage>>();
+
+    CJobQueue::instance()->submit([file, iconv, parsed](const CJobToken &)
+    {
+        *parsed = CMessage::prepare(file, iconv);
+    },
+    [msg, file, parsed]()
+    {
+        msg->adopt(file, *parsed);
+    }, JOB_PREFETCH, token);
+}
+
+
+/*
+ * Prepare the given messages, cancelling those we were preparing.
+ */
+void CGlobalState::prepare_messages(CMessageList &messages)
+{
+    if (messages == m_preparing)
+        return;
+
+    m_preparing_token.cancel();
+    m_preparing_token = CJobToken();
+    m_preparing = messages;
+
+    /*
+     * A Lua filter may replace the file a message is parsed from,
+     * and that can only be called upon this thread.
+     */
+    if (CLua::instance()->function_exists("message_replace"))
+        return;
+
+    int iconv = CConfig::instance()->get_integer("global.iconv", 0);
+    CJobToken token = m_preparing_token;
 
-        for (Json::ValueConstIterator it = messages.begin(); it != messages.end(); ++it)
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if (! msg || msg->parts_known())
+            continue;
+
+        if (! msg->is_imap())
         {
-            /*
-             * The array-member
-             */
-            Json::Value single = (*it);
+            prepare_message(msg, iconv, token);
+            continue;
+        }
 
-            /*
-             * The flags and ID of the message.
-             */
-            int id_val            = single["id"].asInt();
-            std::string flags_val = single["flags"].asString();
+        if (msg->imap_body_cached())
+        {
+            prepare_message(msg, iconv, token);
+            continue;
+        }
 
-            /*
-             * Create a path to hold the IMAP message.
-             *
-             * The path will be $cache/$server/$folder/NN
-             */
-            std::string path = imap_cache;
-            path += "/";
-            path += escape_filename(imap_server);
-            path += "/";
-            path += escape_filename(folder);
+        if (! msg->parent())
+            continue;
 
-            CDirectory::mkdir_p(path);
+        /*
+         * The body is stored even if we've since moved on, as it may
+         * yet be wanted, and it's cheaper to keep than to fetch again.
+         */
+        std::string cmd = "get_message " + std::to_string(msg->imap_id()) +
+                          " " + msg->parent()->path() + "\n";
 
-            path += "/";
-            path += std::to_string(id_val);
+        CIMAPProxy::instance()->request(cmd, [msg, iconv, token](std::string reply)
+        {
+            if (! msg->imap_body_cached())
+                msg->set_imap_body(reply);
 
-            /*
-             * Now create the message-object, pointing to the suitable
-             * path, making sure that it is marked as non-local.
-             */
-            std::shared_ptr < CMessage > t = std::shared_ptr < CMessage >(new CMessage(path, false));
-            t->path(path);
+            if (! token.cancelled() && msg->imap_body_cached())
+                prepare_message(msg, iconv, token);
+        });
+    }
+}
 
-            /*
-             * Split the flags into sane things.
-             */
-            std::string f;
-            std::vector<std::string> flags = split(flags_val, ',');
 
-            for (auto it = flags.begin() ; it != flags.end(); ++it)
-            {
-                std::string flag = (*it);
+/*
+ * Store the headers held in the reply to a `get_headers_bulk` request
+ * in the messages they belong to.
+ */
+static void store_headers(CMessageList &messages, const std::string &reply)
+{
+    std::unordered_map < int, std::shared_ptr<CMessage> > by_id;
 
-                if (flag == "\\Seen")
-                    f += "S";
+    for (std::shared_ptr<CMessage> msg : messages)
+        by_id[msg->imap_id()] = msg;
 
-                if (flag == "\\Unseen")
-                    f += "N";
+    for (auto &entry : CIMAPProxy::split_bulk(reply))
+    {
+        auto it = by_id.find(entry.first);
 
-                if (flag == "\\Answered")
-                    f += "R";
-            }
+        if (it != by_id.end())
+            it->second->set_imap_headers(entry.second);
+    }
+}
 
-            /*
-             * Empty flag == new message.
-             */
-            if (f.empty())
-                f = "N";
 
-            /*
-             * Set the flags and ID to the message.  The flags will be
-             * usable as-is.
-             *
-             * The ID means that the message-object can fetch its own
-             * body on-demand when it wants to.
-             */
-            t->parent(current);
-            t->set_imap_flags(f);
-            t->set_imap_id(id_val);
+/*
+ * Request the headers of the given messages, which we don't yet have.
+ */
+void CGlobalState::request_headers(CMessageList &messages, bool wait)
+{
+    std::map < std::shared_ptr<CMaildir>, CMessageList > folders;
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        if (! msg || ! msg->is_imap() || ! msg->parent())
+            continue;
+
+        if (msg->imap_headers_cached() || (m_prefetching.find(msg) != m_prefetching.end()))
+            continue;
+
+        folders[msg->parent()].push_back(msg);
+    }
+
+    CIMAPProxy *proxy = CIMAPProxy::instance();
+    std::vector < std::pair < int, CMessageList > > waiting;
+
+    for (auto it = folders.begin(); it != folders.end(); ++it)
+    {
+        CMessageList batch = it->second;
+        std::string ids;
+
+        for (std::shared_ptr<CMessage> msg : batch)
+        {
+            if (! ids.empty())
+                ids += ",";
+
+            ids += std::to_string(msg->imap_id());
+        }
+
+        std::string cmd = "get_headers_bulk " + ids + " " + it->first->path() + "\n";
+
+        if (wait)
+        {
+            waiting.push_back(std::make_pair(proxy->send_request(cmd), batch));
+            continue;
+        }
+
+        for (std::shared_ptr<CMessage> msg : batch)
+            m_prefetching.insert(msg);
+
+        proxy->request(cmd, [this, batch](std::string reply)
+        {
+            CMessageList fetched = batch;
+            store_headers(fetched, reply);
+
+            for (std::shared_ptr<CMessage> msg : fetched)
+                m_prefetching.erase(msg);
+        });
+    }
+
+    /*
+     * All of our requests were sent before we wait for any of them.
+     */
+    for (auto it = waiting.begin(); it != waiting.end(); ++it)
+        store_headers(it->second, proxy->wait_reply(it->first));
+}
+
+
+/*
+ * Apply the changes reported by our maildir-watcher to the
+ * current list of messages.
+ */
+void CGlobalState::apply_message_changes(std::vector<maildir_change> &changes)
+{
+    std::shared_ptr<CMessageArena> arena;
+
+    for (maildir_change change : changes)
+    {
+        auto found = m_message_index.find(change.path);
 
+        if (change.added)
+        {
             /*
-             * Add the message to our list.
+             * If we know of this path already there's nothing to do.
              */
+            if (found != m_message_index.end())
+                continue;
+
+            if (! arena)
+                arena = CMessageArena::folder(m_index_maildir);
+
+            std::shared_ptr<CMessage> t = arena->message(change.path);
             m_messages->push_back(t);
+            m_message_index[change.path] = t;
+            continue;
+        }
 
-            count += 1;
+        if (found == m_message_index.end())
+            continue;
+
+        std::shared_ptr<CMessage> msg = found->second;
+        m_message_index.erase(found);
+
+        /*
+         * If the message has a different path now then we renamed
+         * it ourselves, when changing its flags, so it is still present
+         * and just needs re-indexing.
+         */
+        if (msg->path() != change.path)
+        {
+            m_message_index[msg->path()] = msg;
+            continue;
         }
 
-        config->set("index.max", count);
+        auto pos = std::find(m_messages->begin(), m_messages->end(), msg);
+
+        if (pos != m_messages->end())
+            m_messages->erase(pos);
+    }
+
+    m_messages_generation = ++m_generations;
+}
+
+
+/*
+ * Apply changes we've made to message-files ourselves.
+ */
+void CGlobalState::messages_changed(std::vector<maildir_change> &changes)
+{
+    /*
+     * Whichever maildirs these were, their counts have changed.
+     */
+    m_summaries.invalidate();
+
+    std::shared_ptr<CMaildir> current = current_maildir();
+
+    if (! current || ! current->is_maildir() || (m_messages == NULL))
         return;
+
+    std::string prefix = current->path();
+
+    while ((prefix.size() > 1) && (prefix[prefix.size() - 1] == '/'))
+        prefix.erase(prefix.size() - 1);
+
+    prefix += "/";
+
+    std::vector<maildir_change> ours;
+
+    for (maildir_change change : changes)
+    {
+        if (change.added && (change.path.compare(0, prefix.size(), prefix) != 0))
+            continue;
+
+        ours.push_back(change);
     }
 
+    apply_message_changes(ours);
+
+    CConfig *config = CConfig::instance();
+    config->set("index.max", m_messages->size());
+}
+
+
+/*
+ * Rescan the given maildir, reusing the existing message-objects
+ * for each file which is still present.
+ */
+void CGlobalState::merge_messages(std::shared_ptr<CMaildir> folder)
+{
+    CLogger *logger = CLogger::instance();
+    logger->log("maildir", "Rescanning %s.", folder->path().c_str());
 
     /*
-     * Get the messages from the maildir.
+     * Index the current messages by their current path.
      */
-    if (current)
+    std::unordered_map<std::string, std::shared_ptr<CMessage> > old;
+
+    for (std::shared_ptr<CMessage> msg : *m_messages)
+        old[msg->path()] = msg;
+
+    std::shared_ptr<CMessageArena> arena = CMessageArena::folder(folder->path());
+
+    m_messages->clear();
+
+    std::vector < std::string > dirs;
+    dirs.push_back(folder->path() + "/cur/");
+    dirs.push_back(folder->path() + "/new/");
+
+    std::vector<CDirectoryEntry> entries;
+
+    for (std::string path : dirs)
     {
-        logger->log("maildir", "%s", "Fetching messages.");
-        CMessageList contents = current->getMessages();
+        path.erase(std::unique(path.begin(), path.end(), both_slashes()), path.end());
 
-        for (std::shared_ptr<CMessage> content : contents)
+        entries.clear();
+        CDirectory::list(path, entries, old.size());
+
+        for (CDirectoryEntry entry : entries)
         {
-            m_messages->push_back(content) ;
+            std::string file = path + entry.name;
+            auto found = old.find(file);
+
+            if (found != old.end())
+            {
+                m_messages->push_back(found->second);
+                continue;
+            }
+
+            if (entry.is_directory())
+                continue;
+
+            if (entry.is_unknown() && CFile::is_directory(file))
+                continue;
+
+            std::shared_ptr<CMessage> t = arena->message(file);
+            t->set_inode(entry.inode);
+            seed_message(t);
+            m_messages->push_back(t);
         }
     }
 
-    logger->log("maildir", "Found %d message(s).", m_messages->size());
+    m_messages_generation = ++m_generations;
+    index_messages();
 
-    config->set("index.max", m_messages->size());
+    /*
+     * Our watch may have been dropped if events were lost.
+     */
+    if (! m_watcher.is_watching())
+        m_watcher.watch(folder->path());
+}
+
+
+/*
+ * Keep the messages of the local maildir we're leaving.
+ */
+bool CGlobalState::stash_messages()
+{
+    CConfig *config = CConfig::instance();
+    int max = config->get_integer("index.folder_cache", 4);
+
+    if ((max <= 0) || m_index_maildir.empty() || (m_messages == NULL))
+        return false;
+
+    /*
+     * Apply whatever our watcher has seen, so that the messages are
+     * current as of the maildir's modification-time.  If we can't then
+     * the maildir is rescanned when we return to it.
+     */
+    bool exact = m_watcher.is_watching() && (m_watcher.path() == m_index_maildir);
+
+    if (exact)
+    {
+        std::vector<maildir_change> changes;
+
+        if (m_watcher.poll(changes))
+            apply_message_changes(changes);
+        else
+            exact = false;
+    }
+
+    CMaildir folder(m_index_maildir);
+
+    m_folder_cache.push_front(folder_messages());
+
+    folder_messages &entry = m_folder_cache.front();
+    entry.path       = m_index_maildir;
+    entry.messages   = m_messages;
+    entry.mtime      = exact ? folder.last_modified() : -1;
+    entry.stashed    = time(NULL);
+    entry.generation = m_messages_generation;
+    entry.index.swap(m_message_index);
+
+    m_messages = NULL;
+
+    /*
+     * Forget the maildirs we left longest ago.
+     */
+    while (m_folder_cache.size() > (size_t) max)
+    {
+        delete(m_folder_cache.back().messages);
+        m_folder_cache.pop_back();
+    }
+
+    return true;
+}
+
+
+/*
+ * Reuse the messages we kept of the given maildir.
+ */
+bool CGlobalState::restore_messages(std::shared_ptr<CMaildir> folder)
+{
+    auto found = std::find_if(m_folder_cache.begin(), m_folder_cache.end(),
+                              [&folder](const folder_messages &entry)
+    {
+        return (entry.path == folder->path());
+    });
+
+    if (found == m_folder_cache.end())
+        return false;
+
+    delete(m_messages);
+
+    m_messages = found->messages;
+    m_message_index.swap(found->index);
+
+    time_t mtime      = found->mtime;
+    time_t stashed    = found->stashed;
+    uint64_t previous = found->generation;
+
+    m_folder_cache.erase(found);
+
+    /*
+     * If the maildir hasn't been modified since we left it, in a second
+     * which has since passed, nothing has changed - so the list keeps
+     * its generation, and copies made of it remain valid.  Otherwise
+     * we rescan it, reusing each message which is still present.
+     */
+    if ((mtime != -1) && (mtime < stashed) && (folder->last_modified() == mtime))
+        m_messages_generation = previous;
+    else
+        merge_messages(folder);
+
+    return true;
+}
+
+
+/*
+ * Rebuild our path-index from the current list of messages.
+ */
+void CGlobalState::index_messages()
+{
+    m_message_index.clear();
+
+    for (std::shared_ptr<CMessage> msg : *m_messages)
+        m_message_index[msg->path()] = msg;
+}
+
+
+/*
+ * Seed the given message from our maildir-index, if possible.
+ */
+void CGlobalState::seed_message(std::shared_ptr<CMessage> msg)
+{
+    if (msg->inode() == 0)
+        return;
+
+    CHeaderList headers;
+    time_t date = 0;
+    uint32_t attributes = 0;
+    time_t mtime = 0;
+    off_t size = 0;
+
+    if (m_index.lookup(msg->inode(), msg->path(), headers, date, attributes, mtime, size))
+    {
+        msg->seed_headers(headers, true);
+        msg->set_ctime(date);
+        msg->set_stat(mtime, size);
+
+        if (attributes & INDEX_ATTACHMENTS_KNOWN)
+            msg->set_attachments((attributes & INDEX_ATTACHMENTS) != 0);
+    }
+}
+
+
+/*
+ * Write the index of the local maildir our messages came from.
+ */
+void CGlobalState::save_index()
+{
+    if (m_index_maildir.empty() || (m_messages == NULL))
+        return;
+
+    std::string index = CMaildirIndex::index_file(m_index_maildir);
+
+    if (index.empty())
+        return;
+
+    /*
+     * If no message has been parsed, nor had its attachments counted,
+     * since the index was loaded there's nothing new to record.
+     */
+    bool dirty = false;
+
+    for (std::shared_ptr<CMessage> msg : *m_messages)
+    {
+        if ((msg->headers_known() && ! msg->headers_seeded()) ||
+                (msg->attachments_known() && ! msg->attachments_seeded()))
+        {
+            dirty = true;
+            break;
+        }
+    }
+
+    if (! dirty)
+        return;
+
+    m_index.close();
+
+    CLogger *logger = CLogger::instance();
+    logger->log("maildir", "Saving index %s.", index.c_str());
+
+    /*
+     * The index is built from our messages now, and written to disk
+     * while we carry on.
+     */
+    m_index.save_background(index, m_index_maildir, m_messages);
 }
 
 
@@ -591,6 +1922,14 @@ std::shared_ptr<CMaildir>CGlobalState::current_maildir()
  */
 void CGlobalState::set_maildir(std::shared_ptr<CMaildir> updated)
 {
+    CTraceSpan span("set_maildir ", updated ? updated->path() : "");
+
+    /*
+     * Jobs concerning the previous folder are no longer wanted.
+     */
+    if ((m_current_maildir ? m_current_maildir->path() : "") != (updated ? updated->path() : ""))
+        CJobQueue::instance()->folder_changed();
+
     m_current_maildir = updated;
 
     update_messages();
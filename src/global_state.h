@@ -20,14 +20,25 @@
 #pragma once
 
 
+#include <list>
 #include <memory>
+#include <stdint.h>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "imap_sync.h"
+#include "job_queue.h"
 #include "maildir.h"
+#include "maildir_index.h"
+#include "maildir_loader.h"
+#include "maildir_summary.h"
+#include "maildir_watcher.h"
 #include "message.h"
 #include "observer.h"
 #include "singleton.h"
+#include "virtual_folder.h"
 
 
 /**
@@ -55,15 +66,37 @@ public:
 public:
 
     /**
-     * Get the available maildirs.
+     * Get the available maildirs, finding them first if the settings
+     * which determine them have changed since we last did so.
      */
     std::vector<std::shared_ptr<CMaildir>> get_maildirs();
 
+    /**
+     * Get the path, and counts, of each of our maildirs, sorted by path.
+     *
+     * The counts of local maildirs are refreshed upon our workers, every
+     * `maildir.summary_interval` seconds, so they may briefly lag behind
+     * changes made by other programs.
+     */
+    const std::vector<maildir_summary> &maildir_summaries();
+
+    /**
+     * A number which changes whenever the result of `maildir_summaries`
+     * does.
+     */
+    uint64_t summaries_generation();
+
     /**
      * Get the messages in the currently-selected folder.
      */
     std::vector<std::shared_ptr<CMessage> > *get_messages();
 
+    /**
+     * A number which changes whenever the messages returned by
+     * `get_messages` do, so that copies of them may be kept until then.
+     */
+    uint64_t messages_generation();
+
     /**
      * Get the currently selected message.
      */
@@ -85,6 +118,21 @@ public:
      */
     void set_maildir(std::shared_ptr<CMaildir >  folder);
 
+    /**
+     * Define a virtual folder, replacing any of the same name, which
+     * will appear amongst our maildirs.
+     *
+     * Returns false, with a description of the problem, if the query
+     * is invalid.
+     */
+    bool add_virtual_folder(std::string name, std::string folders, std::string query,
+                            std::string &error);
+
+    /**
+     * Remove the virtual folder with the given name.
+     */
+    void remove_virtual_folder(std::string name);
+
 public:
 
     /**
@@ -98,12 +146,164 @@ public:
      */
     void update_messages(bool force = false);
 
+    /**
+     * Apply changes we've made to message-files ourselves, such as
+     * moving them between maildirs, to the list of messages.
+     *
+     * Files added to maildirs other than the current one are ignored.
+     */
+    void messages_changed(std::vector<maildir_change> &changes);
+
+    /**
+     * Collect any messages found by our background loader, appending
+     * them to the list returned by `get_messages`.
+     *
+     * This is called from the main-loop, and returns true if the list
+     * changed.  The Lua function `on_messages_loaded` is invoked, if it
+     * exists, each time a batch is collected.
+     */
+    bool poll_messages();
+
+    /**
+     * Add, and remove, the given flags upon each of the given messages.
+     *
+     * Local messages are each renamed once.  IMAP messages are updated
+     * with a single command per folder, and each folder's counters are
+     * updated once at the end.
+     *
+     * Returns the number of messages which changed.
+     */
+    int apply_flags(CMessageList &messages, std::string add, std::string remove);
+
+    /**
+     * Delete each of the given messages.
+     *
+     * Our list of messages, and the counts of their folders, are
+     * updated in place, rather than the folders being read again, and
+     * our generation changes just once.
+     *
+     * Returns the number of messages which were deleted.
+     */
+    int remove_messages(CMessageList &messages);
+
+    /**
+     * Fetch the headers of the given IMAP messages, which are about to
+     * be drawn, with a single request to each folder.  Their bodies are
+     * only fetched once they're needed.
+     *
+     * The headers of the `following` messages are requested without
+     * waiting, so that they're ready by the time they're scrolled to.
+     */
+    void prefetch_messages(CMessageList &visible, CMessageList &following);
+
+    /**
+     * Parse, and decode, the given messages upon our workers, fetching
+     * the bodies of any IMAP messages first, so that they're ready to be
+     * displayed.  They're prepared in the order given.
+     *
+     * Each call cancels whatever remains of the previous one, so that
+     * the preparation follows the message being viewed.
+     */
+    void prepare_messages(CMessageList &messages);
+
     /**
      * This method is called when a configuration key changes,
      * via our observer implementation.
      */
     void update(std::string key_name, CConfigEntry *old);
 
+    /**
+     * Called once a batch of configuration changes has been delivered,
+     * to perform the updates they required just once.
+     */
+    void batch_complete();
+
+private:
+
+    /**
+     * Update our messages, or maildirs, as a configuration change
+     * requires.  While a batch of changes is delivered updating our
+     * messages is deferred until `batch_complete`, while our maildirs
+     * are only found again once they're next asked for.
+     */
+    void refresh_messages();
+    void refresh_maildirs();
+
+    /**
+     * Apply the changes reported by our maildir-watcher to the
+     * current list of messages.
+     */
+    void apply_message_changes(std::vector<maildir_change> &changes);
+
+    /**
+     * Rescan the given maildir, reusing the existing message-objects
+     * for each file which is still present.
+     */
+    void merge_messages(std::shared_ptr<CMaildir> folder);
+
+    /**
+     * Rebuild our path-index from the current list of messages.
+     */
+    void index_messages();
+
+    /**
+     * Keep the messages of the local maildir we're leaving, so that we
+     * may return to it cheaply.  Returns false if they can't be kept,
+     * in which case they remain ours to free.
+     */
+    bool stash_messages();
+
+    /**
+     * Reuse the messages we kept of the given maildir, if we have them,
+     * applying any changes made to it since.
+     */
+    bool restore_messages(std::shared_ptr<CMaildir> folder);
+
+    /**
+     * Seed the given message from our maildir-index, if possible.
+     */
+    void seed_message(std::shared_ptr<CMessage> msg);
+
+    /**
+     * Write the index of the local maildir our messages came from.
+     */
+    void save_index();
+
+    /**
+     * Handle the IMAP proxy's reply to our request for folders, or for
+     * the changes to the messages in the given folder since `state`.
+     */
+    void imap_folders_loaded(uint64_t request, std::string json);
+    void imap_messages_loaded(uint64_t request, std::shared_ptr<CMaildir> current,
+                              std::shared_ptr<CIMAPSync> state, std::string json);
+
+    /**
+     * Populate our messages from our state of the given IMAP folder, and
+     * find the file in which that state is kept.
+     */
+    void imap_messages_populate(std::shared_ptr<CMaildir> current, std::shared_ptr<CIMAPSync> state);
+    std::string imap_sync_path(std::shared_ptr<CMaildir> folder);
+
+    /**
+     * Ask the IMAP proxy for the changes to the current folder since our
+     * state of it.
+     */
+    void imap_messages_sync(std::shared_ptr<CMaildir> current);
+
+    /**
+     * Handle an event from the IMAP proxy, resynchronising the current
+     * folder if it has changed.
+     */
+    void imap_folder_changed(std::string json);
+
+    /**
+     * Request the headers of those of the given messages which we've
+     * neither fetched, nor requested, with a single request per folder.
+     * If `wait` is true we wait for them, otherwise they're stored as
+     * they arrive.
+     */
+    void request_headers(CMessageList &messages, bool wait);
+
 private:
 
     /**
@@ -111,6 +311,17 @@ private:
      */
     std::vector<std::shared_ptr<CMaildir> > m_maildirs;
 
+    /**
+     * The sorted summaries of our maildirs.
+     */
+    CMaildirSummaries m_summaries;
+
+    /**
+     * The virtual folders which have been defined, which are kept up to
+     * date while they're amongst our maildirs.
+     */
+    std::vector<std::shared_ptr<CVirtualFolder> > m_virtual_folders;
+
     /**
      * The currently selected maildir.
      */
@@ -121,8 +332,112 @@ private:
      */
     std::vector<std::shared_ptr<CMessage> > *m_messages;
 
+    /**
+     * The messages in the current local maildir, keyed by the path
+     * they had when we last saw them.
+     */
+    std::unordered_map<std::string, std::shared_ptr<CMessage> > m_message_index;
+
+    /**
+     * Watches the currently selected local maildir for new, and
+     * removed, messages.
+     */
+    CMaildirWatcher m_watcher;
+
+    /**
+     * Loads the messages of the current local maildir in the background.
+     */
+    CMaildirLoader m_loader;
+
+    /**
+     * The persistent index of the current local maildir.
+     */
+    CMaildirIndex m_index;
+
+    /**
+     * The local maildir our messages were read from, if any.
+     */
+    std::string m_index_maildir;
+
     /**
      * The currently selected message.
      */
     std::shared_ptr<CMessage> m_current_message;
+
+    /**
+     * Updates required by the batch of configuration changes being
+     * delivered.
+     */
+    bool m_pending_messages;
+
+    /**
+     * Must our maildirs be found again before they're returned?
+     */
+    bool m_maildirs_stale;
+
+    /**
+     * The batch of configuration changes during which our messages
+     * were last updated.
+     */
+    uint64_t m_messages_batch;
+
+    /**
+     * Changed whenever our messages do, and the number from which each
+     * new generation is taken.  A list we return to keeps its
+     * generation if nothing has changed since we left it.
+     */
+    uint64_t m_messages_generation;
+    uint64_t m_generations;
+
+    /**
+     * The messages of a local maildir we've left, along with our
+     * path-index of them.
+     *
+     * They're current as of the maildir's modification-time, or if
+     * that is -1 the maildir must be rescanned to be sure of them.
+     */
+    typedef struct _folder_messages
+    {
+        std::string path;
+        CMessageList *messages;
+        std::unordered_map<std::string, std::shared_ptr<CMessage> > index;
+        time_t mtime;
+        time_t stashed;
+        uint64_t generation;
+    } folder_messages;
+
+    /**
+     * The messages of the `index.folder_cache` maildirs we've most
+     * recently left, the most recent first.
+     */
+    std::list<folder_messages> m_folder_cache;
+
+    /**
+     * Our latest requests for IMAP folders, and messages, so that we
+     * may ignore the replies to earlier ones.
+     */
+    uint64_t m_folders_request;
+    uint64_t m_messages_request;
+
+    /**
+     * Our state of the current IMAP folder, whether we're waiting for
+     * the proxy to tell us what has changed in it, and whether it has
+     * changed again since we asked.
+     */
+    std::shared_ptr<CIMAPSync> m_imap_state;
+    bool m_imap_syncing;
+    bool m_imap_changed;
+
+    /**
+     * The IMAP messages whose headers we've requested, but not yet
+     * received.
+     */
+    std::unordered_set<std::shared_ptr<CMessage> > m_prefetching;
+
+    /**
+     * The messages we were last asked to prepare, and the token by which
+     * the jobs preparing them may be cancelled.
+     */
+    CMessageList m_preparing;
+    CJobToken m_preparing_token;
 };
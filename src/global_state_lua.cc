@@ -19,12 +19,23 @@
 
 #include <algorithm>
 #include <iostream>
+#include <stdio.h>
+#include <unistd.h>
 
+#include "cache.h"
 #include "config.h"
 #include "global_state.h"
+#include "history.h"
+#include "intern.h"
 #include "maildir_lua.h"
+#include "message_filter.h"
+#include "message_arena.h"
+#include "message_id_index.h"
 #include "message_lua.h"
+#include "message_sort.h"
+#include "message_threader.h"
 #include "lua.h"
+#include "part_cache.h"
 #include "screen.h"
 
 
@@ -42,6 +53,204 @@
  */
 
 
+/**
+ * Collect the messages in the table at the given stack-index.
+ */
+static CMessageList table_to_messages(lua_State * l, int index)
+{
+    CMessageList messages;
+
+    luaL_checktype(l, index, LUA_TTABLE);
+
+#if LUA_VERSION_NUM == 501
+    size_t n = lua_objlen(l, index);
+#else
+    size_t n = lua_rawlen(l, index);
+#endif
+    messages.reserve(n);
+
+    for (size_t i = 1; i <= n; i++)
+    {
+        lua_rawgeti(l, index, i);
+        messages.push_back(l_CheckCMessage(l, -1));
+        lua_pop(l, 1);
+    }
+
+    return (messages);
+}
+
+
+/**
+ * Implementation of `Global:add_virtual_folder`.
+ *
+ * Define a virtual folder holding the messages of the maildirs matching
+ * the given pattern which match the given query.
+ */
+int l_CGlobalState_add_virtual_folder(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_add_virtual_folder");
+
+    const char *name    = luaL_checkstring(l, 2);
+    const char *folders = luaL_checkstring(l, 3);
+    const char *query   = luaL_optstring(l, 4, "all");
+
+    std::string error;
+    CGlobalState *global = CGlobalState::instance();
+
+    if (! global->add_virtual_folder(name, folders, query, error))
+    {
+        lua_pushnil(l);
+        lua_pushstring(l, error.c_str());
+        return 2;
+    }
+
+    lua_pushboolean(l, 1);
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:remove_virtual_folder`.
+ */
+int l_CGlobalState_remove_virtual_folder(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_remove_virtual_folder");
+
+    const char *name = luaL_checkstring(l, 2);
+
+    CGlobalState *global = CGlobalState::instance();
+    global->remove_virtual_folder(name);
+
+    return 0;
+}
+
+
+/**
+ * Implementation of `Global:apply_flags`.
+ *
+ * Apply a change such as "+S-N" to each message in the given table,
+ * returning the number of messages which changed.
+ */
+int l_CGlobalState_apply_flags(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_apply_flags");
+
+    CMessageList messages = table_to_messages(l, 2);
+    const char *spec = luaL_checkstring(l, 3);
+
+    /*
+     * Split the specification into the flags to add, and remove.
+     */
+    std::string add, remove;
+    bool adding = true;
+
+    for (const char *p = spec; *p; p++)
+    {
+        if (*p == '+')
+            adding = true;
+        else if (*p == '-')
+            adding = false;
+        else if (adding)
+            add += *p;
+        else
+            remove += *p;
+    }
+
+    CGlobalState *global = CGlobalState::instance();
+    lua_pushinteger(l, global->apply_flags(messages, add, remove));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:mark_read`.
+ */
+int l_CGlobalState_mark_read(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_mark_read");
+
+    CMessageList messages = table_to_messages(l, 2);
+
+    CGlobalState *global = CGlobalState::instance();
+    lua_pushinteger(l, global->apply_flags(messages, "S", "N"));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:mark_unread`.
+ */
+int l_CGlobalState_mark_unread(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_mark_unread");
+
+    CMessageList messages = table_to_messages(l, 2);
+
+    CGlobalState *global = CGlobalState::instance();
+    lua_pushinteger(l, global->apply_flags(messages, "", "S"));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:delete_messages`.
+ */
+int l_CGlobalState_delete_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_delete_messages");
+
+    CMessageList messages = table_to_messages(l, 2);
+
+    CGlobalState *global = CGlobalState::instance();
+    lua_pushinteger(l, global->remove_messages(messages));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:find_message_id`.
+ *
+ * Return a table of the messages, in any maildir, with the given
+ * Message-ID.  There will be more than one if it is duplicated.
+ */
+int l_CGlobalState_find_message_id(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_find_message_id");
+
+    const char *id = luaL_checkstring(l, 2);
+
+    std::vector<std::string> paths = CMessageIdIndex::find(CMessageIdIndex::index_file(), id);
+
+    CMessageList messages;
+    messages.reserve(paths.size());
+
+    for (std::string path : paths)
+        messages.push_back(std::shared_ptr<CMessage>(new CMessage(path)));
+
+    push_cmessages(l, messages);
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:generations`.
+ *
+ * Return numbers which change whenever the current messages do, and
+ * whenever the flags of any message do, so that selections made from
+ * them may be kept until then.
+ */
+int l_CGlobalState_generations(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_generations");
+
+    CGlobalState *global = CGlobalState::instance();
+
+    lua_pushnumber(l, (lua_Number) global->messages_generation());
+    lua_pushnumber(l, (lua_Number) CMessage::flags_generation());
+    return 2;
+}
+
+
 /**
  * Implementation of `Global:maildirs`.
  */
@@ -69,6 +278,81 @@ int l_CGlobalState_maildirs(lua_State * L)
 }
 
 
+/**
+ * The registry-keys of our table of maildir summaries, and of the
+ * generation of the summaries it holds.
+ */
+#define MAILDIR_SUMMARIES "lumail.maildir_summaries"
+#define SUMMARIES_GENERATION "lumail.summaries_generation"
+
+
+/**
+ * Implementation of `Global:maildir_summaries`.
+ *
+ * Like the table of current messages this is kept in the registry, and
+ * rebuilt only once the summaries change, so it must not be modified.
+ */
+int l_CGlobalState_maildir_summaries(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_maildir_summaries");
+
+    CGlobalState *global = CGlobalState::instance();
+    const std::vector<maildir_summary> &summaries = global->maildir_summaries();
+    lua_Number generation = (lua_Number) global->summaries_generation();
+
+    lua_getfield(l, LUA_REGISTRYINDEX, SUMMARIES_GENERATION);
+    bool fresh = lua_isnumber(l, -1) && (lua_tonumber(l, -1) == generation);
+    lua_pop(l, 1);
+
+    if (fresh)
+    {
+        lua_getfield(l, LUA_REGISTRYINDEX, MAILDIR_SUMMARIES);
+
+        if (lua_istable(l, -1))
+        {
+            lua_pushnumber(l, generation);
+            return 2;
+        }
+
+        lua_pop(l, 1);
+    }
+
+    lua_createtable(l, summaries.size(), 0);
+    int i = 0;
+
+    for (const maildir_summary &summary : summaries)
+    {
+        lua_createtable(l, 0, 5);
+
+        push_cmaildir(l, summary.maildir);
+        lua_setfield(l, -2, "maildir");
+
+        lua_pushstring(l, summary.path.c_str());
+        lua_setfield(l, -2, "path");
+
+        lua_pushinteger(l, summary.total);
+        lua_setfield(l, -2, "total");
+
+        lua_pushinteger(l, summary.unread);
+        lua_setfield(l, -2, "unread");
+
+        lua_pushinteger(l, summary.mtime);
+        lua_setfield(l, -2, "mtime");
+
+        lua_rawseti(l, -2, ++i);
+    }
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, LUA_REGISTRYINDEX, MAILDIR_SUMMARIES);
+
+    lua_pushnumber(l, generation);
+    lua_setfield(l, LUA_REGISTRYINDEX, SUMMARIES_GENERATION);
+
+    lua_pushnumber(l, generation);
+    return 2;
+}
+
+
 /**
  * Implementation of `Global:current_maildir`.
  */
@@ -120,25 +404,128 @@ int l_CGlobalState_current_message(lua_State * l)
 
 
 /**
- * Implementation of `Global:current_messages`.
+ * The registry-keys of our table of current messages, and of the
+ * generation of the messages it holds.
  */
-int l_CGlobalState_current_messages(lua_State * l)
+#define CURRENT_MESSAGES "lumail.current_messages"
+#define CURRENT_GENERATION "lumail.current_generation"
+
+
+/**
+ * Push the table of current messages.
+ *
+ * The index-view asks for the current messages every time it is drawn,
+ * so rather than building a new table of them each time we keep the
+ * table we built in the registry, and build another only once the
+ * messages have changed.
+ */
+static void push_current_messages(lua_State * l)
 {
     CGlobalState *global = CGlobalState::instance();
-    std::vector<std::shared_ptr<CMessage> > *msgs = global->get_messages();
+    lua_Number generation = (lua_Number) global->messages_generation();
 
-    lua_createtable(l, msgs->size(), 0);
-    int i = 0;
+    lua_getfield(l, LUA_REGISTRYINDEX, CURRENT_GENERATION);
+    bool fresh = lua_isnumber(l, -1) && (lua_tonumber(l, -1) == generation);
+    lua_pop(l, 1);
 
-    for (std::vector <std::shared_ptr<CMessage>>::iterator it = msgs->begin();
-            it != msgs->end(); ++it)
+    if (fresh)
     {
-        std::shared_ptr<CMessage> m = (*it);
-        push_cmessage(l, m);
-        lua_rawseti(l, -2, i + 1);
-        i++;
+        lua_getfield(l, LUA_REGISTRYINDEX, CURRENT_MESSAGES);
+
+        if (lua_istable(l, -1))
+            return;
+
+        lua_pop(l, 1);
     }
 
+    CMessageList *messages = global->get_messages();
+
+    if (messages != NULL)
+        push_cmessages(l, *messages);
+    else
+        lua_newtable(l);
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, LUA_REGISTRYINDEX, CURRENT_MESSAGES);
+
+    lua_pushnumber(l, generation);
+    lua_setfield(l, LUA_REGISTRYINDEX, CURRENT_GENERATION);
+}
+
+
+/**
+ * Implementation of `Global:current_messages`.
+ *
+ * The table returned is shared by every caller until the messages
+ * change, so it must not be modified.
+ */
+int l_CGlobalState_current_messages(lua_State * l)
+{
+    push_current_messages(l);
+    return 1;
+}
+
+
+/**
+ * The iterator returned by `Global:each_message`.
+ */
+static int l_CGlobalState_next_message(lua_State * l)
+{
+    lua_Integer i = luaL_checkinteger(l, 2) + 1;
+
+    lua_rawgeti(l, 1, i);
+
+    if (lua_isnil(l, -1))
+        return 1;
+
+    lua_pushinteger(l, i);
+    lua_insert(l, -2);
+    return 2;
+}
+
+
+/**
+ * Implementation of `Global:each_message`.
+ *
+ * Iterate over the current messages, as `ipairs` would, without making
+ * a table of them for the caller.
+ */
+int l_CGlobalState_each_message(lua_State * l)
+{
+    lua_pushcfunction(l, l_CGlobalState_next_message);
+    push_current_messages(l);
+    lua_pushinteger(l, 0);
+    return 3;
+}
+
+
+/**
+ * Implementation of `Global:message_at`.
+ *
+ * Return the current message at the given (one-based) offset, or nil.
+ */
+int l_CGlobalState_message_at(lua_State * l)
+{
+    lua_Integer i = luaL_checkinteger(l, 2);
+    CMessageList *messages = CGlobalState::instance()->get_messages();
+
+    if ((messages != NULL) && (i >= 1) && ((size_t) i <= messages->size()))
+        push_cmessage(l, messages->at(i - 1));
+    else
+        lua_pushnil(l);
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:message_count`.
+ */
+int l_CGlobalState_message_count(lua_State * l)
+{
+    CMessageList *messages = CGlobalState::instance()->get_messages();
+
+    lua_pushinteger(l, (messages != NULL) ? messages->size() : 0);
     return 1;
 }
 
@@ -186,6 +573,337 @@ int l_CGlobalState_select_message(lua_State * l)
 }
 
 
+/**
+ * Implementation of `Global:filter_messages`.
+ *
+ * Filter the given table of messages by one of our built-in limits,
+ * defaulting to the value of `index.limit`, returning a new table.
+ *
+ * If the limit isn't built-in we return nil, and the caller should
+ * filter in Lua instead.
+ */
+int l_CGlobalState_filter_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_filter_messages");
+
+    std::string limit;
+
+    if (lua_gettop(l) >= 3)
+        limit = luaL_checkstring(l, 3);
+    else
+        limit = CConfig::instance()->get_string("index.limit", "all");
+
+    if (! CMessageFilter::is_native(limit))
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    CMessageList messages = table_to_messages(l, 2);
+    CMessageFilter::filter(messages, limit);
+
+    push_cmessages(l, messages);
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:prefetch_messages`.
+ *
+ * Given the table of messages being drawn, along with the (zero-based)
+ * offset and number of those which are visible, fetch the headers of
+ * the visible IMAP messages with a single request, and start fetching
+ * those of the `index.prefetch` messages which follow.
+ */
+int l_CGlobalState_prefetch_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_prefetch_messages");
+
+    luaL_checktype(l, 2, LUA_TTABLE);
+    int offset = luaL_checkinteger(l, 3);
+    int count  = luaL_checkinteger(l, 4);
+
+#if LUA_VERSION_NUM == 501
+    int n = (int) lua_objlen(l, 2);
+#else
+    int n = (int) lua_rawlen(l, 2);
+#endif
+
+    int ahead = CConfig::instance()->get_integer("index.prefetch", 50);
+
+    if (offset < 0)
+        offset = 0;
+
+    if (ahead < 0)
+        ahead = 0;
+
+    CMessageList visible, following;
+
+    for (int i = offset; (i < n) && (i < offset + count + ahead); i++)
+    {
+        lua_rawgeti(l, 2, i + 1);
+        std::shared_ptr<CMessage> msg = l_CheckCMessage(l, -1);
+        lua_pop(l, 1);
+
+        if (i < offset + count)
+            visible.push_back(msg);
+        else
+            following.push_back(msg);
+    }
+
+    CGlobalState *global = CGlobalState::instance();
+    global->prefetch_messages(visible, following);
+    return 0;
+}
+
+
+/**
+ * Implementation of `Global:prepare_adjacent`.
+ *
+ * Given the table of messages, and the (zero-based) offset of the one
+ * being viewed, parse and decode the `message.prefetch` messages either
+ * side of it upon our workers - nearest first, and those following
+ * before those preceding.
+ */
+int l_CGlobalState_prepare_adjacent(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_prepare_adjacent");
+
+    luaL_checktype(l, 2, LUA_TTABLE);
+    int offset = luaL_checkinteger(l, 3);
+
+#if LUA_VERSION_NUM == 501
+    int n = (int) lua_objlen(l, 2);
+#else
+    int n = (int) lua_rawlen(l, 2);
+#endif
+
+    int around = CConfig::instance()->get_integer("message.prefetch", 2);
+
+    if (around < 0)
+        around = 0;
+
+    CMessageList adjacent;
+
+    for (int distance = 1; distance <= around; distance++)
+    {
+        int positions[] = { offset + distance, offset - distance };
+
+        for (int i : positions)
+        {
+            if ((i < 0) || (i >= n))
+                continue;
+
+            lua_rawgeti(l, 2, i + 1);
+            adjacent.push_back(l_CheckCMessage(l, -1));
+            lua_pop(l, 1);
+        }
+    }
+
+    CGlobalState *global = CGlobalState::instance();
+    global->prepare_messages(adjacent);
+    return 0;
+}
+
+
+/**
+ * Implementation of `Global:sort_messages`.
+ *
+ * Sort the given table of messages by one of our built-in methods,
+ * defaulting to the value of `index.sort`, returning a new table.
+ *
+ * If the method isn't built-in we return nil, and the caller should
+ * sort in Lua instead.
+ */
+int l_CGlobalState_sort_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_sort_messages");
+
+    std::string method;
+
+    if (lua_gettop(l) >= 3)
+        method = luaL_checkstring(l, 3);
+    else
+        method = CConfig::instance()->get_string("index.sort", "none");
+
+    if (! CMessageSort::is_native(method))
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    CMessageList messages = table_to_messages(l, 2);
+    CMessageSort::sort(messages, method);
+
+    push_cmessages(l, messages);
+    return 1;
+}
+
+
+/**
+ * Implementation of `Global:thread_messages`.
+ *
+ * Thread the given table of messages, optionally sorting each thread by
+ * one of our built-in methods.  Three tables are returned:
+ *
+ * - The messages, in thread-order.
+ * - The indentation of each message, keyed by the message.
+ * - The first message of each thread, in order, with each such message
+ *   also mapped to the number of its thread.
+ */
+int l_CGlobalState_thread_messages(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_thread_messages");
+
+    std::string method;
+
+    if (lua_gettop(l) >= 3 && !lua_isnil(l, 3))
+        method = luaL_checkstring(l, 3);
+
+    CMessageList messages = table_to_messages(l, 2);
+    CThreadResult res = CMessageThreader::instance()->thread(messages, method);
+
+    lua_createtable(l, res.order.size(), 0);
+    int flat = lua_gettop(l);
+
+    lua_createtable(l, 0, res.order.size());
+    int indentation = lua_gettop(l);
+
+    lua_createtable(l, res.roots.size(), res.roots.size());
+    int roots = lua_gettop(l);
+
+    /*
+     * Each message is pushed once, and the same userdata is then used as
+     * the key of the other tables.
+     */
+    size_t thread = 0;
+
+    for (size_t i = 0; i < res.order.size(); i++)
+    {
+        push_cmessage(l, messages[res.order[i]]);
+
+        lua_pushvalue(l, -1);
+        lua_pushstring(l, res.indentation[i].c_str());
+        lua_rawset(l, indentation);
+
+        if ((thread < res.roots.size()) && (res.roots[thread] == i))
+        {
+            thread += 1;
+
+            lua_pushvalue(l, -1);
+            lua_rawseti(l, roots, thread);
+
+            lua_pushvalue(l, -1);
+            lua_pushinteger(l, thread);
+            lua_rawset(l, roots);
+        }
+
+        lua_rawseti(l, flat, i + 1);
+    }
+
+    return 3;
+}
+
+
+/**
+ * Set the given field of the table upon the top of the stack.
+ */
+static void set_stat(lua_State * l, const char *name, uint64_t value)
+{
+    lua_pushnumber(l, (lua_Number) value);
+    lua_setfield(l, -2, name);
+}
+
+
+/**
+ * Implementation of `Global:memory_stats`.
+ *
+ * Return a table of the memory used by each of our subsystems, so that
+ * the limits of their caches may be tuned.
+ */
+int l_CGlobalState_memory_stats(lua_State * l)
+{
+    CLuaLog("l_CGlobalState_memory_stats");
+
+    lua_newtable(l);
+
+    /*
+     * Our current messages, and the headers they hold.
+     */
+    CGlobalState *global = CGlobalState::instance();
+    CMessageList *messages = global->get_messages();
+
+    size_t count = messages ? messages->size() : 0;
+    size_t headers = 0;
+
+    for (size_t i = 0; i < count; i++)
+        headers += (*messages)[i]->header_bytes();
+
+    set_stat(l, "messages", count);
+    set_stat(l, "message_bytes", count * sizeof(CMessage));
+    set_stat(l, "header_bytes", headers);
+
+    /*
+     * The arenas holding them.
+     */
+    size_t arenas, reserved, allocated, released;
+    CMessageArena::totals(arenas, reserved, allocated, released);
+
+    set_stat(l, "arenas", arenas);
+    set_stat(l, "arena_bytes", reserved);
+    set_stat(l, "arena_used", allocated - released);
+
+    /*
+     * Interned strings.
+     */
+    set_stat(l, "interned", CInterned::count());
+    set_stat(l, "interned_bytes", CInterned::bytes());
+
+    /*
+     * Parsed MIME-parts.
+     */
+    CPartCache *parts = CPartCache::instance();
+    set_stat(l, "parts", parts->count());
+    set_stat(l, "part_bytes", parts->size());
+
+    /*
+     * Every `Cache` object.
+     */
+    size_t caches, entries, bytes;
+    CCache::totals(caches, entries, bytes);
+
+    set_stat(l, "caches", caches);
+    set_stat(l, "cache_entries", entries);
+    set_stat(l, "cache_bytes", bytes);
+
+    /*
+     * The Lua heap, and our history.
+     */
+    set_stat(l, "lua_heap", CLua::instance()->heap_size());
+
+    CHistory *history = CHistory::instance();
+    set_stat(l, "history", history->size());
+    set_stat(l, "history_bytes", history->bytes());
+
+    /*
+     * The size of our resident set, so the above may be compared to it.
+     */
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (fp != NULL)
+    {
+        unsigned long size = 0, resident = 0;
+
+        if (fscanf(fp, "%lu %lu", &size, &resident) == 2)
+            set_stat(l, "rss", (uint64_t) resident * sysconf(_SC_PAGESIZE));
+
+        fclose(fp);
+    }
+
+    return 1;
+}
+
+
 /**
  * Register the global `Global` object to the Lua environment,
  * and setup our public methods upon which the user may operate.
@@ -194,13 +912,31 @@ void InitGlobalState(lua_State * l)
 {
     luaL_Reg sFooRegs[] =
     {
+        {"add_virtual_folder", l_CGlobalState_add_virtual_folder},
+        {"apply_flags", l_CGlobalState_apply_flags},
         {"current_maildir", l_CGlobalState_current_maildir},
         {"current_message", l_CGlobalState_current_message},
         {"current_messages", l_CGlobalState_current_messages},
+        {"delete_messages", l_CGlobalState_delete_messages},
+        {"each_message", l_CGlobalState_each_message},
+        {"filter_messages", l_CGlobalState_filter_messages},
+        {"find_message_id", l_CGlobalState_find_message_id},
+        {"generations", l_CGlobalState_generations},
+        {"maildir_summaries", l_CGlobalState_maildir_summaries},
         {"maildirs", l_CGlobalState_maildirs},
+        {"mark_read", l_CGlobalState_mark_read},
+        {"mark_unread", l_CGlobalState_mark_unread},
+        {"memory_stats", l_CGlobalState_memory_stats},
+        {"message_at", l_CGlobalState_message_at},
+        {"message_count", l_CGlobalState_message_count},
         {"modes", l_CGlobalState_modes},
+        {"prefetch_messages", l_CGlobalState_prefetch_messages},
+        {"prepare_adjacent", l_CGlobalState_prepare_adjacent},
+        {"remove_virtual_folder", l_CGlobalState_remove_virtual_folder},
         {"select_maildir", l_CGlobalState_select_maildir},
         {"select_message", l_CGlobalState_select_message},
+        {"sort_messages", l_CGlobalState_sort_messages},
+        {"thread_messages", l_CGlobalState_thread_messages},
         {NULL, NULL}
     };
     luaL_newmetatable(l, "luaL_CGlobalState");
@@ -16,8 +16,10 @@
  * General Public License can be found in `/usr/share/common-licenses/GPL-2'
  */
 
+#include <algorithm>
 #include <assert.h>
 #include <fstream>
+#include <unistd.h>
 
 #include "history.h"
 
@@ -28,7 +30,20 @@
  */
 CHistory::CHistory()
 {
-    m_filename = "";
+    m_filename   = "";
+    m_file       = NULL;
+    m_next_stamp = 0;
+    m_max        = HISTORY_SIZE;
+}
+
+
+/*
+ * Destructor - close our file.
+ */
+CHistory::~CHistory()
+{
+    if (m_file != NULL)
+        fclose(m_file);
 }
 
 
@@ -41,6 +56,20 @@ int CHistory::size()
 }
 
 
+/*
+ * Return the number of bytes held by our entries.
+ */
+size_t CHistory::bytes()
+{
+    size_t total = 0;
+
+    for (const std::string &entry : m_history)
+        total += entry.size();
+
+    return (total);
+}
+
+
 /*
  * Get the Nth piece of history.
  */
@@ -55,6 +84,16 @@ std::string CHistory::at(size_t offset)
 }
 
 
+/*
+ * Remove the entry at the given offset.
+ */
+void CHistory::remove(size_t offset)
+{
+    m_index.erase(m_history[offset]);
+    m_history.erase(m_history.begin() + offset);
+    m_stamps.erase(m_stamps.begin() + offset);
+}
+
 
 /*
  * Add a new string to the history.
@@ -67,18 +106,35 @@ void CHistory::add(std::string entry)
     if (entry.empty())
         return;
 
+    /*
+     * If we already have this entry, then remove it - the stamps are
+     * sorted, so we can find its offset from its stamp.
+     */
+    auto existing = m_index.find(entry);
+
+    if (existing != m_index.end())
+    {
+        auto it = std::lower_bound(m_stamps.begin(), m_stamps.end(), existing->second);
+        remove(it - m_stamps.begin());
+    }
+
     m_history.push_back(entry);
+    m_stamps.push_back(m_next_stamp);
+    m_index[entry] = m_next_stamp++;
     assert(m_history.size() > 0);
 
+    while (m_history.size() > m_max)
+        remove(0);
+
     /*
-     * If we've got a filename append the history.
+     * If we've got a file append the entry.  We flush each entry so
+     * that history isn't lost if we crash.
      */
-    if (! m_filename.empty())
+    if (m_file != NULL)
     {
-        std::fstream fs;
-        fs.open(m_filename,  std::fstream::out | std::fstream::app);
-        fs << entry << "\n";
-        fs.close();
+        fputs(entry.c_str(), m_file);
+        fputc('\n', m_file);
+        fflush(m_file);
     }
 }
 
@@ -89,6 +145,8 @@ void CHistory::add(std::string entry)
 void CHistory::clear()
 {
     m_history.clear();
+    m_stamps.clear();
+    m_index.clear();
     assert(m_history.size() == 0);
 }
 
@@ -100,7 +158,13 @@ void CHistory::set_file(std::string filename)
     /*
      * Clear the current history.
      */
-    m_history.clear();
+    clear();
+
+    if (m_file != NULL)
+    {
+        fclose(m_file);
+        m_file = NULL;
+    }
 
     /*
      * Save the filename
@@ -108,14 +172,115 @@ void CHistory::set_file(std::string filename)
     m_filename = filename;
 
     /*
-     * Load the prior history
+     * Load the prior history, which de-duplicates and limits it as
+     * we go.
      */
+    size_t lines = 0;
     std::ifstream input(m_filename);
 
     for (std::string line; getline(input, line);)
     {
-        m_history.push_back(line);
+        if (line.empty())
+            continue;
+
+        add(line);
+        lines++;
     }
 
     input.close();
+
+    /*
+     * If the file held more than we kept then rewrite it, so that it
+     * doesn't grow without limit.
+     */
+    if (lines > m_history.size())
+        rewrite();
+
+    m_file = fopen(m_filename.c_str(), "a");
+}
+
+
+/*
+ * Set the number of entries we keep.
+ */
+void CHistory::set_max(size_t max)
+{
+    m_max = std::max(max, (size_t)1);
+
+    while (m_history.size() > m_max)
+        remove(0);
+}
+
+
+/*
+ * Rewrite our file, by way of a temporary file which replaces it.
+ */
+void CHistory::rewrite()
+{
+    std::string tmp = m_filename + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+
+    if (fp == NULL)
+        return;
+
+    for (const std::string &entry : m_history)
+    {
+        fputs(entry.c_str(), fp);
+        fputc('\n', fp);
+    }
+
+    if (fclose(fp) != 0)
+    {
+        unlink(tmp.c_str());
+        return;
+    }
+
+    if (rename(tmp.c_str(), m_filename.c_str()) != 0)
+        unlink(tmp.c_str());
+}
+
+
+/*
+ * Find the nearest entry to the given offset with the given prefix.
+ */
+int CHistory::search(const std::string &prefix, int offset, bool backwards)
+{
+    int count = m_history.size();
+
+    /*
+     * Every entry matches the empty prefix.
+     */
+    if (prefix.empty())
+    {
+        int next = backwards ? (offset - 1) : (offset + 1);
+        return (((next >= 0) && (next < count)) ? next : -1);
+    }
+
+    /*
+     * Otherwise visit only the entries with the prefix, which are
+     * adjacent in our index, looking for the one with the nearest stamp.
+     */
+    int found = -1;
+
+    for (auto it = m_index.lower_bound(prefix); it != m_index.end(); ++it)
+    {
+        if (it->first.compare(0, prefix.size(), prefix) != 0)
+            break;
+
+        auto pos = std::lower_bound(m_stamps.begin(), m_stamps.end(), it->second);
+        int candidate = pos - m_stamps.begin();
+
+        if (backwards)
+        {
+            if ((candidate < offset) && (candidate > found))
+                found = candidate;
+        }
+        else
+        {
+            if ((candidate > offset) && ((found == -1) || (candidate < found)))
+                found = candidate;
+        }
+    }
+
+    return (found);
 }
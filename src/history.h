@@ -18,14 +18,31 @@
 
 #pragma once
 
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
 #include <string>
 #include <vector>
 
 #include "singleton.h"
 
+
+/**
+ * The number of entries we keep, unless `global.history_size` says
+ * otherwise.
+ */
+#define HISTORY_SIZE 10000
+
+
 /**
  * Singleton class to maintain a history of input which has been
  * entered into the prompt.
+ *
+ * Each distinct line is kept once, at the point it was most recently
+ * entered, and only the most recent `HISTORY_SIZE` lines are kept.  An
+ * index of the lines, sorted by their text, allows searching for those
+ * beginning with a given prefix without visiting every entry.
  */
 class CHistory : public Singleton<CHistory>
 {
@@ -37,6 +54,11 @@ public:
        */
     int size();
 
+    /**
+     * Return the number of bytes held by the entries of the history.
+     */
+    size_t bytes();
+
     /**
      * Get the Nth piece of history.
      */
@@ -44,6 +66,8 @@ public:
 
     /**
      * Add a new string to the history.
+     *
+     * If the string is already present it is moved to the end.
      */
     void add(std::string entry);
 
@@ -54,9 +78,27 @@ public:
 
     /**
      * Set the file to write history from.
+     *
+     * If the file holds duplicate lines, or more than we keep, it is
+     * rewritten without them.
      */
     void set_file(std::string path);
 
+    /**
+     * Set the number of entries we keep, discarding the oldest if we have
+     * more than that.
+     */
+    void set_max(size_t max);
+
+    /**
+     * Find the entry nearest to `offset` which begins with `prefix`,
+     * searching towards older entries if `backwards` is true, and newer
+     * ones otherwise.  The entry at `offset` itself is not considered.
+     *
+     * Returns the offset of the entry, or -1 if there is none.
+     */
+    int search(const std::string &prefix, int offset, bool backwards);
+
 public:
 
     /**
@@ -64,16 +106,56 @@ public:
      */
     CHistory();
 
+    /**
+     * Destructor.
+     */
+    ~CHistory();
+
+private:
+
+    /**
+     * Remove the entry at the given offset.
+     */
+    void remove(size_t offset);
+
+    /**
+     * Rewrite our file to hold exactly our history.
+     */
+    void rewrite();
+
 private:
 
     /**
-     * List of history items.
+     * List of history items, oldest first.
+     */
+    std::deque<std::string> m_history;
+
+    /**
+     * The stamp of each item, which increases with each addition, so
+     * that the offset of an item may be found from its stamp.
+     */
+    std::deque<uint64_t> m_stamps;
+
+    /**
+     * The stamp of each item, by its text.
+     */
+    std::map<std::string, uint64_t> m_index;
+
+    /**
+     * The stamp of the next item to be added.
+     */
+    uint64_t m_next_stamp;
+
+    /**
+     * The number of items we keep.
      */
-    std::vector<std::string> m_history;
+    size_t m_max;
 
     /**
-     * The file to write to, may be unset.
+     * The file to write to, may be unset, and the handle we append to it
+     * with.
      */
     std::string m_filename;
+    FILE *m_file;
 
 };
@@ -18,7 +18,9 @@
 
 
 
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "file.h"
 #include "history.h"
@@ -181,11 +183,157 @@ void TestHistoryPersistence(CuTest * tc)
 }
 
 
+/**
+ * Test that duplicate entries are only kept once, at their latest
+ * position, and that the size is limited.
+ */
+void TestHistoryDuplicates(CuTest * tc)
+{
+    /*
+     * Start without a file, or the history an earlier test loaded.
+     */
+    CHistory *instance = CHistory::instance();
+    instance->set_file("bogus/path");
+    CuAssertIntEquals(tc, 0, instance->size());
+
+    instance->add("one");
+    instance->add("two");
+    instance->add("three");
+    instance->add("one");
+    instance->add("");
+
+    CuAssertIntEquals(tc, 3, instance->size());
+    CuAssertStrEquals(tc, "two", instance->at(0).c_str());
+    CuAssertStrEquals(tc, "three", instance->at(1).c_str());
+    CuAssertStrEquals(tc, "one", instance->at(2).c_str());
+
+    /*
+     * Lowering the limit discards the oldest entries.
+     */
+    instance->set_max(2);
+    CuAssertIntEquals(tc, 2, instance->size());
+    CuAssertStrEquals(tc, "three", instance->at(0).c_str());
+
+    instance->add("four");
+    CuAssertIntEquals(tc, 2, instance->size());
+    CuAssertStrEquals(tc, "one", instance->at(0).c_str());
+    CuAssertStrEquals(tc, "four", instance->at(1).c_str());
+
+    instance->set_max(HISTORY_SIZE);
+    instance->clear();
+    CuAssertIntEquals(tc, 0, instance->size());
+}
+
+
+/**
+ * Test searching the history by prefix.
+ */
+void TestHistorySearch(CuTest * tc)
+{
+    /*
+     * Start without a file, or the history an earlier test loaded.
+     */
+    CHistory *instance = CHistory::instance();
+    instance->set_file("bogus/path");
+    CuAssertIntEquals(tc, 0, instance->size());
+
+    instance->add("open INBOX");     // 0
+    instance->add("search foo");     // 1
+    instance->add("open sent-mail"); // 2
+    instance->add("quit");           // 3
+    instance->add("open drafts");    // 4
+
+    int size = instance->size();
+
+    /*
+     * Searching backwards, from beyond the newest entry.
+     */
+    CuAssertIntEquals(tc, 4, instance->search("open", size, true));
+    CuAssertIntEquals(tc, 2, instance->search("open", 4, true));
+    CuAssertIntEquals(tc, 0, instance->search("open", 2, true));
+    CuAssertIntEquals(tc, -1, instance->search("open", 0, true));
+
+    /*
+     * And forwards again.
+     */
+    CuAssertIntEquals(tc, 2, instance->search("open", 0, false));
+    CuAssertIntEquals(tc, 4, instance->search("open", 2, false));
+    CuAssertIntEquals(tc, -1, instance->search("open", 4, false));
+
+    CuAssertIntEquals(tc, 3, instance->search("q", size, true));
+    CuAssertIntEquals(tc, -1, instance->search("quitting", size, true));
+    CuAssertIntEquals(tc, -1, instance->search("zzz", size, true));
+
+    /*
+     * Every entry matches the empty prefix.
+     */
+    CuAssertIntEquals(tc, 4, instance->search("", size, true));
+    CuAssertIntEquals(tc, 3, instance->search("", 4, true));
+    CuAssertIntEquals(tc, -1, instance->search("", 0, true));
+    CuAssertIntEquals(tc, -1, instance->search("", 4, false));
+
+    /*
+     * Re-adding an entry moves it, within the index too.
+     */
+    instance->add("open INBOX");
+    CuAssertIntEquals(tc, 4, instance->search("open", size, true));
+    CuAssertStrEquals(tc, "open INBOX", instance->at(4).c_str());
+    CuAssertIntEquals(tc, 3, instance->search("open", 4, true));
+    CuAssertStrEquals(tc, "open drafts", instance->at(3).c_str());
+
+    instance->clear();
+    CuAssertIntEquals(tc, 0, instance->size());
+}
+
+
+/**
+ * Test a history file with duplicates, and too many entries, is rewritten
+ * when loaded.
+ */
+void TestHistoryCompaction(CuTest * tc)
+{
+    char path[] = "/tmp/history.XXXXXX";
+    int fd = mkstemp(path);
+    CuAssertTrue(tc, fd != -1);
+
+    std::string content = "a\nb\na\nc\nd\n";
+    CuAssertIntEquals(tc, content.size(), write(fd, content.c_str(), content.size()));
+    close(fd);
+
+    CHistory *instance = CHistory::instance();
+    instance->set_max(3);
+    instance->set_file(path);
+
+    CuAssertIntEquals(tc, 3, instance->size());
+    CuAssertStrEquals(tc, "a", instance->at(0).c_str());
+    CuAssertStrEquals(tc, "c", instance->at(1).c_str());
+    CuAssertStrEquals(tc, "d", instance->at(2).c_str());
+
+    /*
+     * The file holds what we kept, and then whatever we add.
+     */
+    instance->add("e");
+    CuAssertIntEquals(tc, 8, CFile::size(path));
+
+    instance->set_max(HISTORY_SIZE);
+    instance->set_file(path);
+    CuAssertIntEquals(tc, 4, instance->size());
+    CuAssertStrEquals(tc, "e", instance->at(3).c_str());
+
+    instance->set_file("bogus/path");
+    instance->clear();
+    CFile::delete_file(path);
+}
+
+
 CuSuite *
 history_getsuite()
 {
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, TestHistory);
     SUITE_ADD_TEST(suite, TestHistoryPersistence);
+    SUITE_ADD_TEST(suite, TestHistoryDuplicates);
+    SUITE_ADD_TEST(suite, TestHistorySearch);
+    SUITE_ADD_TEST(suite, TestHistoryCompaction);
     return suite;
 }
@@ -0,0 +1,165 @@
+/*
+ * host_identity.cc - The name of the host we're running upon.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "host_identity.h"
+
+
+/*
+ * Our short name, as `gethostname` returns it.
+ */
+static std::string local_name()
+{
+    char host[1024] = {'\0'};
+    gethostname(host, sizeof(host) - 1);
+
+    return (host);
+}
+
+
+/*
+ * Constructor.
+ */
+CHostIdentity::CHostIdentity()
+    : m_names(std::make_shared<host_names>())
+{
+    m_names->short_name = local_name();
+    m_names->resolving  = false;
+    m_names->resolved   = 0;
+
+    resolve();
+}
+
+
+/*
+ * The short name of this host.
+ */
+std::string CHostIdentity::short_name()
+{
+    std::lock_guard<std::mutex> guard(m_names->lock);
+    return (m_names->short_name);
+}
+
+
+/*
+ * The fully-qualified name of this host.
+ */
+std::string CHostIdentity::fqdn()
+{
+    const char *env = getenv("HOSTNAME");
+
+    if ((env != NULL) && (*env != '\0'))
+        return (env);
+
+    bool stale;
+    std::string name;
+
+    {
+        std::lock_guard<std::mutex> guard(m_names->lock);
+
+        stale = (time(NULL) - m_names->resolved >= HOST_REFRESH);
+        name  = m_names->fqdn.empty() ? m_names->short_name : m_names->fqdn;
+    }
+
+    if (stale)
+        resolve();
+
+    return (name);
+}
+
+
+/*
+ * Look up our name again, in the background.
+ */
+void CHostIdentity::resolve()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_names->lock);
+
+        if (m_names->resolving)
+            return;
+
+        m_names->resolving = true;
+    }
+
+    /*
+     * The thread is detached, rather than joined when we're destroyed,
+     * so that exiting never waits for a lookup which is timing out.
+     */
+    std::thread(&CHostIdentity::lookup, m_names).detach();
+}
+
+
+/*
+ * Find the canonical name of the given host via DNS.
+ */
+std::string CHostIdentity::canonical_name(const std::string &host)
+{
+    if (host.empty())
+        return "";
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_CANONNAME;
+
+    struct addrinfo *info = NULL;
+
+    if (getaddrinfo(host.c_str(), NULL, &hints, &info) != 0)
+        return "";
+
+    std::string result;
+
+    if ((info != NULL) && (info->ai_canonname != NULL))
+        result = info->ai_canonname;
+
+    freeaddrinfo(info);
+    return (result);
+}
+
+
+/*
+ * Look up the names of this host.
+ */
+void CHostIdentity::lookup(std::shared_ptr<host_names> names)
+{
+    std::string name = local_name();
+    std::string fqdn = canonical_name(name);
+
+    std::lock_guard<std::mutex> guard(names->lock);
+
+    names->short_name = name;
+
+    /*
+     * A failed lookup keeps any name we found before, and is retried
+     * along with a successful one.
+     */
+    if (! fqdn.empty())
+        names->fqdn = fqdn;
+
+    names->resolved  = time(NULL);
+    names->resolving = false;
+}
@@ -0,0 +1,104 @@
+/*
+ * host_identity.h - The name of the host we're running upon.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <time.h>
+
+#include "singleton.h"
+
+
+/**
+ * How often, in seconds, our fully-qualified name is looked up again.
+ */
+#define HOST_REFRESH 3600
+
+
+/**
+ * This singleton holds the name of the host we're running upon, which
+ * is used to generate Message-IDs and the names of the messages we save.
+ *
+ * The fully-qualified name is looked up via DNS upon a thread of our own,
+ * which is started when we're constructed - as lumail starts - and again
+ * once the name is `HOST_REFRESH` seconds old.  Nothing waits for it: until
+ * a lookup succeeds the short name is used instead, so a host with slow or
+ * broken DNS never stalls composing or saving a message.
+ */
+class CHostIdentity : public Singleton<CHostIdentity>
+{
+public:
+
+    /**
+     * Constructor - start looking up our name.
+     */
+    CHostIdentity();
+
+    /**
+     * The short name of this host, as `gethostname` returns.
+     */
+    std::string short_name();
+
+    /**
+     * The fully-qualified name of this host.
+     *
+     * This is `$HOSTNAME` if that is set, otherwise the name found by our
+     * last lookup, or the short name if none has succeeded.
+     */
+    std::string fqdn();
+
+    /**
+     * Look up our name again, in the background, unless a lookup is
+     * already running.
+     */
+    void resolve();
+
+    /**
+     * Find the canonical name of the given host via DNS, blocking until
+     * it is found.  Returns the empty string if it can't be.
+     */
+    static std::string canonical_name(const std::string &host);
+
+private:
+
+    /**
+     * Our names, which are shared with the thread looking them up, so
+     * that a lookup still running as we exit touches nothing freed.
+     */
+    typedef struct _host_names
+    {
+        std::mutex lock;
+        std::string short_name;
+        std::string fqdn;
+        bool resolving;
+        time_t resolved;
+    } host_names;
+
+    /**
+     * Look up the names of this host, and store them in the given state.
+     */
+    static void lookup(std::shared_ptr<host_names> names);
+
+private:
+
+    std::shared_ptr<host_names> m_names;
+};
@@ -0,0 +1,74 @@
+/*
+ * host_identity_test.cc - Test-cases for our host-name cache.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "host_identity.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that our names are available at once, and `$HOSTNAME` wins.
+ */
+void TestHostIdentityNames(CuTest * tc)
+{
+    char host[1024] = {'\0'};
+    gethostname(host, sizeof(host) - 1);
+
+    CHostIdentity *identity = CHostIdentity::instance();
+    CuAssertStrEquals(tc, host, identity->short_name().c_str());
+
+    const char *env = getenv("HOSTNAME");
+    std::string saved = env ? env : "";
+
+    setenv("HOSTNAME", "mail.example.com", 1);
+    CuAssertStrEquals(tc, "mail.example.com", identity->fqdn().c_str());
+
+    /*
+     * Without it we have either the short name, or the result of our
+     * lookup, whether or not that has completed.
+     */
+    unsetenv("HOSTNAME");
+    CuAssertTrue(tc, ! identity->fqdn().empty());
+
+    if (env)
+        setenv("HOSTNAME", saved.c_str(), 1);
+}
+
+
+/**
+ * Test looking up canonical names.
+ */
+void TestHostIdentityCanonical(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "", CHostIdentity::canonical_name("").c_str());
+    CuAssertTrue(tc, ! CHostIdentity::canonical_name("localhost").empty());
+}
+
+
+CuSuite *
+host_identity_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestHostIdentityNames);
+    SUITE_ADD_TEST(suite, TestHostIdentityCanonical);
+    return suite;
+}
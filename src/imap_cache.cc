@@ -0,0 +1,530 @@
+/*
+ * imap_cache.cc - The files we've fetched from IMAP, and their budget.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+#include <fstream>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "config.h"
+#include "directory.h"
+#include "file.h"
+#include "imap_cache.h"
+#include "util.h"
+
+
+/*
+ * The default budget - 1Gb.
+ */
+#define IMAP_CACHE_DEFAULT (1024 * 1024 * 1024)
+
+
+/*
+ * The first line of our index, which changes if its format does.
+ */
+#define IMAP_CACHE_MAGIC "lumail-imap-cache 1"
+
+
+/*
+ * Uses of a file closer together than this, in seconds, aren't recorded.
+ */
+#define IMAP_CACHE_TOUCH_INTERVAL 60
+
+
+/*
+ * Our budget, in bytes, or zero for none.
+ *
+ * Integer configuration values can't exceed 2Gb, so the budget may also
+ * be given as a string, optionally suffixed by "K", "M", or "G".
+ */
+static uint64_t cache_budget()
+{
+    CConfig *config = CConfig::instance();
+    std::string value = config->get_string("imap.cache_max_bytes");
+
+    if (value.empty())
+        return ((uint64_t) std::max(0, config->get_integer("imap.cache_max_bytes", IMAP_CACHE_DEFAULT)));
+
+    char *end = NULL;
+    uint64_t budget = strtoull(value.c_str(), &end, 10);
+
+    switch (tolower((unsigned char) *end))
+    {
+    case 'g':
+        budget <<= 10;
+
+    /* FALLTHROUGH */
+    case 'm':
+        budget <<= 10;
+
+    /* FALLTHROUGH */
+    case 'k':
+        budget <<= 10;
+        break;
+    }
+
+    return (budget);
+}
+
+
+/*
+ * Constructor.
+ */
+CIMAPCache::CIMAPCache()
+{
+    m_bytes   = 0;
+    m_journal = NULL;
+    m_records = 0;
+}
+
+
+/*
+ * Destructor.
+ */
+CIMAPCache::~CIMAPCache()
+{
+    flush();
+
+    if (m_journal != NULL)
+        fclose(m_journal);
+}
+
+
+/*
+ * The directory beneath which our server's messages are kept.
+ */
+std::string CIMAPCache::root()
+{
+    CConfig *config = CConfig::instance();
+    std::string imap_server = config->get_string("imap.server");
+    std::string imap_cache  = config->get_string("imap.cache");
+
+    if (imap_cache.empty())
+        imap_cache = "/tmp";
+
+    return (imap_cache + "/" + escape_filename(imap_server));
+}
+
+
+/*
+ * Store the given data, atomically.
+ */
+bool CIMAPCache::store(const std::string &path, const std::string &data)
+{
+    if (CFile::exists(path))
+    {
+        touch(path);
+        return true;
+    }
+
+    if (data.empty())
+        return false;
+
+    std::string tmp = path + ".tmp";
+
+    FILE *fp = fopen(tmp.c_str(), "wb");
+
+    if (fp == NULL)
+        return false;
+
+    bool ok = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+    ok = (fclose(fp) == 0) && ok;
+
+    if (! ok || (rename(tmp.c_str(), path.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    open();
+
+    if (path.compare(0, m_root.size() + 1, m_root + "/") == 0)
+    {
+        insert(path, data.size(), time(NULL));
+        record(path);
+        evict(path);
+    }
+
+    return true;
+}
+
+
+/*
+ * Record that the given file has been used.
+ */
+void CIMAPCache::touch(const std::string &path)
+{
+    open();
+
+    time_t now = time(NULL);
+    auto it = m_entries.find(path);
+
+    if (it == m_entries.end())
+    {
+        /*
+         * A file we didn't know of, perhaps because it was written by an
+         * older release, is tracked from now on.
+         */
+        int bytes = CFile::size(path);
+
+        if ((bytes < 0) || (path.compare(0, m_root.size() + 1, m_root + "/") != 0))
+            return;
+
+        insert(path, bytes, now);
+        record(path);
+        evict(path);
+        return;
+    }
+
+    /*
+     * Files used repeatedly move to the front of our list, but we only
+     * write to our index once in a while.
+     */
+    if ((now - it->second.atime) < IMAP_CACHE_TOUCH_INTERVAL)
+    {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.pos);
+        return;
+    }
+
+    insert(path, it->second.bytes, now);
+    record(path);
+}
+
+
+/*
+ * The number of bytes we hold.
+ */
+uint64_t CIMAPCache::size()
+{
+    open();
+    return (m_bytes);
+}
+
+
+/*
+ * The number of files we hold.
+ */
+size_t CIMAPCache::count()
+{
+    open();
+    return (m_entries.size());
+}
+
+
+/*
+ * Rewrite our index.
+ *
+ * The new index is written to a temporary file, which is renamed into
+ * place, and then becomes our journal.
+ */
+void CIMAPCache::flush()
+{
+    if (m_root.empty())
+        return;
+
+    if (m_journal != NULL)
+    {
+        fclose(m_journal);
+        m_journal = NULL;
+    }
+
+    std::string index = m_root + "/.index";
+    std::string tmp   = index + ".tmp";
+
+    FILE *fp = fopen(tmp.c_str(), "w");
+
+    if (fp == NULL)
+        return;
+
+    fprintf(fp, "%s\n", IMAP_CACHE_MAGIC);
+
+    /*
+     * The oldest are written first, so that the order of our list
+     * survives even the loss of our times.
+     */
+    for (auto it = m_lru.rbegin(); it != m_lru.rend(); ++it)
+    {
+        cache_entry &entry = m_entries[*it];
+        fprintf(fp, "%lld %llu %s\n", (long long) entry.atime,
+                (unsigned long long) entry.bytes, it->c_str());
+    }
+
+    bool ok = (ferror(fp) == 0);
+    ok = (fclose(fp) == 0) && ok;
+
+    if (! ok || (rename(tmp.c_str(), index.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return;
+    }
+
+    m_journal = fopen(index.c_str(), "a");
+    m_records = m_entries.size();
+}
+
+
+/*
+ * Load the index of our current root.
+ */
+void CIMAPCache::open()
+{
+    std::string current = root();
+
+    if (current == m_root)
+        return;
+
+    /*
+     * Our server, or cache, has changed: finish with the old one.
+     */
+    flush();
+
+    if (m_journal != NULL)
+    {
+        fclose(m_journal);
+        m_journal = NULL;
+    }
+
+    m_lru.clear();
+    m_entries.clear();
+    m_bytes = 0;
+    m_root  = current;
+
+    CDirectory::mkdir_p(m_root);
+
+    if (! load())
+        scan();
+
+    evict("");
+    flush();
+}
+
+
+/*
+ * Load our index.
+ *
+ * Each record is the time a file was used, its size, and its path, or
+ * "-" and the path of a file which has been removed.  Later records of a
+ * file replace earlier ones.
+ */
+bool CIMAPCache::load()
+{
+    std::ifstream in(m_root + "/.index");
+    std::string line;
+
+    if (! std::getline(in, line) || (line != IMAP_CACHE_MAGIC))
+        return false;
+
+    std::unordered_map < std::string, std::pair < time_t, uint64_t > > found;
+
+    while (std::getline(in, line))
+    {
+        if (line.compare(0, 2, "- ") == 0)
+        {
+            found.erase(line.substr(2));
+            continue;
+        }
+
+        char *end = NULL;
+        time_t atime = (time_t) strtoll(line.c_str(), &end, 10);
+
+        if (*end != ' ')
+            continue;
+
+        const char *digits = end + 1;
+        uint64_t bytes = strtoull(digits, &end, 10);
+
+        if ((end == digits) || (*end != ' '))
+            continue;
+
+        found[end + 1] = std::make_pair(atime, bytes);
+    }
+
+    /*
+     * Add the files, oldest first, skipping those which have gone.
+     */
+    std::vector < std::pair < time_t, std::string > > files;
+
+    for (auto &file : found)
+        files.push_back(std::make_pair(file.second.first, file.first));
+
+    std::sort(files.begin(), files.end());
+
+    for (auto &file : files)
+    {
+        if (CFile::exists(file.second))
+            insert(file.second, found[file.second].second, file.first);
+    }
+
+    return true;
+}
+
+
+/*
+ * Find the files beneath our root - each beneath the directory of its
+ * folder - using the time each was last used, or written.
+ */
+void CIMAPCache::scan()
+{
+    std::vector < CDirectoryEntry > folders;
+
+    if (! CDirectory::list(m_root, folders))
+        return;
+
+    std::vector < std::pair < time_t, std::string > > files;
+    std::unordered_map < std::string, uint64_t > sizes;
+
+    for (const CDirectoryEntry &folder : folders)
+    {
+        std::vector < CDirectoryEntry > entries;
+
+        if ((folder.name[0] == '.') || ! CDirectory::list(m_root + "/" + folder.name, entries))
+            continue;
+
+        for (const CDirectoryEntry &entry : entries)
+        {
+            const std::string &name = entry.name;
+
+            /*
+             * Our state-files, and anything half-written, aren't ours.
+             */
+            if ((name[0] == '.') ||
+                    ((name.size() > 4) && (name.compare(name.size() - 4, 4, ".tmp") == 0)))
+                continue;
+
+            std::string path = m_root + "/" + folder.name + "/" + name;
+            struct stat sb;
+
+            if ((stat(path.c_str(), &sb) != 0) || ! S_ISREG(sb.st_mode))
+                continue;
+
+            files.push_back(std::make_pair(std::max(sb.st_atime, sb.st_mtime), path));
+            sizes[path] = sb.st_size;
+        }
+    }
+
+    std::sort(files.begin(), files.end());
+
+    for (auto &file : files)
+        insert(file.second, sizes[file.second], file.first);
+}
+
+
+/*
+ * Track the given file, at the front of our list.
+ */
+void CIMAPCache::insert(const std::string &path, uint64_t bytes, time_t atime)
+{
+    auto it = m_entries.find(path);
+
+    if (it != m_entries.end())
+    {
+        m_bytes -= it->second.bytes;
+        m_lru.erase(it->second.pos);
+        m_entries.erase(it);
+    }
+
+    m_lru.push_front(path);
+
+    cache_entry entry;
+    entry.pos   = m_lru.begin();
+    entry.bytes = bytes;
+    entry.atime = atime;
+    m_entries[path] = entry;
+    m_bytes += bytes;
+}
+
+
+/*
+ * Stop tracking the given file, and remove it.
+ */
+void CIMAPCache::evict_file(const std::string &path)
+{
+    auto it = m_entries.find(path);
+
+    if (it == m_entries.end())
+        return;
+
+    m_bytes -= it->second.bytes;
+    m_lru.erase(it->second.pos);
+    m_entries.erase(it);
+
+    unlink(path.c_str());
+
+    if (m_journal != NULL)
+    {
+        fprintf(m_journal, "- %s\n", path.c_str());
+        fflush(m_journal);
+        m_records += 1;
+    }
+}
+
+
+/*
+ * Append a record of the given file to our index, rewriting the index
+ * once it holds many more records than we have files.
+ */
+void CIMAPCache::record(const std::string &path)
+{
+    if (m_journal == NULL)
+        return;
+
+    cache_entry &entry = m_entries[path];
+
+    fprintf(m_journal, "%lld %llu %s\n", (long long) entry.atime,
+            (unsigned long long) entry.bytes, path.c_str());
+    fflush(m_journal);
+
+    m_records += 1;
+
+    if (m_records > ((m_entries.size() * 2) + 1024))
+        flush();
+}
+
+
+/*
+ * Evict the least-recently used files until we're within budget, and
+ * all of those unused for too long.
+ */
+void CIMAPCache::evict(const std::string &keep)
+{
+    CConfig *config = CConfig::instance();
+
+    uint64_t budget = cache_budget();
+    int max_age = config->get_integer("imap.cache_max_age", 0);
+    time_t now = time(NULL);
+
+    while (! m_lru.empty())
+    {
+        std::string oldest = m_lru.back();
+
+        if (oldest == keep)
+            break;
+
+        bool over = (budget > 0) && (m_bytes > budget);
+        bool old  = (max_age > 0) && ((now - m_entries[oldest].atime) > max_age);
+
+        if (! over && ! old)
+            break;
+
+        evict_file(oldest);
+    }
+}
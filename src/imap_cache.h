@@ -0,0 +1,175 @@
+/*
+ * imap_cache.h - The files we've fetched from IMAP, and their budget.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <list>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <unordered_map>
+
+#include "singleton.h"
+
+
+/**
+ * This singleton manages the messages, and headers, we've fetched from
+ * our IMAP server, which are kept beneath `imap.cache`.
+ *
+ * Each file is written atomically, via a temporary file which is renamed
+ * into place, so that a failed or partial fetch never leaves anything
+ * behind which would be mistaken for the message.
+ *
+ * We record the size of each file, and when it was last used, in an
+ * index kept alongside them.  When the total exceeds the budget set by
+ * `imap.cache_max_bytes` the least-recently used files are removed, as
+ * are those unused for longer than `imap.cache_max_age` seconds.  They'll
+ * be fetched again, transparently, the next time they're needed.
+ *
+ * The index is a journal to which each use is appended, and which is
+ * rewritten once it holds many more records than files.  If there is no
+ * index the files already present are found, so that a cache filled
+ * before we tracked it is bounded too.
+ */
+class CIMAPCache : public Singleton<CIMAPCache>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CIMAPCache();
+
+    /**
+     * Destructor - rewrite our index.
+     */
+    ~CIMAPCache();
+
+public:
+
+    /**
+     * The directory beneath which the messages of our IMAP server are
+     * kept.
+     */
+    static std::string root();
+
+    /**
+     * Store the given data in the file at the given path, beneath our
+     * root, unless it exists already.
+     *
+     * Empty data, as a failed fetch returns, is never stored.  Storing a
+     * file may evict others, but never the one stored.  Returns true if
+     * the file exists afterwards.
+     */
+    bool store(const std::string &path, const std::string &data);
+
+    /**
+     * Record that the file at the given path has been used.
+     */
+    void touch(const std::string &path);
+
+    /**
+     * The number of bytes of the files we hold.
+     */
+    uint64_t size();
+
+    /**
+     * The number of files we hold.
+     */
+    size_t count();
+
+    /**
+     * Rewrite our index, holding a single record for each file.
+     */
+    void flush();
+
+private:
+
+    /**
+     * Load the index of our current root, if we've not done so.
+     */
+    void open();
+
+    /**
+     * Load our index, returning false if there isn't one.
+     */
+    bool load();
+
+    /**
+     * Find the files beneath our root, for want of an index.
+     */
+    void scan();
+
+    /**
+     * Start tracking the given file, or move it to the front of our list.
+     */
+    void insert(const std::string &path, uint64_t bytes, time_t atime);
+
+    /**
+     * Stop tracking the given file, and remove it from disk.
+     */
+    void evict_file(const std::string &path);
+
+    /**
+     * Append a record for the given file to our index.
+     */
+    void record(const std::string &path);
+
+    /**
+     * Evict files until we're within budget, keeping the one given.
+     */
+    void evict(const std::string &keep);
+
+private:
+
+    /**
+     * A file we hold, and its position in our list.
+     */
+    typedef struct _cache_entry
+    {
+        std::list < std::string >::iterator pos;
+        uint64_t bytes;
+        time_t atime;
+    } cache_entry;
+
+    /**
+     * Our files, most recently used first.
+     */
+    std::list < std::string > m_lru;
+
+    /**
+     * The entry for each file we hold, keyed by path.
+     */
+    std::unordered_map < std::string, cache_entry > m_entries;
+
+    /**
+     * The total size of our files.
+     */
+    uint64_t m_bytes;
+
+    /**
+     * The root our entries were loaded from, and the journal of its index,
+     * along with the number of records it holds.
+     */
+    std::string m_root;
+    FILE *m_journal;
+    size_t m_records;
+};
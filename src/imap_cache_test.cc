@@ -0,0 +1,173 @@
+/*
+ * imap_cache_test.cc - Test-cases for our IMAP cache.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <cstddef>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "config.h"
+#include "directory.h"
+#include "file.h"
+#include "imap_cache.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test that files are stored, that failed fetches aren't, and that the
+ * least-recently used files are evicted beyond our budget.
+ */
+void TestIMAPCacheEviction(CuTest * tc)
+{
+    char dir[] = "/tmp/imap_cache.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(dir) != NULL);
+
+    CConfig *config = CConfig::instance();
+    config->set("imap.cache", dir, false);
+    config->set("imap.server", "imaps://imap.example.com/", false);
+    config->set("imap.cache_max_bytes", 25, false);
+
+    std::string root = CIMAPCache::root();
+    std::string folder = root + "/INBOX";
+    CDirectory::mkdir_p(folder);
+
+    CIMAPCache *cache = CIMAPCache::instance();
+
+    /*
+     * An empty reply is a failed fetch, which mustn't be stored.
+     */
+    CuAssertTrue(tc, ! cache->store(folder + "/1", ""));
+    CuAssertTrue(tc, ! CFile::exists(folder + "/1"));
+    CuAssertTrue(tc, ! CFile::exists(folder + "/1.tmp"));
+
+    CuAssertTrue(tc, cache->store(folder + "/1", "0123456789"));
+    CuAssertTrue(tc, cache->store(folder + "/2", "0123456789"));
+    CuAssertIntEquals(tc, 2, cache->count());
+    CuAssertIntEquals(tc, 20, cache->size());
+
+    /*
+     * Storing a file twice leaves the first copy alone.
+     */
+    CuAssertTrue(tc, cache->store(folder + "/2", "abcdefghijklmnopqrstuvwxyz"));
+    CuAssertIntEquals(tc, 10, CFile::size(folder + "/2"));
+
+    /*
+     * Using the first makes the second the oldest, which is evicted
+     * once we exceed our budget.
+     */
+    cache->touch(folder + "/1");
+    CuAssertTrue(tc, cache->store(folder + "/3", "0123456789"));
+
+    CuAssertIntEquals(tc, 2, cache->count());
+    CuAssertTrue(tc, CFile::exists(folder + "/1"));
+    CuAssertTrue(tc, ! CFile::exists(folder + "/2"));
+    CuAssertTrue(tc, CFile::exists(folder + "/3"));
+
+    /*
+     * A file larger than our budget is kept, alone, as it is wanted.
+     */
+    CuAssertTrue(tc, cache->store(folder + "/4", "abcdefghijklmnopqrstuvwxyz"));
+    CuAssertIntEquals(tc, 1, cache->count());
+    CuAssertTrue(tc, CFile::exists(folder + "/4"));
+
+    /*
+     * Our index survives us - and with a larger budget so does the file.
+     */
+    config->set("imap.cache_max_bytes", 100, false);
+    CIMAPCache::destroy_instance();
+    cache = CIMAPCache::instance();
+
+    CuAssertIntEquals(tc, 1, cache->count());
+    CuAssertIntEquals(tc, 26, cache->size());
+
+    CIMAPCache::destroy_instance();
+
+    unlink((folder + "/1").c_str());
+    unlink((folder + "/3").c_str());
+    unlink((folder + "/4").c_str());
+    unlink((root + "/.index").c_str());
+    rmdir(folder.c_str());
+    rmdir(root.c_str());
+    rmdir(dir);
+}
+
+
+/**
+ * Test that files cached before we had an index are found, and bounded.
+ */
+void TestIMAPCacheScan(CuTest * tc)
+{
+    char dir[] = "/tmp/imap_cache.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(dir) != NULL);
+
+    CConfig *config = CConfig::instance();
+    config->set("imap.cache", dir, false);
+    config->set("imap.server", "imaps://imap.example.com/", false);
+    config->set("imap.cache_max_bytes", "1K", false);
+
+    std::string root = CIMAPCache::root();
+    std::string folder = root + "/Sent";
+    CDirectory::mkdir_p(folder);
+
+    /*
+     * Two messages, the headers of one, and our state, which is not a
+     * message.
+     */
+    std::string kilobyte(1000, 'x');
+
+    for (std::string name : { "/7", "/8", "/8.headers", "/.sync" })
+    {
+        FILE *fp = fopen((folder + name).c_str(), "w");
+        CuAssertTrue(tc, fp != NULL);
+        fputs((name == "/8.headers") ? "Subject: hi\n\n" : kilobyte.c_str(), fp);
+        fclose(fp);
+    }
+
+    CIMAPCache *cache = CIMAPCache::instance();
+
+    /*
+     * The files are over our budget, so one message has gone.
+     */
+    CuAssertIntEquals(tc, 2, cache->count());
+    CuAssertIntEquals(tc, 1013, cache->size());
+    CuAssertTrue(tc, CFile::exists(folder + "/8.headers"));
+    CuAssertTrue(tc, CFile::exists(folder + "/.sync"));
+    CuAssertTrue(tc, CFile::exists(folder + "/7") != CFile::exists(folder + "/8"));
+
+    CIMAPCache::destroy_instance();
+    config->set("imap.cache_max_bytes", 0, false);
+
+    for (std::string name : { "/7", "/8", "/8.headers", "/.sync" })
+        unlink((folder + name).c_str());
+
+    unlink((root + "/.index").c_str());
+    rmdir(folder.c_str());
+    rmdir(root.c_str());
+    rmdir(dir);
+}
+
+
+CuSuite *
+imap_cache_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestIMAPCacheEviction);
+    SUITE_ADD_TEST(suite, TestIMAPCacheScan);
+    return suite;
+}
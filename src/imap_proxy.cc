@@ -17,7 +17,9 @@
  */
 
 
+#include <ctype.h>
 #include <cstdlib>
+#include <errno.h>
 #include <fcntl.h>
 #include <memory>
 #include <signal.h>
@@ -34,18 +36,53 @@
 #include "config.h"
 #include "file.h"
 #include "imap_proxy.h"
+#include "input_queue.h"
+#include "logger.h"
 #include "statuspanel.h"
 
 
+/*
+ * The environment-variable naming the descriptor of the connection we
+ * hand to a proxy we launch.
+ */
+#define PROXY_FD_VARIABLE "LUMAIL_PROXY_FD"
+
+
+/*
+ * Our environment, which a proxy we launch inherits.
+ */
+extern char **environ;
+
+
+/*
+ * The connection-details a proxy reads from its environment, which it
+ * inherits when it is launched.
+ */
+static std::string proxy_details()
+{
+    const char *names[] = { "imap_server", "imap_username", "imap_password", "imap_workers" };
+    std::string details;
+
+    for (const char *name : names)
+    {
+        const char *value = getenv(name);
+        details += (value != NULL) ? value : "";
+        details += '\n';
+    }
+
+    return (details);
+}
+
+
 CIMAPProxy::CIMAPProxy()
 {
-    m_child = -1;
+    m_child    = -1;
+    m_sock     = -1;
+    m_next_id  = 1;
 
-    /*
-     * Use ~/.imap.sock as the path.
-     */
-    m_sock_path = getenv("HOME");
-    m_sock_path += "/.imap.sock";
+    m_input_start = 0;
+    m_input_end   = 0;
+    m_input_id    = 0;
 }
 
 
@@ -62,129 +99,635 @@ CIMAPProxy::~CIMAPProxy()
  * Terminate the child we've launched.
  */
 void CIMAPProxy::terminate()
+{
+    std::lock_guard < std::mutex > lock(m_lock);
+    disconnect();
+    reap_child();
+}
+
+
+/*
+ * Kill, and reap, the child we've launched, if any.
+ */
+void CIMAPProxy::reap_child()
 {
     if (m_child != -1)
     {
         kill(m_child, SIGKILL);
+        waitpid(m_child, NULL, 0);
         m_child = -1;
     }
 }
 
 
-
 /*
  * Launch the child, if not already running.
  */
 void CIMAPProxy::launch()
 {
-    size_t unused __attribute__((unused));
+    std::lock_guard < std::mutex > lock(m_lock);
 
-    if (m_child == -1)
+    /*
+     * A proxy which was given other connection-details is replaced.
+     */
+    if ((m_child != -1) && (m_details != proxy_details()))
     {
-        /*
-         * Get the path to the proxy
-         */
-        CConfig *config = CConfig::instance();
-        std::string path = config->get_string("imap.proxy");
+        disconnect();
+        reap_child();
+    }
 
-        if (path.empty())
-            path = "/usr/share/lumail/imap-proxy" ;
+    connect_proxy();
+}
+
+
+/*
+ * Fork the proxy, handing it one end of a connected pair of sockets.
+ */
+bool CIMAPProxy::launch_child()
+{
+    /*
+     * Get the path to the proxy
+     */
+    CConfig *config = CConfig::instance();
+    std::string path = config->get_string("imap.proxy");
+
+    if (path.empty())
+        path = "/usr/share/lumail/imap-proxy" ;
+
+    CStatusPanel *panel = CStatusPanel::instance();
+
+    if (! CFile::exists(path))
+    {
+        panel->add_text("IMAP proxy not found at " + path);
+        return false;
+    }
+
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+        return false;
+
+    /*
+     * Everything the child needs is prepared before we fork, as we may
+     * have other threads whose locks it would inherit.
+     */
+    std::string name = CFile::basename(path);
+    std::string handoff = std::string(PROXY_FD_VARIABLE "=") + std::to_string(fds[1]);
+
+    std::vector < char * > env;
+
+    for (char **e = environ; *e != NULL; e++)
+    {
+        if (strncmp(*e, PROXY_FD_VARIABLE "=", strlen(PROXY_FD_VARIABLE) + 1) != 0)
+            env.push_back(*e);
+    }
+
+    env.push_back((char *) handoff.c_str());
+    env.push_back(NULL);
 
+    char *argv[] = { (char *) name.c_str(), NULL };
 
+    panel->add_text("Launching IMAP proxy " + path);
+
+    pid_t child = fork();
+
+    if (child == 0)
+    {
         /*
-         * If the proxy exists then we can launch it, if not we'll
-         * error.
+         * The proxy's end of the pair is the only descriptor of ours
+         * which survives exec.
          */
-        if (CFile::exists(path))
+        fcntl(fds[1], F_SETFD, 0);
+        execve(path.c_str(), argv, env.data());
+        _exit(1);
+    }
+
+    close(fds[1]);
+
+    if (child == -1)
+    {
+        close(fds[0]);
+        return false;
+    }
+
+    m_child   = child;
+    m_details = proxy_details();
+    m_sock    = fds[0];
+    return true;
+}
+
+
+/*
+ * Connect to the proxy, launching it first if required.
+ */
+bool CIMAPProxy::connect_proxy()
+{
+    if (m_sock != -1)
+        return true;
+
+    /*
+     * A proxy we launched is only ever connected to us, so once our
+     * connection has failed it is of no further use.
+     */
+    reap_child();
+
+    /*
+     * The proxy we launch is connected from the outset, and logs in to
+     * the server while we carry on - anything we send it meanwhile is
+     * read once it has.
+     *
+     * If we can't launch one we look for a proxy which was launched by
+     * hand, listening upon `imap.socket`.
+     */
+    if (! launch_child())
+    {
+        std::string path = CConfig::instance()->get_string("imap.socket");
+
+        if (path.empty())
         {
-            CStatusPanel *panel = CStatusPanel::instance();
-            int i;
-
-            panel->add_text("Launching IMAP proxy " + path);
-
-            unlink(m_sock_path.c_str());
-            m_child = fork();
-
-            if (m_child == 0)
-            {
-                unused = execl(path.c_str(), CFile::basename(path).c_str(), NULL);
-                exit(1);
-            }
-
-            for (i = 0; i < 100; i++)
-            {
-                if (access(m_sock_path.c_str(), F_OK) == 0)
-                {
-                    /*
-                     * Done waiting, successfully.
-                     */
-                    return;
-                }
-                usleep(100000);
-            }
-            panel->add_text("Timed out waiting for IMAP proxy");
+            const char *home = getenv("HOME");
+            path = std::string(home ? home : "") + "/.imap.sock";
         }
-        else
+
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+
+        if (path.size() >= sizeof(addr.sun_path))
+            return false;
+
+        strcpy(addr.sun_path, path.c_str());
+
+        m_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (m_sock == -1)
+            return false;
+
+        if (connect(m_sock, (sockaddr*)&addr, sizeof(addr)) != 0)
         {
-            CStatusPanel *panel = CStatusPanel::instance();
-            panel->add_text("IMAP proxy not found at " + path);
-            return;
+            close(m_sock);
+            m_sock = -1;
+            return false;
         }
     }
+
+    clear_input();
+
+    /*
+     * Have our input-queue tell us when replies arrive.
+     */
+    CInputQueue *input = CInputQueue::instance();
+    input->watch(m_sock, []()
+    {
+        CIMAPProxy::instance()->poll();
+    });
+
+    /*
+     * Resume watching our folder.
+     */
+    send_idle();
+
+    return (m_sock != -1);
 }
 
 
 /*
- * Read a string from our IMAP proxy, launching it first
- * if required.
+ * Close our connection.
+ *
+ * Requests which are awaiting replies get empty ones, so nobody waits
+ * for a reply which will never come.
  */
-std::string CIMAPProxy::read_imap_output(std::string cmd)
+void CIMAPProxy::disconnect()
+{
+    if (m_sock != -1)
+    {
+        CInputQueue *input = CInputQueue::instance();
+        input->unwatch(m_sock);
+
+        close(m_sock);
+        m_sock = -1;
+    }
+
+    std::set < int > pending;
+    pending.swap(m_pending);
+
+    for (int id : pending)
+        store_reply(id, "");
+
+    clear_input();
+}
+
+
+/*
+ * Write a request to our connection.
+ */
+bool CIMAPProxy::write_line(const std::string &line)
 {
-    int sockfd;
-    sockaddr_un addr;
-    size_t unused __attribute__((unused));
-    std::string result = "";
+    size_t written = 0;
 
+    while (written < line.size())
+    {
+        ssize_t rval = send(m_sock, line.c_str() + written, line.size() - written, MSG_NOSIGNAL);
+
+        if (rval < 0 && errno == EINTR)
+            continue;
+
+        if (rval <= 0)
+            return false;
+
+        written += rval;
+    }
+
+    return true;
+}
+
+
+/*
+ * Store the reply to the given request.
+ *
+ * Asynchronous requests have their callbacks invoked by `poll`, the
+ * replies to others are collected by `wait_reply`.
+ */
+void CIMAPProxy::store_reply(int id, std::string reply)
+{
     /*
-     * Launch the child.
+     * Events aren't replies to anything.
      */
-    launch();
+    if (id == 0)
+    {
+        if (m_event_handler)
+            m_completed.push_back(std::make_pair(m_event_handler, std::move(reply)));
 
+        return;
+    }
 
-    sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
-    addr.sun_family = AF_UNIX;
+    m_pending.erase(id);
 
-    strcpy(addr.sun_path, m_sock_path.c_str());
+    auto it = m_callbacks.find(id);
 
-    if (connect(sockfd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    if (it != m_callbacks.end())
     {
-        return ("Connection failed!");
+        m_completed.push_back(std::make_pair(it->second, std::move(reply)));
+        m_callbacks.erase(it);
     }
+    else
+        m_replies[id] = std::move(reply);
+}
+
 
-    unused = write(sockfd, cmd.c_str(), cmd.length());
+/*
+ * Discard anything we've read.
+ */
+void CIMAPProxy::clear_input()
+{
+    m_input.clear();
+    m_input_start = 0;
+    m_input_end   = 0;
+    m_input_id    = 0;
+}
 
-    char buf[65535];
-    int rval;
 
-    do
+/*
+ * Remove a complete reply from our input, if we have one.
+ */
+bool CIMAPProxy::take_reply()
+{
+    if (m_input_end == 0)
     {
-        bzero(buf, sizeof(buf));
+        size_t nl = m_input.find('\n', m_input_start);
+
+        if (nl == std::string::npos)
+            return false;
+
+        /*
+         * Parse the header ourselves, rather than via `sscanf`, which
+         * would measure the whole of our input - however large - first.
+         */
+        const char *header = m_input.c_str() + m_input_start;
+        char *end = NULL;
+
+        errno = 0;
+        long id = strtol(header, &end, 10);
+        unsigned long long length = 0;
+        bool valid = (end != header) && (*end == ' ') && (id >= 0);
 
-        if ((rval = read(sockfd, buf, sizeof(buf) - 1)) < 0)
+        if (valid)
         {
-            // Failure
+            const char *digits = end + 1;
+            length = strtoull(digits, &end, 10);
+            valid = (end != digits) && (*end == '\n') && (errno == 0) &&
+                    isdigit((unsigned char) *digits) && (length < (1ULL << 32));
         }
-        else if (rval == 0)
+
+        if (! valid)
         {
-            // End.
+            CLogger *logger = CLogger::instance();
+            logger->log("imap", "Invalid reply from IMAP proxy: %s",
+                        m_input.substr(m_input_start, nl - m_input_start).c_str());
+
+            disconnect();
+            return false;
         }
-        else
+
+        m_input_id  = (int) id;
+        m_input_end = nl + 1 + length;
+
+        /*
+         * Grow our buffer once to hold all of the reply.
+         */
+        m_input.reserve(m_input_end);
+    }
+
+    if (m_input.size() < m_input_end)
+        return false;
+
+    size_t body = m_input.find('\n', m_input_start) + 1;
+    std::string reply = m_input.substr(body, m_input_end - body);
+    int id = m_input_id;
+
+    m_input_start = m_input_end;
+    m_input_end   = 0;
+
+    /*
+     * Once everything we've read has been consumed we can start again
+     * from the front of our buffer, otherwise we move what remains down
+     * once the consumed part is the larger.
+     */
+    if (m_input_start == m_input.size())
+    {
+        m_input.clear();
+        m_input_start = 0;
+    }
+    else if (m_input_start > (m_input.size() / 2))
+    {
+        m_input.erase(0, m_input_start);
+        m_input_start = 0;
+    }
+
+    store_reply(id, std::move(reply));
+    return true;
+}
+
+
+/*
+ * Read more from our connection.
+ */
+bool CIMAPProxy::read_more(bool wait)
+{
+    if (m_sock == -1)
+        return false;
+
+    while (true)
+    {
+        char buf[65536];
+        ssize_t rval = recv(m_sock, buf, sizeof(buf), wait ? 0 : MSG_DONTWAIT);
+
+        if (rval < 0 && errno == EINTR)
+            continue;
+
+        if (rval < 0 && ! wait && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+            return false;
+
+        if (rval <= 0)
+        {
+            disconnect();
+            return false;
+        }
+
+        m_input.append(buf, rval);
+        return true;
+    }
+}
+
+
+/*
+ * Send a request to our IMAP proxy, without waiting for the reply.
+ */
+int CIMAPProxy::send_request(std::string cmd)
+{
+    std::lock_guard < std::mutex > lock(m_lock);
+
+    /*
+     * Our callers terminate their commands with newlines, which we add
+     * ourselves after the ID.
+     */
+    while (! cmd.empty() && ((cmd.back() == '\n') || (cmd.back() == '\r')))
+        cmd.pop_back();
+
+    int id = m_next_id++;
+    std::string line = std::to_string(id) + " " + cmd + "\n";
+
+    /*
+     * If the proxy has gone away since our last request we'll find out
+     * when we try to write to it, so try again upon a new connection.
+     */
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (! connect_proxy())
+            return -1;
+
+        if (write_line(line))
+        {
+            m_pending.insert(id);
+            return id;
+        }
+
+        disconnect();
+    }
+
+    return -1;
+}
+
+
+/*
+ * Wait for the reply to the given request, storing any replies to
+ * other requests which arrive first.
+ */
+std::string CIMAPProxy::wait_reply(int id)
+{
+    if (id < 0)
+        return ("Connection failed!");
+
+    std::lock_guard < std::mutex > lock(m_lock);
+
+    while (true)
+    {
+        auto it = m_replies.find(id);
+
+        if (it != m_replies.end())
+        {
+            std::string result = std::move(it->second);
+            m_replies.erase(it);
+            return (result);
+        }
+
+        if (m_pending.find(id) == m_pending.end())
+            return "";
+
+        if (! take_reply())
+            read_more(true);
+    }
+}
+
+
+/*
+ * Read a string from our IMAP proxy, launching it first
+ * if required.
+ */
+std::string CIMAPProxy::read_imap_output(std::string cmd)
+{
+    return (wait_reply(send_request(cmd)));
+}
+
+
+/*
+ * Send a request without waiting.
+ */
+int CIMAPProxy::request(std::string cmd, std::function<void(std::string)> callback)
+{
+    std::lock_guard < std::mutex > lock(m_lock);
+
+    while (! cmd.empty() && ((cmd.back() == '\n') || (cmd.back() == '\r')))
+        cmd.pop_back();
+
+    int id = m_next_id++;
+    std::string line = std::to_string(id) + " " + cmd + "\n";
+
+    m_callbacks[id] = callback;
+
+    /*
+     * A proxy which is still starting reads this once it is ready.
+     */
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (! connect_proxy())
+            break;
+
+        if (write_line(line))
         {
-            result += buf;
+            m_pending.insert(id);
+            return id;
         }
+
+        disconnect();
+    }
+
+    store_reply(id, "");
+    return id;
+}
+
+
+/*
+ * Split the reply to a bulk request into its messages.
+ */
+std::vector < std::pair < int, std::string > > CIMAPProxy::split_bulk(const std::string &reply)
+{
+    std::vector < std::pair < int, std::string > > result;
+    size_t offset = 0;
+
+    while (offset < reply.size())
+    {
+        size_t nl = reply.find('\n', offset);
+
+        if (nl == std::string::npos)
+            break;
+
+        const char *header = reply.c_str() + offset;
+        char *end = NULL;
+
+        long id = strtol(header, &end, 10);
+
+        if ((end == header) || (*end != ' '))
+            break;
+
+        size_t length = strtoul(end + 1, &end, 10);
+
+        if ((*end != '\n') || (length > (reply.size() - nl - 1)))
+            break;
+
+        result.push_back(std::make_pair((int) id, reply.substr(nl + 1, length)));
+        offset = nl + 1 + length;
     }
-    while (rval > 0);
 
-    close(sockfd);
     return (result);
 }
+
+
+/*
+ * Read replies, and invoke their callbacks.
+ */
+bool CIMAPProxy::poll()
+{
+    std::vector < std::pair < std::function<void(std::string)>, std::string > > completed;
+
+    {
+        std::lock_guard < std::mutex > lock(m_lock);
+
+        while (take_reply() || read_more(false))
+            ;
+
+        completed.swap(m_completed);
+    }
+
+    /*
+     * The callbacks may make further requests, so they're invoked
+     * without holding our lock.
+     */
+    for (auto &done : completed)
+    {
+        if (done.first)
+            done.first(done.second);
+    }
+
+    return (! completed.empty());
+}
+
+
+/*
+ * Ask the proxy to watch the given folder.
+ */
+void CIMAPProxy::idle(std::string folder)
+{
+    std::lock_guard < std::mutex > lock(m_lock);
+
+    if ((folder == m_idle_folder) && (m_sock != -1))
+        return;
+
+    m_idle_folder = folder;
+
+    /*
+     * If we're not connected we'll ask once we are.
+     */
+    if (m_sock != -1)
+        send_idle();
+    else
+        connect_proxy();
+}
+
+
+/*
+ * Send our `idle` request, whose reply nobody waits for.
+ */
+void CIMAPProxy::send_idle()
+{
+    if (m_idle_folder.empty() || (m_sock == -1))
+        return;
+
+    int id = m_next_id++;
+    m_callbacks[id] = nullptr;
+
+    if (write_line(std::to_string(id) + " idle " + m_idle_folder + "\n"))
+        m_pending.insert(id);
+    else
+        store_reply(id, "");
+}
+
+
+/*
+ * Set the handler of the proxy's events.
+ */
+void CIMAPProxy::on_event(std::function<void(std::string)> handler)
+{
+    std::lock_guard < std::mutex > lock(m_lock);
+    m_event_handler = handler;
+}
@@ -19,14 +19,44 @@
 
 #pragma once
 
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdint.h>
 #include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
 
 #include "singleton.h"
 
 /**
  * The CImapProxy class is a singleton which is responsible for
- * launching our (perl) IMAP-proxy.
+ * launching our (perl) IMAP-proxy, and talking to it.
  *
+ * We hold a single connection open to the proxy, upon which each
+ * request is sent as a line prefixed by a numeric ID:
+ *
+ *     17 get_message 123 INBOX
+ *
+ * The proxy replies with a line holding the same ID, and the length of
+ * the reply in bytes, followed by the reply itself:
+ *
+ *     17 4096
+ *     From: ...
+ *
+ * So several requests may be sent before any of their replies are read.
+ *
+ * Requests may be made synchronously, via `read_imap_output`, which
+ * blocks until the reply arrives, or asynchronously via `request`.  The
+ * callbacks of asynchronous requests are invoked by `poll`, upon the main
+ * thread, which happens as soon as our connection is readable because it
+ * is watched by `CInputQueue`.
+ *
+ * Once we've asked the proxy to watch a folder, via `idle`, it may also
+ * send us "replies" with the ID 0, which are events telling us that the
+ * folder has changed.  These are given to the handler set by `on_event`.
  */
 class CIMAPProxy : public Singleton<CIMAPProxy>
 {
@@ -50,7 +80,71 @@ public:
     std::string read_imap_output(std::string cmd);
 
     /**
-     * Launch an IMAP-proxy.
+     * Send a request to our IMAP proxy, launching it first if required,
+     * without waiting for the reply.
+     *
+     * Returns the ID of the request, which must be passed to `wait_reply`,
+     * or -1 if we couldn't connect to the proxy.
+     */
+    int send_request(std::string cmd);
+
+    /**
+     * Wait for the reply to the given request.
+     *
+     * If the connection fails before the reply arrives it is empty.
+     */
+    std::string wait_reply(int id);
+
+    /**
+     * Send a request to our IMAP proxy without waiting for anything,
+     * including the proxy to log in.
+     *
+     * The callback, if any, is invoked with the reply by `poll`.  If the
+     * request fails the reply is empty.
+     *
+     * Returns the ID of the request.
+     */
+    int request(std::string cmd, std::function<void(std::string)> callback);
+
+    /**
+     * Read any replies which have arrived, and invoke their callbacks.
+     *
+     * This is called upon the main thread, and returns true if any
+     * callbacks were invoked.
+     */
+    bool poll();
+
+    /**
+     * Ask the proxy to watch the given folder, via IMAP IDLE, and tell
+     * us when it changes.
+     *
+     * Only a single folder is watched, and it is watched again if we have
+     * to reconnect to the proxy.
+     */
+    void idle(std::string folder);
+
+    /**
+     * Set the handler which is invoked, by `poll`, with each event the
+     * proxy sends us.
+     */
+    void on_event(std::function<void(std::string)> handler);
+
+    /**
+     * Split the reply to a bulk request, such as `get_messages_bulk`,
+     * which holds several messages each prefixed by a line of the
+     * message's ID and its length in bytes.
+     *
+     * Anything following an invalid, or truncated, message is ignored.
+     */
+    static std::vector < std::pair < int, std::string > > split_bulk(const std::string &reply);
+
+    /**
+     * Launch an IMAP-proxy, without waiting for it to be ready.
+     *
+     * The proxy is handed one end of a connected pair of sockets, so
+     * requests may be sent to it at once, and are read once it has
+     * logged in to the server.  A proxy launched with other
+     * connection-details than those in our environment now is replaced.
      */
     void launch();
 
@@ -60,13 +154,110 @@ public:
     void terminate();
 
 private:
+
     /**
-     * The handle to our child-process.
+     * Connect to the proxy, if we're not already connected, launching it
+     * first if required.
+     *
+     * If the proxy can't be launched we connect to one listening upon
+     * `imap.socket`, such as one launched by hand.
+     */
+    bool connect_proxy();
+
+    /**
+     * Fork the proxy, connected to us by a pair of sockets.
+     */
+    bool launch_child();
+
+    /**
+     * Kill, and reap, the child we've launched, if any.
+     */
+    void reap_child();
+
+    /**
+     * Close our connection, failing any requests awaiting replies.
+     */
+    void disconnect();
+
+    /**
+     * Write a request to our connection, returning false on failure.
+     */
+    bool write_line(const std::string &line);
+
+    /**
+     * Ask the proxy to watch the folder we're watching, if any.
+     */
+    void send_idle();
+
+    /**
+     * Discard anything we've read from our connection.
+     */
+    void clear_input();
+
+    /**
+     * Remove a complete reply from our input, if we have one.
+     */
+    bool take_reply();
+
+    /**
+     * Read more from our connection, waiting if `wait` is true, returning
+     * false if the connection failed, or there was nothing to read.
+     */
+    bool read_more(bool wait);
+
+    /**
+     * Store the reply to the given request, for whoever is waiting for it.
+     */
+    void store_reply(int id, std::string reply);
+
+private:
+    /**
+     * The handle to our child-process, and the connection-details it
+     * was launched with.
      */
     pid_t m_child;
+    std::string m_details;
+
+    /**
+     * Our connection to the proxy, or -1, and anything we've read from
+     * it which isn't yet a complete reply.
+     *
+     * Replies are consumed from `m_input_start` rather than erased from
+     * the front of the buffer, and once the header of the reply there
+     * has been read `m_input_end` is the offset at which it finishes, and
+     * `m_input_id` its request, so that we needn't parse it again as the
+     * rest arrives.
+     */
+    int m_sock;
+    std::string m_input;
+    size_t m_input_start;
+    size_t m_input_end;
+    int m_input_id;
+
+    /**
+     * The ID of our next request, those we're awaiting replies to, and
+     * the replies which have arrived but not yet been collected.
+     */
+    int m_next_id;
+    std::set < int > m_pending;
+    std::map < int, std::string > m_replies;
+
+    /**
+     * The callbacks of asynchronous requests which have been sent, and
+     * those which are ready to be invoked along with their replies.
+     */
+    std::map < int, std::function<void(std::string)> > m_callbacks;
+    std::vector < std::pair < std::function<void(std::string)>, std::string > > m_completed;
+
+    /**
+     * The folder the proxy is watching for us, and the handler of the
+     * events it sends.
+     */
+    std::string m_idle_folder;
+    std::function<void(std::string)> m_event_handler;
 
     /**
-     * Path to the IMAP proxy socket.
+     * Requests may be made by any thread.
      */
-    std::string m_sock_path;
+    std::mutex m_lock;
 };
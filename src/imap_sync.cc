@@ -0,0 +1,300 @@
+/*
+ * imap_sync.cc - The state of an IMAP folder, as last synchronised.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "imap_sync.h"
+#include "json_stream.h"
+
+
+/*
+ * The first line of our state-files, which changes if their format does.
+ */
+#define IMAP_SYNC_MAGIC "lumail-imap-sync 1"
+
+
+/*
+ * Collects the proxy's reply to `sync_messages` as it is parsed, without
+ * building a tree of it.
+ *
+ * We track the member of the top-level object we're within, and the
+ * member of each message.  Anything we don't expect is ignored.
+ */
+class CSyncReply : public CJSONHandler
+{
+public:
+    CSyncReply()
+    {
+        depth = 0;
+        in_message = false;
+        uidvalidity = modseq = uidnext = 0;
+        has_uidvalidity = has_messages = has_uids = full = false;
+    };
+
+    bool start_object()
+    {
+        depth++;
+
+        if ((depth == 3) && (member == "messages"))
+        {
+            in_message = true;
+            messages.push_back(std::make_pair(0, std::string()));
+        }
+
+        return (depth > 1 || member.empty());
+    };
+
+    bool end_object()
+    {
+        if (depth == 3)
+            in_message = false;
+
+        depth--;
+        return true;
+    };
+
+    bool start_array()
+    {
+        depth++;
+
+        if (depth == 2)
+        {
+            has_messages = has_messages || (member == "messages");
+            has_uids     = has_uids || (member == "uids");
+        }
+
+        return (depth > 1);
+    };
+
+    bool end_array()
+    {
+        depth--;
+        return true;
+    };
+
+    bool key(const std::string &name)
+    {
+        if (depth == 1)
+            member = name;
+        else if (depth == 3)
+            field = name;
+
+        return true;
+    };
+
+    bool value(json_type type, const std::string &text)
+    {
+        if (depth == 1)
+        {
+            if (member == "uidvalidity")
+            {
+                has_uidvalidity = true;
+                uidvalidity = CJSONStream::to_u64(text);
+            }
+            else if (member == "highestmodseq")
+                modseq = CJSONStream::to_u64(text);
+            else if (member == "uidnext")
+                uidnext = CJSONStream::to_u64(text);
+            else if (member == "full")
+                full = (type == JSON_TRUE) || ((type == JSON_NUMBER) && (text != "0"));
+        }
+        else if ((depth == 2) && (member == "uids"))
+            uids.push_back((int) CJSONStream::to_u64(text));
+        else if ((depth == 3) && in_message)
+        {
+            if (field == "id")
+                messages.back().first = (int) CJSONStream::to_u64(text);
+            else if ((field == "flags") && (type == JSON_STRING))
+                messages.back().second = text;
+        }
+
+        return (depth > 0);
+    };
+
+public:
+    int depth;
+    bool in_message;
+    std::string member;
+    std::string field;
+
+    uint64_t uidvalidity, modseq, uidnext;
+    bool has_uidvalidity, has_messages, has_uids, full;
+
+    std::vector < std::pair < int, std::string > > messages;
+    std::vector < int > uids;
+};
+
+
+/*
+ * Constructor.
+ */
+CIMAPSync::CIMAPSync()
+{
+    clear();
+}
+
+
+/*
+ * Forget everything.
+ */
+void CIMAPSync::clear()
+{
+    m_uidvalidity = 0;
+    m_modseq      = 0;
+    m_uidnext     = 0;
+    m_messages.clear();
+}
+
+
+/*
+ * Load our state from the given file.
+ *
+ * The file holds our magic, then a line of the UIDVALIDITY, HIGHESTMODSEQ,
+ * and UIDNEXT, then a line for each message of its UID and flags.
+ */
+bool CIMAPSync::load(std::string path)
+{
+    clear();
+
+    std::ifstream in(path);
+    std::string line;
+
+    if (! std::getline(in, line) || (line != IMAP_SYNC_MAGIC))
+        return false;
+
+    unsigned long long uidvalidity, modseq, uidnext;
+
+    if (! std::getline(in, line) ||
+            (sscanf(line.c_str(), "%llu %llu %llu", &uidvalidity, &modseq, &uidnext) != 3))
+        return false;
+
+    while (std::getline(in, line))
+    {
+        size_t space = line.find(' ');
+
+        if (space == std::string::npos)
+        {
+            clear();
+            return false;
+        }
+
+        m_messages[atoi(line.c_str())] = line.substr(space + 1);
+    }
+
+    m_uidvalidity = uidvalidity;
+    m_modseq      = modseq;
+    m_uidnext     = uidnext;
+    return true;
+}
+
+
+/*
+ * Save our state to the given file.
+ *
+ * We write to a temporary file, which is renamed into place, so that
+ * we never leave a partial state behind.
+ */
+bool CIMAPSync::save(std::string path)
+{
+    std::string tmp = path + ".tmp";
+
+    FILE *fp = fopen(tmp.c_str(), "w");
+
+    if (fp == NULL)
+        return false;
+
+    fprintf(fp, "%s\n%llu %llu %llu\n", IMAP_SYNC_MAGIC,
+            (unsigned long long) m_uidvalidity,
+            (unsigned long long) m_modseq,
+            (unsigned long long) m_uidnext);
+
+    for (auto it = m_messages.begin(); it != m_messages.end(); ++it)
+        fprintf(fp, "%d %s\n", it->first, it->second.c_str());
+
+    bool ok = (ferror(fp) == 0);
+    ok = (fclose(fp) == 0) && ok;
+
+    if (! ok || (rename(tmp.c_str(), path.c_str()) != 0))
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Return our request for the changes to the given folder.
+ */
+std::string CIMAPSync::request(std::string folder)
+{
+    return ("sync_messages " + std::to_string(m_uidvalidity) + " " +
+            std::to_string(m_modseq) + " " +
+            std::to_string(m_uidnext) + " " +
+            std::to_string(m_messages.size()) + " " + folder + "\n");
+}
+
+
+/*
+ * Merge the proxy's reply to our request.
+ */
+bool CIMAPSync::apply(const std::string &json)
+{
+    CSyncReply reply;
+
+    if (! CJSONStream::parse(json, reply) || ! reply.has_uidvalidity || ! reply.has_messages)
+        return false;
+
+    /*
+     * If the folder's UIDs have been reset then nothing we hold is valid,
+     * and the proxy will have sent us everything.
+     */
+    if (reply.full || (reply.uidvalidity != m_uidvalidity))
+        m_messages.clear();
+
+    for (auto &message : reply.messages)
+        m_messages[message.first] = std::move(message.second);
+
+    /*
+     * If we've been given every UID then forget any message which has
+     * been expunged.
+     */
+    if (reply.has_uids)
+    {
+        std::set < int > present(reply.uids.begin(), reply.uids.end());
+
+        for (auto it = m_messages.begin(); it != m_messages.end();)
+        {
+            if (present.find(it->first) == present.end())
+                it = m_messages.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    m_uidvalidity = reply.uidvalidity;
+    m_modseq      = reply.modseq;
+    m_uidnext     = reply.uidnext;
+    return true;
+}
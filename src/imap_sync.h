@@ -0,0 +1,113 @@
+/*
+ * imap_sync.h - The state of an IMAP folder, as last synchronised.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+/**
+ * What we know of the messages in a single IMAP folder, as of our last
+ * synchronisation with the server.
+ *
+ * Rather than asking our proxy for the ID and flags of every message in
+ * a folder each time it is opened we tell it the UIDVALIDITY, HIGHESTMODSEQ,
+ * and UIDNEXT of the folder when we last looked, along with the number of
+ * messages we hold, via the command `request` returns.  The proxy replies
+ * with only what has changed since then, which `apply` merges:
+ *
+ *   uidvalidity   - The folder's UIDVALIDITY, as a string.
+ *   highestmodseq - The folder's HIGHESTMODSEQ, as a string, or "0" if
+ *                   the server doesn't support CONDSTORE.
+ *   uidnext       - The folder's UIDNEXT.
+ *   full          - If true `messages` replaces everything we hold.
+ *   messages      - An array of the new, or changed, messages, each an
+ *                   object of `id` and `flags`.
+ *   uids          - Optional.  The UID of every message in the folder,
+ *                   sent when messages may have been expunged.
+ *
+ * The state is saved to, and loaded from, a file beneath `imap.cache`.
+ */
+class CIMAPSync
+{
+public:
+    /**
+     * Constructor.
+     */
+    CIMAPSync();
+
+public:
+
+    /**
+     * Load our state from the given file.
+     *
+     * If the file doesn't exist, or isn't valid, we're left empty and
+     * false is returned.
+     */
+    bool load(std::string path);
+
+    /**
+     * Save our state to the given file, returning true on success.
+     */
+    bool save(std::string path);
+
+    /**
+     * Return the command which asks our proxy for the changes to the
+     * named folder since our state was current.
+     */
+    std::string request(std::string folder);
+
+    /**
+     * Merge the proxy's reply to our `request`.
+     *
+     * Returns false, leaving our state unchanged, if the reply isn't
+     * valid.
+     */
+    bool apply(const std::string &json);
+
+    /**
+     * Forget everything.
+     */
+    void clear();
+
+    /**
+     * The flags of each message we know of, as reported by the server,
+     * keyed by UID.
+     */
+    const std::map < int, std::string > &messages()
+    {
+        return (m_messages);
+    };
+
+private:
+
+    /**
+     * The UIDVALIDITY, HIGHESTMODSEQ, and UIDNEXT of the folder.
+     */
+    uint64_t m_uidvalidity;
+    uint64_t m_modseq;
+    uint64_t m_uidnext;
+
+    /**
+     * The flags of each message, by UID.
+     */
+    std::map < int, std::string > m_messages;
+};
@@ -0,0 +1,144 @@
+/*
+ * imap_sync_test.cc - Test-cases for our IMAP folder-state.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <cstddef>
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "imap_sync.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test that replies are merged: a full listing, then changes to it.
+ */
+void TestIMAPSyncApply(CuTest * tc)
+{
+    CIMAPSync sync;
+
+    /*
+     * With no state we ask for everything.
+     */
+    CuAssertStrEquals(tc, "sync_messages 0 0 0 0 INBOX\n", sync.request("INBOX").c_str());
+
+    CuAssertTrue(tc, sync.apply("{ \"uidvalidity\": \"17\", \"highestmodseq\": \"9000000000\", "
+                                "\"uidnext\": 4, \"full\": 1, \"messages\": ["
+                                "{ \"id\": 1, \"flags\": \"\\\\Seen\" },"
+                                "{ \"id\": 2, \"flags\": \"\" },"
+                                "{ \"id\": 3, \"flags\": \"\\\\Seen,\\\\Answered\" } ] }"));
+
+    CuAssertIntEquals(tc, 3, sync.messages().size());
+    CuAssertStrEquals(tc, "\\Seen,\\Answered", sync.messages().at(3).c_str());
+    CuAssertStrEquals(tc, "sync_messages 17 9000000000 4 3 INBOX\n", sync.request("INBOX").c_str());
+
+    /*
+     * A change of flags, and a new message, leave the others alone.
+     */
+    CuAssertTrue(tc, sync.apply("{ \"uidvalidity\": \"17\", \"highestmodseq\": \"9000000005\", "
+                                "\"uidnext\": 5, \"messages\": ["
+                                "{ \"id\": 2, \"flags\": \"\\\\Seen\" },"
+                                "{ \"id\": 4, \"flags\": \"\" } ] }"));
+
+    CuAssertIntEquals(tc, 4, sync.messages().size());
+    CuAssertStrEquals(tc, "\\Seen", sync.messages().at(2).c_str());
+    CuAssertStrEquals(tc, "\\Seen", sync.messages().at(1).c_str());
+
+    /*
+     * Being given every UID removes those which were expunged.
+     */
+    CuAssertTrue(tc, sync.apply("{ \"uidvalidity\": \"17\", \"highestmodseq\": \"9000000006\", "
+                                "\"uidnext\": 5, \"messages\": [], \"uids\": [ 1, 4 ] }"));
+
+    CuAssertIntEquals(tc, 2, sync.messages().size());
+    CuAssertTrue(tc, sync.messages().find(2) == sync.messages().end());
+    CuAssertTrue(tc, sync.messages().find(4) != sync.messages().end());
+
+    /*
+     * A reply we can't parse changes nothing.
+     */
+    CuAssertTrue(tc, ! sync.apply("Connection failed!"));
+    CuAssertTrue(tc, ! sync.apply("{ \"messages\": [] }"));
+    CuAssertIntEquals(tc, 2, sync.messages().size());
+
+    /*
+     * A new UIDVALIDITY invalidates everything we held.
+     */
+    CuAssertTrue(tc, sync.apply("{ \"uidvalidity\": \"18\", \"highestmodseq\": \"0\", "
+                                "\"uidnext\": 2, \"messages\": ["
+                                "{ \"id\": 1, \"flags\": \"\" } ] }"));
+
+    CuAssertIntEquals(tc, 1, sync.messages().size());
+    CuAssertStrEquals(tc, "", sync.messages().at(1).c_str());
+    CuAssertStrEquals(tc, "sync_messages 18 0 2 1 Lists/lumail\n", sync.request("Lists/lumail").c_str());
+}
+
+
+/**
+ * Test that our state survives being saved and loaded, and that a
+ * damaged state-file leaves us empty.
+ */
+void TestIMAPSyncPersistence(CuTest * tc)
+{
+    char dir[] = "/tmp/imap_sync.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(dir) != NULL);
+
+    std::string path = std::string(dir) + "/.sync";
+
+    CIMAPSync sync;
+    CuAssertTrue(tc, ! sync.load(path));
+
+    CuAssertTrue(tc, sync.apply("{ \"uidvalidity\": \"17\", \"highestmodseq\": \"12\", "
+                                "\"uidnext\": 11, \"full\": 1, \"messages\": ["
+                                "{ \"id\": 7, \"flags\": \"\\\\Seen,$Junk\" },"
+                                "{ \"id\": 10, \"flags\": \"\" } ] }"));
+    CuAssertTrue(tc, sync.save(path));
+
+    CIMAPSync loaded;
+    CuAssertTrue(tc, loaded.load(path));
+    CuAssertIntEquals(tc, 2, loaded.messages().size());
+    CuAssertStrEquals(tc, "\\Seen,$Junk", loaded.messages().at(7).c_str());
+    CuAssertStrEquals(tc, "", loaded.messages().at(10).c_str());
+    CuAssertStrEquals(tc, "sync_messages 17 12 11 2 INBOX\n", loaded.request("INBOX").c_str());
+
+    /*
+     * A damaged file is ignored.
+     */
+    std::ofstream out(path);
+    out << "lumail-imap-sync 1\n17 12\n7 \\Seen\n";
+    out.close();
+
+    CuAssertTrue(tc, ! loaded.load(path));
+    CuAssertIntEquals(tc, 0, loaded.messages().size());
+    CuAssertStrEquals(tc, "sync_messages 0 0 0 0 INBOX\n", loaded.request("INBOX").c_str());
+
+    unlink(path.c_str());
+    rmdir(dir);
+}
+
+
+CuSuite *
+imap_sync_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestIMAPSyncApply);
+    SUITE_ADD_TEST(suite, TestIMAPSyncPersistence);
+    return suite;
+}
@@ -16,8 +16,10 @@
  * General Public License can be found in `/usr/share/common-licenses/GPL-2'
  */
 
+#include <poll.h>
 #include <string>
 #include <cursesw.h>
+#include <unistd.h>
 
 #include "input_queue.h"
 
@@ -29,6 +31,7 @@
 CInputQueue::CInputQueue()
 {
     m_queue = "";
+    m_queue_pos = 0;
 }
 
 
@@ -51,22 +54,166 @@ int CInputQueue::get_input()
      */
     if (! has_pending_input())
     {
-        return (getch());
+        std::vector < std::pair < int, std::function<void()> > > watches;
+
+        {
+            std::lock_guard < std::mutex > lock(m_watch_lock);
+            watches = m_watches;
+        }
+
+        if (watches.empty() || (stdscr == NULL))
+            return (getch());
+
+        return (wait_input(watches));
     }
 
     /*
      * Remove the first character from our queue, and return it.
      */
-    int tmp = m_queue.at(0);
-    m_queue = m_queue.substr(1);
+    int tmp = m_queue.at(m_queue_pos++);
+
+    if (m_queue_pos == m_queue.size())
+    {
+        m_queue.clear();
+        m_queue_pos = 0;
+    }
 
     return tmp;
 }
 
+/*
+ * Wait for keyboard input, or for one of the given file-descriptors to
+ * become readable, for no longer than the curses timeout.
+ */
+int CInputQueue::wait_input(std::vector < std::pair < int, std::function<void()> > > &watches)
+{
+    int delay = wgetdelay(stdscr);
+
+    /*
+     * Curses may already hold input it has read, which poll wouldn't
+     * see, so look for that first.
+     */
+    timeout(0);
+    int c = getch();
+
+    if (c != ERR)
+    {
+        timeout(delay);
+        return (c);
+    }
+
+    std::vector < struct pollfd > fds(watches.size() + 1);
+    fds[0].fd     = STDIN_FILENO;
+    fds[0].events = POLLIN;
+
+    for (size_t i = 0; i < watches.size(); i++)
+    {
+        fds[i + 1].fd     = watches[i].first;
+        fds[i + 1].events = POLLIN;
+    }
+
+    int ready = poll(fds.data(), fds.size(), delay);
+
+    /*
+     * Interrupted, typically by a resize - so let curses report that.
+     */
+    if (ready < 0)
+    {
+        c = getch();
+        timeout(delay);
+        return (c);
+    }
+
+    timeout(delay);
+
+    bool handled = false;
+
+    for (size_t i = 0; i < watches.size(); i++)
+    {
+        if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            watches[i].second();
+            handled = true;
+        }
+    }
+
+    if ((! handled) && (fds[0].revents & POLLIN))
+        return (getch());
+
+    return (ERR);
+}
+
+
+/*
+ * Watch the given file-descriptor.
+ */
+void CInputQueue::watch(int fd, std::function<void()> handler)
+{
+    std::lock_guard < std::mutex > lock(m_watch_lock);
+
+    for (auto &watch : m_watches)
+    {
+        if (watch.first == fd)
+        {
+            watch.second = handler;
+            return;
+        }
+    }
+
+    m_watches.push_back(std::make_pair(fd, handler));
+}
+
+
+/*
+ * Stop watching the given file-descriptor.
+ */
+void CInputQueue::unwatch(int fd)
+{
+    std::lock_guard < std::mutex > lock(m_watch_lock);
+
+    for (auto it = m_watches.begin(); it != m_watches.end(); ++it)
+    {
+        if (it->first == fd)
+        {
+            m_watches.erase(it);
+            return;
+        }
+    }
+}
+
+
 /*
  * Is there more input pending in our faux input-buffer?
  */
 bool CInputQueue::has_pending_input()
 {
-    return (m_queue.empty() == false);
+    return (m_queue_pos < m_queue.size());
+}
+
+
+/*
+ * Is there input which may be read without waiting?
+ */
+bool CInputQueue::input_ready()
+{
+    if (has_pending_input())
+        return true;
+
+    if (stdscr == NULL)
+        return false;
+
+    /*
+     * Ask curses for a key without waiting, and push back any we get.
+     */
+    int delay = wgetdelay(stdscr);
+
+    timeout(0);
+    int c = getch();
+    timeout(delay);
+
+    if (c == ERR)
+        return false;
+
+    ungetch(c);
+    return true;
 }
@@ -18,7 +18,10 @@
 
 #pragma once
 
+#include <functional>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "singleton.h"
@@ -33,6 +36,9 @@
  *
  * This will allow interesting automation.
  *
+ * Other file-descriptors may be watched too, such as our connection to
+ * the IMAP proxy, so that while we wait for a key their handlers are
+ * invoked as soon as they're readable - upon the main thread.
  */
 class CInputQueue : public Singleton<CInputQueue>
 {
@@ -47,14 +53,40 @@ public:
     /**
      * Return the next input from our faux input queue, or failing
      * that poll for keyboard input with ncurses.
+     *
+     * If any watched file-descriptor becomes readable, during the
+     * curses timeout, its handler is invoked and `ERR` is returned as
+     * if the timeout had passed.
      */
     int get_input();
 
+    /**
+     * Invoke the given handler whenever the file-descriptor is readable,
+     * while we're waiting for input.
+     *
+     * This may be called from any thread.
+     */
+    void watch(int fd, std::function<void()> handler);
+
+    /**
+     * Stop watching the given file-descriptor.
+     */
+    void unwatch(int fd);
+
     /**
      * Is there more input pending in our faux input-buffer?
      */
     bool has_pending_input();
 
+    /**
+     * Is there input which may be read without waiting, either in our
+     * faux input-buffer or already typed at the keyboard?
+     *
+     * This lets a burst of keys, such as a paste or a held key, be
+     * handled before the screen is drawn again.
+     */
+    bool input_ready();
+
 public:
 
     /**
@@ -64,10 +96,26 @@ public:
 
 private:
 
+    /**
+     * Wait for keyboard input, or for a watched file-descriptor to be
+     * readable.
+     */
+    int wait_input(std::vector < std::pair < int, std::function<void()> > > &watches);
+
+private:
 
     /**
-     * The faux input-buffer we read from.
+     * The faux input-buffer we read from, and the offset of the next
+     * character within it.  Long pastes are consumed without copying
+     * the remainder for each key.
      */
     std::string m_queue;
+    size_t m_queue_pos;
+
+    /**
+     * The file-descriptors we watch, and their handlers.
+     */
+    std::vector < std::pair < int, std::function<void()> > > m_watches;
+    std::mutex m_watch_lock;
 
 };
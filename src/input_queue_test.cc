@@ -62,6 +62,18 @@ void TestInputQueue(CuTest * tc)
      * Now we've stuffed & drained we should find our queue is empty.
      */
     CuAssertTrue(tc, !input->has_pending_input());
+    CuAssertTrue(tc, !input->input_ready());
+
+    /*
+     * Input added once the queue was drained is returned too.
+     */
+    input->add_input("ab");
+    CuAssertTrue(tc, input->input_ready());
+    CuAssertIntEquals(tc, 'a', input->get_input());
+    input->add_input("c");
+    CuAssertIntEquals(tc, 'b', input->get_input());
+    CuAssertIntEquals(tc, 'c', input->get_input());
+    CuAssertTrue(tc, !input->has_pending_input());
 }
 
 
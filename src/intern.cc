@@ -0,0 +1,96 @@
+/*
+ * intern.cc - A process-wide table of interned strings.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <mutex>
+#include <unordered_map>
+
+#include "intern.h"
+
+
+/*
+ * Our table, and the lock protecting it.
+ *
+ * The nodes of an unordered_map never move, so handles may point to
+ * them directly.  The table is never destroyed, as handles may outlive
+ * any point at which we'd do that.
+ */
+typedef std::unordered_map<std::string, uint32_t> intern_table;
+
+static intern_table *g_table = NULL;
+static std::mutex g_lock;
+static size_t g_bytes = 0;
+
+
+/*
+ * Find, or add, the entry of the given string.
+ */
+const std::pair<const std::string, uint32_t> *CInterned::lookup(const std::string &str)
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+
+    if (g_table == NULL)
+        g_table = new intern_table();
+
+    auto it = g_table->find(str);
+
+    if (it == g_table->end())
+    {
+        it = g_table->insert(std::make_pair(str, (uint32_t) g_table->size())).first;
+        g_bytes += str.size();
+    }
+
+    return (&(*it));
+}
+
+
+/*
+ * Constructors.
+ */
+CInterned::CInterned()
+{
+    static const std::pair<const std::string, uint32_t> *empty = lookup("");
+
+    m_entry = empty;
+}
+
+CInterned::CInterned(const std::string &str)
+{
+    m_entry = lookup(str);
+}
+
+CInterned::CInterned(const char *str)
+{
+    m_entry = lookup(std::string(str ? str : ""));
+}
+
+
+/*
+ * Our statistics.
+ */
+size_t CInterned::count()
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+    return (g_table ? g_table->size() : 0);
+}
+
+size_t CInterned::bytes()
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+    return (g_bytes);
+}
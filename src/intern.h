@@ -0,0 +1,136 @@
+/*
+ * intern.h - A process-wide table of interned strings.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+
+/**
+ * A handle to an interned string.
+ *
+ * Each distinct string is held once, for the life of the process, and
+ * every handle to it shares that copy - so a handle is a single pointer,
+ * equal handles have equal values, and each string has a stable ID.
+ *
+ * As interned strings are never freed this is only suitable for values
+ * which repeat, such as the names of headers, or the addresses of those
+ * we correspond with.
+ *
+ * Strings may be interned from any thread.
+ */
+class CInterned
+{
+public:
+
+    /**
+     * The empty string.
+     */
+    CInterned();
+
+    /**
+     * Intern the given string.
+     */
+    CInterned(const std::string &str);
+    CInterned(const char *str);
+
+    /**
+     * The value of this string.
+     */
+    const std::string &str() const
+    {
+        return (m_entry->first);
+    };
+
+    operator const std::string &() const
+    {
+        return (m_entry->first);
+    };
+
+    const char *c_str() const
+    {
+        return (m_entry->first.c_str());
+    };
+
+    const char *data() const
+    {
+        return (m_entry->first.data());
+    };
+
+    size_t size() const
+    {
+        return (m_entry->first.size());
+    };
+
+    bool empty() const
+    {
+        return (m_entry->first.empty());
+    };
+
+    /**
+     * The ID of this string, which is unique to it.
+     */
+    uint32_t id() const
+    {
+        return (m_entry->second);
+    };
+
+    /**
+     * Equal strings have the same entry, so comparing those suffices.
+     */
+    bool operator==(const CInterned &other) const
+    {
+        return (m_entry == other.m_entry);
+    };
+
+    bool operator!=(const CInterned &other) const
+    {
+        return (m_entry != other.m_entry);
+    };
+
+    /**
+     * Handles are ordered by their values.
+     */
+    bool operator<(const CInterned &other) const
+    {
+        return ((m_entry != other.m_entry) && (m_entry->first < other.m_entry->first));
+    };
+
+    /**
+     * The number of strings interned, and the bytes they hold.
+     */
+    static size_t count();
+    static size_t bytes();
+
+private:
+
+    /**
+     * Find, or add, the entry of the given string.
+     */
+    static const std::pair<const std::string, uint32_t> *lookup(const std::string &str);
+
+    /**
+     * Our entry within the table.
+     */
+    const std::pair<const std::string, uint32_t> *m_entry;
+};
@@ -0,0 +1,96 @@
+/*
+ * intern_test.cc - Test-cases for our interned strings.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "intern.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test that equal strings share an entry, and an ID.
+ */
+void TestInternShared(CuTest * tc)
+{
+    std::string from = "Steve Kemp <steve@steve.org.uk>";
+
+    CInterned a(from);
+    CInterned b(std::string("Steve Kemp <steve@steve.org.uk>"));
+    CInterned c("Someone Else <someone@example.com>");
+
+    CuAssertTrue(tc, a == b);
+    CuAssertTrue(tc, a != c);
+    CuAssertTrue(tc, &a.str() == &b.str());
+    CuAssertIntEquals(tc, a.id(), b.id());
+    CuAssertTrue(tc, a.id() != c.id());
+    CuAssertStrEquals(tc, from.c_str(), a.c_str());
+    CuAssertIntEquals(tc, from.size(), a.size());
+
+    /*
+     * Handles are ordered by value, not by ID.
+     */
+    CuAssertTrue(tc, c < a);
+    CuAssertTrue(tc, ! (a < c));
+    CuAssertTrue(tc, ! (a < b));
+
+    CInterned empty;
+    CuAssertTrue(tc, empty.empty());
+    CuAssertTrue(tc, empty == CInterned(""));
+}
+
+
+/**
+ * Test that strings may be interned from many threads at once.
+ */
+void TestInternThreads(CuTest * tc)
+{
+    std::vector<std::thread> threads;
+    std::vector<uint32_t> ids(4);
+
+    for (int t = 0; t < 4; t++)
+    {
+        threads.push_back(std::thread([t, &ids]()
+        {
+            for (int i = 0; i < 1000; i++)
+                CInterned("list-" + std::to_string(i));
+
+            ids[t] = CInterned("list-999").id();
+        }));
+    }
+
+    for (std::thread &thread : threads)
+        thread.join();
+
+    for (int t = 1; t < 4; t++)
+        CuAssertIntEquals(tc, ids[0], ids[t]);
+
+    CuAssertTrue(tc, CInterned::count() >= 1000);
+}
+
+
+CuSuite *
+intern_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestInternShared);
+    SUITE_ADD_TEST(suite, TestInternThreads);
+    return suite;
+}
@@ -0,0 +1,335 @@
+/*
+ * job_lua.cc - Export our background jobs to Lua.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <iterator>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "directory.h"
+#include "file.h"
+#include "job_queue.h"
+#include "lua.h"
+
+
+/**
+ * @file job_lua.cc
+ *
+ * This file allows Lua to run tasks, implemented in C++, upon our
+ * workers, with a function being called with their results once they're
+ * complete.
+ *
+ * Lua-usage looks something like this:
+ *
+ *<code>
+ * Job.run( "maildir.count", { path }, function(r) Panel:append(r[1]) end )<br/>
+ *</code>
+ *
+ */
+
+
+/**
+ * A task which may be run, given its arguments, returning its results.
+ *
+ * Tasks are run upon a worker thread, so mustn't touch Lua, the screen,
+ * or our global state.
+ */
+typedef std::vector < std::string > (*job_task)(const std::vector < std::string > &args,
+        const CJobToken &token);
+
+
+/**
+ * Copy the file named by the first argument to the second, returning
+ * the destination upon success.
+ */
+static std::vector < std::string > task_file_copy(const std::vector < std::string > &args,
+        const CJobToken &token)
+{
+    std::vector < std::string > out;
+
+    if ((args.size() >= 2) && CFile::copy(args[0], args[1]))
+        out.push_back(args[1]);
+
+    return (out);
+}
+
+
+/**
+ * Read the contents of the named file.
+ */
+static std::vector < std::string > task_file_read(const std::vector < std::string > &args,
+        const CJobToken &token)
+{
+    std::vector < std::string > out;
+
+    if (args.empty())
+        return (out);
+
+    std::ifstream in(args[0], std::ios::in | std::ios::binary);
+
+    if (! in.is_open())
+        return (out);
+
+    out.push_back(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()));
+    return (out);
+}
+
+
+/**
+ * Count the messages in the named maildir, returning the total and
+ * the number which are unread.
+ */
+static std::vector < std::string > task_maildir_count(const std::vector < std::string > &args,
+        const CJobToken &token)
+{
+    std::vector < std::string > out;
+
+    if (args.empty())
+        return (out);
+
+    int total  = 0;
+    int unread = 0;
+
+    std::vector < CDirectoryEntry > entries;
+
+    if (CDirectory::list(args[0] + "/new", entries))
+    {
+        total  += entries.size();
+        unread += entries.size();
+    }
+
+    entries.clear();
+
+    if (CDirectory::list(args[0] + "/cur", entries))
+    {
+        for (CDirectoryEntry &entry : entries)
+        {
+            if (token.cancelled())
+                return (out);
+
+            total++;
+
+            size_t info = entry.name.rfind(":2,");
+
+            if ((info == std::string::npos) ||
+                    (strchr(entry.name.c_str() + info + 3, 'S') == NULL))
+                unread++;
+        }
+    }
+
+    out.push_back(std::to_string(total));
+    out.push_back(std::to_string(unread));
+    return (out);
+}
+
+
+/**
+ * The tasks which may be run, by name.
+ */
+static std::unordered_map < std::string, job_task > g_tasks =
+{
+    { "file.copy",     task_file_copy },
+    { "file.read",     task_file_read },
+    { "maildir.count", task_maildir_count },
+};
+
+
+/**
+ * The Lua state in which completions are run.
+ */
+static lua_State *g_lua = NULL;
+
+
+/**
+ * Implementation of Job.run().
+ *
+ * Run the named task with the given table of arguments, and call the
+ * given function with a table of its results once it has completed.
+ *
+ * Returns the ID of the job, or nil and an error if the task is unknown.
+ *
+ * This may be called with either `Job.run()` or `Job:run()`.
+ */
+int l_CJob_run(lua_State * l)
+{
+    CLuaLog("l_CJob_run");
+
+    int arg = lua_istable(l, 1) ? 2 : 1;
+
+    const char *name = luaL_checkstring(l, arg);
+    luaL_checktype(l, arg + 1, LUA_TTABLE);
+    luaL_checktype(l, arg + 2, LUA_TFUNCTION);
+    const char *level = lua_tostring(l, arg + 3);
+
+    auto task = g_tasks.find(name);
+
+    if (task == g_tasks.end())
+    {
+        lua_pushnil(l);
+        lua_pushstring(l, (std::string("Unknown task: ") + name).c_str());
+        return 2;
+    }
+
+    /*
+     * Collect the arguments.
+     */
+    std::vector < std::string > args;
+
+#if LUA_VERSION_NUM == 501
+    size_t n = lua_objlen(l, arg + 1);
+#else
+    size_t n = lua_rawlen(l, arg + 1);
+#endif
+
+    for (size_t i = 1; i <= n; i++)
+    {
+        lua_rawgeti(l, arg + 1, i);
+        const char *str = lua_tostring(l, -1);
+        args.push_back(str ? str : "");
+        lua_pop(l, 1);
+    }
+
+    job_priority priority = JOB_NORMAL;
+
+    if (level != NULL && strcmp(level, "visible") == 0)
+        priority = JOB_VISIBLE;
+    else if (level != NULL && strcmp(level, "prefetch") == 0)
+        priority = JOB_PREFETCH;
+
+    lua_pushvalue(l, arg + 2);
+    int ref = luaL_ref(l, LUA_REGISTRYINDEX);
+
+    /*
+     * The results are shared between the work, upon a worker, and the
+     * completion which follows it upon the main thread.
+     */
+    std::shared_ptr < std::vector < std::string > > results =
+        std::make_shared < std::vector < std::string > >();
+    job_task fn = task->second;
+
+    auto work = [fn, args, results](const CJobToken & token)
+    {
+        *results = fn(args, token);
+    };
+
+    auto done = [ref, results]()
+    {
+        lua_State *state = g_lua;
+
+        lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+        luaL_unref(state, LUA_REGISTRYINDEX, ref);
+
+        lua_newtable(state);
+
+        for (size_t i = 0; i < results->size(); i++)
+        {
+            lua_pushinteger(state, i + 1);
+            lua_pushlstring(state, (*results)[i].data(), (*results)[i].size());
+            lua_settable(state, -3);
+        }
+
+        if (lua_pcall(state, 1, 0, 0) != 0)
+        {
+            std::string err = lua_tostring(state, -1);
+            lua_pop(state, 1);
+
+            CLua *lua = CLua::instance();
+            lua->on_error(err);
+        }
+    };
+
+    CJobQueue *queue = CJobQueue::instance();
+    uint64_t id = queue->submit(work, done, priority);
+
+    lua_pushinteger(l, id);
+    return 1;
+}
+
+
+/**
+ * Implementation of Job.pending().
+ *
+ * Return the number of jobs whose functions have not yet been called.
+ */
+int l_CJob_pending(lua_State * l)
+{
+    CLuaLog("l_CJob_pending");
+
+    CJobQueue *queue = CJobQueue::instance();
+    lua_pushinteger(l, queue->pending());
+    return 1;
+}
+
+
+/**
+ * Implementation of Job.tasks().
+ *
+ * Return a table of the names of the tasks which may be run.
+ */
+int l_CJob_tasks(lua_State * l)
+{
+    CLuaLog("l_CJob_tasks");
+
+    lua_newtable(l);
+
+    int i = 1;
+
+    for (auto it = g_tasks.begin(); it != g_tasks.end(); ++it)
+    {
+        lua_pushinteger(l, i++);
+        lua_pushstring(l, it->first.c_str());
+        lua_settable(l, -3);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Export the `Job` object to Lua.
+ *
+ * Bind the appropriate methods to that object.
+ */
+void InitJob(lua_State * l)
+{
+    g_lua = l;
+
+    luaL_Reg sFooRegs[] =
+    {
+        {"pending", l_CJob_pending},
+        {"run", l_CJob_run},
+        {"tasks", l_CJob_tasks},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(l, "luaL_CJob");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sFooRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sFooRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_setglobal(l, "Job");
+}
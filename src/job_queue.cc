@@ -0,0 +1,284 @@
+/*
+ * job_queue.cc - A pool of workers for jobs, completed upon the main thread.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "config.h"
+#include "job_queue.h"
+
+
+/**
+ * The most workers we'll start.
+ */
+#define JOB_MAX_THREADS 8
+
+
+/*
+ * Constructor.
+ */
+CJobQueue::CJobQueue()
+{
+    m_running     = false;
+    m_next        = 0;
+    m_queued      = 0;
+    m_outstanding = 0;
+    m_last_id     = 0;
+}
+
+
+/*
+ * Destructor - stop our workers.
+ */
+CJobQueue::~CJobQueue()
+{
+    {
+        std::lock_guard < std::mutex > guard(m_sleep_lock);
+        m_running = false;
+    }
+
+    m_sleep.notify_all();
+
+    for (auto &w : m_workers)
+    {
+        if (w->thread.joinable())
+            w->thread.join();
+    }
+}
+
+
+/*
+ * Start our workers.
+ */
+void CJobQueue::start()
+{
+    CConfig *config = CConfig::instance();
+    int count = config->get_integer("jobs.threads", 0);
+
+    if (count <= 0)
+    {
+        count = std::thread::hardware_concurrency();
+
+        if (count > JOB_MAX_THREADS)
+            count = JOB_MAX_THREADS;
+    }
+
+    if (count < 1)
+        count = 1;
+
+    /*
+     * Create every worker before any start, as each may steal from
+     * the others.
+     */
+    for (int i = 0; i < count; i++)
+        m_workers.push_back(std::unique_ptr < worker > (new worker));
+
+    m_running = true;
+
+    for (size_t i = 0; i < m_workers.size(); i++)
+        m_workers[i]->thread = std::thread(&CJobQueue::run, this, i);
+}
+
+
+/*
+ * Submit a job.
+ */
+uint64_t CJobQueue::submit(std::function < void(const CJobToken &) > work,
+                           std::function < void() > done,
+                           job_priority priority, CJobToken token)
+{
+    if (m_workers.empty())
+        start();
+
+    job j;
+    j.work  = work;
+    j.done  = done;
+    j.token = token;
+
+    m_outstanding++;
+
+    /*
+     * The job is counted before it is queued, so that our count is
+     * never less than the number of jobs which may be taken.
+     */
+    {
+        std::lock_guard < std::mutex > guard(m_sleep_lock);
+        m_queued++;
+    }
+
+    worker *w = m_workers[m_next++ % m_workers.size()].get();
+
+    {
+        std::lock_guard < std::mutex > guard(w->lock);
+        w->queue[priority].push_back(j);
+    }
+
+    m_sleep.notify_one();
+
+    return (++m_last_id);
+}
+
+
+/*
+ * Take the next job for the given worker.
+ */
+bool CJobQueue::take(size_t self, job &out)
+{
+    size_t count = m_workers.size();
+
+    for (int priority = 0; priority < JOB_PRIORITIES; priority++)
+    {
+        /*
+         * Our own jobs are taken from the front, in the order they were
+         * submitted, and those of others from the back.
+         */
+        for (size_t i = 0; i < count; i++)
+        {
+            worker *w = m_workers[(self + i) % count].get();
+            std::lock_guard < std::mutex > guard(w->lock);
+            std::deque < job > &queue = w->queue[priority];
+
+            if (queue.empty())
+                continue;
+
+            if (i == 0)
+            {
+                out = queue.front();
+                queue.pop_front();
+            }
+            else
+            {
+                out = queue.back();
+                queue.pop_back();
+            }
+
+            m_queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * The body of each worker thread.
+ */
+void CJobQueue::run(size_t self)
+{
+    while (true)
+    {
+        {
+            std::unique_lock < std::mutex > lock(m_sleep_lock);
+            m_sleep.wait(lock, [this] { return (! m_running) || (m_queued > 0); });
+
+            if (! m_running)
+                return;
+        }
+
+        job j;
+
+        if (! take(self, j))
+            continue;
+
+        /*
+         * A cancelled job is dropped, without running its work.
+         */
+        if (j.token.cancelled())
+        {
+            {
+                std::lock_guard < std::mutex > guard(m_completed_lock);
+                m_outstanding--;
+            }
+
+            m_completed_cond.notify_all();
+            continue;
+        }
+
+        try
+        {
+            j.work(j.token);
+        }
+        catch (...)
+        {
+        }
+
+        /*
+         * The work is done, so release anything it captured here.
+         */
+        j.work = nullptr;
+
+        {
+            std::lock_guard < std::mutex > guard(m_completed_lock);
+            m_completed.push_back(j);
+        }
+
+        m_completed_cond.notify_all();
+    }
+}
+
+
+/*
+ * Run the completions of finished jobs.
+ */
+size_t CJobQueue::drain()
+{
+    std::vector < job > completed;
+
+    {
+        std::lock_guard < std::mutex > guard(m_completed_lock);
+        completed.swap(m_completed);
+    }
+
+    size_t count = 0;
+
+    for (job &j : completed)
+    {
+        m_outstanding--;
+
+        if (j.token.cancelled() || ! j.done)
+            continue;
+
+        j.done();
+        count++;
+    }
+
+    return (count);
+}
+
+
+/*
+ * Block until there is a completion to drain, or nothing outstanding.
+ */
+void CJobQueue::wait()
+{
+    std::unique_lock < std::mutex > lock(m_completed_lock);
+
+    m_completed_cond.wait(lock, [this]
+    {
+        return (! m_completed.empty()) || (m_outstanding == 0);
+    });
+}
+
+
+/*
+ * Cancel the jobs of the current folder.
+ */
+void CJobQueue::folder_changed()
+{
+    m_folder.cancel();
+    m_folder = CJobToken();
+}
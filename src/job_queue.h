@@ -0,0 +1,267 @@
+/*
+ * job_queue.h - A pool of workers for jobs, completed upon the main thread.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "singleton.h"
+
+
+/**
+ * How often, in milliseconds, the main loop checks for completed jobs
+ * while any are outstanding.
+ */
+#define JOB_POLL_MS 20
+
+
+/**
+ * The priorities of our jobs, highest first.
+ *
+ * Work for what is visible upon the screen is run before anything we're
+ * doing in anticipation of it being needed.
+ */
+typedef enum
+{
+    JOB_VISIBLE = 0,
+    JOB_NORMAL,
+    JOB_PREFETCH,
+    JOB_PRIORITIES
+} job_priority;
+
+
+/**
+ * A token shared between the submitter of jobs, and the jobs themselves,
+ * by which they may be cancelled.
+ *
+ * Copies of a token share its state.
+ */
+class CJobToken
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CJobToken() : m_cancelled(std::make_shared < std::atomic < bool > >(false))
+    {
+    };
+
+    /**
+     * Cancel the jobs holding this token.
+     */
+    void cancel()
+    {
+        *m_cancelled = true;
+    };
+
+    /**
+     * Has this token been cancelled?
+     */
+    bool cancelled() const
+    {
+        return (*m_cancelled);
+    };
+
+private:
+
+    std::shared_ptr < std::atomic < bool > > m_cancelled;
+};
+
+
+/**
+ * This singleton runs jobs upon a pool of worker threads, and holds
+ * their completions until the main thread collects them via `drain()`.
+ *
+ * Each job has two parts: the work, which is run upon a worker and
+ * mustn't touch the screen, Lua, or our global state, and the completion,
+ * which is run upon the main thread once the work is done.  A job whose
+ * token is cancelled is skipped, if it hasn't started, and its completion
+ * is never run.
+ *
+ * Each worker has a deque of jobs for each priority.  Jobs are handed
+ * to the workers in turn, and a worker with nothing to do steals from the
+ * back of the others' deques - always taking the most important job it
+ * can find first.
+ *
+ * Jobs tied to the current folder should hold `folder_token()`, which is
+ * cancelled when another folder is selected.
+ */
+class CJobQueue : public Singleton < CJobQueue >
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CJobQueue();
+
+    /**
+     * Destructor - stop our workers, discarding any jobs not yet run.
+     */
+    ~CJobQueue();
+
+    /**
+     * Submit a job, returning its ID.
+     *
+     * The workers are started, as configured by `jobs.threads`, when the
+     * first job is submitted.
+     */
+    uint64_t submit(std::function < void(const CJobToken &) > work,
+                    std::function < void() > done,
+                    job_priority priority = JOB_NORMAL,
+                    CJobToken token = CJobToken());
+
+    /**
+     * Run the completions of finished jobs, upon the calling thread,
+     * returning the number run.
+     */
+    size_t drain();
+
+    /**
+     * Block until there is a completion to drain, or nothing remains
+     * outstanding.
+     */
+    void wait();
+
+    /**
+     * The number of jobs submitted whose completions have not yet been
+     * drained.
+     */
+    size_t pending()
+    {
+        return (m_outstanding);
+    };
+
+    /**
+     * The token for jobs concerning the current folder.
+     */
+    CJobToken folder_token()
+    {
+        return (m_folder);
+    };
+
+    /**
+     * Cancel the jobs holding the current folder-token, as another
+     * folder has been selected.
+     */
+    void folder_changed();
+
+    /**
+     * The number of worker threads.
+     */
+    size_t threads()
+    {
+        return (m_workers.size());
+    };
+
+private:
+
+    /**
+     * A single job.
+     */
+    typedef struct _job
+    {
+        std::function < void(const CJobToken &) > work;
+        std::function < void() > done;
+        CJobToken token;
+    } job;
+
+    /**
+     * The state of each worker.
+     */
+    typedef struct _worker
+    {
+        std::mutex lock;
+        std::deque < job > queue[JOB_PRIORITIES];
+        std::thread thread;
+    } worker;
+
+    /**
+     * Start our workers.
+     */
+    void start();
+
+    /**
+     * The body of each worker thread.
+     */
+    void run(size_t self);
+
+    /**
+     * Take the next job for the given worker, from its own deques or
+     * those of the others.
+     */
+    bool take(size_t self, job &out);
+
+private:
+
+    /**
+     * Our workers.
+     */
+    std::vector < std::unique_ptr < worker > > m_workers;
+
+    /**
+     * Are our workers running?
+     */
+    std::atomic < bool > m_running;
+
+    /**
+     * The worker to which the next job is given.
+     */
+    size_t m_next;
+
+    /**
+     * The number of jobs waiting for a worker, and the means by which
+     * idle workers sleep until there are some.
+     */
+    std::atomic < size_t > m_queued;
+    std::mutex m_sleep_lock;
+    std::condition_variable m_sleep;
+
+    /**
+     * Completions waiting for the main thread.
+     */
+    std::vector < job > m_completed;
+    std::mutex m_completed_lock;
+    std::condition_variable m_completed_cond;
+
+    /**
+     * The number of jobs submitted, but not yet drained.
+     */
+    std::atomic < size_t > m_outstanding;
+
+    /**
+     * The ID of the last job submitted.
+     */
+    uint64_t m_last_id;
+
+    /**
+     * The token of the current folder.
+     */
+    CJobToken m_folder;
+};
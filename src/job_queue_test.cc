@@ -0,0 +1,127 @@
+/*
+ * job_queue_test.cc - Test-cases for our job queue.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <atomic>
+
+#include "job_queue.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Drain our queue until nothing remains outstanding.
+ */
+static size_t drain_all(CJobQueue *queue)
+{
+    size_t count = 0;
+
+    while (queue->pending() > 0)
+    {
+        queue->wait();
+        count += queue->drain();
+    }
+
+    return (count);
+}
+
+
+/**
+ * Test every job is run, and completed upon the calling thread.
+ */
+void TestJobsComplete(CuTest * tc)
+{
+    CJobQueue *queue = CJobQueue::instance();
+
+    std::atomic < int > worked(0);
+    int done = 0;
+
+    for (int i = 0; i < 100; i++)
+    {
+        job_priority priority = (job_priority)(i % JOB_PRIORITIES);
+
+        queue->submit([&worked](const CJobToken &)
+        {
+            worked++;
+        },
+        [&done]()
+        {
+            done++;
+        }, priority);
+    }
+
+    CuAssertIntEquals(tc, 100, (int)drain_all(queue));
+    CuAssertIntEquals(tc, 100, worked);
+    CuAssertIntEquals(tc, 100, done);
+    CuAssertIntEquals(tc, 0, (int)queue->pending());
+    CuAssertTrue(tc, queue->threads() > 0);
+}
+
+
+/**
+ * Test that cancelled jobs are never completed.
+ */
+void TestJobsCancel(CuTest * tc)
+{
+    CJobQueue *queue = CJobQueue::instance();
+
+    CJobToken token;
+    int done = 0;
+
+    for (int i = 0; i < 10; i++)
+    {
+        queue->submit([](const CJobToken &) {},
+                      [&done]()
+        {
+            done++;
+        }, JOB_NORMAL, token);
+    }
+
+    token.cancel();
+
+    CuAssertIntEquals(tc, 0, (int)drain_all(queue));
+    CuAssertIntEquals(tc, 0, done);
+}
+
+
+/**
+ * Test the folder-token is replaced when the folder changes.
+ */
+void TestJobsFolderToken(CuTest * tc)
+{
+    CJobQueue *queue = CJobQueue::instance();
+
+    CJobToken before = queue->folder_token();
+    CuAssertTrue(tc, ! before.cancelled());
+
+    queue->folder_changed();
+
+    CuAssertTrue(tc, before.cancelled());
+    CuAssertTrue(tc, ! queue->folder_token().cancelled());
+}
+
+
+CuSuite *
+job_queue_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestJobsCancel);
+    SUITE_ADD_TEST(suite, TestJobsComplete);
+    SUITE_ADD_TEST(suite, TestJobsFolderToken);
+    return suite;
+}
@@ -0,0 +1,450 @@
+/*
+ * json_stream.cc - A streaming, callback-based, JSON parser.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_stream.h"
+
+
+/*
+ * The deepest nesting of objects and arrays we'll parse, so that a
+ * hostile document can't exhaust our stack.
+ */
+#define JSON_MAX_DEPTH 256
+
+
+/*
+ * The state of a single parse.
+ */
+typedef struct _json_state
+{
+    const char *pos;
+    const char *end;
+    CJSONHandler *handler;
+    std::string text;
+} json_state;
+
+
+static bool parse_value(json_state &state, int depth);
+
+
+/*
+ * Skip any whitespace.
+ */
+static void skip_space(json_state &state)
+{
+    while ((state.pos < state.end) &&
+            ((*state.pos == ' ') || (*state.pos == '\t') ||
+             (*state.pos == '\n') || (*state.pos == '\r')))
+        state.pos++;
+}
+
+
+/*
+ * Parse four hex digits.
+ */
+static bool parse_hex4(json_state &state, unsigned int &out)
+{
+    if ((state.end - state.pos) < 4)
+        return false;
+
+    out = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        char c = *state.pos++;
+        out <<= 4;
+
+        if ((c >= '0') && (c <= '9'))
+            out |= (c - '0');
+        else if ((c >= 'a') && (c <= 'f'))
+            out |= (c - 'a' + 10);
+        else if ((c >= 'A') && (c <= 'F'))
+            out |= (c - 'A' + 10);
+        else
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Append the given code-point to the string, as UTF-8.
+ */
+static void append_utf8(std::string &out, unsigned int cp)
+{
+    if (cp < 0x80)
+        out += (char) cp;
+    else if (cp < 0x800)
+    {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+
+/*
+ * Parse a string, whose opening quote we're upon, into `out`.
+ *
+ * Runs of plain characters are appended at once, rather than one by one.
+ */
+static bool parse_string(json_state &state, std::string &out)
+{
+    out.clear();
+    state.pos++;
+
+    while (state.pos < state.end)
+    {
+        const char *start = state.pos;
+
+        while ((state.pos < state.end) && (*state.pos != '"') &&
+                (*state.pos != '\\') && ((unsigned char) *state.pos >= 0x20))
+            state.pos++;
+
+        out.append(start, state.pos - start);
+
+        if (state.pos >= state.end)
+            return false;
+
+        char c = *state.pos++;
+
+        if (c == '"')
+            return true;
+
+        if (c != '\\')
+            return false;
+
+        if (state.pos >= state.end)
+            return false;
+
+        c = *state.pos++;
+
+        switch (c)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            out += c;
+            break;
+
+        case 'b':
+            out += '\b';
+            break;
+
+        case 'f':
+            out += '\f';
+            break;
+
+        case 'n':
+            out += '\n';
+            break;
+
+        case 'r':
+            out += '\r';
+            break;
+
+        case 't':
+            out += '\t';
+            break;
+
+        case 'u':
+        {
+            unsigned int cp;
+
+            if (! parse_hex4(state, cp))
+                return false;
+
+            /*
+             * Characters beyond the BMP are escaped as surrogate pairs.
+             */
+            if ((cp >= 0xD800) && (cp <= 0xDBFF))
+            {
+                unsigned int low;
+
+                if (((state.end - state.pos) < 2) || (state.pos[0] != '\\') ||
+                        (state.pos[1] != 'u'))
+                    return false;
+
+                state.pos += 2;
+
+                if (! parse_hex4(state, low) || (low < 0xDC00) || (low > 0xDFFF))
+                    return false;
+
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            else if ((cp >= 0xDC00) && (cp <= 0xDFFF))
+                return false;
+
+            append_utf8(out, cp);
+            break;
+        }
+
+        default:
+            return false;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * Parse a number, as its text.
+ */
+static bool parse_number(json_state &state, std::string &out)
+{
+    const char *start = state.pos;
+
+    if ((state.pos < state.end) && (*state.pos == '-'))
+        state.pos++;
+
+    const char *digits = state.pos;
+
+    while ((state.pos < state.end) && isdigit((unsigned char) *state.pos))
+        state.pos++;
+
+    if (state.pos == digits)
+        return false;
+
+    if ((state.pos < state.end) && (*state.pos == '.'))
+    {
+        digits = ++state.pos;
+
+        while ((state.pos < state.end) && isdigit((unsigned char) *state.pos))
+            state.pos++;
+
+        if (state.pos == digits)
+            return false;
+    }
+
+    if ((state.pos < state.end) && ((*state.pos == 'e') || (*state.pos == 'E')))
+    {
+        state.pos++;
+
+        if ((state.pos < state.end) && ((*state.pos == '+') || (*state.pos == '-')))
+            state.pos++;
+
+        digits = state.pos;
+
+        while ((state.pos < state.end) && isdigit((unsigned char) *state.pos))
+            state.pos++;
+
+        if (state.pos == digits)
+            return false;
+    }
+
+    out.assign(start, state.pos - start);
+    return true;
+}
+
+
+/*
+ * Parse the given literal.
+ */
+static bool parse_literal(json_state &state, const char *literal)
+{
+    size_t len = strlen(literal);
+
+    if (((size_t)(state.end - state.pos) < len) || (strncmp(state.pos, literal, len) != 0))
+        return false;
+
+    state.pos += len;
+    return true;
+}
+
+
+/*
+ * Parse an object, whose opening brace we're upon.
+ */
+static bool parse_object(json_state &state, int depth)
+{
+    state.pos++;
+
+    if (! state.handler->start_object())
+        return false;
+
+    skip_space(state);
+
+    if ((state.pos < state.end) && (*state.pos == '}'))
+    {
+        state.pos++;
+        return (state.handler->end_object());
+    }
+
+    while (true)
+    {
+        skip_space(state);
+
+        if ((state.pos >= state.end) || (*state.pos != '"') ||
+                ! parse_string(state, state.text) || ! state.handler->key(state.text))
+            return false;
+
+        skip_space(state);
+
+        if ((state.pos >= state.end) || (*state.pos != ':'))
+            return false;
+
+        state.pos++;
+
+        if (! parse_value(state, depth + 1))
+            return false;
+
+        skip_space(state);
+
+        if (state.pos >= state.end)
+            return false;
+
+        char c = *state.pos++;
+
+        if (c == '}')
+            return (state.handler->end_object());
+
+        if (c != ',')
+            return false;
+    }
+}
+
+
+/*
+ * Parse an array, whose opening bracket we're upon.
+ */
+static bool parse_array(json_state &state, int depth)
+{
+    state.pos++;
+
+    if (! state.handler->start_array())
+        return false;
+
+    skip_space(state);
+
+    if ((state.pos < state.end) && (*state.pos == ']'))
+    {
+        state.pos++;
+        return (state.handler->end_array());
+    }
+
+    while (true)
+    {
+        if (! parse_value(state, depth + 1))
+            return false;
+
+        skip_space(state);
+
+        if (state.pos >= state.end)
+            return false;
+
+        char c = *state.pos++;
+
+        if (c == ']')
+            return (state.handler->end_array());
+
+        if (c != ',')
+            return false;
+    }
+}
+
+
+/*
+ * Parse any value.
+ */
+static bool parse_value(json_state &state, int depth)
+{
+    if (depth > JSON_MAX_DEPTH)
+        return false;
+
+    skip_space(state);
+
+    if (state.pos >= state.end)
+        return false;
+
+    switch (*state.pos)
+    {
+    case '{':
+        return (parse_object(state, depth));
+
+    case '[':
+        return (parse_array(state, depth));
+
+    case '"':
+        return (parse_string(state, state.text) &&
+                state.handler->value(JSON_STRING, state.text));
+
+    case 't':
+        return (parse_literal(state, "true") &&
+                state.handler->value(JSON_TRUE, "true"));
+
+    case 'f':
+        return (parse_literal(state, "false") &&
+                state.handler->value(JSON_FALSE, "false"));
+
+    case 'n':
+        return (parse_literal(state, "null") &&
+                state.handler->value(JSON_NULL, "null"));
+
+    default:
+        return (parse_number(state, state.text) &&
+                state.handler->value(JSON_NUMBER, state.text));
+    }
+}
+
+
+/*
+ * Parse the given document.
+ */
+bool CJSONStream::parse(const std::string &json, CJSONHandler &handler)
+{
+    json_state state;
+    state.pos     = json.c_str();
+    state.end     = json.c_str() + json.size();
+    state.handler = &handler;
+
+    if (! parse_value(state, 0))
+        return false;
+
+    skip_space(state);
+    return (state.pos == state.end);
+}
+
+
+/*
+ * Parse an unsigned integer.
+ */
+unsigned long long CJSONStream::to_u64(const std::string &text)
+{
+    if (text.empty() || ! isdigit((unsigned char) text[0]))
+        return 0;
+
+    return (strtoull(text.c_str(), NULL, 10));
+}
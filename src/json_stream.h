@@ -0,0 +1,97 @@
+/*
+ * json_stream.h - A streaming, callback-based, JSON parser.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+#include <string>
+
+
+/**
+ * The types of the scalar values given to `CJSONHandler::value`.
+ */
+typedef enum
+{
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL
+} json_type;
+
+
+/**
+ * The interface of something which is told of the contents of a JSON
+ * document as it is parsed, by `CJSONStream`.
+ *
+ * Each method returns false to stop the parse, which then fails.
+ */
+class CJSONHandler
+{
+public:
+    virtual ~CJSONHandler() {};
+
+    /**
+     * An object, or array, starts or ends.
+     */
+    virtual bool start_object() = 0;
+    virtual bool end_object() = 0;
+    virtual bool start_array() = 0;
+    virtual bool end_array() = 0;
+
+    /**
+     * The name of the next member of the current object.
+     */
+    virtual bool key(const std::string &name) = 0;
+
+    /**
+     * A scalar value.
+     *
+     * Strings are given unescaped, as UTF-8, and numbers as they were
+     * written, so that those too large for a double aren't rounded.
+     */
+    virtual bool value(json_type type, const std::string &text) = 0;
+};
+
+
+/**
+ * A JSON parser which builds nothing itself, but calls a handler with
+ * each token, so that the objects we want may be built directly - rather
+ * than from a tree of `Json::Value` several times the size of the
+ * document.
+ */
+class CJSONStream
+{
+public:
+
+    /**
+     * Parse the given document, which must hold a single value, calling
+     * the handler for each part of it.
+     *
+     * Returns false if the document isn't valid, or the handler stopped
+     * us, in which case the handler will have been told of only some of
+     * the document.
+     */
+    static bool parse(const std::string &json, CJSONHandler &handler);
+
+    /**
+     * Parse the text of a number, or a string holding one, as an
+     * unsigned 64-bit integer - returning zero if it isn't one.
+     */
+    static unsigned long long to_u64(const std::string &text);
+};
@@ -0,0 +1,160 @@
+/*
+ * json_stream_test.cc - Test-cases for our streaming JSON parser.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <cstddef>
+#include <string>
+
+#include "json_stream.h"
+#include "CuTest.h"
+
+
+/*
+ * A handler which records each event as text.
+ */
+class CJSONRecorder : public CJSONHandler
+{
+public:
+    bool start_object()
+    {
+        events += "{";
+        return true;
+    };
+    bool end_object()
+    {
+        events += "}";
+        return true;
+    };
+    bool start_array()
+    {
+        events += "[";
+        return true;
+    };
+    bool end_array()
+    {
+        events += "]";
+        return true;
+    };
+    bool key(const std::string &name)
+    {
+        events += "<" + name + ">";
+        return true;
+    };
+    bool value(json_type type, const std::string &text)
+    {
+        const char *types[] = { "s", "n", "t", "f", "z" };
+        events += std::string(types[type]) + ":" + text + ";";
+        return (text != "stop");
+    };
+
+public:
+    std::string events;
+};
+
+
+/*
+ * Parse the given document, returning its events, or "invalid".
+ */
+static std::string parse(const std::string &json)
+{
+    CJSONRecorder recorder;
+
+    if (! CJSONStream::parse(json, recorder))
+        return "invalid";
+
+    return (recorder.events);
+}
+
+
+
+/**
+ * Test that documents are reported as they're parsed.
+ */
+void TestJSONStreamEvents(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "{<folders>[{<name>s:INBOX;<unread>n:3;<total>n:-1.5e3;}]}",
+                      parse("{ \"folders\" : [ { \"name\": \"INBOX\", \"unread\": 3,\n"
+                            "\"total\": -1.5e3 } ] }").c_str());
+
+    CuAssertStrEquals(tc, "[t:true;f:false;z:null;{}[]]",
+                      parse(" [true,false ,null, {}, [ ] ] ").c_str());
+
+    CuAssertStrEquals(tc, "n:9000000000000000001;", parse("9000000000000000001").c_str());
+
+    /*
+     * Strings are unescaped, including characters beyond the BMP.
+     */
+    CuAssertStrEquals(tc, "s:a\"b\\c/d\n\t;", parse("\"a\\\"b\\\\c\\/d\\n\\t\"").c_str());
+    CuAssertStrEquals(tc, "s:\xc3\xa9\xe2\x98\x83\xf0\x9f\x98\x80;",
+                      parse("\"\\u00e9\\u2603\\ud83d\\ude00\"").c_str());
+
+    CuAssertTrue(tc, CJSONStream::to_u64("") == 0);
+    CuAssertTrue(tc, CJSONStream::to_u64("9000000000") == 9000000000ULL);
+    CuAssertTrue(tc, CJSONStream::to_u64("-3") == 0);
+}
+
+
+/**
+ * Test that invalid documents are rejected, as are those our handler
+ * stops.
+ */
+void TestJSONStreamInvalid(CuTest * tc)
+{
+    const char *invalid[] =
+    {
+        "",
+        "Connection failed!",
+        "{ \"a\": 1 } trailing",
+        "{ \"a\" 1 }",
+        "{ \"a\": 1, }",
+        "[ 1 2 ]",
+        "[ 1,",
+        "\"unterminated",
+        "\"tab\there\"",
+        "\"\\x\"",
+        "\"\\ud83d\"",
+        "\"\\ude00\"",
+        "01.",
+        "-",
+        "1e",
+        "tru",
+        "{ 1: 2 }",
+    };
+
+    for (const char *json : invalid)
+        CuAssertStrEquals_Msg(tc, json, "invalid", parse(json).c_str());
+
+    /*
+     * Very deep documents are refused, rather than exhausting our stack.
+     */
+    CuAssertStrEquals(tc, "invalid", parse(std::string(100000, '[')).c_str());
+
+    /*
+     * The handler may stop us.
+     */
+    CuAssertStrEquals(tc, "invalid", parse("[ \"go\", \"stop\", \"go\" ]").c_str());
+}
+
+
+CuSuite *
+json_stream_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestJSONStreamEvents);
+    SUITE_ADD_TEST(suite, TestJSONStreamInvalid);
+    return suite;
+}
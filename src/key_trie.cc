@@ -0,0 +1,197 @@
+/*
+ * key_trie.cc - A trie of the key-sequences bound in a keymap.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string.h>
+
+#include "key_trie.h"
+
+
+/*
+ * Constructor.
+ */
+CKeyTrie::CKeyTrie()
+{
+    clear();
+}
+
+
+/*
+ * Remove all bindings, leaving just our root.
+ */
+void CKeyTrie::clear()
+{
+    trie_node root;
+    root.c = '\0';
+    root.terminal = false;
+    root.first_child = -1;
+    root.next_sibling = -1;
+    root.below = 0;
+
+    m_nodes.clear();
+    m_nodes.push_back(root);
+}
+
+
+/*
+ * Is the given binding one we ignore?
+ *
+ * If the user presses "K" that would otherwise appear to be the prefix
+ * of "KEY_LEFT", so the names of special keys aren't prefixes.
+ */
+bool CKeyTrie::ignored(const std::string &key)
+{
+    static const char *names[] = { "SPACE", "ENTER", "KEY_" };
+
+    for (const char *name : names)
+    {
+        if (key.compare(0, strlen(name), name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Add the given binding.
+ */
+void CKeyTrie::insert(const std::string &key)
+{
+    if (key.empty() || ignored(key))
+        return;
+
+    std::vector<int> path;
+    int node = 0;
+
+    for (char c : key)
+    {
+        path.push_back(node);
+
+        int child = m_nodes[node].first_child;
+
+        while ((child != -1) && (m_nodes[child].c != c))
+            child = m_nodes[child].next_sibling;
+
+        if (child == -1)
+        {
+            trie_node added;
+            added.c = c;
+            added.terminal = false;
+            added.first_child = -1;
+            added.next_sibling = m_nodes[node].first_child;
+            added.below = 0;
+
+            child = (int) m_nodes.size();
+            m_nodes.push_back(added);
+            m_nodes[node].first_child = child;
+        }
+
+        node = child;
+    }
+
+    if (m_nodes[node].terminal)
+        return;
+
+    m_nodes[node].terminal = true;
+
+    for (int parent : path)
+        m_nodes[parent].below += 1;
+}
+
+
+/*
+ * Find the node reached by the given key-sequence.
+ */
+int CKeyTrie::find(const std::string &key) const
+{
+    int node = 0;
+
+    for (char c : key)
+    {
+        int child = m_nodes[node].first_child;
+
+        while ((child != -1) && (m_nodes[child].c != c))
+            child = m_nodes[child].next_sibling;
+
+        if (child == -1)
+            return -1;
+
+        node = child;
+    }
+
+    return (node);
+}
+
+
+/*
+ * Is the given key-sequence the prefix of a longer binding?
+ */
+bool CKeyTrie::is_prefix(const std::string &key) const
+{
+    int node = find(key);
+
+    return ((node != -1) && (m_nodes[node].below > 0));
+}
+
+
+/*
+ * Collect the bindings beneath the given node.
+ */
+void CKeyTrie::collect(int node, std::string &key, size_t max, std::vector<std::string> &out) const
+{
+    for (int child = m_nodes[node].first_child; child != -1; child = m_nodes[child].next_sibling)
+    {
+        if (out.size() >= max)
+            return;
+
+        key.push_back(m_nodes[child].c);
+
+        if (m_nodes[child].terminal)
+            out.push_back(key);
+
+        collect(child, key, max, out);
+        key.erase(key.size() - 1);
+    }
+}
+
+
+/*
+ * Get some of the bindings which extend the given key-sequence.
+ */
+std::vector<std::string> CKeyTrie::extensions(const std::string &key, size_t max) const
+{
+    std::vector<std::string> out;
+    int node = find(key);
+
+    if (node == -1)
+        return (out);
+
+    std::string current = key;
+    collect(node, current, max, out);
+    return (out);
+}
+
+
+/*
+ * The number of bindings held.
+ */
+size_t CKeyTrie::size() const
+{
+    return (m_nodes[0].below);
+}
@@ -0,0 +1,107 @@
+/*
+ * key_trie.h - A trie of the key-sequences bound in a keymap.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <string>
+#include <vector>
+
+
+/**
+ * This class holds the key-sequences bound in one keymap, such as "^X^C",
+ * so that we may tell whether the keys pressed so far are the prefix of
+ * a longer binding in time proportional to their length.
+ *
+ * Bindings of "SPACE", "ENTER", and "KEY_*" are not held, as they would
+ * otherwise make prefixes of the keys "S", "E", and "K".
+ */
+class CKeyTrie
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CKeyTrie();
+
+    /**
+     * Remove all bindings.
+     */
+    void clear();
+
+    /**
+     * Add the given binding, unless it is one we ignore.
+     */
+    void insert(const std::string &key);
+
+    /**
+     * Is the given key-sequence the prefix of a longer binding?
+     */
+    bool is_prefix(const std::string &key) const;
+
+    /**
+     * Get up to `max` of the bindings which extend the given
+     * key-sequence, excluding the sequence itself.
+     */
+    std::vector<std::string> extensions(const std::string &key, size_t max) const;
+
+    /**
+     * The number of bindings held.
+     */
+    size_t size() const;
+
+    /**
+     * Is the given binding one we ignore?
+     */
+    static bool ignored(const std::string &key);
+
+private:
+
+    /**
+     * Find the node reached by the given key-sequence, or -1.
+     */
+    int find(const std::string &key) const;
+
+    /**
+     * Collect the bindings beneath the given node.
+     */
+    void collect(int node, std::string &key, size_t max, std::vector<std::string> &out) const;
+
+private:
+
+    /**
+     * A node of our trie, and the first of its children, each of which
+     * links to the next.  Keymaps are small, and each node has few
+     * children, so a list is compact and quick enough.
+     */
+    typedef struct _trie_node
+    {
+        char c;
+        bool terminal;
+        int first_child;
+        int next_sibling;
+        size_t below;
+    } trie_node;
+
+    /**
+     * Our nodes, the first of which is the root.
+     */
+    std::vector<trie_node> m_nodes;
+};
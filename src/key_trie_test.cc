@@ -0,0 +1,97 @@
+/*
+ * key_trie_test.cc - Test-cases for our trie of key-bindings.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "key_trie.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test prefix-detection.
+ */
+void TestKeyTriePrefix(CuTest * tc)
+{
+    CKeyTrie trie;
+
+    trie.insert("q");
+    trie.insert("^A");
+    trie.insert("^A^B");
+    trie.insert("^A^B^C");
+    trie.insert(".a");
+    trie.insert(".n");
+    trie.insert("^A^B");
+
+    CuAssertIntEquals(tc, 6, trie.size());
+
+    CuAssertTrue(tc, trie.is_prefix("^A"));
+    CuAssertTrue(tc, trie.is_prefix("^A^B"));
+    CuAssertTrue(tc, ! trie.is_prefix("^A^B^C"));
+    CuAssertTrue(tc, trie.is_prefix("."));
+    CuAssertTrue(tc, trie.is_prefix("^"));
+    CuAssertTrue(tc, ! trie.is_prefix("q"));
+    CuAssertTrue(tc, ! trie.is_prefix("x"));
+    CuAssertTrue(tc, ! trie.is_prefix(".ab"));
+
+    std::vector<std::string> ext = trie.extensions(".", 10);
+    std::sort(ext.begin(), ext.end());
+    CuAssertIntEquals(tc, 2, ext.size());
+    CuAssertStrEquals(tc, ".a", ext[0].c_str());
+    CuAssertStrEquals(tc, ".n", ext[1].c_str());
+
+    CuAssertIntEquals(tc, 1, trie.extensions("^A", 1).size());
+    CuAssertIntEquals(tc, 0, trie.extensions("zz", 10).size());
+
+    trie.clear();
+    CuAssertIntEquals(tc, 0, trie.size());
+    CuAssertTrue(tc, ! trie.is_prefix("^A"));
+}
+
+
+/**
+ * Test the names of special keys aren't prefixes.
+ */
+void TestKeyTrieIgnored(CuTest * tc)
+{
+    CKeyTrie trie;
+
+    trie.insert("SPACE");
+    trie.insert("ENTER");
+    trie.insert("KEY_LEFT");
+    trie.insert("K");
+
+    CuAssertIntEquals(tc, 1, trie.size());
+    CuAssertTrue(tc, ! trie.is_prefix("K"));
+    CuAssertTrue(tc, ! trie.is_prefix("S"));
+    CuAssertTrue(tc, ! trie.is_prefix("E"));
+    CuAssertTrue(tc, CKeyTrie::ignored("KEY_DOWN"));
+    CuAssertTrue(tc, ! CKeyTrie::ignored("KE"));
+}
+
+
+CuSuite *
+key_trie_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestKeyTriePrefix);
+    SUITE_ADD_TEST(suite, TestKeyTrieIgnored);
+    return suite;
+}
@@ -0,0 +1,83 @@
+/*
+ * keymap_lua.cc - Native helpers for our keymaps.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "lua.h"
+
+
+/**
+ * @file keymap_lua.cc
+ *
+ * The keymaps themselves are the Lua tables beneath the global `keymap`
+ * table, one per mode.  This file provides the default `lookup_key`
+ * function, which CLua recognizes so that it may read the keymap itself
+ * rather than calling it, and the metamethod which tells CLua when a
+ * binding is added to a keymap.
+ *
+ */
+
+
+/**
+ * Implementation of `lookup_key(mode, key)`.
+ *
+ * Return the binding of the given key in the given mode, or nil.
+ */
+int l_lookup_key(lua_State * l)
+{
+    const char *mode = luaL_checkstring(l, 1);
+    const char *key  = luaL_checkstring(l, 2);
+
+    lua_getglobal(l, "keymap");
+
+    if (lua_istable(l, -1))
+    {
+        lua_getfield(l, -1, mode);
+
+        if (lua_istable(l, -1))
+        {
+            lua_getfield(l, -1, key);
+            return 1;
+        }
+    }
+
+    lua_pushnil(l);
+    return 1;
+}
+
+
+/**
+ * The `__newindex` metamethod of each keymap CLua has read, which is
+ * invoked when a binding is added to it.
+ */
+int l_keymap_newindex(lua_State * l)
+{
+    lua_settop(l, 3);
+    lua_rawset(l, 1);
+
+    CLua::instance()->keymap_changed();
+    return 0;
+}
+
+
+/**
+ * Register our default `lookup_key` function.
+ */
+void InitKeymap(lua_State * l)
+{
+    lua_register(l, "lookup_key", l_lookup_key);
+}
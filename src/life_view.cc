@@ -19,6 +19,7 @@
 
 #include "lua.h"
 #include "life_view.h"
+#include "screen.h"
 #include "statuspanel.h"
 
 
@@ -64,4 +65,9 @@ void CLifeView::on_idle()
 
     lua->execute("life:print_matrix()");
     lua->execute("life:next_gen()");
+
+    /*
+     * Each generation needs to be drawn.
+     */
+    CScreen::instance()->invalidate();
 }
@@ -0,0 +1,268 @@
+/*
+ * logfile_test.cc - Test-cases for our logger, and its tracing.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "json/json.h"
+#include "logger.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Read the lines of the given file.
+ */
+static std::vector < std::string > read_lines(const char *path)
+{
+    std::vector < std::string > lines;
+    std::ifstream in(path);
+    std::string line;
+
+    while (std::getline(in, line))
+        lines.push_back(line);
+
+    return (lines);
+}
+
+
+/**
+ * Test that only the levels we've asked for are logged.
+ */
+void TestLogLevels(CuTest * tc)
+{
+    char path[] = "/tmp/log.XXXXXX";
+    int fd = mkstemp(path);
+    CuAssertTrue(tc, fd != -1);
+    close(fd);
+
+    CLogger *logger = CLogger::instance();
+
+    /*
+     * Nothing is logged without a level, and a file.
+     */
+    CuAssertTrue(tc, ! logger->enabled("debug"));
+
+    logger->set_level("debug|lua");
+    CuAssertTrue(tc, ! logger->enabled("debug"));
+
+    logger->set_path(path);
+    CuAssertTrue(tc, logger->enabled("debug"));
+    CuAssertTrue(tc, logger->enabled("lua"));
+    CuAssertTrue(tc, ! logger->enabled("deb"));
+    CuAssertTrue(tc, ! logger->enabled("maildir"));
+    CuAssertTrue(tc, ! logger->enabled(NULL));
+    CuAssertStrEquals(tc, "debug|lua", logger->get_level().c_str());
+
+    logger->log("debug", "one %d", 1);
+    logger->log("maildir", "two");
+    logger->log("lua", "%s", "three");
+
+    /*
+     * "all" enables every level.
+     */
+    logger->set_level("debug|all");
+    CuAssertTrue(tc, logger->enabled("maildir"));
+
+    logger->log("maildir", "four");
+    logger->flush();
+
+    std::vector < std::string > lines = read_lines(path);
+    CuAssertIntEquals(tc, 3, lines.size());
+
+    CuAssertTrue(tc, lines[0].find(" <debug> one 1") != std::string::npos);
+    CuAssertTrue(tc, lines[1].find(" <lua> three") != std::string::npos);
+    CuAssertTrue(tc, lines[2].find(" <maildir> four") != std::string::npos);
+
+    /*
+     * The time comes first: "DD/MM/YYYY HH:MM:SS.mmm".
+     */
+    CuAssertIntEquals(tc, '/', lines[0][2]);
+    CuAssertIntEquals(tc, ' ', lines[0][10]);
+    CuAssertIntEquals(tc, '.', lines[0][19]);
+
+    logger->set_level("");
+    CuAssertTrue(tc, ! logger->enabled("debug"));
+
+    logger->set_path("");
+    unlink(path);
+}
+
+
+/**
+ * Test that messages logged by several threads at once, many more than our
+ * buffer holds, are all written.
+ */
+void TestLogThreads(CuTest * tc)
+{
+    char path[] = "/tmp/log.XXXXXX";
+    int fd = mkstemp(path);
+    CuAssertTrue(tc, fd != -1);
+    close(fd);
+
+    CLogger *logger = CLogger::instance();
+    logger->set_level("all");
+    logger->set_path(path);
+
+    const int threads  = 4;
+    const int messages = 2000;
+
+    std::vector < std::thread > workers;
+
+    for (int t = 0; t < threads; t++)
+    {
+        workers.push_back(std::thread([logger, t, messages]()
+        {
+            for (int i = 0; i < messages; i++)
+                logger->log("thread", "%d:%d", t, i);
+        }));
+    }
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    /*
+     * Changing the file writes everything logged to the old one.
+     */
+    logger->set_path("");
+    logger->set_level("");
+
+    std::vector < std::string > lines = read_lines(path);
+    unlink(path);
+
+    CuAssertIntEquals(tc, threads * messages, lines.size());
+
+    /*
+     * Each thread's messages are written in the order they were logged.
+     */
+    std::vector < int > next(threads, 0);
+
+    for (const std::string &line : lines)
+    {
+        size_t pos = line.find("<thread> ");
+        CuAssertTrue(tc, pos != std::string::npos);
+
+        int t = -1, i = -1;
+        CuAssertIntEquals(tc, 2, sscanf(line.c_str() + pos + 9, "%d:%d", &t, &i));
+        CuAssertTrue(tc, (t >= 0) && (t < threads));
+        CuAssertIntEquals(tc, next[t], i);
+        next[t]++;
+    }
+
+    /*
+     * Long messages are truncated.
+     */
+    fd = mkstemp(path);
+    close(fd);
+
+    logger->set_level("all");
+    logger->set_path(path);
+    logger->log("long", "%s", std::string(4096, 'x').c_str());
+    logger->set_path("");
+    logger->set_level("");
+
+    lines = read_lines(path);
+    unlink(path);
+
+    CuAssertIntEquals(tc, 1, lines.size());
+    CuAssertTrue(tc, lines[0].size() > 1000);
+    CuAssertTrue(tc, lines[0].size() < 1100);
+}
+
+
+/**
+ * Test that spans are written as valid trace-events.
+ */
+void TestTraceSpans(CuTest * tc)
+{
+    /*
+     * Spans cost nothing, and record nothing, when we're not tracing.
+     */
+    CuAssertTrue(tc, ! CLogger::tracing());
+
+    {
+        CTraceSpan ignored("ignored");
+    }
+
+    char path[] = "/tmp/trace.XXXXXX";
+    int fd = mkstemp(path);
+    CuAssertTrue(tc, fd != -1);
+    close(fd);
+
+    CLogger *logger = CLogger::instance();
+    logger->set_trace_path(path);
+    CuAssertTrue(tc, CLogger::tracing());
+
+    {
+        CTraceSpan outer("outer");
+
+        {
+            CTraceSpan inner(std::string("inner \"quoted\""));
+        }
+    }
+
+    logger->set_trace_path("");
+    CuAssertTrue(tc, ! CLogger::tracing());
+
+    {
+        CTraceSpan ignored("ignored");
+    }
+
+    std::ifstream in(path);
+    std::stringstream content;
+    content << in.rdbuf();
+    unlink(path);
+
+    /*
+     * The file is a JSON array of events, the inner span - which ended
+     * first - being written first, and being nested deeper.
+     */
+    Json::Value root;
+    Json::Reader reader;
+    CuAssertTrue(tc, reader.parse(content.str(), root));
+    CuAssertTrue(tc, root.isArray());
+    CuAssertIntEquals(tc, 3, root.size());
+
+    CuAssertStrEquals(tc, "inner \"quoted\"", root[0]["name"].asString().c_str());
+    CuAssertStrEquals(tc, "X", root[0]["ph"].asString().c_str());
+    CuAssertIntEquals(tc, 1, root[0]["args"]["depth"].asInt());
+
+    CuAssertStrEquals(tc, "outer", root[1]["name"].asString().c_str());
+    CuAssertIntEquals(tc, 0, root[1]["args"]["depth"].asInt());
+    CuAssertTrue(tc, root[1]["ts"].asUInt64() <= root[0]["ts"].asUInt64());
+    CuAssertTrue(tc, root[1]["dur"].asUInt64() >= root[0]["dur"].asUInt64());
+
+    CuAssertStrEquals(tc, "M", root[2]["ph"].asString().c_str());
+}
+
+
+CuSuite *
+logfile_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestLogLevels);
+    SUITE_ADD_TEST(suite, TestLogThreads);
+    SUITE_ADD_TEST(suite, TestTraceSpans);
+    return suite;
+}
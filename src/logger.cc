@@ -18,70 +18,221 @@
 
 #include <chrono>
 #include <fstream>
-#include <iomanip>
 #include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "logger.h"
 #include "util.h"
 
 
+/*
+ * The number of trace-events we buffer before writing them out.
+ */
+#define TRACE_BUFFER 512
+
+
+/*
+ * The number of slots in our ring-buffer of messages, which must be a
+ * power of two.
+ */
+#define LOG_SLOTS 256
+
+/*
+ * The space reserved for the time and level which prefix each message,
+ * and for the message itself.
+ */
+#define LOG_PREFIX  64
+#define LOG_MESSAGE 1024
+
+/*
+ * How often our writer wakes to write messages, in milliseconds, when
+ * it isn't woken sooner.
+ */
+#define LOG_INTERVAL 100
+
+
+/*
+ * A slot of our ring-buffer.  The sequence-number says whether the slot
+ * is free to be written, or holds a message waiting to be written out.
+ */
+struct CLogger::log_slot
+{
+    std::atomic < size_t > sequence;
+    size_t length;
+    char text[LOG_PREFIX + LOG_MESSAGE + 1];
+};
+
+
+/*
+ * Is tracing enabled?
+ */
+std::atomic < bool > CLogger::m_tracing(false);
+
+/*
+ * The depth of nesting of spans, upon each thread.
+ */
+thread_local int CTraceSpan::m_depth = 0;
+
+
+/*
+ * Escape a string for inclusion within JSON.
+ */
+static std::string json_escape(const std::string &input)
+{
+    std::string result;
+
+    for (char c : input)
+    {
+        if ((c == '"') || (c == '\\'))
+        {
+            result += '\\';
+            result += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            result += buf;
+        }
+        else
+            result += c;
+    }
+
+    return (result);
+}
+
+
+/*
+ * A small number identifying the calling thread, for trace-events.
+ */
+static int trace_thread_id()
+{
+    static std::atomic < int > next(1);
+    static thread_local int id = 0;
+
+    if (id == 0)
+        id = next++;
+
+    return (id);
+}
+
+
 
 /*
  * Constructor - This is private as this class is a singleton.
  */
 CLogger::CLogger()
 {
-    m_level = "";
-    m_path  = "";
+    m_level  = "";
+    m_levels = NULL;
+    m_path   = "";
+    m_logging = false;
+
+    m_slots.reset(new log_slot[LOG_SLOTS]);
+
+    for (size_t i = 0; i < LOG_SLOTS; i++)
+        m_slots[i].sequence = i;
+
+    m_enqueue = 0;
+    m_dequeue = 0;
+
+    m_file     = NULL;
+    m_reopen   = false;
+    m_flushing = false;
+    m_stopping = false;
 }
 
 /*
- * Log a message, if the level includes it.
+ * Destructor - writes any pending messages, and completes any trace-file.
  */
-void CLogger::log(const char *level, const char *fmt,  ...)
+CLogger::~CLogger()
 {
-    if (m_level.empty())
-        return;
+    if (m_writer.joinable())
+    {
+        {
+            std::lock_guard < std::mutex > lock(m_writer_lock);
+            m_stopping = true;
+        }
 
-    if (m_path.empty())
-        return;
+        m_wake.notify_one();
+        m_writer.join();
+    }
 
-    /*
-     * Only log if the level matches, or is all.
-     */
-    std::vector<std::string> levels;
-    levels = split(m_level, '|');
+    if (m_file != NULL)
+        fclose(m_file);
 
-    /*
-     * Should we log?
-     */
-    bool log = false;
+    set_trace_path("");
+}
 
-    /*
-     * Is the log-level "all", or otherwise a match for the
-     * level?
-     */
-    for (std::vector<std::string>::iterator it = levels.begin(); it != levels.end() ; ++it)
-    {
-        std::string opt = (*it);
 
-        if ((opt == "all") || (opt == level))
-            log = true;
+/*
+ * Would a message of the given level be logged?
+ */
+bool CLogger::enabled(const char *level)
+{
+    if (! m_logging.load(std::memory_order_relaxed))
+        return false;
+
+    const log_levels *levels = m_levels.load(std::memory_order_acquire);
+
+    if (levels == NULL)
+        return false;
+
+    if (levels->all)
+        return true;
+
+    if (level == NULL)
+        return false;
+
+    for (const std::string &name : levels->names)
+    {
+        if (strcmp(name.c_str(), level) == 0)
+            return true;
     }
 
-    if (log == false)
+    return false;
+}
+
+
+/*
+ * Log a message, if the level includes it.
+ */
+void CLogger::log(const char *level, const char *fmt,  ...)
+{
+    if (! enabled(level))
         return;
 
+    /*
+     * Claim the next slot, waiting for the writer if the buffer is full.
+     */
+    log_slot *slot;
+    size_t pos = m_enqueue.load(std::memory_order_relaxed);
 
-    char buffer[1024];
-    va_list args;
-    va_start(args, fmt);
-    memset(buffer, '\0', sizeof(buffer));
-    vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
-    va_end(args);
+    while (true)
+    {
+        slot = &m_slots[pos & (LOG_SLOTS - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
 
+        if (sequence == pos)
+        {
+            if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (sequence < pos)
+        {
+            m_wake.notify_one();
+            std::this_thread::yield();
+            pos = m_enqueue.load(std::memory_order_relaxed);
+        }
+        else
+            pos = m_enqueue.load(std::memory_order_relaxed);
+    }
 
+    /*
+     * Format the message directly into the slot.
+     */
     tm localTime;
     std::chrono::system_clock::time_point t = std::chrono::system_clock::now();
     time_t now = std::chrono::system_clock::to_time_t(t);
@@ -90,23 +241,35 @@ void CLogger::log(const char *level, const char *fmt,  ...)
     const std::chrono::duration<double> tse = t.time_since_epoch();
     std::chrono::seconds::rep milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(tse).count() % 1000;
 
-    std::fstream fs;
-    fs.open(m_path,  std::fstream::out | std::fstream::app);
+    int len = snprintf(slot->text, LOG_PREFIX, "%02d/%02d/%04d %02d:%02d:%02d.%03d <%s> ",
+                       localTime.tm_mday, localTime.tm_mon + 1, 1900 + localTime.tm_year,
+                       localTime.tm_hour, localTime.tm_min, localTime.tm_sec,
+                       (int)milliseconds, level ? level : "");
 
-    fs
-            << std::setfill('0') << std::setw(2) << localTime.tm_mday << '/'
-            << std::setfill('0') << std::setw(2) << (localTime.tm_mon + 1) << '/'
-            << std::setfill('0') << std::setw(4) << (1900 + localTime.tm_year) << ' '
-            << std::setfill('0') << std::setw(2) << localTime.tm_hour << ':'
-            << std::setfill('0') << std::setw(2) << localTime.tm_min << ':'
-            << std::setfill('0') << std::setw(2) << localTime.tm_sec << '.'
-            << std::setfill('0') << std::setw(3) << milliseconds
-            << " <"
-            << level
-            << "> ";
+    if ((len < 0) || (len >= LOG_PREFIX))
+        len = LOG_PREFIX - 1;
 
-    fs << buffer << "\n";
-    fs.close();
+    va_list args;
+    va_start(args, fmt);
+    int body = vsnprintf(slot->text + len, LOG_MESSAGE, fmt, args);
+    va_end(args);
+
+    if (body < 0)
+        body = 0;
+    else if (body >= LOG_MESSAGE)
+        body = LOG_MESSAGE - 1;
+
+    len += body;
+    slot->text[len++] = '\n';
+    slot->length = len;
+
+    /*
+     * Publish it, waking the writer if the buffer is filling up.
+     */
+    slot->sequence.store(pos + 1, std::memory_order_release);
+
+    if ((pos - m_dequeue.load(std::memory_order_relaxed)) == (LOG_SLOTS / 2))
+        m_wake.notify_one();
 }
 
 /*
@@ -114,21 +277,276 @@ void CLogger::log(const char *level, const char *fmt,  ...)
  */
 std::string CLogger::get_level()
 {
+    std::lock_guard < std::mutex > lock(m_level_lock);
     return (m_level);
 }
 
 /*
- * Change the log-level
+ * Change the log-level, parsing it into the set of levels we log.
  */
 void CLogger::set_level(std::string level)
 {
+    std::lock_guard < std::mutex > lock(m_level_lock);
+
+    if (level == m_level)
+        return;
+
     m_level = level;
+
+    if (level.empty())
+    {
+        m_levels = NULL;
+        return;
+    }
+
+    std::unique_ptr < log_levels > levels(new log_levels);
+    levels->all = false;
+
+    for (const std::string &name : split(level, '|'))
+    {
+        if (name == "all")
+            levels->all = true;
+        else
+            levels->names.push_back(name);
+    }
+
+    m_levels.store(levels.get(), std::memory_order_release);
+    m_level_sets.push_back(std::move(levels));
 }
 
 /*
  * Change the log-file.
+ *
+ * Messages logged before the change are written to the previous file.
  */
 void CLogger::set_path(std::string path)
 {
-    m_path = path;
+    flush();
+
+    {
+        std::lock_guard < std::mutex > lock(m_writer_lock);
+
+        if (path == m_path)
+            return;
+
+        m_path   = path;
+        m_reopen = true;
+
+        if (! m_writer.joinable() && ! path.empty())
+            m_writer = std::thread(&CLogger::writer, this);
+    }
+
+    m_wake.notify_one();
+
+    /*
+     * Wait for the file to be opened, so that it exists once we return.
+     */
+    flush();
+
+    m_logging = ! path.empty();
+}
+
+/*
+ * Wait until every message logged so far has been written.
+ */
+void CLogger::flush()
+{
+    std::unique_lock < std::mutex > lock(m_writer_lock);
+
+    if (! m_writer.joinable())
+        return;
+
+    size_t target = m_enqueue.load(std::memory_order_relaxed);
+
+    m_flushing = true;
+    m_wake.notify_one();
+
+    m_written.wait(lock, [&]
+    {
+        return ((! m_reopen) && (m_dequeue.load(std::memory_order_relaxed) >= target));
+    });
+}
+
+
+/*
+ * The body of our writer-thread: wait to be woken, because the buffer is
+ * filling up or we've been asked to, or for a short time to pass, then
+ * write out everything we've been given.
+ */
+void CLogger::writer()
+{
+    std::unique_lock < std::mutex > lock(m_writer_lock);
+
+    while (true)
+    {
+        m_wake.wait_for(lock, std::chrono::milliseconds(LOG_INTERVAL), [&]
+        {
+            size_t queued = m_enqueue.load(std::memory_order_relaxed) -
+                            m_dequeue.load(std::memory_order_relaxed);
+
+            return (m_stopping || m_flushing || m_reopen || (queued >= (LOG_SLOTS / 2)));
+        });
+
+        bool stopping = m_stopping;
+        m_flushing = false;
+
+        /*
+         * Changing the file only happens here, so that the file is never
+         * closed beneath us.
+         */
+        if (m_reopen)
+        {
+            if (m_file != NULL)
+                fclose(m_file);
+
+            m_file = m_path.empty() ? NULL : fopen(m_path.c_str(), "a");
+        }
+
+        lock.unlock();
+
+        while (drain())
+            ;
+
+        if (m_file != NULL)
+            fflush(m_file);
+
+        lock.lock();
+        m_reopen = false;
+        m_written.notify_all();
+
+        if (stopping)
+            return;
+    }
+}
+
+
+/*
+ * Write every completed message to our log-file.
+ *
+ * Messages are discarded if we have no file.
+ */
+bool CLogger::drain()
+{
+    bool found = false;
+    size_t pos = m_dequeue.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        log_slot *slot = &m_slots[pos & (LOG_SLOTS - 1)];
+
+        if (slot->sequence.load(std::memory_order_acquire) != (pos + 1))
+            break;
+
+        if (m_file != NULL)
+            fwrite(slot->text, 1, slot->length, m_file);
+
+        slot->sequence.store(pos + LOG_SLOTS, std::memory_order_release);
+        m_dequeue.store(++pos, std::memory_order_relaxed);
+        found = true;
+    }
+
+    return (found);
+}
+
+
+/*
+ * Change the trace-file.
+ */
+void CLogger::set_trace_path(std::string path)
+{
+    flush_trace();
+
+    std::lock_guard < std::mutex > lock(m_trace_lock);
+
+    if (path == m_trace_path)
+        return;
+
+    /*
+     * Complete the JSON array of any previous file.  Viewers accept a
+     * file without this, so one we were killed before finishing is
+     * still useful.
+     */
+    if (! m_trace_path.empty())
+    {
+        std::fstream fs;
+        fs.open(m_trace_path, std::fstream::out | std::fstream::app);
+        fs << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << getpid()
+           << ",\"args\":{\"name\":\"lumail\"}}\n]\n";
+        fs.close();
+    }
+
+    m_trace_path = path;
+    m_tracing    = ! path.empty();
+
+    if (m_tracing)
+    {
+        std::fstream fs;
+        fs.open(m_trace_path, std::fstream::out | std::fstream::trunc);
+        fs << "[\n";
+        fs.close();
+    }
+}
+
+
+/*
+ * Record a completed span.
+ */
+void CLogger::trace(const std::string &name, uint64_t start, uint64_t duration, int depth)
+{
+    if (! tracing())
+        return;
+
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "\",\"cat\":\"lumail\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"depth\":%d}},\n",
+             (unsigned long long)start, (unsigned long long)duration,
+             (int)getpid(), trace_thread_id(), depth);
+
+    std::string event = "{\"name\":\"" + json_escape(name) + buf;
+
+    bool full = false;
+
+    {
+        std::lock_guard < std::mutex > lock(m_trace_lock);
+        m_trace_events.push_back(event);
+        full = (m_trace_events.size() >= TRACE_BUFFER);
+    }
+
+    if (full)
+        flush_trace();
+}
+
+
+/*
+ * Write any buffered trace-events to our trace-file.
+ */
+void CLogger::flush_trace()
+{
+    std::lock_guard < std::mutex > lock(m_trace_lock);
+
+    if (m_trace_events.empty())
+        return;
+
+    if (! m_trace_path.empty())
+    {
+        std::fstream fs;
+        fs.open(m_trace_path, std::fstream::out | std::fstream::app);
+
+        for (const std::string &event : m_trace_events)
+            fs << event;
+
+        fs.close();
+    }
+
+    m_trace_events.clear();
+}
+
+
+/*
+ * The current time, in microseconds, from a monotonic clock.
+ */
+uint64_t CLogger::now()
+{
+    auto since = std::chrono::steady_clock::now().time_since_epoch();
+    return (std::chrono::duration_cast<std::chrono::microseconds>(since).count());
 }
@@ -18,7 +18,14 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "singleton.h"
@@ -29,6 +36,10 @@
  * messages.
  *
  * It can be used by the C++ code, or via the Lua wrapper.
+ *
+ * Messages are formatted by the caller into a fixed-size ring-buffer,
+ * without taking a lock, and a background thread writes them out to our
+ * log-file, which it keeps open.
  */
 class CLogger : public Singleton<CLogger>
 {
@@ -40,6 +51,14 @@ public:
      */
     void log(const char *level , const char *fmt,  ...);
 
+    /**
+     * Would a message of the given level be logged?
+     *
+     * This is cheap, so that callers may avoid building messages which
+     * would be discarded.
+     */
+    bool enabled(const char *level);
+
     /**
      * Get the current log-level
      */
@@ -55,6 +74,48 @@ public:
      */
     void set_path(std::string path);
 
+    /**
+     * Wait until every message logged so far has been written to our
+     * log-file.
+     */
+    void flush();
+
+    /**
+     * Change the file we write trace-events to, which enables tracing.
+     * An empty path disables it.
+     *
+     * The file is written in the Chrome trace-event format, so it may
+     * be loaded into `chrome://tracing`, or a similar viewer.
+     */
+    void set_trace_path(std::string path);
+
+    /**
+     * Are we tracing?  This is cheap, so that spans cost next to nothing
+     * when tracing is disabled.
+     */
+    static bool tracing()
+    {
+        return (m_tracing.load(std::memory_order_relaxed));
+    };
+
+    /**
+     * Record a span with the given name, which started at `start` and
+     * lasted `duration` microseconds, at the given depth of nesting.
+     *
+     * This is usually done via `CTraceSpan`.
+     */
+    void trace(const std::string &name, uint64_t start, uint64_t duration, int depth);
+
+    /**
+     * Write any buffered trace-events to our trace-file.
+     */
+    void flush_trace();
+
+    /**
+     * The current time, in microseconds, as used for trace-events.
+     */
+    static uint64_t now();
+
 public:
 
     /**
@@ -62,15 +123,165 @@ public:
      */
     CLogger();
 
+    /**
+     * Destructor - writes any pending messages, and completes any
+     * trace-file.
+     */
+    ~CLogger();
+
+private:
+
+    /**
+     * The levels we log, as parsed from our log-level.
+     */
+    typedef struct _log_levels
+    {
+        bool all;
+        std::vector < std::string > names;
+    } log_levels;
+
+    /**
+     * A single slot of our ring-buffer.
+     */
+    struct log_slot;
+
+    /**
+     * The body of our writer-thread.
+     */
+    void writer();
+
+    /**
+     * Write every message which has been completed to our log-file,
+     * returning false if there were none.
+     */
+    bool drain();
+
 private:
 
     /**
-     * The current log-level.
+     * The current log-level, and the levels it enables.
+     *
+     * Sets are never freed until we are, as they may still be in use by
+     * a thread which is logging while the level is changed.
      */
     std::string m_level;
+    std::atomic < const log_levels * > m_levels;
+    std::vector < std::unique_ptr < log_levels > > m_level_sets;
+    std::mutex m_level_lock;
 
     /**
-     * The log-file
+     * The log-file, and whether we have one.
      */
     std::string m_path;
+    std::atomic < bool > m_logging;
+
+    /**
+     * The ring-buffer of messages.
+     *
+     * This is a bounded queue with a sequence-number in each slot, so any
+     * number of threads may add messages while the writer removes them.
+     */
+    std::unique_ptr < log_slot[] > m_slots;
+    std::atomic < size_t > m_enqueue;
+    std::atomic < size_t > m_dequeue;
+
+    /**
+     * The writer-thread, the file it writes to, and the state which is
+     * used to wake it, and to wait for it.
+     */
+    std::thread m_writer;
+    FILE *m_file;
+    std::mutex m_writer_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_written;
+    bool m_reopen;
+    bool m_flushing;
+    bool m_stopping;
+
+    /**
+     * The trace-file, and the events we've yet to write to it.
+     */
+    std::string m_trace_path;
+    std::vector < std::string > m_trace_events;
+
+    /**
+     * Spans may be recorded by any thread.
+     */
+    std::mutex m_trace_lock;
+
+    /**
+     * Is tracing enabled?
+     */
+    static std::atomic < bool > m_tracing;
+};
+
+
+/**
+ * Record the lifetime of this object as a span, if tracing is enabled.
+ *
+ * Spans nest, so a span created while another is alive, upon the same
+ * thread, is shown within it.
+ */
+class CTraceSpan
+{
+public:
+    CTraceSpan(const char *name)
+    {
+        m_start = 0;
+
+        if (CLogger::tracing())
+        {
+            m_name  = name;
+            m_start = CLogger::now();
+            m_depth++;
+        }
+    };
+
+    CTraceSpan(const std::string &name)
+    {
+        m_start = 0;
+
+        if (CLogger::tracing())
+        {
+            m_name  = name;
+            m_start = CLogger::now();
+            m_depth++;
+        }
+    };
+
+    /**
+     * A span named by the given prefix and detail, which are only joined
+     * if we're tracing.
+     */
+    CTraceSpan(const char *prefix, const std::string &detail)
+    {
+        m_start = 0;
+
+        if (CLogger::tracing())
+        {
+            m_name  = std::string(prefix) + detail;
+            m_start = CLogger::now();
+            m_depth++;
+        }
+    };
+
+    ~CTraceSpan()
+    {
+        if (m_start == 0)
+            return;
+
+        m_depth--;
+
+        CLogger *logger = CLogger::instance();
+        logger->trace(m_name, m_start, CLogger::now() - m_start, m_depth);
+    };
+
+private:
+    std::string m_name;
+    uint64_t m_start;
+
+    /**
+     * The number of spans alive upon this thread.
+     */
+    static thread_local int m_depth;
 };
@@ -84,6 +84,38 @@ int l_CLog_level(lua_State * L)
 }
 
 
+/**
+ * Call a function, recording its duration as a span if tracing is
+ * enabled, and returning its results.
+ *
+ * Any error raised by the function is raised again once the span has
+ * been recorded.
+ */
+int l_CLog_span(lua_State * L)
+{
+    CLuaLog("l_CLog_span");
+
+    const char *name = luaL_checkstring(L, 2);
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+
+    int args = lua_gettop(L) - 3;
+    int status;
+
+    {
+        CTraceSpan span(name);
+        status = lua_pcall(L, args, LUA_MULTRET, 0);
+    }
+
+    if (status != 0)
+        return (lua_error(L));
+
+    /*
+     * Return everything above our own two arguments.
+     */
+    return (lua_gettop(L) - 2);
+}
+
+
 /**
  * Register the global `Log` object to the Lua environment,
  * and setup our public methods upon which the user may operate.
@@ -94,6 +126,7 @@ void InitLogfile(lua_State * l)
     {
         {"log",  l_CLog_log},
         {"level",  l_CLog_level},
+        {"span",  l_CLog_span},
         {NULL,      NULL}
     };
     luaL_newmetatable(l, "luaL_CLog");
@@ -17,11 +17,14 @@
  */
 
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <string.h>
 
+#include "bytecode_cache.h"
 #include "config.h"
+#include "frame_stats.h"
 #include "lua.h"
 #include "screen.h"
 
@@ -29,11 +32,14 @@
 /*
  * External functions implemented in *_lua.cc
  */
+extern void InitBytecode(lua_State * l);
 extern void InitCache(lua_State * l);
 extern void InitConfig(lua_State * l);
 extern void InitDirectory(lua_State * l);
 extern void InitFile(lua_State * l);
 extern void InitGlobalState(lua_State * l);
+extern void InitJob(lua_State * l);
+extern void InitKeymap(lua_State * l);
 extern void InitLogfile(lua_State * l);
 extern void InitMaildir(lua_State * l);
 extern void InitMessage(lua_State * l);
@@ -41,10 +47,21 @@ extern void InitMIME(lua_State * l);
 extern void InitMessagePart(lua_State * l);
 extern void InitNet(lua_State * l);
 extern void InitPanel(lua_State * l);
+extern void InitProfiler(lua_State * l);
 extern void InitRegexp(lua_State * l);
 extern void InitScreen(lua_State * l);
+extern void InitSearch(lua_State * l);
+extern void InitSelection(lua_State * l);
+extern void InitText(lua_State * l);
+extern void InitTimer(lua_State * l);
 extern void InitUtf(lua_State * l);
 
+extern void RunConfigSubscribers(lua_State * l, const std::string &key, CConfigEntry *old);
+extern void RunTimers(lua_State * l);
+
+extern int l_lookup_key(lua_State * l);
+extern int l_keymap_newindex(lua_State * l);
+
 
 /*
  * For debug-purposes the nesting starts at zero.
@@ -76,8 +93,12 @@ void CLua::set_args(char *argv[], int argc)
 /*
  * Constructor - This is private as this class is a singleton.
  */
-CLua::CLua() : Observer(CConfig::instance())
+CLua::CLua()
 {
+    m_key_changed    = false;
+    m_gc_idle_heap   = 0;
+    m_gc_idle_cycles = 0;
+    m_keymaps_dirty  = false;
 
     /*
      * Create a new Lua object.
@@ -95,21 +116,35 @@ CLua::CLua() : Observer(CConfig::instance())
     /*
      * Load our bindings.
      */
+    InitBytecode(m_lua);
     InitCache(m_lua);
     InitConfig(m_lua);
     InitDirectory(m_lua);
     InitFile(m_lua);
     InitGlobalState(m_lua);
+    InitJob(m_lua);
+    InitKeymap(m_lua);
     InitLogfile(m_lua);
     InitMaildir(m_lua);
     InitMessage(m_lua);
     InitMessagePart(m_lua);
     InitNet(m_lua);
     InitPanel(m_lua);
+    InitProfiler(m_lua);
     InitMIME(m_lua);
     InitRegexp(m_lua);
     InitScreen(m_lua);
+    InitSearch(m_lua);
+    InitSelection(m_lua);
+    InitText(m_lua);
+    InitTimer(m_lua);
     InitUtf(m_lua);
+
+    /*
+     * Tune our collector, now and whenever its settings change.
+     */
+    CConfig::instance()->subscribe_prefix(this, "lua.gc_");
+    apply_gc_settings();
 }
 
 
@@ -132,8 +167,10 @@ CLua::~CLua()
 void CLua::load_file(std::string filename)
 {
     CLuaLog("load_file(" + filename + ")");
+    CTraceSpan span("load_file ", filename);
 
-    int erred = luaL_dofile(m_lua, filename.c_str());
+    int erred = CBytecodeCache::instance()->load(m_lua, filename) ||
+                lua_pcall(m_lua, 0, LUA_MULTRET, 0);
 
     if (erred)
     {
@@ -155,7 +192,36 @@ void CLua::load_file(std::string filename)
          */
         free(err);
     }
+}
+
+/*
+ * Run the given file as a batch script.
+ */
+bool CLua::run_file(std::string filename, int &status, std::string &error)
+{
+    CLuaLog("run_file(" + filename + ")");
+    CTraceSpan span("run_file ", filename);
+
+    status = 0;
+
+    int top = lua_gettop(m_lua);
+    int erred = CBytecodeCache::instance()->load(m_lua, filename) ||
+                lua_pcall(m_lua, 0, 1, 0);
 
+    if (erred)
+    {
+        error = lua_isstring(m_lua, -1) ? lua_tostring(m_lua, -1) : "unknown error";
+        lua_settop(m_lua, top);
+        return false;
+    }
+
+    if (lua_isnumber(m_lua, -1))
+        status = (int) lua_tointeger(m_lua, -1);
+    else if (lua_isboolean(m_lua, -1) && ! lua_toboolean(m_lua, -1))
+        status = 1;
+
+    lua_settop(m_lua, top);
+    return true;
 }
 
 void CLua::on_error(std::string msg)
@@ -181,6 +247,133 @@ void CLua::on_error(std::string msg)
     }
 }
 
+/*
+ * Call the user "on_idle" function, if it exists.
+ *
+ * This is called frequently, so we call the function directly rather
+ * than compiling a string to do so.
+ */
+void CLua::on_idle()
+{
+    CLuaLog("on_idle()");
+
+    lua_getglobal(m_lua, "on_idle");
+
+    if (! lua_isfunction(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        return;
+    }
+
+    if (lua_pcall(m_lua, 0, 0, 0) != 0)
+    {
+        std::string err = lua_tostring(m_lua, -1);
+        lua_pop(m_lua, 1);
+        on_error(err);
+    }
+}
+
+
+/*
+ * Invoke the callbacks of any `Timer` which has expired.
+ */
+void CLua::run_timers()
+{
+    CLuaLog("run_timers()");
+
+    RunTimers(m_lua);
+}
+
+
+/*
+ * Spend some of our idle time collecting garbage.
+ */
+void CLua::gc_idle()
+{
+    CConfig *config = CConfig::instance();
+    int budget = config->get_integer("lua.gc_idle_usec", 2000);
+
+    if (budget <= 0)
+        return;
+
+    /*
+     * If we finished a cycle last time, and nothing has been allocated
+     * since, there's nothing to do.
+     */
+    if ((m_gc_idle_heap > 0) && (heap_size() <= m_gc_idle_heap))
+        return;
+
+    CFrameTimer timer("gc");
+
+    m_gc_idle_heap = 0;
+    uint64_t deadline = CFrameStats::now() + budget;
+
+    do
+    {
+        if (lua_gc(m_lua, LUA_GCSTEP, 0))
+        {
+            m_gc_idle_heap = heap_size();
+            m_gc_idle_cycles += 1;
+            break;
+        }
+    }
+    while (CFrameStats::now() < deadline);
+
+    CFrameStats *stats = CFrameStats::instance();
+    stats->set_counter("lua_gc_cycles", m_gc_idle_cycles);
+}
+
+
+/*
+ * The number of bytes the Lua heap holds.
+ */
+uint64_t CLua::heap_size()
+{
+    uint64_t kb = lua_gc(m_lua, LUA_GCCOUNT, 0);
+    return ((kb * 1024) + lua_gc(m_lua, LUA_GCCOUNTB, 0));
+}
+
+
+/*
+ * Apply the `lua.gc_*` settings to our collector.
+ *
+ * Unset, or zero, values leave Lua's defaults alone.  The generational
+ * collector is only available with Lua 5.4, elsewhere we're always
+ * incremental.
+ */
+void CLua::apply_gc_settings()
+{
+    CConfig *config = CConfig::instance();
+
+    int pause   = config->get_integer("lua.gc_pause", 0);
+    int stepmul = config->get_integer("lua.gc_stepmul", 0);
+    std::string mode = config->get_string("lua.gc_mode", "incremental");
+
+#if LUA_VERSION_NUM >= 504
+    if (mode == "generational")
+        lua_gc(m_lua, LUA_GCGEN, 0, 0);
+    else
+        lua_gc(m_lua, LUA_GCINC, std::max(pause, 0), std::max(stepmul, 0), 0);
+#else
+
+    if (mode == "generational")
+        CLogger::instance()->log("lua", "The generational collector requires Lua 5.4.");
+
+    if (pause > 0)
+        lua_gc(m_lua, LUA_GCSETPAUSE, pause);
+
+    if (stepmul > 0)
+        lua_gc(m_lua, LUA_GCSETSTEPMUL, stepmul);
+
+#endif
+
+    /*
+     * Our idle collection starts afresh.
+     */
+    m_gc_idle_heap = 0;
+}
+
+
 /*
  * Evaluate the given string.
  *
@@ -293,6 +486,19 @@ std::vector<std::string> CLua::bindings(std::string mode)
 }
 
 
+/*
+ * Be told of changes to every configuration key.
+ */
+void CLua::watch_all_keys()
+{
+    if (m_key_changed)
+        return;
+
+    CConfig::instance()->attach(this);
+    m_key_changed = true;
+}
+
+
 /*
  * This method is called when a configuration key changes,
  * via our observer implementation.
@@ -301,6 +507,17 @@ void CLua::update(std::string key_name, CConfigEntry *old)
 {
     CLuaLog("update(" + key_name + ")");
 
+    if (key_name.compare(0, 7, "lua.gc_") == 0)
+        apply_gc_settings();
+
+    /*
+     * Call any functions subscribed to this key.
+     */
+    RunConfigSubscribers(m_lua, key_name, old);
+
+    if (! m_key_changed)
+        return;
+
     /*
      * If there is a Config:key_changed() function, then call it.
      */
@@ -308,7 +525,10 @@ void CLua::update(std::string key_name, CConfigEntry *old)
     lua_getfield(m_lua, -1, "key_changed");
 
     if (lua_isnil(m_lua, -1))
+    {
+        lua_pop(m_lua, 2);
         return;
+    }
 
     /*
      * Call the function.
@@ -393,6 +613,7 @@ void CLua::update(std::string key_name, CConfigEntry *old)
 std::vector<std::string> CLua::function2table(std::string function)
 {
     CLuaLog("function2table(" + function + ")");
+    CTraceSpan span("lua ", function);
 
     std::vector<std::string> result;
 
@@ -528,6 +749,91 @@ std::vector<std::string> CLua::functiona2table(std::string function, std::string
 }
 
 
+/*
+ * Call a view-function for a window of its rows.
+ */
+bool CLua::function2window(std::string function, int offset, int count,
+                           CLuaRows &rows, int &max)
+{
+    CLuaLog("function2window(" + function + ")");
+    CTraceSpan span("lua ", function);
+
+    rows.clear();
+    max = 0;
+
+    /*
+     * Get the function - if it doesn't exist we're done.
+     */
+    lua_getglobal(m_lua, function.c_str());
+
+    if (lua_isnil(m_lua, -1))
+    {
+        lua_pop(m_lua, 1);
+        fprintf(stderr, "FAILED to find function %s\n", function.c_str());
+        return false;
+    }
+
+    /*
+     * Views declare that they're windowed by being present in the
+     * `windowed_views` table.  Other views may well expect different
+     * arguments, if any, so they're called just as they always were.
+     */
+    bool windowed = false;
+
+    lua_getglobal(m_lua, "windowed_views");
+
+    if (lua_istable(m_lua, -1))
+    {
+        lua_pushvalue(m_lua, -2);
+        lua_rawget(m_lua, -2);
+        windowed = lua_toboolean(m_lua, -1);
+        lua_pop(m_lua, 1);
+    }
+
+    lua_pop(m_lua, 1);
+
+    int args = 0;
+
+    if (windowed)
+    {
+        lua_pushinteger(m_lua, offset);
+        lua_pushinteger(m_lua, count);
+        args = 2;
+    }
+
+    if (lua_pcall(m_lua, args, 2, 0) != 0)
+    {
+        fprintf(stderr, "FAILED  - Error in %s\n", function.c_str());
+
+        if (lua_isstring(m_lua, -1))
+        {
+            std::string err = lua_tostring(m_lua, -1);
+            lua_pop(m_lua, 1);
+            on_error(err);
+        }
+        else
+            lua_pop(m_lua, 1);
+
+        return false;
+    }
+
+    /*
+     * The rows are below the count, if any, on the stack.
+     */
+    rows.borrow(m_lua, -2);
+
+    windowed = windowed && lua_isnumber(m_lua, -1);
+
+    if (windowed)
+        max = lua_tointeger(m_lua, -1);
+    else
+        max = rows.size();
+
+    lua_pop(m_lua, 2);
+    return (windowed);
+}
+
+
 /*
  * Return the (string) contents of a variable.
  * Used for our test suite only.
@@ -622,10 +928,36 @@ std::string CLua::keybinding(std::string mode, std::string key)
 {
     CLuaLog("keybinding(" + mode + "," + key + ")");
 
+    std::string out = "";
+
     /*
      * Get the function.
      */
     lua_getglobal(m_lua, "lookup_key");
+
+    /*
+     * If it is our own we can read the keymap directly.
+     */
+    if (lua_tocfunction(m_lua, -1) == l_lookup_key)
+    {
+        lua_pop(m_lua, 1);
+
+        push_keymap(mode);
+
+        if (lua_istable(m_lua, -1))
+        {
+            lua_getfield(m_lua, -1, key.c_str());
+
+            if (lua_isstring(m_lua, -1))
+                out = lua_tostring(m_lua, -1);
+
+            lua_pop(m_lua, 1);
+        }
+
+        lua_pop(m_lua, 1);
+        return (out);
+    }
+
     lua_pushstring(m_lua, mode.c_str());
     lua_pushstring(m_lua, key.c_str());
 
@@ -650,17 +982,133 @@ std::string CLua::keybinding(std::string mode, std::string key)
         }
         else
             lua_pop(m_lua, 1);
+
+        return (out);
     }
 
     const char *res = lua_tostring(m_lua, -1);
-    std::string out = "";
 
     if (res != NULL)
         out = res ;
 
+    lua_pop(m_lua, 1);
     return (out);
 }
 
+
+/**
+ * Push the keymap of the given mode, and get the trie of its bindings.
+ *
+ * Each trie remembers the table it was built from, so that replacing a
+ * keymap is noticed.  The first time we read a keymap we give it a
+ * `__newindex` metamethod, so that we're told when a binding is added.
+ */
+CKeyTrie &CLua::push_keymap(const std::string &mode)
+{
+    lua_getglobal(m_lua, "keymap");
+
+    if (lua_istable(m_lua, -1))
+        lua_getfield(m_lua, -1, mode.c_str());
+    else
+        lua_pushnil(m_lua);
+
+    lua_remove(m_lua, -2);
+
+    const void *table = lua_istable(m_lua, -1) ? lua_topointer(m_lua, -1) : NULL;
+
+    if (m_keymaps_dirty)
+    {
+        for (auto it = m_keymaps.begin(); it != m_keymaps.end(); ++it)
+            luaL_unref(m_lua, LUA_REGISTRYINDEX, it->second.ref);
+
+        m_keymaps.clear();
+        m_keymaps_dirty = false;
+    }
+
+    auto it = m_keymaps.find(mode);
+
+    if ((it != m_keymaps.end()) && (it->second.table == table))
+        return (it->second.trie);
+
+    if (it != m_keymaps.end())
+        luaL_unref(m_lua, LUA_REGISTRYINDEX, it->second.ref);
+
+    keymap_trie &entry = m_keymaps[mode];
+    entry.table = table;
+    entry.ref   = LUA_NOREF;
+    entry.trie.clear();
+
+    if (table == NULL)
+        return (entry.trie);
+
+    lua_pushvalue(m_lua, -1);
+    entry.ref = luaL_ref(m_lua, LUA_REGISTRYINDEX);
+
+    lua_pushnil(m_lua);
+
+    while (lua_next(m_lua, -2))
+    {
+        if (lua_type(m_lua, -2) == LUA_TSTRING)
+            entry.trie.insert(lua_tostring(m_lua, -2));
+
+        lua_pop(m_lua, 1);
+    }
+
+    if (lua_getmetatable(m_lua, -1) == 0)
+    {
+        if (luaL_newmetatable(m_lua, "lumail.keymap"))
+        {
+            lua_pushcfunction(m_lua, l_keymap_newindex);
+            lua_setfield(m_lua, -2, "__newindex");
+        }
+
+        lua_setmetatable(m_lua, -2);
+    }
+    else
+        lua_pop(m_lua, 1);
+
+    return (entry.trie);
+}
+
+
+/**
+ * Is the given key-sequence the prefix of a longer binding?
+ */
+bool CLua::is_prefixed_key(std::string mode, const std::string &key)
+{
+    CKeyTrie *trie = &push_keymap(mode);
+    bool found = false;
+
+    if (trie->is_prefix(key))
+    {
+        /*
+         * Bindings may have been removed, without our knowledge, so
+         * make sure one of those which extend the key remains.
+         */
+        for (std::string binding : trie->extensions(key, 8))
+        {
+            lua_getfield(m_lua, -1, binding.c_str());
+            found = ! lua_isnil(m_lua, -1);
+            lua_pop(m_lua, 1);
+
+            if (found)
+                break;
+        }
+
+        if (! found)
+        {
+            lua_pop(m_lua, 1);
+            m_keymaps_dirty = true;
+
+            trie  = &push_keymap(mode);
+            found = trie->is_prefix(key);
+        }
+    }
+
+    lua_pop(m_lua, 1);
+    return (found);
+}
+
 void CLua::append_to_package_path(std::string added)
 {
     // get package.path
@@ -27,12 +27,17 @@ extern "C"
 #include <lualib.h>
 }
 
+#include <stdint.h>
+#include <unordered_map>
 #include <vector>
 #include <string>
 
+#include "key_trie.h"
 #include "logger.h"
+#include "lua_rows.h"
 #include "message_lua.h"
 #include "observer.h"
+#include "profiler.h"
 #include "singleton.h"
 
 /**
@@ -69,6 +74,15 @@ public:
      */
     void load_file(std::string filename);
 
+    /**
+     * Load the specified Lua file, and run it as a batch script.
+     *
+     * If the script returns a number that becomes `status`, `false` gives
+     * a status of one, and anything else zero.  On error we return false,
+     * with the error message, rather than aborting.
+     */
+    bool run_file(std::string filename, int &status, std::string &error);
+
     /**
      * Evaluate the given string.
      *
@@ -94,6 +108,12 @@ public:
      */
     void update(std::string key_name, CConfigEntry *old);
 
+    /**
+     * Be told of changes to every configuration key, rather than only
+     * those subscribed to, because `Config.key_changed` has been defined.
+     */
+    void watch_all_keys();
+
     /**
      * Call a Lua function which will return a table of text.
      *
@@ -110,6 +130,46 @@ public:
      */
     std::vector<std::string> functiona2table(std::string function, std::string arugment);
 
+    /**
+     * Call a view-function for a window of its rows.
+     *
+     * If the function is a key of the global `windowed_views` table it is
+     * given the (zero-based) offset of the first row we want, and the
+     * number of rows.  It returns just those rows, along with the total
+     * number of rows it has, in which case `max` is set and we return
+     * true.
+     *
+     * Other views are called without arguments and return every row, in
+     * which case we return false, with `max` set to the number of rows.
+     */
+    bool function2window(std::string function, int offset, int count,
+                         CLuaRows &rows, int &max);
+
+    /**
+     * Call the user "on_idle" function, if it exists.
+     */
+    void on_idle();
+
+    /**
+     * Invoke the callbacks of any `Timer` which has expired.
+     */
+    void run_timers();
+
+    /**
+     * Spend some of our idle time collecting garbage, so that less of
+     * it is left to be collected while we're handling input.
+     *
+     * We run incremental steps of the collector for no more than
+     * `lua.gc_idle_usec` microseconds, stopping early once a cycle is
+     * complete and nothing new has been allocated since.
+     */
+    void gc_idle();
+
+    /**
+     * The number of bytes the Lua heap holds.
+     */
+    uint64_t heap_size();
+
     /**
      * Call the user "on_error" function with given error message.
      */
@@ -134,9 +194,26 @@ public:
 
     /**
      * Lookup a key-binding.
+     *
+     * Unless `lookup_key` has been replaced the keymap is read directly,
+     * without calling any Lua.
      */
     std::string keybinding(std::string mode, std::string key);
 
+    /**
+     * Is the given key-sequence the prefix of a longer binding in the
+     * given mode?
+     */
+    bool is_prefixed_key(std::string mode, const std::string &key);
+
+    /**
+     * Note that a binding has been added to a keymap.
+     */
+    void keymap_changed()
+    {
+        m_keymaps_dirty = true;
+    };
+
     /**
      * Append to package.path
      */
@@ -149,6 +226,54 @@ private:
      */
     lua_State * m_lua;
 
+    /**
+     * Has `Config.key_changed` been defined?  If so we're
+     * told of changes to every key, otherwise only of those which Lua
+     * has subscribed to via `Config:subscribe`.
+     */
+    bool m_key_changed;
+
+    /**
+     * The size of the heap when an idle collection last completed, so
+     * that we don't collect again until something has been allocated.
+     */
+    uint64_t m_gc_idle_heap;
+
+    /**
+     * The number of collection-cycles completed while idle.
+     */
+    uint64_t m_gc_idle_cycles;
+
+    /**
+     * Apply the `lua.gc_*` settings to our collector.
+     */
+    void apply_gc_settings();
+
+    /**
+     * Push the keymap of the given mode, or nil, and get its trie,
+     * rebuilding that if the keymap has changed.
+     */
+    CKeyTrie &push_keymap(const std::string &mode);
+
+    /**
+     * The bindings of each mode's keymap, and the table each was
+     * built from.  We hold a reference to that table, so that its
+     * address isn't reused by another.
+     */
+    typedef struct _keymap_trie
+    {
+        const void *table;
+        int ref;
+        CKeyTrie trie;
+    } keymap_trie;
+
+    std::unordered_map<std::string, keymap_trie> m_keymaps;
+
+    /**
+     * Has a binding been added to any keymap since we built our tries?
+     */
+    bool m_keymaps_dirty;
+
 };
 
 
@@ -167,20 +292,27 @@ public:
     {
         m_name = name;
 
-        /*
-         * We're going to output padding to show nesting level.
-         */
-        std::string tmp = "";
+        CLogger *x = CLogger::instance();
+
+        if (x->enabled("lua"))
+        {
+            /*
+             * We're going to output padding to show nesting level.
+             */
+            std::string tmp = "";
 
-        for (int i = 0 ; i < m_nest ; i++)
+            for (int i = 0 ; i < m_nest ; i++)
+                tmp += " ";
+
+            tmp += "enter:" + m_name;
             tmp += " ";
+            tmp += "stack-depth:" + std::to_string(depth());
 
-        tmp += "enter:" + m_name;
-        tmp += " ";
-        tmp += "stack-depth:" + std::to_string(depth());
+            x->log("lua", "%s", tmp.c_str());
+        }
 
-        CLogger *x = CLogger::instance();
-        x->log("lua", "%s", tmp.c_str());
+        if (CProfiler::profiling())
+            CProfiler::instance()->binding(m_name);
 
         /*
          * Bump nesting level.
@@ -192,21 +324,24 @@ public:
     {
         m_nest -= 1;
 
-        /*
-         * We're going to output padding to show nesting level.
-         */
-        std::string tmp = "";
+        CLogger *x = CLogger::instance();
 
-        for (int i = 0 ; i < m_nest ; i++)
-            tmp += " ";
+        if (x->enabled("lua"))
+        {
+            /*
+             * We're going to output padding to show nesting level.
+             */
+            std::string tmp = "";
 
-        tmp += "exit:" + m_name;
-        tmp += " ";
-        tmp += "stack-depth:" + std::to_string(depth());
+            for (int i = 0 ; i < m_nest ; i++)
+                tmp += " ";
 
+            tmp += "exit:" + m_name;
+            tmp += " ";
+            tmp += "stack-depth:" + std::to_string(depth());
 
-        CLogger *x = CLogger::instance();
-        x->log("lua", "%s", tmp.c_str());
+            x->log("lua", "%s", tmp.c_str());
+        }
 
         /*
          * Ensure we don't go negative.
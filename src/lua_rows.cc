@@ -0,0 +1,153 @@
+/*
+ * lua_rows.cc - Rows of text borrowed from a Lua table.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+extern "C"
+{
+#include <lauxlib.h>
+}
+
+#include "lua_rows.h"
+
+
+/*
+ * Constructor.
+ */
+CLuaRows::CLuaRows()
+{
+    m_lua = NULL;
+    m_ref = LUA_NOREF;
+}
+
+
+/*
+ * Destructor.
+ */
+CLuaRows::~CLuaRows()
+{
+    clear();
+}
+
+
+/*
+ * Borrow the rows of the table at the given stack-index.
+ */
+void CLuaRows::borrow(lua_State *l, int index)
+{
+    clear();
+
+    if (! lua_istable(l, index))
+        return;
+
+    /*
+     * Make the index absolute, as we'll be pushing values.
+     */
+    if ((index < 0) && (index > LUA_REGISTRYINDEX))
+        index = lua_gettop(l) + index + 1;
+
+#if LUA_VERSION_NUM == 501
+    int size = lua_objlen(l, index);
+#else
+    int size = lua_rawlen(l, index);
+#endif
+
+    m_data.reserve(size);
+    m_length.reserve(size);
+
+    for (int i = 1; i <= size; i++)
+    {
+        lua_rawgeti(l, index, i);
+
+        /*
+         * A number is converted upon the stack, and the string it becomes
+         * is only kept alive by being stored back in the table.
+         */
+        if ((lua_type(l, -1) != LUA_TSTRING) && lua_isstring(l, -1))
+        {
+            lua_tostring(l, -1);
+            lua_pushvalue(l, -1);
+            lua_rawseti(l, index, i);
+        }
+
+        size_t len = 0;
+        const char *text = NULL;
+
+        if (lua_type(l, -1) == LUA_TSTRING)
+            text = lua_tolstring(l, -1, &len);
+
+        m_data.push_back(text ? text : "");
+        m_length.push_back(len);
+
+        lua_pop(l, 1);
+    }
+
+    lua_pushvalue(l, index);
+    m_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    m_lua = l;
+}
+
+
+/*
+ * Release our table.
+ */
+void CLuaRows::clear()
+{
+    if ((m_lua != NULL) && (m_ref != LUA_NOREF))
+        luaL_unref(m_lua, LUA_REGISTRYINDEX, m_ref);
+
+    m_lua = NULL;
+    m_ref = LUA_NOREF;
+    m_data.clear();
+    m_length.clear();
+}
+
+
+/*
+ * The number of rows we hold.
+ */
+size_t CLuaRows::size() const
+{
+    return (m_data.size());
+}
+
+
+/*
+ * Do we have no rows?
+ */
+bool CLuaRows::empty() const
+{
+    return (m_data.empty());
+}
+
+
+/*
+ * The text of the given row.
+ */
+const char *CLuaRows::data(size_t row) const
+{
+    return (m_data.at(row));
+}
+
+
+/*
+ * The length of the given row.
+ */
+size_t CLuaRows::length(size_t row) const
+{
+    return (m_length.at(row));
+}
@@ -0,0 +1,105 @@
+/*
+ * lua_rows.h - Rows of text borrowed from a Lua table.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+extern "C"
+{
+#include <lua.h>
+}
+
+#include <stddef.h>
+#include <vector>
+
+
+/**
+ * The rows of text returned by a view-function, which are drawn straight
+ * from the strings Lua holds rather than being copied.
+ *
+ * The table holding the rows is referenced from the Lua registry, so
+ * that neither it, nor its strings, may be collected while we point into
+ * them.  The rows remain valid until they are cleared, or borrowed again,
+ * and the table shouldn't be modified by Lua in the meantime.
+ */
+class CLuaRows
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CLuaRows();
+
+    /**
+     * Destructor - release our table.
+     */
+    ~CLuaRows();
+
+    /**
+     * Borrow the rows of the table at the given stack-index.
+     *
+     * Entries which aren't strings are converted to them, in the table,
+     * and those which can't be are empty.
+     */
+    void borrow(lua_State *l, int index);
+
+    /**
+     * Release our table, and forget its rows.
+     */
+    void clear();
+
+    /**
+     * The number of rows we hold.
+     */
+    size_t size() const;
+
+    /**
+     * Do we have no rows?
+     */
+    bool empty() const;
+
+    /**
+     * The text of the given row, which isn't terminated, and its length.
+     */
+    const char *data(size_t row) const;
+    size_t length(size_t row) const;
+
+private:
+
+    /**
+     * We can't be copied, as only one of us may release our table.
+     */
+    CLuaRows(const CLuaRows &);
+    CLuaRows &operator=(const CLuaRows &);
+
+private:
+
+    /**
+     * The interpreter holding our table, and our reference to it.
+     */
+    lua_State *m_lua;
+    int m_ref;
+
+    /**
+     * The text, and length, of each row.
+     */
+    std::vector < const char * > m_data;
+    std::vector < size_t > m_length;
+};
@@ -177,6 +177,48 @@ void TestFunctionToTableArgs(CuTest * tc)
 }
 
 
+/**
+ * Test the rows of a view-function are borrowed from Lua.
+ */
+void TestFunctionToWindow(CuTest * tc)
+{
+    CLua *instance = CLua::instance();
+    CuAssertPtrNotNull(tc, instance);
+
+    /*
+     * A windowed view of 100 rows, and one which returns every row.
+     */
+    instance->execute("windowed_views = { get_window = true } "
+                      "function get_window(o, c) t = {} for i = 1, c do t[i] = 'row ' .. (o + i) end return t, 100 end "
+                      "function get_rows() return { 'one', 2, 'three' } end ");
+
+    CLuaRows rows;
+    int max = 0;
+
+    CuAssertTrue(tc, instance->function2window("get_window", 10, 3, rows, max));
+    CuAssertIntEquals(tc, 100, max);
+    CuAssertIntEquals(tc, 3, rows.size());
+    CuAssertStrEquals(tc, "row 11", std::string(rows.data(0), rows.length(0)).c_str());
+    CuAssertStrEquals(tc, "row 13", std::string(rows.data(2), rows.length(2)).c_str());
+
+    /*
+     * Numbers are converted, and the rows survive a collection.
+     */
+    CuAssertTrue(tc, ! instance->function2window("get_rows", 0, 0, rows, max));
+    CuAssertIntEquals(tc, 3, max);
+
+    instance->execute("collectgarbage()");
+
+    CuAssertIntEquals(tc, 3, rows.size());
+    CuAssertStrEquals(tc, "one", std::string(rows.data(0), rows.length(0)).c_str());
+    CuAssertStrEquals(tc, "2", std::string(rows.data(1), rows.length(1)).c_str());
+    CuAssertStrEquals(tc, "three", std::string(rows.data(2), rows.length(2)).c_str());
+
+    rows.clear();
+    CuAssertTrue(tc, rows.empty());
+}
+
+
 /**
  * Test function detection works.
  */
@@ -249,6 +291,45 @@ void TestStringFunction(CuTest * tc)
 }
 
 
+/**
+ * Test key-bindings, and prefixes, as the keymap changes.
+ */
+void TestKeymap(CuTest * tc)
+{
+    CLua *instance = CLua::instance();
+
+    instance->execute("keymap = { global = { q = 'quit()', ['^A^B'] = 'ab()' }, index = {} }");
+
+    CuAssertStrEquals(tc, "quit()", instance->keybinding("global", "q").c_str());
+    CuAssertStrEquals(tc, "", instance->keybinding("index", "q").c_str());
+    CuAssertStrEquals(tc, "", instance->keybinding("missing", "q").c_str());
+
+    CuAssertTrue(tc, instance->is_prefixed_key("global", "^A"));
+    CuAssertTrue(tc, ! instance->is_prefixed_key("global", "^A^B"));
+    CuAssertTrue(tc, ! instance->is_prefixed_key("index", "^A"));
+
+    /*
+     * Bindings which are added, removed, or replaced, are all seen.
+     */
+    instance->execute("keymap.index['.a'] = 'all()'");
+    CuAssertTrue(tc, instance->is_prefixed_key("index", "."));
+
+    instance->execute("keymap.global['^A^B'] = nil");
+    CuAssertTrue(tc, ! instance->is_prefixed_key("global", "^A"));
+
+    instance->execute("keymap.global = { ['^X^C'] = 'exit()' }");
+    CuAssertTrue(tc, instance->is_prefixed_key("global", "^X"));
+    CuAssertStrEquals(tc, "exit()", instance->keybinding("global", "^X^C").c_str());
+
+    /*
+     * A replacement `lookup_key` is called.
+     */
+    instance->execute("native_lookup = lookup_key; lookup_key = function(m, k) return m .. k end");
+    CuAssertStrEquals(tc, "globalq", instance->keybinding("global", "q").c_str());
+    instance->execute("lookup_key = native_lookup; keymap = nil");
+}
+
+
 CuSuite *
 lua_getsuite()
 {
@@ -257,7 +338,9 @@ lua_getsuite()
     SUITE_ADD_TEST(suite, TestErrorHandler);
     SUITE_ADD_TEST(suite, TestFunctionToTable);
     SUITE_ADD_TEST(suite, TestFunctionToTableArgs);
+    SUITE_ADD_TEST(suite, TestFunctionToWindow);
     SUITE_ADD_TEST(suite, TestFunctionExists);
     SUITE_ADD_TEST(suite, TestStringFunction);
+    SUITE_ADD_TEST(suite, TestKeymap);
     return suite;
 }
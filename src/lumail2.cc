@@ -20,22 +20,37 @@
 #include <iostream>
 #include <gmime/gmime.h>
 #include <getopt.h>
+#include <sysexits.h>
 
+#include "bytecode_cache.h"
 #include "config.h"
+#include "durability.h"
 #include "file.h"
+#include "frame_stats.h"
 #include "global_state.h"
 #include "history.h"
+#include "host_identity.h"
+#include "imap_cache.h"
 #include "imap_proxy.h"
 #include "input_queue.h"
+#include "job_queue.h"
 #include "logger.h"
 #include "lua.h"
 #include "maildir.h"
 #include "message.h"
+#include "message_format.h"
 #include "message_part.h"
+#include "message_threader.h"
 #include "mime.h"
+#include "part_cache.h"
+#include "regexp.h"
 #include "screen.h"
+#include "search_index.h"
+#include "sort_order.h"
+#include "startup_timings.h"
 #include "statuspanel.h"
 #include "tests.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 /*
@@ -49,15 +64,51 @@ void run_all_tests()
     CuString *output = CuStringNew();
     CuSuite *suite = CuSuiteNew();
 
+    CuSuiteAddSuite(suite, approxidate_getsuite());
+    CuSuiteAddSuite(suite, bytecode_cache_getsuite());
+    CuSuiteAddSuite(suite, cache_getsuite());
     CuSuiteAddSuite(suite, coloured_string_getsuite());
+    CuSuiteAddSuite(suite, compression_getsuite());
     CuSuiteAddSuite(suite, config_getsuite());
     CuSuiteAddSuite(suite, directory_getsuite());
+    CuSuiteAddSuite(suite, durability_getsuite());
     CuSuiteAddSuite(suite, file_getsuite());
+    CuSuiteAddSuite(suite, format_template_getsuite());
+    CuSuiteAddSuite(suite, frame_stats_getsuite());
+    CuSuiteAddSuite(suite, fuzzy_matcher_getsuite());
     CuSuiteAddSuite(suite, history_getsuite());
+    CuSuiteAddSuite(suite, host_identity_getsuite());
+    CuSuiteAddSuite(suite, imap_cache_getsuite());
+    CuSuiteAddSuite(suite, imap_sync_getsuite());
+    CuSuiteAddSuite(suite, intern_getsuite());
+    CuSuiteAddSuite(suite, job_queue_getsuite());
+    CuSuiteAddSuite(suite, json_stream_getsuite());
     CuSuiteAddSuite(suite, input_queue_getsuite());
+    CuSuiteAddSuite(suite, key_trie_getsuite());
+    CuSuiteAddSuite(suite, logfile_getsuite());
     CuSuiteAddSuite(suite, lua_getsuite());
+    CuSuiteAddSuite(suite, maildir_grep_getsuite());
+    CuSuiteAddSuite(suite, maildir_summary_getsuite());
+    CuSuiteAddSuite(suite, mbox_getsuite());
+    CuSuiteAddSuite(suite, message_getsuite());
+    CuSuiteAddSuite(suite, message_arena_getsuite());
+    CuSuiteAddSuite(suite, message_columns_getsuite());
+    CuSuiteAddSuite(suite, message_id_index_getsuite());
+    CuSuiteAddSuite(suite, message_replace_getsuite());
+    CuSuiteAddSuite(suite, message_selection_getsuite());
+    CuSuiteAddSuite(suite, message_threader_getsuite());
+    CuSuiteAddSuite(suite, mime_getsuite());
+    CuSuiteAddSuite(suite, profiler_getsuite());
+    CuSuiteAddSuite(suite, regexp_getsuite());
+    CuSuiteAddSuite(suite, search_index_getsuite());
+    CuSuiteAddSuite(suite, sort_order_getsuite());
+    CuSuiteAddSuite(suite, startup_timings_getsuite());
     CuSuiteAddSuite(suite, statuspanel_getsuite());
+    CuSuiteAddSuite(suite, syscalls_getsuite());
+    CuSuiteAddSuite(suite, text_lines_getsuite());
+    CuSuiteAddSuite(suite, timer_wheel_getsuite());
     CuSuiteAddSuite(suite, util_getsuite());
+    CuSuiteAddSuite(suite, virtual_folder_getsuite());
 
     CuSuiteRun(suite);
     CuSuiteSummary(suite, output);
@@ -70,10 +121,24 @@ void run_all_tests()
  */
 int main(int argc, char *argv[])
 {
+    /*
+     * Our startup-timings are measured from here.
+     */
+    CStartupTimings *timings = CStartupTimings::instance();
+
+    /*
+     * Start looking up our hostname, which Message-IDs need, so that it
+     * is found while we do everything else.
+     */
+    CHostIdentity::instance();
+
     /*
      * Initiate mime.
      */
-    g_mime_init(GMIME_ENABLE_RFC2047_WORKAROUNDS);
+    {
+        CStartupTimer timer("gmime init");
+        g_mime_init(GMIME_ENABLE_RFC2047_WORKAROUNDS);
+    }
 
     /*
      * Parse command-line arguments
@@ -84,14 +149,23 @@ int main(int argc, char *argv[])
      * Flags/things set by the command-line arguments.
      */
     std::vector < std::string > load;
+    std::string batch;
     bool curses = true;
+    bool report = false;
+    int status = 0;
 
 
     /*
      * The default load-path is set at compile-time, here we
      * ensure that it is used.
      */
-    CLua *instance        = CLua::instance();
+    CLua *instance = NULL;
+
+    {
+        CStartupTimer timer("lua construction");
+        instance = CLua::instance();
+    }
+
     std::string load_path = LUMAIL_LUAPATH;
     instance->append_to_package_path(load_path  + "/?.lua");
     load_path = "";
@@ -120,11 +194,13 @@ int main(int argc, char *argv[])
 
         static struct option long_options[] =
         {
+            {"batch", required_argument, 0, 'b'},
             {"no-curses", no_argument, 0, 'c'},
             {"no-defaults", no_argument, 0, 'd'},
             {"load-file", required_argument, 0, 'l'},
             {"load-path", required_argument, 0, 'p'},
             {"test", no_argument, 0, 't'},
+            {"timings", no_argument, 0, 'T'},
             {"version", no_argument, 0, 'v'},
             {0, 0, 0, 0}
         };
@@ -132,7 +208,7 @@ int main(int argc, char *argv[])
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "l:p:cdtv", long_options, &option_index);
+        c = getopt_long(argc, argv, "b:l:p:cdtTv", long_options, &option_index);
 
         /* Detect the end of the options. */
         if (c == -1)
@@ -140,6 +216,11 @@ int main(int argc, char *argv[])
 
         switch (c)
         {
+        case 'b':
+            batch = optarg;
+            curses = false;
+            break;
+
         case 'c':
             curses = false;
             break;
@@ -161,6 +242,10 @@ int main(int argc, char *argv[])
             return 0;
             break;
 
+        case 'T':
+            report = true;
+            break;
+
         case 'v':
             std::cout << "Lumail2 " << LUMAIL_VERSION << std::endl;
             return 0;
@@ -189,7 +274,10 @@ int main(int argc, char *argv[])
     CScreen *screen = CScreen::instance();
 
     if (curses == true)
+    {
+        CStartupTimer timer("screen setup");
         screen->setup();
+    }
 
 
     /*
@@ -210,6 +298,13 @@ int main(int argc, char *argv[])
          */
         CConfig *config = CConfig::instance();
         config->set("global.launched", time(NULL));
+
+        /*
+         * Let the configuration files know that there's no screen, and
+         * that they're setting up for a script.
+         */
+        if (! batch.empty())
+            config->set("global.batch", 1);
     }
 
     /*
@@ -221,7 +316,10 @@ int main(int argc, char *argv[])
         for (std::string filename : load)
         {
             if (CFile::exists(filename))
+            {
+                CStartupTimer timer("load_file " + filename);
                 instance->load_file(filename);
+            }
             else
             {
                 screen->teardown();
@@ -231,6 +329,30 @@ int main(int argc, char *argv[])
         }
     }
 
+    /*
+     * Run the batch-script, if we were given one, without any screen.
+     *
+     * Messages are then read in full before any are returned, rather
+     * than in the background.
+     */
+    if (! batch.empty())
+    {
+        std::string error;
+
+        CConfig::instance()->set("index.async", 0);
+
+        if (! CFile::exists(batch))
+        {
+            std::cerr << "File doesn't exist: " << batch << std::endl;
+            status = EX_NOINPUT;
+        }
+        else if (! instance->run_file(batch, status, error))
+        {
+            std::cerr << "ERROR " << error << std::endl;
+            status = EX_SOFTWARE;
+        }
+    }
+
     /*
      * Run the event-loop and terminate once that finishes.
      */
@@ -242,9 +364,25 @@ int main(int argc, char *argv[])
 
 
     /*
-     * Cleanup: Delete the config-values.
+     * Show how long our startup took, if we've been asked to.
      */
     CConfig *config = CConfig::instance();
+
+    if (report || (config->get_integer("startup.report", 0) != 0))
+        std::cerr << timings->report();
+
+    /*
+     * Cleanup: Stop our workers, as their jobs might use any of our
+     * singletons, then free our messages.  That writes the index of the
+     * open folder, so must be done while the config-values which say
+     * where it belongs remain.
+     */
+    CJobQueue::destroy_instance();
+    CGlobalState::instance()->destroy_instance();
+
+    /*
+     * Cleanup: Delete the config-values.
+     */
     config->remove_all();
 
     /*
@@ -258,16 +396,28 @@ int main(int argc, char *argv[])
      * to explicitly free memory and make leak-detection
      * simpler.
      */
+    CSortOrder::destroy_instance();
+    CDurability::destroy_instance();
+    CMessageFormat::destroy_instance();
     config->destroy_instance();
     proxy->destroy_instance();
 
     CHistory::instance()->destroy_instance();
-    CGlobalState::instance()->destroy_instance();
     CInputQueue::instance()->destroy_instance();
     CStatusPanel::instance()->destroy_instance();
     CScreen::instance()->destroy_instance();
     CMime::instance()->destroy_instance();
+    CMessageThreader::instance()->destroy_instance();
     CLua::instance()->destroy_instance();
+    CPartCache::instance()->destroy_instance();
+    CIMAPCache::destroy_instance();
+    CSearchIndex::destroy_instance();
+    CRegexpCache::destroy_instance();
+    CTimerWheel::destroy_instance();
+    CFrameStats::destroy_instance();
+    CBytecodeCache::destroy_instance();
+    CStartupTimings::destroy_instance();
+    CHostIdentity::destroy_instance();
     CLogger::instance()->destroy_instance();
 
     /*
@@ -275,5 +425,5 @@ int main(int argc, char *argv[])
      */
     g_mime_shutdown();
 
-    return 0;
+    return (status);
 }
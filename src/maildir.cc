@@ -27,6 +27,7 @@
 #include <string.h>
 #include <string>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <unordered_map>
@@ -36,12 +37,22 @@
 #include <gmime/gmime.h>
 
 
+#include "compression.h"
+#include "config.h"
 #include "directory.h"
+#include "durability.h"
 #include "file.h"
+#include "global_state.h"
+#include "host_identity.h"
 #include "imap_proxy.h"
+#include "logger.h"
 #include "maildir.h"
+#include "mbox.h"
 #include "message.h"
+#include "message_arena.h"
+#include "syscalls.h"
 #include "util.h"
+#include "virtual_folder.h"
 
 
 /*
@@ -56,10 +67,30 @@ CMaildir::CMaildir(const std::string name, bool is_local)
     else
         m_imap = true;
 
+    m_mbox = is_local && CMbox::is_mbox(name);
+
     /*
      * Default cache-time.
      */
     m_modified = -1;
+    m_unread   = 0;
+    m_total    = 0;
+}
+
+
+/*
+ * Constructor.  Create an object to encapsulate a virtual folder,
+ * which is named after it.
+ */
+CMaildir::CMaildir(std::shared_ptr<CVirtualFolder> folder)
+{
+    m_path     = folder->name();
+    m_imap     = false;
+    m_mbox     = false;
+    m_virtual  = folder;
+    m_modified = -1;
+    m_unread   = 0;
+    m_total    = 0;
 }
 
 
@@ -88,7 +119,7 @@ CMaildir::~CMaildir()
  */
 bool CMaildir::is_maildir()
 {
-    return (! m_imap);
+    return ((! m_imap) && (! m_virtual));
 }
 
 
@@ -102,6 +133,33 @@ bool CMaildir::is_imap()
 }
 
 
+/*
+ * Is this a virtual folder?
+ */
+bool CMaildir::is_virtual()
+{
+    return (m_virtual != NULL);
+}
+
+
+/*
+ * Is this an mbox-file?
+ */
+bool CMaildir::is_mbox()
+{
+    return (m_mbox);
+}
+
+
+/*
+ * Get the virtual folder we represent, if any.
+ */
+std::shared_ptr<CVirtualFolder> CMaildir::virtual_folder()
+{
+    return (m_virtual);
+}
+
+
 /*
  * The number of new messages for this maildir.
  */
@@ -131,6 +189,14 @@ void CMaildir::update_cache()
     if (m_imap)
         return;
 
+    if (m_virtual)
+    {
+        m_virtual->refresh();
+        m_total  = m_virtual->total_messages();
+        m_unread = m_virtual->unread_messages();
+        return;
+    }
+
     /*
      * If the cached date isn't different then we need do nothing.
      */
@@ -145,22 +211,109 @@ void CMaildir::update_cache()
     m_modified = last_mod;
 
     /*
-     * Get all messages, and update the total
+     * Count the messages in each directory, without creating objects
+     * for them.
      */
-    CMessageList all = getMessages();
-    m_total = all.size();
+    count(m_path, m_total, m_unread);
+}
+
+
+/*
+ * Set our cached counts.
+ */
+void CMaildir::set_counts(time_t modified, int total, int unread)
+{
+    if (m_imap || m_virtual)
+        return;
 
+    m_modified = modified;
+    m_total    = total;
+    m_unread   = unread;
+}
 
+
+/*
+ * Count the messages in the maildir at the given path.
+ */
+void CMaildir::count(const std::string &path, int &total, int &unread)
+{
+    total  = 0;
+    unread = 0;
+
+    struct stat sb;
+
+    if ((CSyscalls::stat(path.c_str(), &sb) == 0) && S_ISREG(sb.st_mode))
+    {
+        CMbox::count(path, total, unread);
+        return;
+    }
+
+    count_messages(path + "/cur/", false, total, unread);
+    count_messages(path + "/new/", true, total, unread);
+}
+
+
+/*
+ * Count the messages in the given directory, adding them to the given
+ * total/unread values.
+ *
+ * Each message is considered new if it lives in `new/`, or if the
+ * flags encoded in its name - following the ":2," marker - include
+ * "N" or lack "S".  This matches `CMessage::is_new()`.
+ */
+void CMaildir::count_messages(std::string path, bool is_new, int &total, int &unread)
+{
     /*
-      * Now update the unread count.
-      */
-    m_unread = 0;
+     * Mirror the "/new/" test made by `CMessage::get_flags()`.
+     */
+    if (path.find("/new/") != std::string::npos)
+        is_new = true;
+
+    DIR *dp = CSyscalls::opendir(path.c_str());
+
+    if (dp == NULL)
+        return;
 
-    for (std::shared_ptr < CMessage > message : all)
+    dirent *de;
+
+    while ((de = readdir(dp)) != NULL)
     {
-        if (message->is_new())
-            m_unread++;
+        const char *name = de->d_name;
+
+        if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+            continue;
+
+        /*
+         * Directories aren't messages, we only need to stat entries
+         * when the filesystem doesn't tell us their type.
+         */
+        if (de->d_type == DT_DIR)
+            continue;
+
+        if (de->d_type == DT_UNKNOWN)
+        {
+            struct stat sb;
+
+            if ((CSyscalls::fstatat(dirfd(dp), name, &sb, 0) == 0) && S_ISDIR(sb.st_mode))
+                continue;
+        }
+
+        total++;
+
+        if (is_new)
+        {
+            unread++;
+            continue;
+        }
+
+        const char *flags = strstr(name, ":2,");
+
+        if ((flags == NULL) || (strchr(flags + 3, 'N') != NULL) ||
+                (strchr(flags + 3, 'S') == NULL))
+            unread++;
     }
+
+    closedir(dp);
 }
 
 /*
@@ -174,10 +327,32 @@ time_t CMaildir::last_modified()
         return (m_modified);
     }
 
+    /*
+     * A virtual folder changes when its messages do.
+     */
+    if (m_virtual)
+    {
+        m_virtual->refresh();
+        return ((time_t) m_virtual->generation());
+    }
+
+    return (modified(m_path));
+}
+
+
+/*
+ * Return the last modified time of the maildir at the given path.
+ */
+time_t CMaildir::modified(const std::string &p)
+{
     time_t last = 0;
     struct stat st_buf;
 
-    std::string p = path();
+    /*
+     * An mbox is a single file.
+     */
+    if ((CSyscalls::stat(p.c_str(), &st_buf) == 0) && S_ISREG(st_buf.st_mode))
+        return (st_buf.st_mtime);
 
     /*
      * The two directories we care about: new/ + cur/
@@ -195,7 +370,7 @@ time_t CMaildir::last_modified()
          * If we can stat() the dir and it is more recent
          * than the current value - update it.
          */
-        if (!stat(dir.c_str(), &st_buf))
+        if (!CSyscalls::stat(dir.c_str(), &st_buf))
             if (st_buf.st_mtime > last)
                 last = st_buf.st_mtime;
     }
@@ -215,8 +390,35 @@ time_t CMaildir::last_modified()
  */
 CMessageList CMaildir::getMessages()
 {
+    CTraceSpan span("CMaildir::getMessages ", m_path);
+
+    if (m_virtual)
+    {
+        m_virtual->refresh();
+        return (m_virtual->messages());
+    }
+
     CMessageList result;
 
+    /*
+     * Our messages are held together, rather than each allocated alone.
+     */
+    std::shared_ptr<CMessageArena> arena = CMessageArena::folder(m_path);
+
+    /*
+     * The messages of an mbox are named after their offsets within it.
+     */
+    if (m_mbox)
+    {
+        std::vector<std::string> paths = CMbox::messages(m_path);
+        result.reserve(paths.size());
+
+        for (const std::string &file : paths)
+            result.push_back(arena->message(file));
+
+        return (result);
+    }
+
     /*
      * Directories we search.
      */
@@ -225,30 +427,44 @@ CMessageList CMaildir::getMessages()
     dirs.push_back(m_path + "/new/");
 
     /*
-     * For each directory.
+     * Our listing is reused for both directories, and sized by the
+     * last count we made of this folder.
      */
+    std::vector<CDirectoryEntry> entries;
+
     for (std::string path : dirs)
     {
-
         /*
-         * Get the entries in the directory
+         * Remove duplicate "/" characters, so our paths match those
+         * which `CDirectory::entries` would have returned.
          */
-        std::vector<std::string> entries = CDirectory::entries(path);
+        path.erase(std::unique(path.begin(), path.end(), both_slashes()), path.end());
+
+        entries.clear();
+
+        if (! CDirectory::list(path, entries, m_total > 0 ? m_total : 0))
+            continue;
+
+        result.reserve(result.size() + entries.size());
 
         /*
-         * For each one - if it isn't a dirrectory create a message
-         * using the path.
-         *
-         * This test is required because `CDirectory::entries` will return
-         * both the prefix, and the children "." + "..".
+         * For each entry which isn't a directory create a message
+         * using the path - we only need to stat the entry if the
+         * filesystem didn't tell us what type it was.
          */
-        for (std::string file : entries)
+        for (CDirectoryEntry entry : entries)
         {
-            if (! CFile::is_directory(file))
-            {
-                std::shared_ptr < CMessage > t = std::shared_ptr < CMessage > (new CMessage(std::string(file)));
-                result.push_back(t);
-            }
+            std::string file = path + entry.name;
+
+            if (entry.is_directory())
+                continue;
+
+            if (entry.is_unknown() && CFile::is_directory(file))
+                continue;
+
+            std::shared_ptr < CMessage > t = arena->message(file);
+            t->set_inode(entry.inode);
+            result.push_back(t);
         }
     }
 
@@ -256,14 +472,109 @@ CMessageList CMaildir::getMessages()
 }
 
 
+/*
+ * Should messages saved into the maildir with the given path be
+ * compressed?  That is so for those listed in `maildir.compress`.
+ */
+static bool compresses(std::string path)
+{
+    while ((path.size() > 1) && (path.back() == '/'))
+        path.pop_back();
+
+    std::vector<std::string> archives = CConfig::instance()->get_array("maildir.compress");
+
+    for (std::string archive : archives)
+    {
+        archive = CFile::expand_path(archive);
+
+        while ((archive.size() > 1) && (archive.back() == '/'))
+            archive.pop_back();
+
+        if (archive == path)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Copy a message into the maildir with the given path, compressing it
+ * if we should and it isn't already.
+ *
+ * A compressed copy is written beneath `tmp/`, and renamed into place,
+ * so that it is never seen half-written.
+ */
+static bool copy_message(const std::string &maildir, const std::string &src,
+                         const std::string &dst, bool compress)
+{
+    std::string tmp = maildir + "/tmp/" + CFile::basename(dst);
+
+    /*
+     * A message within an mbox is extracted from it, beneath `tmp/`,
+     * and compressed from there if need be.
+     */
+    if (CMbox::is_message(src))
+    {
+        if (! CMbox::extract(src, tmp))
+            return false;
+
+        if (compress)
+        {
+            int level = CConfig::instance()->get_integer("maildir.compress_level", COMPRESSION_LEVEL);
+            bool ok = CCompression::compress(tmp, tmp + ".gz", level);
+
+            CFile::delete_file(tmp);
+
+            if (! ok)
+                return false;
+
+            tmp += ".gz";
+        }
+    }
+    else if (! compress || CCompression::is_compressed(src))
+    {
+        if (! CFile::copy(src, dst))
+            return false;
+
+        tmp = "";
+    }
+    else
+    {
+        int level = CConfig::instance()->get_integer("maildir.compress_level", COMPRESSION_LEVEL);
+
+        if (! CCompression::compress(src, tmp, level))
+            return false;
+    }
+
+    if ((! tmp.empty()) && (CSyscalls::rename(tmp.c_str(), dst.c_str()) != 0))
+    {
+        CFile::delete_file(tmp);
+        return false;
+    }
+
+    CDurability *durability = CDurability::instance();
+    durability->written(dst);
+    durability->changed(dst.substr(0, dst.rfind('/')));
+    return true;
+}
+
+
 /*
  * Save the given message in this maildir.
  *
  * If this message is stored on a remote IMAP-server we handle
  * that specially.
  */
-bool CMaildir::saveMessage(std::shared_ptr <CMessage > msg)
+bool CMaildir::saveMessage(std::shared_ptr <CMessage > msg, bool move)
 {
+    /*
+     * Virtual folders hold no messages of their own, and mbox-files
+     * are read-only.
+     */
+    if (m_virtual || m_mbox)
+        return false;
+
     /*
      * If we were created by IMAP then our folder will have
      * the m_imap flag set.
@@ -300,16 +611,194 @@ bool CMaildir::saveMessage(std::shared_ptr <CMessage > msg)
         CIMAPProxy *proxy = CIMAPProxy::instance();
         std::string out  = proxy->read_imap_output(cmd);
 
+        /*
+         * If the message wasn't appended the original must be kept.
+         */
+        if (out.compare(0, strlen("saved message"), "saved message") != 0)
+            return false;
+
+        if (move)
+        {
+            CMessageList moved;
+            moved.push_back(msg);
+            CGlobalState::instance()->remove_messages(moved);
+        }
+
         return (true);
     }
     else
     {
         std::string path = generate_filename(false);
 
-        return (CFile::copy(msg->path(), path));
+        if (path.empty())
+            return false;
+
+        if (move && msg->is_maildir())
+        {
+            CMessageList messages;
+            messages.push_back(msg);
+
+            return (import(messages, true) == 1);
+        }
+
+        if (! copy_message(m_path, msg->path(), path, compresses(m_path)))
+            return false;
+
+        if (move)
+        {
+            CMessageList moved;
+            moved.push_back(msg);
+            CGlobalState::instance()->remove_messages(moved);
+        }
+
+        return true;
+    }
+}
+
+/*
+ * Save, or move, each of the given messages into this maildir.
+ */
+int CMaildir::import(CMessageList &messages, bool move)
+{
+    if (m_virtual || m_mbox)
+        return 0;
+
+    /*
+     * Remote folders are saved to one message at a time, via our proxy.
+     */
+    if ((m_imap) || ((m_path.empty() == false) && (m_path.at(0) != '/')) ||
+            (! CFile::is_maildir(m_path)))
+    {
+        int count = 0;
+
+        for (std::shared_ptr<CMessage> msg : messages)
+        {
+            if (saveMessage(msg, move))
+                count++;
+        }
+
+        return (count);
     }
+
+    int count = 0;
+
+    std::vector<maildir_change> changes;
+    std::vector<std::pair<std::shared_ptr<CMessage>, std::string> > moved;
+    CMessageList copied;
+
+    /*
+     * Each directory we change need reach the disk just once.
+     */
+    CDurableBatch batch;
+    CDurability *durability = CDurability::instance();
+
+    /*
+     * Messages moved into a maildir which compresses them are copied,
+     * unless they're compressed already, and the originals removed.
+     */
+    bool compress = compresses(m_path);
+
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        std::string src = msg->path();
+
+        /*
+         * Keep the message in `new/`, or `cur/` with its flags.
+         */
+        std::string dir  = src.substr(0, src.rfind('/'));
+        bool is_new      = (dir.size() >= 4) && (dir.compare(dir.size() - 4, 4, "/new") == 0);
+        size_t info      = src.rfind(":2,");
+        std::string dst  = unique_filename(is_new, (info == std::string::npos) ? ":2," : src.substr(info));
+
+        /*
+         * Messages within an mbox are copied out of it, but remain.
+         */
+        bool in_mbox = CMbox::is_message(src);
+
+        if (move && msg->is_maildir() && ! in_mbox &&
+                (! compress || CCompression::is_compressed(src)))
+        {
+            if (! CFile::move(src, dst))
+                continue;
+
+            maildir_change removed;
+            removed.added = false;
+            removed.path  = src;
+            changes.push_back(removed);
+
+            moved.push_back(std::make_pair(msg, dst));
+            durability->renamed(src, dst);
+        }
+        else
+        {
+            if (! copy_message(m_path, src, dst, compress))
+                continue;
+
+            if (move && ! in_mbox)
+                copied.push_back(msg);
+        }
+
+        maildir_change added;
+        added.added = true;
+        added.path  = dst;
+        changes.push_back(added);
+        count++;
+    }
+
+    /*
+     * Update the list of messages, before our moved messages are told
+     * where they are now, so that the list knows them by their old
+     * names.
+     */
+    CGlobalState *global = CGlobalState::instance();
+
+    if (! changes.empty())
+        global->messages_changed(changes);
+
+    /*
+     * Messages we copied, rather than renamed, are removed together.
+     */
+    if (! copied.empty())
+        global->remove_messages(copied);
+
+    for (auto &it : moved)
+        it.first->path(it.second);
+
+    return (count);
 }
 
+
+/*
+ * Generate a unique filename for a message being imported.
+ *
+ * Filename is: $time.M$usecP$pidQ$seq.$hostname$info.
+ */
+std::string CMaildir::unique_filename(bool is_new, const std::string &info)
+{
+    static uint64_t sequence = 0;
+    std::string hostname = CHostIdentity::instance()->short_name();
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    std::string file = std::to_string(tv.tv_sec);
+    file += ".M" + std::to_string(tv.tv_usec);
+    file += "P" + std::to_string(getpid());
+    file += "Q" + std::to_string(++sequence);
+    file += "." + hostname;
+
+    std::string dir = path();
+
+    while ((dir.size() > 1) && (dir[dir.size() - 1] == '/'))
+        dir.erase(dir.size() - 1);
+
+    if (is_new)
+        return (dir + "/new/" + file);
+
+    return (dir + "/cur/" + file + info);
+}
+
+
 /*
  * Generate a filename for saving a message into.
  */
@@ -335,9 +824,7 @@ std::string CMaildir::generate_filename(bool is_new)
     /*
      * Filename is: $time.xxx.$hostname.
      */
-    char host[1024] = {'\0'};
-    gethostname(host, sizeof(host) - 1);
-    std::string hostname(host);
+    std::string hostname = CHostIdentity::instance()->short_name();
 
     /*
      * Loop until we found a file that is unique.
@@ -26,6 +26,8 @@
 #include "message.h"
 
 
+class CVirtualFolder;
+
 
 
 /**
@@ -55,6 +57,13 @@ public:
     CMaildir(const std::string name, bool is_local = true);
 
 
+    /**
+     * Constructor for a virtual folder, whose messages are those of
+     * several local maildirs which match its query.
+     */
+    CMaildir(std::shared_ptr<CVirtualFolder> folder);
+
+
     /**
      * Destructor.
      */
@@ -82,6 +91,25 @@ public:
     bool is_imap();
 
 
+    /**
+     * Is this a virtual folder?
+     */
+    bool is_virtual();
+
+
+    /**
+     * Is this an mbox-file, rather than a maildir?  Such folders are
+     * read-only.
+     */
+    bool is_mbox();
+
+
+    /**
+     * Get the virtual folder we represent, if any.
+     */
+    std::shared_ptr<CVirtualFolder> virtual_folder();
+
+
     /**
      * Retrieve the number of new messages for this maildir.
      *
@@ -140,8 +168,23 @@ public:
      *
      * If this message is stored on a remote IMAP-server we handle
      * that specially.
+     *
+     * If `move` is true the message is removed from its current
+     * folder too, which between local maildirs upon the same
+     * filesystem is a single rename.  It is only removed once it has
+     * been saved, and false is returned if it couldn't be.
+     */
+    bool saveMessage(std::shared_ptr <CMessage > msg, bool move = false);
+
+    /**
+     * Save, or move, each of the given messages into this maildir,
+     * returning the number which were.
+     *
+     * Each message keeps its flags, and the directory it was in.  Moves
+     * between local maildirs are renames, and the list of messages is
+     * updated to reflect the changes made, rather than being rebuilt.
      */
-    bool saveMessage(std::shared_ptr <CMessage > msg);
+    int import(CMessageList &messages, bool move);
 
 
     /**
@@ -161,6 +204,36 @@ public:
      */
     time_t last_modified();
 
+
+    /**
+     * Set our cached counts, as of the given modification-time, which
+     * have been found elsewhere - for example upon a worker thread.
+     *
+     * **NOTE**: This is a NOP for IMAP, and virtual, folders.
+     */
+    void set_counts(time_t modified, int total, int unread);
+
+
+    /**
+     * Return the last modified time of the local maildir at the given
+     * path, which is the later of that of its `cur/` and `new/`
+     * directories.
+     *
+     * This touches nothing but the filesystem, so may be called from
+     * any thread.
+     */
+    static time_t modified(const std::string &path);
+
+
+    /**
+     * Count the messages, and the unread messages, in the local maildir
+     * at the given path, without creating objects for them.
+     *
+     * This touches nothing but the filesystem, so may be called from
+     * any thread.
+     */
+    static void count(const std::string &path, int &total, int &unread);
+
 private:
 
     /**
@@ -173,6 +246,16 @@ private:
      */
     bool m_imap;
 
+    /**
+     * Are we an mbox-file?
+     */
+    bool m_mbox;
+
+    /**
+     * The virtual folder we represent, if any.
+     */
+    std::shared_ptr<CVirtualFolder> m_virtual;
+
     /**
      * The date/time this maildir was last updated.  Used to maintain a
      * cache that can be expired/tested easily.
@@ -198,11 +281,25 @@ private:
      */
     void update_cache();
 
+    /**
+     * Count the messages in the given `cur/` or `new/` directory,
+     * adding them to the given total/unread counts.
+     */
+    static void count_messages(std::string path, bool is_new, int &total, int &unread);
+
     /**
      * Generate a filename for saving a message into.
      */
     std::string generate_filename(bool is_new);
 
+    /**
+     * Generate the name of a new file beneath our `cur/` or `new/`
+     * directory, for a message with the given maildir-info.
+     *
+     * Names are unique to this process, so nothing need be tested.
+     */
+    std::string unique_filename(bool is_new, const std::string &info);
+
 };
 
 
@@ -0,0 +1,333 @@
+/*
+ * maildir_grep.cc - Search the bodies of messages across worker threads.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <chrono>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <gmime/gmime.h>
+#include <pcrecpp.h>
+
+#include "maildir_grep.h"
+#include "message.h"
+#include "message_part.h"
+
+
+/*
+ * State shared with `match_part`, as it visits each MIME-part.
+ */
+struct grep_state
+{
+    const pcrecpp::RE *re;
+    bool matched;
+};
+
+
+/*
+ * Test the decoded content of a single MIME-part, if it is textual and
+ * not an attachment.
+ */
+static void match_part(GMimeObject *parent, GMimeObject *part, gpointer data)
+{
+    (void)parent;
+
+    grep_state *state = (grep_state *)data;
+
+    if (state->matched || ! GMIME_IS_PART(part))
+        return;
+
+    GMimeContentType *ct = g_mime_object_get_content_type(part);
+
+    if (! g_mime_content_type_is_type(ct, "text", "*"))
+        return;
+
+    /*
+     * Parts with a filename are attachments, as `CMessage::build_part`
+     * considers them.
+     */
+    const char *name = g_mime_object_get_content_disposition_parameter(part, "filename");
+
+    if (name == NULL)
+        name = g_mime_object_get_content_type_parameter(part, "name");
+
+    if (name != NULL)
+        return;
+
+    GMimeDataWrapper *content = g_mime_part_get_content_object(GMIME_PART(part));
+
+    if (content == NULL)
+        return;
+
+    GMimeStream *mem = g_mime_stream_mem_new();
+    g_mime_data_wrapper_write_to_stream(content, mem);
+
+    GByteArray *bytes = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(mem));
+
+    char *text = (char *)bytes->data;
+    size_t len = bytes->len;
+
+    /*
+     * Convert the content to UTF-8, if it is in some other character-set,
+     * so that patterns written in UTF-8 match it.
+     */
+    const char *charset = g_mime_content_type_get_parameter(ct, "charset");
+    bool converted = ((charset != NULL) &&
+                      (strcasecmp(charset, "utf-8") != 0) &&
+                      (strcasecmp(charset, "us-ascii") != 0) &&
+                      CMessagePart::to_utf8(charset, &text, &len));
+
+    state->matched = state->re->PartialMatch(pcrecpp::StringPiece(text, len));
+
+    if (converted)
+        free(text);
+
+    g_object_unref(mem);
+}
+
+
+/*
+ * Constructor.
+ */
+CMaildirGrep::CMaildirGrep(std::string pattern, bool caseless, bool headers, unsigned int threads)
+{
+    m_pattern  = pattern;
+    m_caseless = caseless;
+    m_headers  = headers;
+
+    if (threads < 1)
+        threads = std::thread::hardware_concurrency();
+
+    if (threads < 1)
+        threads = 1;
+
+    if (threads > GREP_MAX_THREADS)
+        threads = GREP_MAX_THREADS;
+
+    m_threads  = threads;
+    m_next     = 0;
+    m_searched = 0;
+    m_running  = 0;
+    m_cancel   = false;
+}
+
+
+/*
+ * Destructor - cancels any search in progress.
+ */
+CMaildirGrep::~CMaildirGrep()
+{
+    cancel();
+}
+
+
+/*
+ * Is our pattern valid?
+ */
+bool CMaildirGrep::valid(std::string &error)
+{
+    pcrecpp::RE_Options opt;
+    opt.set_caseless(m_caseless);
+    pcrecpp::RE re(m_pattern, opt);
+
+    error = re.error();
+    return (error.empty());
+}
+
+
+/*
+ * Start searching the given files.
+ */
+void CMaildirGrep::start(const std::vector < std::string > &files)
+{
+    cancel();
+
+    m_files    = files;
+    m_next     = 0;
+    m_searched = 0;
+    m_cancel   = false;
+    m_found.clear();
+
+    unsigned int threads = m_threads;
+
+    if (threads > m_files.size())
+        threads = m_files.size();
+
+    m_running = threads;
+
+    for (unsigned int i = 0; i < threads; i++)
+        m_workers.push_back(std::thread(&CMaildirGrep::worker, this));
+}
+
+
+/*
+ * Stop the search, and wait for the workers to exit.
+ */
+void CMaildirGrep::cancel()
+{
+    m_cancel = true;
+    join();
+}
+
+
+/*
+ * Wait for all workers to exit.
+ */
+void CMaildirGrep::join()
+{
+    for (std::thread &worker : m_workers)
+        worker.join();
+
+    m_workers.clear();
+}
+
+
+/*
+ * Wait for further matches, returning false once the search has finished
+ * and they've all been collected.
+ */
+bool CMaildirGrep::poll(std::vector < size_t > &found, int timeout)
+{
+    std::unique_lock < std::mutex > lock(m_lock);
+
+    m_cond.wait_for(lock, std::chrono::milliseconds(timeout), [this]
+    {
+        return ((! m_found.empty()) || (m_running == 0));
+    });
+
+    found.insert(found.end(), m_found.begin(), m_found.end());
+    m_found.clear();
+
+    if (m_running > 0)
+        return true;
+
+    lock.unlock();
+    join();
+    return false;
+}
+
+
+/*
+ * The number of files searched so far.
+ */
+size_t CMaildirGrep::searched()
+{
+    return (m_searched);
+}
+
+
+/*
+ * The number of files to be searched.
+ */
+size_t CMaildirGrep::total()
+{
+    return (m_files.size());
+}
+
+
+/*
+ * Test whether a single file matches.
+ */
+bool CMaildirGrep::match_file(const std::string &file)
+{
+    pcrecpp::RE_Options opt;
+    opt.set_caseless(m_caseless);
+    pcrecpp::RE re(m_pattern, opt);
+
+    return (search_file(file, re));
+}
+
+
+/*
+ * The body of each worker thread.
+ *
+ * Every worker compiles its own copy of the pattern, and claims files
+ * one at a time, so a few large messages can't leave the others idle.
+ */
+void CMaildirGrep::worker()
+{
+    pcrecpp::RE_Options opt;
+    opt.set_caseless(m_caseless);
+    pcrecpp::RE re(m_pattern, opt);
+
+    while (! m_cancel)
+    {
+        size_t i = m_next++;
+
+        if (i >= m_files.size())
+            break;
+
+        if (search_file(m_files[i], re))
+        {
+            std::lock_guard < std::mutex > lock(m_lock);
+            m_found.push_back(i);
+            m_cond.notify_all();
+        }
+
+        m_searched++;
+    }
+
+    std::lock_guard < std::mutex > lock(m_lock);
+    m_running--;
+    m_cond.notify_all();
+}
+
+
+/*
+ * Test whether a single file matches the given expression.
+ */
+bool CMaildirGrep::search_file(const std::string &file, const pcrecpp::RE &re)
+{
+    /*
+     * Messages are parsed as `CMessage` parses them, whether they're
+     * compressed, or within an mbox.
+     */
+    bool lazy = false;
+    std::string error;
+    GMimeMessage *message = CMessage::parse_file(file, false, &lazy, error);
+
+    if (message == NULL)
+        return false;
+
+    grep_state state;
+    state.re = &re;
+    state.matched = false;
+
+    if (m_headers)
+    {
+        char *raw = g_mime_object_get_headers(GMIME_OBJECT(message));
+
+        if (raw != NULL)
+        {
+            char *decoded = g_mime_utils_header_decode_text(raw);
+
+            state.matched = re.PartialMatch(decoded ? decoded : raw);
+
+            g_free(decoded);
+            g_free(raw);
+        }
+    }
+
+    if (! state.matched)
+        g_mime_message_foreach(message, match_part, &state);
+
+    g_object_unref(message);
+    return (state.matched);
+}
@@ -0,0 +1,168 @@
+/*
+ * maildir_grep.h - Search the bodies of messages across worker threads.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace pcrecpp
+{
+class RE;
+}
+
+
+/**
+ * The most worker threads a single search will use.
+ */
+#define GREP_MAX_THREADS 8
+
+
+/**
+ * This class searches the decoded textual parts of a list of message
+ * files for a regular expression, using a pool of worker threads.
+ *
+ * Each worker claims the next unsearched file, parses it with GMime, and
+ * tests the content of its textual parts - converted to UTF-8 - and
+ * optionally its headers, against the pattern.  The offsets of matching
+ * files are handed back to the caller, as they are found, via `poll()`.
+ *
+ * The workers never touch a `CMessage`, or any other shared state, so
+ * the caller is free to map the offsets back to its own messages.
+ */
+class CMaildirGrep
+{
+public:
+
+    /**
+     * Constructor.
+     *
+     * `threads` is the number of workers to use, zero meaning one per
+     * CPU, capped at `GREP_MAX_THREADS`.
+     */
+    CMaildirGrep(std::string pattern, bool caseless, bool headers, unsigned int threads = 0);
+
+    /**
+     * Destructor - cancels any search in progress.
+     */
+    ~CMaildirGrep();
+
+    /**
+     * Is our pattern valid?  If not `error` is set to the reason.
+     */
+    bool valid(std::string &error);
+
+    /**
+     * Start searching the given files.
+     */
+    void start(const std::vector < std::string > &files);
+
+    /**
+     * Stop the search, and wait for the workers to exit.
+     */
+    void cancel();
+
+    /**
+     * Wait up to `timeout` milliseconds for further matches, appending
+     * the offsets of any found since the last call to `found`.
+     *
+     * Returns false once the search has finished and every match has
+     * been collected.
+     */
+    bool poll(std::vector < size_t > &found, int timeout);
+
+    /**
+     * The number of files searched so far, and in total.
+     */
+    size_t searched();
+    size_t total();
+
+    /**
+     * Test whether a single file matches, as a worker does.
+     */
+    bool match_file(const std::string &file);
+
+private:
+
+    /**
+     * The body of each worker thread.
+     */
+    void worker();
+
+    /**
+     * Test whether a single file matches the given expression.
+     */
+    bool search_file(const std::string &file, const pcrecpp::RE &re);
+
+    /**
+     * Wait for all workers to exit.
+     */
+    void join();
+
+private:
+
+    /**
+     * The pattern we're searching for, and how.
+     */
+    std::string m_pattern;
+    bool m_caseless;
+    bool m_headers;
+
+    /**
+     * The number of workers to start.
+     */
+    unsigned int m_threads;
+
+    /**
+     * The files we're searching.
+     */
+    std::vector < std::string > m_files;
+
+    /**
+     * The offset of the next file to be claimed, the number of files
+     * searched, and the number of workers still running.
+     */
+    std::atomic < size_t > m_next;
+    std::atomic < size_t > m_searched;
+    std::atomic < unsigned int > m_running;
+
+    /**
+     * Set to stop the workers.
+     */
+    std::atomic < bool > m_cancel;
+
+    /**
+     * Matches not yet collected by `poll()`, along with the lock and
+     * condition which guard them.
+     */
+    std::vector < size_t > m_found;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+
+    /**
+     * Our workers.
+     */
+    std::vector < std::thread > m_workers;
+};
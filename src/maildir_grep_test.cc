@@ -0,0 +1,158 @@
+/*
+ * maildir_grep_test.cc - Test-cases for our parallel message search.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "maildir_grep.h"
+#include "CuTest.h"
+
+
+
+/**
+ * The messages we search.
+ */
+static const char *messages[] =
+{
+    "From: steve@example.com\n"
+    "Subject: Plain\n"
+    "Content-Type: text/plain\n\n"
+    "There is a Needle in this haystack.\n",
+
+    "From: steve@example.com\n"
+    "Subject: Encoded\n"
+    "Content-Type: text/plain\n"
+    "Content-Transfer-Encoding: base64\n\n"
+    "SGVyZSBpcyBhIG5lZWRsZSwgaGlkZGVuLgo=\n",
+
+    "From: steve@example.com\n"
+    "Subject: A needle in the headers\n"
+    "Content-Type: text/plain\n\n"
+    "Nothing to see here.\n",
+
+    "From: steve@example.com\n"
+    "Subject: Attached\n"
+    "MIME-Version: 1.0\n"
+    "Content-Type: multipart/mixed; boundary=\"XX\"\n\n"
+    "--XX\n"
+    "Content-Type: text/plain\n\n"
+    "Only hay.\n"
+    "--XX\n"
+    "Content-Type: text/plain; name=\"needle.txt\"\n"
+    "Content-Disposition: attachment; filename=\"needle.txt\"\n\n"
+    "needle\n"
+    "--XX--\n",
+};
+
+
+/**
+ * Run a search over the given files, returning the offsets of the
+ * matches, in order, as a string.
+ */
+static std::string results(CMaildirGrep &grep, const std::vector < std::string > &files)
+{
+    std::vector < size_t > found;
+
+    grep.start(files);
+
+    while (grep.poll(found, 100))
+        ;
+
+    std::sort(found.begin(), found.end());
+
+    std::string out;
+
+    for (size_t i : found)
+    {
+        if (! out.empty())
+            out += ",";
+
+        out += std::to_string(i);
+    }
+
+    return (out);
+}
+
+
+/**
+ * Test searching a handful of messages.
+ */
+void TestMaildirGrep(CuTest * tc)
+{
+    std::vector < std::string > files;
+
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++)
+    {
+        char tmpl[] = "/tmp/grep.XXXXXX";
+        int fd = mkstemp(tmpl);
+        CuAssertTrue(tc, fd >= 0);
+        CuAssertTrue(tc, write(fd, messages[i], strlen(messages[i])) == (ssize_t)strlen(messages[i]));
+        close(fd);
+
+        files.push_back(tmpl);
+    }
+
+    /*
+     * Bodies are decoded, and attachments are ignored.
+     */
+    CMaildirGrep body("needle", true, false, 2);
+    CuAssertStrEquals(tc, "0,1", results(body, files).c_str());
+    CuAssertIntEquals(tc, files.size(), body.searched());
+    CuAssertTrue(tc, body.match_file(files[1]));
+    CuAssertTrue(tc, ! body.match_file(files[3]));
+
+    /*
+     * Headers are only searched on request.
+     */
+    CMaildirGrep headers("needle", true, true, 2);
+    CuAssertStrEquals(tc, "0,1,2", results(headers, files).c_str());
+
+    CMaildirGrep exact("Needle", false, false, 1);
+    CuAssertStrEquals(tc, "0", results(exact, files).c_str());
+
+    /*
+     * Missing files don't match, and invalid patterns are reported.
+     */
+    CuAssertTrue(tc, ! body.match_file("/does/not/exist"));
+
+    std::string error;
+    CuAssertTrue(tc, body.valid(error));
+
+    CMaildirGrep broken("(needle", true, false);
+    CuAssertTrue(tc, ! broken.valid(error));
+    CuAssertTrue(tc, ! error.empty());
+
+    for (std::string file : files)
+        unlink(file.c_str());
+}
+
+
+CuSuite *
+maildir_grep_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMaildirGrep);
+    return suite;
+}
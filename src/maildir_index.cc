@@ -0,0 +1,552 @@
+/*
+ * maildir_index.cc - A persistent, memory-mapped, index of a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fcntl.h>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "config.h"
+#include "directory.h"
+#include "file.h"
+#include "maildir_index.h"
+#include "message_id_index.h"
+#include "util.h"
+
+
+/*
+ * The version of our on-disk format.
+ */
+#define INDEX_VERSION 5
+
+
+/*
+ * Get the mtime of the given directory, in seconds and nanoseconds, or
+ * zero.
+ *
+ * The nanoseconds matter: a message delivered within the same second as
+ * the index was written would otherwise leave the index looking fresh.
+ */
+static void index_dir_mtime(std::string path, int64_t &mtime, int64_t &nsec)
+{
+    struct stat sb;
+
+    mtime = 0;
+    nsec  = 0;
+
+    if (stat(path.c_str(), &sb) != 0)
+        return;
+
+    mtime = sb.st_mtim.tv_sec;
+    nsec  = sb.st_mtim.tv_nsec;
+}
+
+
+/*
+ * Constructor.
+ */
+CMaildirIndex::CMaildirIndex()
+{
+    m_map          = NULL;
+    m_size         = 0;
+    m_fresh        = false;
+    m_fields       = NULL;
+    m_fields_size  = 0;
+    m_strings      = NULL;
+    m_strings_size = 0;
+}
+
+
+/*
+ * Destructor.
+ */
+CMaildirIndex::~CMaildirIndex()
+{
+    close();
+    wait();
+}
+
+
+/*
+ * Return the directory holding our index-files.
+ */
+std::string CMaildirIndex::index_dir()
+{
+    CConfig *config = CConfig::instance();
+
+    std::string dir = config->get_string("index.cache");
+
+    if (dir.empty())
+    {
+        dir = config->get_string("cache.prefix");
+
+        if (dir.empty())
+            return "";
+
+        dir += "/index";
+    }
+
+    return (dir);
+}
+
+
+/*
+ * Return the index-file to use for the given maildir.
+ */
+std::string CMaildirIndex::index_file(std::string maildir)
+{
+    std::string dir = index_dir();
+
+    if (dir.empty())
+        return "";
+
+    return (dir + "/" + escape_filename(maildir));
+}
+
+
+
+
+/*
+ * Map the given index-file, which describes the given maildir.
+ */
+bool CMaildirIndex::open(std::string file, std::string maildir)
+{
+    close();
+
+    /*
+     * Don't read an index we're still writing.
+     */
+    wait();
+
+    int fd = ::open(file.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat sb;
+
+    if ((fstat(fd, &sb) != 0) || (sb.st_size < (off_t)sizeof(index_header)))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    m_map  = map;
+    m_size = sb.st_size;
+
+    /*
+     * Validate the header, and the size of the file.
+     */
+    const index_header *header = (const index_header *)m_map;
+
+    if ((memcmp(header->magic, "LMIX", 4) != 0) ||
+            (header->version != INDEX_VERSION) ||
+            (m_size != sizeof(index_header) +
+             (uint64_t)header->count * sizeof(index_record) +
+             (uint64_t)header->names * sizeof(uint32_t) +
+             (uint64_t)header->headers * sizeof(index_field) +
+             header->strings) ||
+            (header->strings == 0))
+    {
+        close();
+        return false;
+    }
+
+    const index_record *records = (const index_record *)(header + 1);
+    const uint32_t *names       = (const uint32_t *)(records + header->count);
+    m_fields       = (const index_field *)(names + header->names);
+    m_fields_size  = header->headers;
+    m_strings      = (const char *)(m_fields + header->headers);
+    m_strings_size = header->strings;
+
+    if (m_strings[m_strings_size - 1] != '\0')
+    {
+        close();
+        return false;
+    }
+
+    /*
+     * Intern the header-names, each is shared by all our messages.
+     */
+    m_names.reserve(header->names);
+
+    for (uint32_t i = 0; i < header->names; i++)
+    {
+        if (names[i] >= m_strings_size)
+        {
+            close();
+            return false;
+        }
+
+        m_names.push_back(CInterned(m_strings + names[i]));
+    }
+
+    int64_t cur_mtime, cur_nsec, new_mtime, new_nsec;
+    index_dir_mtime(maildir + "/cur", cur_mtime, cur_nsec);
+    index_dir_mtime(maildir + "/new", new_mtime, new_nsec);
+
+    m_fresh = (header->cur_mtime == cur_mtime) &&
+              (header->cur_mtime_nsec == cur_nsec) &&
+              (header->new_mtime == new_mtime) &&
+              (header->new_mtime_nsec == new_nsec);
+
+    m_records.reserve(header->count);
+
+    for (uint32_t i = 0; i < header->count; i++)
+    {
+        const index_record *r = &records[i];
+        bool valid = (r->name < m_strings_size) && (r->flags < m_strings_size) &&
+                     (r->first <= m_fields_size) && (r->headers <= m_fields_size - r->first);
+
+        for (uint32_t h = 0; valid && (h < r->headers); h++)
+        {
+            const index_field &f = m_fields[r->first + h];
+            valid = (f.name < m_names.size()) && (f.value < m_strings_size);
+        }
+
+        if (valid)
+            m_records[r->inode] = r;
+    }
+
+    return true;
+}
+
+
+/*
+ * Unmap any index-file we've opened.
+ */
+void CMaildirIndex::close()
+{
+    if (m_map != NULL)
+        munmap(m_map, m_size);
+
+    m_map          = NULL;
+    m_size         = 0;
+    m_fresh        = false;
+    m_fields       = NULL;
+    m_fields_size  = 0;
+    m_strings      = NULL;
+    m_strings_size = 0;
+    m_records.clear();
+    m_names.clear();
+}
+
+
+/*
+ * Find the indexed headers for the message with the given inode.
+ */
+bool CMaildirIndex::lookup(ino_t inode, std::string path, CHeaderList &headers, time_t &date, uint32_t &attributes,
+                           time_t &mtime, off_t &size)
+{
+    if (m_map == NULL)
+        return false;
+
+    auto it = m_records.find(inode);
+
+    if (it == m_records.end())
+        return false;
+
+    const index_record *r = it->second;
+
+    mtime = r->mtime;
+    size  = r->size;
+
+    /*
+     * If the maildir has changed since the index was written the
+     * inode might have been reused, so test the size too.
+     */
+    if (! m_fresh)
+    {
+        struct stat sb;
+
+        if ((stat(path.c_str(), &sb) != 0) || (sb.st_ino != inode) ||
+                (sb.st_size != r->size))
+            return false;
+
+        mtime = sb.st_mtime;
+    }
+
+    headers.reserve(r->headers);
+
+    for (uint32_t h = 0; h < r->headers; h++)
+    {
+        const index_field &f = m_fields[r->first + h];
+        const CInterned &name = m_names[f.name];
+        headers.push_back(std::make_pair(name, CHeaderValue::make(name, m_strings + f.value)));
+    }
+
+    date       = r->date;
+    attributes = r->attributes;
+    return true;
+}
+
+
+/*
+ * Write an index of the given messages to the specified file.
+ */
+bool CMaildirIndex::save(std::string file, std::string maildir, CMessageList *messages)
+{
+    if (file.empty() || (messages == NULL))
+        return false;
+
+    index_image image;
+    build(maildir, messages, image);
+    return (write(file, image));
+}
+
+
+/*
+ * Write an index of the given messages, from a background thread.
+ */
+void CMaildirIndex::save_background(std::string file, std::string maildir, CMessageList *messages)
+{
+    if (file.empty() || (messages == NULL))
+        return;
+
+    /*
+     * Only one index may be written at a time.
+     */
+    wait();
+
+    std::shared_ptr<index_image> image = std::make_shared<index_image>();
+    build(maildir, messages, *image);
+
+    m_writer = std::thread([file, image]()
+    {
+        write(file, *image);
+    });
+}
+
+
+/*
+ * Wait for any index which is being written in the background.
+ */
+void CMaildirIndex::wait()
+{
+    if (m_writer.joinable())
+        m_writer.join();
+}
+
+
+/*
+ * Build an index of the given messages, ready to be written.
+ */
+void CMaildirIndex::build(std::string maildir, CMessageList *messages, index_image &image)
+{
+    std::unordered_map < uint32_t, uint32_t > names;
+
+    image.records.reserve(messages->size());
+    image.paths.reserve(messages->size());
+
+    /*
+     * The empty string lives at offset zero.
+     */
+    image.strings.push_back('\0');
+
+    /*
+     * Record the mtimes of the directories before we look at any of
+     * their messages, so that anything which changes while we're
+     * working makes the index stale, rather than wrong.
+     */
+    index_header &header = image.header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "LMIX", 4);
+    header.version   = INDEX_VERSION;
+    index_dir_mtime(maildir + "/cur", header.cur_mtime, header.cur_mtime_nsec);
+    index_dir_mtime(maildir + "/new", header.new_mtime, header.new_mtime_nsec);
+
+    image.maildir = maildir;
+    image.ids.reserve(messages->size());
+
+    for (std::shared_ptr<CMessage> msg : *messages)
+    {
+        if (! msg->headers_complete())
+            continue;
+
+        std::string path = msg->path();
+
+        index_record r;
+        memset(&r, 0, sizeof(r));
+
+        r.name = image.strings.size();
+        image.strings += CFile::basename(path);
+        image.strings.push_back('\0');
+
+        r.flags = image.strings.size();
+        image.strings += msg->get_flags();
+        image.strings.push_back('\0');
+
+        /*
+         * Store each header, interning its name.
+         */
+        const CHeaderList &headers = msg->header_list();
+
+        r.first   = image.fields.size();
+        r.headers = headers.size();
+
+        std::string id;
+
+        for (auto it = headers.begin(); it != headers.end(); ++it)
+        {
+            index_field f;
+
+            if (it->first.str() == "message-id")
+                id = it->second.str();
+
+            auto name = names.find(it->first.id());
+
+            if (name == names.end())
+            {
+                name = names.insert(std::make_pair(it->first.id(), (uint32_t)image.names.size())).first;
+
+                image.names.push_back(image.strings.size());
+                image.strings += it->first.str();
+                image.strings.push_back('\0');
+            }
+
+            f.name  = name->second;
+            f.value = 0;
+
+            if (! it->second.empty())
+            {
+                f.value = image.strings.size();
+                image.strings += it->second.str();
+                image.strings.push_back('\0');
+            }
+
+            image.fields.push_back(f);
+        }
+
+        /*
+         * Store the parsed date, preferring the delivery-date.
+         */
+        r.date = msg->get_ctime();
+
+        /*
+         * Store whether the message has attachments, if we know.
+         */
+        if (msg->attachments_known())
+        {
+            r.attributes |= INDEX_ATTACHMENTS_KNOWN;
+
+            if (msg->has_attachments())
+                r.attributes |= INDEX_ATTACHMENTS;
+        }
+
+        image.records.push_back(r);
+        image.paths.push_back(path);
+        image.ids.push_back(id);
+    }
+}
+
+
+/*
+ * Write the given index to the specified file.
+ */
+bool CMaildirIndex::write(std::string file, index_image &image)
+{
+    /*
+     * Find the inode, size, and mtime, of each message - dropping any
+     * which have vanished since the index was built.  Their headers,
+     * and strings, are left behind unreferenced.
+     */
+    size_t count = 0;
+
+    std::vector < std::string > names;
+    std::vector < std::string > ids;
+
+    for (size_t i = 0; i < image.records.size(); i++)
+    {
+        struct stat sb;
+
+        if (stat(image.paths[i].c_str(), &sb) != 0)
+            continue;
+
+        /*
+         * Each message is known to our index of Message-IDs by its
+         * directory, and name, such as "cur/1234.host:2,S".
+         */
+        const std::string &path = image.paths[i];
+        size_t slash = path.find_last_of('/');
+        size_t parent = (slash > 0) ? path.find_last_of('/', slash - 1) : std::string::npos;
+
+        names.push_back(path.substr(parent == std::string::npos ? 0 : parent + 1));
+        ids.push_back(image.ids[i]);
+
+        index_record &r = image.records[count++];
+        r = image.records[i];
+        r.inode = sb.st_ino;
+        r.size  = sb.st_size;
+        r.mtime = sb.st_mtime;
+    }
+
+    image.records.resize(count);
+
+    index_header &header = image.header;
+    header.count   = image.records.size();
+    header.names   = image.names.size();
+    header.headers = image.fields.size();
+    header.strings = image.strings.size();
+
+    /*
+     * Write to a temporary file, and rename it into place, so readers
+     * never see a partial index.
+     */
+    std::string dir = file.substr(0, file.find_last_of('/'));
+    CDirectory::mkdir_p(dir);
+
+    std::string tmp = file + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+
+    if (fp == NULL)
+        return false;
+
+    bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+    if (ok && ! image.records.empty())
+        ok = (fwrite(&image.records[0], sizeof(index_record), image.records.size(), fp) == image.records.size());
+
+    if (ok && ! image.names.empty())
+        ok = (fwrite(&image.names[0], sizeof(uint32_t), image.names.size(), fp) == image.names.size());
+
+    if (ok && ! image.fields.empty())
+        ok = (fwrite(&image.fields[0], sizeof(index_field), image.fields.size(), fp) == image.fields.size());
+
+    ok = ok && (fwrite(image.strings.data(), 1, image.strings.size(), fp) == image.strings.size());
+    ok = (fclose(fp) == 0) && ok;
+
+    if (! ok || (rename(tmp.c_str(), file.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    CMessageIdIndex::update(dir + "/" MESSAGE_ID_FILE, image.maildir, names, ids);
+    return true;
+}
@@ -0,0 +1,240 @@
+/*
+ * maildir_index.h - A persistent, memory-mapped, index of a maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "message.h"
+
+
+/**
+ * Bits of `index_record.attributes`.
+ */
+#define INDEX_ATTACHMENTS_KNOWN 0x01
+#define INDEX_ATTACHMENTS       0x02
+
+
+/**
+ * The on-disk header of an index-file.
+ */
+typedef struct _index_header
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t names;
+    uint32_t headers;
+    uint32_t strings;
+    int64_t  cur_mtime;
+    int64_t  new_mtime;
+    int64_t  cur_mtime_nsec;
+    int64_t  new_mtime_nsec;
+} index_header;
+
+
+/**
+ * The on-disk record for a single message.
+ *
+ * Strings are stored as offsets into the NUL-terminated string-table
+ * which follows the records.  The headers of the message are the
+ * `headers` entries of the header-table starting at `first`.
+ */
+typedef struct _index_record
+{
+    uint64_t inode;
+    int64_t  size;
+    int64_t  mtime;
+    int64_t  date;
+    uint32_t name;
+    uint32_t flags;
+    uint32_t attributes;
+    uint32_t first;
+    uint32_t headers;
+    uint32_t reserved;
+} index_record;
+
+
+/**
+ * The on-disk form of a single header.
+ *
+ * Each distinct header-name is stored once, in the name-table, and
+ * referred to by its position there; the value is an offset into the
+ * string-table.
+ */
+typedef struct _index_field
+{
+    uint32_t name;
+    uint32_t value;
+} index_field;
+
+
+/**
+ * An index, built from our messages, which is waiting to be written.
+ *
+ * The inode, size, and mtime, of each record are filled in as it is
+ * written, from the matching path.
+ */
+typedef struct _index_image
+{
+    index_header header;
+    std::vector < index_record > records;
+    std::vector < std::string > paths;
+    std::vector < uint32_t > names;
+    std::vector < index_field > fields;
+    std::string strings;
+    std::string maildir;
+    std::vector < std::string > ids;
+} index_image;
+
+
+class CMaildirIndex
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMaildirIndex();
+
+    /**
+     * Destructor.
+     */
+    ~CMaildirIndex();
+
+    /**
+     * Return the directory holding our index-files, or the empty string
+     * if indexing is disabled.
+     */
+    static std::string index_dir();
+
+    /**
+     * Return the index-file to use for the given maildir, or the
+     * empty string if indexing is disabled.
+     */
+    static std::string index_file(std::string maildir);
+
+    /**
+     * Map the given index-file, which describes the given maildir.
+     *
+     * Returns false if the file is missing, or invalid.
+     */
+    bool open(std::string file, std::string maildir);
+
+    /**
+     * Unmap any index-file we've opened.
+     */
+    void close();
+
+    /**
+     * Find the indexed headers, parsed date, and attributes, for the
+     * message with the given inode and path.  Returns false if the
+     * message isn't indexed, or its record is stale.
+     *
+     * The headers are all those of the message, sorted by name.
+     *
+     * The attributes are a mask of the `INDEX_ATTACHMENTS` bits.
+     *
+     * The modification time, and size, of the message are found too, so
+     * that the message needn't be stat'd for them.
+     */
+    bool lookup(ino_t inode, std::string path, CHeaderList &headers, time_t &date, uint32_t &attributes,
+                time_t &mtime, off_t &size);
+
+    /**
+     * Write an index of the given messages to the specified file.
+     *
+     * Only messages whose headers are already known are written, we
+     * never parse messages just to index them.
+     */
+    static bool save(std::string file, std::string maildir, CMessageList *messages);
+
+    /**
+     * Write an index of the given messages to the specified file, as
+     * `save` does, but from a background thread.
+     *
+     * The messages are only read before this returns, so may be freed
+     * while the index is being written.
+     */
+    void save_background(std::string file, std::string maildir, CMessageList *messages);
+
+    /**
+     * Wait for any index which is being written in the background.
+     */
+    void wait();
+
+private:
+
+    /**
+     * Build an index of the given messages, ready to be written.
+     */
+    static void build(std::string maildir, CMessageList *messages, index_image &image);
+
+    /**
+     * Write the given index to the specified file, and record the
+     * Message-IDs of its messages in our index of those.
+     */
+    static bool write(std::string file, index_image &image);
+
+private:
+
+    /**
+     * The mapped file, and its size.
+     */
+    void *m_map;
+    size_t m_size;
+
+    /**
+     * Do the directory mtimes match those of the index?
+     */
+    bool m_fresh;
+
+    /**
+     * Records, indexed by inode.
+     */
+    std::unordered_map < uint64_t, const index_record * > m_records;
+
+    /**
+     * The header-table, and its size.
+     */
+    const index_field *m_fields;
+    uint32_t m_fields_size;
+
+    /**
+     * The interned header-names, by their position in the name-table.
+     */
+    std::vector < CInterned > m_names;
+
+    /**
+     * The string-table, and its size.
+     */
+    const char *m_strings;
+    uint32_t m_strings_size;
+
+    /**
+     * The thread writing an index in the background, if any.
+     */
+    std::thread m_writer;
+};
@@ -0,0 +1,227 @@
+/*
+ * maildir_loader.cc - Load the messages of a maildir in the background.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "maildir_loader.h"
+#include "message_arena.h"
+#include "util.h"
+
+
+/*
+ * The size of the first batch we publish, and the largest.
+ */
+#define LOADER_FIRST_BATCH 256
+#define LOADER_MAX_BATCH   16384
+
+
+/*
+ * Constructor.
+ */
+CMaildirLoader::CMaildirLoader()
+{
+    m_done   = true;
+    m_active = false;
+    m_cancel = false;
+}
+
+
+/*
+ * Destructor - cancels any load in progress.
+ */
+CMaildirLoader::~CMaildirLoader()
+{
+    cancel();
+}
+
+
+/*
+ * Start loading the given maildir, cancelling any previous load.
+ */
+void CMaildirLoader::start(std::string maildir)
+{
+    cancel();
+
+    m_path   = maildir;
+    m_done   = false;
+    m_active = true;
+    m_cancel = false;
+    m_thread = std::thread(&CMaildirLoader::run, this, maildir);
+}
+
+
+/*
+ * Cancel any load in progress, discarding pending messages.
+ */
+void CMaildirLoader::cancel()
+{
+    m_cancel = true;
+
+    if (m_thread.joinable())
+        m_thread.join();
+
+    m_pending.clear();
+    m_done   = true;
+    m_active = false;
+    m_path   = "";
+}
+
+
+/*
+ * Is a load in progress, or are there messages still to be collected?
+ */
+bool CMaildirLoader::is_loading()
+{
+    return (m_active);
+}
+
+
+/*
+ * The maildir being loaded.
+ */
+std::string CMaildirLoader::path()
+{
+    return (m_path);
+}
+
+
+/*
+ * Block until a batch of messages is ready, or the load completes.
+ */
+void CMaildirLoader::wait()
+{
+    std::unique_lock < std::mutex > lock(m_lock);
+
+    while (m_pending.empty() && ! m_done)
+        m_cond.wait(lock);
+}
+
+
+/*
+ * Append any completed messages to the given list.
+ */
+bool CMaildirLoader::poll(CMessageList &out)
+{
+    if (! m_active)
+        return true;
+
+    bool done;
+
+    {
+        std::lock_guard < std::mutex > lock(m_lock);
+        out.insert(out.end(), m_pending.begin(), m_pending.end());
+        m_pending.clear();
+        done = m_done;
+    }
+
+    if (done)
+    {
+        if (m_thread.joinable())
+            m_thread.join();
+
+        m_active = false;
+    }
+
+    return (done);
+}
+
+
+/*
+ * Hand a batch of messages over to the main thread.
+ */
+void CMaildirLoader::publish(CMessageList &batch, bool done)
+{
+    {
+        std::lock_guard < std::mutex > lock(m_lock);
+        m_pending.insert(m_pending.end(), batch.begin(), batch.end());
+
+        if (done)
+            m_done = true;
+    }
+
+    batch.clear();
+    m_cond.notify_all();
+}
+
+
+/*
+ * The body of our worker-thread.
+ *
+ * This mirrors `CMaildir::getMessages`, but publishes messages as
+ * they are found rather than once the listing is complete.
+ */
+void CMaildirLoader::run(std::string maildir)
+{
+    CMessageList batch;
+    size_t batch_size = LOADER_FIRST_BATCH;
+
+    std::shared_ptr<CMessageArena> arena = CMessageArena::folder(maildir);
+
+    const char *subdirs[] = { "/cur/", "/new/" };
+
+    for (int i = 0; i < 2 && ! m_cancel; i++)
+    {
+        std::string path = maildir + subdirs[i];
+        path.erase(std::unique(path.begin(), path.end(), both_slashes()), path.end());
+
+        DIR *dp = opendir(path.c_str());
+
+        if (dp == NULL)
+            continue;
+
+        dirent *de;
+
+        while (((de = readdir(dp)) != NULL) && ! m_cancel)
+        {
+            const char *name = de->d_name;
+
+            if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+                continue;
+
+            if (de->d_type == DT_DIR)
+                continue;
+
+            if (de->d_type == DT_UNKNOWN)
+            {
+                struct stat sb;
+
+                if ((fstatat(dirfd(dp), name, &sb, 0) == 0) && S_ISDIR(sb.st_mode))
+                    continue;
+            }
+
+            std::shared_ptr < CMessage > t = arena->message(path + name);
+            t->set_inode(de->d_ino);
+            batch.push_back(t);
+
+            if (batch.size() >= batch_size)
+            {
+                publish(batch, false);
+                batch_size = std::min(batch_size * 2, (size_t)LOADER_MAX_BATCH);
+            }
+        }
+
+        closedir(dp);
+    }
+
+    publish(batch, true);
+}
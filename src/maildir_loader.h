@@ -0,0 +1,144 @@
+/*
+ * maildir_loader.h - Load the messages of a maildir in the background.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "message.h"
+
+
+/**
+ * This class lists the messages of a local maildir upon a worker
+ * thread, handing them back to the main thread in batches.
+ *
+ * Batches start small, so the first screenful of messages can be shown
+ * immediately, and double in size as loading continues so the index is
+ * only re-sorted a handful of times for even the largest folder.
+ *
+ * Only the worker creates messages, and only the main thread consumes
+ * them via `poll()`, so the messages themselves are never shared.
+ */
+class CMaildirLoader
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMaildirLoader();
+
+    /**
+     * Destructor - cancels any load in progress.
+     */
+    ~CMaildirLoader();
+
+    /**
+     * Start loading the given maildir, cancelling any previous load.
+     */
+    void start(std::string maildir);
+
+    /**
+     * Cancel any load in progress, discarding pending messages.
+     */
+    void cancel();
+
+    /**
+     * Is a load in progress, or are there messages still to be
+     * collected via `poll()`?
+     */
+    bool is_loading();
+
+    /**
+     * The maildir being loaded.
+     */
+    std::string path();
+
+    /**
+     * Block until a batch of messages is ready, or the load completes.
+     */
+    void wait();
+
+    /**
+     * Append any completed messages to the given list.
+     *
+     * Returns true once the load has completed and every message has
+     * been collected.
+     */
+    bool poll(CMessageList &out);
+
+private:
+
+    /**
+     * The body of our worker-thread.
+     */
+    void run(std::string maildir);
+
+    /**
+     * Hand a batch of messages over to the main thread.
+     */
+    void publish(CMessageList &batch, bool done);
+
+private:
+
+    /**
+     * The maildir being loaded.
+     */
+    std::string m_path;
+
+    /**
+     * The worker thread.
+     */
+    std::thread m_thread;
+
+    /**
+     * Protects `m_pending` and `m_done`.
+     */
+    std::mutex m_lock;
+
+    /**
+     * Signalled whenever a batch is published.
+     */
+    std::condition_variable m_cond;
+
+    /**
+     * Messages which have been loaded, but not yet collected.
+     */
+    CMessageList m_pending;
+
+    /**
+     * Has the worker finished?
+     */
+    bool m_done;
+
+    /**
+     * Are we loading, or holding uncollected messages?
+     */
+    bool m_active;
+
+    /**
+     * Set to ask the worker to stop.
+     */
+    std::atomic < bool > m_cancel;
+};
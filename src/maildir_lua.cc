@@ -32,12 +32,16 @@
 #include <unordered_map>
 #include <vector>
 #include <gmime/gmime.h>
+#include <cursesw.h>
 
 
+#include "config.h"
 #include "file.h"
 #include "global_state.h"
+#include "input_queue.h"
 #include "lua.h"
 #include "maildir.h"
+#include "maildir_grep.h"
 #include "message.h"
 #include "message_lua.h"
 
@@ -58,6 +62,13 @@
  */
 
 
+/**
+ * How long `Maildir:grep()` waits for matches, in milliseconds, before
+ * checking the keyboard again.
+ */
+#define GREP_POLL_INTERVAL 50
+
+
 /**
  * Push a CMaildir pointer onto the Lua stack.
  */
@@ -134,6 +145,183 @@ std::shared_ptr<CMaildir> l_CheckCMaildir(lua_State * l, int n)
 }
 
 
+/**
+ * Implementation of Maildir:grep()
+ *
+ * Search the textual parts of each message in the maildir for the given
+ * regular expression, across a pool of threads, returning a table of the
+ * messages which matched and whether the search was cancelled.
+ *
+ * The optional table of options may contain:
+ *
+ *    caseless - Ignore case, which is the default, as `Regexp:match()`.
+ *    headers  - Search the headers of each message too.
+ *    threads  - The number of threads to use, by default one per CPU.
+ *    callback - A function called with a table of each new batch of
+ *               matches, the number of messages searched, and the total.
+ *               If it returns `false` the search is cancelled.
+ *
+ * Pressing `ESC`, or `Ctrl-g`, cancels the search.  Other keys pressed
+ * while the search is running are queued as input for afterwards.
+ *
+ * If the pattern is invalid, or the callback fails, `nil` is returned
+ * along with the error.
+ */
+int l_CMaildir_grep(lua_State * l)
+{
+    CLuaLog("l_CMaildir_grep");
+
+    std::shared_ptr<CMaildir> maildir = l_CheckCMaildir(l, 1);
+    const char *pattern = luaL_checkstring(l, 2);
+
+    bool caseless = true;
+    bool headers  = false;
+    bool callback = false;
+    int threads   = 0;
+
+    if (lua_istable(l, 3))
+    {
+        lua_getfield(l, 3, "caseless");
+
+        if (! lua_isnil(l, -1))
+            caseless = lua_toboolean(l, -1);
+
+        lua_pop(l, 1);
+
+        lua_getfield(l, 3, "headers");
+        headers = lua_toboolean(l, -1);
+        lua_pop(l, 1);
+
+        lua_getfield(l, 3, "threads");
+
+        if (lua_isnumber(l, -1))
+            threads = lua_tointeger(l, -1);
+
+        lua_pop(l, 1);
+
+        lua_getfield(l, 3, "callback");
+        callback = lua_isfunction(l, -1);
+        lua_pop(l, 1);
+    }
+
+    CMaildirGrep grep(pattern, caseless, headers, threads > 0 ? threads : 0);
+
+    std::string error;
+
+    if (! grep.valid(error))
+    {
+        lua_pushnil(l);
+        lua_pushstring(l, error.c_str());
+        return 2;
+    }
+
+    CMessageList messages = maildir->getMessages();
+    std::vector < std::string > files;
+
+    files.reserve(messages.size());
+
+    for (std::shared_ptr<CMessage> msg : messages)
+        files.push_back(msg->path());
+
+    grep.start(files);
+
+    /*
+     * We only read the keyboard ourselves if the screen is active, and
+     * there's no faux input waiting to be processed.
+     */
+    CInputQueue *input = CInputQueue::instance();
+    bool keyboard = ((stdscr != NULL) && ! isendwin() && ! input->has_pending_input());
+
+    if (keyboard)
+        timeout(0);
+
+    std::vector < size_t > found;
+    std::string keys;
+    bool cancelled = false;
+    bool more = true;
+
+    while (more && ! cancelled)
+    {
+        size_t seen = found.size();
+        more = grep.poll(found, GREP_POLL_INTERVAL);
+
+        if (keyboard)
+        {
+            int ch;
+
+            while ((ch = getch()) != ERR)
+            {
+                if ((ch == 27) || (ch == 7))
+                    cancelled = true;
+                else if ((ch > 0) && (ch < 256))
+                    keys += (char)ch;
+            }
+        }
+
+        if (callback && (found.size() > seen) && ! cancelled)
+        {
+            lua_getfield(l, 3, "callback");
+            lua_createtable(l, found.size() - seen, 0);
+
+            for (size_t i = seen; i < found.size(); i++)
+            {
+                push_cmessage(l, messages.at(found[i]));
+                lua_rawseti(l, -2, i - seen + 1);
+            }
+
+            lua_pushinteger(l, grep.searched());
+            lua_pushinteger(l, grep.total());
+
+            if (lua_pcall(l, 3, 1, 0) != 0)
+            {
+                const char *err = lua_tostring(l, -1);
+                error = err ? err : "Maildir:grep() callback failed";
+                cancelled = true;
+            }
+            else if (lua_isboolean(l, -1) && ! lua_toboolean(l, -1))
+                cancelled = true;
+
+            lua_pop(l, 1);
+        }
+    }
+
+    grep.cancel();
+
+    if (keyboard)
+    {
+        CConfig *config = CConfig::instance();
+        timeout(config->get_integer("global.timeout", 500));
+    }
+
+    if (! keys.empty())
+        input->add_input(keys);
+
+    if (! error.empty())
+    {
+        lua_pushnil(l);
+        lua_pushstring(l, error.c_str());
+        return 2;
+    }
+
+    /*
+     * Return the matches in the order of the maildir, rather than the
+     * order in which the workers happened to find them.
+     */
+    std::sort(found.begin(), found.end());
+
+    lua_createtable(l, found.size(), 0);
+
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        push_cmessage(l, messages.at(found[i]));
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    lua_pushboolean(l, cancelled ? 1 : 0);
+    return 2;
+}
+
+
 /**
  * Implementation of Maildir:is_imap()
  */
@@ -170,6 +358,32 @@ int l_CMaildir_is_maildir(lua_State * l)
     return 1;
 }
 
+/**
+ * Implementation of Maildir:is_mbox()
+ */
+int l_CMaildir_is_mbox(lua_State * l)
+{
+    CLuaLog("l_CMaildir_is_mbox");
+
+    std::shared_ptr<CMaildir> foo = l_CheckCMaildir(l, 1);
+
+    lua_pushboolean(l, foo->is_mbox());
+    return 1;
+}
+
+/**
+ * Implementation of Maildir:is_virtual()
+ */
+int l_CMaildir_is_virtual(lua_State * l)
+{
+    CLuaLog("l_CMaildir_is_virtual");
+
+    std::shared_ptr<CMaildir> foo = l_CheckCMaildir(l, 1);
+
+    lua_pushboolean(l, foo->is_virtual());
+    return 1;
+}
+
 /**
  * Implementation of Maildir:path()
  */
@@ -193,8 +407,9 @@ int l_CMaildir_save_message(lua_State * l)
 
     std::shared_ptr<CMaildir> maildir = l_CheckCMaildir(l, 1);
     std::shared_ptr<CMessage> message = l_CheckCMessage(l, 2);
+    bool move = lua_toboolean(l, 3);
 
-    bool ret = maildir->saveMessage(message);
+    bool ret = maildir->saveMessage(message, move);
 
     if (ret)
         lua_pushboolean(l , 1);
@@ -204,6 +419,50 @@ int l_CMaildir_save_message(lua_State * l)
     return 1;
 }
 
+/**
+ * Implementation of Maildir:import()
+ *
+ * Save each message in the given table to this maildir, or move them if
+ * the optional table of options has `move` set.
+ */
+int l_CMaildir_import(lua_State * l)
+{
+    CLuaLog("l_CMaildir_import");
+
+    std::shared_ptr<CMaildir> maildir = l_CheckCMaildir(l, 1);
+
+    luaL_checktype(l, 2, LUA_TTABLE);
+
+#if LUA_VERSION_NUM == 501
+    size_t n = lua_objlen(l, 2);
+#else
+    size_t n = lua_rawlen(l, 2);
+#endif
+
+    CMessageList messages;
+    messages.reserve(n);
+
+    for (size_t i = 1; i <= n; i++)
+    {
+        lua_rawgeti(l, 2, i);
+        messages.push_back(l_CheckCMessage(l, -1));
+        lua_pop(l, 1);
+    }
+
+    bool move = false;
+
+    if (lua_istable(l, 3))
+    {
+        lua_getfield(l, 3, "move");
+        move = lua_toboolean(l, -1);
+        lua_pop(l, 1);
+    }
+
+    lua_pushinteger(l, maildir->import(messages, move));
+    return 1;
+}
+
+
 /**
  * Implementation of Maildir:total_messages()
  */
@@ -333,8 +592,12 @@ void InitMaildir(lua_State * l)
     {
         {"__gc", l_CMaildir_destructor},
         {"__eq", l_CMaildir_equality},
+        {"grep", l_CMaildir_grep},
+        {"import", l_CMaildir_import},
         {"is_imap", l_CMaildir_is_imap},
         {"is_maildir", l_CMaildir_is_maildir},
+        {"is_mbox", l_CMaildir_is_mbox},
+        {"is_virtual", l_CMaildir_is_virtual},
         {"messages", l_CMaildir_messages},
         {"mtime", l_CMaildir_mtime},
         {"new", l_CMaildir_constructor},
@@ -0,0 +1,233 @@
+/*
+ * maildir_summary.cc - A sorted snapshot of the counts of every maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <strings.h>
+
+#include "maildir_summary.h"
+
+
+/*
+ * Constructor.
+ */
+CMaildirSummaries::CMaildirSummaries()
+{
+    m_generation = 1;
+    m_refreshed  = 0;
+    m_refreshing = false;
+}
+
+
+/*
+ * Destructor.
+ */
+CMaildirSummaries::~CMaildirSummaries()
+{
+    m_token.cancel();
+}
+
+
+/*
+ * Replace the maildirs we summarize.
+ */
+void CMaildirSummaries::set_maildirs(const CMaildirList &maildirs)
+{
+    /*
+     * Any refresh in progress concerns the maildirs we had.
+     */
+    m_token.cancel();
+    m_token      = CJobToken();
+    m_refreshing = false;
+
+    std::vector<maildir_summary> summaries;
+    summaries.reserve(maildirs.size());
+
+    for (std::shared_ptr<CMaildir> folder : maildirs)
+    {
+        maildir_summary summary;
+        summary.maildir = folder;
+        summary.local   = folder->is_maildir();
+        summary.path    = folder->path();
+        summary.total   = 0;
+        summary.unread  = 0;
+        summary.mtime   = -1;
+        summary.counted = 0;
+        summaries.push_back(summary);
+    }
+
+    sort(summaries);
+
+    /*
+     * Count everything now, so that the snapshot is complete.
+     */
+    std::vector<maildir_summary> counted = summaries;
+    count(counted, m_token);
+
+    m_summaries.swap(summaries);
+    collect(counted);
+
+    m_refreshed = time(NULL);
+    m_generation++;
+}
+
+
+/*
+ * Get the snapshot, refreshing it if that is due.
+ */
+const std::vector<maildir_summary> &CMaildirSummaries::summaries(int interval)
+{
+    time_t now = time(NULL);
+
+    if (m_refreshing || m_summaries.empty() || (now - m_refreshed < interval))
+        return (m_summaries);
+
+    m_refreshing = true;
+    m_refreshed  = now;
+
+    /*
+     * Our workers are given copies of the summaries, without the
+     * maildirs themselves, which mustn't be touched off this thread.
+     */
+    std::shared_ptr<std::vector<maildir_summary> > counted =
+        std::make_shared<std::vector<maildir_summary> >(m_summaries);
+
+    for (maildir_summary &summary : *counted)
+        summary.maildir.reset();
+
+    CJobToken token = m_token;
+
+    CJobQueue::instance()->submit([counted](const CJobToken & t)
+    {
+        count(*counted, t);
+    },
+    [this, counted]()
+    {
+        m_refreshing = false;
+
+        if (collect(*counted))
+            m_generation++;
+    }, JOB_NORMAL, token);
+
+    return (m_summaries);
+}
+
+
+/*
+ * Refresh at the next request.
+ */
+void CMaildirSummaries::invalidate()
+{
+    m_refreshed = 0;
+}
+
+
+/*
+ * Our generation.
+ */
+uint64_t CMaildirSummaries::generation()
+{
+    return (m_generation);
+}
+
+
+/*
+ * Sort the given summaries case-insensitively by path.
+ */
+void CMaildirSummaries::sort(std::vector<maildir_summary> &summaries)
+{
+    std::stable_sort(summaries.begin(), summaries.end(),
+                     [](const maildir_summary & a, const maildir_summary & b)
+    {
+        return (strcasecmp(a.path.c_str(), b.path.c_str()) < 0);
+    });
+}
+
+
+/*
+ * Count the messages in the given local maildirs.
+ */
+void CMaildirSummaries::count(std::vector<maildir_summary> &summaries, const CJobToken &token)
+{
+    time_t now = time(NULL);
+
+    for (maildir_summary &summary : summaries)
+    {
+        if (token.cancelled())
+            return;
+
+        if (! summary.local)
+            continue;
+
+        /*
+         * A maildir modified in the second we last counted it might
+         * have changed again since.
+         */
+        time_t mtime = CMaildir::modified(summary.path);
+
+        if ((mtime == summary.mtime) && (summary.counted > mtime))
+            continue;
+
+        CMaildir::count(summary.path, summary.total, summary.unread);
+        summary.mtime   = mtime;
+        summary.counted = now;
+    }
+}
+
+
+/*
+ * Replace our counts with the given ones.
+ */
+bool CMaildirSummaries::collect(std::vector<maildir_summary> &counted)
+{
+    if (counted.size() != m_summaries.size())
+        return false;
+
+    bool changed = false;
+
+    for (size_t i = 0; i < m_summaries.size(); i++)
+    {
+        maildir_summary &summary = m_summaries[i];
+        int total  = counted[i].total;
+        int unread = counted[i].unread;
+        time_t mtime = counted[i].mtime;
+
+        if (summary.local)
+        {
+            summary.counted = counted[i].counted;
+            summary.maildir->set_counts(mtime, total, unread);
+        }
+        else
+        {
+            total  = summary.maildir->total_messages();
+            unread = summary.maildir->unread_messages();
+            mtime  = summary.maildir->last_modified();
+        }
+
+        if ((summary.total != total) || (summary.unread != unread) ||
+                (summary.mtime != mtime))
+        {
+            summary.total  = total;
+            summary.unread = unread;
+            summary.mtime  = mtime;
+            changed = true;
+        }
+    }
+
+    return (changed);
+}
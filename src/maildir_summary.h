@@ -0,0 +1,146 @@
+/*
+ * maildir_summary.h - A sorted snapshot of the counts of every maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "job_queue.h"
+#include "maildir.h"
+
+
+/**
+ * The summary of a single maildir.
+ *
+ * `counted` is the time at which the counts of a local maildir were
+ * taken, as a maildir modified within that same second may have changed
+ * again since.
+ */
+typedef struct _maildir_summary
+{
+    std::shared_ptr<CMaildir> maildir;
+    bool local;
+    std::string path;
+    int total;
+    int unread;
+    time_t mtime;
+    time_t counted;
+} maildir_summary;
+
+
+/**
+ * This class holds the path, and message counts, of each of our
+ * maildirs, sorted case-insensitively by path, so that the maildir view
+ * needn't ask each folder for them, nor sort them, whenever it is drawn.
+ *
+ * The counts of local maildirs are refreshed upon our workers, at most
+ * once every `interval` seconds, and the snapshot is replaced once they
+ * have been.  Those of IMAP, and virtual, folders are maintained
+ * elsewhere, and copied when the local counts are collected.
+ *
+ * Each change to the snapshot changes its generation, so that anything
+ * built from it may be kept until then.
+ */
+class CMaildirSummaries
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMaildirSummaries();
+
+    /**
+     * Destructor - cancels any refresh in progress.
+     */
+    ~CMaildirSummaries();
+
+    /**
+     * Replace the maildirs we summarize.  Their counts are found upon
+     * the calling thread, so the snapshot is complete immediately.
+     */
+    void set_maildirs(const CMaildirList &maildirs);
+
+    /**
+     * Get the snapshot, starting a refresh upon our workers if none is
+     * running and `interval` seconds have passed since the last began.
+     */
+    const std::vector<maildir_summary> &summaries(int interval);
+
+    /**
+     * Refresh at the next request, whatever the interval, as we've
+     * changed some of our maildirs ourselves.
+     */
+    void invalidate();
+
+    /**
+     * A number which changes whenever the snapshot does.
+     */
+    uint64_t generation();
+
+    /**
+     * Sort the given summaries case-insensitively by path.
+     */
+    static void sort(std::vector<maildir_summary> &summaries);
+
+private:
+
+    /**
+     * Find the counts of the given local maildirs, recounting only
+     * those which have been modified since they were last counted.
+     *
+     * This touches nothing but the filesystem, so may be run upon a
+     * worker.
+     */
+    static void count(std::vector<maildir_summary> &summaries, const CJobToken &token);
+
+    /**
+     * Replace our counts with the given ones, and copy those of our
+     * remote and virtual folders.  Returns true if any changed.
+     */
+    bool collect(std::vector<maildir_summary> &counted);
+
+private:
+
+    /**
+     * The snapshot.
+     */
+    std::vector<maildir_summary> m_summaries;
+
+    /**
+     * Changed whenever the snapshot is.
+     */
+    uint64_t m_generation;
+
+    /**
+     * When the last refresh began, and whether it's still running.
+     */
+    time_t m_refreshed;
+    bool m_refreshing;
+
+    /**
+     * Cancels the refresh in progress once our maildirs change.
+     */
+    CJobToken m_token;
+};
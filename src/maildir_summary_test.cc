@@ -0,0 +1,140 @@
+/*
+ * maildir_summary_test.cc - Test-cases for our summaries of maildirs.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "directory.h"
+#include "job_queue.h"
+#include "maildir_summary.h"
+#include "CuTest.h"
+
+
+/**
+ * Create an empty message.
+ */
+static void create(std::string path)
+{
+    std::fstream fs;
+    fs.open(path, std::fstream::out);
+    fs << "Subject: test\n\nBody\n";
+    fs.close();
+}
+
+
+/**
+ * Create a maildir.
+ */
+static std::shared_ptr<CMaildir> maildir(std::string path)
+{
+    CDirectory::mkdir_p(path + "/cur");
+    CDirectory::mkdir_p(path + "/new");
+    CDirectory::mkdir_p(path + "/tmp");
+
+    return (std::make_shared<CMaildir>(path));
+}
+
+
+/**
+ * Test our summaries are sorted, and counted, when they're created.
+ */
+void TestMaildirSummaries(CuTest * tc)
+{
+    char tmpl[] = "/tmp/summary.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(tmpl) != NULL);
+
+    std::string prefix = tmpl;
+
+    CMaildirList maildirs;
+    maildirs.push_back(maildir(prefix + "/sent"));
+    maildirs.push_back(maildir(prefix + "/INBOX"));
+    maildirs.push_back(maildir(prefix + "/Drafts"));
+
+    create(prefix + "/INBOX/new/1");
+    create(prefix + "/INBOX/cur/2:2,S");
+    create(prefix + "/INBOX/cur/3:2,");
+    create(prefix + "/sent/cur/4:2,S");
+
+    CMaildirSummaries summaries;
+    uint64_t generation = summaries.generation();
+
+    summaries.set_maildirs(maildirs);
+    CuAssertTrue(tc, summaries.generation() != generation);
+
+    const std::vector<maildir_summary> &all = summaries.summaries(60);
+    CuAssertIntEquals(tc, 3, all.size());
+
+    CuAssertStrEquals(tc, (prefix + "/Drafts").c_str(), all[0].path.c_str());
+    CuAssertStrEquals(tc, (prefix + "/INBOX").c_str(), all[1].path.c_str());
+    CuAssertStrEquals(tc, (prefix + "/sent").c_str(), all[2].path.c_str());
+
+    CuAssertIntEquals(tc, 0, all[0].total);
+    CuAssertIntEquals(tc, 3, all[1].total);
+    CuAssertIntEquals(tc, 2, all[1].unread);
+    CuAssertIntEquals(tc, 1, all[2].total);
+    CuAssertIntEquals(tc, 0, all[2].unread);
+
+    /*
+     * The maildirs are given the counts too.
+     */
+    CuAssertIntEquals(tc, 3, all[1].maildir->total_messages());
+    CuAssertIntEquals(tc, 2, all[1].maildir->unread_messages());
+
+    /*
+     * Changes are found once a refresh is due, upon our workers.
+     */
+    create(prefix + "/Drafts/cur/5:2,S");
+    generation = summaries.generation();
+
+    summaries.summaries(60);
+    CuAssertIntEquals(tc, 0, (int)CJobQueue::instance()->pending());
+    CuAssertIntEquals(tc, 0, summaries.summaries(60)[0].total);
+
+    summaries.invalidate();
+    summaries.summaries(60);
+
+    CJobQueue *queue = CJobQueue::instance();
+
+    while (queue->pending() > 0)
+    {
+        queue->wait();
+        queue->drain();
+    }
+
+    CuAssertTrue(tc, summaries.generation() != generation);
+    CuAssertIntEquals(tc, 1, summaries.summaries(60)[0].total);
+    CuAssertIntEquals(tc, 3, summaries.summaries(60)[1].total);
+
+    /*
+     * Cleanup.
+     */
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+CuSuite *
+maildir_summary_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMaildirSummaries);
+    return suite;
+}
@@ -0,0 +1,267 @@
+/*
+ * maildir_watcher.cc - Watch a maildir for changes.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__DragonFly__)
+#define HAVE_KQUEUE 1
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include "maildir_watcher.h"
+#include "util.h"
+
+
+/*
+ * Constructor.
+ */
+CMaildirWatcher::CMaildirWatcher()
+{
+    m_fd = -1;
+    m_watch[0] = m_watch[1] = -1;
+}
+
+
+/*
+ * Destructor.
+ */
+CMaildirWatcher::~CMaildirWatcher()
+{
+    unwatch();
+}
+
+
+/*
+ * Start watching the given maildir, replacing any previous watch.
+ */
+bool CMaildirWatcher::watch(std::string path)
+{
+    unwatch();
+
+    const char *subdirs[] = { "/cur/", "/new/" };
+
+    for (int i = 0; i < 2; i++)
+    {
+        /*
+         * Build the prefix in the same way as `CDirectory::entries`
+         * so our paths match those of the messages we report upon.
+         */
+        std::string p = path + subdirs[i];
+        p.erase(std::unique(p.begin(), p.end(), both_slashes()), p.end());
+        m_prefix[i] = p;
+    }
+
+#if defined(__linux__)
+
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (m_fd < 0)
+        return false;
+
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+    for (int i = 0; i < 2; i++)
+    {
+        m_watch[i] = inotify_add_watch(m_fd, m_prefix[i].c_str(), mask);
+
+        if (m_watch[i] < 0)
+        {
+            unwatch();
+            return false;
+        }
+    }
+
+#elif defined(HAVE_KQUEUE)
+
+    m_fd = kqueue();
+
+    if (m_fd < 0)
+        return false;
+
+    for (int i = 0; i < 2; i++)
+    {
+#ifdef O_EVTONLY
+        m_watch[i] = open(m_prefix[i].c_str(), O_EVTONLY);
+#else
+        m_watch[i] = open(m_prefix[i].c_str(), O_RDONLY);
+#endif
+
+        if (m_watch[i] < 0)
+        {
+            unwatch();
+            return false;
+        }
+
+        struct kevent ev;
+        EV_SET(&ev, m_watch[i], EVFILT_VNODE, EV_ADD | EV_CLEAR,
+               NOTE_WRITE | NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE, 0, NULL);
+
+        if (kevent(m_fd, &ev, 1, NULL, 0, NULL) < 0)
+        {
+            unwatch();
+            return false;
+        }
+    }
+
+#else
+
+    return false;
+
+#endif
+
+    m_path = path;
+    return true;
+}
+
+
+/*
+ * Stop watching.
+ */
+void CMaildirWatcher::unwatch()
+{
+#if defined(HAVE_KQUEUE)
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (m_watch[i] >= 0)
+            close(m_watch[i]);
+    }
+
+#endif
+
+    if (m_fd >= 0)
+        close(m_fd);
+
+    m_fd = -1;
+    m_watch[0] = m_watch[1] = -1;
+    m_path = "";
+}
+
+
+/*
+ * Are we currently watching a maildir?
+ */
+bool CMaildirWatcher::is_watching()
+{
+    return (m_fd >= 0);
+}
+
+
+/*
+ * Get the path of the maildir we're watching, if any.
+ */
+std::string CMaildirWatcher::path()
+{
+    return (m_path);
+}
+
+
+/*
+ * Append any pending changes to the given vector.
+ */
+bool CMaildirWatcher::poll(std::vector<maildir_change> &changes)
+{
+    if (m_fd < 0)
+        return false;
+
+#if defined(__linux__)
+
+    /*
+     * The buffer must be suitably aligned for `struct inotify_event`.
+     */
+    char buf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool exact = true;
+
+    while (true)
+    {
+        ssize_t len = read(m_fd, buf, sizeof(buf));
+
+        if (len <= 0)
+            break;
+
+        for (char *ptr = buf; ptr < buf + len;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            /*
+             * If the queue overflowed, or one of our directories went
+             * away, we can no longer trust our deltas.
+             */
+            if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+            {
+                exact = false;
+                continue;
+            }
+
+            if ((event->mask & IN_ISDIR) || (event->len == 0))
+                continue;
+
+            /*
+             * Dotfiles are never messages.
+             */
+            if (event->name[0] == '.')
+                continue;
+
+            int i = (event->wd == m_watch[0]) ? 0 : 1;
+
+            maildir_change change;
+            change.path  = m_prefix[i] + event->name;
+            change.added = (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0;
+            changes.push_back(change);
+        }
+    }
+
+    /*
+     * We can't recover from having lost events, so stop watching
+     * and let the caller rescan, and re-watch.
+     */
+    if (!exact)
+        unwatch();
+
+    return exact;
+
+#elif defined(HAVE_KQUEUE)
+
+    struct kevent events[4];
+    struct timespec zero = { 0, 0 };
+
+    int n = kevent(m_fd, NULL, 0, events, 4, &zero);
+
+    if (n == 0)
+        return true;
+
+    (void)changes;
+    return false;
+
+#else
+
+    (void)changes;
+    return false;
+
+#endif
+}
@@ -0,0 +1,125 @@
+/*
+ * maildir_watcher.h - Watch a maildir for changes.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <string>
+#include <vector>
+
+
+/**
+ * A single change to the contents of a watched maildir.
+ */
+typedef struct _maildir_change
+{
+    /**
+     * True if the file appeared, false if it went away.
+     */
+    bool added;
+
+    /**
+     * The full path of the message-file which changed.
+     */
+    std::string path;
+} maildir_change;
+
+
+/**
+ * This class watches the `cur/` and `new/` directories of a single
+ * local maildir, and reports the files which have been added, or removed,
+ * since it was last polled.
+ *
+ * Upon Linux this uses inotify, which gives us the exact names of the
+ * files which changed.  Upon the BSDs and Mac OS X we use kqueue, which
+ * only tells us that _something_ changed - so there every change is
+ * reported as requiring a rescan.
+ *
+ * Polling never blocks.
+ */
+class CMaildirWatcher
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMaildirWatcher();
+
+    /**
+     * Destructor.
+     */
+    ~CMaildirWatcher();
+
+    /**
+     * Start watching the given maildir, replacing any previous watch.
+     *
+     * Returns false if the maildir could not be watched.
+     */
+    bool watch(std::string path);
+
+    /**
+     * Stop watching.
+     */
+    void unwatch();
+
+    /**
+     * Are we currently watching a maildir?
+     */
+    bool is_watching();
+
+    /**
+     * Get the path of the maildir we're watching, if any.
+     */
+    std::string path();
+
+    /**
+     * Append any pending changes to the given vector.
+     *
+     * If this returns false the changes could not be determined
+     * precisely - for example because the kernel's event-queue overflowed,
+     * or the platform cannot tell us - and the caller must rescan the
+     * maildir.
+     */
+    bool poll(std::vector<maildir_change> &changes);
+
+private:
+
+    /**
+     * The maildir we're watching.
+     */
+    std::string m_path;
+
+    /**
+     * The inotify/kqueue handle, or -1.
+     */
+    int m_fd;
+
+    /**
+     * The watch-descriptors for `cur/` and `new/`.
+     *
+     * Under kqueue these are the open directory handles.
+     */
+    int m_watch[2];
+
+    /**
+     * The (normalized) path-prefixes of `cur/` and `new/`.
+     */
+    std::string m_prefix[2];
+};
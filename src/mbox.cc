@@ -0,0 +1,657 @@
+/*
+ * mbox.cc - Read-only access to the messages of mbox-files.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "directory.h"
+#include "maildir_index.h"
+#include "mbox.h"
+
+
+/*
+ * The version of our index-files.
+ */
+#define MBOX_INDEX_VERSION 1
+
+
+/*
+ * The indexes we've loaded, by the path of their mbox.
+ *
+ * Indexes are built, and written, beneath a separate lock so that
+ * looking up messages isn't held up by them.
+ */
+static std::unordered_map<std::string, std::shared_ptr<const mbox_index> > g_loaded;
+static std::mutex g_lock;
+static std::mutex g_build;
+
+
+/*
+ * Is the given path an mbox-file?
+ */
+bool CMbox::is_mbox(const std::string &path)
+{
+    struct stat sb;
+
+    if ((stat(path.c_str(), &sb) != 0) || ! S_ISREG(sb.st_mode))
+        return false;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return false;
+
+    char buf[5];
+    bool found = (pread(fd, buf, sizeof(buf), 0) == (ssize_t) sizeof(buf)) &&
+                 (memcmp(buf, "From ", 5) == 0);
+
+    close(fd);
+    return (found);
+}
+
+
+/*
+ * Find the flags recorded in the given header-block.
+ */
+static uint32_t header_flags(const char *data, size_t size)
+{
+    uint32_t flags = 0;
+    size_t pos = 0;
+
+    while (pos < size)
+    {
+        const char *line = data + pos;
+        const char *eol  = (const char *) memchr(line, '\n', size - pos);
+        size_t len       = eol ? (size_t)(eol - line) : size - pos;
+        const char *value = NULL;
+        bool extended = false;
+
+        if ((len >= 7) && (strncasecmp(line, "Status:", 7) == 0))
+            value = line + 7;
+        else if ((len >= 9) && (strncasecmp(line, "X-Status:", 9) == 0))
+        {
+            value = line + 9;
+            extended = true;
+        }
+
+        for (const char *c = value; c && (c < line + len); c++)
+        {
+            if (! extended && (*c == 'R'))
+                flags |= MBOX_SEEN;
+            else if (extended && (*c == 'A'))
+                flags |= MBOX_REPLIED;
+            else if (extended && (*c == 'F'))
+                flags |= MBOX_FLAGGED;
+            else if (extended && (*c == 'D'))
+                flags |= MBOX_TRASHED;
+        }
+
+        pos += len + 1;
+    }
+
+    return (flags);
+}
+
+
+/*
+ * Does the line at the given offset look like the `From ` line which
+ * begins a message, such as "From steve@example.com Mon Jan  4 10:00:00 2016"?
+ *
+ * Body lines which begin "From " are meant to be quoted, but not every
+ * program does so - so we insist upon the time of delivery too.
+ */
+static bool from_line(const char *data, size_t size, uint64_t offset)
+{
+    if ((offset + 5 > size) || (memcmp(data + offset, "From ", 5) != 0))
+        return false;
+
+    const char *line = data + offset;
+    const char *eol  = (const char *) memchr(line, '\n', size - offset);
+    size_t len       = eol ? (size_t)(eol - line) : size - offset;
+
+    for (size_t i = 5; i + 3 < len; i++)
+    {
+        if (isdigit((unsigned char) line[i]) && (line[i + 1] == ':') &&
+                isdigit((unsigned char) line[i + 2]) && isdigit((unsigned char) line[i + 3]))
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Find the messages within the given mapping of an mbox-file.
+ */
+void CMbox::scan(const char *data, size_t size, uint64_t from,
+                 std::vector<mbox_entry> &entries)
+{
+    /*
+     * Messages are separated by a blank line followed by a `From `
+     * line, so a body line which merely begins with "From " - having
+     * escaped quoting - doesn't split its message unless it follows a
+     * blank line and looks like a real `From ` line.
+     */
+    static const char separator[] = "\n\nFrom ";
+    static const char crlf_separator[] = "\n\r\nFrom ";
+
+    uint64_t offset = from;
+
+    while (from_line(data, size, offset))
+    {
+        const char *eol = (const char *) memchr(data + offset, '\n', size - offset);
+
+        mbox_entry entry;
+        entry.offset   = offset;
+        entry.start    = eol ? (uint64_t)(eol - data) + 1 : size;
+        entry.flags    = 0;
+        entry.reserved = 0;
+
+        /*
+         * The message ends with the newline before the blank line which
+         * precedes the next `From ` line, if there is one.
+         */
+        const char *rest = data + entry.start;
+        uint64_t end  = size;
+        uint64_t next = size;
+        uint64_t pos  = entry.start;
+
+        while (pos < size)
+        {
+            const char *lf   = (const char *) memmem(data + pos, size - pos, separator, sizeof(separator) - 1);
+            const char *crlf = (const char *) memmem(data + pos, size - pos, crlf_separator, sizeof(crlf_separator) - 1);
+            uint64_t at;
+
+            if (crlf && (! lf || (crlf < lf)))
+            {
+                end = (crlf - data) + 1;
+                at  = end + 2;
+            }
+            else if (lf)
+            {
+                end = (lf - data) + 1;
+                at  = end + 1;
+            }
+            else
+            {
+                end = size;
+                break;
+            }
+
+            if (from_line(data, size, at))
+            {
+                next = at;
+                break;
+            }
+
+            end = size;
+            pos = at;
+        }
+
+        entry.length = end - entry.start;
+
+        /*
+         * The flags are found from the headers alone.
+         */
+        const char *headers = (const char *) memmem(rest, entry.length, "\n\n", 2);
+        size_t header_size = headers ? (size_t)(headers - rest) : entry.length;
+
+        entry.flags = header_flags(rest, header_size);
+        entries.push_back(entry);
+
+        offset = next;
+    }
+}
+
+
+/*
+ * The path of the given message.
+ */
+std::string CMbox::path(const std::string &mbox, const mbox_entry &entry)
+{
+    std::string flags;
+
+    if (entry.flags & MBOX_FLAGGED)
+        flags += "F";
+
+    if (entry.flags & MBOX_REPLIED)
+        flags += "R";
+
+    if (entry.flags & MBOX_SEEN)
+        flags += "S";
+
+    if (entry.flags & MBOX_TRASHED)
+        flags += "T";
+
+    return (mbox + "/" + std::to_string(entry.offset) + ",S=" +
+            std::to_string(entry.length) + ":2," + flags);
+}
+
+
+/*
+ * The file holding the index of the given mbox.
+ */
+std::string CMbox::index_file(const std::string &mbox)
+{
+    std::string file = CMaildirIndex::index_file(mbox);
+
+    if (file.empty())
+        return "";
+
+    return (file + ".mbox");
+}
+
+
+/*
+ * Read the given index-file.
+ */
+std::shared_ptr<mbox_index> CMbox::read_index(const std::string &file)
+{
+    std::shared_ptr<mbox_index> index;
+
+    FILE *fp = fopen(file.c_str(), "rb");
+
+    if (fp == NULL)
+        return (index);
+
+    mbox_header header;
+
+    if ((fread(&header, sizeof(header), 1, fp) == 1) &&
+            (memcmp(header.magic, "LMBX", 4) == 0) &&
+            (header.version == MBOX_INDEX_VERSION))
+    {
+        index = std::make_shared<mbox_index>();
+        index->inode = header.inode;
+        index->size  = header.size;
+        index->mtime = header.mtime;
+        index->entries.resize(header.count);
+
+        if ((header.count > 0) &&
+                (fread(&index->entries[0], sizeof(mbox_entry), header.count, fp) != header.count))
+            index.reset();
+    }
+
+    fclose(fp);
+    return (index);
+}
+
+
+/*
+ * Write the given index-file.
+ */
+bool CMbox::write_index(const std::string &file, const mbox_index &index)
+{
+    mbox_header header;
+    memcpy(header.magic, "LMBX", 4);
+    header.version  = MBOX_INDEX_VERSION;
+    header.count    = index.entries.size();
+    header.reserved = 0;
+    header.inode    = index.inode;
+    header.size     = index.size;
+    header.mtime    = index.mtime;
+
+    /*
+     * Write to a temporary file, and rename it into place, so readers
+     * never see a partial index.
+     */
+    CDirectory::mkdir_p(file.substr(0, file.find_last_of('/')));
+
+    std::string tmp = file + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+
+    if (fp == NULL)
+        return false;
+
+    bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+    if (ok && ! index.entries.empty())
+        ok = (fwrite(&index.entries[0], sizeof(mbox_entry), index.entries.size(), fp) == index.entries.size());
+
+    ok = (fclose(fp) == 0) && ok;
+
+    if (! ok || (rename(tmp.c_str(), file.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Get the index of the given mbox-file.
+ */
+std::shared_ptr<const mbox_index> CMbox::load(const std::string &mbox)
+{
+    std::shared_ptr<const mbox_index> result;
+    struct stat sb;
+
+    if (stat(mbox.c_str(), &sb) != 0)
+        return (result);
+
+    /*
+     * The index we have is current if the file hasn't changed.
+     */
+    auto current = [&sb](const mbox_index & index)
+    {
+        return ((index.inode == (uint64_t) sb.st_ino) &&
+                (index.size == (int64_t) sb.st_size) &&
+                (index.mtime == (int64_t) sb.st_mtime));
+    };
+
+    {
+        std::lock_guard<std::mutex> guard(g_lock);
+        auto it = g_loaded.find(mbox);
+
+        if ((it != g_loaded.end()) && current(*it->second))
+            return (it->second);
+    }
+
+    std::lock_guard<std::mutex> build(g_build);
+
+    /*
+     * Another thread might have built it whilst we waited.
+     */
+    {
+        std::lock_guard<std::mutex> guard(g_lock);
+        auto it = g_loaded.find(mbox);
+
+        if ((it != g_loaded.end()) && current(*it->second))
+            return (it->second);
+    }
+
+    std::string file = index_file(mbox);
+    std::shared_ptr<mbox_index> index = file.empty() ? NULL : read_index(file);
+
+    /*
+     * Without an index upon disk, the one we loaded before may still be
+     * extended.
+     */
+    if (! index)
+    {
+        std::lock_guard<std::mutex> guard(g_lock);
+        auto it = g_loaded.find(mbox);
+
+        if (it != g_loaded.end())
+            index = std::make_shared<mbox_index>(*it->second);
+    }
+
+    if (! index || ! current(*index))
+    {
+        int fd = open(mbox.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd == -1)
+            return (result);
+
+        if ((fstat(fd, &sb) != 0))
+        {
+            close(fd);
+            return (result);
+        }
+
+        void *map = NULL;
+
+        if (sb.st_size > 0)
+        {
+            map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (map == MAP_FAILED)
+            {
+                close(fd);
+                return (result);
+            }
+        }
+
+        close(fd);
+
+        const char *data = (const char *) map;
+
+        /*
+         * If the file has only grown, and its last message is still
+         * where it was, then only that message, and those after it,
+         * need be found again.
+         */
+        uint64_t from = 0;
+
+        if (index && (index->inode == (uint64_t) sb.st_ino) &&
+                (index->size <= (int64_t) sb.st_size) && ! index->entries.empty())
+        {
+            uint64_t last = index->entries.back().offset;
+
+            if (from_line(data, sb.st_size, last))
+            {
+                index->entries.pop_back();
+                from = last;
+            }
+            else
+                index->entries.clear();
+        }
+        else if (index)
+            index->entries.clear();
+        else
+            index = std::make_shared<mbox_index>();
+
+        if (map != NULL)
+        {
+            scan(data, sb.st_size, from, index->entries);
+            munmap(map, sb.st_size);
+        }
+
+        index->inode = sb.st_ino;
+        index->size  = sb.st_size;
+        index->mtime = sb.st_mtime;
+
+        if (! file.empty())
+            write_index(file, *index);
+    }
+
+    result = index;
+
+    std::lock_guard<std::mutex> guard(g_lock);
+    g_loaded[mbox] = result;
+    return (result);
+}
+
+
+/*
+ * The paths of the messages within the given mbox-file.
+ */
+std::vector<std::string> CMbox::messages(const std::string &mbox)
+{
+    std::vector<std::string> paths;
+    std::shared_ptr<const mbox_index> index = load(mbox);
+
+    if (! index)
+        return (paths);
+
+    paths.reserve(index->entries.size());
+
+    for (const mbox_entry &entry : index->entries)
+        paths.push_back(path(mbox, entry));
+
+    return (paths);
+}
+
+
+/*
+ * Count the messages within the given mbox-file.
+ */
+void CMbox::count(const std::string &mbox, int &total, int &unread)
+{
+    total  = 0;
+    unread = 0;
+
+    std::shared_ptr<const mbox_index> index = load(mbox);
+
+    if (! index)
+        return;
+
+    for (const mbox_entry &entry : index->entries)
+    {
+        total++;
+
+        if (! (entry.flags & MBOX_SEEN))
+            unread++;
+    }
+}
+
+
+/*
+ * Find the mbox, and region, holding the message with the given path.
+ */
+bool CMbox::locate(const std::string &path, std::string &mbox,
+                   uint64_t &start, uint64_t &length)
+{
+    size_t slash = path.rfind('/');
+
+    if ((slash == std::string::npos) || (slash + 1 >= path.size()) ||
+            ! isdigit((unsigned char) path[slash + 1]))
+        return false;
+
+    char *end = NULL;
+    uint64_t offset = strtoull(path.c_str() + slash + 1, &end, 10);
+
+    if ((*end != ',') && (*end != ':') && (*end != '\0'))
+        return false;
+
+    std::shared_ptr<const mbox_index> index;
+
+    {
+        std::lock_guard<std::mutex> guard(g_lock);
+        auto it = g_loaded.find(path.substr(0, slash));
+
+        if (it == g_loaded.end())
+            return false;
+
+        index = it->second;
+    }
+
+    auto it = std::lower_bound(index->entries.begin(), index->entries.end(), offset,
+                               [](const mbox_entry & e, uint64_t o)
+    {
+        return (e.offset < o);
+    });
+
+    if ((it == index->entries.end()) || (it->offset != offset))
+        return false;
+
+    mbox   = path.substr(0, slash);
+    start  = it->start;
+    length = it->length;
+    return true;
+}
+
+
+/*
+ * Is the given path that of a message within an mbox?
+ */
+bool CMbox::is_message(const std::string &path)
+{
+    std::string mbox;
+    uint64_t start, length;
+
+    return (locate(path, mbox, start, length));
+}
+
+
+/*
+ * Write the given message to the given file.
+ */
+bool CMbox::extract(const std::string &path, const std::string &dst)
+{
+    std::string mbox;
+    uint64_t start, length;
+
+    if (! locate(path, mbox, start, length))
+        return false;
+
+    int in = open(mbox.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (in == -1)
+        return false;
+
+    int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if (out == -1)
+    {
+        close(in);
+        return false;
+    }
+
+    std::vector<char> buf(1024 * 1024);
+    uint64_t done = 0;
+    bool ok = true;
+
+    while (ok && (done < length))
+    {
+        size_t want = std::min((uint64_t) buf.size(), length - done);
+        ssize_t len = pread(in, &buf[0], want, start + done);
+
+        if ((len < 0) && (errno == EINTR))
+            continue;
+
+        if (len <= 0)
+        {
+            ok = false;
+            break;
+        }
+
+        ssize_t written = 0;
+
+        while (written < len)
+        {
+            ssize_t w = write(out, &buf[written], len - written);
+
+            if ((w < 0) && (errno == EINTR))
+                continue;
+
+            if (w < 0)
+            {
+                ok = false;
+                break;
+            }
+
+            written += w;
+        }
+
+        done += len;
+    }
+
+    close(in);
+
+    if (close(out) != 0)
+        ok = false;
+
+    if (! ok)
+        unlink(dst.c_str());
+
+    return (ok);
+}
@@ -0,0 +1,177 @@
+/*
+ * mbox.h - Read-only access to the messages of mbox-files.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+/**
+ * Bits of `mbox_entry.flags`, found from the `Status:` and `X-Status:`
+ * headers of each message.
+ */
+#define MBOX_SEEN    0x01
+#define MBOX_REPLIED 0x02
+#define MBOX_FLAGGED 0x04
+#define MBOX_TRASHED 0x08
+
+
+/**
+ * A single message within an mbox-file.
+ *
+ * `offset` is that of its `From ` line, and `start` that of the message
+ * itself, which is `length` bytes long.  This is also the form in which
+ * entries are persisted.
+ */
+typedef struct _mbox_entry
+{
+    uint64_t offset;
+    uint64_t start;
+    uint64_t length;
+    uint32_t flags;
+    uint32_t reserved;
+} mbox_entry;
+
+
+/**
+ * The on-disk header of the index of an mbox-file.
+ */
+typedef struct _mbox_header
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t inode;
+    int64_t  size;
+    int64_t  mtime;
+} mbox_header;
+
+
+/**
+ * The messages of an mbox-file, and the state of the file when they
+ * were found.
+ */
+typedef struct _mbox_index
+{
+    std::vector<mbox_entry> entries;
+    uint64_t inode;
+    int64_t size;
+    int64_t mtime;
+} mbox_index;
+
+
+/**
+ * This class allows mbox-files to be opened as folders, without their
+ * messages being converted into maildirs.
+ *
+ * The file is memory-mapped, and its `From ` lines found once, to build
+ * an index of the offset of each message.  The index is written beneath
+ * `index.cache`, and reused until the file changes - when only messages
+ * appended since are looked for.
+ *
+ * Each message is known by a path beneath that of the mbox, which can
+ * never exist upon disk, such as `/archive/2009.mbox/1234,S=567:2,S` -
+ * the offset of its `From ` line, its size, and its flags.  Messages
+ * are parsed directly from their region of the file.
+ *
+ * mbox-files are read-only: messages may be copied out of them, but
+ * not saved into them, deleted, or have their flags changed.
+ *
+ * The indexes we've loaded are shared, so every member is safe to call
+ * from any thread.
+ */
+class CMbox
+{
+public:
+
+    /**
+     * Is the given path an mbox-file?
+     */
+    static bool is_mbox(const std::string &path);
+
+    /**
+     * Get the index of the given mbox-file, building it if it has
+     * changed since it was last built, or returning NULL if the file
+     * can't be read.
+     */
+    static std::shared_ptr<const mbox_index> load(const std::string &mbox);
+
+    /**
+     * The paths of the messages within the given mbox-file.
+     */
+    static std::vector<std::string> messages(const std::string &mbox);
+
+    /**
+     * Count the messages, and unread messages, within the given
+     * mbox-file.
+     */
+    static void count(const std::string &mbox, int &total, int &unread);
+
+    /**
+     * Is the given path that of a message within an mbox we've loaded?
+     * If so find the mbox, and the region of it holding the message.
+     */
+    static bool locate(const std::string &path, std::string &mbox,
+                       uint64_t &start, uint64_t &length);
+
+    /**
+     * Is the given path that of a message within an mbox?
+     */
+    static bool is_message(const std::string &path);
+
+    /**
+     * Write the message with the given path to the file `dst`.
+     */
+    static bool extract(const std::string &path, const std::string &dst);
+
+    /**
+     * Find the messages within the given mapping of an mbox-file,
+     * appending them to the given list.
+     */
+    static void scan(const char *data, size_t size, uint64_t from,
+                     std::vector<mbox_entry> &entries);
+
+    /**
+     * The path of the given message within the given mbox.
+     */
+    static std::string path(const std::string &mbox, const mbox_entry &entry);
+
+    /**
+     * The file holding the index of the given mbox, or "" if we're not
+     * persisting them.
+     */
+    static std::string index_file(const std::string &mbox);
+
+private:
+
+    /**
+     * Read the given index-file, returning NULL if it can't be read.
+     */
+    static std::shared_ptr<mbox_index> read_index(const std::string &file);
+
+    /**
+     * Write the given index-file.
+     */
+    static bool write_index(const std::string &file, const mbox_index &index);
+};
@@ -0,0 +1,188 @@
+/*
+ * mbox_test.cc - Test-cases for our mbox-files.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "config.h"
+#include "mbox.h"
+#include "CuTest.h"
+
+
+/**
+ * Create a file, or append to it.
+ */
+static void create(std::string path, std::string content, bool append = false)
+{
+    std::fstream fs;
+    fs.open(path, append ? (std::fstream::out | std::fstream::app) : std::fstream::out);
+    fs << content;
+    fs.close();
+}
+
+
+/**
+ * Read a file.
+ */
+static std::string read(std::string path)
+{
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return (ss.str());
+}
+
+
+/**
+ * Test that messages are found within a mapping, with their flags.
+ */
+void TestMboxScan(CuTest * tc)
+{
+    std::string data =
+        "From steve@example.com Mon Jan  4 10:00:00 2016\n"
+        "Subject: one\n"
+        "Status: RO\n"
+        "\n"
+        "From the body, this isn't a new message.\n"
+        "\n"
+        "From bob@example.com Mon Jan  4 11:00:00 2016\n"
+        "Subject: two\n"
+        "X-Status: AF\n"
+        "\n"
+        "Body\n";
+
+    std::vector<mbox_entry> entries;
+    CMbox::scan(data.c_str(), data.size(), 0, entries);
+
+    CuAssertIntEquals(tc, 2, entries.size());
+
+    std::string first = data.substr(entries[0].start, entries[0].length);
+    CuAssertTrue(tc, first.find("Subject: one\n") == 0);
+    CuAssertTrue(tc, first.find("isn't a new message.\n") != std::string::npos);
+    CuAssertTrue(tc, first[first.size() - 1] == '\n');
+    CuAssertTrue(tc, first.find("bob@") == std::string::npos);
+    CuAssertIntEquals(tc, MBOX_SEEN, entries[0].flags);
+
+    std::string second = data.substr(entries[1].start, entries[1].length);
+    CuAssertTrue(tc, second.find("Subject: two\n") == 0);
+    CuAssertIntEquals(tc, MBOX_REPLIED | MBOX_FLAGGED, entries[1].flags);
+
+    /*
+     * The flags are in the form of a maildir.
+     */
+    CuAssertStrEquals(tc, ("/a.mbox/" + std::to_string(entries[1].offset) + ",S=" +
+                           std::to_string(entries[1].length) + ":2,FR").c_str(),
+                      CMbox::path("/a.mbox", entries[1]).c_str());
+
+    /*
+     * Files which aren't mboxes hold nothing.
+     */
+    entries.clear();
+    CMbox::scan("Subject: x\n", 11, 0, entries);
+    CuAssertIntEquals(tc, 0, entries.size());
+}
+
+
+/**
+ * Test that mbox-files are indexed, and their messages found and
+ * extracted.
+ */
+void TestMboxFile(CuTest * tc)
+{
+    char tmpl[] = "/tmp/mbox.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string dir  = tmpl;
+    std::string mbox = dir + "/test.mbox";
+
+    CConfig *config = CConfig::instance();
+    config->set("index.cache", dir + "/index", false);
+
+    create(mbox,
+           "From a@example.com Mon Jan  4 10:00:00 2016\n"
+           "Subject: one\n"
+           "\n"
+           "First\n"
+           "\n"
+           "From b@example.com Mon Jan  4 11:00:00 2016\n"
+           "Subject: two\n"
+           "Status: RO\n"
+           "\n"
+           "Second\n");
+
+    CuAssertTrue(tc, CMbox::is_mbox(mbox));
+    CuAssertTrue(tc, ! CMbox::is_mbox(dir));
+    CuAssertTrue(tc, ! CMbox::is_mbox(dir + "/missing"));
+
+    int total, unread;
+    CMbox::count(mbox, total, unread);
+    CuAssertIntEquals(tc, 2, total);
+    CuAssertIntEquals(tc, 1, unread);
+
+    std::vector<std::string> paths = CMbox::messages(mbox);
+    CuAssertIntEquals(tc, 2, paths.size());
+    CuAssertTrue(tc, CMbox::is_message(paths[1]));
+    CuAssertTrue(tc, ! CMbox::is_message(mbox + "/12345,S=1:2,"));
+    CuAssertTrue(tc, ! CMbox::is_message(dir + "/cur/1234.host:2,S"));
+
+    CuAssertTrue(tc, CMbox::extract(paths[1], dir + "/out"));
+    CuAssertStrEquals(tc, "Subject: two\nStatus: RO\n\nSecond\n", read(dir + "/out").c_str());
+
+    /*
+     * The index is written, and reused.
+     */
+    CuAssertTrue(tc, access(CMbox::index_file(mbox).c_str(), R_OK) == 0);
+
+    /*
+     * Appended messages are found, and the earlier ones are unchanged.
+     */
+    create(mbox,
+           "\n"
+           "From c@example.com Mon Jan  4 12:00:00 2016\n"
+           "Subject: three\n"
+           "\n"
+           "Third\n", true);
+
+    std::vector<std::string> more = CMbox::messages(mbox);
+    CuAssertIntEquals(tc, 3, more.size());
+    CuAssertStrEquals(tc, paths[0].c_str(), more[0].c_str());
+
+    CuAssertTrue(tc, CMbox::extract(more[1], dir + "/out"));
+    CuAssertStrEquals(tc, "Subject: two\nStatus: RO\n\nSecond\n", read(dir + "/out").c_str());
+    CuAssertTrue(tc, CMbox::extract(more[2], dir + "/out"));
+    CuAssertStrEquals(tc, "Subject: three\n\nThird\n", read(dir + "/out").c_str());
+
+    config->delete_key("index.cache");
+
+    std::string cmd = "rm -rf " + dir;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+CuSuite *
+mbox_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMboxScan);
+    SUITE_ADD_TEST(suite, TestMboxFile);
+    return suite;
+}
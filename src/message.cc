@@ -18,6 +18,7 @@
 
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <fcntl.h>
 #include <fstream>
@@ -25,6 +26,7 @@
 #include <string.h>
 #include <string>
 #include <sstream>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -41,27 +43,48 @@
 
 
 
+#include "approxidate.h"
+#include "compression.h"
 #include "config.h"
+#include "durability.h"
 #include "file.h"
 #include "global_state.h"
+#include "imap_cache.h"
 #include "imap_proxy.h"
+#include "logger.h"
 #include "json/json.h"
 #include "lua.h"
 #include "maildir.h"
+#include "mbox.h"
 #include "message.h"
 #include "message_part.h"
+#include "message_replace.h"
 #include "mime.h"
+#include "part_cache.h"
 #include "util.h"
 
 
 /*
  * Constructor.
  */
-CMessage::CMessage(const std::string name, bool is_local)
+CMessage::CMessage(const std::string name, bool is_local, CMessageArena *arena)
 {
-    m_path = name;
-    m_time = 0;
-    m_imap = !is_local;
+    m_arena = arena;
+    m_path.assign(name, m_arena);
+    m_imap_id = 0;
+    m_time  = 0;
+    m_imap  = !is_local;
+    m_inode = 0;
+    m_size  = -1;
+    m_mtime = -1;
+    m_ctime = 0;
+    m_ctime_known = false;
+    m_attachments = -1;
+    m_attachments_seeded = false;
+    m_seeded_complete = false;
+    m_flags = 0;
+    m_flags_known = false;
+    m_parts_cached = false;
 }
 
 
@@ -73,7 +96,7 @@ std::string CMessage::path()
     if (m_imap)
         lazy_load();
 
-    return (m_path);
+    return (m_path.str());
 }
 
 
@@ -82,7 +105,20 @@ std::string CMessage::path()
  */
 void CMessage::path(std::string new_path)
 {
-    m_path = new_path;
+    m_path.assign(new_path, m_arena);
+    m_flags_known = false;
+
+    /*
+     * Parts which have yet to be decoded need to find their content
+     * under the new name.
+     */
+    std::shared_ptr<const CParsedMessage> parsed = std::atomic_load(&m_parsed);
+
+    if (parsed)
+    {
+        for (std::shared_ptr<CMessagePart> part : parsed->parts)
+            part->set_source(new_path);
+    }
 }
 
 
@@ -91,87 +127,326 @@ void CMessage::path(std::string new_path)
  */
 std::string CMessage::header(std::string name)
 {
-    std::unordered_map < std::string, std::string > h = headers();
+    return (header_ref(name));
+}
+
+
+/*
+ * Return a reference to the value of a given header.
+ */
+const std::string &CMessage::header_ref(const std::string &name)
+{
+    static const std::string empty;
 
     /*
-     * Lower-case the header we were given.
+     * Lower-case the header we were given - avoiding a copy in
+     * the common case where it already is.
      */
-    std::transform(name.begin(), name.end(), name.begin(), tolower);
+    std::string lower;
+    const std::string *key = &name;
+
+    if (std::any_of(name.begin(), name.end(), ::isupper))
+    {
+        lower = name;
+        std::transform(lower.begin(), lower.end(), lower.begin(), tolower);
+        key = &lower;
+    }
 
     /*
-     * Lookup the value.
+     * If we've not parsed the message, but the header was seeded,
+     * we can avoid parsing it.
      */
-    return (h[name]);
+    std::shared_ptr<const CHeaderList> headers = parsed_headers();
+
+    if (! headers)
+    {
+        const std::string *seeded = find_header(m_seeded, *key);
+
+        if (seeded != NULL)
+            return (*seeded);
+
+        if (m_seeded_complete)
+            return (empty);
+
+        populate_headers();
+
+        if (!(headers = parsed_headers()))
+            return (empty);
+    }
+
+    /*
+     * Our headers are never replaced once published, so the value
+     * remains valid for as long as we do.
+     */
+    const std::string *value = find_header(*headers, *key);
+
+    return (value ? *value : empty);
 }
 
 
 /*
- * Parse a MIME message and return an object suitable for operating
- * upon.
+ * Find the named header in the given list.
  */
-GMimeMessage * CMessage::parse_message()
+const std::string *CMessage::find_header(const CHeaderList &list, const std::string &name)
 {
+    auto it = std::lower_bound(list.begin(), list.end(), name,
+                               [](const std::pair<CInterned, CHeaderValue> &entry, const std::string & key)
+    {
+        return (entry.first.str() < key);
+    });
 
-    /*
-     * If we're an IMAP-messge then we need to ensure
-     * that our file exists locally.
-     */
-    if (m_imap)
-        lazy_load();
+    if ((it != list.end()) && (it->first.str() == name))
+        return (&it->second.str());
 
-    int result __attribute__((unused));
+    return (NULL);
+}
 
-    GMimeMessage * message;
-    GMimeParser *parser;
-    GMimeStream *stream;
-    int fd;
 
-    /*
-     * The filename we'll operate upon.
-     */
-    std::string file = path();
-    bool replaced = false;
+/*
+ * Set the named header in the given list, replacing any existing value.
+ */
+void CMessage::set_header(CHeaderList &list, const std::string &name, const std::string &value)
+{
+    auto it = std::lower_bound(list.begin(), list.end(), name,
+                               [](const std::pair<CInterned, CHeaderValue> &entry, const std::string & key)
+    {
+        return (entry.first.str() < key);
+    });
+
+    if ((it != list.end()) && (it->first.str() == name))
+        it->second = CHeaderValue::make(it->first, value);
+    else
+    {
+        CInterned interned(name);
+        list.insert(it, std::make_pair(interned, CHeaderValue::make(interned, value)));
+    }
+}
+
+
+/*
+ * The headers whose values we intern - those naming the people, and
+ * lists, we correspond with, and the software they use.
+ */
+bool CHeaderValue::shared(const CInterned &name)
+{
+    static const CInterned names[] =
+    {
+        "cc", "content-transfer-encoding", "content-type", "delivered-to",
+        "from", "list-archive", "list-help", "list-id", "list-post",
+        "list-subscribe", "list-unsubscribe", "mailing-list", "mime-version",
+        "organization", "precedence", "reply-to", "return-path", "sender",
+        "to", "user-agent", "x-mailer", "x-original-to"
+    };
+
+    for (const CInterned &shared : names)
+    {
+        if (shared == name)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Create the value of the named header.
+ */
+CHeaderValue CHeaderValue::make(const CInterned &name, const std::string &value)
+{
+    if (shared(name))
+        return (CHeaderValue(CInterned(value)));
+
+    return (CHeaderValue(value));
+}
+
+
+/*
+ * Seed some of our headers, from a cached source.
+ */
+void CMessage::seed_headers(CHeaderList headers, bool complete)
+{
+    std::sort(headers.begin(), headers.end(),
+              [](const std::pair<CInterned, CHeaderValue> &a, const std::pair<CInterned, CHeaderValue> &b)
+    {
+        return (a.first < b.first);
+    });
 
     /*
-     * There is a Lua filter which *might* return an *updated* path to
-     * use.
+     * Our caller may have given values which we'd intern.
      */
-    CLua *lua = CLua::instance();
+    for (auto it = headers.begin(); it != headers.end(); ++it)
+    {
+        if (CHeaderValue::shared(it->first))
+            it->second = CInterned(it->second.str());
+    }
 
-    if (lua->function_exists("message_replace"))
+    m_seeded.swap(headers);
+    m_seeded_complete = complete && ! m_seeded.empty();
+}
+
+
+/*
+ * Do we know our headers already?
+ */
+bool CMessage::headers_known()
+{
+    return (parsed_headers() || (! m_seeded.empty()));
+}
+
+
+/*
+ * The bytes of the header values in the given list, which aren't interned.
+ */
+static size_t list_bytes(const CHeaderList &list)
+{
+    size_t total = list.capacity() * sizeof(CHeaderList::value_type);
+
+    for (auto it = list.begin(); it != list.end(); ++it)
     {
-        std::string updated = lua->function2string("message_replace", file);
+        if (! CHeaderValue::shared(it->first))
+            total += it->second.size();
+    }
 
-        if (! updated.empty())
-        {
-            file = updated;
-            replaced = true;
-        }
+    return (total);
+}
+
+
+/*
+ * The bytes of header values we hold.
+ */
+size_t CMessage::header_bytes()
+{
+    size_t total = list_bytes(m_seeded);
+    std::shared_ptr<const CHeaderList> headers = parsed_headers();
+
+    if (headers)
+        total += list_bytes(*headers);
+
+    return (total);
+}
+
+
+/*
+ * Incremented whenever the flags of any message change.
+ */
+static std::atomic < uint64_t > g_flags_generation(0);
+
+
+/*
+ * Map the given region of a file as a GMime stream, returning NULL on
+ * failure.  An `end` of -1 maps to the end of the file.
+ *
+ * The stream is given its own duplicate of the descriptor, and owns it,
+ * so that the mapping is released - and the duplicate closed - when the
+ * last reference to the stream goes away.  Marking the stream as not
+ * owning the caller's descriptor would leak the mapping instead.
+ */
+static GMimeStream *map_stream(int fd, off_t start, off_t end)
+{
+    int copy = dup(fd);
+
+    if (copy < 0)
+        return (NULL);
+
+    GMimeStream *stream = g_mime_stream_mmap_new_with_bounds(copy, PROT_READ, MAP_PRIVATE, start, end);
+
+    if (stream == NULL)
+    {
+        close(copy);
+        return (NULL);
     }
 
+    GMIME_STREAM_MMAP(stream)->owner = TRUE;
+    return (stream);
+}
+
 
-    if ((fd = open(file.c_str(), O_RDONLY, 0)) == -1)
+/*
+ * Open a GMime stream reading the given file from the specified offset.
+ *
+ * We prefer to memory-map the file, falling back to reading it via
+ * an ordinary file-stream if that fails - as it will for empty files,
+ * or upon systems where GMime was built without mmap support.
+ *
+ * Compressed files are read through a filter which decompresses them,
+ * so they're never mapped, and `offset` is within their content.
+ *
+ * In each case the caller keeps ownership of `fd`.  `mapped` is set to
+ * show whether we mapped the file.
+ */
+GMimeStream *CMessage::open_stream(int fd, off_t offset, bool *mapped)
+{
+    if (CCompression::is_compressed(fd))
     {
+        *mapped = false;
 
-        std::string error = strerror(errno);
-        CLua *lua = CLua::instance();
+        lseek(fd, 0, SEEK_SET);
 
-        if (CFile::exists(path()))
-            lua->on_error("Failed to open the existing message file:" + path() + " " + error);
-        else
-            lua->on_error("Failed to open the message file - not found :" + path() + " " + error);
+        GMimeStream *file = g_mime_stream_fs_new(fd);
+        g_mime_stream_fs_set_owner((GMimeStreamFs*)file, FALSE);
 
-        if (replaced == true)
-            CFile::delete_file(file);
+        GMimeStream *stream = g_mime_stream_filter_new(file);
+        g_object_unref(file);
 
-        return (NULL);
+        GMimeFilter *unzip = g_mime_filter_gzip_new(GMIME_FILTER_GZIP_MODE_UNZIP, 0);
+        g_mime_stream_filter_add(GMIME_STREAM_FILTER(stream), unzip);
+        g_object_unref(unzip);
+
+        /*
+         * A filtered stream can't seek, so we skip to the offset.
+         */
+        char buf[1024];
+
+        while (offset > 0)
+        {
+            ssize_t len = g_mime_stream_read(stream, buf, (size_t) offset < sizeof(buf) ? offset : sizeof(buf));
+
+            if (len <= 0)
+                break;
+
+            offset -= len;
+        }
+
+        return (stream);
     }
 
+    GMimeStream *stream = map_stream(fd, offset, -1);
+
+    *mapped = (stream != NULL);
+
+    if (stream != NULL)
+        return (stream);
+
+    lseek(fd, offset, SEEK_SET);
+
     stream = g_mime_stream_fs_new(fd);
     g_mime_stream_fs_set_owner((GMimeStreamFs*)stream, FALSE);
+    return (stream);
+}
+
+
+/*
+ * Parse the message in the given file.
+ */
+GMimeMessage * CMessage::parse_fd(int fd, bool persist, bool *lazy)
+{
+    GMimeMessage * message;
+    GMimeParser *parser;
+    GMimeStream *stream;
+
+    /*
+     * If the file is mapped, and we may refer to it later, then we ask
+     * the parser to persist the stream.  That leaves the content of each
+     * part referring to its location within the file, rather than a copy
+     * of it, which allows `build_part` to defer decoding until the
+     * content is wanted.
+     */
+    bool mapped = false;
+    stream = open_stream(fd, 0, &mapped);
+    *lazy  = mapped && persist;
 
     parser = g_mime_parser_new_with_stream(stream);
-    g_mime_parser_set_persist_stream(parser, FALSE);
+    g_mime_parser_set_persist_stream(parser, *lazy ? TRUE : FALSE);
 
     message = g_mime_parser_construct_message(parser);
     g_object_unref(stream);
@@ -183,47 +458,46 @@ GMimeMessage * CMessage::parse_message()
      */
     if (message == NULL)
     {
-
-        /*
-         * Close the file and retry parsing it, by opening it and
-         * skipping two lines.
-         */
-        close(fd);
-        fd = open(file.c_str(), O_RDONLY, 0);
-
-        int newline = 2;
-        int count   = 1024;
-        char buf[2] = { '\0', '\0' };
-
         /*
          * We're skipping two lines, but if the message
          * is really malformed and contains a long
          * line, etc, we'll have an infinite loop
          * if we don't cap our attempts.
          *
-         * `count` is the number of characters read,
-         * and we limit that to 1024 bytes.
-         *
+         * So we read the first 1024 bytes in one go, and
+         * find the offset just past the second newline within them.
          */
-        while ((newline > 0) && (count > 0))
+        char buf[1024];
+        ssize_t len = 0;
+        off_t offset = 0;
+
+        if (CCompression::is_compressed(fd))
         {
-            result = read(fd, buf, 1);
+            std::string head;
 
-            if (buf[0] == '\n')
-                newline -= 1;
+            if (CCompression::read(fd, head, sizeof(buf)))
+            {
+                len = std::min(head.size(), sizeof(buf));
+                memcpy(buf, head.data(), len);
+            }
+        }
+        else
+            len = pread(fd, buf, sizeof(buf), 0);
 
-            count -= 1;
+        for (int newline = 2; (newline > 0) && (offset < len); offset++)
+        {
+            if (buf[offset] == '\n')
+                newline -= 1;
         }
 
         /*
-         * Rebuild - the key here is that `fd` is the file-descriptor
-         * to the open file, and we've consumed content from it already.
+         * Rebuild - mapping the file from that offset onwards.
          */
-        stream    = g_mime_stream_fs_new(fd);
+        stream    = open_stream(fd, offset, &mapped);
+        *lazy     = mapped && persist;
 
         parser    = g_mime_parser_new_with_stream(stream);
-        g_mime_stream_fs_set_owner((GMimeStreamFs*)stream, FALSE);
-        g_mime_parser_set_persist_stream(parser, FALSE);
+        g_mime_parser_set_persist_stream(parser, *lazy ? TRUE : FALSE);
 
         message = g_mime_parser_construct_message(parser);
         g_object_unref(stream);
@@ -231,30 +505,344 @@ GMimeMessage * CMessage::parse_message()
 
     }
 
-    if (replaced == true)
-        CFile::delete_file(file);
+    return (message);
+}
+
+
+/*
+ * Find the file our message should be parsed from.
+ */
+std::string CMessage::parse_source(bool &replaced)
+{
+    /*
+     * If we're an IMAP-messge then we need to ensure
+     * that our file exists locally.
+     */
+    if (m_imap)
+        lazy_load();
+
+    /*
+     * The filename we'll operate upon.
+     */
+    std::string file = path();
+    replaced = false;
+
+    /*
+     * There is a Lua filter which *might* return an *updated* path to
+     * use.
+     */
+    CLua *lua = CLua::instance();
+
+    if (lua->function_exists("message_replace"))
+    {
+        std::string updated = lua->function2string("message_replace", file);
+
+        if (! updated.empty())
+        {
+            file = updated;
+            replaced = true;
+        }
+    }
+
+    return (file);
+}
+
+
+/*
+ * Parse a message held in memory, returning NULL on failure.
+ */
+static GMimeMessage *parse_buffer(const char *data, size_t len)
+{
+    GMimeStream *stream = g_mime_stream_mem_new_with_buffer(data, len);
+    GMimeParser *parser = g_mime_parser_new_with_stream(stream);
+    g_mime_parser_set_persist_stream(parser, FALSE);
+
+    GMimeMessage *message = g_mime_parser_construct_message(parser);
+    g_object_unref(stream);
+    g_object_unref(parser);
+
+    return (message);
+}
+
+
+/*
+ * Parse the message held within the given region of a file, such as a
+ * message within an mbox.
+ */
+static GMimeMessage *parse_region(int fd, uint64_t start, uint64_t length)
+{
+    GMimeStream *stream = map_stream(fd, start, start + length);
+
+    if (stream == NULL)
+    {
+        stream = g_mime_stream_fs_new_with_bounds(fd, start, start + length);
+        g_mime_stream_fs_set_owner((GMimeStreamFs*)stream, FALSE);
+    }
+
+    GMimeParser *parser = g_mime_parser_new_with_stream(stream);
+    g_mime_parser_set_persist_stream(parser, FALSE);
+
+    GMimeMessage *message = g_mime_parser_construct_message(parser);
+    g_object_unref(stream);
+    g_object_unref(parser);
+
+    return (message);
+}
+
+
+/*
+ * Parse the message in the given file, which may be within an mbox.
+ */
+GMimeMessage *CMessage::parse_file(const std::string &file, bool persist,
+                                   bool *lazy, std::string &error)
+{
+    std::string mbox;
+    uint64_t start  = 0;
+    uint64_t length = 0;
+    bool in_mbox    = CMbox::locate(file, mbox, start, length);
+
+    *lazy = false;
+
+    int fd = open(in_mbox ? mbox.c_str() : file.c_str(), O_RDONLY, 0);
+
+    if (fd == -1)
+    {
+        error = strerror(errno);
+        return (NULL);
+    }
+
+    GMimeMessage *message = NULL;
+
+    if (in_mbox)
+        message = parse_region(fd, start, length);
+    else
+        message = parse_fd(fd, persist, lazy);
 
     /*
      * We close this here explicitly to avoid a leak.
      */
     close(fd);
+
     return (message);
 }
 
-/**
- * Populate the headers and MIME-Parts caches.
+
+/*
+ * Parse the message in the given file.
  */
-void CMessage::populate_message() {
+std::shared_ptr<CParsedMessage> CMessage::parse(const std::string &file,
+        bool lazy, int iconv,
+        std::string &error)
+{
+    /*
+     * If one of our filters replaces the message we parse its output,
+     * which our parts can't decode lazily as it isn't in a file.
+     */
+    bool mapped = false;
+    GMimeMessage *message = NULL;
+    std::shared_ptr<const std::string> filtered = CMessageReplace::apply(file);
 
-    GMimeMessage *msg = parse_message();
+    error = "";
 
-    if (msg == NULL)
+    if (filtered)
+        message = parse_buffer(filtered->data(), filtered->size());
+    else
+        message = parse_file(file, lazy, &mapped, error);
+
+    if (message == NULL)
+        return (NULL);
+
+    std::shared_ptr<CParsedMessage> parsed = std::make_shared<CParsedMessage>();
+
+    std::shared_ptr<CHeaderList> headers = std::make_shared<CHeaderList>();
+    store_headers(message, *headers);
+    parsed->headers = headers;
+
+    /* Parse into MIME-Parts */
+
+    GMimeObject *mime_part = g_mime_message_get_mime_part(message);
+
+    if (mime_part)
+        parsed->parts.push_back(build_part(mime_part, mapped ? file : "", iconv));
+
+    g_object_unref(message);
+    return (parsed);
+}
+
+/*
+ * If the given data holds the blank line which terminates a header-block,
+ * searching from the given offset, truncate it just after that line.
+ */
+static bool header_block_end(std::string &data, size_t from)
+{
+    size_t lf   = data.find("\n\n", from);
+    size_t crlf = data.find("\n\r\n", from);
+
+    if ((lf == std::string::npos) && (crlf == std::string::npos))
+        return false;
+
+    if ((crlf != std::string::npos) && ((lf == std::string::npos) || (crlf < lf)))
+        data.resize(crlf + 3);
+    else
+        data.resize(lf + 2);
+
+    return true;
+}
+
+
+/*
+ * Read the header-block of the given file, up to and including the
+ * blank line which terminates it.
+ *
+ * If there is no blank line the whole file is returned.
+ */
+static bool read_header_block(std::string file, std::string &out)
+{
+    /*
+     * A message within an mbox is read from its region of the file.
+     */
+    std::string mbox;
+    uint64_t start, length;
+
+    if (CMbox::locate(file, mbox, start, length))
+    {
+        int fd = open(mbox.c_str(), O_RDONLY, 0);
+
+        if (fd == -1)
+            return false;
+
+        char buf[8192];
+        uint64_t done = 0;
+        ssize_t len;
+
+        while ((done < length) &&
+                ((len = pread(fd, buf, std::min((uint64_t) sizeof(buf), length - done), start + done)) > 0))
+        {
+            size_t from = out.size() > 3 ? out.size() - 3 : 0;
+            out.append(buf, len);
+            done += len;
+
+            if (header_block_end(out, from))
+                break;
+        }
+
+        close(fd);
+        return true;
+    }
+
+    int fd = open(file.c_str(), O_RDONLY, 0);
+
+    if (fd == -1)
+        return false;
+
+    /*
+     * Compressed messages are decompressed in one go, first enough for
+     * most header-blocks, and then entirely if that wasn't enough.
+     */
+    if (CCompression::is_compressed(fd))
+    {
+        bool ok = CCompression::read(fd, out, 64 * 1024);
+
+        if (ok && ! header_block_end(out, 0))
+        {
+            out.clear();
+            ok = CCompression::read(fd, out);
+            header_block_end(out, 0);
+        }
+
+        close(fd);
+        return (ok);
+    }
+
+    char buf[8192];
+    ssize_t len;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        /*
+         * Only search the newly-read data, along with the tail of
+         * the previous read in case the terminator straddles the two.
+         */
+        size_t from = out.size() > 3 ? out.size() - 3 : 0;
+        out.append(buf, len);
+
+        if (header_block_end(out, from))
+            break;
+    }
+
+    close(fd);
+    return true;
+}
+
+
+/*
+ * Parse the headers of our message, without reading the body.
+ */
+GMimeMessage * CMessage::parse_headers()
+{
+    CTraceSpan span("CMessage::parse_headers");
+
+    std::string file = m_path.str();
+    std::string headers;
+
+    /*
+     * If we're an IMAP-message we only need our header-block, which
+     * we'll fetch alone unless we have the whole message already.
+     */
+    if (m_imap && ! CFile::exists(m_path.str()))
     {
+        lazy_load_headers();
+
+        if (CFile::exists(m_path.str() + ".headers"))
+            file = m_path.str() + ".headers";
+        else
+            lazy_load();
+    }
+
+    if (m_imap)
+        CIMAPCache::instance()->touch(file);
+
+    if (! read_header_block(file, headers))
+    {
+        std::string error = strerror(errno);
         CLua *lua = CLua::instance();
-        lua->on_error("Failed to populate message :" + path());
-        return;
+
+        if (CFile::exists(file))
+            lua->on_error("Failed to open the existing message file:" + file + " " + error);
+        else
+            lua->on_error("Failed to open the message file - not found :" + file + " " + error);
+
+        return (NULL);
+    }
+
+    GMimeMessage *message = parse_buffer(headers.data(), headers.size());
+
+    /*
+     * If that failed try again after skipping two lines, capped at
+     * 1024 bytes, in the same way that `parse_fd` does.
+     */
+    if (message == NULL)
+    {
+        size_t offset = 0;
+
+        for (int newline = 2; (newline > 0) && (offset < headers.size()) && (offset < 1024); offset++)
+        {
+            if (headers[offset] == '\n')
+                newline -= 1;
+        }
+
+        message = parse_buffer(headers.data() + offset, headers.size() - offset);
     }
 
+    return (message);
+}
+
+
+/*
+ * Store the headers of the given message in the given list.
+ */
+void CMessage::store_headers(GMimeMessage *msg, CHeaderList &headers)
+{
     const char *name;
     const char *value;
 
@@ -301,7 +889,7 @@ void CMessage::populate_message() {
             /*
              * Store the updated value and free the original pointer.
              */
-            m_headers[nm] = v;
+            set_header(headers, nm, v);
             free(decoded);
 
             /*
@@ -314,17 +902,102 @@ void CMessage::populate_message() {
 
     g_mime_header_list_clear(ls);
     g_mime_header_iter_free(iter);
+}
 
-    /* Parse into MIME-Parts */
 
-    GMimeObject *mime_part = g_mime_message_get_mime_part(msg);
+/*
+ * Populate the headers cache, reading only the header-block of
+ * the message.
+ */
+void CMessage::populate_headers()
+{
+    GMimeMessage *msg = parse_headers();
 
-    if (!mime_part)
+    if (msg == NULL)
+    {
+        CLua *lua = CLua::instance();
+        lua->on_error("Failed to populate message :" + path());
         return;
+    }
 
-    m_parts.push_back(part2obj(mime_part));
-
+    std::shared_ptr<CHeaderList> headers = std::make_shared<CHeaderList>();
+    store_headers(msg, *headers);
     g_object_unref(msg);
+
+    publish_headers(headers);
+}
+
+
+/**
+ * Populate the headers and MIME-Parts caches.
+ */
+void CMessage::populate_message()
+{
+    CTraceSpan span("CMessage::parse_message");
+
+    bool replaced = false;
+    std::string file = parse_source(replaced);
+
+    /*
+     * This is used to enable/disable conversion of character
+     * sets.
+     */
+    CConfig *config = CConfig::instance();
+    int iconv       = config->get_integer("global.iconv", 0);
+
+    /*
+     * Our parts may decode their content lazily from the file, if it
+     * is our message rather than a temporary replacement.
+     */
+    std::string error;
+    std::shared_ptr<CParsedMessage> parsed = parse(file, ! replaced, iconv, error);
+
+    if (replaced == true)
+        CFile::delete_file(file);
+
+    if (! parsed)
+    {
+        CLua *lua = CLua::instance();
+
+        if (! error.empty())
+        {
+            if (CFile::exists(path()))
+                lua->on_error("Failed to open the existing message file:" + path() + " " + error);
+            else
+                lua->on_error("Failed to open the message file - not found :" + path() + " " + error);
+        }
+
+        lua->on_error("Failed to populate message :" + path());
+        return;
+    }
+
+    publish(parsed);
+}
+
+
+/*
+ * Publish the given snapshot.
+ */
+void CMessage::publish(std::shared_ptr<const CParsedMessage> parsed)
+{
+    /*
+     * The headers might have been read already, by `populate_headers`,
+     * in which case we keep those.
+     */
+    publish_headers(parsed->headers);
+
+    std::atomic_store(&m_parsed, parsed);
+}
+
+
+/*
+ * Publish our headers, unless we already have some.
+ */
+void CMessage::publish_headers(std::shared_ptr<const CHeaderList> headers)
+{
+    std::shared_ptr<const CHeaderList> none;
+
+    std::atomic_compare_exchange_strong(&m_headers, &none, headers);
 }
 
 
@@ -336,10 +1009,43 @@ std::unordered_map < std::string, std::string > CMessage::headers()
     /*
      * If we've cached these then return that copy.
      */
-    if (m_headers.size() == 0)
-        populate_message();
+    std::unordered_map < std::string, std::string > result;
+
+    const CHeaderList &list = header_list();
+
+    for (auto it = list.begin(); it != list.end(); ++it)
+        result[it->first.str()] = it->second.str();
+
+    return (result);
+}
+
+
+/*
+ * Return all header-names, and their values, without copying them.
+ */
+const CHeaderList &CMessage::header_list()
+{
+    /*
+     * If all our headers were seeded there's no need to parse.
+     */
+    std::shared_ptr<const CHeaderList> headers = parsed_headers();
+
+    if (! headers && m_seeded_complete)
+        return (m_seeded);
+
+    /*
+     * If we've cached these then return that copy.
+     */
+    if (! headers)
+        populate_headers();
+
+    if (!(headers = parsed_headers()))
+    {
+        static const CHeaderList empty;
+        return (empty);
+    }
 
-    return (m_headers);
+    return (*headers);
 }
 
 
@@ -348,44 +1054,177 @@ std::unordered_map < std::string, std::string > CMessage::headers()
  */
 CMessage::~CMessage()
 {
-    m_parts.clear();
+    release_parts();
+    m_path.clear(m_arena);
 }
 
 
 /*
- * Retrieve the current flags for this message.
+ * Map a flag-character to its bit within our mask, or -1 if it isn't
+ * a valid flag.
+ *
+ * Digits, then upper-case, then lower-case letters are allocated bits
+ * in ascending order, so walking the mask from the lowest bit yields
+ * the flags sorted as maildir expects.
  */
-std::string CMessage::get_flags()
+int CMessage::flag_bit(char c)
 {
-    if (m_imap)
-        return m_imap_flags;
+    if (c >= '0' && c <= '9')
+        return (c - '0');
+
+    if (c >= 'A' && c <= 'Z')
+        return (10 + c - 'A');
 
-    std::string flags = "";
-    std::string pth = path();
+    if (c >= 'a' && c <= 'z')
+        return (36 + c - 'a');
 
-    if (pth.empty())
-        return (flags);
+    return -1;
+}
+
+
+/*
+ * Convert a string of flag-characters to a mask.
+ */
+uint64_t CMessage::flags_to_mask(const std::string &flags)
+{
+    uint64_t mask = 0;
+
+    for (char c : flags)
+    {
+        int bit = flag_bit(c);
+
+        if (bit >= 0)
+            mask |= ((uint64_t)1 << bit);
+    }
+
+    return (mask);
+}
+
+
+/*
+ * Convert a mask to a sorted string of flag-characters.
+ */
+std::string CMessage::mask_to_flags(uint64_t mask)
+{
+    static const char chars[] = "0123456789"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "abcdefghijklmnopqrstuvwxyz";
+    std::string flags;
+
+    for (int bit = 0; mask != 0; bit++, mask >>= 1)
+    {
+        if (mask & 1)
+            flags += chars[bit];
+    }
 
-    size_t
-    offset = pth.find(":2,");
+    return (flags);
+}
+
+
+/*
+ * Parse the flags of a local message from the given path.
+ */
+uint64_t CMessage::path_to_mask(const std::string &path)
+{
+    uint64_t mask = 0;
+    size_t offset = path.find(":2,");
 
     if (offset != std::string::npos)
-        flags = pth.substr(offset + 3);
+        mask = flags_to_mask(path.substr(offset + 3));
 
     /*
      * Sleazy Hack.
      */
-    if (pth.find("/new/") != std::string::npos)
-        flags += "N";
+    if (path.find("/new/") != std::string::npos)
+        mask |= ((uint64_t)1 << flag_bit('N'));
+
+    return (mask);
+}
+
+
+/*
+ * Get our flags as a mask, parsing them from our filename only once.
+ */
+uint64_t CMessage::flags_mask()
+{
+    if (m_imap)
+        return (flags_to_mask(m_imap_flags));
+
+    if (! m_flags_known)
+    {
+        m_flags = path_to_mask(path());
+        m_flags_known = true;
+    }
+
+    return (m_flags);
+}
+
+
+/*
+ * Rename our message so that its filename encodes the given flags.
+ *
+ * `dst` is the path to rename to, ignoring any flags it contains,
+ * which allows callers to move between `new/` and `cur/` too.
+ */
+bool CMessage::rename_with_flags(std::string dst, uint64_t mask)
+{
+    size_t offset = dst.find(":2,");
+
+    if (offset != std::string::npos)
+        dst = dst.substr(0, offset);
+
+    dst += ":2,";
+    dst += mask_to_flags(mask);
 
+    std::string cur = path();
+
+    if (cur != dst)
+    {
+        if (rename(cur.c_str(), dst.c_str()) != 0)
+            return false;
+
+        CDurability::instance()->renamed(cur, dst);
+        path(dst);
+    }
 
     /*
-     * Sort the flags, and remove duplicates
+     * We know the flags our new name encodes, so there's no need to
+     * parse them again.
      */
-    std::sort(flags.begin(), flags.end());
-    flags.erase(std::unique(flags.begin(), flags.end()), flags.end());
+    m_flags = path_to_mask(dst);
+    m_flags_known = true;
+    g_flags_generation++;
+    return true;
+}
+
+
+/*
+ * The number of times the flags of any message have changed.
+ */
+uint64_t CMessage::flags_generation()
+{
+    return (g_flags_generation);
+}
+
 
-    return flags;
+/*
+ * Retrieve our upper-case flags as a mask.
+ */
+uint32_t CMessage::flag_letters()
+{
+    return ((uint32_t)((flags_mask() >> flag_bit('A')) & 0x3ffffff));
+}
+
+
+/*
+ * Retrieve the current flags for this message.
+ */
+std::string CMessage::get_flags()
+{
+    if (m_imap)
+        return m_imap_flags;
+
+    return (mask_to_flags(flags_mask()));
 }
 
 
@@ -394,39 +1233,56 @@ std::string CMessage::get_flags()
  */
 void CMessage::set_flags(std::string new_flags)
 {
-    /*
-     * Sort the flags.
-     */
-    std::string flags = new_flags;
-    std::sort(flags.begin(), flags.end());
-    flags.erase(std::unique(flags.begin(), flags.end()), flags.end());
+    rename_with_flags(path(), flags_to_mask(new_flags));
+}
+
+
+/*
+ * Add and remove the given flags, with a single rename.
+ */
+bool CMessage::update_flags(std::string add, std::string remove)
+{
+    std::transform(add.begin(), add.end(), add.begin(), ::toupper);
+    std::transform(remove.begin(), remove.end(), remove.begin(), ::toupper);
+
+    uint64_t current = flags_mask();
+    uint64_t updated = (current | flags_to_mask(add)) & ~flags_to_mask(remove);
+    uint64_t is_new  = ((uint64_t)1 << flag_bit('N'));
+    uint64_t seen    = ((uint64_t)1 << flag_bit('S'));
 
     /*
-     * Get the current ending position.
+     * For IMAP messages we only update our local copy of the flags,
+     * the caller is responsible for telling the server.  As with
+     * `mark_unread` a message which is no longer seen becomes new.
      */
-    std::string cur_path = path();
-    std::string dst_path = cur_path;
+    if (m_imap)
+    {
+        if ((current & seen) && !(updated & seen))
+            updated |= is_new;
 
-    size_t offset = std::string::npos;
+        if (updated == current)
+            return false;
 
-    if ((offset = cur_path.find(":2,")) != std::string::npos)
-    {
-        dst_path = cur_path.substr(0, offset);
-        dst_path += ":2,";
-        dst_path += flags;
-    }
-    else
-    {
-        dst_path = cur_path;
-        dst_path += ":2,";
-        dst_path += flags;
+        m_imap_flags = mask_to_flags(updated);
+        m_time += 1;
+        g_flags_generation++;
+        return true;
     }
 
-    if (cur_path != dst_path)
-    {
-        CFile::move(cur_path, dst_path);
-        path(dst_path);
-    }
+    if (updated == current)
+        return false;
+
+    /*
+     * A message in `new/` is moved to `cur/` if it is no longer new,
+     * in the same rename.
+     */
+    std::string dst = path();
+    size_t offset   = dst.find("/new/");
+
+    if (!(updated & is_new) && (offset != std::string::npos))
+        dst = dst.substr(0, offset) + "/cur/" + dst.substr(offset + strlen("/new/"));
+
+    return (rename_with_flags(dst, updated));
 }
 
 
@@ -441,6 +1297,13 @@ void CMessage::set_imap_flags(std::string flags)
     std::sort(flags.begin(), flags.end());
     flags.erase(std::unique(flags.begin(), flags.end()), flags.end());
 
+    /*
+     * Nothing need be flushed if nothing has changed, as is the case for
+     * most messages when a folder is resynchronised.
+     */
+    if (flags == m_imap_flags)
+        return;
+
     m_imap_flags = flags;
 
     /*
@@ -463,21 +1326,13 @@ void CMessage::set_imap_flags(std::string flags)
  */
 bool CMessage::add_flag(char c)
 {
-    std::string flags = get_flags();
-
-    size_t offset = std::string::npos;
+    int bit = flag_bit(c);
 
-    /*
-     * If the flag was missing, add it.
-     */
-    if ((offset = flags.find(c)) == std::string::npos)
-    {
-        flags += c;
-        set_flags(flags);
-        return true;
-    }
-    else
+    if ((bit < 0) || (flags_mask() & ((uint64_t)1 << bit)))
         return false;
+
+    set_flags(mask_to_flags(flags_mask() | ((uint64_t)1 << bit)));
+    return true;
 }
 
 
@@ -489,12 +1344,12 @@ bool CMessage::has_flag(char c)
     /*
      * Flags are upper-case.
      */
-    c = toupper(c);
+    int bit = flag_bit(toupper(c));
 
-    if (get_flags().find(c) != std::string::npos)
-        return true;
-    else
+    if (bit < 0)
         return false;
+
+    return ((flags_mask() & ((uint64_t)1 << bit)) != 0);
 }
 
 /*
@@ -504,26 +1359,15 @@ bool CMessage::has_flag(char c)
  */
 bool CMessage::remove_flag(char c)
 {
-    c = toupper(c);
-
-    std::string current = get_flags();
+    int bit = flag_bit(toupper(c));
 
     /*
      * If the flag is not present, return.
      */
-    if (current.find(c) == std::string::npos)
+    if ((bit < 0) || !(flags_mask() & ((uint64_t)1 << bit)))
         return false;
 
-    /*
-     * Remove the flag.
-     */
-    std::string::size_type k = 0;
-
-    while ((k = current.find(c, k)) != current.npos)
-        current.erase(k, 1);
-
-    set_flags(current);
-
+    set_flags(mask_to_flags(flags_mask() & ~((uint64_t)1 << bit)));
     return true;
 }
 
@@ -573,10 +1417,11 @@ void CMessage::mark_unread()
         std::string cmd = "mark_unread " + id + " " + folder + "\n";
 
         /*
-         * Get the output.
+         * We don't wait for the reply, as the proxy carries out requests
+         * in order, so any later request will see the change.
          */
         CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string out  = proxy->read_imap_output(cmd);
+        proxy->request(cmd, nullptr);
 
         /*
          * Remove `S` flag from m_imap_flags since these are
@@ -646,10 +1491,11 @@ void CMessage::mark_read()
         std::string cmd = "mark_read " + id + " " + folder + "\n";
 
         /*
-         * Get the output.
+         * We don't wait for the reply, as the proxy carries out requests
+         * in order, so any later request will see the change.
          */
         CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string out  = proxy->read_imap_output(cmd);
+        proxy->request(cmd, nullptr);
 
         /*
          * Remove `N` flag from m_imap_flags since these are
@@ -681,68 +1527,31 @@ void CMessage::mark_read()
 
         int c = m_parent->unread_messages();
         c -= 1;
-
-        if (c < 0)
-            c = 0;
-
-        m_parent->set_unread(c);
-
-        return;
-    }
-
-    /*
-     * Get the current path, and build a new one.
-     */
-    std::string c_path = path();
-    std::string n_path = "";
-
-    size_t offset = std::string::npos;
-
-    /*
-     * If we find /new/ in the path then rename to be /cur/
-     */
-    if ((offset = c_path.find("/new/")) != std::string::npos)
-    {
-        /*
-         * Path component before /new/ + after it.
-         */
-        std::string before = c_path.substr(0, offset);
-        std::string after  = c_path.substr(offset + strlen("/new/"));
-
-        n_path = before + "/cur/" + after;
-
-        if (rename(c_path.c_str(), n_path.c_str())  == 0)
-        {
-            path(n_path);
-            add_flag('S');
-        }
-    }
-    else
-    {
-        /*
-         * The file is new, but not in the new folder.
-         *
-         * That means we need to remove "N" from the flag-component of the path.
-         *
-         */
-        remove_flag('N');
-        add_flag('S');
+
+        if (c < 0)
+            c = 0;
+
+        m_parent->set_unread(c);
+
+        return;
     }
+
+    /*
+     * Add the seen-flag, and remove the new-flag, which moves a
+     * message from `new/` to `cur/` too - all with a single rename.
+     */
+    update_flags("S", "N");
 }
 
 
 /*
- * Convert a message-part from the MIME message to a CMessagePart object.
+ * Convert a message-part to a CMessagePart object, without reference
+ * to any message or to our configuration.
  */
-std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
+std::shared_ptr<CMessagePart> CMessage::build_part(GMimeObject *part,
+        const std::string &lazy_source,
+        int iconv)
 {
-    /*
-     * This is used to enable/disable conversion of character
-     * sets.
-     */
-    CConfig *config = CConfig::instance();
-    int iconv       = config->get_integer("global.iconv", 0);
-
     /*
      * Get the content-type of this part.
      */
@@ -764,6 +1573,52 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
     if (aname == NULL)
         aname = (char *) g_mime_object_get_content_type_parameter(part, "name");
 
+    /*
+     * Should we convert the content of this part to UTF-8?  We only
+     * do that if the content is:
+     *
+     *   text/plain
+     *   not UTF-8 already.
+     */
+    bool convert = ((iconv == 1) &&
+                    (g_mime_content_type_is_type(ct, "text", "plain")) &&
+                    (charset != NULL) &&
+                    (strcmp(charset, "utf-8") != 0) &&
+                    (strcmp(charset, "UTF-8") != 0));
+
+    std::shared_ptr<CMessagePart> ret;
+
+    /*
+     * If this is a simple part, of a message parsed straight from disk,
+     * then we record where the encoded body lives rather than decoding
+     * it - it'll be decoded only if the content is requested.
+     */
+    GMimeStream *source = NULL;
+    GMimeDataWrapper *content = NULL;
+
+    if (!lazy_source.empty() && !GMIME_IS_MULTIPART(part) &&
+            !GMIME_IS_MESSAGE_PARTIAL(part) && !GMIME_IS_MESSAGE_PART(part))
+    {
+        content = g_mime_part_get_content_object(GMIME_PART(part));
+
+        if (content != NULL)
+            source = g_mime_data_wrapper_get_stream(content);
+
+        if ((source != NULL) && (source->bound_start < 0 || source->bound_end <= source->bound_start))
+            source = NULL;
+    }
+
+    if (source != NULL)
+    {
+        ret = std::shared_ptr<CMessagePart> (new CMessagePart(type, aname ? aname : "",
+                                             lazy_source,
+                                             source->bound_start, source->bound_end,
+                                             g_mime_data_wrapper_get_encoding(content),
+                                             convert ? charset : ""));
+        free(type);
+        return ret;
+    }
+
     /*
      * Holder for the content
      */
@@ -798,7 +1653,7 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
         /*
          * Populate `mem` with the data.
          */
-        GMimeDataWrapper *content = g_mime_part_get_content_object(GMIME_PART(part));
+        content = g_mime_part_get_content_object(GMIME_PART(part));
         g_mime_data_wrapper_write_to_stream(content, mem);
     }
 
@@ -822,44 +1677,14 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
     char *adata = (char *) res->data;
     size_t len = (res->len);
 
-    if (iconv == 1)
+    if (convert)
     {
-        /*
-         * Now we'll try to conver the text to UTF-8, but we
-         * only do that if the content is:
-         *
-         *   text/plain
-         *   not UTF-8 already.
-         */
-
-        if ((g_mime_content_type_is_type(ct, "text", "plain")) &&
-                (charset != NULL) &&
-                (strcmp(charset, "utf-8") != 0) &&
-                (strcmp(charset, "UTF-8") != 0))
-        {
-            iconv_t cv = g_mime_iconv_open("UTF-8", charset);
-            char *converted = g_mime_iconv_strndup(cv, (const char *) adata, len);
-
-            if (converted != NULL)
-            {
-                /*
-                 * If that succeeded then update our byte-array.
-                 *
-                 * This might causes problems in free.  We should check.
-                 */
-                size_t conv_len = strlen(converted);
-                adata = (char*)malloc(conv_len + 1);
-
-                memcpy(adata, converted, conv_len + 1);
-                len = (size_t)conv_len;
-                g_free(converted);
-            }
+        char *original = adata;
 
-        }
+        if (CMessagePart::to_utf8(charset, &adata, &len))
+            free(original);
     }
 
-    std::shared_ptr<CMessagePart> ret;
-
     /*
      * If it is an attachment we'll add it.
      */
@@ -893,7 +1718,7 @@ std::shared_ptr<CMessagePart> CMessage::part2obj(GMimeObject *part)
             /*
              * Create the child - set the parent.
              */
-            std::shared_ptr<CMessagePart> child = part2obj(subpart);
+            std::shared_ptr<CMessagePart> child = build_part(subpart, lazy_source, iconv);
             child->set_parent(ret);
 
             /*
@@ -922,10 +1747,139 @@ std::vector<std::shared_ptr<CMessagePart> >CMessage::get_parts()
      *
      * A message can't/won't change under our feet.
      */
-    if (m_parts.size() == 0)
+    std::shared_ptr<const CParsedMessage> parsed = std::atomic_load(&m_parsed);
+
+    if (! parsed)
+    {
         populate_message();
+        parsed = std::atomic_load(&m_parsed);
+    }
+
+    if (! parsed)
+        return (std::vector<std::shared_ptr<CMessagePart>>());
+
+    /*
+     * Record our use, so the least-recently used parts can be
+     * released if we're holding too much content.
+     */
+    size_t bytes = 0;
+
+    for (std::shared_ptr<CMessagePart> part : parsed->parts)
+        bytes += part->total_size();
+
+    CPartCache::instance()->touch(this, bytes);
+    m_parts_cached = true;
+
+    return (parsed->parts);
+}
+
+
+/*
+ * Decode the content of the given parts, and of their children.
+ */
+static void decode_parts(const std::vector<std::shared_ptr<CMessagePart>> &parts)
+{
+    for (std::shared_ptr<CMessagePart> part : parts)
+    {
+        part->content();
+        decode_parts(part->children());
+    }
+}
 
-    return (m_parts);
+
+/*
+ * Parse, and decode, the message in the given file.
+ */
+std::shared_ptr<CParsedMessage> CMessage::prepare(const std::string &file, int iconv)
+{
+    std::string error;
+    std::shared_ptr<CParsedMessage> parsed = parse(file, true, iconv, error);
+
+    /*
+     * The parts are ours alone until they're adopted, so we can
+     * decode them here rather than when they're first displayed.
+     */
+    if (parsed)
+        decode_parts(parsed->parts);
+
+    return (parsed);
+}
+
+
+/*
+ * Adopt the snapshot prepared for us.
+ */
+bool CMessage::adopt(const std::string &file, std::shared_ptr<const CParsedMessage> parsed)
+{
+    /*
+     * If we've been renamed, or parsed, since the preparation began
+     * then we keep what we have.
+     */
+    if (! parsed || (file != path()) || parts_known())
+        return false;
+
+    publish(parsed);
+
+    size_t bytes = 0;
+
+    for (std::shared_ptr<CMessagePart> part : parsed->parts)
+        bytes += part->total_size();
+
+    CPartCache::instance()->touch(this, bytes);
+    m_parts_cached = true;
+    return true;
+}
+
+
+/*
+ * Do any of the given parts, or their children, have a filename?
+ */
+static bool parts_have_attachment(const std::vector<std::shared_ptr<CMessagePart>> &parts)
+{
+    for (std::shared_ptr<CMessagePart> part : parts)
+    {
+        if (part->is_attachment() || parts_have_attachment(part->children()))
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Does this message have any attachments?
+ */
+bool CMessage::has_attachments()
+{
+    if (m_attachments == -1)
+    {
+        /*
+         * If we parse the message only to answer this then we release
+         * the parts again, rather than holding them for every message
+         * in a folder.
+         */
+        bool parsed = parts_known();
+
+        m_attachments = parts_have_attachment(get_parts()) ? 1 : 0;
+
+        if (! parsed)
+            release_parts();
+    }
+
+    return (m_attachments == 1);
+}
+
+
+/*
+ * Release our parsed MIME-parts.
+ */
+void CMessage::release_parts()
+{
+    if (m_parts_cached)
+        CPartCache::instance()->remove(this);
+
+    m_parts_cached = false;
+    std::atomic_store(&m_parsed, std::shared_ptr<const CParsedMessage>());
 }
 
 
@@ -960,26 +1914,20 @@ bool CMessage::unlink()
         std::string cmd = "delete_message " + id + " " + folder + "\n";
 
         /*
-         * Get the output.
+         * We don't wait for the reply, as the proxy carries out requests
+         * in order, so any later request will see the change.
          */
         CIMAPProxy *proxy = CIMAPProxy::instance();
-        std::string out  = proxy->read_imap_output(cmd);
+        proxy->request(cmd, nullptr);
 
         /*
          * Increase the modification time of the parent folder.
          */
         m_parent->bump_mtime();
-
-        CGlobalState *global = CGlobalState::instance();
-        global->update_messages();
         return true;
     }
 
-    bool ret = CFile::delete_file(path());
-
-    CGlobalState *global = CGlobalState::instance();
-    global->update_messages(true);
-    return ret;
+    return (CFile::delete_file(path()));
 }
 
 
@@ -1003,6 +1951,11 @@ bool CMessage::is_imap()
 
 /*
  * Update our on-disk email to add the specified files as attachments.
+ *
+ * Neither the message nor the attachments are read into memory: the
+ * parser refers to the body of the message within its file, and each
+ * attachment is read through a base64-encoding filter as the updated
+ * message is written, so memory use doesn't grow with their sizes.
  */
 void CMessage::add_attachments(std::vector<std::string> attachments)
 {
@@ -1010,7 +1963,6 @@ void CMessage::add_attachments(std::vector<std::string> attachments)
     GMimeParser  *parser;
     GMimeStream  *stream;
     int fd;
-    int result __attribute__((unused));
 
     /*
      * If there are no attachments return.
@@ -1021,18 +1973,28 @@ void CMessage::add_attachments(std::vector<std::string> attachments)
     if ((fd = open(m_path.c_str(), O_RDONLY, 0)) == -1)
     {
         CLua *lua = CLua::instance();
-        lua->on_error("Failed to open the message:" + m_path);
+        lua->on_error("Failed to open the message:" + m_path.str());
         return;
     }
 
     stream = g_mime_stream_fs_new(fd);
 
+    /*
+     * The stream owns the descriptor now.
+     */
     parser = g_mime_parser_new_with_stream(stream);
+    g_mime_parser_set_persist_stream(parser, TRUE);
     g_object_unref(stream);
 
     message = g_mime_parser_construct_message(parser);
     g_object_unref(parser);
 
+    if (message == NULL)
+    {
+        CLua *lua = CLua::instance();
+        lua->on_error("Failed to parse the message:" + m_path.str());
+        return;
+    }
 
     GMimeMultipart *multipart;
     GMimePart *addition;
@@ -1076,15 +2038,30 @@ void CMessage::add_attachments(std::vector<std::string> attachments)
         int ad;
 
         if ((ad = open(name.c_str(), O_RDONLY)) == -1)
-            return;
+        {
+            CLua *lua = CLua::instance();
+            lua->on_error("Failed to open the attachment:" + name);
 
-        stream = g_mime_stream_fs_new(ad);
+            g_object_unref(multipart);
+            g_object_unref(message);
+            return;
+        }
 
         /*
-         * the stream isn't encoded, so just use DEFAULT
+         * Read the file through a base64-encoder, and tell GMime the
+         * content is already encoded, so that it is copied a buffer at a
+         * time as we write the message, rather than being examined, or
+         * encoded, as a whole.
          */
-        content = g_mime_data_wrapper_new_with_stream(stream, GMIME_CONTENT_ENCODING_DEFAULT);
+        GMimeStream *file = g_mime_stream_fs_new(ad);
+        stream = g_mime_stream_filter_new(file);
+        g_object_unref(file);
 
+        GMimeFilter *encoder = g_mime_filter_basic_new(GMIME_CONTENT_ENCODING_BASE64, TRUE);
+        g_mime_stream_filter_add(GMIME_STREAM_FILTER(stream), encoder);
+        g_object_unref(encoder);
+
+        content = g_mime_data_wrapper_new_with_stream(stream, GMIME_CONTENT_ENCODING_BASE64);
         g_object_unref(stream);
 
         /*
@@ -1109,11 +2086,8 @@ void CMessage::add_attachments(std::vector<std::string> attachments)
         g_mime_part_set_filename(addition, CFile::basename(name).c_str());
 
         /*
-         * Here we use base64 encoding.
-         *
-         * NOTE: if you want to get really fancy, you could use
-         * g_mime_part_get_best_content_encoding()
-         * to calculate the most efficient encoding algorithm to use.
+         * The encoding matches that of our content, so it is written
+         * as-is.
          */
         g_mime_part_set_content_encoding(addition, GMIME_CONTENT_ENCODING_BASE64);
 
@@ -1134,43 +2108,76 @@ void CMessage::add_attachments(std::vector<std::string> attachments)
      * Output the updated message.  First pick a tmpfile.
      *
      * NOTE: We must use a temporary file.  If we attempt to overwrite the
-     * input file we'll get corruption, due to GMime caching.
+     * input file we'll get corruption, as the parser reads the body from it.
+     *
+     * We prefer one beside the message, so that it may be renamed into
+     * place, but fall back to `global.tmpdir` if that directory isn't
+     * writeable.
      */
-    CConfig *config     = CConfig::instance();
-    std::string tmp_dir = config->get_string("global.tmpdir", "/tmp");
-    std::string tmp_pat = tmp_dir + "/lumail2XXXXXXXX";
-    char *tmp_file      = strdup(tmp_pat.c_str());
+    std::string path = m_path.str();
+    std::string dir  = path.substr(0, path.rfind('/') + 1);
+    std::string tmp_file = dir + ".lumail2XXXXXXXX";
+    int tmp_fd = -1;
 
-    result = mkstemp(tmp_file);
+    if (! dir.empty())
+        tmp_fd = mkstemp(&tmp_file[0]);
 
-    /*
-     * Write out the updated message.
-     */
-    FILE *f = NULL;
+    if (tmp_fd == -1)
+    {
+        CConfig *config     = CConfig::instance();
+        std::string tmp_dir = config->get_string("global.tmpdir", "/tmp");
+        tmp_file = tmp_dir + "/lumail2XXXXXXXX";
+        tmp_fd   = mkstemp(&tmp_file[0]);
+    }
 
-    if ((f = fopen(tmp_file, "wb")) == NULL)
+    if (tmp_fd == -1)
     {
-        free(tmp_file);
-        close(fd);
+        CLua *lua = CLua::instance();
+        lua->on_error("Failed to create a temporary file for:" + m_path.str());
+        g_object_unref(message);
         return;
     }
 
-    GMimeStream *ostream = g_mime_stream_file_new(f);
-    g_mime_object_write_to_stream((GMimeObject *) message, ostream);
+    /*
+     * Write out the updated message, via a buffer, and close the
+     * temporary file when the stream is released.
+     */
+    GMimeStream *ostream = g_mime_stream_fs_new(tmp_fd);
+    GMimeStream *buffered = g_mime_stream_buffer_new(ostream, GMIME_STREAM_BUFFER_BLOCK_WRITE);
     g_object_unref(ostream);
+
+    bool ok = (g_mime_object_write_to_stream((GMimeObject *) message, buffered) != -1);
+    ok = (g_mime_stream_flush(buffered) == 0) && ok;
+
+    g_object_unref(buffered);
     g_object_unref(message);
+
+    if (! ok)
+    {
+        CLua *lua = CLua::instance();
+        lua->on_error("Failed to write the message:" + m_path.str());
+        CFile::delete_file(tmp_file);
+        return;
+    }
+
     /*
      * Now rename the temporary file over the top of the input
-     * message.
+     * message, or copy it if it was written elsewhere.
      */
-    CFile::copy(tmp_file, m_path);
-    CFile::delete_file(tmp_file);
+    if (rename(tmp_file.c_str(), m_path.c_str()) != 0)
+    {
+        CFile::copy(tmp_file, m_path.str());
+        CFile::delete_file(tmp_file);
+    }
 
-    if (m_parts.size() > 0)
-        m_parts.clear();
+    CDurability *durability = CDurability::instance();
+    durability->written(m_path.str());
+    durability->changed(m_path.str().substr(0, m_path.str().rfind('/')));
 
-    close(fd);
-    free(tmp_file);
+    m_size  = -1;
+    m_mtime = -1;
+
+    std::atomic_store(&m_parsed, std::shared_ptr<const CParsedMessage>());
 }
 
 
@@ -1196,19 +2203,116 @@ void CMessage::parent(std::shared_ptr<CMaildir> owner)
  */
 int CMessage::get_mtime()
 {
-    if (m_imap == false)
+    if (m_imap)
+        return (m_time);
+
+    if ((m_mtime < 0) && ! stat_file())
+        return 1;
+
+    return (m_mtime);
+}
+
+
+/*
+ * Retrieve the size of our message, preferring the `S=` field which
+ * some delivery agents add to the filename.
+ */
+off_t CMessage::get_size()
+{
+    if (m_imap)
+        return 0;
+
+    if (m_size >= 0)
+        return (m_size);
+
+    std::string path = m_path.str();
+    size_t slash  = path.rfind('/');
+    size_t offset = path.find(",S=", (slash == std::string::npos) ? 0 : slash);
+
+    if (offset != std::string::npos)
     {
-        std::string our_path = path();
+        const char *start = path.c_str() + offset + 3;
+        char *end = NULL;
+        long long size = strtoll(start, &end, 10);
 
-        struct stat sb;
+        if ((end != start) && ((*end == ',') || (*end == ':') || (*end == '\0')))
+        {
+            m_size = (off_t) size;
+            return (m_size);
+        }
+    }
 
-        if (stat(our_path.c_str(), &sb) < 0)
-            return 1;
-        else
-            return sb.st_mtime;
+    /*
+     * The size of a message within an mbox isn't that of any file.
+     */
+    if (! stat_file() || (m_size < 0))
+        return 0;
+
+    return (m_size);
+}
+
+
+/*
+ * Find the modification time, and size, of our message.
+ */
+bool CMessage::stat_file()
+{
+    std::string our_path = path();
+
+    struct stat sb;
+
+    if (stat(our_path.c_str(), &sb) == 0)
+    {
+        m_mtime = sb.st_mtime;
+
+        if (m_size < 0)
+            m_size = sb.st_size;
+
+        return true;
+    }
+
+    /*
+     * Messages within an mbox share its modification time.
+     */
+    std::string mbox;
+    uint64_t start, length;
+
+    if (CMbox::locate(our_path, mbox, start, length) &&
+            (stat(mbox.c_str(), &sb) == 0))
+    {
+        m_mtime = sb.st_mtime;
+        return true;
     }
 
-    return (m_time);
+    return false;
+}
+
+
+/*
+ * Retrieve the date of our message, parsing it only once.
+ */
+time_t CMessage::get_ctime()
+{
+    if (m_ctime_known)
+        return (m_ctime);
+
+    /*
+     * Look for `Delivery-Date`, then `Date`.
+     */
+    const std::string *date = &header_ref("delivery-date");
+
+    if (date->empty())
+        date = &header_ref("date");
+
+    struct timeval tv;
+
+    if ((! date->empty()) && (approxidate(date->c_str(), &tv) == 0))
+        m_ctime = tv.tv_sec;
+    else
+        m_ctime = 0;
+
+    m_ctime_known = true;
+    return (m_ctime);
 }
 
 
@@ -1217,7 +2321,9 @@ int CMessage::get_mtime()
  */
 void CMessage::lazy_load()
 {
-    if (! CFile::exists(m_path))
+    if (CFile::exists(m_path.str()))
+        CIMAPCache::instance()->touch(m_path.str());
+    else
     {
         /*
          * Fetch our body
@@ -1237,10 +2343,83 @@ void CMessage::lazy_load()
         /*
          * Write to disk.
          */
-        std::fstream fs;
-        fs.open(m_path,  std::fstream::out | std::fstream::app);
-        fs << out;
-        fs.close();
+        set_imap_body(out);
+    }
+}
+
 
+/*
+ * Load our IMAP-based headers, lazily.
+ */
+void CMessage::lazy_load_headers()
+{
+    if (imap_headers_cached())
+        return;
+
+    std::string cmd = "get_headers_bulk ";
+    cmd += std::to_string(m_imap_id);
+    cmd += " ";
+    cmd += m_parent->path();
+    cmd += "\n";
+
+    CIMAPProxy *proxy = CIMAPProxy::instance();
+    std::string out = proxy->read_imap_output(cmd);
+
+    for (auto &entry : CIMAPProxy::split_bulk(out))
+    {
+        if (entry.first == m_imap_id)
+            set_imap_headers(entry.second);
     }
 }
+
+
+/*
+ * Has our IMAP-based body been fetched?
+ */
+bool CMessage::imap_body_cached()
+{
+    return (CFile::exists(m_path.str()));
+}
+
+
+/*
+ * Store our IMAP-based body.
+ *
+ * Our cache writes it atomically, so that something fetched twice - once
+ * by a prefetch and once on demand - is never appended to itself, nor
+ * seen half-written, and ignores the empty reply of a failed fetch.
+ */
+void CMessage::set_imap_body(const std::string &body)
+{
+    CIMAPCache::instance()->store(m_path.str(), body);
+}
+
+
+/*
+ * Have our IMAP-based headers been fetched?
+ */
+bool CMessage::imap_headers_cached()
+{
+    return (CFile::exists(m_path.str() + ".headers") || CFile::exists(m_path.str()));
+}
+
+
+/*
+ * Do we have only the headers of our IMAP-based message?
+ */
+bool CMessage::imap_headers_only()
+{
+    return (m_imap && ! CFile::exists(m_path.str()) && CFile::exists(m_path.str() + ".headers"));
+}
+
+
+/*
+ * Store our IMAP-based headers.
+ *
+ * IMAP includes the blank line which ends the header-block, so it may
+ * be parsed just as the whole message would be.
+ */
+void CMessage::set_imap_headers(const std::string &headers)
+{
+    CIMAPCache::instance()->store(m_path.str() + ".headers", headers);
+}
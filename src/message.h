@@ -21,19 +21,118 @@
 
 
 #include <memory>
+#include <stdint.h>
 #include <string>
+#include <sys/types.h>
 #include <unordered_map>
 #include <vector>
 #include <gmime/gmime.h>
 
+#include "intern.h"
+#include "message_arena.h"
+
 class CMaildir;
 
+
+/**
+ * The value of a header.
+ *
+ * The values of those headers which repeat from one message to the next,
+ * such as `From` or `List-Id`, are interned - so that each distinct value
+ * is held once, however many messages share it.  Others are held by each
+ * message, as they're usually unique to it.
+ */
+class CHeaderValue
+{
+public:
+    CHeaderValue() : m_shared(NULL) {}
+    CHeaderValue(const std::string &value) : m_shared(NULL), m_own(value) {}
+    CHeaderValue(const char *value) : m_shared(NULL), m_own(value) {}
+    CHeaderValue(const CInterned &value) : m_shared(&value.str()) {}
+
+    /**
+     * Create the value of the named header, interning it if that
+     * header is one whose values repeat.
+     */
+    static CHeaderValue make(const CInterned &name, const std::string &value);
+
+    /**
+     * Are the values of the named header interned?
+     */
+    static bool shared(const CInterned &name);
+
+    /**
+     * Our value.  Interned values are the same object wherever they're
+     * held, so they may be compared by address.
+     */
+    const std::string &str() const
+    {
+        return (m_shared ? *m_shared : m_own);
+    };
+
+    operator const std::string &() const
+    {
+        return (str());
+    };
+
+    const char *data() const
+    {
+        return (str().data());
+    };
+
+    size_t size() const
+    {
+        return (str().size());
+    };
+
+    bool empty() const
+    {
+        return (str().empty());
+    };
+
+private:
+    const std::string *m_shared;
+    std::string m_own;
+};
+
+
+/**
+ * A compact list of header-names and their values, kept sorted by the
+ * (lower-case) name so that lookups are a binary search.  The names are
+ * interned, as the same few are shared by every message.
+ */
+typedef std::vector < std::pair < CInterned, CHeaderValue > > CHeaderList;
+
 /*
  * Forward declaration of class.
  */
 class CMessagePart;
 
 
+/**
+ * The result of parsing a message: its headers, and its MIME-parts.
+ *
+ * This is built by `CMessage::parse()`, which may be called upon any
+ * thread, and is never changed once it has been published to a message.
+ * A message replaces its snapshot as a whole, so that a reader holding
+ * one never sees it half-updated.
+ */
+class CParsedMessage
+{
+public:
+
+    /**
+     * The headers, sorted by their lower-cased names.
+     */
+    std::shared_ptr<const CHeaderList> headers;
+
+    /**
+     * The MIME-parts, each of which could contain nested children.
+     */
+    std::vector<std::shared_ptr<CMessagePart>> parts;
+};
+
+
 
 /**
  *
@@ -47,8 +146,11 @@ class CMessage
 public:
     /**
      * Constructor.
+     *
+     * Messages of a folder are usually created by `CMessageArena::message`,
+     * which gives the arena their path is to be stored within.
      */
-    CMessage(const std::string name, bool is_local = true);
+    CMessage(const std::string name, bool is_local = true, CMessageArena *arena = NULL);
 
     /**
      * Destructor.
@@ -82,11 +184,80 @@ public:
      */
     std::string header(std::string name);
 
+    /**
+     * Get a reference to the value of the given header, or to an empty
+     * string if it is not present.
+     *
+     * Unlike `header()` this copies nothing, the reference remains valid
+     * until the message is re-parsed.
+     */
+    const std::string &header_ref(const std::string &name);
+
     /**
      * Get all headers, and their values.
      */
     std::unordered_map < std::string, std::string > headers();
 
+    /**
+     * Get all headers, and their values, without copying them.
+     */
+    const CHeaderList &header_list();
+
+    /**
+     * Seed some of our headers, from a cached source such as the
+     * maildir index.  Lookups of these headers will not require the
+     * message to be parsed.
+     *
+     * If `complete` is set the headers are all those of the message,
+     * so lookups of any header will not require parsing.
+     */
+    void seed_headers(CHeaderList headers, bool complete = false);
+
+    /**
+     * Do we know our headers already, either because the message has
+     * been parsed or because they were seeded?
+     */
+    bool headers_known();
+
+    /**
+     * The number of bytes of header values we hold, excluding those
+     * which are interned.
+     */
+    size_t header_bytes();
+
+    /**
+     * Do we know all of our headers, without parsing the message again?
+     */
+    bool headers_complete()
+    {
+        return (parsed_headers() || m_seeded_complete);
+    };
+
+    /**
+     * Were our headers seeded from a cache?
+     */
+    bool headers_seeded()
+    {
+        return (! m_seeded.empty());
+    };
+
+    /**
+     * Get the inode of this message, as reported by the directory
+     * listing, if known.  Zero otherwise.
+     */
+    ino_t inode()
+    {
+        return (m_inode);
+    };
+
+    /**
+     * Set the inode of this message.
+     */
+    void set_inode(ino_t inode)
+    {
+        m_inode = inode;
+    };
+
     /**
      * Retrieve the current flags for this message.
      */
@@ -110,6 +281,65 @@ public:
         m_imap_id = n;
     };
 
+    /**
+     * Get the IMAP message ID of this message.
+     */
+    int imap_id()
+    {
+        return (m_imap_id);
+    };
+
+    /**
+     * Has the body of this IMAP message been fetched to our cache?
+     */
+    bool imap_body_cached();
+
+    /**
+     * Store the body of this IMAP message, as fetched by somebody else,
+     * unless we already have it.
+     */
+    void set_imap_body(const std::string &body);
+
+    /**
+     * Have the headers of this IMAP message been fetched to our cache,
+     * either alone or along with its body?
+     */
+    bool imap_headers_cached();
+
+    /**
+     * Is this an IMAP message of which we have only the headers?
+     */
+    bool imap_headers_only();
+
+    /**
+     * Store the header-block of this IMAP message, as fetched by somebody
+     * else, unless we already have it.
+     */
+    void set_imap_headers(const std::string &headers);
+
+
+    /**
+     * Add, and remove, the given flags with a single rename of the
+     * message.  Removing "N" from a message in `new/` moves it to `cur/`.
+     *
+     * For IMAP messages only our local copy of the flags is updated.
+     *
+     * Returns true if the flags were changed.
+     */
+    bool update_flags(std::string add, std::string remove);
+
+    /**
+     * A counter which is incremented whenever the flags of any message
+     * change, so callers can cheaply tell whether anything has.
+     */
+    static uint64_t flags_generation();
+
+    /**
+     * Our flags as a mask of the upper-case flags only, with the flag
+     * `c` held in bit `c - 'A'`.  This covers every flag maildir
+     * defines, and our own `N`.
+     */
+    uint32_t flag_letters();
 
     /**
      * Add a flag to a message.
@@ -152,6 +382,9 @@ public:
      *
      * If this message is stored on a remote IMAP-server we handle
      * that specially.
+     *
+     * The lists of messages aren't updated, use
+     * `CGlobalState::remove_messages` for that.
      */
     bool unlink();
 
@@ -163,6 +396,65 @@ public:
      */
     std::vector<std::shared_ptr<CMessagePart>> get_parts();
 
+    /**
+     * Release our parsed MIME-parts, to save memory.  They'll be
+     * re-parsed when `get_parts()` is next called.
+     */
+    void release_parts();
+
+    /**
+     * Parse the message in the given file.
+     *
+     * If `lazy` is true the content of the parts is decoded from the
+     * file only when it is wanted, otherwise it is copied as we parse.
+     * Parts needing conversion to UTF-8 are converted if `iconv` is 1.
+     *
+     * If one of the filters of `CMessageReplace` applies to the file its
+     * output is parsed instead, and its parts are never lazy.
+     *
+     * This touches no message, and neither Lua nor our configuration,
+     * so it may be called upon any thread.  On failure NULL is returned,
+     * and `error` describes why the file couldn't be opened - or is
+     * empty if it could, but didn't hold a message.
+     */
+    static std::shared_ptr<CParsedMessage> parse(const std::string &file,
+            bool lazy, int iconv,
+            std::string &error);
+
+    /**
+     * Parse the message in the given file, as `parse()` does, and decode
+     * the content of its parts, so that it's ready to be displayed.
+     *
+     * This is run upon a worker-thread, and the result given to the
+     * message by `adopt()`.
+     */
+    static std::shared_ptr<CParsedMessage> prepare(const std::string &file, int iconv);
+
+    /**
+     * Parse the message in the given file, which may be a message
+     * within an mbox, returning NULL on failure.  If the file couldn't
+     * be opened `error` describes why.
+     *
+     * If `persist` is true, and the file could be mapped, the content of
+     * the parts will refer to the file, and `lazy` is set.
+     */
+    static GMimeMessage *parse_file(const std::string &file, bool persist,
+                                    bool *lazy, std::string &error);
+
+    /**
+     * Adopt the result of preparing the given file, unless we've since
+     * been parsed, or renamed.  Returns true if we did.
+     */
+    bool adopt(const std::string &file, std::shared_ptr<const CParsedMessage> parsed);
+
+    /**
+     * Have our MIME-parts been parsed?
+     */
+    bool parts_known()
+    {
+        return (std::atomic_load(&m_parsed) != nullptr);
+    };
+
 
     /**
      * Add the named file as an attachment to this message.
@@ -190,9 +482,93 @@ public:
 
     /**
      * Retrieve the last modification time of our message.
+     *
+     * For local messages this is stat'd once, along with the size, and
+     * the result cached, unless it was seeded from the folder's index.
+     * It is forgotten when the message is rewritten.
      */
     int get_mtime();
 
+    /**
+     * Seed the modification time, and size, of our message, as they
+     * are recorded in the index of its folder.
+     */
+    void set_stat(time_t mtime, off_t size)
+    {
+        m_mtime = mtime;
+        m_size  = size;
+    };
+
+    /**
+     * Retrieve the size of our message, in bytes.
+     *
+     * This is taken from the `S=` field of the filename, if it has one,
+     * otherwise the message is stat'd once and the result cached.  The
+     * size of IMAP messages is not known, and is returned as zero.
+     */
+    off_t get_size();
+
+    /**
+     * Retrieve the date of our message, in seconds past the epoch,
+     * from the `Delivery-Date` or `Date` header.  Zero if neither can
+     * be parsed.
+     *
+     * The date is parsed once, and cached.
+     */
+    time_t get_ctime();
+
+    /**
+     * Set the date of our message, from a cached source such as the
+     * maildir index.
+     */
+    void set_ctime(time_t ctime)
+    {
+        m_ctime = ctime;
+        m_ctime_known = true;
+    };
+
+    /**
+     * Is the date of our message known, without parsing it?
+     */
+    bool ctime_known()
+    {
+        return (m_ctime_known);
+    };
+
+    /**
+     * Does this message have any attachments?
+     *
+     * The answer is cached, so the message is parsed at most once.
+     */
+    bool has_attachments();
+
+    /**
+     * Do we know whether this message has attachments, without parsing
+     * it?
+     */
+    bool attachments_known()
+    {
+        return (m_attachments != -1);
+    };
+
+    /**
+     * Was our attachment-state seeded from a cache?
+     */
+    bool attachments_seeded()
+    {
+        return (m_attachments_seeded);
+    };
+
+    /**
+     * Set whether this message has attachments, from a cached source
+     * such as the maildir index.
+     */
+    void set_attachments(bool present)
+    {
+        m_attachments = present ? 1 : 0;
+        m_attachments_seeded = true;
+    };
+
 private:
 
     /**
@@ -201,10 +577,36 @@ private:
     void lazy_load();
 
     /**
-     * Parse a MIME message and return an object suitable for operating
-     * upon.
+     * Load our IMAP-based headers, lazily, without the body.
      */
-    GMimeMessage * parse_message();
+    void lazy_load_headers();
+
+    /**
+     * Find the modification time, and size, of our local message with
+     * a single stat, caching them.  Returns false if it can't be found.
+     */
+    bool stat_file();
+
+    /**
+     * Find the file our message should be parsed from, fetching it if
+     * we're an IMAP message.  If the `message_replace` hook gave us a
+     * temporary replacement `replaced` is set, and the caller should
+     * remove it once parsed.
+     *
+     * This calls Lua, so may only be called upon the main thread.
+     */
+    std::string parse_source(bool &replaced);
+
+    /**
+     * Parse only the headers of our message, returning an object
+     * with an empty body.
+     */
+    GMimeMessage * parse_headers();
+
+    /**
+     * Populate the headers cache, without parsing the body.
+     */
+    void populate_headers();
 
     /**
      * Populate the headers and MIME-Parts caches.
@@ -212,51 +614,199 @@ private:
     void populate_message();
 
     /**
-     * Convert a message-part from the MIME message to a CMessagePart object.
+     * Publish the given snapshot, and its headers, unless we already
+     * have some.
      */
-    std::shared_ptr<CMessagePart> part2obj(GMimeObject *part);
+    void publish(std::shared_ptr<const CParsedMessage> parsed);
 
-private:
+    /**
+     * Publish our headers, unless we already have some.  Once published
+     * our headers are never replaced, so that references to them remain
+     * valid for as long as we exist.
+     */
+    void publish_headers(std::shared_ptr<const CHeaderList> headers);
 
     /**
-     * The last modification time of our message.
+     * Our parsed headers, or NULL if we've not parsed them.
      */
-    int m_time;
+    std::shared_ptr<const CHeaderList> parsed_headers()
+    {
+        return (std::atomic_load(&m_headers));
+    };
 
     /**
-     * The path on-disk to the message.
+     * Parse the message in the given file, which is not closed.
+     *
+     * If `persist` is true, and the file could be mapped, the content of
+     * the parts will refer to the file, and `lazy` is set.
+     */
+    static GMimeMessage * parse_fd(int fd, bool persist, bool *lazy);
+
+    /**
+     * Open a GMime stream reading the file upon the given descriptor,
+     * from the given offset, decompressing it if it is compressed.
+     *
+     * The caller keeps ownership of the descriptor, and `mapped` is set
+     * if the stream refers to a mapping of the file.
      */
-    std::string m_path;
+    static GMimeStream *open_stream(int fd, off_t offset, bool *mapped);
 
     /**
-     * Cached message-headers from this mail.
+     * Copy the headers of the given message into the given list.
      */
-    std::unordered_map < std::string, std::string > m_headers;
+    static void store_headers(GMimeMessage *msg, CHeaderList &headers);
 
     /**
-     * Cached MIME-parts to this message.
+     * Find the named header in the given list, returning NULL if it
+     * is not present.  The name must be lower-case.
      */
-    std::vector<std::shared_ptr<CMessagePart>> m_parts;
+    static const std::string *find_header(const CHeaderList &list, const std::string &name);
 
     /**
-     * Is this message stored in IMAP?
+     * Set the named header in the given list, replacing any existing
+     * value.  The name must be lower-case.
      */
-    bool m_imap;
+    static void set_header(CHeaderList &list, const std::string &name, const std::string &value);
+
+    /**
+     * Map a flag-character to its bit within our flags-mask, returning
+     * -1 for characters which aren't valid flags.
+     */
+    static int flag_bit(char c);
+
+    /**
+     * Convert between strings of flag-characters and flags-masks.
+     */
+    static uint64_t flags_to_mask(const std::string &flags);
+    static std::string mask_to_flags(uint64_t mask);
+
+    /**
+     * Parse the flags a local message has from its path.
+     */
+    static uint64_t path_to_mask(const std::string &path);
+
+    /**
+     * Get our flags as a mask, parsing them only once.
+     */
+    uint64_t flags_mask();
+
+    /**
+     * Rename our message to the given path, with its flags replaced by
+     * those in the mask.
+     */
+    bool rename_with_flags(std::string dst, uint64_t mask);
+
+    /**
+     * Convert a message-part to a CMessagePart object, decoding lazily
+     * from the given file if it isn't empty.  This refers to neither a
+     * message nor our configuration, so it may be called on any thread.
+     */
+    static std::shared_ptr<CMessagePart> build_part(GMimeObject *part,
+            const std::string &lazy_source,
+            int iconv);
+
+private:
+
+    /*
+     * Our members are ordered by size, so that there's little padding
+     * between them - a folder may hold many thousands of us.
+     */
+
+    /**
+     * The parent folder.
+     */
+    std::shared_ptr<CMaildir> m_parent;
+
+    /**
+     * Cached message-headers from this mail, once parsed.
+     */
+    std::shared_ptr<const CHeaderList> m_headers;
+
+    /**
+     * Cached MIME-parts to this message, along with the headers parsed
+     * alongside them.
+     */
+    std::shared_ptr<const CParsedMessage> m_parsed;
+
+    /**
+     * Headers seeded from a cache, used until the message is parsed.
+     */
+    CHeaderList m_seeded;
 
     /**
      * The flags retrieved from IMAP
      */
     std::string m_imap_flags;
 
+    /**
+     * The arena our path is held within, if any, which outlives us.
+     */
+    CMessageArena *m_arena;
+
+    /**
+     * The path on-disk to the message.
+     */
+    CArenaString m_path;
+
+    /**
+     * The size of our message, or -1 if not yet known.
+     */
+    off_t m_size;
+
+    /**
+     * The modification time of a local message, or -1 if not yet known.
+     */
+    time_t m_mtime;
+
+    /**
+     * The parsed date of our message, valid if `m_ctime_known`.
+     */
+    time_t m_ctime;
+
+    /**
+     * The inode of our message, if known.
+     */
+    ino_t m_inode;
+
+    /**
+     * Our flags, as parsed from our path, valid if `m_flags_known`.
+     */
+    uint64_t m_flags;
+
+    /**
+     * The last modification time of our message.
+     */
+    int m_time;
+
     /**
      * The IMAP ID
      */
     int m_imap_id;
 
     /**
-     * The parent folder.
+     * Whether we have attachments: -1 if unknown, otherwise 0 or 1.
      */
-    std::shared_ptr<CMaildir> m_parent;
+    int8_t m_attachments;
+    bool m_attachments_seeded;
+
+    bool m_ctime_known;
+
+    /**
+     * Are our seeded headers all those of the message?
+     */
+    bool m_seeded_complete;
+
+    /**
+     * Are our parts being tracked by the CPartCache?
+     */
+    bool m_parts_cached;
+
+    bool m_flags_known;
+
+    /**
+     * Is this message stored in IMAP?
+     */
+    bool m_imap;
 };
 
 
@@ -0,0 +1,250 @@
+/*
+ * message_arena.cc - Folder-scoped storage for message records.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+
+#include "message.h"
+#include "message_arena.h"
+
+
+/*
+ * The arena of each folder, and the lock protecting them.
+ */
+static std::unordered_map<std::string, std::weak_ptr<CMessageArena>> g_folders;
+static std::mutex g_folders_lock;
+
+
+/*
+ * The totals of every arena.
+ */
+static std::atomic<size_t> g_arenas(0);
+static std::atomic<size_t> g_reserved(0);
+static std::atomic<size_t> g_allocated(0);
+static std::atomic<size_t> g_released(0);
+
+
+/*
+ * Constructor.
+ */
+CMessageArena::CMessageArena(size_t chunk_size)
+{
+    m_next       = NULL;
+    m_left       = 0;
+    m_chunk_size = chunk_size;
+    m_reserved   = 0;
+    m_allocated  = 0;
+    m_released   = 0;
+
+    g_arenas += 1;
+}
+
+
+/*
+ * Destructor.
+ */
+CMessageArena::~CMessageArena()
+{
+    for (char *chunk : m_chunks)
+        free(chunk);
+
+    g_arenas    -= 1;
+    g_reserved  -= m_reserved;
+    g_allocated -= m_allocated;
+    g_released  -= m_released;
+}
+
+
+/*
+ * Get the arena of the given folder.
+ */
+std::shared_ptr<CMessageArena> CMessageArena::folder(const std::string &path)
+{
+    std::lock_guard<std::mutex> guard(g_folders_lock);
+
+    std::shared_ptr<CMessageArena> arena = g_folders[path].lock();
+
+    /*
+     * If most of the arena is unused its remaining messages keep it,
+     * but new messages start afresh.
+     */
+    if (arena && (arena->released() * 2 > arena->reserved()))
+        arena.reset();
+
+    if (! arena)
+    {
+        arena = std::make_shared<CMessageArena>();
+        g_folders[path] = arena;
+    }
+
+    return (arena);
+}
+
+
+/*
+ * Create a message within this arena.
+ */
+std::shared_ptr<CMessage> CMessageArena::message(const std::string &path, bool is_local)
+{
+    CArenaAllocator<CMessage> allocator(shared_from_this());
+
+    return (std::allocate_shared<CMessage>(allocator, path, is_local, this));
+}
+
+
+/*
+ * Allocate some bytes.
+ */
+void *CMessageArena::allocate(size_t bytes, size_t align)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    size_t pad = m_next ? ((align - ((uintptr_t) m_next % align)) % align) : 0;
+
+    if ((m_next == NULL) || (pad + bytes > m_left))
+    {
+        /*
+         * Anything larger than a chunk gets a chunk of its own, and
+         * malloc aligns that suitably for anything.
+         */
+        size_t size = (bytes > m_chunk_size) ? bytes : m_chunk_size;
+        char *chunk = (char *) malloc(size);
+
+        if (chunk == NULL)
+            throw std::bad_alloc();
+
+        m_chunks.push_back(chunk);
+        m_reserved += size;
+        g_reserved += size;
+
+        m_next = chunk;
+        m_left = size;
+        pad    = 0;
+    }
+
+    char *ret = m_next + pad;
+
+    m_next      += pad + bytes;
+    m_left      -= pad + bytes;
+    m_allocated += bytes;
+    g_allocated += bytes;
+
+    return (ret);
+}
+
+
+/*
+ * Note that some bytes are unused.
+ */
+void CMessageArena::release(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_released += bytes;
+    g_released += bytes;
+}
+
+
+/*
+ * Copy a string into this arena.
+ */
+const char *CMessageArena::store(const std::string &str)
+{
+    char *copy = (char *) allocate(str.size() + 1, 1);
+
+    memcpy(copy, str.c_str(), str.size() + 1);
+    return (copy);
+}
+
+
+/*
+ * Our statistics.
+ */
+size_t CMessageArena::allocated()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return (m_allocated);
+}
+
+size_t CMessageArena::released()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return (m_released);
+}
+
+size_t CMessageArena::reserved()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return (m_reserved);
+}
+
+
+/*
+ * The totals of every arena.
+ */
+void CMessageArena::totals(size_t &arenas, size_t &reserved, size_t &allocated, size_t &released)
+{
+    arenas    = g_arenas;
+    reserved  = g_reserved;
+    allocated = g_allocated;
+    released  = g_released;
+}
+
+
+/*
+ * Replace the value of a string.
+ */
+void CArenaString::assign(const std::string &str, CMessageArena *arena)
+{
+    clear(arena);
+
+    if (arena != NULL)
+        m_data = arena->store(str);
+    else
+    {
+        char *copy = (char *) malloc(str.size() + 1);
+
+        if (copy == NULL)
+            throw std::bad_alloc();
+
+        memcpy(copy, str.c_str(), str.size() + 1);
+        m_data = copy;
+    }
+
+    m_size = (uint32_t) str.size();
+}
+
+
+/*
+ * Release the value of a string.
+ */
+void CArenaString::clear(CMessageArena *arena)
+{
+    if (m_data == NULL)
+        return;
+
+    if (arena != NULL)
+        arena->release(m_size + 1);
+    else
+        free((void *) m_data);
+
+    m_data = NULL;
+    m_size = 0;
+}
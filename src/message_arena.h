@@ -0,0 +1,230 @@
+/*
+ * message_arena.h - Folder-scoped storage for message records.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+class CMessage;
+
+
+/**
+ * The default size of each chunk of an arena.
+ */
+#define ARENA_CHUNK_SIZE (256 * 1024)
+
+
+/**
+ * This class holds the records of the messages of one folder.
+ *
+ * Each message, along with the control-block of the `shared_ptr` which
+ * refers to it, and its path, is carved from large chunks rather than
+ * being allocated individually, so a folder of many thousands of
+ * messages costs little more than the records themselves.
+ *
+ * Nothing is freed until every message allocated from an arena has been
+ * destroyed, at which point the arena is too.  The bytes which would
+ * have been freed are counted, and once they're the larger part of an
+ * arena `folder()` begins a new one, leaving the old to be reclaimed as
+ * its messages are.
+ *
+ * Arenas may be used from any thread.
+ */
+class CMessageArena : public std::enable_shared_from_this<CMessageArena>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMessageArena(size_t chunk_size = ARENA_CHUNK_SIZE);
+
+    /**
+     * Destructor - frees every chunk.
+     */
+    ~CMessageArena();
+
+    /**
+     * Get the arena of the folder with the given path, creating it if
+     * there's no such arena, or if the current one is mostly unused.
+     */
+    static std::shared_ptr<CMessageArena> folder(const std::string &path);
+
+    /**
+     * Create a message with the given path within this arena.
+     */
+    std::shared_ptr<CMessage> message(const std::string &path, bool is_local = true);
+
+    /**
+     * Allocate the given number of bytes, with the given alignment.
+     */
+    void *allocate(size_t bytes, size_t align);
+
+    /**
+     * Note that the given number of bytes are no longer used.
+     */
+    void release(size_t bytes);
+
+    /**
+     * Copy the given string into this arena, terminated.
+     */
+    const char *store(const std::string &str);
+
+    /**
+     * The number of bytes allocated, and the number since released.
+     */
+    size_t allocated();
+    size_t released();
+
+    /**
+     * The number of bytes of the chunks we hold.
+     */
+    size_t reserved();
+
+    /**
+     * The totals of every arena which exists: their number, the bytes
+     * their chunks hold, and the bytes allocated and since released.
+     */
+    static void totals(size_t &arenas, size_t &reserved, size_t &allocated, size_t &released);
+
+private:
+
+    /**
+     * Protects all of the following.
+     */
+    std::mutex m_lock;
+
+    /**
+     * The chunks we've allocated.
+     */
+    std::vector<char *> m_chunks;
+
+    /**
+     * The next free byte of the current chunk, and how many remain.
+     */
+    char *m_next;
+    size_t m_left;
+
+    /**
+     * The size of each chunk.
+     */
+    size_t m_chunk_size;
+
+    /**
+     * The bytes reserved by our chunks, allocated, and released.
+     */
+    size_t m_reserved;
+    size_t m_allocated;
+    size_t m_released;
+};
+
+
+/**
+ * An allocator drawing from an arena, which it keeps alive.
+ *
+ * This is used to allocate each message and its control-block together,
+ * via `std::allocate_shared`, so that the arena lives for as long as
+ * any of its messages.
+ */
+template <typename T> class CArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    CArenaAllocator(std::shared_ptr<CMessageArena> arena) : m_arena(arena) {}
+
+    template <typename U> CArenaAllocator(const CArenaAllocator<U> &other) : m_arena(other.m_arena) {}
+
+    T *allocate(size_t n)
+    {
+        return ((T *) m_arena->allocate(n * sizeof(T), alignof(T)));
+    };
+
+    void deallocate(T *, size_t n)
+    {
+        m_arena->release(n * sizeof(T));
+    };
+
+    template <typename U> bool operator==(const CArenaAllocator<U> &other) const
+    {
+        return (m_arena == other.m_arena);
+    };
+
+    template <typename U> bool operator!=(const CArenaAllocator<U> &other) const
+    {
+        return (m_arena != other.m_arena);
+    };
+
+    std::shared_ptr<CMessageArena> m_arena;
+};
+
+
+/**
+ * A compact, immutable, string held within an arena - or upon the heap
+ * if there is no arena.
+ *
+ * The arena isn't recorded, to keep this small, so it must be given to
+ * `assign()` and `clear()` - which must be called before destruction.
+ */
+class CArenaString
+{
+public:
+    CArenaString() : m_data(NULL), m_size(0) {}
+
+    CArenaString(const CArenaString &) = delete;
+    CArenaString &operator=(const CArenaString &) = delete;
+
+    /**
+     * Replace our value.
+     */
+    void assign(const std::string &str, CMessageArena *arena);
+
+    /**
+     * Release our value.
+     */
+    void clear(CMessageArena *arena);
+
+    /**
+     * Get our value.
+     */
+    std::string str() const
+    {
+        return (m_data ? std::string(m_data, m_size) : std::string());
+    };
+
+    const char *c_str() const
+    {
+        return (m_data ? m_data : "");
+    };
+
+    size_t size() const
+    {
+        return (m_size);
+    };
+
+private:
+    const char *m_data;
+    uint32_t m_size;
+};
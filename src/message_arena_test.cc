@@ -0,0 +1,119 @@
+/*
+ * message_arena_test.cc - Test-cases for our folder-scoped message storage.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <stdint.h>
+#include <string>
+
+#include "message.h"
+#include "message_arena.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test that allocations are aligned, and counted.
+ */
+void TestArenaAllocate(CuTest * tc)
+{
+    CMessageArena arena(1024);
+
+    void *a = arena.allocate(3, 1);
+    void *b = arena.allocate(16, 8);
+
+    CuAssertTrue(tc, a != NULL);
+    CuAssertIntEquals(tc, 0, (int)((uintptr_t) b % 8));
+    CuAssertIntEquals(tc, 19, (int) arena.allocated());
+    CuAssertIntEquals(tc, 1024, (int) arena.reserved());
+
+    /*
+     * Something larger than a chunk gets one of its own.
+     */
+    arena.allocate(4096, 8);
+    CuAssertIntEquals(tc, 1024 + 4096, (int) arena.reserved());
+
+    arena.release(16);
+    CuAssertIntEquals(tc, 16, (int) arena.released());
+}
+
+
+/**
+ * Test our strings, both within an arena and upon the heap.
+ */
+void TestArenaString(CuTest * tc)
+{
+    CMessageArena arena;
+    CArenaString held, heap;
+
+    held.assign("/tmp/Maildir/cur/1234.host:2,S", &arena);
+    heap.assign("/tmp/Maildir/new/5678.host", NULL);
+
+    CuAssertStrEquals(tc, "/tmp/Maildir/cur/1234.host:2,S", held.c_str());
+    CuAssertStrEquals(tc, "/tmp/Maildir/new/5678.host", heap.str().c_str());
+    CuAssertIntEquals(tc, 26, (int) heap.size());
+
+    held.assign("/tmp/Maildir/cur/1234.host:2,RS", &arena);
+    CuAssertStrEquals(tc, "/tmp/Maildir/cur/1234.host:2,RS", held.c_str());
+    CuAssertIntEquals(tc, 31, (int) arena.released());
+
+    held.clear(&arena);
+    heap.clear(NULL);
+    CuAssertStrEquals(tc, "", held.c_str());
+    CuAssertIntEquals(tc, 0, (int) heap.size());
+}
+
+
+/**
+ * Test that a folder's messages share an arena, which lives as long as
+ * any of them.
+ */
+void TestArenaFolder(CuTest * tc)
+{
+    std::weak_ptr<CMessageArena> weak;
+    std::shared_ptr<CMessage> msg;
+
+    {
+        std::shared_ptr<CMessageArena> arena = CMessageArena::folder("/tmp/arena-test");
+        weak = arena;
+
+        CuAssertTrue(tc, arena == CMessageArena::folder("/tmp/arena-test"));
+        CuAssertTrue(tc, arena != CMessageArena::folder("/tmp/arena-other"));
+
+        msg = arena->message("/tmp/arena-test/cur/1.host:2,S");
+        arena->message("/tmp/arena-test/cur/2.host:2,");
+    }
+
+    CuAssertTrue(tc, ! weak.expired());
+    CuAssertStrEquals(tc, "/tmp/arena-test/cur/1.host:2,S", msg->path().c_str());
+
+    msg->path("/tmp/arena-test/cur/1.host:2,RS");
+    CuAssertStrEquals(tc, "/tmp/arena-test/cur/1.host:2,RS", msg->path().c_str());
+
+    msg.reset();
+    CuAssertTrue(tc, weak.expired());
+}
+
+
+CuSuite *
+message_arena_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestArenaAllocate);
+    SUITE_ADD_TEST(suite, TestArenaString);
+    SUITE_ADD_TEST(suite, TestArenaFolder);
+    return suite;
+}
@@ -0,0 +1,240 @@
+/*
+ * message_columns.cc - Contiguous per-message fields for LuaJIT's FFI.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+
+#include "global_state.h"
+#include "maildir.h"
+#include "message_columns.h"
+
+
+/*
+ * The path of the folder holding the given message: the maildir holding
+ * its `cur/` or `new/` directory, the mbox holding it, or the folder of
+ * an IMAP message.
+ */
+static std::string folder_of(std::shared_ptr<CMessage> msg)
+{
+    if (msg->is_imap())
+    {
+        std::shared_ptr<CMaildir> parent = msg->parent();
+        return (parent ? parent->path() : "");
+    }
+
+    std::string path = msg->path();
+    size_t slash = path.rfind('/');
+
+    if (slash == std::string::npos)
+        return ("");
+
+    path.erase(slash);
+
+    size_t len = path.size();
+
+    if ((len > 4) && ((path.compare(len - 4, 4, "/cur") == 0) ||
+                      (path.compare(len - 4, 4, "/new") == 0)))
+        path.erase(len - 4);
+
+    return (path);
+}
+
+
+/*
+ * Constructor.
+ */
+CMessageColumns::CMessageColumns()
+{
+    m_messages_generation = 0;
+    m_flags_generation = 0;
+    m_built = false;
+
+    m_columns.generation = 0;
+    intern("");
+    publish();
+}
+
+
+/*
+ * Get the columns of the current messages, updating them as required.
+ */
+const lumail_columns *CMessageColumns::current()
+{
+    CGlobalState *global = CGlobalState::instance();
+    uint64_t messages = global->messages_generation();
+    uint64_t flags = CMessage::flags_generation();
+
+    if (m_built && (messages == m_messages_generation) && (flags == m_flags_generation))
+        return (&m_columns);
+
+    CMessageList *list = global->get_messages();
+    CMessageList empty;
+
+    if (list == NULL)
+        list = &empty;
+
+    if (m_built && (messages == m_messages_generation))
+        refresh_flags(*list);
+    else
+        build(*list);
+
+    m_messages_generation = messages;
+    m_flags_generation = flags;
+    m_built = true;
+
+    return (&m_columns);
+}
+
+
+/*
+ * Rebuild our columns from the given messages.
+ */
+void CMessageColumns::build(CMessageList &messages)
+{
+    size_t n = messages.size();
+
+    m_ids.clear();
+    m_strings.clear();
+    intern("");
+
+    m_flags.resize(n);
+    m_ctime.resize(n);
+    m_size.resize(n);
+    m_from.resize(n);
+    m_subject.resize(n);
+    m_folder.resize(n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        std::shared_ptr<CMessage> msg = messages[i];
+
+        m_flags[i]  = msg->flag_letters();
+        m_size[i]   = (double) msg->get_size();
+        m_folder[i] = intern(folder_of(msg));
+
+        /*
+         * Don't fetch the headers of remote messages just for this,
+         * their fields remain empty until something else has.
+         */
+        if (msg->is_imap() && ! msg->headers_complete() && ! msg->imap_headers_cached())
+        {
+            m_ctime[i]   = msg->ctime_known() ? (double) msg->get_ctime() : 0;
+            m_from[i]    = 0;
+            m_subject[i] = 0;
+            continue;
+        }
+
+        m_ctime[i]   = (double) msg->get_ctime();
+        m_from[i]    = intern(msg->header_ref("from"));
+        m_subject[i] = intern(msg->header_ref("subject"));
+    }
+
+    m_columns.generation += 1;
+    publish();
+}
+
+
+/*
+ * Refresh the flags of the messages we were built from.
+ */
+void CMessageColumns::refresh_flags(CMessageList &messages)
+{
+    size_t n = std::min(messages.size(), m_flags.size());
+
+    for (size_t i = 0; i < n; i++)
+        m_flags[i] = messages[i]->flag_letters();
+}
+
+
+/*
+ * Get the ID of the given string, interning it if it is new.
+ */
+uint32_t CMessageColumns::intern(const std::string &value)
+{
+    auto it = m_ids.find(value);
+
+    if (it != m_ids.end())
+        return (it->second);
+
+    uint32_t id = (uint32_t) m_strings.size();
+    auto added = m_ids.insert(std::make_pair(value, id));
+
+    m_strings.push_back(&added.first->first);
+    return (id);
+}
+
+
+/*
+ * Find the ID of the given string, without interning it.
+ */
+bool CMessageColumns::find(const std::string &value, uint32_t &id)
+{
+    auto it = m_ids.find(value);
+
+    if (it == m_ids.end())
+        return false;
+
+    id = it->second;
+    return true;
+}
+
+
+/*
+ * Get the string with the given ID.
+ */
+const std::string &CMessageColumns::string(uint32_t id)
+{
+    if (id >= m_strings.size())
+        id = 0;
+
+    return (*m_strings[id]);
+}
+
+
+/*
+ * Point our exported structure at our arrays.
+ */
+void CMessageColumns::publish()
+{
+    m_columns.count   = (uint32_t) m_flags.size();
+    m_columns.flags   = m_flags.data();
+    m_columns.ctime   = m_ctime.data();
+    m_columns.size    = m_size.data();
+    m_columns.from    = m_from.data();
+    m_columns.subject = m_subject.data();
+    m_columns.folder  = m_folder.data();
+}
+
+
+/*
+ * The C functions we export, for LuaJIT's FFI.
+ */
+extern "C" const lumail_columns *lumail_message_columns(void)
+{
+    return (CMessageColumns::instance()->current());
+}
+
+extern "C" const char *lumail_column_string(uint32_t id, size_t *len)
+{
+    const std::string &value = CMessageColumns::instance()->string(id);
+
+    if (len != NULL)
+        *len = value.size();
+
+    return (value.c_str());
+}
@@ -0,0 +1,169 @@
+/*
+ * message_columns.h - Contiguous per-message fields for LuaJIT's FFI.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "message.h"
+#include "singleton.h"
+
+
+extern "C"
+{
+    /**
+     * The fields of the current messages, each held in an array with
+     * one entry per message, in the order of `Global:current_messages()`.
+     *
+     * - `flags` holds the upper-case flags, with flag `c` in bit `c - 'A'`.
+     * - `ctime` and `size` hold the date and size of each message.
+     * - `from` and `subject` hold the ID of each header's value, which
+     *   may be resolved with `lumail_column_string`.
+     * - `folder` holds the ID of the path of each message's folder.
+     *
+     * The structure is laid out so that it may be declared verbatim via
+     * `ffi.cdef`, and everything it points to is owned by lumail.  The
+     * arrays remain valid until `generation` changes.
+     */
+    typedef struct lumail_columns
+    {
+        double generation;
+        uint32_t count;
+        const uint32_t *flags;
+        const double *ctime;
+        const double *size;
+        const uint32_t *from;
+        const uint32_t *subject;
+        const uint32_t *folder;
+    } lumail_columns;
+
+    /**
+     * Get the columns of the current messages, updating them first if
+     * the messages, or their flags, have changed.
+     */
+    const lumail_columns *lumail_message_columns(void);
+
+    /**
+     * Get the string with the given ID, along with its length.  ID zero
+     * is always the empty string, as are unknown IDs.
+     */
+    const char *lumail_column_string(uint32_t id, size_t *len);
+}
+
+
+/**
+ * This singleton holds the columns exported via `lumail_message_columns`.
+ *
+ * The strings in the `from`, `subject`, and `folder` columns are
+ * interned, so that each distinct value is held once, and may be
+ * compared by ID.  They're
+ * discarded each time the columns are rebuilt.
+ */
+class CMessageColumns : public Singleton<CMessageColumns>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMessageColumns();
+
+    /**
+     * Get the columns of the current messages, rebuilding them if the
+     * messages have changed, and refreshing their flags if those have.
+     */
+    const lumail_columns *current();
+
+    /**
+     * Rebuild our columns from the given messages.
+     */
+    void build(CMessageList &messages);
+
+    /**
+     * Refresh the flags of the messages we were built from.
+     */
+    void refresh_flags(CMessageList &messages);
+
+    /**
+     * Get our columns, as they were last built.
+     */
+    const lumail_columns *columns()
+    {
+        return (&m_columns);
+    };
+
+    /**
+     * Get the ID of the given string, interning it if it is new.
+     */
+    uint32_t intern(const std::string &value);
+
+    /**
+     * Find the ID of the given string, without interning it.
+     */
+    bool find(const std::string &value, uint32_t &id);
+
+    /**
+     * Get the string with the given ID.
+     */
+    const std::string &string(uint32_t id);
+
+private:
+
+    /**
+     * Point our exported structure at our arrays.
+     */
+    void publish();
+
+private:
+
+    /**
+     * The structure we export, which points into the arrays below.
+     */
+    lumail_columns m_columns;
+
+    /**
+     * The arrays themselves.
+     */
+    std::vector < uint32_t > m_flags;
+    std::vector < double > m_ctime;
+    std::vector < double > m_size;
+    std::vector < uint32_t > m_from;
+    std::vector < uint32_t > m_subject;
+    std::vector < uint32_t > m_folder;
+
+    /**
+     * Our interned strings, by value, and by ID.  The latter points to
+     * the keys of the former.
+     */
+    std::unordered_map < std::string, uint32_t > m_ids;
+    std::vector < const std::string * > m_strings;
+
+    /**
+     * The generations of the messages, and of their flags, from which
+     * our columns were built.
+     */
+    uint64_t m_messages_generation;
+    uint64_t m_flags_generation;
+    bool m_built;
+};
@@ -0,0 +1,126 @@
+/*
+ * message_columns_test.cc - Test-cases for our per-message columns.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+#include "message_columns.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Create a message with the given filename, and seeded headers.
+ */
+static std::shared_ptr<CMessage> make_message(std::string dir, std::string name,
+        std::string from, std::string subject, time_t ctime)
+{
+    std::string path = dir + "/" + name;
+    FILE *fp = fopen(path.c_str(), "w");
+
+    if (fp != NULL)
+    {
+        fputs("Subject: test\n\nbody\n", fp);
+        fclose(fp);
+    }
+
+    std::shared_ptr<CMessage> msg = std::shared_ptr<CMessage>(new CMessage(path));
+
+    CHeaderList headers;
+    headers.push_back(std::make_pair("from", from));
+    headers.push_back(std::make_pair("subject", subject));
+    msg->seed_headers(headers, true);
+    msg->set_ctime(ctime);
+
+    return (msg);
+}
+
+
+/**
+ * Test the columns built from a handful of messages.
+ */
+void TestMessageColumns(CuTest * tc)
+{
+    char tmpl[] = "/tmp/columns.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string dir = tmpl;
+
+    CMessageList messages;
+    messages.push_back(make_message(dir, "1.host,S=42:2,FS", "steve@example.com", "One", 100));
+    messages.push_back(make_message(dir, "2.host:2,", "bob@example.com", "Two", 200));
+    messages.push_back(make_message(dir, "3.host:2,S", "steve@example.com", "", 300));
+
+    CMessageColumns columns;
+    columns.build(messages);
+
+    const lumail_columns *c = columns.columns();
+    CuAssertIntEquals(tc, 3, c->count);
+
+    /*
+     * Flags are held in bits, counting from 'A'.
+     */
+    CuAssertIntEquals(tc, (1 << ('F' - 'A')) | (1 << ('S' - 'A')), c->flags[0]);
+    CuAssertIntEquals(tc, 0, c->flags[1]);
+    CuAssertIntEquals(tc, (1 << ('S' - 'A')), c->flags[2]);
+
+    /*
+     * The size in the filename is preferred to that on-disk.
+     */
+    CuAssertTrue(tc, c->size[0] == 42);
+    CuAssertTrue(tc, c->size[1] == strlen("Subject: test\n\nbody\n"));
+
+    CuAssertTrue(tc, c->ctime[0] == 100);
+    CuAssertTrue(tc, c->ctime[2] == 300);
+
+    /*
+     * Equal values share an ID, and the empty string is ID zero.
+     */
+    CuAssertIntEquals(tc, c->from[0], c->from[2]);
+    CuAssertTrue(tc, c->from[0] != c->from[1]);
+    CuAssertIntEquals(tc, 0, c->subject[2]);
+    CuAssertStrEquals(tc, "bob@example.com", columns.string(c->from[1]).c_str());
+    CuAssertStrEquals(tc, "Two", columns.string(c->subject[1]).c_str());
+    CuAssertStrEquals(tc, "", columns.string(12345).c_str());
+
+    /*
+     * Flag changes are seen once refreshed.
+     */
+    double generation = c->generation;
+    CuAssertTrue(tc, messages[1]->add_flag('R'));
+    columns.refresh_flags(messages);
+    CuAssertIntEquals(tc, (1 << ('R' - 'A')), c->flags[1]);
+    CuAssertTrue(tc, c->generation == generation);
+
+    for (size_t i = 0; i < messages.size(); i++)
+        unlink(messages[i]->path().c_str());
+
+    rmdir(tmpl);
+}
+
+
+CuSuite *
+message_columns_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageColumns);
+    return suite;
+}
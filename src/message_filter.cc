@@ -0,0 +1,131 @@
+/*
+ * message_filter.cc - Native filtering of message-lists.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+#include "message_filter.h"
+#include "message_sort.h"
+#include "parallel.h"
+
+
+/**
+ * The result of testing a message.
+ */
+#define FILTER_NO    0
+#define FILTER_YES   1
+#define FILTER_DEFER 2
+
+
+/*
+ * Test a message against the given limit.
+ *
+ * If `may_parse` is false, and the message would need to be parsed to
+ * be tested, FILTER_DEFER is returned.
+ */
+static int filter_test(std::shared_ptr<CMessage> msg, const std::string &limit,
+                       time_t cutoff, bool may_parse)
+{
+    if (limit == "all")
+        return FILTER_YES;
+
+    if (limit == "new")
+        return (msg->is_new() ? FILTER_YES : FILTER_NO);
+
+    if (limit == "attach")
+    {
+        /*
+         * IMAP messages are never tested from a worker, as that might
+         * fetch their bodies.
+         */
+        if (! may_parse && (msg->is_imap() || ! msg->attachments_known()))
+            return FILTER_DEFER;
+
+        return (msg->has_attachments() ? FILTER_YES : FILTER_NO);
+    }
+
+    /*
+     * "today": messages from the past 24 hours.
+     */
+    int64_t date = 0;
+
+    if (! CMessageSort::filename_date(msg, date))
+    {
+        if (! may_parse && ! msg->ctime_known())
+            return FILTER_DEFER;
+
+        date = msg->get_ctime();
+    }
+
+    return ((date > cutoff) ? FILTER_YES : FILTER_NO);
+}
+
+
+/*
+ * Is the given limit one we implement natively?
+ */
+bool CMessageFilter::is_native(std::string limit)
+{
+    return ((limit == "all") || (limit == "attach") || (limit == "new") ||
+            (limit == "today"));
+}
+
+
+/*
+ * Filter the given messages, in place, by the given limit.
+ */
+bool CMessageFilter::filter(CMessageList &messages, std::string limit)
+{
+    if (! is_native(limit))
+        return false;
+
+    if (limit == "all")
+        return true;
+
+    size_t n = messages.size();
+    time_t cutoff = time(NULL) - (60 * 60 * 24);
+    std::vector < unsigned char > result(n);
+
+    /*
+     * Test everything we can without parsing, in parallel.
+     */
+    parallel_ranges(n, parallel_threads(n), [&messages, &result, &limit, cutoff](size_t lo, size_t hi)
+    {
+        for (size_t i = lo; i < hi; i++)
+            result[i] = filter_test(messages[i], limit, cutoff, false);
+    });
+
+    /*
+     * Now test the remainder, and keep the matches.
+     */
+    size_t kept = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (result[i] == FILTER_DEFER)
+            result[i] = filter_test(messages[i], limit, cutoff, true);
+
+        if (result[i] == FILTER_YES)
+            messages[kept++] = messages[i];
+    }
+
+    messages.resize(kept);
+    return true;
+}
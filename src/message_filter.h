@@ -0,0 +1,57 @@
+/*
+ * message_filter.h - Native filtering of message-lists.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <string>
+
+#include "message.h"
+
+
+/**
+ * This class implements the built-in values of `index.limit`, as an
+ * alternative to testing each message in Lua.
+ *
+ * Each message is first tested across several worker threads, using
+ * only what is known without parsing it: the flags in its filename,
+ * a cached date, or a cached attachment-state.  The few messages which
+ * must be parsed to be tested are then handled upon the calling thread,
+ * as neither GMime nor our part-cache may be used from several threads.
+ */
+class CMessageFilter
+{
+public:
+
+    /**
+     * Is the given limit one we implement natively?
+     *
+     * The limits are `all`, `attach`, `new`, and `today`.
+     */
+    static bool is_native(std::string limit);
+
+    /**
+     * Filter the given messages, in place, keeping those which match
+     * the given limit.  The order of the messages is preserved.
+     *
+     * Returns false, leaving the messages untouched, if the limit
+     * isn't one we implement.
+     */
+    static bool filter(CMessageList &messages, std::string limit);
+};
@@ -0,0 +1,235 @@
+/*
+ * message_format.cc - Format messages for the index-view.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <strings.h>
+#include <vector>
+
+#include "config.h"
+#include "message_format.h"
+#include "message_part.h"
+
+
+/**
+ * The default value of `index.format`, which must match that used in
+ * `global.config.lua`.
+ */
+#define DEFAULT_INDEX_FORMAT "[${4|flags}] ${2|message_flags} - ${20|sender} - ${indent}${subject}"
+
+
+/**
+ * The fields which may be used in `index.format`, in the order of the
+ * names below.
+ */
+enum
+{
+    FIELD_FLAGS,
+    FIELD_MESSAGE_FLAGS,
+    FIELD_SENDER,
+    FIELD_SENDER_NAME,
+    FIELD_SENDER_EMAIL,
+    FIELD_EMAIL,
+    FIELD_NAME,
+    FIELD_INDENT,
+    FIELD_SUBJECT,
+    FIELD_NUMBER,
+    FIELD_DATE,
+    FIELD_ID,
+    FIELD_RECIPIENT,
+    FIELD_RECIPIENT_NAME,
+    FIELD_RECIPIENT_EMAIL,
+    FIELD_MAX
+};
+
+static const std::vector < std::string > field_names =
+{
+    "flags", "message_flags", "sender", "sender_name", "sender_email",
+    "email", "name", "indent", "subject", "number", "date", "id",
+    "recipient", "recipient_name", "recipient_email"
+};
+
+
+/*
+ * Split an address such as "Steve <steve@example.com>" into its
+ * email-address and name, as the Lua patterns "<(.*)>" do.
+ */
+static void split_address(const std::string &address, std::string &email, std::string &name)
+{
+    size_t open  = address.find('<');
+    size_t close = address.rfind('>');
+
+    if ((open == std::string::npos) || (close == std::string::npos) || (close < open))
+    {
+        email = address;
+        name  = address;
+        return;
+    }
+
+    email = address.substr(open + 1, close - open - 1);
+    name  = address.substr(0, open) + address.substr(close + 1);
+}
+
+
+/*
+ * Find the informational flags of a message: "A" if it has attachments,
+ * and "S" for each signature-check.
+ */
+static void part_flags(const std::vector<std::shared_ptr<CMessagePart>> &parts,
+                       bool &attachment, std::string &signatures)
+{
+    for (std::shared_ptr<CMessagePart> part : parts)
+    {
+        if (part->type() == "text/x-gpg-output")
+            signatures += "S";
+
+        if (part->is_attachment())
+            attachment = true;
+
+        part_flags(part->children(), attachment, signatures);
+    }
+}
+
+
+/*
+ * Constructor.
+ */
+CMessageFormat::CMessageFormat()
+{
+    CConfig::instance()->subscribe(this, "index.format");
+    compile();
+}
+
+
+/*
+ * Destructor.
+ */
+CMessageFormat::~CMessageFormat()
+{
+}
+
+
+/*
+ * Compile the current value of `index.format`.
+ */
+void CMessageFormat::compile()
+{
+    std::string tmpl = CConfig::instance()->get_string("index.format", DEFAULT_INDEX_FORMAT);
+    m_template.compile(tmpl, field_names);
+}
+
+
+/*
+ * Called when a configuration-key has changed.
+ */
+void CMessageFormat::update(std::string key_name, CConfigEntry *old)
+{
+    (void)old;
+
+    if (key_name == "index.format")
+        compile();
+}
+
+
+/*
+ * Format the given message.
+ */
+const std::string &CMessageFormat::format(std::shared_ptr<CMessage> msg, const std::string &indent, int number)
+{
+    std::vector < const std::string * > values(FIELD_MAX, NULL);
+
+    std::string flags, message_flags, email, name, recipient_email;
+    std::string recipient_name, num;
+
+    if (m_template.uses(FIELD_FLAGS))
+    {
+        flags = msg->get_flags();
+        values[FIELD_FLAGS] = &flags;
+    }
+
+    /*
+     * Only parse the MIME-parts if they're going to be displayed.
+     */
+    if (m_template.uses(FIELD_MESSAGE_FLAGS))
+    {
+        bool attachment = false;
+
+        /*
+         * If we've only the headers of an IMAP message we don't fetch
+         * its body to find out, but assume that a multipart/mixed one
+         * has an attachment.
+         */
+        if (msg->imap_headers_only())
+            attachment = (strncasecmp(msg->header_ref("content-type").c_str(), "multipart/mixed", 15) == 0);
+        else
+            part_flags(msg->get_parts(), attachment, message_flags);
+
+        if (attachment)
+            message_flags = "A" + message_flags;
+
+        values[FIELD_MESSAGE_FLAGS] = &message_flags;
+    }
+
+    const std::string &sender = msg->header_ref("from");
+    split_address(sender, email, name);
+
+    /*
+     * If the name is empty we use the whole sender instead, but the
+     * recipient has no such fallback.
+     */
+    if (name.empty())
+        name = sender;
+
+    values[FIELD_SENDER]       = &sender;
+    values[FIELD_SENDER_NAME]  = &name;
+    values[FIELD_SENDER_EMAIL] = &email;
+    values[FIELD_EMAIL]        = &email;
+    values[FIELD_NAME]         = &name;
+
+    if (m_template.uses(FIELD_RECIPIENT) || m_template.uses(FIELD_RECIPIENT_NAME) ||
+            m_template.uses(FIELD_RECIPIENT_EMAIL))
+    {
+        const std::string &recipient = msg->header_ref("to");
+        split_address(recipient, recipient_email, recipient_name);
+
+        values[FIELD_RECIPIENT]       = &recipient;
+        values[FIELD_RECIPIENT_NAME]  = &recipient_name;
+        values[FIELD_RECIPIENT_EMAIL] = &recipient_email;
+    }
+
+    values[FIELD_INDENT]  = &indent;
+    values[FIELD_SUBJECT] = &msg->header_ref("subject");
+    values[FIELD_DATE]    = &msg->header_ref("date");
+    values[FIELD_ID]      = &msg->header_ref("message-id");
+
+    if (number >= 0)
+    {
+        num = std::to_string(number);
+        values[FIELD_NUMBER] = &num;
+    }
+
+    m_buffer.clear();
+
+    /*
+     * If the message is unread then show it in the "unread" colour.
+     */
+    if (msg->is_new())
+        m_buffer = "$[UNREAD]";
+
+    m_template.render(values, m_buffer);
+    return (m_buffer);
+}
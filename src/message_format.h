@@ -0,0 +1,87 @@
+/*
+ * message_format.h - Format messages for the index-view.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <string>
+
+#include "format_template.h"
+#include "message.h"
+#include "observer.h"
+#include "singleton.h"
+
+
+/**
+ * This class formats messages for display in index-mode, as the Lua
+ * function `Message:format` does.
+ *
+ * The `index.format` template is compiled once, and again whenever
+ * it is changed, rather than being expanded for every row.  Only the
+ * fields it uses are extracted from each message, and each row is
+ * rendered into a buffer which is reused.
+ */
+class CMessageFormat : public Singleton<CMessageFormat>, public Observer
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMessageFormat();
+
+    /**
+     * Destructor.
+     */
+    virtual ~CMessageFormat();
+
+    /**
+     * Format the given message, with the given thread-indentation and
+     * number.  If `number` is negative the `number` field is left
+     * unexpanded, as in Lua.
+     *
+     * The result is valid until the next call.
+     */
+    const std::string &format(std::shared_ptr<CMessage> msg, const std::string &indent, int number);
+
+    /**
+     * Called when a configuration-key has changed.
+     */
+    void update(std::string key_name, CConfigEntry *old);
+
+private:
+
+    /**
+     * Compile the current value of `index.format`.
+     */
+    void compile();
+
+private:
+
+    /**
+     * The compiled template.
+     */
+    CFormatTemplate m_template;
+
+    /**
+     * The buffer into which rows are rendered.
+     */
+    std::string m_buffer;
+};
@@ -0,0 +1,396 @@
+/*
+ * message_id_index.cc - Find messages, by their ID, across every maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "directory.h"
+#include "maildir_index.h"
+#include "message_id_index.h"
+
+
+/*
+ * The first line of our file.
+ */
+#define MESSAGE_ID_MAGIC "LMID 1"
+
+
+/*
+ * Where a message was recorded: the position of its maildir, and its
+ * path relative to that.
+ */
+typedef struct _id_location
+{
+    uint32_t folder;
+    std::string name;
+} id_location;
+
+
+/*
+ * The file our index was loaded from, the maildirs it covers, the
+ * locations of each Message-ID, and the IDs recorded for each maildir.
+ *
+ * The latter point at the keys of `g_ids`, which never move.
+ */
+static std::string g_file;
+static bool g_loaded = false;
+static std::vector<std::string> g_folders;
+static std::unordered_map<std::string, std::vector<id_location> > g_ids;
+static std::vector<std::vector<const std::string *> > g_folder_ids;
+static std::mutex g_lock;
+
+
+/*
+ * The file holding the index.
+ */
+std::string CMessageIdIndex::index_file()
+{
+    std::string dir = CMaildirIndex::index_dir();
+
+    if (dir.empty())
+        return "";
+
+    return (dir + "/" MESSAGE_ID_FILE);
+}
+
+
+/*
+ * Normalize a Message-ID.
+ */
+std::string CMessageIdIndex::normalize(const std::string &id)
+{
+    std::string out;
+    out.reserve(id.size());
+
+    for (char c : id)
+    {
+        if ((c == '<') || (c == '>') || isspace((unsigned char) c))
+            continue;
+
+        out.push_back(c);
+    }
+
+    return (out);
+}
+
+
+/*
+ * Load the given index.
+ */
+void CMessageIdIndex::load(const std::string &file)
+{
+    if (g_loaded && (g_file == file))
+        return;
+
+    g_file   = file;
+    g_loaded = true;
+    g_folders.clear();
+    g_ids.clear();
+    g_folder_ids.clear();
+
+    std::ifstream in(file);
+    std::string line;
+
+    if (! std::getline(in, line) || (line != MESSAGE_ID_MAGIC))
+        return;
+
+    /*
+     * Each maildir is introduced by a line naming it, and followed by a
+     * line for each of its messages.
+     */
+    while (std::getline(in, line))
+    {
+        size_t tab = line.find('\t');
+
+        if (tab == std::string::npos)
+            continue;
+
+        if (line.compare(0, tab, "F") == 0)
+        {
+            g_folders.push_back(line.substr(tab + 1));
+            g_folder_ids.push_back(std::vector<const std::string *>());
+            continue;
+        }
+
+        if (g_folders.empty())
+            continue;
+
+        id_location location;
+        location.folder = g_folders.size() - 1;
+        location.name   = line.substr(0, tab);
+
+        auto it = g_ids.insert(std::make_pair(line.substr(tab + 1), std::vector<id_location>())).first;
+        it->second.push_back(location);
+        g_folder_ids.back().push_back(&it->first);
+    }
+}
+
+
+/*
+ * Write our index.
+ */
+bool CMessageIdIndex::save(const std::string &file)
+{
+    std::string dir = file.substr(0, file.find_last_of('/'));
+    CDirectory::mkdir_p(dir);
+
+    std::string tmp = file + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+
+    if (fp == NULL)
+        return false;
+
+    bool ok = (fprintf(fp, "%s\n", MESSAGE_ID_MAGIC) > 0);
+
+    for (size_t f = 0; ok && (f < g_folders.size()); f++)
+    {
+        ok = (fprintf(fp, "F\t%s\n", g_folders[f].c_str()) > 0);
+
+        /*
+         * An ID recorded several times is written once, with each of
+         * its locations.
+         */
+        std::vector<const std::string *> ids = g_folder_ids[f];
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+        for (const std::string *id : ids)
+        {
+            for (const id_location &location : g_ids[*id])
+            {
+                if (ok && (location.folder == f))
+                    ok = (fprintf(fp, "%s\t%s\n", location.name.c_str(), id->c_str()) > 0);
+            }
+        }
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+
+    if (! ok || (rename(tmp.c_str(), file.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Replace the entries of the given maildir.
+ */
+bool CMessageIdIndex::update(std::string file, std::string maildir,
+                             const std::vector<std::string> &names,
+                             const std::vector<std::string> &ids)
+{
+    if (file.empty())
+        return false;
+
+    std::lock_guard<std::mutex> guard(g_lock);
+
+    load(file);
+
+    /*
+     * Find the maildir, adding it if it is new.
+     */
+    uint32_t folder = 0;
+
+    while ((folder < g_folders.size()) && (g_folders[folder] != maildir))
+        folder++;
+
+    if (folder == g_folders.size())
+    {
+        g_folders.push_back(maildir);
+        g_folder_ids.push_back(std::vector<const std::string *>());
+    }
+
+    /*
+     * Remove its previous entries.  An ID recorded several times is
+     * visited once, as its key may be freed.
+     */
+    std::vector<const std::string *> &old = g_folder_ids[folder];
+    std::sort(old.begin(), old.end());
+    old.erase(std::unique(old.begin(), old.end()), old.end());
+
+    for (const std::string *id : old)
+    {
+        auto it = g_ids.find(*id);
+
+        if (it == g_ids.end())
+            continue;
+
+        std::vector<id_location> &locations = it->second;
+        locations.erase(std::remove_if(locations.begin(), locations.end(),
+                                       [folder](const id_location &l)
+        {
+            return (l.folder == folder);
+        }), locations.end());
+
+        if (locations.empty())
+            g_ids.erase(it);
+    }
+
+    old.clear();
+
+    /*
+     * Add the new.
+     */
+    for (size_t i = 0; (i < names.size()) && (i < ids.size()); i++)
+    {
+        std::string id = normalize(ids[i]);
+
+        /*
+         * Names and IDs containing separators can't be stored.
+         */
+        if (id.empty() || (names[i].find_first_of("\t\n") != std::string::npos))
+            continue;
+
+        id_location location;
+        location.folder = folder;
+        location.name   = names[i];
+
+        auto it = g_ids.insert(std::make_pair(id, std::vector<id_location>())).first;
+        it->second.push_back(location);
+        old.push_back(&it->first);
+    }
+
+    return (save(file));
+}
+
+
+/*
+ * Find the current path of a message.
+ */
+std::string CMessageIdIndex::locate(const std::string &maildir, const std::string &name)
+{
+    std::string path = maildir + "/" + name;
+
+    if (access(path.c_str(), F_OK) == 0)
+        return (path);
+
+    /*
+     * The message has been renamed, or moved between `new/` and `cur/`,
+     * so look for the unique part of its name - which precedes any
+     * flags.
+     */
+    std::string unique = name.substr(name.find('/') + 1);
+    unique = unique.substr(0, unique.find(':'));
+
+    const char *dirs[] = { "/cur/", "/new/" };
+
+    for (const char *dir : dirs)
+    {
+        std::string prefix = maildir + dir;
+        DIR *dp = opendir(prefix.c_str());
+
+        if (dp == NULL)
+            continue;
+
+        dirent *de;
+
+        while ((de = readdir(dp)) != NULL)
+        {
+            size_t len = unique.size();
+
+            if ((strncmp(de->d_name, unique.c_str(), len) == 0) &&
+                    ((de->d_name[len] == '\0') || (de->d_name[len] == ':')))
+            {
+                path = prefix + de->d_name;
+                closedir(dp);
+                return (path);
+            }
+        }
+
+        closedir(dp);
+    }
+
+    return "";
+}
+
+
+/*
+ * Find the paths of the messages with the given ID.
+ */
+std::vector<std::string> CMessageIdIndex::find(std::string file, std::string id)
+{
+    std::vector<std::string> paths;
+
+    if (file.empty())
+        return (paths);
+
+    std::vector<std::pair<std::string, std::string> > found;
+
+    {
+        std::lock_guard<std::mutex> guard(g_lock);
+
+        load(file);
+
+        auto it = g_ids.find(normalize(id));
+
+        if (it == g_ids.end())
+            return (paths);
+
+        for (const id_location &location : it->second)
+            found.push_back(std::make_pair(g_folders[location.folder], location.name));
+    }
+
+    /*
+     * The filesystem is only consulted once we've released our lock.
+     */
+    for (auto location : found)
+    {
+        std::string path = locate(location.first, location.second);
+
+        if (! path.empty())
+            paths.push_back(path);
+    }
+
+    return (paths);
+}
+
+
+/*
+ * The number of distinct Message-IDs indexed.
+ */
+size_t CMessageIdIndex::count(std::string file)
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+
+    load(file);
+    return (g_ids.size());
+}
+
+
+/*
+ * The number of maildirs indexed.
+ */
+size_t CMessageIdIndex::folders(std::string file)
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+
+    load(file);
+    return (g_folders.size());
+}
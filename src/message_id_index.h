@@ -0,0 +1,111 @@
+/*
+ * message_id_index.h - Find messages, by their ID, across every maildir.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+
+/**
+ * The name of our file, within the directory of the maildir indexes.
+ */
+#define MESSAGE_ID_FILE "message-ids"
+
+
+/**
+ * This class maintains a persistent index of the Message-IDs of the
+ * messages in every local maildir, so that a message may be found
+ * without knowing which folder it lives in - for example the parent of
+ * a reply which has been archived, or the other copies of a duplicate.
+ *
+ * The index is updated whenever a maildir's own index is written, from
+ * the messages recorded there, so it covers each folder as it is
+ * indexed.  It lives beside the maildir indexes, and is loaded the first
+ * time it is used.
+ *
+ * Filenames change when a message's flags do, so a message which isn't
+ * where we recorded it is looked for by the unique part of its name.
+ *
+ * The index may be used from any thread.
+ */
+class CMessageIdIndex
+{
+public:
+
+    /**
+     * The file holding the index, or the empty string if indexing is
+     * disabled.  This reads our configuration, so must be called from
+     * the main thread.
+     */
+    static std::string index_file();
+
+    /**
+     * Normalize a Message-ID, removing any whitespace and angle-brackets.
+     */
+    static std::string normalize(const std::string &id);
+
+    /**
+     * Replace the entries of the given maildir, and write the index to
+     * the given file.
+     *
+     * Each of the `names` is the path of a message relative to its
+     * maildir, such as "cur/1234.host:2,S", and `ids` are their
+     * Message-IDs.
+     */
+    static bool update(std::string file, std::string maildir,
+                       const std::vector<std::string> &names,
+                       const std::vector<std::string> &ids);
+
+    /**
+     * Find the paths of the messages with the given Message-ID, which
+     * may be empty.  There will be several if the message is duplicated.
+     */
+    static std::vector<std::string> find(std::string file, std::string id);
+
+    /**
+     * The number of distinct Message-IDs, and of maildirs, indexed.
+     */
+    static size_t count(std::string file);
+    static size_t folders(std::string file);
+
+private:
+
+    /**
+     * Load the given index, unless it is the one we hold.
+     *
+     * The caller must hold our lock.
+     */
+    static void load(const std::string &file);
+
+    /**
+     * Write our index to the given file.
+     *
+     * The caller must hold our lock.
+     */
+    static bool save(const std::string &file);
+
+    /**
+     * Find the current path of a message which was recorded with the
+     * given name, returning the empty string if it has gone.
+     */
+    static std::string locate(const std::string &maildir, const std::string &name);
+};
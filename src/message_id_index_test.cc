@@ -0,0 +1,147 @@
+/*
+ * message_id_index_test.cc - Test-cases for our index of Message-IDs.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "directory.h"
+#include "message_id_index.h"
+#include "CuTest.h"
+
+
+/**
+ * Create a message-file.
+ */
+static void create(std::string path)
+{
+    std::fstream fs;
+    fs.open(path, std::fstream::out);
+    fs << "Subject: test\n\nBody\n";
+    fs.close();
+}
+
+
+/**
+ * Test normalizing Message-IDs.
+ */
+void TestMessageIdNormalize(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "abc@example.com", CMessageIdIndex::normalize("<abc@example.com>").c_str());
+    CuAssertStrEquals(tc, "abc@example.com", CMessageIdIndex::normalize(" <abc@example.com>\n").c_str());
+    CuAssertStrEquals(tc, "abc@example.com", CMessageIdIndex::normalize("abc@example.com").c_str());
+    CuAssertStrEquals(tc, "", CMessageIdIndex::normalize("<>").c_str());
+}
+
+
+/**
+ * Test finding messages across maildirs.
+ */
+void TestMessageIdFind(CuTest * tc)
+{
+    char tmpl[] = "/tmp/msgid.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(tmpl) != NULL);
+
+    std::string prefix = tmpl;
+    std::string inbox  = prefix + "/inbox";
+    std::string archive = prefix + "/archive";
+    std::string file   = prefix + "/index/" MESSAGE_ID_FILE;
+
+    CDirectory::mkdir_p(inbox + "/cur");
+    CDirectory::mkdir_p(inbox + "/new");
+    CDirectory::mkdir_p(archive + "/cur");
+    CDirectory::mkdir_p(archive + "/new");
+
+    create(inbox + "/new/1");
+    create(inbox + "/cur/2:2,S");
+    create(archive + "/cur/3:2,S");
+
+    std::vector<std::string> names, ids;
+    names.push_back("new/1");
+    ids.push_back("<one@example.com>");
+    names.push_back("cur/2:2,S");
+    ids.push_back("<two@example.com>");
+
+    CuAssertTrue(tc, CMessageIdIndex::update(file, inbox, names, ids));
+
+    names.clear();
+    ids.clear();
+    names.push_back("cur/3:2,S");
+    ids.push_back("<two@example.com>");
+
+    CuAssertTrue(tc, CMessageIdIndex::update(file, archive, names, ids));
+
+    CuAssertIntEquals(tc, 2, CMessageIdIndex::count(file));
+    CuAssertIntEquals(tc, 2, CMessageIdIndex::folders(file));
+
+    /*
+     * Found with, or without, angle-brackets - and duplicates are found
+     * in each maildir.
+     */
+    std::vector<std::string> found = CMessageIdIndex::find(file, "one@example.com");
+    CuAssertIntEquals(tc, 1, found.size());
+    CuAssertStrEquals(tc, (inbox + "/new/1").c_str(), found[0].c_str());
+
+    found = CMessageIdIndex::find(file, "<two@example.com>");
+    CuAssertIntEquals(tc, 2, found.size());
+
+    CuAssertIntEquals(tc, 0, CMessageIdIndex::find(file, "three@example.com").size());
+
+    /*
+     * A message whose flags have changed is still found.
+     */
+    CuAssertIntEquals(tc, 0, rename((inbox + "/new/1").c_str(), (inbox + "/cur/1:2,RS").c_str()));
+
+    found = CMessageIdIndex::find(file, "one@example.com");
+    CuAssertIntEquals(tc, 1, found.size());
+    CuAssertStrEquals(tc, (inbox + "/cur/1:2,RS").c_str(), found[0].c_str());
+
+    /*
+     * The index is persistent.
+     */
+    CuAssertIntEquals(tc, 0, CMessageIdIndex::count(prefix + "/missing"));
+    CuAssertIntEquals(tc, 2, CMessageIdIndex::count(file));
+    CuAssertIntEquals(tc, 2, CMessageIdIndex::find(file, "two@example.com").size());
+
+    /*
+     * Updating a maildir replaces its entries.
+     */
+    names.clear();
+    ids.clear();
+    CuAssertTrue(tc, CMessageIdIndex::update(file, archive, names, ids));
+    CuAssertIntEquals(tc, 1, CMessageIdIndex::find(file, "two@example.com").size());
+
+    /*
+     * Cleanup.
+     */
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+CuSuite *
+message_id_index_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageIdNormalize);
+    SUITE_ADD_TEST(suite, TestMessageIdFind);
+    return suite;
+}
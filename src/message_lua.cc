@@ -32,13 +32,17 @@
 #include <unordered_map>
 #include <vector>
 
-#include "approxidate.h"
+#include "config.h"
 #include "file.h"
 #include "global_state.h"
+#include "host_identity.h"
 #include "lua.h"
 #include "message.h"
+#include "message_format.h"
+#include "message_id_index.h"
 #include "message_part.h"
 #include "message_part_lua.h"
+#include "message_replace.h"
 
 
 /**
@@ -56,10 +60,6 @@
  */
 
 
-
-int l_CNet_hostname(lua_State * L);
-
-
 /**
  * Push a CMessage pointer onto the Lua stack.
  */
@@ -97,6 +97,33 @@ void push_cmessage(lua_State * l, std::shared_ptr<CMessage> message)
     lua_setmetatable(l, -2);
 }
 
+
+/**
+ * Push a table of CMessage pointers onto the Lua stack.
+ *
+ * This is `push_cmessage` for each message, but looks up the metatable
+ * only once, as folders may hold tens of thousands of messages.
+ */
+void push_cmessages(lua_State * l, const CMessageList &messages)
+{
+    CLuaLog("push_cmessages");
+
+    lua_createtable(l, messages.size(), 0);
+    luaL_getmetatable(l, "luaL_CMessage");
+
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        void *ud = lua_newuserdata(l, sizeof(std::shared_ptr<CMessage>));
+        new(ud) std::shared_ptr<CMessage>(messages[i]);
+
+        lua_pushvalue(l, -2);
+        lua_setmetatable(l, -2);
+        lua_rawseti(l, -3, i + 1);
+    }
+
+    lua_pop(l, 1);
+}
+
 /**
  * Implementation for Message.new
  */
@@ -149,6 +176,33 @@ int l_CMessage_path(lua_State * l)
 }
 
 
+/**
+ * Implementation for Message:format_index()
+ *
+ * Format the message for the index-view, with the optional thread
+ * indentation and message-number, using the compiled `index.format`.
+ */
+int l_CMessage_format_index(lua_State *l)
+{
+    CLuaLog("l_CMessage_format_index");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    std::string indent;
+    int number = -1;
+
+    if (lua_isstring(l, 2))
+        indent = lua_tostring(l, 2);
+
+    if (lua_isnumber(l, 3))
+        number = lua_tointeger(l, 3);
+
+    const std::string &out = CMessageFormat::instance()->format(foo, indent, number);
+    lua_pushlstring(l, out.data(), out.size());
+    return 1;
+}
+
+
 /**
  * Implementation for Message:generate_message_id()
  */
@@ -156,20 +210,15 @@ int l_CMessage_generate_message_id(lua_State *L)
 {
     CLuaLog("l_CMessage_generate_message_id");
 
-    char *name = (char *)"example.org";
+    std::string name = CHostIdentity::instance()->fqdn();
 
-    /*
-     * Defined in net_lua.cc
-     */
-    if (l_CNet_hostname(L) == 1)
-    {
-        name = (char *)lua_tostring(L, -1);
-    }
+    if (name.empty())
+        name = "example.org";
 
     /*
      * Generate a new ID.
      */
-    char *message_id = g_mime_utils_generate_message_id(name);
+    char *message_id = g_mime_utils_generate_message_id(name.c_str());
     std::string result(message_id);
     result = "<" + result + ">";
     g_free(message_id);
@@ -192,10 +241,10 @@ int l_CMessage_header(lua_State * l)
     /* Get the header. */
     const char *str = luaL_checkstring(l, 2);
     CLuaLog("l_CMessage_header(" + std::string(str) + ")");
-    std::string result = foo->header(str);
+    const std::string &result = foo->header_ref(str);
 
     /* set the retulr */
-    lua_pushstring(l, result.c_str());
+    lua_pushlstring(l, result.data(), result.size());
     return 1;
 
 }
@@ -211,26 +260,18 @@ int l_CMessage_headers(lua_State * l)
      * Get the headers.
      */
     std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
-    std::unordered_map < std::string, std::string > headers = foo->headers();
+    const CHeaderList &headers = foo->header_list();
 
 
     /*
      * Create the table.
      */
-    lua_newtable(l);
+    lua_createtable(l, 0, headers.size());
 
     for (auto it = headers.begin(); it != headers.end(); ++it)
     {
-        std::string name = it->first;
-        std::string value = it->second;
-
-        lua_pushstring(l, name.c_str());
-
-        if (!value.empty())
-            lua_pushstring(l, value.c_str());
-        else
-            lua_pushstring(l, "");
-
+        lua_pushlstring(l, it->first.data(), it->first.size());
+        lua_pushlstring(l, it->second.data(), it->second.size());
         lua_settable(l, -3);
     }
 
@@ -263,6 +304,21 @@ int l_CMessage_mark_unread(lua_State *l)
 }
 
 
+/**
+ * Implementation for Message:has_attachments()
+ *
+ * The answer is cached, and stored in the maildir index.
+ */
+int l_CMessage_has_attachments(lua_State *l)
+{
+    CLuaLog("l_CMessage_has_attachments");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+    lua_pushboolean(l, foo->has_attachments());
+    return 1;
+}
+
+
 /**
  * Implementation for Message:mtime()
  */
@@ -278,6 +334,71 @@ int l_CMessage_mtime(lua_State *l)
 }
 
 
+/**
+ * Implementation for Message:size()
+ */
+int l_CMessage_size(lua_State *l)
+{
+    CLuaLog("l_CMessage_size");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    lua_pushnumber(l, (lua_Number) foo->get_size());
+    return 1;
+}
+
+
+/**
+ * Implementation for Message:parent()
+ *
+ * Find the message this one replies to, in any maildir, via our index
+ * of Message-IDs.  Returns nil if it can't be found.
+ */
+int l_CMessage_parent(lua_State * l)
+{
+    CLuaLog("l_CMessage_parent");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+
+    /*
+     * The parent is the message named by `In-Reply-To`, or failing
+     * that the last of the `References`.
+     */
+    std::string id;
+    const char *headers[] = { "in-reply-to", "references" };
+
+    for (const char *header : headers)
+    {
+        const std::string &value = foo->header_ref(header);
+        size_t end   = value.rfind('>');
+        size_t start = (end == std::string::npos) ? end : value.rfind('<', end);
+
+        if (start != std::string::npos)
+        {
+            id = value.substr(start + 1, end - start - 1);
+            break;
+        }
+    }
+
+    if (! id.empty())
+    {
+        std::string file = CMessageIdIndex::index_file();
+
+        for (std::string path : CMessageIdIndex::find(file, id))
+        {
+            if (path == foo->path())
+                continue;
+
+            push_cmessage(l, std::shared_ptr<CMessage>(new CMessage(path)));
+            return 1;
+        }
+    }
+
+    lua_pushnil(l);
+    return 1;
+}
+
+
 /**
  * Implementation for Message:parts()
  *
@@ -357,30 +478,10 @@ int l_CMessage_ctime(lua_State * l)
     std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
 
     /*
-     * Look for `Delivery-Date`, then `Date`.  If neither
-     * is present we're screwed.
-     */
-    std::string rd = foo->header("Delivery-Date");
-
-    if (rd.empty())
-        rd = foo->header("Date");
-
-    if (rd.empty())
-    {
-        lua_pushnumber(l, 0);
-        return 1;
-    }
-
-    /*
-     * Convert the result to a date.
+     * The date is parsed once, from `Delivery-Date` or `Date`, and
+     * cached by the message.
      */
-    struct timeval t;
-
-    if (0 ==  approxidate(rd.c_str(), &t))
-        lua_pushnumber(l, t.tv_sec);
-    else
-        lua_pushnumber(l, 0);
-
+    lua_pushnumber(l, foo->get_ctime());
     return 1;
 }
 
@@ -466,20 +567,124 @@ int l_CMessage_unlink(lua_State * l)
 
     std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
 
-    if (foo)
-        foo->unlink();
-
     /**
      * Update our global-state to reflect the fact that
-     * a message has been deleted.
+     * a message has been deleted, without reading the folder again.
      */
+    CMessageList messages;
+
+    if (foo)
+        messages.push_back(foo);
+
     CGlobalState *global = CGlobalState::instance();
-    global->set_message(NULL);
-    global->update_messages();
+    global->remove_messages(messages);
+
+    return 0;
+}
+
+/**
+ * Implementation of CMessage:update_flags
+ *
+ * Add and remove the given flags with a single rename.
+ */
+int l_CMessage_update_flags(lua_State * l)
+{
+    CLuaLog("l_CMessage_update_flags");
+
+    std::shared_ptr<CMessage> foo = l_CheckCMessage(l, 1);
+    const char *add    = luaL_optstring(l, 2, "");
+    const char *remove = luaL_optstring(l, 3, "");
+
+    if (foo && foo->update_flags(add, remove))
+        lua_pushboolean(l, 1);
+    else
+        lua_pushboolean(l, 0);
+
+    return 1;
+}
+
+/**
+ * Read the strings in the table at the given index, if there is one.
+ */
+static std::vector<std::string> string_array(lua_State * l, int index)
+{
+    std::vector<std::string> result;
+
+    if (lua_isnoneornil(l, index))
+        return (result);
+
+    luaL_checktype(l, index, LUA_TTABLE);
+
+#if LUA_VERSION_NUM == 501
+    int n = (int) lua_objlen(l, index);
+#else
+    int n = (int) lua_rawlen(l, index);
+#endif
+
+    for (int i = 1; i <= n; i++)
+    {
+        lua_rawgeti(l, index, i);
+
+        const char *str = lua_tostring(l, -1);
+
+        if (str != NULL)
+            result.push_back(str);
+
+        lua_pop(l, 1);
+    }
+
+    return (result);
+}
+
+
+/**
+ * Implementation of Message.add_filter
+ *
+ * Replace the messages of the given types, or containing the given
+ * markers, with the output of a command before they're parsed.
+ */
+int l_CMessage_add_filter(lua_State * l)
+{
+    CLuaLog("l_CMessage_add_filter");
+
+    replace_filter filter;
+    filter.name    = luaL_checkstring(l, 1);
+    filter.command = luaL_checkstring(l, 2);
+    filter.types   = string_array(l, 3);
+    filter.markers = string_array(l, 4);
+
+    for (std::string &type : filter.types)
+        std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+
+    int size = CConfig::instance()->get_integer("filter.cache_size", REPLACE_CACHE_BYTES);
+
+    if (size < 0)
+        size = 0;
+
+    CMessageReplace::set_cache_size(size);
+    CMessageReplace::add(filter);
 
     return 0;
 }
 
+
+/**
+ * Implementation of Message.remove_filter
+ */
+int l_CMessage_remove_filter(lua_State * l)
+{
+    CLuaLog("l_CMessage_remove_filter");
+
+    const char *name = luaL_checkstring(l, 1);
+
+    if (CMessageReplace::remove(name))
+        lua_pushboolean(l, 1);
+    else
+        lua_pushboolean(l, 0);
+
+    return 1;
+}
+
 /**
  * Register the global `Message` object to the Lua environment, and
  * setup our public methods upon which the user may operate.
@@ -491,18 +696,25 @@ void InitMessage(lua_State * l)
         {"__eq", l_CMessage_equality},
         {"__gc", l_CMessage_destructor},
         {"add_attachments", l_CMessage_add_attachments},
+        {"add_filter", l_CMessage_add_filter},
         {"ctime", l_CMessage_ctime},
         {"flags", l_CMessage_flags},
+        {"format_index", l_CMessage_format_index},
         {"generate_message_id", l_CMessage_generate_message_id},
+        {"has_attachments", l_CMessage_has_attachments},
         {"header", l_CMessage_header},
         {"headers", l_CMessage_headers},
         {"mark_read", l_CMessage_mark_read},
         {"mark_unread", l_CMessage_mark_unread},
         {"mtime", l_CMessage_mtime},
         {"new", l_CMessage_constructor},
+        {"parent", l_CMessage_parent},
         {"parts", l_CMessage_parts},
         {"path", l_CMessage_path},
+        {"remove_filter", l_CMessage_remove_filter},
+        {"size", l_CMessage_size},
         {"unlink", l_CMessage_unlink},
+        {"update_flags", l_CMessage_update_flags},
         {NULL, NULL}
     };
     luaL_newmetatable(l, "luaL_CMessage");
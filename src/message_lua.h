@@ -25,4 +25,5 @@ extern "C"
 #include "message.h"
 
 extern void push_cmessage(lua_State * l, std::shared_ptr<CMessage> message);
+extern void push_cmessages(lua_State * l, const CMessageList &messages);
 extern std::shared_ptr<CMessage> l_CheckCMessage(lua_State * l, int n);
@@ -18,9 +18,12 @@
 
 
 #include <algorithm>
+#include <fcntl.h>
 #include <string>
+#include <string.h>
 #include <vector>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "message_part.h"
 
@@ -32,11 +35,14 @@
 CMessagePart::CMessagePart(std::string type, std::string filename,
                            void *content, size_t content_length)
 {
-    m_parent         = nullptr;
     m_type           = type;
     m_filename       = filename;
     m_content        = NULL;
     m_content_length = 0;
+    m_decoded        = true;
+    m_start          = 0;
+    m_end            = 0;
+    m_encoding       = GMIME_CONTENT_ENCODING_DEFAULT;
 
     if ((content_length > 0) && (content != NULL))
     {
@@ -52,6 +58,28 @@ CMessagePart::CMessagePart(std::string type, std::string filename,
 
 }
 
+
+/*
+ * Constructor, for a part which will be decoded lazily.
+ */
+CMessagePart::CMessagePart(std::string type, std::string filename,
+                           std::string source, off_t start, off_t end,
+                           int encoding, std::string charset)
+{
+    m_type           = type;
+    m_filename       = filename;
+    m_content        = NULL;
+    m_content_length = 0;
+    m_decoded        = false;
+    m_source         = source;
+    m_start          = start;
+    m_end            = end;
+    m_encoding       = encoding;
+    m_charset        = charset;
+
+    std::transform(m_type.begin(), m_type.end(), m_type.begin(), ::tolower);
+}
+
 /*
  * Destructor.
  */
@@ -96,10 +124,13 @@ bool CMessagePart::is_attachment()
 
 
 /*
- * Get the content.
+ * Get the content, decoding it if we've not already done so.
  */
 void * CMessagePart::content()
 {
+    if (! m_decoded)
+        decode();
+
     return (m_content);
 }
 
@@ -108,7 +139,196 @@ void * CMessagePart::content()
  */
 size_t CMessagePart::content_size()
 {
-    return (m_content_length);
+    if (m_decoded)
+        return (m_content_length);
+
+    /*
+     * Estimate the decoded size from the encoded size.  Base64 encodes
+     * three bytes as four, plus a newline every 76 characters.
+     */
+    size_t encoded = (size_t)(m_end - m_start);
+
+    if (m_encoding == GMIME_CONTENT_ENCODING_BASE64)
+        return ((encoded / 77) * 57 + ((encoded % 77) * 3) / 4);
+
+    return (encoded);
+}
+
+
+/*
+ * Get the length of the decoded content held by this part, and all of
+ * its children.
+ */
+size_t CMessagePart::total_size()
+{
+    size_t total = m_content_length;
+
+    for (auto it = m_children.begin(); it != m_children.end(); ++it)
+        total += (*it)->total_size();
+
+    return (total);
+}
+
+
+/*
+ * Write the decoded content of this part to the given file.
+ */
+bool CMessagePart::write_content(std::string path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd == -1)
+        return false;
+
+    GMimeStream *output = g_mime_stream_fs_new(fd);
+    bool ret = false;
+
+    /*
+     * We can only stream the content if it needs no character-set
+     * conversion, which must be applied to the content as a whole.
+     */
+    if ((! m_decoded) && m_charset.empty())
+    {
+        ret = decode_to(output);
+    }
+    else
+    {
+        char *data = (char *) content();
+        ssize_t written = g_mime_stream_write(output, data, m_content_length);
+        ret = (written == (ssize_t) m_content_length);
+    }
+
+    int flushed = g_mime_stream_flush(output);
+
+    if (flushed != 0)
+        ret = false;
+
+    /*
+     * The stream owns the descriptor, so this closes it.
+     */
+    g_object_unref(output);
+    return (ret);
+}
+
+
+/*
+ * Update the file from which our content will be decoded.
+ */
+void CMessagePart::set_source(std::string path)
+{
+    if (! m_source.empty())
+        m_source = path;
+
+    for (auto it = m_children.begin(); it != m_children.end(); ++it)
+        (*it)->set_source(path);
+}
+
+
+/*
+ * Convert the given content from the named character-set to UTF-8.
+ */
+bool CMessagePart::to_utf8(const char *charset, char **data, size_t *length)
+{
+    iconv_t cv = g_mime_iconv_open("UTF-8", charset);
+
+    if (cv == (iconv_t) - 1)
+        return false;
+
+    char *converted = g_mime_iconv_strndup(cv, (const char *) * data, *length);
+    g_mime_iconv_close(cv);
+
+    if (converted == NULL)
+        return false;
+
+    /*
+     * Copy the result into memory which may be released via `free`.
+     */
+    size_t conv_len = strlen(converted);
+    *data = (char*)malloc(conv_len + 1);
+
+    memcpy(*data, converted, conv_len + 1);
+    *length = conv_len;
+    g_free(converted);
+
+    return true;
+}
+
+
+/*
+ * Decode our content from the source file into memory.
+ */
+void CMessagePart::decode()
+{
+    /*
+     * Only try once, even if we fail.
+     */
+    m_decoded = true;
+
+    GMimeStream *mem = g_mime_stream_mem_new();
+
+    if (decode_to(mem))
+    {
+        /*
+         * NOTE: by setting the owner to FALSE, it means unreffing the
+         * memory stream won't free the GByteArray data.
+         */
+        g_mime_stream_mem_set_owner(GMIME_STREAM_MEM(mem), FALSE);
+
+        GByteArray *res = g_mime_stream_mem_get_byte_array(GMIME_STREAM_MEM(mem));
+
+        char *data = (char *) res->data;
+        size_t len = res->len;
+        g_byte_array_free(res, FALSE);
+
+        char *original = data;
+
+        if ((! m_charset.empty()) && to_utf8(m_charset.c_str(), &data, &len))
+        {
+            /*
+             * We have a converted copy, so the original may go.
+             */
+            free(original);
+        }
+
+        if (len > 0)
+        {
+            m_content = data;
+            m_content_length = len;
+        }
+        else
+        {
+            free(data);
+        }
+    }
+
+    g_object_unref(mem);
+}
+
+
+/*
+ * Decode our content from the source file, writing it to the given
+ * stream.
+ */
+bool CMessagePart::decode_to(GMimeStream *output)
+{
+    int fd = open(m_source.c_str(), O_RDONLY, 0);
+
+    if (fd == -1)
+        return false;
+
+    /*
+     * The stream owns the descriptor, and will close it when it is
+     * released.
+     */
+    GMimeStream *input = g_mime_stream_fs_new_with_bounds(fd, m_start, m_end);
+    GMimeDataWrapper *wrapper = g_mime_data_wrapper_new_with_stream(input, (GMimeContentEncoding) m_encoding);
+
+    ssize_t written = g_mime_data_wrapper_write_to_stream(wrapper, output);
+
+    g_object_unref(wrapper);
+    g_object_unref(input);
+
+    return (written != -1);
 }
 
 
@@ -142,5 +362,5 @@ void CMessagePart::set_parent(std::shared_ptr<CMessagePart> parent)
  */
 std::shared_ptr<CMessagePart> CMessagePart::get_parent()
 {
-    return (m_parent);
+    return (m_parent.lock());
 }
@@ -22,6 +22,8 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include <sys/types.h>
+#include <gmime/gmime.h>
 
 
 /**
@@ -37,6 +39,19 @@ public:
      */
     CMessagePart(std::string type, std::string filename, void *content, size_t content_length);
 
+    /**
+     * Constructor, for a part which will be decoded lazily.
+     *
+     * Rather than holding the content we record where the (encoded)
+     * body lives within the given file, and how it is encoded.  The
+     * content is only decoded when it is first requested.
+     *
+     * If `charset` is non-empty the decoded content will be converted
+     * from that character set to UTF-8.
+     */
+    CMessagePart(std::string type, std::string filename, std::string source,
+                 off_t start, off_t end, int encoding, std::string charset);
+
     /**
      * Destructor
      */
@@ -58,15 +73,46 @@ public:
     bool is_attachment();
 
     /**
-     * Get the content.
+     * Get the content, decoding it if we've not already done so.
      */
     void *content();
 
     /**
      * Get the length of the content.
+     *
+     * If the content has not yet been decoded this is an estimate,
+     * made from the size of the encoded body.
      */
     size_t content_size();
 
+    /**
+     * Get the length of the decoded content held in memory by this
+     * part, and all of its children.
+     */
+    size_t total_size();
+
+    /**
+     * Write the decoded content of this part to the given file.
+     *
+     * If the content has not been decoded it is streamed from the
+     * message to the file, without being held in memory.
+     */
+    bool write_content(std::string path);
+
+    /**
+     * Update the file from which our content, and that of our
+     * children, will be decoded.  Used when the message is renamed.
+     */
+    void set_source(std::string path);
+
+    /**
+     * Convert the given content from the named character-set to UTF-8,
+     * updating the data and length on success.
+     *
+     * The caller remains responsible for freeing the original data.
+     */
+    static bool to_utf8(const char *charset, char **data, size_t *length);
+
     /**
      * Get the children of this part, if any.
      */
@@ -88,6 +134,19 @@ public:
     std::shared_ptr<CMessagePart> get_parent();
 
 
+private:
+
+    /**
+     * Decode our content from the source file into memory.
+     */
+    void decode();
+
+    /**
+     * Decode our content from the source file, writing it to the
+     * given stream.
+     */
+    bool decode_to(GMimeStream *output);
+
 private:
 
     /**
@@ -111,6 +170,33 @@ private:
      */
     size_t m_content_length;
 
+    /**
+     * Has our content been decoded?  This is always true for parts
+     * constructed with their content.
+     */
+    bool m_decoded;
+
+    /**
+     * The file our encoded content lives in, if we decode lazily.
+     */
+    std::string m_source;
+
+    /**
+     * The offsets of our encoded content within `m_source`.
+     */
+    off_t m_start;
+    off_t m_end;
+
+    /**
+     * The transfer-encoding of our content.
+     */
+    int m_encoding;
+
+    /**
+     * The character-set to convert our content from, if any.
+     */
+    std::string m_charset;
+
     /**
      * Children of this part.
      */
@@ -118,6 +204,9 @@ private:
 
     /**
      * Parent of this part.
+     *
+     * This is a weak reference, as our parent holds a reference to us,
+     * and otherwise neither could ever be freed.
      */
-    std::shared_ptr<CMessagePart> m_parent;
+    std::weak_ptr<CMessagePart> m_parent;
 };
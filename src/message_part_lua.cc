@@ -19,6 +19,7 @@
 
 #include "lua.h"
 #include "message_part.h"
+#include "mime.h"
 
 
 /**
@@ -201,8 +202,31 @@ int l_CMessagePart_parent(lua_State * l)
 }
 
 
+/**
+ * Implementation of MessagePart:save()
+ *
+ * Write the decoded content of this part to the named file.
+ */
+int l_CMessagePart_save(lua_State * l)
+{
+    CLuaLog("l_CMessagePart_save");
+
+    std::shared_ptr<CMessagePart> foo = l_CheckCMessagePart(l, 1);
+    const char *path = luaL_checkstring(l, 2);
+
+    if (foo->write_content(path))
+        lua_pushboolean(l, 1);
+    else
+        lua_pushboolean(l, 0);
+
+    return 1;
+}
+
+
 /**
  * Implementation of MessagePart:size()
+ *
+ * If the content has not yet been decoded this is an estimate.
  */
 int l_CMessagePart_size(lua_State * l)
 {
@@ -215,6 +239,27 @@ int l_CMessagePart_size(lua_State * l)
 }
 
 
+/**
+ * Implementation of MessagePart:detected_type()
+ *
+ * The type of the part as identified by its filename, or content,
+ * rather than by what the sender claimed.
+ */
+int l_CMessagePart_detected_type(lua_State * l)
+{
+    CLuaLog("l_CMessagePart_detected_type");
+
+    std::shared_ptr<CMessagePart> foo = l_CheckCMessagePart(l, 1);
+
+    CMime *mime = CMime::instance();
+    std::string type = mime->type(foo->content(), foo->content_size(),
+                                  foo->filename(), foo->type());
+
+    lua_pushstring(l, type.c_str());
+    return 1;
+}
+
+
 /**
  * Implementation of MessagePart:type()
  */
@@ -281,9 +326,11 @@ void InitMessagePart(lua_State * l)
     {
         {"children", l_CMessagePart_children},
         {"content", l_CMessagePart_content},
+        {"detected_type", l_CMessagePart_detected_type},
         {"filename", l_CMessagePart_filename},
         {"is_attachment", l_CMessagePart_is_attachment},
         {"parent", l_CMessagePart_parent},
+        {"save", l_CMessagePart_save},
         {"size", l_CMessagePart_size},
         {"type", l_CMessagePart_type},
         {"__gc", l_CMessagePart_destructor},
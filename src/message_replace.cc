@@ -0,0 +1,573 @@
+/*
+ * message_replace.cc - Replace messages, such as signed ones, before parsing.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <list>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "compression.h"
+#include "message_replace.h"
+
+
+/*
+ * The most results we'll cache, whatever their size, as those of
+ * messages which need no filter are tiny.
+ */
+#define REPLACE_CACHE_ENTRIES 8192
+
+
+/*
+ * The most of a message we'll read looking for the end of its headers.
+ */
+#define REPLACE_HEADER_MAX (64 * 1024)
+
+
+/*
+ * A cached result: the key of the file it came from, and its
+ * replacement - which is NULL if it needed none.
+ */
+typedef struct _filter_result
+{
+    std::string key;
+    std::shared_ptr<const std::string> content;
+} filter_result;
+
+
+/*
+ * Our filters, our results - the most recently used first - and their
+ * index, the size of our results and the most we'll keep.
+ *
+ * The epoch changes with our filters, so that results found with the
+ * old ones aren't cached.
+ */
+static std::vector<replace_filter> g_filters;
+static std::list<filter_result> g_results;
+static std::unordered_map<std::string, std::list<filter_result>::iterator> g_index;
+static size_t g_bytes = 0;
+static size_t g_limit = REPLACE_CACHE_BYTES;
+static uint64_t g_epoch = 0;
+static std::mutex g_lock;
+
+
+/*
+ * Forget our results.
+ *
+ * The caller must hold our lock.
+ */
+static void forget()
+{
+    g_results.clear();
+    g_index.clear();
+    g_bytes = 0;
+    g_epoch++;
+}
+
+
+/*
+ * The size of the given result.
+ */
+static size_t result_size(const filter_result &result)
+{
+    return (result.key.size() + (result.content ? result.content->size() : 0));
+}
+
+
+/*
+ * Add a filter.
+ */
+void CMessageReplace::add(const replace_filter &filter)
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+
+    auto it = std::find_if(g_filters.begin(), g_filters.end(),
+                           [&filter](const replace_filter & f)
+    {
+        return (f.name == filter.name);
+    });
+
+    if (it != g_filters.end())
+        *it = filter;
+    else
+        g_filters.push_back(filter);
+
+    forget();
+}
+
+
+/*
+ * Remove a filter.
+ */
+bool CMessageReplace::remove(const std::string &name)
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+
+    auto it = std::find_if(g_filters.begin(), g_filters.end(),
+                           [&name](const replace_filter & f)
+    {
+        return (f.name == name);
+    });
+
+    if (it == g_filters.end())
+        return false;
+
+    g_filters.erase(it);
+    forget();
+    return true;
+}
+
+
+/*
+ * Are there any filters?
+ */
+bool CMessageReplace::active()
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+    return (! g_filters.empty());
+}
+
+
+/*
+ * Set the size of our cache.
+ */
+void CMessageReplace::set_cache_size(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+    g_limit = bytes;
+
+    while ((g_bytes > g_limit) && ! g_results.empty())
+    {
+        g_bytes -= result_size(g_results.back());
+        g_index.erase(g_results.back().key);
+        g_results.pop_back();
+    }
+}
+
+
+/*
+ * Filter the message in the given file.
+ */
+std::shared_ptr<const std::string> CMessageReplace::apply(const std::string &file)
+{
+    std::shared_ptr<const std::string> content;
+    struct stat sb;
+
+    if (stat(file.c_str(), &sb) != 0)
+        return (content);
+
+    /*
+     * Our results are keyed by the identity of the file, along with
+     * its size and modification-time, so that they're found whatever
+     * the message is called now, and forgotten if it changes.
+     */
+    std::string key = std::to_string(sb.st_dev) + ":" + std::to_string(sb.st_ino) + ":" +
+                      std::to_string(sb.st_mtim.tv_sec) + "." + std::to_string(sb.st_mtim.tv_nsec) + ":" +
+                      std::to_string(sb.st_size);
+
+    std::vector<replace_filter> filters;
+    uint64_t epoch;
+
+    {
+        std::lock_guard<std::mutex> guard(g_lock);
+
+        if (g_filters.empty())
+            return (content);
+
+        auto found = g_index.find(key);
+
+        if (found != g_index.end())
+        {
+            g_results.splice(g_results.begin(), g_results, found->second);
+            return (found->second->content);
+        }
+
+        filters = g_filters;
+        epoch   = g_epoch;
+    }
+
+    /*
+     * Filters are run without our lock, so that several messages may be
+     * filtered at once.
+     */
+    int filter = wanted(file, filters);
+
+    if (filter >= 0)
+    {
+        std::string out;
+
+        /*
+         * A filter which failed, perhaps because an agent timed out, is
+         * tried again next time rather than being remembered as having
+         * found nothing to replace.
+         */
+        if (! run(filters[filter].command, file, out))
+            return (content);
+
+        if (! out.empty())
+            content = std::make_shared<const std::string>(std::move(out));
+    }
+
+    std::lock_guard<std::mutex> guard(g_lock);
+
+    if ((epoch != g_epoch) || (g_index.find(key) != g_index.end()))
+        return (content);
+
+    filter_result result;
+    result.key     = key;
+    result.content = content;
+
+    g_results.push_front(result);
+    g_index[key] = g_results.begin();
+    g_bytes += result_size(result);
+
+    while (((g_bytes > g_limit) || (g_results.size() > REPLACE_CACHE_ENTRIES)) &&
+            (g_results.size() > 1))
+    {
+        g_bytes -= result_size(g_results.back());
+        g_index.erase(g_results.back().key);
+        g_results.pop_back();
+    }
+
+    /*
+     * A result larger than our cache isn't kept at all.
+     */
+    if (g_bytes > g_limit)
+        forget();
+
+    return (content);
+}
+
+
+/*
+ * Find the value of the given header within the given header-block,
+ * lower-cased, and with any continuation lines unfolded.
+ */
+static std::string header_value(const std::string &headers, const char *name)
+{
+    size_t len = strlen(name);
+    size_t pos = 0;
+
+    while (pos < headers.size())
+    {
+        size_t eol = headers.find('\n', pos);
+
+        if (eol == std::string::npos)
+            eol = headers.size();
+
+        if ((eol - pos > len) && (headers[pos + len] == ':') &&
+                (strncasecmp(headers.c_str() + pos, name, len) == 0))
+        {
+            std::string value = headers.substr(pos + len + 1, eol - pos - len - 1);
+
+            while ((eol + 1 < headers.size()) && ((headers[eol + 1] == ' ') || (headers[eol + 1] == '\t')))
+            {
+                size_t next = headers.find('\n', eol + 1);
+
+                if (next == std::string::npos)
+                    next = headers.size();
+
+                value += headers.substr(eol + 1, next - eol - 1);
+                eol = next;
+            }
+
+            value.erase(std::remove(value.begin(), value.end(), '\r'), value.end());
+            value.erase(0, value.find_first_not_of(" \t"));
+            std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+            return (value);
+        }
+
+        pos = eol + 1;
+    }
+
+    return "";
+}
+
+
+/*
+ * Find the filter which applies to the message in the given file.
+ */
+int CMessageReplace::wanted(const std::string &file, const std::vector<replace_filter> &filters)
+{
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return -1;
+
+    /*
+     * Read the headers, up to the blank line which terminates them.
+     *
+     * Compressed messages are decompressed entirely, as their bodies
+     * can't be mapped to be searched.
+     */
+    std::string headers;
+    std::string content;
+    size_t body = std::string::npos;
+    char buf[8192];
+    ssize_t len;
+
+    bool compressed = CCompression::is_compressed(fd);
+
+    if (compressed)
+    {
+        if (! CCompression::read(fd, content))
+        {
+            close(fd);
+            return -1;
+        }
+
+        size_t lf   = content.find("\n\n");
+        size_t crlf = content.find("\n\r\n");
+
+        if ((crlf != std::string::npos) && ((lf == std::string::npos) || (crlf < lf)))
+            body = crlf + 3;
+        else if (lf != std::string::npos)
+            body = lf + 2;
+
+        headers = content.substr(0, std::min(body, (size_t) REPLACE_HEADER_MAX));
+    }
+
+    while (! compressed && (headers.size() < REPLACE_HEADER_MAX) && ((len = read(fd, buf, sizeof(buf))) > 0))
+    {
+        size_t from = headers.size() > 3 ? headers.size() - 3 : 0;
+        headers.append(buf, len);
+
+        size_t lf   = headers.find("\n\n", from);
+        size_t crlf = headers.find("\n\r\n", from);
+
+        if ((crlf != std::string::npos) && ((lf == std::string::npos) || (crlf < lf)))
+            body = crlf + 3;
+        else if (lf != std::string::npos)
+            body = lf + 2;
+
+        if (body != std::string::npos)
+        {
+            headers.resize(body);
+            break;
+        }
+    }
+
+    std::string type = header_value(headers, "Content-Type");
+
+    for (size_t i = 0; i < filters.size(); i++)
+    {
+        for (const std::string &prefix : filters[i].types)
+        {
+            if (type.compare(0, prefix.size(), prefix) == 0)
+            {
+                close(fd);
+                return ((int) i);
+            }
+        }
+    }
+
+    /*
+     * Only textual messages can hold markers, such as those of inline
+     * signatures, so only their bodies are searched.
+     */
+    bool markers = false;
+
+    for (const replace_filter &filter : filters)
+        markers = markers || ! filter.markers.empty();
+
+    struct stat sb;
+
+    if (! markers || (body == std::string::npos) ||
+            (! type.empty() && (type.compare(0, 5, "text/") != 0)) ||
+            (compressed ? (content.size() <= body) :
+             ((fstat(fd, &sb) != 0) || (sb.st_size <= (off_t) body))))
+    {
+        close(fd);
+        return -1;
+    }
+
+    void *map = NULL;
+
+    if (! compressed)
+    {
+        map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map == MAP_FAILED)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    close(fd);
+
+    /*
+     * Each marker must begin a line, so we look for it following a
+     * newline - including the one which ends the headers.
+     */
+    const char *start = compressed ? content.data() : (const char *) map;
+    size_t total = compressed ? content.size() : sb.st_size;
+    const char *data = start + body - 1;
+    size_t size = total - body + 1;
+    int found = -1;
+
+    for (size_t i = 0; (found < 0) && (i < filters.size()); i++)
+    {
+        for (const std::string &marker : filters[i].markers)
+        {
+            std::string needle = "\n" + marker;
+
+            if (memmem(data, size, needle.data(), needle.size()) != NULL)
+            {
+                found = (int) i;
+                break;
+            }
+        }
+    }
+
+    if (map != NULL)
+        munmap(map, sb.st_size);
+
+    return (found);
+}
+
+
+/*
+ * Run the given command upon the given file.
+ */
+bool CMessageReplace::run(const std::string &command, const std::string &file, std::string &out)
+{
+    int in = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (in == -1)
+        return false;
+
+    /*
+     * A compressed message is decompressed on its way to the command.
+     */
+    std::string cmd = command;
+
+    if (CCompression::is_compressed(in))
+        cmd = "gzip -dc | " + command;
+
+    int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int fds[2];
+
+    if ((null == -1) || (pipe2(fds, O_CLOEXEC) != 0))
+    {
+        close(in);
+
+        if (null != -1)
+            close(null);
+
+        return false;
+    }
+
+    /*
+     * Anything the command writes to its standard error would be drawn
+     * over our screen, so it is discarded.
+     */
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        dup2(in, 0);
+        dup2(fds[1], 1);
+        dup2(null, 2);
+
+        execl("/bin/sh", "sh", "-c", cmd.c_str(), (char *) NULL);
+        _exit(127);
+    }
+
+    close(in);
+    close(null);
+    close(fds[1]);
+
+    if (pid == -1)
+    {
+        close(fds[0]);
+        return false;
+    }
+
+    char buf[65536];
+    ssize_t len;
+    bool ok = true;
+
+    while ((len = read(fds[0], buf, sizeof(buf))) != 0)
+    {
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            ok = false;
+            break;
+        }
+
+        out.append(buf, len);
+    }
+
+    close(fds[0]);
+
+    int status = 0;
+    pid_t reaped;
+
+    while (((reaped = waitpid(pid, &status, 0)) == -1) && (errno == EINTR))
+        ;
+
+    /*
+     * Whatever a command which failed, or was killed, wrote is at best
+     * part of the message, so none of it is used.
+     */
+    if ((reaped != pid) || ! WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+        ok = false;
+
+    if (! ok)
+        out.clear();
+
+    return (ok);
+}
+
+
+/*
+ * Forget our results.
+ */
+void CMessageReplace::clear()
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+    forget();
+}
+
+
+/*
+ * Our statistics.
+ */
+size_t CMessageReplace::count()
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+    return (g_results.size());
+}
+
+size_t CMessageReplace::bytes()
+{
+    std::lock_guard<std::mutex> guard(g_lock);
+    return (g_bytes);
+}
@@ -0,0 +1,127 @@
+/*
+ * message_replace.h - Replace messages, such as signed ones, before parsing.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+
+/**
+ * The number of bytes of filtered messages we keep, unless we're told
+ * otherwise.
+ */
+#define REPLACE_CACHE_BYTES (16 * 1024 * 1024)
+
+
+/**
+ * A filter which replaces messages before they're parsed.
+ *
+ * The `command` is run by the shell, with the message upon its standard
+ * input, and whatever it writes is parsed in place of the message.
+ *
+ * It is applied to messages whose top-level Content-Type begins with any
+ * of the `types`, and to textual messages containing a line which begins
+ * with any of the `markers`.
+ */
+typedef struct _replace_filter
+{
+    std::string name;
+    std::string command;
+    std::vector<std::string> types;
+    std::vector<std::string> markers;
+} replace_filter;
+
+
+/**
+ * This class holds the filters which replace messages before they're
+ * parsed - for example to verify, or decrypt, those which are signed
+ * or encrypted - along with a cache of their results.
+ *
+ * Whether a message needs a filter is decided from its headers, and
+ * only the bodies of textual messages are searched for markers.  The
+ * results are cached in memory, by the identity of the file and its
+ * modification-time and size, so a message which is opened again isn't
+ * filtered again.  Messages which need no filter are cached too.
+ *
+ * Unlike the Lua `message_replace` hook filters may be applied from any
+ * thread, so messages may be filtered upon our workers before they're
+ * displayed.
+ */
+class CMessageReplace
+{
+public:
+
+    /**
+     * Add a filter, replacing any of the same name, and forgetting the
+     * results we've cached.
+     */
+    static void add(const replace_filter &filter);
+
+    /**
+     * Remove the filter with the given name, returning false if there
+     * was none.
+     */
+    static bool remove(const std::string &name);
+
+    /**
+     * Are there any filters?
+     */
+    static bool active();
+
+    /**
+     * Set the number of bytes of results we keep.
+     */
+    static void set_cache_size(size_t bytes);
+
+    /**
+     * Filter the message in the given file, returning its replacement,
+     * or NULL if no filter applies to it, or the filter failed.
+     */
+    static std::shared_ptr<const std::string> apply(const std::string &file);
+
+    /**
+     * Find the filter which applies to the message in the given file,
+     * returning its position, or -1 if there is none.
+     */
+    static int wanted(const std::string &file, const std::vector<replace_filter> &filters);
+
+    /**
+     * Run the given command with the given file as its input, returning
+     * whatever it writes.
+     *
+     * Returns false, with nothing written, if the command couldn't be
+     * run, or didn't exit with a status of zero.
+     */
+    static bool run(const std::string &command, const std::string &file, std::string &out);
+
+    /**
+     * Forget the results we've cached.
+     */
+    static void clear();
+
+    /**
+     * The number of results we've cached, and their total size.
+     */
+    static size_t count();
+    static size_t bytes();
+};
@@ -0,0 +1,211 @@
+/*
+ * message_replace_test.cc - Test-cases for the filters which replace messages.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "message_replace.h"
+#include "CuTest.h"
+
+
+/**
+ * Create a message-file.
+ */
+static void create(std::string path, std::string content)
+{
+    std::fstream fs;
+    fs.open(path, std::fstream::out);
+    fs << content;
+    fs.close();
+}
+
+
+/**
+ * A filter like that of `lib/gpg.lua`, running the given command.
+ */
+static replace_filter gpg_filter(std::string command)
+{
+    replace_filter filter;
+    filter.name    = "gpg";
+    filter.command = command;
+    filter.types.push_back("multipart/signed");
+    filter.types.push_back("application/pgp");
+    filter.markers.push_back("-----BEGIN PGP SIGNATURE-----");
+    return (filter);
+}
+
+
+/**
+ * Test finding the filter a message needs.
+ */
+void TestMessageFilterWanted(CuTest * tc)
+{
+    char tmpl[] = "/tmp/filter.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(tmpl) != NULL);
+
+    std::string prefix = tmpl;
+    std::vector<replace_filter> filters;
+    filters.push_back(gpg_filter("cat"));
+
+    /*
+     * By type - which may be folded, or differ in case.
+     */
+    create(prefix + "/signed", "Subject: test\nContent-Type:\n MultiPart/Signed; boundary=x\n\nBody\n");
+    CuAssertIntEquals(tc, 0, CMessageReplace::wanted(prefix + "/signed", filters));
+
+    create(prefix + "/plain", "Subject: test\nContent-Type: text/plain\n\nBody\n");
+    CuAssertIntEquals(tc, -1, CMessageReplace::wanted(prefix + "/plain", filters));
+
+    /*
+     * By marker, which must begin a line of the body.
+     */
+    create(prefix + "/inline", "Subject: test\r\n\r\nBody\r\n-----BEGIN PGP SIGNATURE-----\r\n");
+    CuAssertIntEquals(tc, 0, CMessageReplace::wanted(prefix + "/inline", filters));
+
+    create(prefix + "/quoted", "Subject: test\n\n> -----BEGIN PGP SIGNATURE-----\n");
+    CuAssertIntEquals(tc, -1, CMessageReplace::wanted(prefix + "/quoted", filters));
+
+    create(prefix + "/first", "Subject: test\n\n-----BEGIN PGP SIGNATURE-----\n");
+    CuAssertIntEquals(tc, 0, CMessageReplace::wanted(prefix + "/first", filters));
+
+    /*
+     * Markers within headers, or non-textual bodies, aren't found.
+     */
+    create(prefix + "/header", "Subject: test\n-----BEGIN PGP SIGNATURE-----: x\n\nBody\n");
+    CuAssertIntEquals(tc, -1, CMessageReplace::wanted(prefix + "/header", filters));
+
+    create(prefix + "/image", "Content-Type: image/png\n\n-----BEGIN PGP SIGNATURE-----\n");
+    CuAssertIntEquals(tc, -1, CMessageReplace::wanted(prefix + "/image", filters));
+
+    CuAssertIntEquals(tc, -1, CMessageReplace::wanted(prefix + "/missing", filters));
+
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+/**
+ * Test applying, and caching, filters.
+ */
+void TestMessageFilterApply(CuTest * tc)
+{
+    char tmpl[] = "/tmp/filter.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(tmpl) != NULL);
+
+    std::string prefix = tmpl;
+    std::string runs   = prefix + "/runs";
+    std::string file   = prefix + "/message";
+
+    CMessageReplace::clear();
+    CuAssertTrue(tc, ! CMessageReplace::active());
+
+    create(file, "Content-Type: multipart/signed\n\nbody\n");
+
+    /*
+     * Without filters nothing is replaced.
+     */
+    CuAssertTrue(tc, CMessageReplace::apply(file) == nullptr);
+
+    /*
+     * The command records each time it is run.
+     */
+    CMessageReplace::add(gpg_filter("echo x >> " + runs + "; tr a-z A-Z"));
+    CuAssertTrue(tc, CMessageReplace::active());
+
+    std::shared_ptr<const std::string> out = CMessageReplace::apply(file);
+    CuAssertTrue(tc, out != nullptr);
+    CuAssertStrEquals(tc, "CONTENT-TYPE: MULTIPART/SIGNED\n\nBODY\n", out->c_str());
+
+    /*
+     * The second time the result is cached.
+     */
+    out = CMessageReplace::apply(file);
+    CuAssertTrue(tc, out != nullptr);
+    CuAssertStrEquals(tc, "CONTENT-TYPE: MULTIPART/SIGNED\n\nBODY\n", out->c_str());
+    CuAssertIntEquals(tc, 1, CMessageReplace::count());
+
+    std::ifstream in(runs);
+    std::string lines((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    CuAssertStrEquals(tc, "x\n", lines.c_str());
+
+    /*
+     * Once the message changes it is filtered again.
+     */
+    create(file, "Content-Type: multipart/signed\n\nchanged body\n");
+    out = CMessageReplace::apply(file);
+    CuAssertTrue(tc, out != nullptr);
+    CuAssertStrEquals(tc, "CONTENT-TYPE: MULTIPART/SIGNED\n\nCHANGED BODY\n", out->c_str());
+
+    /*
+     * Messages needing no filter are cached without content.
+     */
+    create(prefix + "/plain", "Subject: test\n\nbody\n");
+    CuAssertTrue(tc, CMessageReplace::apply(prefix + "/plain") == nullptr);
+    CuAssertIntEquals(tc, 3, CMessageReplace::count());
+
+    /*
+     * A command which writes nothing replaces nothing.
+     */
+    CMessageReplace::add(gpg_filter("true"));
+    CuAssertIntEquals(tc, 0, CMessageReplace::count());
+    CuAssertTrue(tc, CMessageReplace::apply(file) == nullptr);
+
+    /*
+     * A command which fails replaces nothing, even with what it wrote
+     * before failing, and isn't cached, so is run again.
+     */
+    CMessageReplace::add(gpg_filter("echo x >> " + runs + "; echo partial; exit 2"));
+    CuAssertTrue(tc, CMessageReplace::apply(file) == nullptr);
+    CuAssertIntEquals(tc, 0, CMessageReplace::count());
+    CuAssertTrue(tc, CMessageReplace::apply(file) == nullptr);
+    CuAssertIntEquals(tc, 0, CMessageReplace::count());
+
+    std::ifstream again(runs);
+    std::string more((std::istreambuf_iterator<char>(again)), std::istreambuf_iterator<char>());
+    CuAssertStrEquals(tc, "x\nx\nx\nx\n", more.c_str());
+
+    /*
+     * The cache is bounded.
+     */
+    CMessageReplace::add(gpg_filter("cat"));
+    CMessageReplace::set_cache_size(8);
+    CuAssertTrue(tc, CMessageReplace::apply(file) != nullptr);
+    CuAssertIntEquals(tc, 0, CMessageReplace::count());
+    CuAssertIntEquals(tc, 0, CMessageReplace::bytes());
+
+    CMessageReplace::set_cache_size(REPLACE_CACHE_BYTES);
+    CuAssertTrue(tc, CMessageReplace::remove("gpg"));
+    CuAssertTrue(tc, ! CMessageReplace::remove("gpg"));
+    CuAssertTrue(tc, CMessageReplace::apply(file) == nullptr);
+
+    std::string cmd = "rm -rf " + prefix;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+CuSuite *
+message_replace_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageFilterWanted);
+    SUITE_ADD_TEST(suite, TestMessageFilterApply);
+    return suite;
+}
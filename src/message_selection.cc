@@ -0,0 +1,284 @@
+/*
+ * message_selection.cc - Selections of the current messages, by column.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "message_selection.h"
+
+
+/*
+ * The bit of the given flag, within the `flags` column.
+ */
+#define FLAG_BIT(c) (1U << ((c) - 'A'))
+
+
+/*
+ * Set each byte of `out` to the result of testing the matching value of
+ * the given column.
+ *
+ * The test is inlined, and neither it nor the loop branch, so that this
+ * may be vectorized.
+ */
+template <typename T, typename Test>
+static void scan(const T *column, size_t n, uint8_t *out, Test test)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = (uint8_t) test(column[i]);
+}
+
+
+/*
+ * Constructor.
+ */
+CMessageSelection::CMessageSelection(const lumail_columns *columns, bool all)
+    : m_selected(columns->count, all ? 1 : 0)
+{
+    m_generation = columns->generation;
+}
+
+
+/*
+ * Select the messages having any of the given flags.
+ */
+CMessageSelection CMessageSelection::flagged(const lumail_columns *columns, uint32_t mask)
+{
+    CMessageSelection out(columns, false);
+
+    scan(columns->flags, columns->count, out.m_selected.data(), [mask](uint32_t f)
+    {
+        return ((f & mask) != 0);
+    });
+
+    return (out);
+}
+
+
+/*
+ * Select the messages having none of the given flags.
+ */
+CMessageSelection CMessageSelection::unflagged(const lumail_columns *columns, uint32_t mask)
+{
+    CMessageSelection out(columns, false);
+
+    scan(columns->flags, columns->count, out.m_selected.data(), [mask](uint32_t f)
+    {
+        return ((f & mask) == 0);
+    });
+
+    return (out);
+}
+
+
+/*
+ * Select the new messages.
+ */
+CMessageSelection CMessageSelection::unread(const lumail_columns *columns)
+{
+    CMessageSelection out(columns, false);
+
+    scan(columns->flags, columns->count, out.m_selected.data(), [](uint32_t f)
+    {
+        return (((f & FLAG_BIT('N')) | (~f & FLAG_BIT('S'))) != 0);
+    });
+
+    return (out);
+}
+
+
+/*
+ * Select the messages dated after the given time.
+ */
+CMessageSelection CMessageSelection::since(const lumail_columns *columns, double when)
+{
+    CMessageSelection out(columns, false);
+
+    scan(columns->ctime, columns->count, out.m_selected.data(), [when](double t)
+    {
+        return (t > when);
+    });
+
+    return (out);
+}
+
+
+/*
+ * Select the messages larger than the given size.
+ */
+CMessageSelection CMessageSelection::larger(const lumail_columns *columns, double size)
+{
+    CMessageSelection out(columns, false);
+
+    scan(columns->size, columns->count, out.m_selected.data(), [size](double s)
+    {
+        return (s > size);
+    });
+
+    return (out);
+}
+
+
+/*
+ * Select the messages smaller than the given size.
+ */
+CMessageSelection CMessageSelection::smaller(const lumail_columns *columns, double size)
+{
+    CMessageSelection out(columns, false);
+
+    scan(columns->size, columns->count, out.m_selected.data(), [size](double s)
+    {
+        return (s < size);
+    });
+
+    return (out);
+}
+
+
+/*
+ * Select the messages of the given folder.
+ */
+CMessageSelection CMessageSelection::folder(const lumail_columns *columns, uint32_t id)
+{
+    CMessageSelection out(columns, false);
+
+    scan(columns->folder, columns->count, out.m_selected.data(), [id](uint32_t f)
+    {
+        return (f == id);
+    });
+
+    return (out);
+}
+
+
+/*
+ * Select the messages matching one of our built-in limits.
+ */
+bool CMessageSelection::limit(const lumail_columns *columns, const std::string &limit,
+                              CMessageSelection &out, time_t now)
+{
+    if (limit == "all")
+        out = CMessageSelection(columns, true);
+    else if (limit == "new")
+        out = unread(columns);
+    else if (limit == "today")
+        out = since(columns, (double)(now - (60 * 60 * 24)));
+    else
+        return false;
+
+    return true;
+}
+
+
+/*
+ * Convert flag-letters into a mask.
+ */
+uint32_t CMessageSelection::mask(const std::string &flags)
+{
+    uint32_t mask = 0;
+
+    for (char c : flags)
+    {
+        if ((c >= 'A') && (c <= 'Z'))
+            mask |= FLAG_BIT(c);
+    }
+
+    return (mask);
+}
+
+
+/*
+ * Keep only the messages also selected by the other selection.
+ */
+bool CMessageSelection::intersect(const CMessageSelection &other)
+{
+    if ((other.m_generation != m_generation) || (other.size() != size()))
+        return false;
+
+    uint8_t *a = m_selected.data();
+    const uint8_t *b = other.m_selected.data();
+    size_t n = m_selected.size();
+
+    for (size_t i = 0; i < n; i++)
+        a[i] &= b[i];
+
+    return true;
+}
+
+
+/*
+ * Add the messages selected by the other selection.
+ */
+bool CMessageSelection::unite(const CMessageSelection &other)
+{
+    if ((other.m_generation != m_generation) || (other.size() != size()))
+        return false;
+
+    uint8_t *a = m_selected.data();
+    const uint8_t *b = other.m_selected.data();
+    size_t n = m_selected.size();
+
+    for (size_t i = 0; i < n; i++)
+        a[i] |= b[i];
+
+    return true;
+}
+
+
+/*
+ * Select exactly the messages which aren't selected.
+ */
+void CMessageSelection::invert()
+{
+    uint8_t *a = m_selected.data();
+    size_t n = m_selected.size();
+
+    for (size_t i = 0; i < n; i++)
+        a[i] ^= 1;
+}
+
+
+/*
+ * The number of messages selected.
+ */
+size_t CMessageSelection::count() const
+{
+    const uint8_t *a = m_selected.data();
+    size_t n = m_selected.size();
+    size_t sum = 0;
+
+    for (size_t i = 0; i < n; i++)
+        sum += a[i];
+
+    return (sum);
+}
+
+
+/*
+ * The offsets of the messages selected.
+ */
+std::vector<uint32_t> CMessageSelection::offsets() const
+{
+    std::vector<uint32_t> result;
+    result.reserve(count());
+
+    for (size_t i = 0; i < m_selected.size(); i++)
+    {
+        if (m_selected[i])
+            result.push_back((uint32_t) i);
+    }
+
+    return (result);
+}
@@ -0,0 +1,159 @@
+/*
+ * message_selection.h - Selections of the current messages, by column.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "message_columns.h"
+
+
+/**
+ * A selection of the messages described by a set of columns, holding
+ * a byte for each message which is one if it is selected.
+ *
+ * Selections are made by scanning a single column, with a loop free of
+ * branches and calls, which the compiler may vectorize, and are then
+ * combined with one another before any message is looked at.  So the
+ * built-in limits, and counts such as that of the unread messages, cost
+ * a pass over a few contiguous arrays rather than a method-call upon each
+ * message.
+ *
+ * A selection remembers the generation of the columns it was made from,
+ * and may only be combined with those of the same generation.
+ */
+class CMessageSelection
+{
+public:
+
+    /**
+     * Constructor - select every message, or none, of the given columns.
+     */
+    CMessageSelection(const lumail_columns *columns, bool all);
+
+    /**
+     * Select the messages having any of the flags in the given mask.
+     */
+    static CMessageSelection flagged(const lumail_columns *columns, uint32_t mask);
+
+    /**
+     * Select the messages having none of the flags in the given mask.
+     */
+    static CMessageSelection unflagged(const lumail_columns *columns, uint32_t mask);
+
+    /**
+     * Select the new messages - those flagged `N`, or not flagged `S` -
+     * as `CMessage::is_new` would.
+     */
+    static CMessageSelection unread(const lumail_columns *columns);
+
+    /**
+     * Select the messages dated after the given time.
+     */
+    static CMessageSelection since(const lumail_columns *columns, double when);
+
+    /**
+     * Select the messages larger, or smaller, than the given size.
+     */
+    static CMessageSelection larger(const lumail_columns *columns, double size);
+    static CMessageSelection smaller(const lumail_columns *columns, double size);
+
+    /**
+     * Select the messages of the folder with the given ID.
+     */
+    static CMessageSelection folder(const lumail_columns *columns, uint32_t id);
+
+    /**
+     * Select the messages matching one of the built-in limits which
+     * may be tested from the columns alone: `all`, `new`, and `today`.
+     *
+     * Returns false if the limit is any other.
+     */
+    static bool limit(const lumail_columns *columns, const std::string &limit,
+                      CMessageSelection &out, time_t now);
+
+    /**
+     * Convert flag-letters, such as "FS", into a mask.
+     */
+    static uint32_t mask(const std::string &flags);
+
+    /**
+     * Keep only the messages also selected by the other selection.
+     *
+     * Returns false, changing nothing, if the selections were made from
+     * columns of different generations.
+     */
+    bool intersect(const CMessageSelection &other);
+
+    /**
+     * Add the messages selected by the other selection.
+     *
+     * Returns false, changing nothing, if the selections were made from
+     * columns of different generations.
+     */
+    bool unite(const CMessageSelection &other);
+
+    /**
+     * Select exactly the messages which aren't selected.
+     */
+    void invert();
+
+    /**
+     * The number of messages selected.
+     */
+    size_t count() const;
+
+    /**
+     * The offsets of the messages selected, in order.
+     */
+    std::vector<uint32_t> offsets() const;
+
+    /**
+     * The number of messages we describe, selected or not.
+     */
+    size_t size() const
+    {
+        return (m_selected.size());
+    };
+
+    /**
+     * The generation of the columns we were made from.
+     */
+    double generation() const
+    {
+        return (m_generation);
+    };
+
+private:
+
+    /**
+     * One byte per message, one if it is selected and zero otherwise.
+     */
+    std::vector<uint8_t> m_selected;
+
+    /**
+     * The generation of the columns we were made from.
+     */
+    double m_generation;
+};
@@ -0,0 +1,120 @@
+/*
+ * message_selection_test.cc - Test-cases for our selections of messages.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <vector>
+
+#include "message_selection.h"
+#include "CuTest.h"
+
+
+/**
+ * The bit of the given flag.
+ */
+#define BIT(c) (1U << ((c) - 'A'))
+
+
+/**
+ * Test each kernel, and combining selections.
+ */
+void TestMessageSelection(CuTest * tc)
+{
+    uint32_t flags[]   = { BIT('S'), 0, BIT('F') | BIT('S'), BIT('N') | BIT('S'), BIT('F') };
+    double ctime[]     = { 100, 200, 300, 400, 500 };
+    double size[]      = { 10, 2000, 30, 4000, 50 };
+    uint32_t folder[]  = { 1, 1, 2, 2, 1 };
+    uint32_t strings[] = { 0, 0, 0, 0, 0 };
+
+    lumail_columns columns;
+    columns.generation = 7;
+    columns.count      = 5;
+    columns.flags      = flags;
+    columns.ctime      = ctime;
+    columns.size       = size;
+    columns.from       = strings;
+    columns.subject    = strings;
+    columns.folder     = folder;
+
+    CuAssertIntEquals(tc, BIT('F') | BIT('S'), CMessageSelection::mask("FSx"));
+
+    CuAssertIntEquals(tc, 5, CMessageSelection(&columns, true).count());
+    CuAssertIntEquals(tc, 0, CMessageSelection(&columns, false).count());
+
+    /*
+     * New messages are those flagged `N`, or lacking `S`.
+     */
+    std::vector<uint32_t> offsets = CMessageSelection::unread(&columns).offsets();
+    CuAssertIntEquals(tc, 3, offsets.size());
+    CuAssertIntEquals(tc, 1, offsets[0]);
+    CuAssertIntEquals(tc, 3, offsets[1]);
+    CuAssertIntEquals(tc, 4, offsets[2]);
+
+    CuAssertIntEquals(tc, 2, CMessageSelection::flagged(&columns, BIT('F')).count());
+    CuAssertIntEquals(tc, 1, CMessageSelection::unflagged(&columns, BIT('F') | BIT('S')).count());
+    CuAssertIntEquals(tc, 2, CMessageSelection::since(&columns, 300).count());
+    CuAssertIntEquals(tc, 2, CMessageSelection::larger(&columns, 1000).count());
+    CuAssertIntEquals(tc, 3, CMessageSelection::smaller(&columns, 1000).count());
+    CuAssertIntEquals(tc, 3, CMessageSelection::folder(&columns, 1).count());
+    CuAssertIntEquals(tc, 0, CMessageSelection::folder(&columns, 9).count());
+
+    /*
+     * Combine: flagged, or large, within folder one.
+     */
+    CMessageSelection sel = CMessageSelection::flagged(&columns, BIT('F'));
+    CuAssertTrue(tc, sel.unite(CMessageSelection::larger(&columns, 1000)));
+    CuAssertIntEquals(tc, 4, sel.count());
+    CuAssertTrue(tc, sel.intersect(CMessageSelection::folder(&columns, 1)));
+
+    offsets = sel.offsets();
+    CuAssertIntEquals(tc, 2, offsets.size());
+    CuAssertIntEquals(tc, 1, offsets[0]);
+    CuAssertIntEquals(tc, 4, offsets[1]);
+
+    sel.invert();
+    CuAssertIntEquals(tc, 3, sel.count());
+
+    /*
+     * The built-in limits.
+     */
+    CMessageSelection out(&columns, false);
+    CuAssertTrue(tc, CMessageSelection::limit(&columns, "all", out, 0));
+    CuAssertIntEquals(tc, 5, out.count());
+    CuAssertTrue(tc, CMessageSelection::limit(&columns, "new", out, 0));
+    CuAssertIntEquals(tc, 3, out.count());
+    CuAssertTrue(tc, CMessageSelection::limit(&columns, "today", out, 350 + 60 * 60 * 24));
+    CuAssertIntEquals(tc, 2, out.count());
+    CuAssertTrue(tc, ! CMessageSelection::limit(&columns, "attach", out, 0));
+
+    /*
+     * Selections of other columns can't be combined.
+     */
+    columns.generation = 8;
+    CMessageSelection later(&columns, true);
+    CuAssertTrue(tc, ! sel.intersect(later));
+    CuAssertTrue(tc, ! sel.unite(later));
+    CuAssertIntEquals(tc, 3, sel.count());
+}
+
+
+CuSuite *
+message_selection_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageSelection);
+    return suite;
+}
@@ -0,0 +1,569 @@
+/*
+ * message_sort.cc - Native sorting of message-lists.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "maildir_index.h"
+#include "message_sort.h"
+#include "parallel.h"
+#include "sort_order.h"
+
+
+/*
+ * Compare entries by their numeric key.
+ */
+static bool compare_number(const CSortKey &a, const CSortKey &b)
+{
+    if (a.number != b.number)
+        return (a.number < b.number);
+
+    return (a.index < b.index);
+}
+
+
+/*
+ * Compare two strings in the collating order of the current locale, as
+ * Lua's `<` does - so that we sort as the Lua comparators would.
+ *
+ * strcoll() stops at a NUL, so any embedded NULs are stepped over in
+ * turn, as Lua does.
+ */
+static int collate(const std::string &a, const std::string &b)
+{
+    const char *l = a.c_str();
+    const char *r = b.c_str();
+    size_t ll = a.size();
+    size_t lr = b.size();
+
+    while (true)
+    {
+        int cmp = strcoll(l, r);
+
+        if (cmp != 0)
+            return (cmp);
+
+        size_t len = strlen(l);
+
+        if (len == lr)
+            return ((len == ll) ? 0 : 1);
+
+        if (len == ll)
+            return (-1);
+
+        len += 1;
+        l   += len;
+        ll  -= len;
+        r   += len;
+        lr  -= len;
+    }
+}
+
+
+/*
+ * Compare two keys, ignoring their positions.
+ */
+static int compare_keys(const CSortKey &a, const CSortKey &b)
+{
+    if (a.text != NULL)
+        return ((a.text == b.text) ? 0 : collate(*a.text, *b.text));
+
+    if (a.number != b.number)
+        return ((a.number < b.number) ? -1 : 1);
+
+    return 0;
+}
+
+
+/*
+ * Compare entries by their textual key.
+ */
+static bool compare_text(const CSortKey &a, const CSortKey &b)
+{
+    /*
+     * Interned values, such as senders, are shared - so equal values are
+     * often the same string.
+     */
+    int cmp = (a.text == b.text) ? 0 : collate(*a.text, *b.text);
+
+    if (cmp != 0)
+        return (cmp < 0);
+
+    return (a.index < b.index);
+}
+
+
+/*
+ * Get the date of a message from the numeric prefix of its filename.
+ */
+bool CMessageSort::filename_date(std::shared_ptr<CMessage> msg, int64_t &date)
+{
+    std::string path = msg->path();
+    size_t start = path.rfind('/');
+
+    start = (start == std::string::npos) ? 0 : start + 1;
+
+    size_t end = start;
+
+    while ((end < path.size()) && (path[end] >= '0') && (path[end] <= '9'))
+        end++;
+
+    if ((end > start) && (end < path.size()) && (path[end] == '.'))
+    {
+        date = strtoll(path.c_str() + start, NULL, 10);
+        return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Get the date of a message, preferring the numeric prefix of its
+ * filename.
+ */
+int64_t CMessageSort::message_date(std::shared_ptr<CMessage> msg)
+{
+    int64_t date = 0;
+
+    if (filename_date(msg, date))
+        return (date);
+
+    return (msg->get_ctime());
+}
+
+
+/*
+ * Sort the entries, sorting ranges in parallel and then merging them.
+ */
+static void parallel_sort(std::vector < CSortKey > &entries,
+                          bool (*cmp)(const CSortKey &, const CSortKey &))
+{
+    size_t n = entries.size();
+    unsigned int threads = parallel_threads(n);
+
+    if (threads <= 1)
+    {
+        std::sort(entries.begin(), entries.end(), cmp);
+        return;
+    }
+
+    size_t chunk = (n + threads - 1) / threads;
+
+    parallel_ranges(n, threads, [&entries, cmp](size_t lo, size_t hi)
+    {
+        std::sort(entries.begin() + lo, entries.begin() + hi, cmp);
+    });
+
+    /*
+     * Merge neighbouring sorted ranges, doubling their width each
+     * time, with the merges at each width running in parallel.
+     */
+    for (size_t width = chunk; width < n; width *= 2)
+    {
+        std::vector < std::thread > workers;
+
+        for (size_t lo = 0; lo + width < n; lo += 2 * width)
+        {
+            size_t mid = lo + width;
+            size_t hi  = std::min(n, lo + 2 * width);
+
+            workers.push_back(std::thread([&entries, cmp, lo, mid, hi]()
+            {
+                std::inplace_merge(entries.begin() + lo, entries.begin() + mid,
+                                   entries.begin() + hi, cmp);
+            }));
+        }
+
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+}
+
+
+/*
+ * Does `a` sort before `b`, ignoring their positions?
+ */
+static bool before(const CSortKey &a, const CSortKey &b)
+{
+    return (compare_keys(a, b) < 0);
+}
+
+
+/*
+ * Put the given entries, which are those of `messages` in their order,
+ * into order, reusing the order in which the
+ * messages of each folder were last sorted.
+ *
+ * The messages of each folder are placed by their position within its
+ * last order, in linear time, and checked to still be in order.  Only
+ * those which weren't in that order, such as those which have arrived
+ * since, are sorted - and then merged in.  Each folder's order is then
+ * remembered, if it changed, and the folders are merged together.
+ */
+static void repair_sort(CMessageList &messages, const std::string &method,
+                        std::vector < CSortKey > &entries,
+                        bool (*cmp)(const CSortKey &, const CSortKey &))
+{
+    size_t n = entries.size();
+    CSortOrder *orders = CSortOrder::instance();
+
+    /*
+     * Group the entries by folder.  Remote messages aren't remembered,
+     * so are always sorted afresh.
+     */
+    std::vector < std::string > folders;
+    std::vector < std::vector < size_t > > members;
+    std::unordered_map < std::string, size_t > groups;
+    std::vector < std::string > ids(n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        std::shared_ptr<CMessage> msg = messages[i];
+        std::string folder;
+
+        if (! msg->is_imap())
+        {
+            std::string path = msg->path();
+            folder = CSortOrder::folder(path);
+            ids[i] = CSortOrder::identity(path);
+        }
+
+        auto it = groups.find(folder);
+
+        if (it == groups.end())
+        {
+            it = groups.insert(std::make_pair(folder, folders.size())).first;
+            folders.push_back(folder);
+            members.push_back(std::vector < size_t >());
+        }
+
+        members[it->second].push_back(i);
+    }
+
+    std::vector < std::vector < CSortKey > > runs(folders.size());
+
+    for (size_t g = 0; g < folders.size(); g++)
+    {
+        std::shared_ptr<const sort_order> order;
+
+        if (! folders[g].empty())
+            order = orders->find(folders[g], method);
+
+        /*
+         * Place each entry we've seen before by its rank.
+         */
+        std::vector < CSortKey > known, fresh;
+
+        if (order)
+        {
+            std::vector < size_t > slots(order->ids.size(), n);
+
+            for (size_t i : members[g])
+            {
+                auto rank = order->ranks.find(ids[i]);
+
+                if ((rank != order->ranks.end()) && (slots[rank->second] == n))
+                    slots[rank->second] = i;
+                else
+                    fresh.push_back(entries[i]);
+            }
+
+            known.reserve(members[g].size() - fresh.size());
+
+            for (size_t slot : slots)
+            {
+                if (slot != n)
+                    known.push_back(entries[slot]);
+            }
+
+            /*
+             * Keys may have changed, such as the mtimes used by "file",
+             * in which case the whole folder is sorted afresh.
+             */
+            if (! std::is_sorted(known.begin(), known.end(), before))
+            {
+                known.clear();
+                fresh.clear();
+            }
+        }
+
+        if (known.empty() && fresh.empty())
+        {
+            for (size_t i : members[g])
+                fresh.push_back(entries[i]);
+        }
+
+        parallel_sort(fresh, cmp);
+
+        /*
+         * Merge the fresh entries in, with those we knew first amongst
+         * equals.
+         */
+        std::vector < CSortKey > &run = runs[g];
+        run.resize(known.size() + fresh.size());
+
+        std::merge(known.begin(), known.end(), fresh.begin(), fresh.end(),
+                   run.begin(), before);
+
+        if (folders[g].empty())
+            continue;
+
+        if (fresh.empty() && order && (known.size() == order->ids.size()))
+            continue;
+
+        std::vector < std::string > sorted;
+        sorted.reserve(run.size());
+
+        for (const CSortKey &entry : run)
+            sorted.push_back(ids[entry.index]);
+
+        orders->remember(folders[g], method, sorted);
+    }
+
+    /*
+     * Merge the folders, with ties going to the earlier folder.
+     */
+    if (runs.size() == 1)
+    {
+        entries.swap(runs[0]);
+        return;
+    }
+
+    typedef std::pair < size_t, size_t > cursor;
+
+    auto later = [&runs](const cursor & a, const cursor & b)
+    {
+        int c = compare_keys(runs[a.first][a.second], runs[b.first][b.second]);
+
+        if (c != 0)
+            return (c > 0);
+
+        return (a.first > b.first);
+    };
+
+    std::vector < cursor > heap;
+
+    for (size_t g = 0; g < runs.size(); g++)
+    {
+        if (! runs[g].empty())
+            heap.push_back(cursor(g, 0));
+    }
+
+    std::make_heap(heap.begin(), heap.end(), later);
+    entries.clear();
+
+    while (! heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        cursor &next = heap.back();
+
+        entries.push_back(runs[next.first][next.second]);
+
+        if (++next.second < runs[next.first].size())
+            std::push_heap(heap.begin(), heap.end(), later);
+        else
+            heap.pop_back();
+    }
+}
+
+
+/*
+ * Is the given method one we implement natively?
+ */
+bool CMessageSort::is_native(std::string method)
+{
+    return ((method == "date") || (method == "file") ||
+            (method == "from") || (method == "subject"));
+}
+
+
+/*
+ * Compare two keys extracted by `keys()`.
+ */
+bool CMessageSort::less(const CSortKey &a, const CSortKey &b)
+{
+    if (a.text != NULL)
+        return (compare_text(a, b));
+
+    return (compare_number(a, b));
+}
+
+
+/*
+ * Extract the sort-key of each of the given messages.
+ */
+bool CMessageSort::keys(CMessageList &messages, std::string method, std::vector < CSortKey > &entries)
+{
+    if (! is_native(method))
+        return false;
+
+    size_t n = messages.size();
+    entries.resize(n);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        entries[i].number = 0;
+        entries[i].text   = NULL;
+        entries[i].index  = i;
+    }
+
+    if (method == "file")
+    {
+        /*
+         * This requires a stat() per message, which is safe to do
+         * from several threads at once.
+         */
+        parallel_ranges(n, parallel_threads(n), [&messages, &entries](size_t lo, size_t hi)
+        {
+            for (size_t i = lo; i < hi; i++)
+                entries[i].number = messages[i]->get_mtime();
+        });
+    }
+    else if (method == "date")
+    {
+        for (size_t i = 0; i < n; i++)
+            entries[i].number = message_date(messages[i]);
+    }
+    else
+    {
+        std::string header = (method == "from") ? "from" : "subject";
+
+        for (size_t i = 0; i < n; i++)
+            entries[i].text = &messages[i]->header_ref(header);
+    }
+
+    return true;
+}
+
+
+/*
+ * Sort the given messages, in place, by the given method.
+ */
+bool CMessageSort::sort(CMessageList &messages, std::string method)
+{
+    std::vector < CSortKey > entries;
+
+    /*
+     * Extract each key exactly once.
+     */
+    if (! keys(messages, method, entries))
+        return false;
+
+    bool textual = (! entries.empty()) && (entries[0].text != NULL);
+
+    /*
+     * Lists which are already in order, such as those merged by a
+     * virtual folder, need only be checked.
+     */
+    if (std::is_sorted(entries.begin(), entries.end(), textual ? compare_text : compare_number))
+        return true;
+
+    /*
+     * Reuse the orders in which folders were last sorted, if we can
+     * save them.
+     */
+    if (CMaildirIndex::index_dir().empty())
+        parallel_sort(entries, textual ? compare_text : compare_number);
+    else
+        repair_sort(messages, method, entries, textual ? compare_text : compare_number);
+
+    /*
+     * Rebuild the list in the sorted order.
+     */
+    CMessageList sorted;
+    sorted.reserve(entries.size());
+
+    for (const CSortKey &entry : entries)
+        sorted.push_back(messages[entry.index]);
+
+    messages.swap(sorted);
+    return true;
+}
+
+
+/*
+ * Merge the given sorted lists.
+ */
+bool CMessageSort::merge(std::vector < CMessageList > &lists, std::string method, CMessageList &out)
+{
+    if (! is_native(method))
+        return false;
+
+    size_t k = lists.size();
+    size_t total = 0;
+
+    std::vector < std::vector < CSortKey > > keyed(k);
+
+    for (size_t i = 0; i < k; i++)
+    {
+        keys(lists[i], method, keyed[i]);
+        total += lists[i].size();
+    }
+
+    out.clear();
+    out.reserve(total);
+
+    /*
+     * A heap holding the next entry of each list, identified by the
+     * list, and its position within it.
+     */
+    typedef std::pair < size_t, size_t > cursor;
+
+    auto later = [&keyed](const cursor & a, const cursor & b)
+    {
+        int cmp = compare_keys(keyed[a.first][a.second], keyed[b.first][b.second]);
+
+        if (cmp != 0)
+            return (cmp > 0);
+
+        return (a.first > b.first);
+    };
+
+    std::vector < cursor > heap;
+    heap.reserve(k);
+
+    for (size_t i = 0; i < k; i++)
+    {
+        if (! lists[i].empty())
+            heap.push_back(cursor(i, 0));
+    }
+
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    while (! heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        cursor &next = heap.back();
+
+        out.push_back(lists[next.first][next.second]);
+
+        if (++next.second < lists[next.first].size())
+            std::push_heap(heap.begin(), heap.end(), later);
+        else
+            heap.pop_back();
+    }
+
+    return true;
+}
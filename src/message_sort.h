@@ -0,0 +1,111 @@
+/*
+ * message_sort.h - Native sorting of message-lists.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "message.h"
+
+
+/**
+ * The sort-key of a single message, extracted once before sorting.
+ *
+ * Numeric methods use `number`, textual methods use `text`, which
+ * refers to a header held by the message itself, and is compared in
+ * the collating order of the current locale.  `index` is the original
+ * position of the message, which breaks ties.
+ */
+struct CSortKey
+{
+    int64_t number;
+    const std::string *text;
+    size_t index;
+};
+
+
+/**
+ * This class implements the built-in sorting methods for `index.sort`,
+ * as an alternative to sorting in Lua with `table.sort`.
+ *
+ * The sort-key of each message is extracted exactly once, into a
+ * contiguous array, which is then sorted in parallel for large lists.
+ * The sort is stable, so messages with equal keys keep their order.
+ *
+ * If there is an index the order in which each folder was last sorted
+ * is reused, via `CSortOrder`, so that only the messages which have
+ * changed since need be sorted.
+ */
+class CMessageSort
+{
+public:
+
+    /**
+     * Is the given method one we implement natively?
+     *
+     * The methods are `date`, `file`, `from`, and `subject`, matching
+     * the Lua functions `compare_by_date`, etc.
+     */
+    static bool is_native(std::string method);
+
+    /**
+     * Sort the given messages, in place, by the given method.
+     *
+     * Returns false, leaving the messages untouched, if the method
+     * isn't one we implement.
+     */
+    static bool sort(CMessageList &messages, std::string method);
+
+    /**
+     * Merge the given lists, each of which is already sorted by the
+     * given method, into `out`.  Messages with equal keys keep the order
+     * of their lists.
+     *
+     * This is a k-way merge, taking O(n log k) comparisons for `n`
+     * messages in `k` lists, rather than sorting them all again.
+     */
+    static bool merge(std::vector < CMessageList > &lists, std::string method, CMessageList &out);
+
+    /**
+     * Extract the sort-key of each of the given messages, by the given
+     * method, returning false if the method isn't one we implement.
+     */
+    static bool keys(CMessageList &messages, std::string method, std::vector < CSortKey > &out);
+
+    /**
+     * Compare two keys extracted by `keys()`, returning true if `a`
+     * sorts before `b`.
+     */
+    static bool less(const CSortKey &a, const CSortKey &b);
+
+    /**
+     * Get the date of a message, preferring the numeric prefix of its
+     * filename, as `Message:to_ctime()` does.
+     */
+    static int64_t message_date(std::shared_ptr<CMessage> msg);
+
+    /**
+     * Get the date of a message from the numeric prefix of its filename
+     * alone, returning false if it has none.
+     */
+    static bool filename_date(std::shared_ptr<CMessage> msg, int64_t &date);
+};
@@ -0,0 +1,87 @@
+/*
+ * message_test.cc - Test-cases for our message class.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "message.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that a complete seed answers for headers it doesn't hold, without
+ * the message being parsed, and that a partial one doesn't.
+ */
+void TestMessageSeededComplete(CuTest * tc)
+{
+    char tmpl[] = "/tmp/message.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string path = std::string(tmpl) + "/1.host:2,S";
+    FILE *fp = fopen(path.c_str(), "w");
+    CuAssertPtrNotNull(tc, fp);
+    fputs("Subject: test\nIn-Reply-To: <1@example.com>\n\nbody\n", fp);
+    fclose(fp);
+
+    CHeaderList headers;
+    headers.push_back(std::make_pair("subject", std::string("test")));
+
+    /*
+     * The file holds an In-Reply-To header, so had the message been
+     * parsed we'd have found it.
+     */
+    std::shared_ptr<CMessage> complete = std::shared_ptr<CMessage>(new CMessage(path));
+    complete->seed_headers(headers, true);
+
+    CuAssertTrue(tc, complete->headers_complete());
+    CuAssertStrEquals(tc, "test", complete->header_ref("Subject").c_str());
+    CuAssertStrEquals(tc, "", complete->header_ref("In-Reply-To").c_str());
+    CuAssertTrue(tc, complete->headers_seeded());
+
+    /*
+     * An empty seed is never complete.
+     */
+    std::shared_ptr<CMessage> empty = std::shared_ptr<CMessage>(new CMessage(path));
+    empty->seed_headers(CHeaderList(), true);
+    CuAssertTrue(tc, ! empty->headers_complete());
+
+    /*
+     * A partial seed parses the message for headers it doesn't hold.
+     */
+    std::shared_ptr<CMessage> partial = std::shared_ptr<CMessage>(new CMessage(path));
+    partial->seed_headers(headers, false);
+
+    CuAssertTrue(tc, ! partial->headers_complete());
+    CuAssertStrEquals(tc, "<1@example.com>", partial->header_ref("In-Reply-To").c_str());
+
+    unlink(path.c_str());
+    rmdir(tmpl);
+}
+
+
+CuSuite *
+message_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMessageSeededComplete);
+    return suite;
+}
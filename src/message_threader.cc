@@ -0,0 +1,815 @@
+/*
+ * message_threader.cc - Thread messages by their references.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <string.h>
+
+#include "config.h"
+#include "message_sort.h"
+#include "message_threader.h"
+
+
+/**
+ * A container within a single threading-pass.
+ *
+ * `message` is the position of the message within the list being
+ * threaded, or -1 for an empty container.
+ */
+struct thread_container
+{
+    int message;
+    int parent;
+    std::vector < int > children;
+    bool subject_known;
+    std::string subject;
+};
+
+
+/**
+ * The state of a single threading-pass.
+ */
+struct thread_pass
+{
+    std::vector < thread_container > c;
+    CMessageList *messages;
+};
+
+
+/*
+ * Extract the Message-IDs, between angle-brackets, from the given
+ * header-value.
+ */
+static void extract_ids(const std::string &value, std::vector < std::string > &out)
+{
+    size_t start = 0;
+
+    while ((start = value.find('<', start)) != std::string::npos)
+    {
+        size_t end = value.find('>', start + 1);
+
+        if (end == std::string::npos)
+            break;
+
+        if (end > start + 1)
+            out.push_back(value.substr(start + 1, end - start - 1));
+
+        start = end + 1;
+    }
+}
+
+
+/*
+ * Remove the given child from its parent.
+ */
+static void remove_child(thread_pass &p, int parent, int child)
+{
+    std::vector < int > &children = p.c[parent].children;
+    auto it = std::find(children.begin(), children.end(), child);
+
+    if (it != children.end())
+        children.erase(it);
+
+    p.c[child].parent = -1;
+}
+
+
+/*
+ * Add a child to the given container, removing it from any previous
+ * parent.
+ */
+static void add_child(thread_pass &p, int parent, int child)
+{
+    if (p.c[child].parent != -1)
+        remove_child(p, p.c[child].parent, child);
+
+    p.c[child].parent = parent;
+    p.c[parent].children.push_back(child);
+}
+
+
+/*
+ * Move all the children of one container to another.
+ *
+ * As in the Lua implementation the children are moved in reverse.
+ */
+static void transfer_children(thread_pass &p, int from, int to)
+{
+    std::vector < int > children;
+    children.swap(p.c[from].children);
+
+    for (auto it = children.rbegin(); it != children.rend(); ++it)
+    {
+        p.c[*it].parent = to;
+        p.c[to].children.push_back(*it);
+    }
+}
+
+
+/*
+ * Recursively delete empty containers - step four.
+ */
+static void prune_empty(thread_pass &p, int n)
+{
+    /*
+     * Walk the children in reverse, as pruning a child only changes
+     * the children which follow it.
+     */
+    for (int i = (int)p.c[n].children.size() - 1; i >= 0; i--)
+    {
+        if (i < (int)p.c[n].children.size())
+            prune_empty(p, p.c[n].children[i]);
+    }
+
+    if (p.c[n].message != -1)
+        return;
+
+    int parent = p.c[n].parent;
+
+    if (parent != -1)
+    {
+        /*
+         * An empty container is replaced by its children, if any.
+         */
+        if (! p.c[n].children.empty())
+            transfer_children(p, n, parent);
+
+        remove_child(p, parent, n);
+    }
+    else if (p.c[n].children.size() == 1)
+    {
+        /*
+         * An empty root with a single child is replaced by that child.
+         * The child is left empty, so that it isn't found as a root of
+         * its own once it is unlinked.
+         */
+        int child = p.c[n].children[0];
+        remove_child(p, n, child);
+        transfer_children(p, child, n);
+        p.c[n].message = p.c[child].message;
+        p.c[child].message = -1;
+    }
+}
+
+
+/*
+ * Get the subject of a container, or of its first child.
+ */
+static const std::string &find_subject(thread_pass &p, int n)
+{
+    thread_container &c = p.c[n];
+
+    if (! c.subject_known)
+    {
+        int m = c.message;
+
+        if ((m == -1) && (! c.children.empty()))
+            m = p.c[c.children[0]].message;
+
+        if (m != -1)
+            c.subject = (*p.messages)[m]->header_ref("subject");
+
+        c.subject_known = true;
+    }
+
+    return (c.subject);
+}
+
+
+/*
+ * Does the subject contain a reply-marker, such as "Re:" or "Re[2]:",
+ * at the given offset?  If so return its length, including a single
+ * trailing space.
+ */
+static size_t reply_marker(const std::string &s, size_t i)
+{
+    if ((s[i] != 'R') || (i + 2 >= s.size()) || ((s[i + 1] | 0x20) != 'e'))
+        return 0;
+
+    size_t len = 0;
+
+    if (s[i + 2] == ':')
+        len = 3;
+    else if ((i + 5 < s.size()) && (s[i + 2] == '[') && isdigit(s[i + 3]) &&
+             (s[i + 4] == ']') && (s[i + 5] == ':'))
+        len = 6;
+
+    return (len);
+}
+
+
+/*
+ * Does the subject contain a forward-marker, "Fwd:", at the given
+ * offset?  If so return its length.
+ */
+static size_t forward_marker(const std::string &s, size_t i)
+{
+    if ((s[i] == 'F') && (i + 3 < s.size()) && ((s[i + 1] | 0x20) == 'w') &&
+            ((s[i + 2] | 0x20) == 'd') && (s[i + 3] == ':'))
+        return 4;
+
+    return 0;
+}
+
+
+/*
+ * Get the subject of a container without any "Re:" or "Fwd:" markers.
+ */
+static std::string normalized_subject(thread_pass &p, int n)
+{
+    const std::string &subject = find_subject(p, n);
+    std::string out;
+
+    out.reserve(subject.size());
+
+    for (size_t i = 0; i < subject.size();)
+    {
+        size_t len = reply_marker(subject, i);
+
+        if (len == 0)
+            len = forward_marker(subject, i);
+
+        if (len == 0)
+        {
+            out += subject[i++];
+            continue;
+        }
+
+        i += len;
+
+        if ((i < subject.size()) && isspace(subject[i]))
+            i++;
+    }
+
+    return (out);
+}
+
+
+/*
+ * Is the subject of this container that of a reply?
+ */
+static bool is_reply(thread_pass &p, int n)
+{
+    const std::string &subject = find_subject(p, n);
+
+    for (size_t i = 0; i < subject.size(); i++)
+    {
+        if (reply_marker(subject, i))
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * The message by which a container is sorted - its own, or that of
+ * its first child if it is empty.
+ */
+static int sort_message(thread_pass &p, int n)
+{
+    while ((p.c[n].message == -1) && (! p.c[n].children.empty()))
+        n = p.c[n].children[0];
+
+    return (p.c[n].message);
+}
+
+
+/*
+ * Recursively sort the children of a container.
+ */
+static void sort_children(thread_pass &p, int n, std::vector < CSortKey > &keys)
+{
+    std::vector < int > &children = p.c[n].children;
+
+    for (int child : children)
+        sort_children(p, child, keys);
+
+    std::stable_sort(children.begin(), children.end(), [&p, &keys](int a, int b)
+    {
+        int ma = sort_message(p, a);
+        int mb = sort_message(p, b);
+
+        if ((ma == -1) || (mb == -1))
+            return (ma != -1);
+
+        return (CMessageSort::less(keys[ma], keys[mb]));
+    });
+}
+
+
+/*
+ * Find the greatest message within a thread.
+ */
+static int max_message(thread_pass &p, int n, std::vector < CSortKey > &keys)
+{
+    int best = sort_message(p, n);
+
+    for (int child : p.c[n].children)
+    {
+        int m = max_message(p, child, keys);
+
+        if ((m != -1) && ((best == -1) || CMessageSort::less(keys[best], keys[m])))
+            best = m;
+    }
+
+    return (best);
+}
+
+
+/*
+ * Constructor.
+ */
+CMessageThreader::CMessageThreader()
+{
+}
+
+
+/*
+ * Forget every message and Message-ID we've seen.
+ */
+void CMessageThreader::reset()
+{
+    m_nodes.clear();
+    m_ids.clear();
+    m_known.clear();
+}
+
+
+/*
+ * Create a new, unlinked, node.
+ */
+int CMessageThreader::new_node()
+{
+    node n;
+    n.parent = -1;
+    m_nodes.push_back(n);
+    return (m_nodes.size() - 1);
+}
+
+
+/*
+ * Find, or create, the node for the given Message-ID.
+ */
+int CMessageThreader::node_for(const std::string &id)
+{
+    auto it = m_ids.find(id);
+
+    if (it != m_ids.end())
+        return (it->second);
+
+    int n = new_node();
+    m_ids[id] = n;
+    return (n);
+}
+
+
+/*
+ * Is `ancestor` the node `n`, or one of its ancestors?
+ */
+bool CMessageThreader::is_ancestor(int ancestor, int n)
+{
+    for (; n != -1; n = m_nodes[n].parent)
+    {
+        if (n == ancestor)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Make `child` a child of `parent`.
+ */
+void CMessageThreader::link(int parent, int child)
+{
+    int old = m_nodes[child].parent;
+
+    if (old != -1)
+    {
+        std::vector < int > &siblings = m_nodes[old].children;
+        siblings.erase(std::find(siblings.begin(), siblings.end(), child));
+    }
+
+    m_nodes[child].parent = parent;
+    m_nodes[parent].children.push_back(child);
+}
+
+
+/*
+ * Add a message to our graph - step one of the algorithm.
+ */
+void CMessageThreader::add(std::shared_ptr<CMessage> msg)
+{
+    std::vector < std::string > ids;
+
+    /*
+     * 1.A: find or create the container of this message.
+     */
+    extract_ids(msg->header_ref("message-id"), ids);
+
+    if (ids.empty())
+    {
+        /*
+         * Without a Message-ID we cannot thread the message, so it
+         * will be a root of its own.
+         */
+        int n = new_node();
+        m_nodes[n].message = msg;
+        m_known[msg.get()] = n;
+        return;
+    }
+
+    int par = node_for(ids[0]);
+
+    if (m_nodes[par].message.lock())
+    {
+        /*
+         * A duplicate Message-ID.  Rather than losing one of the
+         * messages we make this a child of the first.
+         */
+        int dup = new_node();
+        m_nodes[dup].message = msg;
+        m_known[msg.get()] = dup;
+        link(par, dup);
+        return;
+    }
+
+    m_nodes[par].message = msg;
+    m_known[msg.get()] = par;
+
+    /*
+     * 1.B: link the containers of the references, in order.  The last
+     * Message-ID of `In-Reply-To` is used if it isn't the last of the
+     * references.
+     */
+    ids.clear();
+    extract_ids(msg->header_ref("references"), ids);
+
+    std::vector < std::string > reply;
+    extract_ids(msg->header_ref("in-reply-to"), reply);
+
+    if ((! reply.empty()) && (ids.empty() || (ids.back() != reply.back())))
+        ids.push_back(reply.back());
+
+    int prev = -1;
+
+    for (const std::string &ref : ids)
+    {
+        int cur = node_for(ref);
+
+        /*
+         * Don't link if they are already linked, or we would introduce
+         * a loop.
+         */
+        if ((prev != -1) && (m_nodes[cur].parent == -1) && (! is_ancestor(cur, prev)))
+            link(prev, cur);
+
+        prev = cur;
+    }
+
+    /*
+     * 1.C: link the message to its last reference.
+     */
+    if ((prev != -1) && (! is_ancestor(par, prev)))
+        link(prev, par);
+}
+
+
+/*
+ * Thread the given messages.
+ */
+CThreadResult CMessageThreader::thread(CMessageList &messages, std::string sort)
+{
+    CThreadResult result;
+
+    /*
+     * Find the messages we've already seen.  If we know none of them
+     * the folder has changed, and if our graph has grown far beyond
+     * the list it has accumulated too many messages which have gone.
+     */
+    std::unordered_map < CMessage *, int > present;
+    size_t known = 0;
+
+    for (size_t i = 0; i < messages.size(); i++)
+    {
+        present[messages[i].get()] = i;
+
+        auto it = m_known.find(messages[i].get());
+
+        if ((it != m_known.end()) && (m_nodes[it->second].message.lock() == messages[i]))
+            known += 1;
+    }
+
+    if ((known == 0) || (m_nodes.size() > 4 * messages.size() + 4096))
+        reset();
+
+    /*
+     * Step one, for new messages only.
+     */
+    for (std::shared_ptr<CMessage> msg : messages)
+    {
+        auto it = m_known.find(msg.get());
+
+        if ((it != m_known.end()) && (m_nodes[it->second].message.lock() == msg))
+            continue;
+
+        add(msg);
+    }
+
+    /*
+     * Copy our graph, noting which containers hold messages we're
+     * threading now.
+     */
+    thread_pass p;
+    p.messages = &messages;
+    p.c.resize(m_nodes.size());
+
+    for (size_t i = 0; i < m_nodes.size(); i++)
+    {
+        thread_container &c = p.c[i];
+        c.parent   = m_nodes[i].parent;
+        c.children = m_nodes[i].children;
+        c.message  = -1;
+        c.subject_known = false;
+
+        std::shared_ptr<CMessage> msg = m_nodes[i].message.lock();
+
+        if (msg)
+        {
+            auto it = present.find(msg.get());
+
+            if (it != present.end())
+                c.message = it->second;
+        }
+    }
+
+    /*
+     * 2: find the root set, and 4: prune empty containers.
+     */
+    std::vector < int > roots;
+
+    for (size_t i = 0; i < p.c.size(); i++)
+    {
+        if (p.c[i].parent == -1)
+        {
+            prune_empty(p, i);
+
+            if ((p.c[i].message != -1) || (! p.c[i].children.empty()))
+                roots.push_back(i);
+        }
+    }
+
+    /*
+     * 5.B: find the subject of each thread.
+     */
+    std::unordered_map < std::string, int > subjects;
+    std::vector < std::string > subject_order;
+    std::vector < int > without_subject;
+
+    for (int root : roots)
+    {
+        std::string subject = normalized_subject(p, root);
+
+        if (subject.empty())
+        {
+            without_subject.push_back(root);
+            continue;
+        }
+
+        auto it = subjects.find(subject);
+
+        if (it == subjects.end())
+        {
+            subjects[subject] = root;
+            subject_order.push_back(subject);
+        }
+        else if ((p.c[it->second].message != -1) && (p.c[root].message == -1))
+        {
+            it->second = root;
+        }
+    }
+
+    /*
+     * 5.C: group the threads by subject, preferring a message which is
+     * not a reply over an empty container.
+     */
+    for (int root : roots)
+    {
+        std::string subject = normalized_subject(p, root);
+
+        if (subject.empty())
+            continue;
+
+        int target = subjects[subject];
+
+        if (target == root)
+            continue;
+
+        bool root_empty   = (p.c[root].message == -1);
+        bool target_empty = (p.c[target].message == -1);
+
+        if (root_empty && target_empty)
+        {
+            transfer_children(p, root, target);
+        }
+        else if (target_empty)
+        {
+            add_child(p, target, root);
+        }
+        else if (root_empty)
+        {
+            add_child(p, root, target);
+            subjects[subject] = root;
+        }
+        else
+        {
+            bool root_reply   = is_reply(p, root);
+            bool target_reply = is_reply(p, target);
+
+            if (root_reply && !target_reply)
+            {
+                add_child(p, target, root);
+            }
+            else if (!root_reply && target_reply)
+            {
+                add_child(p, root, target);
+                subjects[subject] = root;
+            }
+            else
+            {
+                thread_container parent;
+                parent.message = -1;
+                parent.parent  = -1;
+                parent.subject_known = false;
+                p.c.push_back(parent);
+
+                int n = p.c.size() - 1;
+                add_child(p, n, root);
+                add_child(p, n, target);
+                subjects[subject] = n;
+            }
+        }
+    }
+
+    /*
+     * Replace empty root containers with their oldest child, if it is
+     * not a reply, to get deterministic results.
+     */
+    for (const std::string &subject : subject_order)
+    {
+        int r = subjects[subject];
+
+        if ((p.c[r].message != -1) || p.c[r].children.empty())
+            continue;
+
+        int oldest = -1;
+        int64_t oldest_date = 0;
+
+        for (int child : p.c[r].children)
+        {
+            if (p.c[child].message == -1)
+                continue;
+
+            int64_t date = CMessageSort::message_date(messages[p.c[child].message]);
+
+            if ((oldest == -1) || (date < oldest_date))
+            {
+                oldest = child;
+                oldest_date = date;
+            }
+        }
+
+        if ((oldest != -1) && !is_reply(p, oldest))
+        {
+            remove_child(p, r, oldest);
+            transfer_children(p, r, oldest);
+            subjects[subject] = oldest;
+        }
+    }
+
+    roots = without_subject;
+
+    for (const std::string &subject : subject_order)
+        roots.push_back(subjects[subject]);
+
+    /*
+     * Sort the messages within each thread, and the threads by their
+     * greatest message.
+     */
+    std::vector < CSortKey > keys;
+
+    if (CMessageSort::keys(messages, sort, keys))
+    {
+        std::vector < std::pair < int, int > > order;
+
+        for (int root : roots)
+        {
+            sort_children(p, root, keys);
+            order.push_back(std::make_pair(max_message(p, root, keys), root));
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&keys](const std::pair < int, int > &a, const std::pair < int, int > &b)
+        {
+            if ((a.first == -1) || (b.first == -1))
+                return (a.first != -1);
+
+            return (CMessageSort::less(keys[a.first], keys[b.first]));
+        });
+
+        roots.clear();
+
+        for (auto &entry : order)
+            roots.push_back(entry.second);
+    }
+
+    /*
+     * The signs used to indent threads.
+     */
+    std::string signs = CConfig::instance()->get_string("threads.output", " ;`;-> ");
+    std::vector < std::string > parts;
+    size_t start = 0;
+
+    while (start <= signs.size())
+    {
+        size_t end = signs.find(';', start);
+
+        if (end == std::string::npos)
+            end = signs.size();
+
+        if (end > start)
+            parts.push_back(signs.substr(start, end - start));
+
+        start = end + 1;
+    }
+
+    std::string indent = parts.size() > 0 ? parts[0] : " ";
+    std::string root_sign = parts.size() > 1 ? parts[1] : "`";
+    std::string sign = parts.size() > 2 ? parts[2] : "-> ";
+
+    /*
+     * Walk each thread, depth-first, to produce the flat list.
+     */
+    struct frame
+    {
+        int container;
+        std::string prefix;
+        int depth;
+    };
+
+    for (int root : roots)
+    {
+        result.roots.push_back(result.order.size());
+
+        std::vector < frame > stack;
+        stack.push_back({root, "", 0});
+
+        while (! stack.empty())
+        {
+            frame f = stack.back();
+            stack.pop_back();
+
+            thread_container &c = p.c[f.container];
+            std::string prefix = f.prefix;
+            int depth = f.depth;
+
+            if (c.message != -1)
+            {
+                result.order.push_back(c.message);
+                result.indentation.push_back(prefix);
+                result.depth.push_back(depth);
+
+                if (prefix.empty())
+                    prefix = root_sign + sign;
+
+                prefix = indent + prefix;
+                depth += 1;
+            }
+            else
+            {
+                prefix = sign;
+            }
+
+            for (auto it = c.children.rbegin(); it != c.children.rend(); ++it)
+                stack.push_back({*it, prefix, depth});
+        }
+    }
+
+    return (result);
+}
@@ -0,0 +1,153 @@
+/*
+ * message_threader.h - Thread messages by their references.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "message.h"
+#include "singleton.h"
+
+
+/**
+ * The result of threading a list of messages.
+ */
+struct CThreadResult
+{
+    /**
+     * The positions of the messages, within the list which was threaded,
+     * in thread order.
+     */
+    std::vector < size_t > order;
+
+    /**
+     * The indentation-prefix of each entry in `order`.
+     */
+    std::vector < std::string > indentation;
+
+    /**
+     * The depth of each entry in `order`, where thread-roots are zero.
+     */
+    std::vector < int > depth;
+
+    /**
+     * The positions, within `order`, of the first message of each
+     * thread.
+     */
+    std::vector < size_t > roots;
+};
+
+
+/**
+ * This class implements the threading algorithm described by Jamie
+ * Zawinski, https://www.jwz.org/doc/threading.html, with the same
+ * variations as `lib/threader.lua`.
+ *
+ * The table of Message-IDs, and the links between them found in the
+ * `References` and `In-Reply-To` headers, persist between calls.  When
+ * a list is re-threaded only messages we've not seen before have their
+ * headers examined, the remaining steps of the algorithm then run over
+ * contiguous arrays of containers.
+ *
+ * Messages which were seen before, but are not in the list being
+ * threaded, are treated as though they were missing from the folder.
+ */
+class CMessageThreader : public Singleton<CMessageThreader>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CMessageThreader();
+
+    /**
+     * Thread the given messages.
+     *
+     * If `sort` names one of the methods of `CMessageSort` the messages
+     * within each thread are sorted by it, and threads are ordered by
+     * their greatest message.
+     */
+    CThreadResult thread(CMessageList &messages, std::string sort);
+
+    /**
+     * Forget every message and Message-ID we've seen.
+     */
+    void reset();
+
+private:
+
+    /**
+     * A node of our persistent graph, holding a Message-ID we've seen
+     * and the message which has it, if any.
+     */
+    struct node
+    {
+        std::weak_ptr<CMessage> message;
+        int parent;
+        std::vector < int > children;
+    };
+
+    /**
+     * Add a message to our graph - step one of the algorithm.
+     */
+    void add(std::shared_ptr<CMessage> msg);
+
+    /**
+     * Find, or create, the node for the given Message-ID.
+     */
+    int node_for(const std::string &id);
+
+    /**
+     * Create a new, unlinked, node.
+     */
+    int new_node();
+
+    /**
+     * Is `ancestor` the node `n`, or one of its ancestors?
+     */
+    bool is_ancestor(int ancestor, int n);
+
+    /**
+     * Make `child` a child of `parent`, unlinking it from any previous
+     * parent.
+     */
+    void link(int parent, int child);
+
+private:
+
+    /**
+     * Our graph of containers.
+     */
+    std::vector < node > m_nodes;
+
+    /**
+     * Map each Message-ID to its node.
+     */
+    std::unordered_map < std::string, int > m_ids;
+
+    /**
+     * Map each message we've seen to its node.
+     */
+    std::unordered_map < CMessage *, int > m_known;
+};
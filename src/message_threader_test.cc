@@ -0,0 +1,262 @@
+/*
+ * message_threader_test.cc - Test-cases for our native threading.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <memory>
+#include <string>
+
+#include "message.h"
+#include "message_threader.h"
+#include "CuTest.h"
+
+
+/**
+ * Create a message with the given headers, which is never parsed.
+ *
+ * The date prefixes the filename, which is where the "date" sort finds
+ * it, and the name follows.
+ */
+static std::shared_ptr<CMessage> message(int date, std::string name, std::string id,
+        std::string references = "", std::string reply = "",
+        std::string subject = "")
+{
+    std::string path = "/tmp/threads/" + std::to_string(date) + "." + name;
+    std::shared_ptr<CMessage> msg = std::shared_ptr<CMessage>(new CMessage(path));
+
+    CHeaderList headers;
+
+    if (! id.empty())
+        headers.push_back(std::make_pair("message-id", id));
+
+    if (! references.empty())
+        headers.push_back(std::make_pair("references", references));
+
+    if (! reply.empty())
+        headers.push_back(std::make_pair("in-reply-to", reply));
+
+    if (subject.empty())
+        subject = "subject of " + name;
+
+    headers.push_back(std::make_pair("subject", subject));
+
+    msg->seed_headers(headers, true);
+    return (msg);
+}
+
+
+/**
+ * Thread the given messages by date, describing the result as the name
+ * and depth of each message in turn.
+ */
+static std::string thread(CMessageList &messages)
+{
+    CThreadResult result = CMessageThreader::instance()->thread(messages, "date");
+    std::string out;
+
+    for (size_t i = 0; i < result.order.size(); i++)
+    {
+        std::string path = messages[result.order[i]]->path();
+
+        if (! out.empty())
+            out += " ";
+
+        out += path.substr(path.find('.') + 1) + ":" + std::to_string(result.depth[i]);
+    }
+
+    return (out);
+}
+
+
+/**
+ * Test that messages whose parents are missing are threaded beneath
+ * their nearest ancestor, or become roots.
+ */
+void TestThreaderMissingParents(CuTest * tc)
+{
+    CMessageThreader::instance()->reset();
+
+    CMessageList messages;
+    messages.push_back(message(1, "a", "<a>", "", "", "one"));
+    messages.push_back(message(2, "c", "<c>", "<a> <b>", "", "Re: one"));
+    messages.push_back(message(3, "d", "<d>", "", "<b>", "Re: one"));
+    messages.push_back(message(4, "e", "<e>", "<x>", "", "two"));
+
+    /*
+     * <b> is missing, so its replies are children of <a>, and <x> is
+     * missing, so its reply is a root.
+     */
+    CuAssertStrEquals(tc, "a:0 c:1 d:1 e:0", thread(messages).c_str());
+
+    /*
+     * A message without a Message-ID is a root of its own.
+     */
+    messages.push_back(message(5, "f", "", "<a>", "", "three"));
+    CuAssertStrEquals(tc, "a:0 c:1 d:1 e:0 f:0", thread(messages).c_str());
+
+    CMessageThreader::instance()->reset();
+
+    /*
+     * A missing root whose only child was first seen as a reference
+     * holds that child, which appears once.
+     */
+    CMessageList later;
+    later.push_back(message(1, "g", "<g>", "<y> <h>", "", "four"));
+    later.push_back(message(2, "h", "<h>", "<y>", "", "four"));
+
+    CuAssertStrEquals(tc, "h:0 g:1", thread(later).c_str());
+
+    CMessageThreader::instance()->reset();
+}
+
+
+/**
+ * Test that references which form a loop don't create one.
+ */
+void TestThreaderLoops(CuTest * tc)
+{
+    CMessageThreader::instance()->reset();
+
+    CMessageList messages;
+    messages.push_back(message(1, "a", "<a>", "<b>"));
+    messages.push_back(message(2, "b", "<b>", "<a>"));
+    messages.push_back(message(3, "c", "<c>", "<c>"));
+    messages.push_back(message(4, "d", "<d>", "<x> <y> <x>"));
+
+    CuAssertStrEquals(tc, "b:0 a:1 c:0 d:0", thread(messages).c_str());
+
+    CMessageThreader::instance()->reset();
+}
+
+
+/**
+ * Test that a message with a duplicate Message-ID is threaded beneath
+ * the first, rather than being lost.
+ */
+void TestThreaderDuplicates(CuTest * tc)
+{
+    CMessageThreader::instance()->reset();
+
+    CMessageList messages;
+    messages.push_back(message(1, "a", "<a>", "", "", "one"));
+    messages.push_back(message(2, "copy", "<a>", "", "", "one"));
+    messages.push_back(message(3, "reply", "<r>", "", "<a>", "Re: one"));
+
+    CuAssertStrEquals(tc, "a:0 copy:1 reply:1", thread(messages).c_str());
+
+    CMessageThreader::instance()->reset();
+}
+
+
+/**
+ * Test that re-threading a list places new arrivals within the threads
+ * we already know.
+ */
+void TestThreaderArrivals(CuTest * tc)
+{
+    CMessageThreader::instance()->reset();
+
+    CMessageList messages;
+    messages.push_back(message(1, "a", "<a>", "", "", "one"));
+    messages.push_back(message(2, "b", "<b>", "<a>", "", "Re: one"));
+    messages.push_back(message(3, "x", "<x>", "", "", "two"));
+
+    CuAssertStrEquals(tc, "a:0 b:1 x:0", thread(messages).c_str());
+
+    /*
+     * A reply to <b>, and an older message, arrive.
+     */
+    messages.push_back(message(4, "c", "<c>", "<a> <b>", "", "Re: one"));
+    messages.push_back(message(0, "w", "<w>", "", "", "three"));
+
+    CuAssertStrEquals(tc, "w:0 x:0 a:0 b:1 c:2", thread(messages).c_str());
+
+    /*
+     * The headers of messages we've seen aren't examined again.
+     */
+    CHeaderList headers;
+    headers.push_back(std::make_pair("message-id", "<x>"));
+    headers.push_back(std::make_pair("in-reply-to", "<c>"));
+    headers.push_back(std::make_pair("subject", "two"));
+    messages[2]->seed_headers(headers, true);
+
+    CuAssertStrEquals(tc, "w:0 x:0 a:0 b:1 c:2", thread(messages).c_str());
+
+    CMessageThreader::instance()->reset();
+}
+
+
+/**
+ * Test that messages which have been dropped from the list are treated
+ * as missing, and that their Message-IDs may be reused.
+ */
+void TestThreaderDropped(CuTest * tc)
+{
+    CMessageThreader::instance()->reset();
+
+    CMessageList messages;
+    messages.push_back(message(1, "a", "<a>", "", "", "one"));
+    messages.push_back(message(2, "b", "<b>", "<a>", "", "Re: one"));
+    messages.push_back(message(3, "c", "<c>", "<a> <b>", "", "Re: one"));
+
+    CuAssertStrEquals(tc, "a:0 b:1 c:2", thread(messages).c_str());
+
+    /*
+     * While <b> still exists, but isn't in the list, its reply moves up.
+     */
+    std::shared_ptr<CMessage> b = messages[1];
+    messages.erase(messages.begin() + 1);
+
+    CuAssertStrEquals(tc, "a:0 c:1", thread(messages).c_str());
+
+    /*
+     * Once it is gone entirely the same is true.
+     */
+    b.reset();
+    CuAssertStrEquals(tc, "a:0 c:1", thread(messages).c_str());
+
+    /*
+     * A new message with its Message-ID takes its place, rather than
+     * being treated as a duplicate of a message which no longer exists.
+     */
+    messages.push_back(message(4, "b2", "<b>", "<a>", "", "Re: one"));
+    CuAssertStrEquals(tc, "a:0 b2:1 c:2", thread(messages).c_str());
+
+    /*
+     * A list of messages we've never seen starts afresh.
+     */
+    CMessageList other;
+    other.push_back(message(1, "p", "<p>", "", "", "other"));
+    other.push_back(message(2, "q", "<q>", "<p>", "", "Re: other"));
+
+    CuAssertStrEquals(tc, "p:0 q:1", thread(other).c_str());
+
+    CMessageThreader::instance()->reset();
+}
+
+
+CuSuite *
+message_threader_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestThreaderMissingParents);
+    SUITE_ADD_TEST(suite, TestThreaderLoops);
+    SUITE_ADD_TEST(suite, TestThreaderDuplicates);
+    SUITE_ADD_TEST(suite, TestThreaderArrivals);
+    SUITE_ADD_TEST(suite, TestThreaderDropped);
+    return suite;
+}
@@ -17,9 +17,62 @@
  */
 
 
+#include <algorithm>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "config.h"
 #include "mime.h"
 
 
+/*
+ * The types of well-known extensions.
+ */
+static const char *g_extensions[][2] =
+{
+    { "bz2",  "application/x-bzip2" },
+    { "csv",  "text/csv" },
+    { "diff", "text/x-diff" },
+    { "doc",  "application/msword" },
+    { "docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document" },
+    { "eml",  "message/rfc822" },
+    { "gif",  "image/gif" },
+    { "gz",   "application/gzip" },
+    { "htm",  "text/html" },
+    { "html", "text/html" },
+    { "ics",  "text/calendar" },
+    { "jpeg", "image/jpeg" },
+    { "jpg",  "image/jpeg" },
+    { "json", "application/json" },
+    { "mp3",  "audio/mpeg" },
+    { "mp4",  "video/mp4" },
+    { "odp",  "application/vnd.oasis.opendocument.presentation" },
+    { "ods",  "application/vnd.oasis.opendocument.spreadsheet" },
+    { "odt",  "application/vnd.oasis.opendocument.text" },
+    { "patch", "text/x-diff" },
+    { "pdf",  "application/pdf" },
+    { "png",  "image/png" },
+    { "ppt",  "application/vnd.ms-powerpoint" },
+    { "pptx", "application/vnd.openxmlformats-officedocument.presentationml.presentation" },
+    { "svg",  "image/svg+xml" },
+    { "tar",  "application/x-tar" },
+    { "tgz",  "application/gzip" },
+    { "txt",  "text/plain" },
+    { "webp", "image/webp" },
+    { "xls",  "application/vnd.ms-excel" },
+    { "xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet" },
+    { "xml",  "application/xml" },
+    { "xz",   "application/x-xz" },
+    { "zip",  "application/zip" },
+};
+
+
+/*
+ * The most files we'll remember the types of.
+ */
+#define MIME_CACHE_MAX 4096
+
+
 
 /*
  * Constructor - This is private as this class is a singleton.
@@ -56,10 +109,97 @@ CMime::~CMime()
  */
 std::string CMime::type(std::string file, std::string def_type)
 {
+    std::string ext = extension_type(file);
+
+    if (! ext.empty())
+        return (ext);
+
+    /*
+     * Have we examined this file, as it is now, before?
+     */
+    struct stat sb;
+    std::string key;
+
+    if (stat(file.c_str(), &sb) == 0)
+    {
+        key = std::to_string(sb.st_dev) + ":" + std::to_string(sb.st_ino) + ":" +
+              std::to_string(sb.st_mtime) + ":" + std::to_string(sb.st_size);
+
+        auto it = m_cache.find(key);
+
+        if (it != m_cache.end())
+            return (it->second);
+    }
+
     const char *info = magic_file(m_mime, file.c_str());
 
+    if (! info)
+        return (def_type);
+
+    if (! key.empty())
+    {
+        if (m_cache.size() >= MIME_CACHE_MAX)
+            m_cache.clear();
+
+        m_cache[key] = info;
+    }
+
+    return (info);
+}
+
+
+/*
+ * Discover the MIME-type of the given content.
+ */
+std::string CMime::type(const void *data, size_t length, std::string name, std::string def_type)
+{
+    std::string ext = extension_type(name);
+
+    if (! ext.empty())
+        return (ext);
+
+    if (data == NULL || length == 0)
+        return (def_type);
+
+    const char *info = magic_buffer(m_mime, data, length);
+
     if (info)
         return (info);
     else
         return (def_type);
 }
+
+
+/*
+ * The MIME-type of the given filename, as identified by its extension.
+ */
+std::string CMime::extension_type(const std::string &name)
+{
+    CConfig *config = CConfig::instance();
+
+    if (config->get_integer("mime.extensions", 1) == 0)
+        return "";
+
+    size_t dot   = name.rfind('.');
+    size_t slash = name.rfind('/');
+
+    if ((dot == std::string::npos) || (dot + 1 >= name.size()) ||
+            ((slash != std::string::npos) && (dot < slash)))
+        return "";
+
+    std::string ext = name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    std::string configured = config->get_string("mime.extension." + ext);
+
+    if (! configured.empty())
+        return (configured);
+
+    for (size_t i = 0; i < sizeof(g_extensions) / sizeof(g_extensions[0]); i++)
+    {
+        if (strcmp(g_extensions[i][0], ext.c_str()) == 0)
+            return (g_extensions[i][1]);
+    }
+
+    return "";
+}
@@ -20,7 +20,9 @@
 #pragma once
 
 #include <magic.h>
+#include <stddef.h>
 #include <string>
+#include <unordered_map>
 
 #include "singleton.h"
 
@@ -42,6 +44,12 @@
  * result in the default value of `application/octet-stream` being
  * returned.
  *
+ * Files with a well-known extension are identified by that, without
+ * being opened, unless `mime.extensions` is set to zero.  The type of
+ * any extension may be set, or overridden, via `mime.extension.$ext`.
+ * Files we must examine are only examined once, so long as they're
+ * unchanged.
+ *
  */
 class CMime : public Singleton<CMime>
 {
@@ -66,6 +74,23 @@ public:
      */
     std::string type(std::string file, std::string def_type = "application/octet-stream");
 
+    /**
+     * Discover the MIME-type of the given content, such as that of an
+     * attachment we've decoded, which was stored in a file of the given
+     * name.
+     *
+     * If this cannot be determined return the default value which was
+     * specified.
+     */
+    std::string type(const void *data, size_t length, std::string name = "",
+                     std::string def_type = "application/octet-stream");
+
+    /**
+     * The MIME-type of the given filename, as identified by its
+     * extension, or the empty string if that isn't known.
+     */
+    std::string extension_type(const std::string &name);
+
 private:
 
     /**
@@ -73,4 +98,10 @@ private:
      */
     magic_t m_mime;
 
+    /**
+     * The types `libmagic` found for files, keyed by their device,
+     * inode, modification-time, and size.
+     */
+    std::unordered_map<std::string, std::string> m_cache;
+
 };
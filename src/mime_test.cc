@@ -0,0 +1,107 @@
+/*
+ * mime_test.cc - Test-cases for our MIME-type detection.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include "config.h"
+#include "mime.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test files are identified by their extension.
+ */
+void TestMimeExtension(CuTest * tc)
+{
+    CMime *mime = CMime::instance();
+
+    CuAssertStrEquals(tc, "application/pdf", mime->extension_type("report.pdf").c_str());
+    CuAssertStrEquals(tc, "image/jpeg", mime->extension_type("/tmp/HOLIDAY.JPG").c_str());
+    CuAssertStrEquals(tc, "", mime->extension_type("/home/user.name/README").c_str());
+    CuAssertStrEquals(tc, "", mime->extension_type("trailing.").c_str());
+    CuAssertStrEquals(tc, "", mime->extension_type("unknown.qqq").c_str());
+
+    /*
+     * The user may add to, or override, our extensions.
+     */
+    CConfig *config = CConfig::instance();
+    config->set("mime.extension.qqq", "application/x-qqq", false);
+    config->set("mime.extension.pdf", "application/x-pdf", false);
+
+    CuAssertStrEquals(tc, "application/x-qqq", mime->extension_type("unknown.qqq").c_str());
+    CuAssertStrEquals(tc, "application/x-pdf", mime->extension_type("report.pdf").c_str());
+
+    /*
+     * Or disable them.
+     */
+    config->set("mime.extensions", 0, false);
+    CuAssertStrEquals(tc, "", mime->extension_type("report.pdf").c_str());
+
+    config->set("mime.extension.qqq", "", false);
+    config->set("mime.extension.pdf", "", false);
+    config->set("mime.extensions", 1, false);
+}
+
+
+/**
+ * Test content is identified by libmagic, and the default is used
+ * when there is nothing to identify.
+ */
+void TestMimeContent(CuTest * tc)
+{
+    CMime *mime = CMime::instance();
+
+    const char png[] = "\x89PNG\r\n\x1a\n\0\0\0\rIHDR\0\0\0\x01\0\0\0\x01\x08\x06\0\0\0";
+    CuAssertStrEquals(tc, "image/png", mime->type(png, sizeof(png) - 1).c_str());
+
+    /*
+     * A well-known name wins.
+     */
+    CuAssertStrEquals(tc, "text/plain", mime->type(png, sizeof(png) - 1, "notes.txt").c_str());
+
+    CuAssertStrEquals(tc, "x/default", mime->type(NULL, 0, "", "x/default").c_str());
+
+    /*
+     * Files are identified the same way, each time.
+     */
+    char path[] = "/tmp/mimeXXXXXX";
+    close(mkstemp(path));
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(png, sizeof(png) - 1);
+    out.close();
+
+    CuAssertStrEquals(tc, "image/png", mime->type(path).c_str());
+    CuAssertStrEquals(tc, "image/png", mime->type(path).c_str());
+
+    unlink(path);
+}
+
+
+CuSuite *
+mime_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestMimeContent);
+    SUITE_ADD_TEST(suite, TestMimeExtension);
+    return suite;
+}
@@ -17,11 +17,7 @@
  */
 
 
-#include <netdb.h>
-#include <stdlib.h>
-#include <sys/socket.h>
-#include <unistd.h>
-
+#include "host_identity.h"
 #include "lua.h"
 
 
@@ -52,46 +48,11 @@ int l_CNet_hostname(lua_State * L)
     CLuaLog("l_CNet_hostname");
 
     /**
-     * If the environmental variable HOSTNAME
-     * is set, use that, otherwise use the standard networking
-     * functions to determine our FQDN.
+     * If the environmental variable HOSTNAME is set this is that,
+     * otherwise our FQDN, which is looked up in the background.
      */
-    const char *env = getenv("HOSTNAME");
-
-    if (env != NULL)
-    {
-        lua_pushstring(L, env);
-    }
-    else
-    {
-        /*
-         * Get the short version.
-         */
-        char res[1024];
-        res[sizeof(res) - 1] = '\0';
-        gethostname(res, sizeof(res) - 1);
-
-        /*
-         * Attempt to get the full vrsion.
-         */
-        struct hostent *hstnm;
-        hstnm = gethostbyname(res);
-
-        if (hstnm)
-        {
-            /*
-             * Success.
-             */
-            lua_pushstring(L, hstnm->h_name);
-        }
-        else
-        {
-            /*
-             * Failure: Return the short-version.
-             */
-            lua_pushstring(L, res);
-        }
-    }
+    std::string name = CHostIdentity::instance()->fqdn();
+    lua_pushstring(L, name.c_str());
 
     return 1;
 }
@@ -0,0 +1,103 @@
+/*
+ * observer.cc - Implementation of the Observer-pattern.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2015 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+
+#include "observer.h"
+
+
+/*
+ * Attach a new observer, interested in every key.
+ */
+void Subject::attach(Observer *obs)
+{
+    subscribed(obs);
+    views.push_back(obs);
+}
+
+
+/*
+ * Subscribe the given observer to changes of the named key.
+ */
+void Subject::subscribe(Observer *obs, const std::string &key)
+{
+    subscribed(obs);
+    m_keys[key].push_back(obs);
+}
+
+
+/*
+ * Subscribe the given observer to changes of keys with the given prefix.
+ */
+void Subject::subscribe_prefix(Observer *obs, const std::string &prefix)
+{
+    subscribed(obs);
+    m_prefixes[prefix].push_back(obs);
+}
+
+
+/*
+ * Note a new subscription.
+ */
+void Subject::subscribed(Observer *obs)
+{
+    if (std::find(m_order.begin(), m_order.end(), obs) == m_order.end())
+        m_order.push_back(obs);
+
+    m_dispatch.clear();
+}
+
+
+/*
+ * The observers interested in the named key.
+ */
+const std::vector < Observer * > &Subject::observers(const std::string &key)
+{
+    auto found = m_dispatch.find(key);
+
+    if (found != m_dispatch.end())
+        return (found->second);
+
+    /*
+     * Find everything which matches, then put them back into the order
+     * they subscribed in, removing duplicates.
+     */
+    std::vector < Observer * > matches = views;
+
+    auto exact = m_keys.find(key);
+
+    if (exact != m_keys.end())
+        matches.insert(matches.end(), exact->second.begin(), exact->second.end());
+
+    for (auto it = m_prefixes.begin(); it != m_prefixes.end(); ++it)
+    {
+        if (key.compare(0, it->first.size(), it->first) == 0)
+            matches.insert(matches.end(), it->second.begin(), it->second.end());
+    }
+
+    std::vector < Observer * > &result = m_dispatch[key];
+
+    for (Observer *obs : m_order)
+    {
+        if (std::find(matches.begin(), matches.end(), obs) != matches.end())
+            result.push_back(obs);
+    }
+
+    return (result);
+}
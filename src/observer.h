@@ -19,8 +19,9 @@
 
 #pragma once
 
-#include <vector>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 
 /*
@@ -35,25 +36,70 @@ class CConfigEntry;
  * This class-interface allows watchers to register themselves
  * via the `attach` method - and then they will be updated
  * whenever something changes.
+ *
+ * Watchers which only care about some keys should instead `subscribe`
+ * to each of them, or to a prefix they share, so that they aren't
+ * bothered by changes to any others.
  */
 class Subject
 {
 public:
     /**
      * This vector contains the registered observers of this
-     * subject.
+     * subject which are interested in every key.
      *
      */
     std::vector < class Observer * > views;
 
 public:
     /**
-     * Attach a new observer to this subject.
+     * Attach a new observer to this subject, to be updated upon
+     * changes to every key.
      */
-    void attach(Observer *obs)
-    {
-        views.push_back(obs);
-    };
+    void attach(Observer *obs);
+
+    /**
+     * Subscribe the given observer to changes of the named key.
+     */
+    void subscribe(Observer *obs, const std::string &key);
+
+    /**
+     * Subscribe the given observer to changes of every key beginning
+     * with the given prefix, such as "imap.".
+     */
+    void subscribe_prefix(Observer *obs, const std::string &prefix);
+
+    /**
+     * The observers interested in the named key, in the order they
+     * subscribed.  Each observer appears once, no matter how many of
+     * its subscriptions match.
+     */
+    const std::vector < class Observer * > &observers(const std::string &key);
+
+private:
+
+    /**
+     * Note that the given observer has subscribed to something, and
+     * forget the observers we've found for each key.
+     */
+    void subscribed(Observer *obs);
+
+    /**
+     * Observers of individual keys, and of prefixes.
+     */
+    std::unordered_map < std::string, std::vector < class Observer * > > m_keys;
+    std::unordered_map < std::string, std::vector < class Observer * > > m_prefixes;
+
+    /**
+     * The observers of each key we've been asked about, found from the
+     * above once, and forgotten whenever anything subscribes.
+     */
+    std::unordered_map < std::string, std::vector < class Observer * > > m_dispatch;
+
+    /**
+     * Every observer, in the order they first subscribed.
+     */
+    std::vector < class Observer * > m_order;
 };
 
 
@@ -76,12 +122,23 @@ class Observer
 {
 public:
 
+    /**
+     * Constructor.
+     *
+     * Observers constructed this way subscribe to nothing, and should
+     * `subscribe` to the keys they're interested in.
+     */
+    Observer()
+    {
+    }
+
     /**
      * Constructor.
      *
      * Call this with a reference to the subject you wish to be watching.
      *
-     * When a change is made then the update-method will be called later.
+     * When a change is made to any key then the update-method will be
+     * called later.
      */
     Observer(Subject *mod)
     {
@@ -94,4 +151,12 @@ public:
      */
     virtual void update(std::string name, CConfigEntry *old) = 0;
 
+    /**
+     * Called once the changes of a batch have all been passed to
+     * `update`, so that work they each require need only be done once.
+     */
+    virtual void batch_complete()
+    {
+    }
+
 };
@@ -0,0 +1,83 @@
+/*
+ * parallel.h - Helpers for processing lists across worker threads.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Lists smaller than this are processed upon the calling thread, as the
+ * cost of starting workers would outweigh any gain.
+ */
+#define PARALLEL_MIN 8192
+
+/**
+ * The most worker threads we'll use for a single list.
+ */
+#define PARALLEL_MAX_THREADS 8
+
+
+/**
+ * How many threads should we use to process `n` items?
+ */
+inline unsigned int parallel_threads(size_t n)
+{
+    if (n < PARALLEL_MIN)
+        return 1;
+
+    unsigned int threads = std::thread::hardware_concurrency();
+
+    if (threads < 1)
+        threads = 1;
+
+    if (threads > PARALLEL_MAX_THREADS)
+        threads = PARALLEL_MAX_THREADS;
+
+    return (threads);
+}
+
+
+/**
+ * Run `fn(lo, hi)` over `n` items, split into contiguous ranges across
+ * `threads` workers.
+ *
+ * With a single thread `fn` is invoked directly, upon the caller.
+ */
+template < typename F >
+void parallel_ranges(size_t n, unsigned int threads, F fn)
+{
+    if (threads <= 1)
+    {
+        fn(0, n);
+        return;
+    }
+
+    size_t chunk = (n + threads - 1) / threads;
+    std::vector < std::thread > workers;
+
+    for (size_t lo = 0; lo < n; lo += chunk)
+        workers.push_back(std::thread(fn, lo, std::min(n, lo + chunk)));
+
+    for (std::thread &worker : workers)
+        worker.join();
+}
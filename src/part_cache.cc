@@ -0,0 +1,123 @@
+/*
+ * part_cache.cc - Bound the memory used by parsed MIME-parts.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "config.h"
+#include "message.h"
+#include "part_cache.h"
+
+
+/*
+ * The default budget - 64Mb.
+ */
+#define PART_CACHE_DEFAULT (64 * 1024 * 1024)
+
+
+/*
+ * Constructor.
+ */
+CPartCache::CPartCache()
+{
+    m_bytes = 0;
+}
+
+
+/*
+ * Record that the given message has been used.
+ */
+void CPartCache::touch(CMessage *msg, size_t bytes)
+{
+    auto it = m_entries.find(msg);
+
+    if (it != m_entries.end())
+    {
+        m_bytes -= it->second.bytes;
+        m_lru.erase(it->second.pos);
+        m_entries.erase(it);
+    }
+
+    m_lru.push_front(msg);
+
+    part_entry entry;
+    entry.pos   = m_lru.begin();
+    entry.bytes = bytes;
+    m_entries[msg] = entry;
+    m_bytes += bytes;
+
+    evict(msg);
+}
+
+
+/*
+ * Stop tracking the given message.
+ */
+void CPartCache::remove(CMessage *msg)
+{
+    auto it = m_entries.find(msg);
+
+    if (it == m_entries.end())
+        return;
+
+    m_bytes -= it->second.bytes;
+    m_lru.erase(it->second.pos);
+    m_entries.erase(it);
+}
+
+
+/*
+ * The number of bytes of content currently held.
+ */
+size_t CPartCache::size()
+{
+    return (m_bytes);
+}
+
+
+/*
+ * The number of messages currently holding parts.
+ */
+size_t CPartCache::count()
+{
+    return (m_entries.size());
+}
+
+
+/*
+ * Evict the least-recently used messages until we're within budget.
+ */
+void CPartCache::evict(CMessage *keep)
+{
+    CConfig *config = CConfig::instance();
+    int budget = config->get_integer("message.parts_max_bytes", PART_CACHE_DEFAULT);
+
+    if (budget <= 0)
+        return;
+
+    while ((m_bytes > (size_t)budget) && (m_lru.size() > 1))
+    {
+        CMessage *victim = m_lru.back();
+
+        if (victim == keep)
+            break;
+
+        /*
+         * The message will call `remove()` as it releases its parts.
+         */
+        victim->release_parts();
+    }
+}
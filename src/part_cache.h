@@ -0,0 +1,107 @@
+/*
+ * part_cache.h - Bound the memory used by parsed MIME-parts.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <list>
+#include <unordered_map>
+
+#include "singleton.h"
+
+
+class CMessage;
+
+
+/**
+ * This singleton tracks which messages currently hold a parsed tree of
+ * MIME-parts, and how many bytes of decoded content each tree holds.
+ *
+ * Messages are kept in least-recently-used order, and when the total
+ * exceeds the budget set by `message.parts_max_bytes` the coldest
+ * messages are asked to release their parts.  They'll be re-parsed,
+ * transparently, the next time `CMessage::get_parts()` is called.
+ *
+ * A budget of zero disables eviction.
+ */
+class CPartCache : public Singleton<CPartCache>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CPartCache();
+
+    /**
+     * Record that the given message has been used, and holds parts
+     * totalling `bytes`.  This may evict other messages' parts, but
+     * never those of the message given.
+     */
+    void touch(CMessage *msg, size_t bytes);
+
+    /**
+     * Stop tracking the given message, which is being destroyed or
+     * has released its parts.
+     */
+    void remove(CMessage *msg);
+
+    /**
+     * The number of bytes of content currently held.
+     */
+    size_t size();
+
+    /**
+     * The number of messages currently holding parts.
+     */
+    size_t count();
+
+private:
+
+    /**
+     * Evict the least-recently used messages until we're within budget.
+     */
+    void evict(CMessage *keep);
+
+private:
+
+    /**
+     * A tracked message, and the position in our list.
+     */
+    typedef struct _part_entry
+    {
+        std::list < CMessage * >::iterator pos;
+        size_t bytes;
+    } part_entry;
+
+    /**
+     * Messages, most recently used first.
+     */
+    std::list < CMessage * > m_lru;
+
+    /**
+     * The entry for each message we track.
+     */
+    std::unordered_map < CMessage *, part_entry > m_entries;
+
+    /**
+     * The total size of the content we're tracking.
+     */
+    size_t m_bytes;
+};
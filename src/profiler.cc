@@ -0,0 +1,203 @@
+/*
+ * profiler.cc - A sampling profiler for our Lua code.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+
+extern "C"
+{
+#include <lua.h>
+}
+
+#include "profiler.h"
+
+
+/*
+ * The deepest stack we'll record, frames beyond this are omitted.
+ */
+#define PROFILE_MAX_DEPTH 64
+
+
+/*
+ * Are we profiling?
+ */
+bool CProfiler::m_profiling = false;
+
+
+/*
+ * Constructor.
+ */
+CProfiler::CProfiler()
+{
+    m_samples = 0;
+}
+
+
+/*
+ * Start sampling the given interpreter.
+ */
+void CProfiler::start(lua_State * l, int period)
+{
+    if (period < 1)
+        period = 1;
+
+    m_stacks.clear();
+    m_bindings.clear();
+    m_samples = 0;
+    m_profiling = true;
+
+    lua_sethook(l, hook, LUA_MASKCOUNT, period);
+}
+
+
+/*
+ * Stop sampling the given interpreter.
+ */
+void CProfiler::stop(lua_State * l)
+{
+    lua_sethook(l, NULL, 0, 0);
+    m_profiling = false;
+}
+
+
+/*
+ * Our hook, which samples the stack.
+ */
+void CProfiler::hook(lua_State * l, lua_Debug *ar)
+{
+    (void)ar;
+
+    if (m_profiling)
+        CProfiler::instance()->sample(l);
+}
+
+
+/*
+ * Describe a frame of the stack.
+ *
+ * Lua functions are named along with the file and line at which they
+ * are defined, so that functions of the same name may be told apart.
+ */
+std::string CProfiler::frame(lua_Debug *ar)
+{
+    std::string name = (ar->name != NULL) ? ar->name : "?";
+
+    if (ar->what != NULL && strcmp(ar->what, "C") == 0)
+        name += " [C]";
+    else if (ar->what != NULL && strcmp(ar->what, "main") == 0)
+        name = std::string("main (") + ar->short_src + ")";
+    else
+        name += std::string(" (") + ar->short_src + ":" + std::to_string(ar->linedefined) + ")";
+
+    /*
+     * Semi-colons separate the frames of our output.
+     */
+    std::replace(name.begin(), name.end(), ';', ':');
+    return (name);
+}
+
+
+/*
+ * Record a sample of the stack.
+ */
+void CProfiler::sample(lua_State * l)
+{
+    lua_Debug ar;
+    std::vector<std::string> frames;
+    std::string line;
+
+    for (int level = 0; level < PROFILE_MAX_DEPTH && lua_getstack(l, level, &ar); level++)
+    {
+        if (lua_getinfo(l, "Snl", &ar) == 0)
+            break;
+
+        /*
+         * The line being executed is our innermost frame.
+         */
+        if (level == 0 && ar.currentline > 0)
+            line = std::string(ar.short_src) + ":" + std::to_string(ar.currentline);
+
+        frames.push_back(frame(&ar));
+    }
+
+    std::string stack;
+
+    for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+    {
+        if (! stack.empty())
+            stack += ";";
+
+        stack += *it;
+    }
+
+    if (! line.empty())
+    {
+        std::replace(line.begin(), line.end(), ';', ':');
+        stack += ";" + line;
+    }
+
+    m_stacks[stack] += 1;
+    m_samples += 1;
+}
+
+
+/*
+ * Record a call to the named C binding.
+ */
+void CProfiler::binding(const std::string &name)
+{
+    m_bindings[name] += 1;
+}
+
+
+/*
+ * Get our samples, in the folded format.
+ */
+std::vector<std::string> CProfiler::folded()
+{
+    std::vector<std::string> out;
+    out.reserve(m_stacks.size());
+
+    for (auto it = m_stacks.begin(); it != m_stacks.end(); ++it)
+        out.push_back(it->first + " " + std::to_string(it->second));
+
+    std::sort(out.begin(), out.end());
+    return (out);
+}
+
+
+/*
+ * Write our samples to the given file.
+ */
+bool CProfiler::write(std::string path)
+{
+    std::ofstream out(path, std::ios::out | std::ios::trunc);
+
+    if (! out.is_open())
+        return false;
+
+    std::vector<std::string> lines = folded();
+
+    for (const std::string &line : lines)
+        out << line << "\n";
+
+    out.close();
+    return (! out.fail());
+}
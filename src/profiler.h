@@ -0,0 +1,151 @@
+/*
+ * profiler.h - A sampling profiler for our Lua code.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "singleton.h"
+
+
+struct lua_State;
+struct lua_Debug;
+
+
+/**
+ * This singleton samples the Lua stack every so many instructions, via
+ * an instruction-count hook, and counts the calls made to each of our
+ * C bindings.
+ *
+ * Samples are aggregated by stack, outermost function first, with the
+ * line being executed as the innermost frame.  They may be written in
+ * the "folded" format read by flamegraph.pl:
+ *
+ *<code>
+ *  main (global.config.lua:0);index_view (global.config.lua:2100);global.config.lua:2131 42
+ *</code>
+ *
+ * Profiling is off until `start()` is called.
+ */
+class CProfiler : public Singleton<CProfiler>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CProfiler();
+
+    /**
+     * Start sampling the given interpreter every `period` instructions,
+     * discarding any previous results.
+     */
+    void start(lua_State * l, int period);
+
+    /**
+     * Stop sampling the given interpreter.  Our results are retained.
+     */
+    void stop(lua_State * l);
+
+    /**
+     * Are we profiling?
+     *
+     * This is tested upon every call to a C binding, so is cheap.
+     */
+    static bool profiling()
+    {
+        return (m_profiling);
+    };
+
+    /**
+     * Record a sample of the stack of the given interpreter.
+     */
+    void sample(lua_State * l);
+
+    /**
+     * Record a call to the named C binding.
+     */
+    void binding(const std::string &name);
+
+    /**
+     * Get our samples, in the folded format, sorted by stack.
+     */
+    std::vector<std::string> folded();
+
+    /**
+     * Write our samples to the given file, in the folded format.
+     *
+     * Returns false if the file could not be written.
+     */
+    bool write(std::string path);
+
+    /**
+     * The number of samples recorded.
+     */
+    uint64_t samples()
+    {
+        return (m_samples);
+    };
+
+    /**
+     * The number of calls made to each C binding.
+     */
+    const std::unordered_map<std::string, uint64_t> &bindings()
+    {
+        return (m_bindings);
+    };
+
+private:
+
+    /**
+     * Describe a frame of the stack, as shown in our output.
+     */
+    static std::string frame(lua_Debug *ar);
+
+    /**
+     * Our hook, invoked every `period` instructions.
+     */
+    static void hook(lua_State * l, lua_Debug *ar);
+
+private:
+
+    /**
+     * The number of samples taken of each stack.
+     */
+    std::unordered_map<std::string, uint64_t> m_stacks;
+
+    /**
+     * The number of calls to each C binding.
+     */
+    std::unordered_map<std::string, uint64_t> m_bindings;
+
+    /**
+     * The total number of samples taken.
+     */
+    uint64_t m_samples;
+
+    /**
+     * Are we profiling?
+     */
+    static bool m_profiling;
+};
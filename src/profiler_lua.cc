@@ -0,0 +1,134 @@
+/*
+ * profiler_lua.cc - Export our Lua profiler to Lua.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "config.h"
+#include "lua.h"
+#include "profiler.h"
+
+
+/**
+ * @file profiler_lua.cc
+ *
+ * This file allows Lua to profile itself, writing samples of its stack
+ * in the folded format which flamegraph.pl reads.  Lua-usage looks
+ * something like this:
+ *
+ *<code>
+ *   Lua:profile_start() <br/>
+ *   -- .. use lumail for a while .. <br/>
+ *   Lua:profile_stop( "/tmp/lumail.folded" ) <br/>
+ *</code>
+ *
+ */
+
+
+/**
+ * Implementation of Lua:profile_start().
+ *
+ * Start sampling the stack every `period` instructions, defaulting to
+ * the value of `lua.profile_period`.
+ */
+int l_CLua_profile_start(lua_State * l)
+{
+    CLuaLog("l_CLua_profile_start");
+
+    int period;
+
+    if (lua_gettop(l) >= 2 && ! lua_isnil(l, 2))
+        period = luaL_checkinteger(l, 2);
+    else
+        period = CConfig::instance()->get_integer("lua.profile_period", 1000);
+
+    CProfiler::instance()->start(l, period);
+    return 0;
+}
+
+
+/**
+ * Implementation of Lua:profile_stop().
+ *
+ * Stop sampling, and if a path is given write our samples to it.  A
+ * table is returned holding the number of samples taken, and the number
+ * of calls made to each C binding.  If the samples could not be written
+ * we return nil and an error instead.
+ */
+int l_CLua_profile_stop(lua_State * l)
+{
+    CLuaLog("l_CLua_profile_stop");
+
+    CProfiler *profiler = CProfiler::instance();
+    profiler->stop(l);
+
+    if (lua_gettop(l) >= 2 && ! lua_isnil(l, 2))
+    {
+        std::string path = luaL_checkstring(l, 2);
+
+        if (! profiler->write(path))
+        {
+            lua_pushnil(l);
+            lua_pushstring(l, ("failed to write " + path).c_str());
+            return 2;
+        }
+    }
+
+    lua_newtable(l);
+
+    lua_pushnumber(l, (lua_Number) profiler->samples());
+    lua_setfield(l, -2, "samples");
+
+    lua_newtable(l);
+
+    for (auto it = profiler->bindings().begin(); it != profiler->bindings().end(); ++it)
+    {
+        lua_pushnumber(l, (lua_Number) it->second);
+        lua_setfield(l, -2, it->first.c_str());
+    }
+
+    lua_setfield(l, -2, "bindings");
+    return 1;
+}
+
+
+/**
+ * Register the global `Lua` object to the Lua environment, and setup
+ * our public methods upon which the user may operate.
+ */
+void InitProfiler(lua_State * l)
+{
+    luaL_Reg sFooRegs[] =
+    {
+        {"profile_start", l_CLua_profile_start},
+        {"profile_stop", l_CLua_profile_stop},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(l, "luaL_CLua");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sFooRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sFooRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_setglobal(l, "Lua");
+
+}
@@ -0,0 +1,100 @@
+/*
+ * profiler_test.cc - Test-cases for our Lua profiler.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include "lua.h"
+#include "profiler.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test sampling a Lua function.
+ */
+void TestProfilerSamples(CuTest * tc)
+{
+    lua_State *l = luaL_newstate();
+    luaL_openlibs(l);
+
+    CProfiler *profiler = CProfiler::instance();
+    profiler->start(l, 10);
+    CuAssertTrue(tc, CProfiler::profiling());
+
+    int erred = luaL_dostring(l,
+                              "function spin()\n"
+                              "  local x = 0\n"
+                              "  for i = 1, 100000 do x = x + i end\n"
+                              "  return x\n"
+                              "end\n"
+                              "spin()\n");
+    CuAssertIntEquals(tc, 0, erred);
+
+    profiler->binding("l_CTest_binding");
+    profiler->binding("l_CTest_binding");
+    profiler->stop(l);
+    CuAssertTrue(tc, ! CProfiler::profiling());
+
+    CuAssertTrue(tc, profiler->samples() > 0);
+    CuAssertIntEquals(tc, 2, profiler->bindings().at("l_CTest_binding"));
+
+    /*
+     * Each stack is outermost first, ends with a line, and is
+     * followed by its count.
+     */
+    bool found = false;
+
+    for (std::string line : profiler->folded())
+    {
+        if (line.find(";spin (") != std::string::npos)
+            found = true;
+
+        CuAssertTrue(tc, line.find(' ', line.rfind(';')) != std::string::npos);
+    }
+
+    CuAssertTrue(tc, found);
+
+    /*
+     * Write the samples out.
+     */
+    char tmpl[] = "/tmp/profile.XXXXXX";
+    int fd = mkstemp(tmpl);
+    CuAssertTrue(tc, fd >= 0);
+    close(fd);
+
+    CuAssertTrue(tc, profiler->write(tmpl));
+
+    std::ifstream in(tmpl);
+    std::string first;
+    std::getline(in, first);
+    CuAssertStrEquals(tc, profiler->folded()[0].c_str(), first.c_str());
+
+    unlink(tmpl);
+    lua_close(l);
+}
+
+
+CuSuite *
+profiler_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestProfilerSamples);
+    return suite;
+}
@@ -0,0 +1,296 @@
+/*
+ * regexp.cc - Compiled regular expressions, and a cache of them.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "config.h"
+#include "regexp.h"
+
+
+/*
+ * The default number of patterns we cache.
+ */
+#define REGEXP_CACHE_DEFAULT 256
+
+
+/*
+ * Constructor - compile the given pattern.
+ */
+CRegexp::CRegexp(std::string pattern, bool caseless)
+{
+    m_pattern  = pattern;
+    m_extra    = NULL;
+    m_captures = 0;
+    m_jit      = false;
+
+    const char *error = NULL;
+    int offset = 0;
+
+    m_code = pcre_compile(pattern.c_str(), caseless ? PCRE_CASELESS : 0, &error, &offset, NULL);
+
+    if (m_code == NULL)
+    {
+        m_error = error ? error : "invalid pattern";
+        return;
+    }
+
+    pcre_fullinfo(m_code, NULL, PCRE_INFO_CAPTURECOUNT, &m_captures);
+
+    /*
+     * Study the pattern, compiling it to machine-code if we can.  A
+     * failure here isn't fatal - we'll just match more slowly.
+     */
+#ifdef PCRE_STUDY_JIT_COMPILE
+    m_extra = pcre_study(m_code, PCRE_STUDY_JIT_COMPILE, &error);
+
+    int jit = 0;
+
+    if ((m_extra != NULL) && (pcre_fullinfo(m_code, m_extra, PCRE_INFO_JIT, &jit) == 0))
+        m_jit = (jit == 1);
+
+#else
+    m_extra = pcre_study(m_code, 0, &error);
+#endif
+}
+
+
+/*
+ * Destructor.
+ */
+CRegexp::~CRegexp()
+{
+#ifdef PCRE_STUDY_JIT_COMPILE
+
+    if (m_extra != NULL)
+        pcre_free_study(m_extra);
+
+#else
+
+    if (m_extra != NULL)
+        pcre_free(m_extra);
+
+#endif
+
+    if (m_code != NULL)
+        pcre_free(m_code);
+}
+
+
+/*
+ * Did the pattern compile?
+ */
+bool CRegexp::valid()
+{
+    return (m_code != NULL);
+}
+
+
+/*
+ * The reason the pattern failed to compile.
+ */
+std::string CRegexp::error()
+{
+    return (m_error);
+}
+
+
+/*
+ * The pattern we were compiled from.
+ */
+std::string CRegexp::pattern()
+{
+    return (m_pattern);
+}
+
+
+/*
+ * The number of capture-groups within the pattern.
+ */
+int CRegexp::captures()
+{
+    return (m_captures);
+}
+
+
+/*
+ * Was the pattern compiled to machine-code?
+ */
+bool CRegexp::jit()
+{
+    return (m_jit);
+}
+
+
+/*
+ * Does the pattern match anywhere within the given input?
+ */
+bool CRegexp::match(const char *input, size_t length)
+{
+    if (m_code == NULL)
+        return false;
+
+    int ovector[3];
+
+    /*
+     * We don't need the offsets of any captures, so we only ask for
+     * the whole match - PCRE returns zero, rather than failing, when
+     * there isn't room for them all.
+     */
+    return (pcre_exec(m_code, m_extra, input, length, 0, 0, ovector, 3) >= 0);
+}
+
+
+/*
+ * Match the pattern repeatedly over the input, collecting captures.
+ */
+int CRegexp::match_all(const char *input, size_t length, std::vector < std::string > &out)
+{
+    if (m_code == NULL)
+        return 0;
+
+    std::vector < int > ovector(3 * (m_captures + 1));
+    int count = 0;
+    size_t start = 0;
+
+    while (start <= length)
+    {
+        int rc = pcre_exec(m_code, m_extra, input, length, start, 0,
+                           &ovector[0], ovector.size());
+
+        if (rc < 0)
+            break;
+
+        count++;
+
+        for (int t = 1; (t <= m_captures) && (t <= REGEXP_MAX_CAPTURES); t++)
+        {
+            /*
+             * Groups which didn't take part in the match are empty.
+             */
+            if (ovector[2 * t] >= 0)
+                out.push_back(std::string(input + ovector[2 * t],
+                                          ovector[2 * t + 1] - ovector[2 * t]));
+            else
+                out.push_back("");
+        }
+
+        /*
+         * Step past an empty match, so we don't find it forever.
+         */
+        if (ovector[1] == ovector[0])
+            start = ovector[1] + 1;
+        else
+            start = ovector[1];
+    }
+
+    return (count);
+}
+
+
+/*
+ * Constructor.
+ */
+CRegexpCache::CRegexpCache()
+{
+    m_hits   = 0;
+    m_misses = 0;
+}
+
+
+/*
+ * Return the compiled form of the given pattern.
+ */
+std::shared_ptr<CRegexp> CRegexpCache::get(const std::string &pattern, bool caseless)
+{
+    std::string key = (caseless ? "i:" : "-:") + pattern;
+
+    auto it = m_entries.find(key);
+
+    if (it != m_entries.end())
+    {
+        m_hits++;
+        m_lru.splice(m_lru.begin(), m_lru, it->second.pos);
+        return (it->second.regexp);
+    }
+
+    m_misses++;
+
+    std::shared_ptr<CRegexp> regexp = std::make_shared<CRegexp>(pattern, caseless);
+
+    /*
+     * A size of zero disables caching.
+     */
+    CConfig *config = CConfig::instance();
+    int limit = config->get_integer("regexp.cache_size", REGEXP_CACHE_DEFAULT);
+
+    if (limit <= 0)
+        return (regexp);
+
+    while (m_entries.size() >= (size_t)limit)
+    {
+        m_entries.erase(m_lru.back());
+        m_lru.pop_back();
+    }
+
+    m_lru.push_front(key);
+
+    regexp_entry entry;
+    entry.pos    = m_lru.begin();
+    entry.regexp = regexp;
+    m_entries[key] = entry;
+
+    return (regexp);
+}
+
+
+/*
+ * Discard every cached pattern, and reset our counters.
+ */
+void CRegexpCache::clear()
+{
+    m_entries.clear();
+    m_lru.clear();
+    m_hits   = 0;
+    m_misses = 0;
+}
+
+
+/*
+ * The number of lookups which found a compiled pattern.
+ */
+size_t CRegexpCache::hits()
+{
+    return (m_hits);
+}
+
+
+/*
+ * The number of lookups which had to compile a pattern.
+ */
+size_t CRegexpCache::misses()
+{
+    return (m_misses);
+}
+
+
+/*
+ * The number of patterns currently cached.
+ */
+size_t CRegexpCache::size()
+{
+    return (m_entries.size());
+}
@@ -0,0 +1,186 @@
+/*
+ * regexp.h - Compiled regular expressions, and a cache of them.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <list>
+#include <memory>
+#include <pcre.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "singleton.h"
+
+
+/**
+ * The most captures we'll return from a single match.
+ */
+#define REGEXP_MAX_CAPTURES 10
+
+
+/**
+ * A compiled PCRE regular expression.
+ *
+ * The pattern is compiled once, and studied - using the JIT compiler if
+ * the PCRE library supports it - so that it may be matched repeatedly
+ * at little cost.
+ */
+class CRegexp
+{
+public:
+
+    /**
+     * Constructor - compile the given pattern.
+     */
+    CRegexp(std::string pattern, bool caseless = true);
+
+    /**
+     * Destructor.
+     */
+    ~CRegexp();
+
+    /**
+     * Did the pattern compile?  If not `error()` will explain why.
+     */
+    bool valid();
+
+    /**
+     * The reason the pattern failed to compile.
+     */
+    std::string error();
+
+    /**
+     * The pattern we were compiled from.
+     */
+    std::string pattern();
+
+    /**
+     * The number of capture-groups within the pattern.
+     */
+    int captures();
+
+    /**
+     * Was the pattern compiled to machine-code?
+     */
+    bool jit();
+
+    /**
+     * Does the pattern match anywhere within the given input?
+     */
+    bool match(const char *input, size_t length);
+
+    /**
+     * Match the pattern repeatedly over the input, appending the
+     * captures (up to `REGEXP_MAX_CAPTURES`) from each match.
+     *
+     * Returns the number of matches.
+     */
+    int match_all(const char *input, size_t length, std::vector < std::string > &out);
+
+private:
+
+    /**
+     * The pattern, and the failure to compile it, if any.
+     */
+    std::string m_pattern;
+    std::string m_error;
+
+    /**
+     * The compiled pattern, and the results of studying it.
+     */
+    pcre *m_code;
+    pcre_extra *m_extra;
+
+    /**
+     * The number of capture-groups, and whether JIT was used.
+     */
+    int m_captures;
+    bool m_jit;
+};
+
+
+/**
+ * This singleton holds the most recently used compiled expressions, so
+ * that matching the same handful of patterns against each line of the
+ * screen doesn't recompile them every time.
+ *
+ * Patterns are keyed by their text and options.  The cache holds at most
+ * `regexp.cache_size` entries, discarding the least-recently used
+ * beyond that.  Patterns which fail to compile are cached too.
+ */
+class CRegexpCache : public Singleton<CRegexpCache>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CRegexpCache();
+
+    /**
+     * Return the compiled form of the given pattern.
+     */
+    std::shared_ptr<CRegexp> get(const std::string &pattern, bool caseless = true);
+
+    /**
+     * Discard every cached pattern, and reset our counters.
+     */
+    void clear();
+
+    /**
+     * The number of lookups which found a compiled pattern, and which
+     * didn't.
+     */
+    size_t hits();
+    size_t misses();
+
+    /**
+     * The number of patterns currently cached.
+     */
+    size_t size();
+
+private:
+
+    /**
+     * A cached pattern, and its position in our list.
+     */
+    typedef struct _regexp_entry
+    {
+        std::list < std::string >::iterator pos;
+        std::shared_ptr<CRegexp> regexp;
+    } regexp_entry;
+
+    /**
+     * Cache keys, most recently used first.
+     */
+    std::list < std::string > m_lru;
+
+    /**
+     * The entry for each key.
+     */
+    std::unordered_map < std::string, regexp_entry > m_entries;
+
+    /**
+     * Our counters.
+     */
+    size_t m_hits;
+    size_t m_misses;
+};
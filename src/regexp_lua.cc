@@ -17,11 +17,12 @@
  */
 
 
-#include <pcrecpp.h>
+#include <memory>
+#include <string>
 #include <vector>
-#include <iostream>
 
 #include "lua.h"
+#include "regexp.h"
 
 
 /**
@@ -39,12 +40,100 @@
  * end<br/>
  *</code>
  *
+ * Patterns are compiled once, and cached, so repeatedly matching the
+ * same pattern is cheap.  A compiled pattern may also be held directly:
+ *
+ *<code>
+ * local re = Regexp:compile( "[kh]emp$" )<br/>
+ * if ( re:match( "Steve Kemp" ) ) then<br/>
+ *   print "OK"<br/>
+ * end<br/>
+ *</code>
+ *
+ */
+
+
+/**
+ * Push the result of matching the given expression against the input.
+ *
+ * If the regexp contains no captures then `true` will be pushed on
+ * a successful match, otherwise `false`.
+ *
+ * If the regexp contains captures (up to ten) then they will be pushed
+ * as a table.
+ */
+static void push_match(lua_State * l, std::shared_ptr<CRegexp> re, const char *input, size_t len)
+{
+    if (re->captures() == 0)
+    {
+        if (re->match(input, len))
+            lua_pushboolean(l , 1);
+        else
+            lua_pushboolean(l , 0);
+
+        return;
+    }
+
+    std::vector<std::string> r;
+    re->match_all(input, len, r);
+
+    lua_newtable(l);
+
+    int i = 1;
+
+    for (auto it = r.begin(); it != r.end(); ++it)
+    {
+        std::string value = (*it);
+
+        lua_pushinteger(l, i);
+        lua_pushlstring(l, value.c_str(), value.size());
+
+        lua_settable(l, -3);
+
+        i += 1;
+    }
+}
+
+
+/**
+ * Push a compiled regexp onto the Lua stack.
+ */
+static void push_cregexp(lua_State * l, std::shared_ptr<CRegexp> re)
+{
+    void *ud = lua_newuserdata(l, sizeof(std::shared_ptr<CRegexp>));
+
+    if (!ud)
+        return;
+
+    /*
+     * Construct the shared pointer in place, as we do for maildirs.
+     */
+    std::shared_ptr<CRegexp> *udata = new(ud) std::shared_ptr<CRegexp>();
+    *udata = re;
+
+    luaL_getmetatable(l, "luaL_CRegexpCompiled");
+    lua_setmetatable(l, -2);
+}
+
+
+/**
+ * Test that the object on the Lua stack is a compiled regexp.
  */
+static std::shared_ptr<CRegexp> l_CheckCRegexp(lua_State * l, int n)
+{
+    void *ud = luaL_checkudata(l, n, "luaL_CRegexpCompiled");
+
+    if (ud)
+        return *(static_cast<std::shared_ptr<CRegexp> *>(ud));
+
+    return std::shared_ptr<CRegexp>();
+}
+
 
 /**
  * Implementation of Regexp:match().
  *
- * This allows a pattern to be tested against a string.
+ * This allows a pattern to be tested against a string, ignoring case.
  *
  * If the regexp contains no captures then `true` will be returned on
  * a successful match, otherwise `false`.
@@ -56,100 +145,163 @@ int l_CRegexp_match(lua_State * l)
 {
     CLuaLog("l_CRegexp_match");
 
-    const char *pattern = lua_tostring(l, 2);
-    const char *input   = lua_tostring(l, 3);
+    const char *pattern = luaL_checkstring(l, 2);
+
+    size_t len;
+    const char *input = luaL_checklstring(l, 3, &len);
+
+    CRegexpCache *cache = CRegexpCache::instance();
+    push_match(l, cache->get(pattern), input, len);
+    return 1;
+}
+
+
+/**
+ * Implementation of Regexp:compile().
+ *
+ * Return a compiled pattern, which may be matched repeatedly, or `nil`
+ * and the reason if it is invalid.
+ *
+ * An optional table of options may contain `caseless`, which defaults
+ * to true, as `Regexp:match()` does.
+ *
+ * This may be called as `Regexp.compile()` too.
+ */
+int l_CRegexp_compile(lua_State * l)
+{
+    CLuaLog("l_CRegexp_compile");
 
-    pcrecpp::RE_Options opt;
-    opt.set_caseless(true);
-    pcrecpp::RE re(pattern, opt);
+    int arg = lua_istable(l, 1) ? 2 : 1;
+    const char *pattern = luaL_checkstring(l, arg);
 
-    int n = re.NumberOfCapturingGroups();
+    bool caseless = true;
 
-    if (n == 0)
+    if (lua_istable(l, arg + 1))
     {
-        if (re.PartialMatch(input))
-            lua_pushboolean(l , 1);
-        else
-            lua_pushboolean(l , 0);
+        lua_getfield(l, arg + 1, "caseless");
 
-        return 1;
+        if (! lua_isnil(l, -1))
+            caseless = lua_toboolean(l, -1);
+
+        lua_pop(l, 1);
     }
 
-    std::string matches[10];
-    const pcrecpp::Arg *args[10];
+    CRegexpCache *cache = CRegexpCache::instance();
+    std::shared_ptr<CRegexp> re = cache->get(pattern, caseless);
 
-    int z = 0;
-    pcrecpp::Arg arg0 = &matches[z];
-    args[z++] = &arg0;
+    if (! re->valid())
+    {
+        lua_pushnil(l);
+        lua_pushstring(l, re->error().c_str());
+        return 2;
+    }
 
-    pcrecpp::Arg arg1 = &matches[z];
-    args[z++] = &arg1;
+    push_cregexp(l, re);
+    return 1;
+}
 
-    pcrecpp::Arg arg2 = &matches[z];
-    args[z++] = &arg2;
 
-    pcrecpp::Arg arg3 = &matches[z];
-    args[z++] = &arg3;
+/**
+ * Implementation of Regexp:stats().
+ *
+ * Return a table of the cache counters.
+ */
+int l_CRegexp_stats(lua_State * l)
+{
+    CLuaLog("l_CRegexp_stats");
 
-    pcrecpp::Arg arg4 = &matches[z];
-    args[z++] = &arg4;
+    CRegexpCache *cache = CRegexpCache::instance();
 
-    pcrecpp::Arg arg5 = &matches[z];
-    args[z++] = &arg5;
+    lua_newtable(l);
 
-    pcrecpp::Arg arg6 = &matches[z];
-    args[z++] = &arg6;
+    lua_pushinteger(l, cache->hits());
+    lua_setfield(l, -2, "hits");
 
-    pcrecpp::Arg arg7 = &matches[z];
-    args[z++] = &arg7;
+    lua_pushinteger(l, cache->misses());
+    lua_setfield(l, -2, "misses");
 
-    pcrecpp::Arg arg8 = &matches[z];
-    args[z++] = &arg8;
+    lua_pushinteger(l, cache->size());
+    lua_setfield(l, -2, "size");
 
-    pcrecpp::Arg arg9 = &matches[z];
-    args[z++] = &arg9;
+    return 1;
+}
 
-    pcrecpp::StringPiece in(input);
 
-    int consumed;
+/**
+ * Implementation of compiled:captures()
+ */
+int l_CRegexpCompiled_captures(lua_State * l)
+{
+    CLuaLog("l_CRegexpCompiled_captures");
 
-    std::vector<std::string> r;
+    std::shared_ptr<CRegexp> re = l_CheckCRegexp(l, 1);
+    lua_pushinteger(l, re->captures());
+    return 1;
+}
 
-    do
-    {
-        if (re.DoMatch(in, re.UNANCHORED, &consumed, args, n))
-        {
-            in.remove_prefix(consumed);
-
-            for (int t = 0; t < n && t < 10; t++)
-            {
-                r.push_back(matches[t]);
-            }
-        }
-        else
-            break;
-    }
-    while (true);
 
-    lua_newtable(l);
+/**
+ * Implementation of compiled:jit()
+ */
+int l_CRegexpCompiled_jit(lua_State * l)
+{
+    CLuaLog("l_CRegexpCompiled_jit");
 
-    int i = 1;
+    std::shared_ptr<CRegexp> re = l_CheckCRegexp(l, 1);
+    lua_pushboolean(l, re->jit() ? 1 : 0);
+    return 1;
+}
 
-    for (auto it = r.begin(); it != r.end(); ++it)
-    {
-        std::string value = (*it);
 
-        lua_pushinteger(l, i);
-        lua_pushstring(l, value.c_str());
+/**
+ * Implementation of compiled:match()
+ */
+int l_CRegexpCompiled_match(lua_State * l)
+{
+    CLuaLog("l_CRegexpCompiled_match");
 
-        lua_settable(l, -3);
+    std::shared_ptr<CRegexp> re = l_CheckCRegexp(l, 1);
 
-        i += 1;
-    }
+    size_t len;
+    const char *input = luaL_checklstring(l, 2, &len);
+
+    push_match(l, re, input, len);
+    return 1;
+}
+
+
+/**
+ * Implementation of compiled:pattern()
+ */
+int l_CRegexpCompiled_pattern(lua_State * l)
+{
+    CLuaLog("l_CRegexpCompiled_pattern");
 
+    std::shared_ptr<CRegexp> re = l_CheckCRegexp(l, 1);
+    lua_pushstring(l, re->pattern().c_str());
     return 1;
 }
 
+
+/**
+ * Destructor for compiled patterns.
+ */
+int l_CRegexpCompiled_destructor(lua_State * l)
+{
+    CLuaLog("l_CRegexpCompiled_destructor");
+
+    void *ud = luaL_checkudata(l, 1, "luaL_CRegexpCompiled");
+
+    if (ud)
+    {
+        std::shared_ptr<CRegexp> *re = static_cast<std::shared_ptr<CRegexp> *>(ud);
+        re->~shared_ptr<CRegexp>();
+    }
+
+    return 0;
+}
+
+
 /**
  * Export the `Regexp` class to Lua.
  *
@@ -157,9 +309,34 @@ int l_CRegexp_match(lua_State * l)
  */
 void InitRegexp(lua_State * l)
 {
+    luaL_Reg sCompiledRegs[] =
+    {
+        {"__gc", l_CRegexpCompiled_destructor},
+        {"captures", l_CRegexpCompiled_captures},
+        {"jit", l_CRegexpCompiled_jit},
+        {"match", l_CRegexpCompiled_match},
+        {"pattern", l_CRegexpCompiled_pattern},
+        {NULL,       NULL}
+    };
+    luaL_newmetatable(l, "luaL_CRegexpCompiled");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sCompiledRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sCompiledRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_pop(l, 1);
+
     luaL_Reg sFooRegs[] =
     {
+        {"compile", l_CRegexp_compile},
         {"match", l_CRegexp_match},
+        {"stats", l_CRegexp_stats},
         {NULL,       NULL}
     };
     luaL_newmetatable(l, "luaL_CRegexp");
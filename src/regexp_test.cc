@@ -0,0 +1,122 @@
+/*
+ * regexp_test.cc - Test-cases for our compiled regular expressions.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "regexp.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test matching compiled patterns.
+ */
+void TestRegexpMatch(CuTest * tc)
+{
+    CRegexp kemp("[kh]emp$");
+    CuAssertTrue(tc, kemp.valid());
+    CuAssertIntEquals(tc, 0, kemp.captures());
+    CuAssertTrue(tc, kemp.match("Steve Kemp", 10));
+    CuAssertTrue(tc, ! kemp.match("Steve Kemp.", 11));
+
+    CRegexp exact("[kh]emp$", false);
+    CuAssertTrue(tc, ! exact.match("Steve Kemp", 10));
+
+    /*
+     * Captures are collected from every match.
+     */
+    CRegexp pairs("([a-z])=([0-9]*)");
+    std::vector < std::string > out;
+
+    CuAssertIntEquals(tc, 2, pairs.captures());
+    CuAssertIntEquals(tc, 3, pairs.match_all("a=1, b=22, c=", 13, out));
+    CuAssertIntEquals(tc, 6, out.size());
+    CuAssertStrEquals(tc, "b", out[2].c_str());
+    CuAssertStrEquals(tc, "22", out[3].c_str());
+    CuAssertStrEquals(tc, "", out[5].c_str());
+
+    /*
+     * Empty matches don't loop forever.
+     */
+    CRegexp empty("(x*)");
+    out.clear();
+    CuAssertIntEquals(tc, 4, empty.match_all("abc", 3, out));
+
+    /*
+     * Invalid patterns never match.
+     */
+    CRegexp broken("(unclosed");
+    CuAssertTrue(tc, ! broken.valid());
+    CuAssertTrue(tc, ! broken.error().empty());
+    CuAssertTrue(tc, ! broken.match("(unclosed", 9));
+}
+
+
+/**
+ * Test the cache of compiled patterns.
+ */
+void TestRegexpCache(CuTest * tc)
+{
+    CConfig *config = CConfig::instance();
+    config->set("regexp.cache_size", 2, false);
+
+    CRegexpCache cache;
+
+    std::shared_ptr<CRegexp> one = cache.get("one");
+    CuAssertTrue(tc, one == cache.get("one"));
+    CuAssertIntEquals(tc, 1, cache.hits());
+    CuAssertIntEquals(tc, 1, cache.misses());
+
+    /*
+     * Options form part of the key.
+     */
+    CuAssertTrue(tc, one != cache.get("one", false));
+    CuAssertIntEquals(tc, 2, cache.size());
+
+    /*
+     * The least-recently used pattern is discarded.
+     */
+    cache.get("one");
+    cache.get("two");
+    CuAssertIntEquals(tc, 2, cache.size());
+    CuAssertTrue(tc, one == cache.get("one"));
+
+    size_t misses = cache.misses();
+    cache.get("one", false);
+    CuAssertIntEquals(tc, misses + 1, cache.misses());
+
+    cache.clear();
+    CuAssertIntEquals(tc, 0, cache.size());
+    CuAssertIntEquals(tc, 0, cache.hits());
+
+    config->set("regexp.cache_size", 256, false);
+}
+
+
+CuSuite *
+regexp_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestRegexpMatch);
+    SUITE_ADD_TEST(suite, TestRegexpCache);
+    return suite;
+}
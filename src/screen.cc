@@ -27,9 +27,14 @@
 #include "attachment_view.h"
 #include "config.h"
 #include "colour_string.h"
+#include "frame_stats.h"
+#include "fuzzy_matcher.h"
+#include "global_state.h"
 #include "history.h"
+#include "imap_proxy.h"
 #include "index_view.h"
 #include "input_queue.h"
+#include "job_queue.h"
 #include "keybinding_view.h"
 #include "lua.h"
 #include "lua_view.h"
@@ -37,15 +42,32 @@
 #include "message_view.h"
 #include "screen.h"
 
+#include "startup_timings.h"
 #include "statuspanel.h"
+#include "timer_wheel.h"
+
+
+/*
+ * Handles upon the configuration keys we read each time we draw.
+ */
+static CConfigKey g_mode_key("global.mode");
+static CConfigKey g_timeout_key("global.timeout");
+static CConfigKey g_budget_key("global.input_budget");
+static CConfigKey g_wrap_key("line.wrap");
+static CConfigKey g_horizontal_key("global.horizontal");
+static CConfigKey g_tab_key("global.tab");
 
 
 
 /*
  * Constructor.
  */
-CScreen::CScreen() : Observer(CConfig::instance())
+CScreen::CScreen()
 {
+    CConfig *config = CConfig::instance();
+    config->subscribe(this, "global.mode");
+    config->subscribe(this, "global.timeout");
+    config->subscribe_prefix(this, "colour.");
 }
 
 
@@ -100,17 +122,24 @@ void CScreen::update(std::string key_name, CConfigEntry *old)
     if (key_name == "global.timeout")
     {
         CConfig *config = CConfig::instance();
-        int value       = config->get_integer("global.timeout", 500);
+        int value       = config->get_integer(g_timeout_key, 500);
         timeout(value);
     }
 
+    /*
+     * Colours such as "unread" are resolved via the `colour.*` keys, so
+     * forget those we've resolved.
+     */
+    if (key_name.compare(0, 7, "colour.") == 0)
+        m_colour_cache.clear();
+
     if (key_name == "global.mode")
     {
         /*
          * The value the user set.
          */
         CConfig *config = CConfig::instance();
-        std::string nm  = config->get_string("global.mode");
+        std::string nm  = config->get_string(g_mode_key);
 
         /*
          * Ensure the new-mode is valid.
@@ -161,22 +190,39 @@ void CScreen::run_main_loop()
     CInputQueue *input = CInputQueue::instance();
 
     /*
-     * Get a single character.
+     * Get a single character - waiting no longer than our idle-period,
+     * or until the next timer is due, whichever is sooner.
      */
-    while ((m_running) && (ch = input->get_input()))
+    while (m_running)
     {
+        timeout(idle_timeout());
+
+        if (!(ch = input->get_input()))
+            break;
+
+        /*
+         * Time each phase of this frame.
+         */
+        CFrameStats *stats = CFrameStats::instance();
+        uint64_t started   = CFrameStats::now();
 
         /*
-         * Clear the screen.
+         * Clear the screen, if we've received input - which will redraw
+         * it.  There's no need to clear it upon an idle iteration unless
+         * something has changed.
          */
-        clear(false);
+        if (ch != ERR)
+        {
+            m_dirty = true;
+            clear(false);
+        }
 
 
         /*
          * Get the current global mode.
          */
         CConfig *config  = CConfig::instance();
-        std::string mode = config->get_string("global.mode", "maildir");
+        std::string mode = config->get_string(g_mode_key, "maildir");
 
 
         /*
@@ -199,19 +245,25 @@ void CScreen::run_main_loop()
                  */
                 on_keypress(total);
                 total = "";
+                m_dirty = true;
             }
             else
             {
                 /*
                  * Call the Lua on_idle() function.
                  */
-                lua->execute("on_idle()");
+                lua->on_idle();
 
                 /*
                  * Call our view-specific on-idle handler.
                  */
                 if (view)
                     view->on_idle();
+
+                /*
+                 * Collect some garbage while there's nothing else to do.
+                 */
+                lua->gc_idle();
             }
         }
         else
@@ -242,42 +294,184 @@ void CScreen::run_main_loop()
             }
         }
 
+        stats->record((ch == ERR) ? "idle" : "input", CFrameStats::now() - started);
 
         /*
-         * Check if the view has changed (after key handling).
-         *
-         * This avoids a single redraw of the wrong mode, before we
-         * run round the event-loop again and draw in the correct mode.
+         * If more keys are waiting, because they've been pasted or a key
+         * is held down, handle them before we draw, so that we draw once
+         * for the lot rather than once for each.  We'll still draw once
+         * `global.input_budget` milliseconds have passed since we last
+         * did, so that scrolling remains smooth.
          */
-        std::string new_mode = config->get_string("global.mode", "maildir");
+        if ((ch != ERR) && input->input_ready())
+        {
+            uint64_t budget = config->get_integer(g_budget_key, 50) * 1000;
+
+            if (CFrameStats::now() - m_last_frame < budget)
+                continue;
+        }
 
-        if (new_mode != mode)
-            view = m_views[new_mode];
 
         /*
-         * Update the view.
+         * Run any timers which have expired.
          */
-        if (view)
-            view->draw();
+        lua->run_timers();
 
         /*
-         * Update our panel
+         * Complete any jobs which have finished upon our workers.
+         */
+        if (CJobQueue::instance()->drain() > 0)
+            m_dirty = true;
+
+        /*
+         * Collect any messages which have been loaded in the background.
+         */
+        if (CGlobalState::instance()->poll_messages())
+            m_dirty = true;
+
+        /*
+         * Handle any IMAP replies which arrived while we were waiting
+         * for a synchronous one.
+         */
+        if (CIMAPProxy::instance()->poll())
+            m_dirty = true;
+
+        /*
+         * If the flags of any message have changed, or the current
+         * maildir has, then we need to redraw.
+         */
+        if (m_flags_generation != CMessage::flags_generation())
+            m_dirty = true;
+
+        /*
+         * Any change to the configuration, made other than by the view
+         * as it draws, requires a redraw.
+         */
+        if (m_config_changes != config->changes())
+            m_dirty = true;
+
+        std::shared_ptr<CMaildir> maildir = CGlobalState::instance()->current_maildir();
+
+        if (maildir && (maildir->is_maildir() || maildir->is_virtual()) &&
+                (maildir->last_modified() != m_maildir_mtime))
+            m_dirty = true;
+
+        /*
+         * Has the panel changed?  If it has been shown, or hidden,
+         * then the area available to the view has changed too.
          */
         CStatusPanel *instance = CStatusPanel::instance();
+        bool panel = instance->changed();
+
+        if (panel && (instance->hidden() != m_panel_hidden))
+        {
+            m_panel_hidden = instance->hidden();
+            m_dirty = true;
+        }
+
+        /*
+         * Nothing has changed?  Then there's nothing to draw.
+         */
+        if (! m_dirty && ! panel)
+            continue;
+
+        if (m_dirty)
+        {
+            /*
+             * Check if the view has changed (after key handling).
+             *
+             * This avoids a single redraw of the wrong mode, before we
+             * run round the event-loop again and draw in the correct
+             * mode.
+             */
+            std::string new_mode = config->get_string(g_mode_key, "maildir");
+
+            if (new_mode != mode)
+                view = m_views[new_mode];
+
+            if (ch == ERR)
+                clear(false);
+
+            /*
+             * Update the view.  Changes the view makes to the
+             * configuration, such as `$mode.max`, don't make us dirty
+             * again.
+             */
+            if (view)
+            {
+                CFrameTimer timer("draw");
+                CTraceSpan span("draw ", new_mode);
+                view->draw();
+            }
+
+            m_dirty = false;
 
+            m_config_changes   = config->changes();
+            m_flags_generation = CMessage::flags_generation();
+            m_maildir_mtime    = maildir ? maildir->last_modified() : 0;
+        }
+
+        /*
+         * Update our panel
+         */
         if (! instance->hidden())
+        {
+            CFrameTimer timer("panel");
             instance->draw();
+        }
 
         /*
          * Update our panel.
          */
-        update_panels();
-        doupdate();
-        refresh();
+        {
+            CFrameTimer timer("update");
+            update_panels();
+            doupdate();
+            refresh();
+        }
+
+        m_last_frame = CFrameStats::now();
+        stats->record("frame", m_last_frame - started);
+        CStartupTimings::instance()->frame_drawn();
+        stats->set_counter("lua_heap", lua->heap_size());
     }
 }
 
 
+/*
+ * The number of milliseconds to wait for input, before we're idle.
+ */
+int CScreen::idle_timeout()
+{
+    CConfig *config = CConfig::instance();
+    int tout = config->get_integer(g_timeout_key, 500);
+
+    CTimerWheel *wheel = CTimerWheel::instance();
+    int64_t next = wheel->next_deadline(CTimerWheel::now());
+
+    if ((next >= 0) && ((tout < 0) || (next < tout)))
+        tout = next;
+
+    /*
+     * While jobs are running we check upon them frequently, so that
+     * their completions aren't held up by our waiting for input.
+     */
+    if ((CJobQueue::instance()->pending() > 0) && ((tout < 0) || (tout > JOB_POLL_MS)))
+        tout = JOB_POLL_MS;
+
+    return (tout);
+}
+
+
+/*
+ * Mark the screen as needing to be redrawn.
+ */
+void CScreen::invalidate()
+{
+    m_dirty = true;
+}
+
+
 /*
  * Is the given character a multi-key prefix?
  */
@@ -287,7 +481,7 @@ bool CScreen::is_prefixed_key(const char *key)
      * Get the current mode.
      */
     CConfig *config  = CConfig::instance();
-    std::string mode = config->get_string("global.mode", "maildir");
+    std::string mode = config->get_string(g_mode_key, "maildir");
 
     /*
      * We allow the user to bind actions to multipl-key-presses,
@@ -303,76 +497,12 @@ bool CScreen::is_prefixed_key(const char *key)
      * with a ^X prefix we'd decide that ^X was NOT a multi-key binding
      * and it would be treated as a single keypress.
      *
-     * The problem is that if the user presses "K" that would appear
-     * to be a prefix-match on the term "KEY_LEFT", so we need to
-     * special case a couple of actions here.
-     *
-     * This is a list of possible-matches which should be ignored.
-     *
-     */
-    std::vector<std::string> ignored;
-    ignored.push_back("SPACE");
-    ignored.push_back("ENTER");
-    ignored.push_back("KEY_");
-
-    /*
-     * Get the lua-helper.
+     * The bindings of each mode are held in a trie, by CLua, so this
+     * costs no more than a walk of the keys pressed.
      */
     CLua *lua = CLua::instance();
 
-    /*
-     * Get the bindings in the current mode, and the global-mode.
-     */
-    std::vector<std::string> b = lua->bindings(mode);
-    std::vector<std::string> g = lua->bindings("global");
-
-    /*
-     * Join them.
-     */
-    for (auto it = g.begin(); it != g.end() ; ++it)
-    {
-        b.push_back((*it));
-    }
-
-    /*
-     * Now test each entry
-     */
-    for (auto it = b.begin(); it != b.end() ; ++it)
-    {
-        std::string k = (*it);
-
-        /*
-         * Make sure that we don't match an ignored term.
-         */
-        bool ignoring = false;
-
-        for (auto i = ignored.begin(); i != ignored.end() ; ++i)
-        {
-            if (k.find((*i), 0) == 0)
-                ignoring = true;
-        }
-
-        /*
-         * Not a match on the ignored token?  Then proceed.
-         */
-        if (ignoring == false)
-        {
-
-            /*
-             * Starts with the string, but NOT equal to the string.
-             */
-            if ((k.compare(0, strlen(key), key) == 0) &&
-                    (strlen(key) != k.length()))
-            {
-                return true;
-            }
-        }
-    }
-
-    /*
-     * Given up - not a multi-map
-     */
-    return false;
+    return (lua->is_prefixed_key(mode, key) || lua->is_prefixed_key("global", key));
 }
 
 /*
@@ -465,7 +595,7 @@ void CScreen::setup()
      * Get our timeout period, and set it.
      */
     CConfig *config = CConfig::instance();
-    int tout = config->get_integer("global.timeout", 500);
+    int tout = config->get_integer(g_timeout_key, 500);
 
     timeout(tout);
     use_default_colors();
@@ -496,6 +626,8 @@ void CScreen::setup()
     init_pair(8, COLOR_BLACK, COLOR_WHITE);
     m_colours[ "black" ] = 8;
 
+    m_colour_cache.clear();
+
     CStatusPanel *panel = CStatusPanel::instance();
     panel->init(6);
 }
@@ -571,7 +703,7 @@ void CScreen::redraw()
      * Get the current global mode.
      */
     CConfig *config  = CConfig::instance();
-    std::string mode = config->get_string("global.mode", "maildir");
+    std::string mode = config->get_string(g_mode_key, "maildir");
 
 
     /*
@@ -629,11 +761,12 @@ int CScreen::width()
 
 
 /*
- * Choose a single item from a small selection.
+ * Choose a single item from a selection, which is narrowed as the user
+ * types, fuzzily if `fuzzy` is set.
  *
  * (This is used to resolve ambiguity in TAB-completion.)
  */
-std::string CScreen::choose_string(std::vector<std::string> choices)
+std::string CScreen::choose_string(std::vector<std::string> choices, bool fuzzy)
 {
     /*
      * We don't need to resolve ambiguity unless there is more than
@@ -646,7 +779,7 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
      */
     size_t max = 0;
 
-    for (std::string choice : choices)
+    for (const std::string &choice : choices)
     {
         if (choice.size() > max)
             max = choice.size();
@@ -676,15 +809,18 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
     if (cols > choices.size())
         cols = choices.size();
 
+    /*
+     * The number of rows of choices we can show, beneath the border and
+     * above the filter.
+     */
+    int rows = std::max(height - 2, 1);
 
     /*
-     * Matches of the string search.
+     * Matches of the string search, which are narrowed as it grows,
+     * rather than searching every choice for each key.
      */
-    std::vector<size_t> matches(choices.size());
-    for (size_t i = 0; i < choices.size(); i++)
-    {
-        matches.at(i)=i;
-    }
+    CFuzzyMatcher matcher(choices, fuzzy);
+
     /*
      * User input to search for.
      */
@@ -696,6 +832,9 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
 
     while (!done)
     {
+        const std::vector<size_t> &matches = matcher.matches();
+        int count = (int) matches.size();
+
         /*
          * Redraw the window in each iteration because of changing choices.
          */
@@ -705,40 +844,42 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
         /*
          * If the selection is bigger than the matches select the last item.
          */
-        if ((size_t)selected >= matches.size())
-            selected = matches.size()-1;
+        if (selected >= count)
+            selected = count - 1;
 
-        int count = 0;
+        if (selected < 0)
+            selected = 0;
 
         /*
-         * Drawing of each item.
+         * Draw only those rows which fit, scrolled so that the selection
+         * is visible.
          */
-        int x = 0;
-        int y = 2;
+        int top   = std::max((int)(selected / cols) - rows + 1, 0);
+        int first = top * cols;
+        int last  = std::min(count, first + (int)(rows * cols));
 
-        for (size_t i: matches)
+        for (int i = first; i < last; i++)
         {
-            std::string choice = choices.at(i);
             /*
              * Calculate the column.
              */
-            x = 2 + ((count % cols) * col_width);
-            y = 1 + (count / cols);
+            int x = 2 + (((i - first) % cols) * col_width);
+            int y = 1 + ((i - first) / cols);
 
-
-            if (count == selected)
+            if (i == selected)
                 wattron(childwin, A_UNDERLINE | A_STANDOUT);
 
-            mvwaddstr(childwin, y, x,  choice.c_str());
+            mvwaddnstr(childwin, y, x, choices.at(matches[i]).c_str(), col_width - 1);
 
             wattrset(childwin, A_NORMAL);
-            count += 1;
         }
+
         /*
          * Display the search string in the last line.
          */
-        if (search_string != "") {
-            mvwprintw(childwin, height - 1, 1, "%s %s ", "filter:", search_string.c_str());
+        if (search_string != "")
+        {
+            mvwprintw(childwin, height - 1, 1, "%s %s (%d) ", "filter:", search_string.c_str(), count);
         }
 
         wrefresh(childwin);
@@ -750,7 +891,12 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
         int c = input->get_input();
 
         if (c == '\n')
-            done = true;
+        {
+            if (count > 0)
+                done = true;
+            else
+                beep();
+        }
 
         if (c == 27)
         {
@@ -760,25 +906,17 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
              * Get our timeout period, and set it.
              */
             CConfig *config = CConfig::instance();
-            int tout = config->get_integer("global.timeout", 200);
+            int tout = config->get_integer(g_timeout_key, 200);
 
             timeout(tout);
             return "";
         }
 
-        if (c == '\t')
+        if ((c == '\t') || (c == KEY_RIGHT))
         {
             selected += 1;
 
-            if (selected >= (int)choices.size())
-                selected = 0;
-        }
-
-        if (c == KEY_RIGHT)
-        {
-            selected += 1;
-
-            if (selected >= (int)choices.size())
+            if (selected >= count)
                 selected = 0;
         }
 
@@ -787,23 +925,24 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
             selected -= 1;
 
             if (selected < 0)
-                selected = (int)(choices.size() - 1);
+                selected = count - 1;
 
         }
 
         if (c == KEY_DOWN)
         {
-            if ((int)(selected + cols) < (int)choices.size())
+            if ((int)(selected + cols) < count)
                 selected += cols;
 
         }
 
         if (c == KEY_UP)
         {
-            if (selected > (int) cols)
+            if (selected >= (int) cols)
                 selected -= cols;
 
         }
+
         /*
          * Update the search string and our matches.
          */
@@ -817,22 +956,15 @@ std::string CScreen::choose_string(std::vector<std::string> choices)
             else
                 search_string += c;
 
-            /*
-             * Calculate matches.
-             */
-            matches.clear();
-            for (size_t i = 0; i < choices.size(); i++)
-            {
-                if (choices[i].find(search_string) != std::string::npos)
-                    matches.push_back(i);
-            }
+            matcher.set_query(search_string);
+            selected = 0;
         }
     }
 
     delwin(childwin);
     ::clear();
 
-    return (choices.at(matches.at(selected)));
+    return (choices.at(matcher.matches().at(selected)));
 }
 
 
@@ -861,6 +993,13 @@ std::string CScreen::get_line(std::string prompt, std::string input)
     CHistory *history  = CHistory::instance();
     int history_offset = history->size();
 
+    /*
+     * Moving through the history only visits entries which begin with
+     * the text entered before we started to do so.
+     */
+    std::string history_prefix;
+    bool history_moving = false;
+
     /*
      * Get the cursor position
      */
@@ -890,7 +1029,7 @@ std::string CScreen::get_line(std::string prompt, std::string input)
      * Get the mode so we can update the display mid-input.
      */
     CConfig *config   = CConfig::instance();
-    std::string mode  = config->get_string("global.mode", "maildir");
+    std::string mode  = config->get_string(g_mode_key, "maildir");
 
     CViewMode *view = m_views[mode];
 
@@ -912,7 +1051,8 @@ std::string CScreen::get_line(std::string prompt, std::string input)
         /*
          * Run our on_idle() functions.
          */
-        lua->execute("on_idle()");
+        lua->on_idle();
+        lua->run_timers();
 
         if (view)
             view->on_idle();
@@ -949,6 +1089,21 @@ std::string CScreen::get_line(std::string prompt, std::string input)
         CInputQueue *input = CInputQueue::instance();
         c = input->get_input();
 
+        /*
+         * Any key other than up/down means the next movement through the
+         * history starts afresh, from whatever has been entered.
+         */
+        if ((c == KEY_UP) || (c == KEY_DOWN))
+        {
+            if (! history_moving)
+            {
+                history_prefix = buffer;
+                history_moving = true;
+            }
+        }
+        else
+            history_moving = false;
+
         /*
          * Ropy input-handler.
          */
@@ -985,31 +1140,34 @@ std::string CScreen::get_line(std::string prompt, std::string input)
         }
         else if (c == KEY_UP)
         {
-            history_offset -= 1;
+            int found = history->search(history_prefix, history_offset, true);
 
-            if (history_offset >= 0)
+            if (found >= 0)
             {
+                history_offset = found;
                 buffer = history->at(history_offset);
                 pos    = buffer.size();
             }
-            else
-            {
-                history_offset = 0;
-            }
         }
         else if (c == KEY_DOWN)
         {
-            history_offset += 1;
+            int found = history->search(history_prefix, history_offset, false);
 
-            if (history_offset < history->size())
+            if (found >= 0)
             {
+                history_offset = found;
                 buffer = history->at(history_offset);
-                pos    = buffer.size();
             }
             else
             {
+                /*
+                 * Moving past the newest entry restores what was entered.
+                 */
                 history_offset = history->size();
+                buffer = history_prefix;
             }
+
+            pos = buffer.size();
         }
         else if (c == KEY_BACKSPACE)
         {
@@ -1112,7 +1270,7 @@ std::string CScreen::prompt_chars(std::string prompt, std::string valid)
      * Get the mode so we can update the display mid-input.
      */
     CConfig *config   = CConfig::instance();
-    std::string mode  = config->get_string("global.mode", "maildir");
+    std::string mode  = config->get_string(g_mode_key, "maildir");
 
     CViewMode *view = m_views[mode];
 
@@ -1136,7 +1294,8 @@ std::string CScreen::prompt_chars(std::string prompt, std::string valid)
         /*
          * Run our on_idle() functions.
          */
-        lua->execute("on_idle()");
+        lua->on_idle();
+        lua->run_timers();
 
         if (view)
             view->on_idle();
@@ -1211,7 +1370,7 @@ std::string CScreen::get_char(std::string prompt)
      * Get the mode so we can update the display mid-input.
      */
     CConfig *config  = CConfig::instance();
-    std::string mode = config->get_string("global.mode", "maildir");
+    std::string mode = config->get_string(g_mode_key, "maildir");
     CViewMode *view  = m_views[mode];
 
     /*
@@ -1233,7 +1392,8 @@ std::string CScreen::get_char(std::string prompt)
         /*
          * Run our on_idle() functions.
          */
-        lua->execute("on_idle()");
+        lua->on_idle();
+        lua->run_timers();
 
         if (view)
             view->on_idle();
@@ -1275,6 +1435,9 @@ std::string CScreen::get_char(std::string prompt)
  */
 bool CScreen::on_keypress(std::string key)
 {
+    CFrameTimer timer("keypress");
+    CTraceSpan span("keypress ", key);
+
     /*
      * The result of the lookup.
      */
@@ -1284,7 +1447,7 @@ bool CScreen::on_keypress(std::string key)
      * Get the current global-mode.
      */
     CConfig *config  = CConfig::instance();
-    std::string mode = config->get_string("global.mode", "message");
+    std::string mode = config->get_string(g_mode_key, "message");
 
     /*
      * Lookup the keypress in the current-mode-keymap.
@@ -1314,7 +1477,23 @@ bool CScreen::on_keypress(std::string key)
 }
 
 
-int CScreen::get_colour(std::string name)
+int CScreen::get_colour(const std::string &name)
+{
+    auto it = m_colour_cache.find(name);
+
+    if (it != m_colour_cache.end())
+        return (it->second);
+
+    int result = resolve_colour(name);
+    m_colour_cache[name] = result;
+    return (result);
+}
+
+
+/*
+ * Resolve the given colour, and attributes, to the value to draw with.
+ */
+int CScreen::resolve_colour(std::string name)
 {
     std::transform(name.begin(), name.end(), name.begin(), ::tolower);
 
@@ -1399,8 +1578,10 @@ int CScreen::get_colour(std::string name)
  * fashion - with no selection, and no smooth-scrolling.
  *
  */
-void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple)
+void CScreen::draw_text_lines(const CLuaRows &lines, int selected, int max, bool simple, int first)
 {
+    CFrameTimer timer("draw_text_lines");
+
     /*
      * Get the dimensions of the screen.
      */
@@ -1412,7 +1593,7 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
      * Is line-wrapping enabled?
      */
     CConfig *config = CConfig::instance();
-    int wrap = config->get_integer("line.wrap", 0);
+    int wrap = config->get_integer(g_wrap_key, 0);
 
     /*
      * Take off the panel, if visible.
@@ -1448,14 +1629,20 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
 
         for (int i = 0; i <= height; i++)
         {
-            std::string buf = "";
+            const char *buf = "";
+            size_t len = 0;
 
             /*
              * If we're still in the array of lines to draw
              * then pick the right one.
              */
-            if ((off + selected) < size)
-                buf = lines.at(off + selected);
+            int line = off + selected - first;
+
+            if ((line >= 0) && (line < size))
+            {
+                buf = lines.data(line);
+                len = lines.length(line);
+            }
 
             /*
              * Last two parameters are:
@@ -1463,7 +1650,7 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
              *  enable scroll: true
              *  enable wrap: true
              */
-            result = draw_single_line(i, 0, buf, stdscr, true, true);
+            result = draw_single_line(i, 0, buf, len, stdscr, true, true);
 
             /*
              * Did we draw more than a single line?
@@ -1549,12 +1736,9 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
         }
 
 
-        std::string buf;
-
-        if ((mailIndex < max) && (mailIndex < size))
-            buf = lines.at(mailIndex);
+        int line = mailIndex - first;
 
-        if (buf.empty())
+        if ((mailIndex >= max) || (line < 0) || (line >= size) || (lines.length(line) == 0))
             continue;
 
         if (row == rowToHighlight)
@@ -1576,7 +1760,7 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
          *  enable scroll: true
          *  enable wrap: false
          */
-        result = draw_single_line(row, 0, buf, stdscr, true, false);
+        result = draw_single_line(row, 0, lines.data(line), lines.length(line), stdscr, true, false);
     }
 
     /*
@@ -1599,7 +1783,16 @@ void CScreen::draw_text_lines(std::vector<std::string> lines, int selected, int
  *
  * The return value is the number of characters drawn.
  */
-int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW * screen, bool enable_scroll, bool enable_wrap)
+int CScreen::draw_single_line(int row, int col_offset, const std::string &buf, WINDOW * screen, bool enable_scroll, bool enable_wrap)
+{
+    return (draw_single_line(row, col_offset, buf.data(), buf.size(), screen, enable_scroll, enable_wrap));
+}
+
+
+/*
+ * Draw a single text line, from text which needn't be terminated.
+ */
+int CScreen::draw_single_line(int row, int col_offset, const char *buf, size_t len, WINDOW * screen, bool enable_scroll, bool enable_wrap)
 {
     /*
      * Move the cursor to the correct location.
@@ -1625,8 +1818,8 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
      * Get the horizontal scroll offset.
      */
     CConfig *config = CConfig::instance();
-    int horiz       = config->get_integer("global.horizontal", 0);
-    int tab_width   = config->get_integer("global.tab", 8);
+    int horiz       = config->get_integer(g_horizontal_key, 0);
+    int tab_width   = config->get_integer(g_tab_key, 8);
 
     /*
      * Is wrapping enabled?
@@ -1636,7 +1829,7 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
      * we don't try to pointlessly enable wrap for modes that
      * it doesn't make sense with.
      */
-    int wrap = config->get_integer("line.wrap", 0);
+    int wrap = config->get_integer(g_wrap_key, 0);
 
     if ((wrap != 0) && (enable_wrap == true))
         enable_wrap = true;
@@ -1649,43 +1842,82 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
         horiz = 0;
 
     /*
-     * Split the string into segments in ONE CHARACTER pieces.
-     *
-     * These single characters may well consist of multiple bytes, but
-     * that is not important.
+     * Split the string into ONE CHARACTER pieces, each of which may well
+     * consist of multiple bytes.  Lines are usually redrawn unchanged, so
+     * this is normally served from the cache of parsed lines.
+     */
+    std::shared_ptr<const COLOURED_LINE> line = CColourString::parse_cached(buf, len, tab_width);
+
+    /*
+     * Lookup each colour the line uses, once.
      */
-    std::vector<COLOUR_STRING *> parts = CColourString::parse_coloured_string(buf, horiz, tab_width);
+    std::vector < int > attrs;
+
+    for (const std::string &colour : line->colours)
+        attrs.push_back(get_colour(colour));
 
     /*
-     * Draw each piece of the string.
+     * Draw each run of characters, skipping those scrolled off to the
+     * left.
      */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
+    size_t skip = std::max(horiz, 0);
+    int cols    = getmaxx(screen);
+    bool full   = false;
+
+    for (const COLOUR_RUN &run : line->runs)
     {
+        size_t first = std::max((size_t) run.first, skip);
+        size_t last  = run.first + run.count;
+
+        if (first >= last)
+            continue;
+
         /*
-         * If we've drawn more characters than the width
-         * of the screen then we should stop - unless we've got
-         * wrapping enabled.
+         * If we've filled the row then we should stop - unless we've
+         * got wrapping enabled.
          */
         getyx(screen, y, x);
 
         if ((y != row) && ! enable_wrap)
-            continue;
+            break;
 
-        /*
-         * Get the text/colour.
-         */
-        COLOUR_STRING *i = (*it);
-        std::string *colour = i->colour;
-        std::string *text   = i->string;
+        wattrset(screen, def_col);
+        wattron(screen, attrs[run.colour]);
 
         /*
-         * Set the colour + draw the component.
+         * A run of ASCII takes a column per byte, so we can draw as much
+         * of it as will fit at once.
          */
-        wattrset(screen, def_col);
-        wattron(screen, get_colour(*colour));
-        waddstr(screen, (char *)(*text).c_str());
+        if (run.ascii)
+        {
+            size_t n = last - first;
 
-        count += 1;
+            if (! enable_wrap)
+                n = std::min(n, (size_t) std::max(cols - x, 0));
+
+            waddnstr(screen, line->text.data() + line->chars[first].offset, n);
+            count += n;
+            continue;
+        }
+
+        for (size_t i = first; i < last; i++)
+        {
+            getyx(screen, y, x);
+
+            if ((y != row) && ! enable_wrap)
+            {
+                full = true;
+                break;
+            }
+
+            const COLOUR_CHAR &chr = line->chars[i];
+            waddnstr(screen, line->text.data() + chr.offset, chr.length);
+
+            count += chr.width;
+        }
+
+        if (full)
+            break;
     }
 
 
@@ -1701,6 +1933,20 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
     getyx(screen, y, x);
     bool moved = true;
 
+    /*
+     * Fill the rest of the row at once, if we can.
+     */
+    if ((y == row) && (x < cols))
+    {
+        static const std::string spaces(512, ' ');
+        int pad = std::min(cols - x, (int) spaces.size());
+
+        waddnstr(screen, spaces.data(), pad);
+        count += pad;
+
+        getyx(screen, y, x);
+    }
+
     /*
      * Until the row has changed we draw " ", ensuring that
      * we fill the line.
@@ -1741,17 +1987,6 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
      */
     wattrset(screen, get_colour("white|normal"));
 
-    /*
-     * Finally free the tokenized string-bits.
-     */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
-    {
-        COLOUR_STRING *i = (*it);
-        delete(i->string);
-        delete(i->colour);
-        free(i);
-    }
-
     return (count);
 }
 
@@ -1761,7 +1996,7 @@ int CScreen::draw_single_line(int row, int col_offset, std::string buf, WINDOW *
 void CScreen::draw_text(int x, int y, std::string str, bool update)
 {
     CConfig *config = CConfig::instance();
-    int tab_width   = config->get_integer("global.tab", 8);
+    int tab_width   = config->get_integer(g_tab_key, 8);
 
     /*
      * Default colour/attributes for this line.
@@ -1772,8 +2007,7 @@ void CScreen::draw_text(int x, int y, std::string str, bool update)
      * Parse the string.  We don't need it in chunks,
      * but we do need it in coloured fashion.
      */
-    std::vector<COLOUR_STRING *> parts;
-    parts = CColourString::parse_coloured_string(str, 0, tab_width);
+    std::shared_ptr<const COLOURED_LINE> line = CColourString::parse_cached(str, tab_width);
 
     /*
      * Move to the starting offset.
@@ -1783,21 +2017,23 @@ void CScreen::draw_text(int x, int y, std::string str, bool update)
     /*
      * Draw the part(s).
      */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
+    std::vector < int > attrs;
+
+    for (const std::string &colour : line->colours)
+        attrs.push_back(get_colour(colour));
+
+    for (const COLOUR_RUN &run : line->runs)
     {
         /*
-         * Get the text/colour.
+         * The characters of a run are consecutive within the text, so
+         * set the colour + draw them all.
          */
-        COLOUR_STRING *i = (*it);
-        std::string *colour = i->colour;
-        std::string *text   = i->string;
+        const COLOUR_CHAR &first = line->chars[run.first];
+        const COLOUR_CHAR &last  = line->chars[run.first + run.count - 1];
 
-        /*
-         * Set the colour + draw the component.
-         */
         wattrset(stdscr, def_col);
-        wattron(stdscr, get_colour(*colour));
-        waddstr(stdscr, (char *)(*text).c_str());
+        wattron(stdscr, attrs[run.colour]);
+        waddnstr(stdscr, line->text.data() + first.offset, last.offset + last.length - first.offset);
     }
 
     /*
@@ -1805,17 +2041,6 @@ void CScreen::draw_text(int x, int y, std::string str, bool update)
      */
     wattrset(stdscr, get_colour("white|normal"));
 
-    /*
-     * Free the parts.
-     */
-    for (auto it = parts.begin(); it != parts.end() ; ++it)
-    {
-        COLOUR_STRING *i = (*it);
-        delete(i->string);
-        delete(i->colour);
-        free(i);
-    }
-
     if (update)
     {
         update_panels();
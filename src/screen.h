@@ -25,10 +25,13 @@
 
 #include <cursesw.h>
 #include <panel.h>
+#include <stdint.h>
 #include <string>
+#include <time.h>
 #include <unordered_map>
 #include <vector>
 
+#include "lua_rows.h"
 #include "singleton.h"
 #include "observer.h"
 
@@ -140,6 +143,16 @@ public:
      */
     void exit_main_loop();
 
+    /**
+     * Mark the screen as needing to be redrawn, by the next iteration of
+     * our event-loop.
+     *
+     * Input, configuration changes, and changes to message-flags do this
+     * automatically.  When nothing has changed idle iterations of the
+     * loop don't redraw anything.
+     */
+    void invalidate();
+
     /**
      * Return the width of the screen, in columns.
      */
@@ -170,11 +183,13 @@ public:
     void sleep(int seconds);
 
     /**
-     * Choose a single item from a small selection.
+     * Choose a single item from a selection, which is narrowed as the
+     * user types.  Choices either contain what has been typed, or if
+     * `fuzzy` is set, contain its characters in order and are ranked.
      *
      * Used by TAB-completion.
      */
-    std::string choose_string(std::vector<std::string> choices);
+    std::string choose_string(std::vector<std::string> choices, bool fuzzy = false);
 
     /**
      * Show a message and read a single character of input.
@@ -220,8 +235,11 @@ public:
      *
      * If `simple` is set to true then we display the lines in a  simplified
      * fashion - with no selection, and no smooth-scrolling.
+     *
+     * `first` is the number of the row held in `lines[0]`, for views
+     * which only supply their visible rows.
      */
-    void draw_text_lines(std::vector<std::string> lines, int selected, int max, bool simple = false);
+    void draw_text_lines(const CLuaRows &lines, int selected, int max, bool simple = false, int first = 0);
 
     /**
      * Draw a single text line, paying attention to our colour strings.
@@ -230,7 +248,13 @@ public:
      *
      * The return value is the number of characters drawn.
      */
-    int draw_single_line(int row, int col_offset, std::string text, WINDOW * screen, bool enable_scroll, bool enable_wrap);
+    int draw_single_line(int row, int col_offset, const std::string &text, WINDOW * screen, bool enable_scroll, bool enable_wrap);
+
+    /**
+     * Draw a single text line, given as text which needn't be terminated,
+     * and its length.
+     */
+    int draw_single_line(int row, int col_offset, const char *text, size_t length, WINDOW * screen, bool enable_scroll, bool enable_wrap);
 
 
     /**
@@ -241,9 +265,21 @@ public:
 private:
 
     /**
-     * Get the colour-pair for the given name.
+     * Get the colour-pair, and attributes, for the given specification,
+     * such as "red|bold", resolving each only once.
      */
-    int get_colour(std::string name);
+    int get_colour(const std::string &name);
+
+    /**
+     * Resolve the given specification to the value we draw with.
+     */
+    int resolve_colour(std::string name);
+
+    /**
+     * The number of milliseconds to wait for input before we're idle: the
+     * `global.timeout` period, or less if a timer is due sooner.
+     */
+    int idle_timeout();
 
     /**
      * Convert ^I -> TAB, etc.
@@ -257,6 +293,36 @@ private:
      */
     bool m_running = true;
 
+    /**
+     * Does the screen need to be redrawn?
+     */
+    bool m_dirty = true;
+
+    /**
+     * The number of configuration changes there had been when we last
+     * drew the screen.  Changes made while we draw, such as the view
+     * updating `$mode.max`, don't make us dirty.
+     */
+    uint64_t m_config_changes = 0;
+
+    /**
+     * The message-flag generation, and the modification time of the
+     * current maildir, when we last drew the screen.
+     */
+    uint64_t m_flags_generation = 0;
+    time_t m_maildir_mtime = 0;
+
+    /**
+     * Was the status-panel hidden when we last drew the screen?
+     */
+    bool m_panel_hidden = false;
+
+    /**
+     * When we last drew the screen, so that a burst of input doesn't
+     * leave it undrawn for longer than `global.input_budget`.
+     */
+    uint64_t m_last_frame = 0;
+
     /**
      * This map contains a mapping between a given mode-name and the
      * virtual class which implements its display.
@@ -274,6 +340,14 @@ private:
      */
     std::unordered_map < std::string, int >m_colours;
 
+    /**
+     * The specifications we've resolved, and what they resolved to.
+     *
+     * This is cleared when any `colour.*` key changes, as names such as
+     * "unread" are resolved via those.
+     */
+    std::unordered_map < std::string, int >m_colour_cache;
+
 private:
 
     /**
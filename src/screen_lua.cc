@@ -17,6 +17,7 @@
  */
 
 
+#include "frame_stats.h"
 #include "global_state.h"
 #include "input_queue.h"
 #include "lua.h"
@@ -138,11 +139,11 @@ int l_CScreen_get_line(lua_State * l)
 }
 
 /**
- * Implementation of Screen:choose_string().
+ * Let the user choose one of the strings in the table upon the top of
+ * the stack, fuzzily or not.
  */
-int l_CScreen_choose_string(lua_State * l)
+static int choose_from_table(lua_State * l, bool fuzzy)
 {
-    CLuaLog("l_CScreen_choose_string");
     /*
      * Get options
      */
@@ -157,8 +158,14 @@ int l_CScreen_choose_string(lua_State * l)
         lua_pop(l, 1);
     }
 
+    if (options.empty())
+    {
+        lua_pushstring(l, "");
+        return 1;
+    }
+
     CScreen *screen = CScreen::instance();
-    std::string out = screen->choose_string(options);
+    std::string out = screen->choose_string(options, fuzzy);
 
     lua_pushstring(l, out.c_str());
 
@@ -166,6 +173,31 @@ int l_CScreen_choose_string(lua_State * l)
 }
 
 
+/**
+ * Implementation of Screen:choose_string().
+ */
+int l_CScreen_choose_string(lua_State * l)
+{
+    CLuaLog("l_CScreen_choose_string");
+
+    return (choose_from_table(l, false));
+}
+
+
+/**
+ * Implementation of Screen:choose_fuzzy().
+ *
+ * As `Screen:choose_string()`, except the choices are matched fuzzily
+ * against what is typed, and ranked.
+ */
+int l_CScreen_choose_fuzzy(lua_State * l)
+{
+    CLuaLog("l_CScreen_choose_fuzzy");
+
+    return (choose_from_table(l, true));
+}
+
+
 /**
  * Implementation of Screen:prompt_chars().
  */
@@ -185,6 +217,20 @@ int l_CScreen_prompt_chars(lua_State * l)
 }
 
 
+/**
+ * Implementation of Screen:invalidate()
+ */
+int l_CScreen_invalidate(lua_State * l)
+{
+    CLuaLog("l_CScreen_invalidate");
+
+    (void)l;
+    CScreen *foo = CScreen::instance();
+    foo->invalidate();
+    return 0;
+}
+
+
 /**
  * Implementation of Screen:redraw()
  */
@@ -196,6 +242,55 @@ int l_CScreen_redraw(lua_State * l)
     return 0;
 }
 
+/**
+ * Implementation of Screen:frame_stats().
+ *
+ * Return a table of the recent timings of each phase of drawing a frame,
+ * in microseconds, along with the value of each counter.  If the argument
+ * is true the timings are then reset.
+ */
+int l_CScreen_frame_stats(lua_State * l)
+{
+    CLuaLog("l_CScreen_frame_stats");
+
+    CFrameStats *stats = CFrameStats::instance();
+
+    lua_newtable(l);
+
+    for (std::string phase : stats->phases())
+    {
+        frame_summary s;
+
+        if (! stats->summary(phase, s))
+            continue;
+
+        lua_newtable(l);
+
+        lua_pushinteger(l, s.p50);
+        lua_setfield(l, -2, "p50");
+        lua_pushinteger(l, s.p99);
+        lua_setfield(l, -2, "p99");
+        lua_pushinteger(l, s.max);
+        lua_setfield(l, -2, "max");
+        lua_pushinteger(l, s.count);
+        lua_setfield(l, -2, "count");
+
+        lua_setfield(l, -2, phase.c_str());
+    }
+
+    for (auto &counter : stats->counters())
+    {
+        lua_pushnumber(l, counter.second);
+        lua_setfield(l, -2, counter.first.c_str());
+    }
+
+    if (lua_toboolean(l, 2))
+        stats->reset();
+
+    return 1;
+}
+
+
 /**
  * Implementation of Screen:get_char().
  */
@@ -278,10 +373,13 @@ void InitScreen(lua_State * l)
         {"draw", l_CScreen_draw},
         {"execute",  l_CScreen_execute},
         {"exit",  l_CScreen_exit},
+        {"frame_stats", l_CScreen_frame_stats},
         {"get_char", l_CScreen_get_char},
         {"get_line", l_CScreen_get_line},
+        {"choose_fuzzy", l_CScreen_choose_fuzzy},
         {"choose_string", l_CScreen_choose_string},
         {"height", l_CScreen_height},
+        {"invalidate", l_CScreen_invalidate},
         {"prompt", l_CScreen_prompt_chars},
         {"redraw", l_CScreen_redraw},
         {"sleep", l_CScreen_sleep},
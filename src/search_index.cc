@@ -0,0 +1,980 @@
+/*
+ * search_index.cc - A full-text index of local messages.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+#include "config.h"
+#include "directory.h"
+#include "file.h"
+#include "logger.h"
+#include "message_part.h"
+#include "search_index.h"
+
+
+/*
+ * The version of our on-disk format.
+ */
+#define SEARCH_VERSION 1
+
+/*
+ * Words longer than this are truncated.
+ */
+#define SEARCH_MAX_WORD 64
+
+/*
+ * The gap left between the positions of the words of different
+ * headers and parts, so phrases don't match across them.
+ */
+#define SEARCH_FIELD_GAP 16
+
+
+/*
+ * Append a variable-length integer to the given string.
+ */
+static void put_varint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+
+    out.push_back((char)value);
+}
+
+
+/*
+ * Read a variable-length integer, advancing the pointer.  Returns false
+ * if the input is truncated.
+ */
+static bool get_varint(const char *&p, const char *end, uint64_t &value)
+{
+    value = 0;
+
+    for (int shift = 0; (p < end) && (shift < 64); shift += 7)
+    {
+        unsigned char c = (unsigned char) * p++;
+        value |= ((uint64_t)(c & 0x7f)) << shift;
+
+        if ((c & 0x80) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Append a length-prefixed string.
+ */
+static void put_string(std::string &out, const std::string &value)
+{
+    put_varint(out, value.size());
+    out += value;
+}
+
+
+/*
+ * Read a length-prefixed string.
+ */
+static bool get_string(const char *&p, const char *end, std::string &value)
+{
+    uint64_t len;
+
+    if (! get_varint(p, end, len) || (len > (uint64_t)(end - p)))
+        return false;
+
+    value.assign(p, len);
+    p += len;
+    return true;
+}
+
+
+/*
+ * Remove the tags from HTML, leaving its text.
+ */
+static std::string strip_tags(const char *data, size_t len)
+{
+    std::string out;
+    bool in_tag = false;
+
+    out.reserve(len);
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (data[i] == '<')
+            in_tag = true;
+        else if (data[i] == '>')
+        {
+            in_tag = false;
+            out.push_back(' ');
+        }
+        else if (! in_tag)
+            out.push_back(data[i]);
+    }
+
+    return (out);
+}
+
+
+/*
+ * Collect the decoded content of the textual parts of a message.
+ */
+static void collect_parts(const std::vector<std::shared_ptr<CMessagePart>> &parts,
+                          std::vector < std::string > &texts)
+{
+    for (std::shared_ptr<CMessagePart> part : parts)
+    {
+        std::string type = part->type();
+
+        if ((type.compare(0, 5, "text/") == 0) && ! part->is_attachment())
+        {
+            const char *data = (const char *)part->content();
+            size_t len = part->content_size();
+
+            if (data != NULL)
+            {
+                if (type == "text/html")
+                    texts.push_back(strip_tags(data, len));
+                else
+                    texts.push_back(std::string(data, len));
+            }
+        }
+
+        collect_parts(part->children(), texts);
+    }
+}
+
+
+/*
+ * Constructor.
+ */
+CSearchIndex::CSearchIndex()
+{
+    m_dead   = 0;
+    m_loaded = false;
+    m_dirty  = false;
+}
+
+
+/*
+ * Return the file the index should be stored in.
+ */
+std::string CSearchIndex::index_file()
+{
+    CConfig *config = CConfig::instance();
+
+    std::string file = config->get_string("search.index");
+
+    if (file.empty())
+    {
+        std::string dir = config->get_string("cache.prefix");
+
+        if (! dir.empty())
+            file = dir + "/search.index";
+    }
+
+    return (file);
+}
+
+
+/*
+ * Split text into lower-case words.
+ *
+ * Words are runs of ASCII letters and digits, along with any non-ASCII
+ * bytes, so that UTF-8 text is kept whole.
+ */
+void CSearchIndex::tokenize(const std::string &text, std::vector < std::string > &out)
+{
+    std::string word;
+
+    for (size_t i = 0; i <= text.size(); i++)
+    {
+        unsigned char c = (i < text.size()) ? text[i] : ' ';
+
+        if (((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'z')) || (c >= 0x80))
+        {
+            word.push_back(c);
+        }
+        else if ((c >= 'A') && (c <= 'Z'))
+        {
+            word.push_back(c + ('a' - 'A'));
+        }
+        else if (! word.empty())
+        {
+            if (word.size() > SEARCH_MAX_WORD)
+                word.resize(SEARCH_MAX_WORD);
+
+            out.push_back(word);
+            word.clear();
+        }
+    }
+}
+
+
+/*
+ * Return the part of a message-filename which precedes its flags.
+ */
+std::string CSearchIndex::filename_stem(std::string path)
+{
+    std::string name = CFile::basename(path);
+    size_t colon = name.find(':');
+
+    if (colon != std::string::npos)
+        name = name.substr(0, colon);
+
+    return (name);
+}
+
+
+/*
+ * Append a document, and its positions, to a posting list.
+ */
+void CSearchIndex::encode(posting &p, uint32_t doc, const std::vector < uint32_t > &positions)
+{
+    put_varint(p.data, (p.count == 0) ? doc : doc - p.last);
+    put_varint(p.data, positions.size());
+
+    uint32_t prev = 0;
+
+    for (uint32_t pos : positions)
+    {
+        put_varint(p.data, pos - prev);
+        prev = pos;
+    }
+
+    p.last   = doc;
+    p.count += 1;
+}
+
+
+/*
+ * Decode a posting list.
+ */
+void CSearchIndex::decode(const posting &p, std::vector < uint32_t > &docs,
+                          std::vector < std::vector < uint32_t > > *positions)
+{
+    const char *ptr = p.data.data();
+    const char *end = ptr + p.data.size();
+
+    docs.reserve(p.count);
+
+    if (positions != NULL)
+        positions->reserve(p.count);
+
+    uint32_t doc = 0;
+
+    for (uint32_t i = 0; i < p.count; i++)
+    {
+        uint64_t delta, count;
+
+        if (! get_varint(ptr, end, delta) || ! get_varint(ptr, end, count))
+            return;
+
+        doc = (i == 0) ? delta : doc + delta;
+        docs.push_back(doc);
+
+        if (positions != NULL)
+            positions->push_back(std::vector < uint32_t > ());
+
+        uint32_t pos = 0;
+
+        for (uint64_t j = 0; j < count; j++)
+        {
+            uint64_t gap;
+
+            if (! get_varint(ptr, end, gap))
+                return;
+
+            pos += gap;
+
+            if (positions != NULL)
+                positions->back().push_back(pos);
+        }
+    }
+}
+
+
+/*
+ * Add a document to the index.
+ */
+uint32_t CSearchIndex::add_document(std::string maildir, std::string stem,
+                                    std::string path, const std::vector < std::string > &texts)
+{
+    uint32_t id = m_docs.size();
+
+    document d;
+    d.maildir = maildir;
+    d.stem    = stem;
+    d.path    = path;
+    d.alive   = true;
+    m_docs.push_back(d);
+
+    m_stems[maildir + "\n" + stem] = id;
+
+    /*
+     * Find the positions of each word within the document, keeping the
+     * words in the order they first appear.
+     */
+    std::unordered_map < std::string, std::vector < uint32_t > > positions;
+    std::vector < std::string > order;
+    std::vector < std::string > words;
+    uint32_t pos = 0;
+
+    for (const std::string &text : texts)
+    {
+        words.clear();
+        tokenize(text, words);
+
+        for (const std::string &word : words)
+        {
+            std::vector < uint32_t > &entry = positions[word];
+
+            if (entry.empty())
+                order.push_back(word);
+
+            entry.push_back(pos++);
+        }
+
+        pos += SEARCH_FIELD_GAP;
+    }
+
+    for (const std::string &word : order)
+    {
+        auto it = m_terms.find(word);
+
+        if (it == m_terms.end())
+        {
+            posting p;
+            p.last  = 0;
+            p.count = 0;
+            it = m_terms.insert(std::make_pair(word, p)).first;
+        }
+
+        encode(it->second, id, positions[word]);
+    }
+
+    m_dirty = true;
+    return (id);
+}
+
+
+/*
+ * Load the index from disk, if we've not yet done so.
+ */
+void CSearchIndex::ensure_loaded()
+{
+    if (m_loaded)
+        return;
+
+    m_loaded = true;
+
+    std::string file = index_file();
+
+    if (! file.empty() && load(file))
+    {
+        CLogger::instance()->log("search", "Loaded search index %s with %d documents.",
+                                 file.c_str(), (int)documents());
+    }
+}
+
+
+/*
+ * Bring the index up to date with the given maildir.
+ */
+int CSearchIndex::update(std::shared_ptr<CMaildir> maildir)
+{
+    if (! maildir || maildir->is_imap())
+        return 0;
+
+    ensure_loaded();
+
+    std::string path = maildir->path();
+    std::unordered_set < uint32_t > seen;
+    int added = 0;
+
+    for (std::shared_ptr<CMessage> msg : maildir->getMessages())
+    {
+        std::string file = msg->path();
+        std::string stem = filename_stem(file);
+
+        auto it = m_stems.find(path + "\n" + stem);
+
+        if (it != m_stems.end())
+        {
+            document &d = m_docs[it->second];
+
+            if (d.path != file)
+            {
+                d.path  = file;
+                m_dirty = true;
+            }
+
+            if (! d.alive)
+            {
+                d.alive = true;
+                m_dead -= 1;
+                m_dirty = true;
+            }
+
+            seen.insert(it->second);
+            continue;
+        }
+
+        std::vector < std::string > texts;
+        texts.push_back(msg->header_ref("from"));
+        texts.push_back(msg->header_ref("to"));
+        texts.push_back(msg->header_ref("cc"));
+        texts.push_back(msg->header_ref("subject"));
+
+        /*
+         * Only drop the parts if we parsed them here, so that we don't
+         * throw away those of a message which is being viewed.
+         */
+        bool known = msg->parts_known();
+
+        collect_parts(msg->get_parts(), texts);
+
+        if (! known)
+            msg->release_parts();
+
+        seen.insert(add_document(path, stem, file, texts));
+        added += 1;
+    }
+
+    /*
+     * Anything we didn't see has been removed.
+     */
+    for (uint32_t i = 0; i < m_docs.size(); i++)
+    {
+        document &d = m_docs[i];
+
+        if (d.alive && (d.maildir == path) && (seen.find(i) == seen.end()))
+        {
+            d.alive = false;
+            m_dead += 1;
+            m_dirty = true;
+        }
+    }
+
+    CLogger::instance()->log("search", "Indexed %d new messages in %s.", added, path.c_str());
+    return (added);
+}
+
+
+/*
+ * Find the documents which contain the given words, consecutively.
+ */
+std::vector < uint32_t > CSearchIndex::match_phrase(const std::vector < std::string > &words)
+{
+    std::vector < uint32_t > result;
+
+    if (words.empty())
+        return (result);
+
+    for (const std::string &word : words)
+    {
+        if (m_terms.find(word) == m_terms.end())
+            return (result);
+    }
+
+    if (words.size() == 1)
+    {
+        decode(m_terms[words[0]], result, NULL);
+        return (result);
+    }
+
+    /*
+     * Start with every position of the first word, and keep those at
+     * which each following word appears at the following position.
+     */
+    std::vector < uint32_t > docs;
+    std::vector < std::vector < uint32_t > > starts;
+    decode(m_terms[words[0]], docs, &starts);
+
+    for (size_t w = 1; w < words.size() && ! docs.empty(); w++)
+    {
+        std::vector < uint32_t > next_docs;
+        std::vector < std::vector < uint32_t > > positions;
+        decode(m_terms[words[w]], next_docs, &positions);
+
+        std::vector < uint32_t > kept_docs;
+        std::vector < std::vector < uint32_t > > kept_starts;
+
+        size_t a = 0, b = 0;
+
+        while ((a < docs.size()) && (b < next_docs.size()))
+        {
+            if (docs[a] < next_docs[b])
+            {
+                a++;
+                continue;
+            }
+
+            if (docs[a] > next_docs[b])
+            {
+                b++;
+                continue;
+            }
+
+            std::vector < uint32_t > valid;
+
+            for (uint32_t s : starts[a])
+            {
+                if (std::binary_search(positions[b].begin(), positions[b].end(), s + w))
+                    valid.push_back(s);
+            }
+
+            if (! valid.empty())
+            {
+                kept_docs.push_back(docs[a]);
+                kept_starts.push_back(valid);
+            }
+
+            a++;
+            b++;
+        }
+
+        docs.swap(kept_docs);
+        starts.swap(kept_starts);
+    }
+
+    return (docs);
+}
+
+
+/*
+ * Return the numbers of the documents matching the given query.
+ */
+std::vector < uint32_t > CSearchIndex::search(const std::string &query)
+{
+    ensure_loaded();
+
+    std::vector < uint32_t > result;
+    std::vector < uint32_t > group;
+    bool group_started = false;
+
+    /*
+     * Add the current group of terms to the result, as an alternative.
+     */
+    auto finish_group = [&result, &group, &group_started]()
+    {
+        if (group_started)
+        {
+            std::vector < uint32_t > merged;
+            std::set_union(result.begin(), result.end(), group.begin(), group.end(),
+                           std::back_inserter(merged));
+            result.swap(merged);
+        }
+
+        group.clear();
+        group_started = false;
+    };
+
+    size_t i = 0;
+
+    while (i < query.size())
+    {
+        if (isspace((unsigned char)query[i]))
+        {
+            i++;
+            continue;
+        }
+
+        /*
+         * Find the next term - a quoted phrase, or a single word.
+         */
+        std::string term;
+        bool quoted = (query[i] == '"');
+
+        if (quoted)
+        {
+            size_t end = query.find('"', i + 1);
+
+            if (end == std::string::npos)
+                end = query.size();
+
+            term = query.substr(i + 1, end - i - 1);
+            i = end + 1;
+        }
+        else
+        {
+            size_t end = i;
+
+            while ((end < query.size()) && ! isspace((unsigned char)query[end]))
+                end++;
+
+            term = query.substr(i, end - i);
+            i = end;
+        }
+
+        if (! quoted && (term == "OR"))
+        {
+            finish_group();
+            continue;
+        }
+
+        std::vector < std::string > words;
+        tokenize(term, words);
+
+        if (words.empty())
+            continue;
+
+        std::vector < uint32_t > docs = match_phrase(words);
+
+        if (! group_started)
+        {
+            group.swap(docs);
+            group_started = true;
+        }
+        else
+        {
+            std::vector < uint32_t > both;
+            std::set_intersection(group.begin(), group.end(), docs.begin(), docs.end(),
+                                  std::back_inserter(both));
+            group.swap(both);
+        }
+    }
+
+    finish_group();
+
+    /*
+     * Drop documents which have been deleted.
+     */
+    std::vector < uint32_t > live;
+
+    for (uint32_t doc : result)
+    {
+        if ((doc < m_docs.size()) && m_docs[doc].alive)
+            live.push_back(doc);
+    }
+
+    return (live);
+}
+
+
+/*
+ * Find the current path of the given document.
+ */
+std::string CSearchIndex::resolve(uint32_t doc)
+{
+    document &d = m_docs[doc];
+    struct stat sb;
+
+    if (stat(d.path.c_str(), &sb) == 0)
+        return (d.path);
+
+    const char *dirs[] = {"/cur/", "/new/"};
+
+    for (const char *dir : dirs)
+    {
+        std::vector < CDirectoryEntry > entries;
+
+        if (! CDirectory::list(d.maildir + dir, entries))
+            continue;
+
+        for (CDirectoryEntry &entry : entries)
+        {
+            if (filename_stem(entry.name) == d.stem)
+            {
+                d.path  = d.maildir + dir + entry.name;
+                m_dirty = true;
+                return (d.path);
+            }
+        }
+    }
+
+    return (d.path);
+}
+
+
+/*
+ * Return the paths of the messages which match the given query.
+ */
+std::vector < std::string > CSearchIndex::query(const std::string &query)
+{
+    std::vector < std::string > paths;
+
+    for (uint32_t doc : search(query))
+        paths.push_back(resolve(doc));
+
+    return (paths);
+}
+
+
+/*
+ * Return the path of the given document.
+ */
+std::string CSearchIndex::document_path(uint32_t doc)
+{
+    if (doc < m_docs.size())
+        return (m_docs[doc].path);
+
+    return "";
+}
+
+
+/*
+ * The number of live documents.
+ */
+size_t CSearchIndex::documents()
+{
+    return (m_docs.size() - m_dead);
+}
+
+
+/*
+ * The number of distinct words.
+ */
+size_t CSearchIndex::terms()
+{
+    return (m_terms.size());
+}
+
+
+/*
+ * The number of bytes used by our posting lists.
+ */
+size_t CSearchIndex::posting_bytes()
+{
+    size_t total = 0;
+
+    for (auto &entry : m_terms)
+        total += entry.second.data.size();
+
+    return (total);
+}
+
+
+/*
+ * Purge deleted documents, renumbering those which remain.
+ */
+void CSearchIndex::compact()
+{
+    std::vector < uint32_t > renumber(m_docs.size(), UINT32_MAX);
+    std::vector < document > docs;
+
+    m_stems.clear();
+
+    for (uint32_t i = 0; i < m_docs.size(); i++)
+    {
+        if (! m_docs[i].alive)
+            continue;
+
+        renumber[i] = docs.size();
+        m_stems[m_docs[i].maildir + "\n" + m_docs[i].stem] = docs.size();
+        docs.push_back(m_docs[i]);
+    }
+
+    m_docs.swap(docs);
+    m_dead = 0;
+
+    for (auto it = m_terms.begin(); it != m_terms.end();)
+    {
+        std::vector < uint32_t > old_docs;
+        std::vector < std::vector < uint32_t > > positions;
+        decode(it->second, old_docs, &positions);
+
+        posting p;
+        p.last  = 0;
+        p.count = 0;
+
+        for (size_t i = 0; i < old_docs.size(); i++)
+        {
+            if (renumber[old_docs[i]] != UINT32_MAX)
+                encode(p, renumber[old_docs[i]], positions[i]);
+        }
+
+        if (p.count == 0)
+        {
+            it = m_terms.erase(it);
+        }
+        else
+        {
+            it->second = p;
+            ++it;
+        }
+    }
+}
+
+
+/*
+ * Save the index, if it has changed.
+ */
+bool CSearchIndex::save()
+{
+    std::string file = index_file();
+
+    if (file.empty() || ! m_dirty)
+        return false;
+
+    return (save(file));
+}
+
+
+/*
+ * Save the index to the given file.
+ */
+bool CSearchIndex::save(std::string file)
+{
+    if (m_dead > m_docs.size() / 2)
+        compact();
+
+    std::string out = "LMSI";
+    put_varint(out, SEARCH_VERSION);
+    put_varint(out, m_docs.size());
+
+    for (const document &d : m_docs)
+    {
+        put_string(out, d.maildir);
+        put_string(out, d.stem);
+        put_string(out, d.path);
+        out.push_back(d.alive ? 1 : 0);
+    }
+
+    put_varint(out, m_terms.size());
+
+    for (auto &entry : m_terms)
+    {
+        put_string(out, entry.first);
+        put_varint(out, entry.second.last);
+        put_varint(out, entry.second.count);
+        put_string(out, entry.second.data);
+    }
+
+    /*
+     * Write to a temporary file, and rename it into place, so readers
+     * never see a partial index.
+     */
+    size_t slash = file.find_last_of('/');
+
+    if (slash != std::string::npos)
+        CDirectory::mkdir_p(file.substr(0, slash));
+
+    std::string tmp = file + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+
+    if (fp == NULL)
+        return false;
+
+    bool ok = (fwrite(out.data(), 1, out.size(), fp) == out.size());
+    ok = (fclose(fp) == 0) && ok;
+
+    if (! ok || (rename(tmp.c_str(), file.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    m_dirty = false;
+    return true;
+}
+
+
+/*
+ * Load the index from the given file.
+ */
+bool CSearchIndex::load(std::string file)
+{
+    m_docs.clear();
+    m_stems.clear();
+    m_terms.clear();
+    m_dead   = 0;
+    m_dirty  = false;
+    m_loaded = true;
+
+    std::string data;
+
+    if (! CFile::exists(file))
+        return false;
+
+    FILE *fp = fopen(file.c_str(), "rb");
+
+    if (fp == NULL)
+        return false;
+
+    char buf[65536];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.append(buf, n);
+
+    fclose(fp);
+
+    const char *p   = data.data();
+    const char *end = p + data.size();
+    uint64_t version, count;
+
+    bool ok = (data.size() > 4) && (memcmp(p, "LMSI", 4) == 0);
+    p += 4;
+
+    ok = ok && get_varint(p, end, version) && (version == SEARCH_VERSION);
+    ok = ok && get_varint(p, end, count);
+
+    for (uint64_t i = 0; ok && (i < count); i++)
+    {
+        document d;
+        ok = get_string(p, end, d.maildir) && get_string(p, end, d.stem) &&
+             get_string(p, end, d.path) && (p < end);
+
+        if (! ok)
+            break;
+
+        d.alive = (*p++ != 0);
+
+        if (! d.alive)
+            m_dead += 1;
+
+        m_stems[d.maildir + "\n" + d.stem] = m_docs.size();
+        m_docs.push_back(d);
+    }
+
+    ok = ok && get_varint(p, end, count);
+
+    for (uint64_t i = 0; ok && (i < count); i++)
+    {
+        std::string word;
+        uint64_t last, docs;
+        posting post;
+
+        ok = get_string(p, end, word) && get_varint(p, end, last) &&
+             get_varint(p, end, docs) && get_string(p, end, post.data);
+
+        post.last  = last;
+        post.count = docs;
+
+        if (ok)
+            m_terms[word] = post;
+    }
+
+    if (! ok)
+    {
+        m_docs.clear();
+        m_stems.clear();
+        m_terms.clear();
+        m_dead = 0;
+    }
+
+    return (ok);
+}
@@ -0,0 +1,238 @@
+/*
+ * search_index.h - A full-text index of local messages.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "maildir.h"
+#include "message.h"
+#include "singleton.h"
+
+
+/**
+ * This class maintains an inverted index of the words within local
+ * messages, across all maildirs, so they may be searched quickly.
+ *
+ * The `From`, `To`, `Cc` and `Subject` headers of each message are
+ * indexed, along with the decoded content of its textual MIME-parts.
+ * For each word we keep a posting list of the messages containing it,
+ * and the positions at which it occurs.  Posting lists are compressed
+ * as deltas, stored as variable-length integers.
+ *
+ * Messages are identified by their maildir, and the part of their
+ * filename which precedes the flags, so that flag changes don't
+ * invalidate the index.  When a maildir is updated only messages we've
+ * not seen before are parsed, and messages which have gone are marked
+ * as deleted.  Deleted messages are purged when the index is saved, if
+ * they make up more than half of it.
+ *
+ * The index is stored in the file named by `search.index`, or beneath
+ * `cache.prefix` if that is unset.  If neither is set the index is
+ * held in memory only.
+ *
+ * Queries are made up of words, all of which must match, and quoted
+ * phrases, whose words must appear consecutively.  Alternatives are
+ * separated by `OR`, for example:
+ *
+ *    lumail "release notes" OR changelog
+ */
+class CSearchIndex : public Singleton<CSearchIndex>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CSearchIndex();
+
+    /**
+     * Return the file the index should be stored in, or the empty
+     * string if it should only be held in memory.
+     */
+    static std::string index_file();
+
+    /**
+     * Load the index from the given file, replacing our contents.
+     *
+     * Returns false if the file is missing, or invalid, in which case
+     * we're left empty.
+     */
+    bool load(std::string file);
+
+    /**
+     * Save the index to the given file.
+     */
+    bool save(std::string file);
+
+    /**
+     * Save the index to `index_file()`, if it has changed.
+     */
+    bool save();
+
+    /**
+     * Bring the index up to date with the given maildir, returning the
+     * number of messages which were added.
+     *
+     * IMAP folders are ignored.
+     */
+    int update(std::shared_ptr<CMaildir> maildir);
+
+    /**
+     * Add a document to the index, made up of the given pieces of text,
+     * returning its number.
+     *
+     * `maildir` and `stem` identify the message, and `path` is where it
+     * may currently be found.
+     */
+    uint32_t add_document(std::string maildir, std::string stem,
+                          std::string path, const std::vector < std::string > &texts);
+
+    /**
+     * Return the numbers of the documents which match the given query,
+     * in the order they were added.
+     */
+    std::vector < uint32_t > search(const std::string &query);
+
+    /**
+     * Return the paths of the messages which match the given query.
+     *
+     * Paths which no longer exist, because the flags of a message have
+     * changed, are found again within the maildir.
+     */
+    std::vector < std::string > query(const std::string &query);
+
+    /**
+     * Return the path of the given document.
+     */
+    std::string document_path(uint32_t doc);
+
+    /**
+     * The number of live documents, and of distinct words, we hold.
+     */
+    size_t documents();
+    size_t terms();
+
+    /**
+     * The number of bytes used by our posting lists.
+     */
+    size_t posting_bytes();
+
+    /**
+     * Split the given text into lower-case words, as both indexing and
+     * queries do.
+     */
+    static void tokenize(const std::string &text, std::vector < std::string > &out);
+
+    /**
+     * Return the part of a message-filename which precedes its flags.
+     */
+    static std::string filename_stem(std::string path);
+
+private:
+
+    /**
+     * A document - a single message.
+     */
+    struct document
+    {
+        std::string maildir;
+        std::string stem;
+        std::string path;
+        bool alive;
+    };
+
+    /**
+     * The postings of a single word.
+     *
+     * For each document this holds the delta from the previous document
+     * number, the count of positions, and the deltas between positions.
+     */
+    struct posting
+    {
+        std::string data;
+        uint32_t last;
+        uint32_t count;
+    };
+
+    /**
+     * Load the index from `index_file()` if we've not yet done so.
+     */
+    void ensure_loaded();
+
+    /**
+     * Decode a posting list into its documents, and optionally the
+     * positions within each.
+     */
+    static void decode(const posting &p, std::vector < uint32_t > &docs,
+                       std::vector < std::vector < uint32_t > > *positions);
+
+    /**
+     * Append a document, and its positions, to a posting list.
+     */
+    static void encode(posting &p, uint32_t doc, const std::vector < uint32_t > &positions);
+
+    /**
+     * Find the documents which contain the given words, consecutively.
+     */
+    std::vector < uint32_t > match_phrase(const std::vector < std::string > &words);
+
+    /**
+     * Purge deleted documents, renumbering those which remain.
+     */
+    void compact();
+
+    /**
+     * Find the current path of the given document, if it has moved.
+     */
+    std::string resolve(uint32_t doc);
+
+private:
+
+    /**
+     * Our documents, by number.
+     */
+    std::vector < document > m_docs;
+
+    /**
+     * Map the maildir and stem of each document to its number.
+     */
+    std::unordered_map < std::string, uint32_t > m_stems;
+
+    /**
+     * The posting list of each word.
+     */
+    std::unordered_map < std::string, posting > m_terms;
+
+    /**
+     * The number of deleted documents.
+     */
+    size_t m_dead;
+
+    /**
+     * Have we loaded the index from disk yet, and has it changed since?
+     */
+    bool m_loaded;
+    bool m_dirty;
+};
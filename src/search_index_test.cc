@@ -0,0 +1,151 @@
+/*
+ * search_index_test.cc - Test-cases for our full-text index.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "search_index.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Populate an index with a few documents.
+ */
+static void populate(CSearchIndex &idx)
+{
+    idx.add_document("/md", "1", "/md/cur/1:2,S", {"Steve Kemp", "Release notes for lumail"});
+    idx.add_document("/md", "2", "/md/cur/2:2,", {"Bob", "Notes on the release"});
+    idx.add_document("/md", "3", "/md/new/3", {"Alice", "Changelog", "The LUMAIL changelog"});
+}
+
+
+/**
+ * Format the results of a query as a string, for easy comparison.
+ */
+static std::string results(CSearchIndex &idx, const char *query)
+{
+    std::string out;
+
+    for (uint32_t doc : idx.search(query))
+    {
+        if (! out.empty())
+            out += ",";
+
+        out += std::to_string(doc);
+    }
+
+    return (out);
+}
+
+
+/**
+ * Test splitting text into words.
+ */
+void TestSearchTokenize(CuTest * tc)
+{
+    std::vector < std::string > words;
+    CSearchIndex::tokenize("Hello, World! It's 2016 -- caf\xc3\xa9.", words);
+
+    const char *expected[] = {"hello", "world", "it", "s", "2016", "caf\xc3\xa9"};
+
+    CuAssertIntEquals(tc, sizeof(expected) / sizeof(expected[0]), words.size());
+
+    for (size_t i = 0; i < words.size(); i++)
+        CuAssertStrEquals(tc, expected[i], words[i].c_str());
+
+    CuAssertStrEquals(tc, "123.host", CSearchIndex::filename_stem("/md/cur/123.host:2,RS").c_str());
+    CuAssertStrEquals(tc, "123.host", CSearchIndex::filename_stem("/md/new/123.host").c_str());
+}
+
+
+/**
+ * Test word, phrase, and alternative queries.
+ */
+void TestSearchQuery(CuTest * tc)
+{
+    CSearchIndex idx;
+    populate(idx);
+
+    CuAssertIntEquals(tc, 3, idx.documents());
+
+    CuAssertStrEquals(tc, "0,2", results(idx, "lumail").c_str());
+    CuAssertStrEquals(tc, "0,1", results(idx, "RELEASE notes").c_str());
+    CuAssertStrEquals(tc, "0", results(idx, "\"release notes\"").c_str());
+    CuAssertStrEquals(tc, "1", results(idx, "\"notes on the\"").c_str());
+    CuAssertStrEquals(tc, "0,1,2", results(idx, "notes OR changelog").c_str());
+    CuAssertStrEquals(tc, "0,2", results(idx, "steve OR \"lumail changelog\"").c_str());
+    CuAssertStrEquals(tc, "", results(idx, "missing").c_str());
+    CuAssertStrEquals(tc, "", results(idx, "lumail missing").c_str());
+    CuAssertStrEquals(tc, "", results(idx, "").c_str());
+
+    /*
+     * Phrases don't match across headers and parts.
+     */
+    CuAssertStrEquals(tc, "", results(idx, "\"kemp release\"").c_str());
+    CuAssertStrEquals(tc, "", results(idx, "\"alice changelog\"").c_str());
+}
+
+
+/**
+ * Test that an index survives being saved and loaded.
+ */
+void TestSearchSaveLoad(CuTest * tc)
+{
+    char tmpl[] = "/tmp/search.XXXXXX";
+    int fd = mkstemp(tmpl);
+    CuAssertTrue(tc, fd >= 0);
+    close(fd);
+
+    CSearchIndex idx;
+    populate(idx);
+    CuAssertTrue(tc, idx.save(tmpl));
+
+    CSearchIndex copy;
+    CuAssertTrue(tc, copy.load(tmpl));
+
+    CuAssertIntEquals(tc, idx.documents(), copy.documents());
+    CuAssertIntEquals(tc, idx.terms(), copy.terms());
+    CuAssertStrEquals(tc, "0", results(copy, "\"release notes\"").c_str());
+    CuAssertStrEquals(tc, "/md/new/3", copy.document_path(2).c_str());
+
+    /*
+     * A truncated file is rejected.
+     */
+    CuAssertTrue(tc, truncate(tmpl, 20) == 0);
+    CuAssertTrue(tc, ! copy.load(tmpl));
+    CuAssertIntEquals(tc, 0, copy.documents());
+
+    unlink(tmpl);
+}
+
+
+CuSuite *
+search_index_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestSearchTokenize);
+    SUITE_ADD_TEST(suite, TestSearchQuery);
+    SUITE_ADD_TEST(suite, TestSearchSaveLoad);
+    return suite;
+}
@@ -0,0 +1,150 @@
+/*
+ * search_lua.cc - Export our full-text index to Lua.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "global_state.h"
+#include "lua.h"
+#include "maildir_lua.h"
+#include "message_lua.h"
+#include "search_index.h"
+
+
+/**
+ * @file search_lua.cc
+ *
+ * This file implements the exporting of our CSearchIndex class to Lua.
+ * Lua-usage looks something like this:
+ *
+ *<code>
+ *   -- Index every maildir, then search them <br/>
+ *   Search:update() <br/>
+ *   local msgs = Search:query( "\"release notes\" OR changelog" ) <br/>
+ *</code>
+ *
+ */
+
+
+/**
+ * Implementation of `Search:query`.
+ *
+ * Return a table of the messages matching the given query.
+ */
+int l_CSearch_query(lua_State * l)
+{
+    CLuaLog("l_CSearch_query");
+
+    const char *query = luaL_checkstring(l, 2);
+
+    std::vector < std::string > paths = CSearchIndex::instance()->query(query);
+
+    lua_createtable(l, paths.size(), 0);
+
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        push_cmessage(l, std::shared_ptr<CMessage>(new CMessage(paths[i])));
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Search:stats`.
+ *
+ * Return a table describing the size of the index.
+ */
+int l_CSearch_stats(lua_State * l)
+{
+    CLuaLog("l_CSearch_stats");
+
+    CSearchIndex *idx = CSearchIndex::instance();
+
+    lua_newtable(l);
+
+    lua_pushinteger(l, idx->documents());
+    lua_setfield(l, -2, "documents");
+
+    lua_pushinteger(l, idx->terms());
+    lua_setfield(l, -2, "terms");
+
+    lua_pushinteger(l, idx->posting_bytes());
+    lua_setfield(l, -2, "bytes");
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Search:update`.
+ *
+ * Index any new messages in the given maildir, or in every maildir,
+ * returning the number of messages which were added.
+ */
+int l_CSearch_update(lua_State * l)
+{
+    CLuaLog("l_CSearch_update");
+
+    CSearchIndex *idx = CSearchIndex::instance();
+    int added = 0;
+
+    if (lua_gettop(l) >= 2)
+    {
+        added = idx->update(l_CheckCMaildir(l, 2));
+    }
+    else
+    {
+        for (std::shared_ptr<CMaildir> maildir : CGlobalState::instance()->get_maildirs())
+            added += idx->update(maildir);
+    }
+
+    idx->save();
+
+    lua_pushinteger(l, added);
+    return 1;
+}
+
+
+/**
+ * Register the global `Search` object to the Lua environment,
+ * and setup our public methods upon which the user may operate.
+ */
+void InitSearch(lua_State * l)
+{
+    luaL_Reg sFooRegs[] =
+    {
+        {"query", l_CSearch_query},
+        {"stats", l_CSearch_stats},
+        {"update", l_CSearch_update},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(l, "luaL_CSearch");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sFooRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sFooRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_setglobal(l, "Search");
+
+}
@@ -0,0 +1,438 @@
+/*
+ * selection_lua.cc - Lua interface for selections of the current messages.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <time.h>
+
+#include "global_state.h"
+#include "lua.h"
+#include "message_columns.h"
+#include "message_lua.h"
+#include "message_selection.h"
+
+
+/**
+ * @file selection_lua.cc
+ *
+ * This file implements the exporting of our CMessageSelection class to
+ * Lua.  A selection picks out some of `Global:current_messages()` from
+ * their columns, without touching the messages themselves:
+ *
+ *<code>
+ *   -- Unread messages, or large ones, of one folder. <br/>
+ *   local s = Selection.limit("new"):union( Selection.larger(1000000) ) <br/>
+ *   s = s:intersect( Selection.folder("/home/steve/Maildir/lists") ) <br/>
+ *   print( s:count() ) <br/>
+ *   local msgs = s:messages() <br/>
+ *</code>
+ *
+ */
+
+
+/**
+ * Push a CMessageSelection onto the Lua stack.
+ */
+void push_cselection(lua_State * l, const CMessageSelection &selection)
+{
+    CLuaLog("push_cselection");
+
+    void *ud = lua_newuserdata(l, sizeof(std::shared_ptr<CMessageSelection>));
+
+    if (!ud)
+    {
+        /* Error - couldn't allocate the memory */
+        return;
+    }
+
+    /*
+     * Construct the shared pointer in the memory we've just allocated.
+     */
+    new(ud) std::shared_ptr<CMessageSelection>(new CMessageSelection(selection));
+
+    luaL_getmetatable(l, "luaL_CSelection");
+    lua_setmetatable(l, -2);
+}
+
+
+/**
+ * Test that the object is a std::shared_ptr<CMessageSelection>.
+ */
+std::shared_ptr<CMessageSelection> l_CheckCSelection(lua_State * l, int n)
+{
+    CLuaLog("l_CheckCSelection");
+
+    void *ud = luaL_checkudata(l, n, "luaL_CSelection");
+
+    if (ud)
+    {
+        /* Return a copy (of the pointer) */
+        return *static_cast<std::shared_ptr<CMessageSelection> *>(ud);
+    }
+    else
+    {
+        /* otherwise a null pointer */
+        return std::shared_ptr<CMessageSelection>();
+    }
+}
+
+
+/**
+ * The columns of the current messages.
+ */
+static const lumail_columns *current_columns()
+{
+    return (CMessageColumns::instance()->current());
+}
+
+
+/**
+ * Implementation of `Selection.all`.
+ */
+int l_CSelection_all(lua_State * l)
+{
+    CLuaLog("l_CSelection_all");
+
+    push_cselection(l, CMessageSelection(current_columns(), true));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection.flagged`.
+ */
+int l_CSelection_flagged(lua_State * l)
+{
+    CLuaLog("l_CSelection_flagged");
+
+    uint32_t mask = CMessageSelection::mask(luaL_checkstring(l, 1));
+
+    push_cselection(l, CMessageSelection::flagged(current_columns(), mask));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection.folder`.
+ */
+int l_CSelection_folder(lua_State * l)
+{
+    CLuaLog("l_CSelection_folder");
+
+    const char *path = luaL_checkstring(l, 1);
+
+    const lumail_columns *columns = current_columns();
+
+    /*
+     * A folder none of the messages are within selects nothing.
+     */
+    uint32_t id;
+
+    if (! CMessageColumns::instance()->find(path, id))
+    {
+        push_cselection(l, CMessageSelection(columns, false));
+        return 1;
+    }
+
+    push_cselection(l, CMessageSelection::folder(columns, id));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection.larger`.
+ */
+int l_CSelection_larger(lua_State * l)
+{
+    CLuaLog("l_CSelection_larger");
+
+    double size = luaL_checknumber(l, 1);
+
+    push_cselection(l, CMessageSelection::larger(current_columns(), size));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection.limit`.
+ *
+ * Returns nil if the limit can't be tested from the columns alone, in
+ * which case `Global:filter_messages` should be used.
+ */
+int l_CSelection_limit(lua_State * l)
+{
+    CLuaLog("l_CSelection_limit");
+
+    const char *limit = luaL_checkstring(l, 1);
+
+    const lumail_columns *columns = current_columns();
+    CMessageSelection selection(columns, false);
+
+    if (! CMessageSelection::limit(columns, limit, selection, time(NULL)))
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    push_cselection(l, selection);
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection.since`.
+ */
+int l_CSelection_since(lua_State * l)
+{
+    CLuaLog("l_CSelection_since");
+
+    double when = luaL_checknumber(l, 1);
+
+    push_cselection(l, CMessageSelection::since(current_columns(), when));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection.smaller`.
+ */
+int l_CSelection_smaller(lua_State * l)
+{
+    CLuaLog("l_CSelection_smaller");
+
+    double size = luaL_checknumber(l, 1);
+
+    push_cselection(l, CMessageSelection::smaller(current_columns(), size));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection.unflagged`.
+ */
+int l_CSelection_unflagged(lua_State * l)
+{
+    CLuaLog("l_CSelection_unflagged");
+
+    uint32_t mask = CMessageSelection::mask(luaL_checkstring(l, 1));
+
+    push_cselection(l, CMessageSelection::unflagged(current_columns(), mask));
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection:count`.
+ */
+int l_CSelection_count(lua_State * l)
+{
+    CLuaLog("l_CSelection_count");
+
+    std::shared_ptr<CMessageSelection> foo = l_CheckCSelection(l, 1);
+
+    lua_pushinteger(l, foo->count());
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection:intersect`.
+ *
+ * Returns a new selection, or nil if the two were made from different
+ * messages.
+ */
+int l_CSelection_intersect(lua_State * l)
+{
+    CLuaLog("l_CSelection_intersect");
+
+    std::shared_ptr<CMessageSelection> foo = l_CheckCSelection(l, 1);
+    std::shared_ptr<CMessageSelection> bar = l_CheckCSelection(l, 2);
+
+    CMessageSelection result(*foo);
+
+    if (! result.intersect(*bar))
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    push_cselection(l, result);
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection:invert`.
+ */
+int l_CSelection_invert(lua_State * l)
+{
+    CLuaLog("l_CSelection_invert");
+
+    std::shared_ptr<CMessageSelection> foo = l_CheckCSelection(l, 1);
+
+    CMessageSelection result(*foo);
+    result.invert();
+
+    push_cselection(l, result);
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection:messages`.
+ *
+ * Returns the selected messages, or nil if the current messages have
+ * changed since the selection was made.
+ */
+int l_CSelection_messages(lua_State * l)
+{
+    CLuaLog("l_CSelection_messages");
+
+    std::shared_ptr<CMessageSelection> foo = l_CheckCSelection(l, 1);
+
+    const lumail_columns *columns = current_columns();
+    CMessageList *messages = CGlobalState::instance()->get_messages();
+
+    if ((columns->generation != foo->generation()) || (messages == NULL) ||
+            (messages->size() != foo->size()))
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    std::vector<uint32_t> offsets = foo->offsets();
+    CMessageList result;
+    result.reserve(offsets.size());
+
+    for (uint32_t offset : offsets)
+        result.push_back((*messages)[offset]);
+
+    push_cmessages(l, result);
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection:offsets`.
+ *
+ * Returns the offsets of the selected messages, counting from one, as
+ * the table `Global:current_messages()` returns does.
+ */
+int l_CSelection_offsets(lua_State * l)
+{
+    CLuaLog("l_CSelection_offsets");
+
+    std::shared_ptr<CMessageSelection> foo = l_CheckCSelection(l, 1);
+
+    std::vector<uint32_t> offsets = foo->offsets();
+
+    lua_createtable(l, offsets.size(), 0);
+
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        lua_pushinteger(l, offsets[i] + 1);
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Implementation of `Selection:union`.
+ *
+ * Returns a new selection, or nil if the two were made from different
+ * messages.
+ */
+int l_CSelection_union(lua_State * l)
+{
+    CLuaLog("l_CSelection_union");
+
+    std::shared_ptr<CMessageSelection> foo = l_CheckCSelection(l, 1);
+    std::shared_ptr<CMessageSelection> bar = l_CheckCSelection(l, 2);
+
+    CMessageSelection result(*foo);
+
+    if (! result.unite(*bar))
+    {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    push_cselection(l, result);
+    return 1;
+}
+
+
+/**
+ * Destructor
+ */
+int l_CSelection_destructor(lua_State * l)
+{
+    CLuaLog("l_CSelection_destructor");
+
+    void *ud = luaL_checkudata(l, 1, "luaL_CSelection");
+
+    if (ud)
+    {
+        std::shared_ptr<CMessageSelection> *ud_sel = static_cast<std::shared_ptr<CMessageSelection> *>(ud);
+        ud_sel->~shared_ptr<CMessageSelection>();
+    }
+
+    return 0;
+}
+
+
+/**
+ * Register the global `Selection` object to the Lua environment, and
+ * setup our public methods upon which the user may operate.
+ */
+void InitSelection(lua_State * l)
+{
+    luaL_Reg sFooRegs[] =
+    {
+        {"all", l_CSelection_all},
+        {"count", l_CSelection_count},
+        {"flagged", l_CSelection_flagged},
+        {"folder", l_CSelection_folder},
+        {"intersect", l_CSelection_intersect},
+        {"invert", l_CSelection_invert},
+        {"larger", l_CSelection_larger},
+        {"limit", l_CSelection_limit},
+        {"messages", l_CSelection_messages},
+        {"offsets", l_CSelection_offsets},
+        {"since", l_CSelection_since},
+        {"smaller", l_CSelection_smaller},
+        {"unflagged", l_CSelection_unflagged},
+        {"union", l_CSelection_union},
+        {"__gc", l_CSelection_destructor},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(l, "luaL_CSelection");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sFooRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sFooRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_setglobal(l, "Selection");
+}
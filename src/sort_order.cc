@@ -0,0 +1,263 @@
+/*
+ * sort_order.cc - The orders in which folders were last sorted.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "maildir_index.h"
+#include "sort_order.h"
+
+
+/*
+ * The first line of each of our files.
+ */
+#define SORT_ORDER_MAGIC "lumail-sort 1"
+
+
+/*
+ * Constructor.
+ */
+CSortOrder::CSortOrder()
+{
+}
+
+
+/*
+ * Destructor.
+ */
+CSortOrder::~CSortOrder()
+{
+    save();
+}
+
+
+/*
+ * The identity of the message with the given path.
+ */
+std::string CSortOrder::identity(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    size_t start = (slash == std::string::npos) ? 0 : slash + 1;
+    size_t colon = path.find(':', start);
+
+    if (colon == std::string::npos)
+        return (path.substr(start));
+
+    return (path.substr(start, colon - start));
+}
+
+
+/*
+ * The path of the folder holding the message with the given path.
+ */
+std::string CSortOrder::folder(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+
+    if (slash == std::string::npos)
+        return ("");
+
+    std::string dir = path.substr(0, slash);
+    size_t len = dir.size();
+
+    if ((len > 4) && ((dir.compare(len - 4, 4, "/cur") == 0) ||
+                      (dir.compare(len - 4, 4, "/new") == 0)))
+        dir.erase(len - 4);
+
+    return (dir);
+}
+
+
+/*
+ * The file holding the order of the given folder by the given method.
+ */
+std::string CSortOrder::order_file(const std::string &folder, const std::string &method)
+{
+    std::string file = CMaildirIndex::index_file(folder);
+
+    if (file.empty())
+        return "";
+
+    return (file + ".sort-" + method);
+}
+
+
+/*
+ * Find the order in which the given folder was last sorted.
+ */
+std::shared_ptr<const sort_order> CSortOrder::find(const std::string &folder, const std::string &method)
+{
+    std::string key = folder + "\n" + method;
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        auto it = m_orders.find(key);
+
+        if (it != m_orders.end())
+            return (it->second);
+    }
+
+    std::string file = order_file(folder, method);
+    std::shared_ptr<sort_order> order;
+
+    if (! file.empty())
+        order = load(file);
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    auto added = m_orders.insert(std::make_pair(key, order));
+
+    return (added.first->second);
+}
+
+
+/*
+ * Remember the order in which the given folder has been sorted.
+ */
+void CSortOrder::remember(const std::string &folder, const std::string &method,
+                          std::vector < std::string > &ids)
+{
+    std::string file = order_file(folder, method);
+
+    if (file.empty())
+        return;
+
+    /*
+     * Orders are replaced rather than changed, so those returned by
+     * `find` remain valid for as long as their callers hold them.
+     */
+    std::shared_ptr<sort_order> order = std::make_shared<sort_order>();
+    order->file  = file;
+    order->dirty = true;
+    order->ranks.reserve(ids.size());
+
+    for (size_t i = 0; i < ids.size(); i++)
+        order->ranks.insert(std::make_pair(ids[i], (uint32_t) i));
+
+    order->ids.swap(ids);
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_orders[folder + "\n" + method] = order;
+}
+
+
+/*
+ * Save each order which has changed.
+ */
+bool CSortOrder::save()
+{
+    std::vector < std::shared_ptr<sort_order> > dirty;
+
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        for (auto &entry : m_orders)
+        {
+            if (entry.second && entry.second->dirty)
+            {
+                dirty.push_back(entry.second);
+                entry.second->dirty = false;
+            }
+        }
+    }
+
+    bool ok = true;
+
+    for (std::shared_ptr<sort_order> order : dirty)
+    {
+        if (! write(*order))
+            ok = false;
+    }
+
+    return (ok);
+}
+
+
+/*
+ * Forget every order we hold.
+ */
+void CSortOrder::reset()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_orders.clear();
+}
+
+
+/*
+ * Read the order held in the given file.
+ */
+std::shared_ptr<sort_order> CSortOrder::load(const std::string &file)
+{
+    std::ifstream input(file);
+    std::string line;
+
+    if (! std::getline(input, line) || (line != SORT_ORDER_MAGIC))
+        return (std::shared_ptr<sort_order>());
+
+    std::shared_ptr<sort_order> order = std::make_shared<sort_order>();
+    order->file  = file;
+    order->dirty = false;
+
+    while (std::getline(input, line))
+    {
+        if (line.empty() || (order->ranks.find(line) != order->ranks.end()))
+            continue;
+
+        order->ranks.insert(std::make_pair(line, (uint32_t) order->ids.size()));
+        order->ids.push_back(line);
+    }
+
+    return (order);
+}
+
+
+/*
+ * Write the given order to its file.
+ */
+bool CSortOrder::write(const sort_order &order)
+{
+    /*
+     * Write to a temporary file, and rename it into place, so readers
+     * never see a partial order.
+     */
+    std::string dir = order.file.substr(0, order.file.find_last_of('/'));
+    CDirectory::mkdir_p(dir);
+
+    std::string tmp = order.file + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+
+    if (fp == NULL)
+        return false;
+
+    bool ok = (fprintf(fp, "%s\n", SORT_ORDER_MAGIC) > 0);
+
+    for (size_t i = 0; ok && (i < order.ids.size()); i++)
+        ok = (fprintf(fp, "%s\n", order.ids[i].c_str()) > 0);
+
+    ok = (fclose(fp) == 0) && ok;
+
+    if (! ok || (rename(tmp.c_str(), order.file.c_str()) != 0))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
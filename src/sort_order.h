@@ -0,0 +1,155 @@
+/*
+ * sort_order.h - The orders in which folders were last sorted.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "singleton.h"
+
+
+/**
+ * The order in which the messages of one folder were last sorted, by
+ * one method.
+ *
+ * Messages are identified by the unique part of their names, before any
+ * `:2,` flags, so that an order survives the renaming of messages as
+ * their flags change, or as they move from `new/` to `cur/`.
+ */
+typedef struct _sort_order
+{
+    /**
+     * The identities of the messages, in sorted order.
+     */
+    std::vector < std::string > ids;
+
+    /**
+     * The position of each identity within `ids`.
+     */
+    std::unordered_map < std::string, uint32_t > ranks;
+
+    /**
+     * The file the order is saved to, and whether it has changed since
+     * it was loaded from there.
+     */
+    std::string file;
+    bool dirty;
+} sort_order;
+
+
+/**
+ * This singleton holds the orders in which folders were last sorted by
+ * each of the methods of `CMessageSort`.
+ *
+ * Each order is kept beside the index of its folder, beneath
+ * `index.cache`, so that a folder which is opened again may be put back
+ * into order in linear time, with only the messages which have arrived
+ * since it was last sorted needing to be sorted, and merged in.
+ *
+ * Orders are loaded when first needed, and those which have changed
+ * are saved when we exit.
+ */
+class CSortOrder : public Singleton<CSortOrder>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CSortOrder();
+
+    /**
+     * Destructor, saving any orders which have changed.
+     */
+    ~CSortOrder();
+
+    /**
+     * The identity of the message with the given path: the part of its
+     * name before any flags.
+     */
+    static std::string identity(const std::string &path);
+
+    /**
+     * The path of the folder holding the message with the given path.
+     */
+    static std::string folder(const std::string &path);
+
+    /**
+     * The file holding the order of the given folder by the given
+     * method, or the empty string if indexing is disabled.
+     */
+    static std::string order_file(const std::string &folder, const std::string &method);
+
+    /**
+     * Find the order in which the given folder was last sorted by the
+     * given method, loading it if necessary.
+     *
+     * Returns NULL if there is no such order, or indexing is disabled.
+     */
+    std::shared_ptr<const sort_order> find(const std::string &folder, const std::string &method);
+
+    /**
+     * Remember the order in which the given folder has been sorted by
+     * the given method, as the identities of its messages.
+     */
+    void remember(const std::string &folder, const std::string &method,
+                  std::vector < std::string > &ids);
+
+    /**
+     * Save each order which has changed, returning false if any could
+     * not be written.
+     */
+    bool save();
+
+    /**
+     * Forget every order we hold, without saving them.
+     */
+    void reset();
+
+private:
+
+    /**
+     * Read the order held in the given file.
+     */
+    static std::shared_ptr<sort_order> load(const std::string &file);
+
+    /**
+     * Write the given order to its file.
+     */
+    static bool write(const sort_order &order);
+
+private:
+
+    /**
+     * The orders we hold, by folder and method.  A missing order is
+     * held as NULL, so that we look for its file once.
+     */
+    std::unordered_map < std::string, std::shared_ptr<sort_order> > m_orders;
+
+    /**
+     * Guards the above.
+     */
+    std::mutex m_lock;
+};
@@ -0,0 +1,249 @@
+/*
+ * sort_order_test.cc - Test-cases for our remembered sort-orders.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <locale.h>
+#include <memory>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "config.h"
+#include "message_sort.h"
+#include "sort_order.h"
+#include "CuTest.h"
+
+
+/**
+ * Test how messages, and their folders, are identified.
+ */
+void TestSortOrderIdentity(CuTest * tc)
+{
+    CuAssertStrEquals(tc, "1234.host", CSortOrder::identity("/tmp/Maildir/cur/1234.host:2,S").c_str());
+    CuAssertStrEquals(tc, "1234.host", CSortOrder::identity("/tmp/Maildir/new/1234.host").c_str());
+    CuAssertStrEquals(tc, "1234.host", CSortOrder::identity("1234.host:2,").c_str());
+
+    CuAssertStrEquals(tc, "/tmp/Maildir", CSortOrder::folder("/tmp/Maildir/cur/1234.host:2,S").c_str());
+    CuAssertStrEquals(tc, "/tmp/Maildir", CSortOrder::folder("/tmp/Maildir/new/1234.host").c_str());
+    CuAssertStrEquals(tc, "/tmp/mbox", CSortOrder::folder("/tmp/mbox/1234").c_str());
+    CuAssertStrEquals(tc, "", CSortOrder::folder("1234.host").c_str());
+}
+
+
+/**
+ * Test that orders are remembered, saved, and loaded again.
+ */
+void TestSortOrderSave(CuTest * tc)
+{
+    char tmpl[] = "/tmp/order.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string dir = tmpl;
+
+    CConfig *config = CConfig::instance();
+    config->set("index.cache", dir, false);
+
+    CSortOrder *orders = CSortOrder::instance();
+    orders->reset();
+
+    CuAssertTrue(tc, orders->find("/tmp/Maildir", "date") == NULL);
+
+    std::vector < std::string > ids;
+    ids.push_back("300.c");
+    ids.push_back("100.a");
+    ids.push_back("200.b");
+    orders->remember("/tmp/Maildir", "date", ids);
+
+    std::shared_ptr<const sort_order> order = orders->find("/tmp/Maildir", "date");
+    CuAssertPtrNotNull(tc, order.get());
+    CuAssertIntEquals(tc, 3, order->ids.size());
+    CuAssertIntEquals(tc, 1, order->ranks.at("100.a"));
+
+    /*
+     * Once saved the order may be loaded again.
+     */
+    CuAssertTrue(tc, orders->save());
+    orders->reset();
+
+    order = orders->find("/tmp/Maildir", "date");
+    CuAssertPtrNotNull(tc, order.get());
+    CuAssertIntEquals(tc, 3, order->ids.size());
+    CuAssertStrEquals(tc, "300.c", order->ids[0].c_str());
+    CuAssertStrEquals(tc, "200.b", order->ids[2].c_str());
+    CuAssertIntEquals(tc, 2, order->ranks.at("200.b"));
+
+    CuAssertTrue(tc, orders->find("/tmp/Maildir", "subject") == NULL);
+
+    unlink(CSortOrder::order_file("/tmp/Maildir", "date").c_str());
+    orders->reset();
+    config->delete_key("index.cache");
+    rmdir(tmpl);
+}
+
+
+/**
+ * Test that sorting reuses, and repairs, the order of a folder.
+ */
+void TestSortOrderRepair(CuTest * tc)
+{
+    char tmpl[] = "/tmp/order.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string dir = tmpl;
+
+    CConfig *config = CConfig::instance();
+    config->set("index.cache", dir, false);
+
+    CSortOrder *orders = CSortOrder::instance();
+    orders->reset();
+
+    /*
+     * Messages are dated by their names.
+     */
+    auto message = [](const std::string & name)
+    {
+        return (std::shared_ptr<CMessage>(new CMessage("/tmp/Maildir/cur/" + name)));
+    };
+
+    CMessageList messages;
+    messages.push_back(message("300.c:2,S"));
+    messages.push_back(message("100.a:2,"));
+    messages.push_back(message("200.b:2,S"));
+
+    CuAssertTrue(tc, CMessageSort::sort(messages, "date"));
+    CuAssertStrEquals(tc, "/tmp/Maildir/cur/100.a:2,", messages[0]->path().c_str());
+    CuAssertStrEquals(tc, "/tmp/Maildir/cur/300.c:2,S", messages[2]->path().c_str());
+
+    std::shared_ptr<const sort_order> order = orders->find("/tmp/Maildir", "date");
+    CuAssertPtrNotNull(tc, order.get());
+    CuAssertIntEquals(tc, 3, order->ids.size());
+    CuAssertStrEquals(tc, "100.a", order->ids[0].c_str());
+
+    /*
+     * New arrivals are merged in, whatever the flags of the others.
+     */
+    CMessageList later;
+    later.push_back(message("250.e:2,"));
+    later.push_back(message("300.c:2,RS"));
+    later.push_back(message("200.b:2,S"));
+    later.push_back(message("100.a:2,S"));
+    later.push_back(message("150.d:2,"));
+
+    CuAssertTrue(tc, CMessageSort::sort(later, "date"));
+
+    const char *expected[] = { "100.a", "150.d", "200.b", "250.e", "300.c" };
+
+    for (int i = 0; i < 5; i++)
+        CuAssertStrEquals(tc, expected[i], CSortOrder::identity(later[i]->path()).c_str());
+
+    order = orders->find("/tmp/Maildir", "date");
+    CuAssertIntEquals(tc, 5, order->ids.size());
+    CuAssertStrEquals(tc, "250.e", order->ids[3].c_str());
+
+    /*
+     * An order which is wrong is discarded.
+     */
+    std::vector < std::string > wrong;
+    wrong.push_back("300.c");
+    wrong.push_back("100.a");
+    orders->remember("/tmp/Maildir", "date", wrong);
+
+    CMessageList again;
+    again.push_back(message("300.c:2,S"));
+    again.push_back(message("100.a:2,"));
+    again.push_back(message("200.b:2,S"));
+
+    CuAssertTrue(tc, CMessageSort::sort(again, "date"));
+    CuAssertStrEquals(tc, "100.a", CSortOrder::identity(again[0]->path()).c_str());
+    CuAssertStrEquals(tc, "200.b", CSortOrder::identity(again[1]->path()).c_str());
+    CuAssertStrEquals(tc, "300.c", CSortOrder::identity(again[2]->path()).c_str());
+
+    orders->reset();
+    config->delete_key("index.cache");
+    rmdir(tmpl);
+}
+
+
+/**
+ * Test that textual keys are compared as Lua's `<` would.
+ */
+void TestSortOrderCollation(CuTest * tc)
+{
+    std::string apple  = "apple";
+    std::string banana = "Banana";
+    std::string nul_a  = std::string("x\0a", 3);
+    std::string nul_b  = std::string("x\0b", 3);
+    std::string x      = "x";
+
+    CSortKey a = { 0, &apple, 1 };
+    CSortKey b = { 0, &banana, 0 };
+    CSortKey p = { 0, &nul_a, 0 };
+    CSortKey q = { 0, &nul_b, 0 };
+    CSortKey r = { 0, &x, 0 };
+
+    /*
+     * Ties are broken by position.
+     */
+    CSortKey c = { 0, &apple, 2 };
+    CuAssertTrue(tc, CMessageSort::less(a, c));
+    CuAssertTrue(tc, ! CMessageSort::less(c, a));
+
+    /*
+     * Content after an embedded NUL still counts.
+     */
+    CuAssertTrue(tc, CMessageSort::less(p, q));
+    CuAssertTrue(tc, CMessageSort::less(r, p));
+
+    /*
+     * In the C locale strings collate bytewise.
+     */
+    std::string saved = setlocale(LC_COLLATE, NULL);
+
+    setlocale(LC_COLLATE, "C");
+    CuAssertTrue(tc, CMessageSort::less(b, a));
+
+    /*
+     * A dictionary order, where available, ignores case first.
+     */
+    const char *locales[] = { "en_US.UTF-8", "en_GB.UTF-8", "de_DE.UTF-8", NULL };
+
+    for (int i = 0; locales[i] != NULL; i++)
+    {
+        if (setlocale(LC_COLLATE, locales[i]) != NULL)
+        {
+            CuAssertTrue(tc, CMessageSort::less(a, b));
+            CuAssertTrue(tc, ! CMessageSort::less(b, a));
+            break;
+        }
+    }
+
+    setlocale(LC_COLLATE, saved.c_str());
+}
+
+
+CuSuite *
+sort_order_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestSortOrderIdentity);
+    SUITE_ADD_TEST(suite, TestSortOrderSave);
+    SUITE_ADD_TEST(suite, TestSortOrderRepair);
+    SUITE_ADD_TEST(suite, TestSortOrderCollation);
+    return suite;
+}
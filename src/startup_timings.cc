@@ -0,0 +1,96 @@
+/*
+ * startup_timings.cc - Record how long each phase of our startup takes.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <stdio.h>
+
+#include "startup_timings.h"
+
+
+/*
+ * Constructor.
+ */
+CStartupTimings::CStartupTimings()
+{
+    m_launched = CFrameStats::now();
+    m_drawn    = false;
+}
+
+
+/*
+ * Record that the named phase took the given number of microseconds.
+ */
+void CStartupTimings::record(const std::string &phase, uint64_t usec)
+{
+    m_phases.push_back(std::make_pair(phase, usec));
+}
+
+
+/*
+ * Record the named phase, unless it has been recorded already.
+ */
+void CStartupTimings::record_first(const std::string &phase, uint64_t usec)
+{
+    for (auto &p : m_phases)
+    {
+        if (p.first == phase)
+            return;
+    }
+
+    record(phase, usec);
+}
+
+
+/*
+ * Note that a frame has been drawn.
+ */
+void CStartupTimings::frame_drawn()
+{
+    if (m_drawn)
+        return;
+
+    m_drawn = true;
+    record("first frame drawn, since launch", CFrameStats::now() - m_launched);
+}
+
+
+/*
+ * Our phases, in order.
+ */
+std::vector < std::pair < std::string, uint64_t > > CStartupTimings::phases()
+{
+    return (m_phases);
+}
+
+
+/*
+ * The breakdown of our timings.
+ */
+std::string CStartupTimings::report()
+{
+    std::string result = "Startup timings (ms):\n";
+
+    for (auto &p : m_phases)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%10.1f  ", p.second / 1000.0);
+        result += buf + p.first + "\n";
+    }
+
+    return (result);
+}
@@ -0,0 +1,125 @@
+/*
+ * startup_timings.h - Record how long each phase of our startup takes.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "frame_stats.h"
+#include "singleton.h"
+
+
+/**
+ * This singleton records the wall-time taken by each phase of our startup,
+ * initialising GMime, creating our Lua interpreter, loading each file,
+ * setting up the screen, and so on, along with the time until our first
+ * frame was drawn.
+ *
+ * The breakdown is written to stderr as we exit if we were launched with
+ * `--timings`, or `startup.report` has been set.
+ */
+class CStartupTimings : public Singleton<CStartupTimings>
+{
+public:
+
+    /**
+     * Constructor.  The time we're created is taken to be our launch.
+     */
+    CStartupTimings();
+
+    /**
+     * Record that the named phase took the given number of microseconds.
+     */
+    void record(const std::string &phase, uint64_t usec);
+
+    /**
+     * Record the named phase, unless it has been recorded already.
+     */
+    void record_first(const std::string &phase, uint64_t usec);
+
+    /**
+     * Note that a frame has been drawn, recording the time since our
+     * launch if it is the first.
+     */
+    void frame_drawn();
+
+    /**
+     * Our phases, and their timings, in the order they were recorded.
+     */
+    std::vector < std::pair < std::string, uint64_t > > phases();
+
+    /**
+     * The breakdown of our timings, one phase per line.
+     */
+    std::string report();
+
+private:
+
+    /**
+     * When we were launched.
+     */
+    uint64_t m_launched;
+
+    /**
+     * Has our first frame been drawn?
+     */
+    bool m_drawn;
+
+    /**
+     * Our phases, in order.
+     */
+    std::vector < std::pair < std::string, uint64_t > > m_phases;
+};
+
+
+/**
+ * Time the scope this object lives within, recording the result as the
+ * given phase of our startup when it is destroyed.  If `first` is set
+ * only the first such scope is recorded.
+ */
+class CStartupTimer
+{
+public:
+    CStartupTimer(const std::string &phase, bool first = false)
+    {
+        m_phase = phase;
+        m_first = first;
+        m_start = CFrameStats::now();
+    };
+
+    ~CStartupTimer()
+    {
+        CStartupTimings *timings = CStartupTimings::instance();
+        uint64_t took = CFrameStats::now() - m_start;
+
+        if (m_first)
+            timings->record_first(m_phase, took);
+        else
+            timings->record(m_phase, took);
+    };
+
+private:
+    std::string m_phase;
+    bool m_first;
+    uint64_t m_start;
+};
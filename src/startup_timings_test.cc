@@ -0,0 +1,65 @@
+/*
+ * startup_timings_test.cc - Test-cases for our startup-timings.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <cstddef>
+#include <string>
+
+#include "startup_timings.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test our phases are kept in order, and reported.
+ */
+void TestStartupTimingsReport(CuTest * tc)
+{
+    CStartupTimings timings;
+
+    timings.record("lua", 1500);
+    timings.record_first("update_maildirs", 300);
+    timings.record_first("update_maildirs", 9999);
+    timings.record("load foo.lua", 20);
+
+    auto phases = timings.phases();
+    CuAssertIntEquals(tc, 3, phases.size());
+    CuAssertStrEquals(tc, "update_maildirs", phases[1].first.c_str());
+    CuAssertIntEquals(tc, 300, phases[1].second);
+
+    CuAssertStrEquals(tc, "Startup timings (ms):\n"
+                      "       1.5  lua\n"
+                      "       0.3  update_maildirs\n"
+                      "       0.0  load foo.lua\n",
+                      timings.report().c_str());
+
+    /*
+     * Only the first frame is recorded.
+     */
+    timings.frame_drawn();
+    timings.frame_drawn();
+    CuAssertIntEquals(tc, 4, timings.phases().size());
+}
+
+
+CuSuite *
+startup_timings_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestStartupTimingsReport);
+    return suite;
+}
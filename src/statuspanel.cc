@@ -17,9 +17,17 @@
  */
 
 
-#include <algorithm>
+#include "config.h"
+#include "frame_stats.h"
 #include "statuspanel.h"
 
+
+/**
+ * The number of lines of text we keep.
+ */
+static CConfigKey g_history_key("panel.history");
+
+
 /**
  * The status-panel.
  */
@@ -97,6 +105,7 @@ void CStatusPanel::init(int rows)
     g_status_bar = new_panel(g_status_bar_window);
     show_panel(g_status_bar);
     m_hidden = false;
+    m_dirty  = true;
     draw();
 }
 
@@ -116,12 +125,14 @@ void CStatusPanel::show()
 {
     init(m_height);
     m_hidden = false;
+    m_changed = true;
 }
 
 void CStatusPanel::hide()
 {
     cleanup();
     m_hidden = true;
+    m_changed = true;
 }
 
 /**
@@ -137,13 +148,6 @@ bool CStatusPanel::hidden()
  */
 void CStatusPanel::draw()
 {
-    /*
-     * Handle resize events
-     */
-    static int old_x = 0;
-    static int old_y = 0;
-
-
     /*
      * If we don't have a status-bar at the moment
      * we can't do anything.
@@ -152,23 +156,33 @@ void CStatusPanel::draw()
         return;
 
 
-    int x;
-    int y;
-    getmaxyx(g_status_bar_window, y, x);
+    CScreen *s = CScreen::instance();
+    int width = CScreen::width();
 
-    if ((x != old_x) || (y != old_y))
+    /*
+     * Handle resize events, which require us to draw again.
+     */
+    if ((width != m_drawn_width) || (m_height != m_drawn_height))
     {
-        wresize(g_status_bar_window, y, x);
+        m_drawn_width  = width;
+        m_drawn_height = m_height;
+        m_dirty = true;
     }
 
+    /*
+     * Our frame-timings change every frame, but the rest of our
+     * window only when we do.
+     */
+    CConfig *config = CConfig::instance();
+    bool timings = config->get_integer("global.frame_stats", 0);
 
-    CScreen *s = CScreen::instance();
-    int width = CScreen::width();
+    if (! m_dirty && ! timings)
+        return;
 
     /*
      * Show the title, and the last two lines of the text.
      */
-    if (! title.empty())
+    if (m_dirty && ! title.empty())
     {
         int result __attribute__((unused));
 
@@ -182,23 +196,21 @@ void CStatusPanel::draw()
     }
 
 
-    if (m_text.size() > 0)
+    if (m_dirty)
     {
         /*
-         * Reverse the lines of text, and draw until we've exceeded
-         * our height.
+         * Draw the most recent lines of text, newest at the foot,
+         * until we've exceeded our height.
          */
-        std::vector<std::string> tmp = m_text;
-        std::reverse(tmp.begin(), tmp.end());
-
+        int count = (int)m_text.size();
         int i = 0;
 
         while (i < (m_height - 3 - 1))
         {
             std::string text;
 
-            if (i < (int)tmp.size())
-                text = tmp.at(i);
+            if (i < count)
+                text = line(count - 1 - i);
             else
                 text = "";
 
@@ -223,12 +235,25 @@ void CStatusPanel::draw()
     mvwhline(g_status_bar_window, 2, 1, ACS_HLINE, width - 2);
     mvwaddch(g_status_bar_window, 2, width - 1, ACS_RTEE);
 
+    /*
+     * Show our frame-timings in the top border, if we're asked to.
+     */
+    if (timings)
+    {
+        std::string stats = " " + CFrameStats::instance()->overlay() + " ";
+
+        if ((stats.size() > 2) && ((int)stats.size() < width - 4))
+            mvwaddstr(g_status_bar_window, 0, width - 2 - stats.size(), stats.c_str());
+    }
+
+    m_dirty = false;
 }
 
 void CStatusPanel::set_title(std::string new_title)
 {
     title = new_title ;
-    draw();
+    m_changed = true;
+    m_dirty   = true;
 }
 
 std::string CStatusPanel::get_title()
@@ -242,16 +267,38 @@ std::string CStatusPanel::get_title()
 void CStatusPanel::reset()
 {
     m_text.clear();
-    draw();
+    m_first   = 0;
+    m_changed = true;
+    m_dirty   = true;
 }
 
 /**
- * Add a line of text to the display.
+ * Add a line of text to the display, replacing the oldest once our
+ * ring is full.
+ *
+ * We're drawn with the next frame, so that many lines added together
+ * are only drawn once.
  */
-void CStatusPanel::add_text(std::string line)
+void CStatusPanel::add_text(std::string text)
 {
-    m_text.push_back(line);
-    draw();
+    int capacity = CConfig::instance()->get_integer(g_history_key, PANEL_HISTORY);
+
+    if (capacity < 1)
+        capacity = 1;
+
+    if ((size_t)capacity != m_capacity)
+        set_capacity(capacity);
+
+    if (m_text.size() < m_capacity)
+        m_text.push_back(text);
+    else
+    {
+        m_text[m_first] = text;
+        m_first = (m_first + 1) % m_text.size();
+    }
+
+    m_changed = true;
+    m_dirty   = true;
 }
 
 /**
@@ -259,5 +306,44 @@ void CStatusPanel::add_text(std::string line)
  */
 std::vector<std::string> CStatusPanel::get_text()
 {
-    return (m_text);
+    std::vector<std::string> result;
+    result.reserve(m_text.size());
+
+    for (size_t i = 0; i < m_text.size(); i++)
+        result.push_back(line(i));
+
+    return (result);
+}
+
+/**
+ * Get the given line of our text.
+ */
+const std::string &CStatusPanel::line(size_t n)
+{
+    return (m_text[(m_first + n) % m_text.size()]);
+}
+
+/**
+ * Resize our ring, keeping the most recent lines.
+ */
+void CStatusPanel::set_capacity(size_t capacity)
+{
+    std::vector<std::string> lines = get_text();
+
+    if (lines.size() > capacity)
+        lines.erase(lines.begin(), lines.end() - capacity);
+
+    m_text.swap(lines);
+    m_first    = 0;
+    m_capacity = capacity;
+}
+
+/**
+ * Has the panel changed since we were last asked?
+ */
+bool CStatusPanel::changed()
+{
+    bool ret = m_changed;
+    m_changed = false;
+    return (ret);
 }
@@ -26,6 +26,13 @@
 #include "screen.h"
 
 
+/**
+ * The number of lines of text we keep, unless `panel.history` says
+ * otherwise.
+ */
+#define PANEL_HISTORY 500
+
+
 /**
  * The status-panel is a singleton object which draws text at the
  * foot of our main screen.
@@ -46,6 +53,9 @@
  *    draw operation.  THis handles the terminal resizing, without having
  *    to respond to KEY_RESIZE or SIGWINCH signals.
  *
+ * Our text is kept in a ring of `panel.history` lines, so the oldest
+ * are forgotten as new ones arrive, and the window is only drawn again
+ * once our text, our title, or our size, has changed.
  */
 class CStatusPanel : public Singleton<CStatusPanel>
 {
@@ -116,10 +126,29 @@ public:
     void add_text(std::string line);
 
     /**
-     * Get the text we're displaying.
+     * Get the text we're displaying, oldest first.
      */
     std::vector<std::string> get_text();
 
+    /**
+     * Has our text, title, or visibility changed since this was last
+     * called?
+     */
+    bool changed();
+
+private:
+
+    /**
+     * Get the given line of our text, counting from the oldest.
+     */
+    const std::string &line(size_t n);
+
+    /**
+     * Resize our ring to hold the given number of lines, keeping the
+     * most recent.
+     */
+    void set_capacity(size_t capacity);
+
 private:
 
 
@@ -129,15 +158,31 @@ private:
     int m_height;
 
     /**
-     * The text the panel contains.
+     * The text the panel contains, as a ring of at most `m_capacity`
+     * lines, the oldest of which is at `m_first`.
      */
     std::vector < std::string > m_text;
+    size_t m_first = 0;
+    size_t m_capacity = PANEL_HISTORY;
+
+    /**
+     * Must our window be drawn again, and the size it was last drawn
+     * at.
+     */
+    bool m_dirty = true;
+    int m_drawn_width = 0;
+    int m_drawn_height = 0;
 
     /**
      * The title of the panel.
      */
     std::string title;
 
+    /**
+     * Set when we change, and cleared by `changed()`.
+     */
+    bool m_changed = true;
+
     /**
      * The window.
      */
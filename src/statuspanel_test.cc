@@ -19,6 +19,7 @@
 
 
 
+#include "config.h"
 #include "statuspanel.h"
 #include "CuTest.h"
 
@@ -71,11 +72,55 @@ void TestStatusPanelAppend(CuTest * tc)
 }
 
 
+/**
+ * Test that only the most recent lines are kept.
+ */
+void TestStatusPanelHistory(CuTest * tc)
+{
+    CStatusPanel *panel = CStatusPanel::instance();
+    CConfig *config = CConfig::instance();
+
+    panel->reset();
+    config->set("panel.history", 3);
+
+    for (int i = 1; i <= 5; i++)
+        panel->add_text("Line " + std::to_string(i));
+
+    std::vector<std::string> lines = panel->get_text();
+    CuAssertIntEquals(tc, 3, lines.size());
+    CuAssertStrEquals(tc, "Line 3", lines[0].c_str());
+    CuAssertStrEquals(tc, "Line 5", lines[2].c_str());
+
+    /*
+     * Growing the ring keeps what we have, shrinking it keeps the most
+     * recent lines.
+     */
+    config->set("panel.history", 4);
+    panel->add_text("Line 6");
+
+    lines = panel->get_text();
+    CuAssertIntEquals(tc, 4, lines.size());
+    CuAssertStrEquals(tc, "Line 3", lines[0].c_str());
+    CuAssertStrEquals(tc, "Line 6", lines[3].c_str());
+
+    config->set("panel.history", 2);
+    panel->add_text("Line 7");
+
+    lines = panel->get_text();
+    CuAssertIntEquals(tc, 2, lines.size());
+    CuAssertStrEquals(tc, "Line 6", lines[0].c_str());
+    CuAssertStrEquals(tc, "Line 7", lines[1].c_str());
+
+    config->delete_key("panel.history");
+    panel->reset();
+}
+
 
 CuSuite *
 statuspanel_getsuite()
 {
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, TestStatusPanelAppend);
+    SUITE_ADD_TEST(suite, TestStatusPanelHistory);
     return suite;
 }
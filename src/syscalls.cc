@@ -0,0 +1,52 @@
+/*
+ * syscalls.cc - Counted wrappers around the file-system calls we make.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include "syscalls.h"
+
+
+/*
+ * The number of calls of each type.
+ */
+std::atomic<uint64_t> CSyscalls::m_counts[SYSCALL_MAX];
+
+
+/*
+ * The number of calls of the given type.
+ */
+uint64_t CSyscalls::count(int call)
+{
+    if ((call < 0) || (call >= SYSCALL_MAX))
+        return 0;
+
+    return (m_counts[call].load(std::memory_order_relaxed));
+}
+
+
+/*
+ * The number of calls of every type.
+ */
+uint64_t CSyscalls::total()
+{
+    uint64_t sum = 0;
+
+    for (int i = 0; i < SYSCALL_MAX; i++)
+        sum += m_counts[i].load(std::memory_order_relaxed);
+
+    return (sum);
+}
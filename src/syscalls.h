@@ -0,0 +1,125 @@
+/*
+ * syscalls.h - Counted wrappers around the file-system calls we make.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <atomic>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ * The calls we count.
+ *
+ * `SYSCALL_OPEN` includes directories opened for listing - the reads of
+ * their entries are batched by the C library, so aren't counted.
+ */
+#define SYSCALL_STAT   0
+#define SYSCALL_OPEN   1
+#define SYSCALL_RENAME 2
+#define SYSCALL_UNLINK 3
+#define SYSCALL_MAX    4
+
+
+/**
+ * This class wraps the system-calls which `CFile`, `CDirectory`, and
+ * `CMaildir` make for each message, counting them, so that the test
+ * suite can hold them to a budget - such as a number of calls for each
+ * message listed.
+ *
+ * The counts are shared by every thread, and only ever increase, so a
+ * caller measures the difference between two readings.  Each call costs
+ * a single relaxed increment over the call it wraps.
+ */
+class CSyscalls
+{
+public:
+
+    static int stat(const char *path, struct stat *sb)
+    {
+        counted(SYSCALL_STAT);
+        return (::stat(path, sb));
+    };
+
+    static int fstatat(int dfd, const char *path, struct stat *sb, int flags)
+    {
+        counted(SYSCALL_STAT);
+        return (::fstatat(dfd, path, sb, flags));
+    };
+
+    static int open(const char *path, int flags, mode_t mode = 0)
+    {
+        counted(SYSCALL_OPEN);
+        return (::open(path, flags, mode));
+    };
+
+    static int openat(int dfd, const char *path, int flags, mode_t mode = 0)
+    {
+        counted(SYSCALL_OPEN);
+        return (::openat(dfd, path, flags, mode));
+    };
+
+    static DIR *opendir(const char *path)
+    {
+        counted(SYSCALL_OPEN);
+        return (::opendir(path));
+    };
+
+    static int rename(const char *src, const char *dst)
+    {
+        counted(SYSCALL_RENAME);
+        return (::rename(src, dst));
+    };
+
+    static int unlink(const char *path)
+    {
+        counted(SYSCALL_UNLINK);
+        return (::unlink(path));
+    };
+
+    /**
+     * The number of calls of the given type made so far.
+     */
+    static uint64_t count(int call);
+
+    /**
+     * The number of calls of every type made so far.
+     */
+    static uint64_t total();
+
+private:
+
+    /**
+     * Count a call of the given type.
+     */
+    static void counted(int call)
+    {
+        m_counts[call].fetch_add(1, std::memory_order_relaxed);
+    };
+
+    /**
+     * The number of calls of each type.
+     */
+    static std::atomic<uint64_t> m_counts[SYSCALL_MAX];
+};
@@ -0,0 +1,115 @@
+/*
+ * syscalls_test.cc - Test-cases for our counted calls, and allocations.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <memory>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "allocations.h"
+#include "syscalls.h"
+#include "CuTest.h"
+
+
+/**
+ * Test that each type of call is counted.
+ */
+void TestSyscallsCounted(CuTest * tc)
+{
+    char tmpl[] = "/tmp/syscalls.XXXXXX";
+    CuAssertPtrNotNull(tc, mkdtemp(tmpl));
+
+    std::string dir = tmpl;
+    std::string a = dir + "/a";
+    std::string b = dir + "/b";
+
+    uint64_t total = CSyscalls::total();
+    uint64_t stats = CSyscalls::count(SYSCALL_STAT);
+    uint64_t opens = CSyscalls::count(SYSCALL_OPEN);
+
+    struct stat sb;
+    CuAssertIntEquals(tc, -1, CSyscalls::stat(a.c_str(), &sb));
+
+    int fd = CSyscalls::open(a.c_str(), O_WRONLY | O_CREAT, 0600);
+    CuAssertTrue(tc, fd != -1);
+    close(fd);
+
+    CuAssertIntEquals(tc, 0, CSyscalls::stat(a.c_str(), &sb));
+    CuAssertIntEquals(tc, 0, CSyscalls::rename(a.c_str(), b.c_str()));
+    CuAssertIntEquals(tc, 0, CSyscalls::unlink(b.c_str()));
+
+    CuAssertIntEquals(tc, 2, CSyscalls::count(SYSCALL_STAT) - stats);
+    CuAssertIntEquals(tc, 1, CSyscalls::count(SYSCALL_OPEN) - opens);
+    CuAssertIntEquals(tc, 5, CSyscalls::total() - total);
+    CuAssertIntEquals(tc, 0, CSyscalls::count(SYSCALL_MAX));
+
+    rmdir(tmpl);
+}
+
+
+/**
+ * Test that allocations are counted upon the thread which made them.
+ */
+void TestAllocationsCounted(CuTest * tc)
+{
+#ifdef DEBUG
+    uint64_t count = CAllocations::count();
+    uint64_t bytes = CAllocations::bytes();
+
+    std::unique_ptr<std::vector<char> > v(new std::vector<char>(1000));
+
+    CuAssertIntEquals(tc, 2, CAllocations::count() - count);
+    CuAssertTrue(tc, CAllocations::bytes() - bytes >= 1000);
+
+    /*
+     * Those of other threads aren't ours.
+     */
+    count = CAllocations::count();
+
+    uint64_t theirs = 0;
+    std::thread worker([&theirs]()
+    {
+        uint64_t before = CAllocations::count();
+        std::vector<std::string *> strings;
+
+        for (int i = 0; i < 100; i++)
+            strings.push_back(new std::string(64, 'x'));
+
+        for (std::string *s : strings)
+            delete s;
+
+        theirs = CAllocations::count() - before;
+    });
+    worker.join();
+
+    CuAssertTrue(tc, theirs >= 200);
+    CuAssertTrue(tc, CAllocations::count() - count < 10);
+#endif
+}
+
+
+CuSuite *
+syscalls_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestSyscallsCounted);
+    SUITE_ADD_TEST(suite, TestAllocationsCounted);
+    return suite;
+}
@@ -21,32 +21,137 @@
 
 #include "CuTest.h"
 
+/* defined in approxidate_test.cc */
+CuSuite *approxidate_getsuite();
+
+/* defined in bytecode_cache_test.cc */
+CuSuite *bytecode_cache_getsuite();
+
+/* defined in cache_test.cc */
+CuSuite *cache_getsuite();
+
 /* defined in config_test.cc */
 CuSuite *config_getsuite();
 
 /* defined in colour_string_test.cc */
 CuSuite *coloured_string_getsuite();
 
+/* defined in compression_test.cc */
+CuSuite *compression_getsuite();
+
 /* defined in directory_test.cc */
 CuSuite *directory_getsuite();
 
+/* defined in durability_test.cc */
+CuSuite *durability_getsuite();
+
 /* defined in file_test.cc */
 CuSuite *file_getsuite();
 
+/* defined in format_template_test.cc */
+CuSuite *format_template_getsuite();
+
+/* defined in frame_stats_test.cc */
+CuSuite *frame_stats_getsuite();
+
+/* defined in fuzzy_matcher_test.cc */
+CuSuite *fuzzy_matcher_getsuite();
+
 /* defined in history_test.cc */
 CuSuite *history_getsuite();
 
+/* defined in host_identity_test.cc */
+CuSuite *host_identity_getsuite();
+
+/* defined in imap_cache_test.cc */
+CuSuite *imap_cache_getsuite();
+
+/* defined in imap_sync_test.cc */
+CuSuite *imap_sync_getsuite();
+
+/* defined in intern_test.cc */
+CuSuite *intern_getsuite();
+
+/* defined in job_queue_test.cc */
+CuSuite *job_queue_getsuite();
+
+/* defined in json_stream_test.cc */
+CuSuite *json_stream_getsuite();
+
 /* defined in input_queue_test.cc */
 CuSuite *input_queue_getsuite();
 
+/* defined in key_trie_test.cc */
+CuSuite *key_trie_getsuite();
+
 /* defined in lua_test.cc */
 CuSuite *lua_getsuite();
 
 /* defined in logfile_test.cc */
 CuSuite *logfile_getsuite();
 
+/* defined in maildir_grep_test.cc */
+CuSuite *maildir_grep_getsuite();
+
+/* defined in maildir_summary_test.cc */
+CuSuite *maildir_summary_getsuite();
+
+/* defined in mbox_test.cc */
+CuSuite *mbox_getsuite();
+
+/* defined in message_test.cc */
+CuSuite *message_getsuite();
+
+/* defined in message_arena_test.cc */
+CuSuite *message_arena_getsuite();
+
+/* defined in message_id_index_test.cc */
+CuSuite *message_id_index_getsuite();
+
+/* defined in message_replace_test.cc */
+CuSuite *message_replace_getsuite();
+
+/* defined in message_columns_test.cc */
+CuSuite *message_columns_getsuite();
+
+/* defined in message_selection_test.cc */
+CuSuite *message_selection_getsuite();
+
+/* defined in message_threader_test.cc */
+CuSuite *message_threader_getsuite();
+
+/* defined in mime_test.cc */
+CuSuite *mime_getsuite();
+
+/* defined in profiler_test.cc */
+CuSuite *profiler_getsuite();
+
+/* defined in regexp_test.cc */
+CuSuite *regexp_getsuite();
+
+/* defined in search_index_test.cc */
+CuSuite *search_index_getsuite();
+
+/* defined in sort_order_test.cc */
+CuSuite *sort_order_getsuite();
+
+/* defined in startup_timings_test.cc */
+CuSuite *startup_timings_getsuite();
+
 /* defined in statuspanel_test.cc */
 CuSuite *statuspanel_getsuite();
 
+/* defined in syscalls_test.cc */
+CuSuite *syscalls_getsuite();
+
+/* defined in text_lines_test.cc */
+CuSuite *text_lines_getsuite();
+
+/* defined in timer_wheel_test.cc */
+CuSuite *timer_wheel_getsuite();
+
 /* defined in util_test.cc */
 CuSuite *util_getsuite();
+
+/* defined in virtual_folder_test.cc */
+CuSuite *virtual_folder_getsuite();
@@ -0,0 +1,93 @@
+/*
+ * text_lines.cc - A body of text, indexed by line.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string.h>
+
+#include "text_lines.h"
+
+
+/*
+ * Constructor - find the start of each line.
+ */
+CTextLines::CTextLines(const std::string &text) : m_text(text)
+{
+    const char *start = m_text.data();
+    const char *end   = start + m_text.size();
+    const char *p     = start;
+
+    m_starts.push_back(0);
+
+    while (p < end)
+    {
+        const char *nl = (const char *) memchr(p, '\n', end - p);
+
+        if (nl == NULL)
+            break;
+
+        m_starts.push_back(nl - start + 1);
+        p = nl + 1;
+    }
+
+    m_starts.push_back(m_text.size());
+}
+
+
+/*
+ * The number of lines.
+ */
+size_t CTextLines::count() const
+{
+    return (m_starts.size() - 1);
+}
+
+
+/*
+ * Get the given line, without its line-ending.
+ */
+std::string CTextLines::line(size_t index) const
+{
+    if (index >= count())
+        return "";
+
+    size_t start = m_starts[index];
+    size_t end   = m_starts[index + 1];
+
+    /*
+     * Every line but the last ends with a newline, and perhaps a
+     * carriage-return before it.
+     */
+    if (index + 1 < count())
+    {
+        end--;
+
+        if ((end > start) && (m_text[end - 1] == '\r'))
+            end--;
+    }
+
+    return (m_text.substr(start, end - start));
+}
+
+
+/*
+ * The size of our text.
+ */
+size_t CTextLines::size() const
+{
+    return (m_text.size());
+}
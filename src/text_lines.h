@@ -0,0 +1,76 @@
+/*
+ * text_lines.h - A body of text, indexed by line.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+/**
+ * This class holds a body of text, such as the decoded body of a message,
+ * along with the offset at which each of its lines begins.
+ *
+ * Any range of lines may then be fetched in time proportional to the size
+ * of the range, rather than that of the text, so that a view need only
+ * format the lines it is about to draw.
+ *
+ * Lines are split as `string.to_table` splits them: upon newlines, with
+ * any carriage-return before each removed, and whatever follows the last
+ * newline as the final line.
+ */
+class CTextLines
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CTextLines(const std::string &text);
+
+    /**
+     * The number of lines.
+     */
+    size_t count() const;
+
+    /**
+     * Get the line with the given (zero-based) index.
+     */
+    std::string line(size_t index) const;
+
+    /**
+     * The size of our text, in bytes.
+     */
+    size_t size() const;
+
+private:
+
+    /**
+     * Our text.
+     */
+    std::string m_text;
+
+    /**
+     * The offset of the start of each line, followed by that of the end
+     * of the text.
+     */
+    std::vector<size_t> m_starts;
+};
@@ -0,0 +1,61 @@
+/*
+ * text_lines_test.cc - Test-cases for our line-indexed text.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <cstddef>
+#include <string>
+
+#include "text_lines.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test we split lines as `string.to_table` does.
+ */
+void TestTextLines(CuTest * tc)
+{
+    CTextLines empty("");
+    CuAssertIntEquals(tc, 1, empty.count());
+    CuAssertStrEquals(tc, "", empty.line(0).c_str());
+
+    CTextLines text("One\r\nTwo\n\nThree\r");
+    CuAssertIntEquals(tc, 4, text.count());
+    CuAssertStrEquals(tc, "One", text.line(0).c_str());
+    CuAssertStrEquals(tc, "Two", text.line(1).c_str());
+    CuAssertStrEquals(tc, "", text.line(2).c_str());
+    CuAssertStrEquals(tc, "Three\r", text.line(3).c_str());
+    CuAssertStrEquals(tc, "", text.line(4).c_str());
+
+    /*
+     * A trailing newline leaves an empty last line.
+     */
+    CTextLines trailing("a\nb\n");
+    CuAssertIntEquals(tc, 3, trailing.count());
+    CuAssertStrEquals(tc, "b", trailing.line(1).c_str());
+    CuAssertStrEquals(tc, "", trailing.line(2).c_str());
+    CuAssertIntEquals(tc, 4, trailing.size());
+}
+
+
+CuSuite *
+text_lines_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestTextLines);
+    return suite;
+}
@@ -0,0 +1,226 @@
+/*
+ * text_lua.cc - Export bodies of text, indexed by line, to Lua.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <memory>
+#include <string>
+
+#include "lua.h"
+#include "text_lines.h"
+
+
+/**
+ * @file text_lua.cc
+ *
+ * This file allows a large body of text to be held natively, indexed by
+ * line, so that Lua may fetch just the lines it is about to draw rather
+ * than splitting the whole of it into a table:
+ *
+ *<code>
+ * local t = Text.new( "One\nTwo\nThree" )<br/>
+ * print( t:count() )<br/>
+ * for i, line in ipairs( t:lines( 1, 2 ) ) do<br/>
+ *   print( line )<br/>
+ * end<br/>
+ *</code>
+ *
+ */
+
+
+/**
+ * Push a body of text onto the Lua stack.
+ */
+static void push_ctext(lua_State * l, std::shared_ptr<CTextLines> text)
+{
+    void *ud = lua_newuserdata(l, sizeof(std::shared_ptr<CTextLines>));
+
+    if (!ud)
+        return;
+
+    /*
+     * Construct the shared pointer in place, as we do for maildirs.
+     */
+    std::shared_ptr<CTextLines> *udata = new(ud) std::shared_ptr<CTextLines>();
+    *udata = text;
+
+    luaL_getmetatable(l, "luaL_CTextLines");
+    lua_setmetatable(l, -2);
+}
+
+
+/**
+ * Test that the object on the Lua stack is a body of text.
+ */
+static std::shared_ptr<CTextLines> l_CheckCText(lua_State * l, int n)
+{
+    void *ud = luaL_checkudata(l, n, "luaL_CTextLines");
+
+    if (ud)
+        return *(static_cast<std::shared_ptr<CTextLines> *>(ud));
+
+    return std::shared_ptr<CTextLines>();
+}
+
+
+/**
+ * Implementation of Text:new().
+ *
+ * This may be called as `Text.new()` too.
+ */
+int l_CText_new(lua_State * l)
+{
+    CLuaLog("l_CText_new");
+
+    int arg = lua_istable(l, 1) ? 2 : 1;
+
+    size_t len;
+    const char *str = luaL_checklstring(l, arg, &len);
+
+    push_ctext(l, std::make_shared<CTextLines>(std::string(str, len)));
+    return 1;
+}
+
+
+/**
+ * Implementation of text:count()
+ */
+int l_CTextLines_count(lua_State * l)
+{
+    CLuaLog("l_CTextLines_count");
+
+    std::shared_ptr<CTextLines> text = l_CheckCText(l, 1);
+    lua_pushinteger(l, text->count());
+    return 1;
+}
+
+
+/**
+ * Implementation of text:lines()
+ *
+ * Return a table of the `count` lines following the first `offset`.
+ */
+int l_CTextLines_lines(lua_State * l)
+{
+    CLuaLog("l_CTextLines_lines");
+
+    std::shared_ptr<CTextLines> text = l_CheckCText(l, 1);
+    int offset = luaL_checkinteger(l, 2);
+    int count  = luaL_checkinteger(l, 3);
+
+    if (offset < 0)
+    {
+        count += offset;
+        offset = 0;
+    }
+
+    int max = (int) text->count();
+    int end = (count > max - offset) ? max : offset + count;
+
+    lua_createtable(l, (end > offset) ? end - offset : 0, 0);
+
+    for (int i = offset; i < end; i++)
+    {
+        std::string line = text->line(i);
+        lua_pushlstring(l, line.c_str(), line.size());
+        lua_rawseti(l, -2, i - offset + 1);
+    }
+
+    return 1;
+}
+
+
+/**
+ * Implementation of text:size()
+ */
+int l_CTextLines_size(lua_State * l)
+{
+    CLuaLog("l_CTextLines_size");
+
+    std::shared_ptr<CTextLines> text = l_CheckCText(l, 1);
+    lua_pushinteger(l, text->size());
+    return 1;
+}
+
+
+/**
+ * Destructor for bodies of text.
+ */
+int l_CTextLines_destructor(lua_State * l)
+{
+    CLuaLog("l_CTextLines_destructor");
+
+    void *ud = luaL_checkudata(l, 1, "luaL_CTextLines");
+
+    if (ud)
+    {
+        std::shared_ptr<CTextLines> *text = static_cast<std::shared_ptr<CTextLines> *>(ud);
+        text->~shared_ptr<CTextLines>();
+    }
+
+    return 0;
+}
+
+
+/**
+ * Export the `Text` class to Lua.
+ *
+ * Bind the appropriate methods to that object.
+ */
+void InitText(lua_State * l)
+{
+    luaL_Reg sLinesRegs[] =
+    {
+        {"__gc", l_CTextLines_destructor},
+        {"count", l_CTextLines_count},
+        {"lines", l_CTextLines_lines},
+        {"size", l_CTextLines_size},
+        {NULL,       NULL}
+    };
+    luaL_newmetatable(l, "luaL_CTextLines");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sLinesRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sLinesRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_pop(l, 1);
+
+    luaL_Reg sFooRegs[] =
+    {
+        {"new", l_CText_new},
+        {NULL,       NULL}
+    };
+    luaL_newmetatable(l, "luaL_CText");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sFooRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sFooRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_setglobal(l, "Text");
+}
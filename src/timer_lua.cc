@@ -0,0 +1,246 @@
+/*
+ * timer_lua.cc - Export our timer-wheel to Lua.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lua.h"
+#include "timer_wheel.h"
+
+
+/**
+ * @file timer_lua.cc
+ *
+ * This file allows Lua to schedule functions to be called periodically,
+ * or once after a delay, from the main event-loop.
+ *
+ * Lua-usage looks something like this:
+ *
+ *<code>
+ * local id = Timer.every( 60, function() Panel:append("tick") end )<br/>
+ * Timer.after( 5, function() Timer.cancel(id) end )<br/>
+ *</code>
+ *
+ */
+
+
+/**
+ * The Lua function to invoke for each timer, as references into the
+ * registry, by timer ID.
+ */
+static std::unordered_map < int, int > g_callbacks;
+
+
+/**
+ * Forget the callback of the given timer.
+ */
+static void release_callback(lua_State * l, int id)
+{
+    auto it = g_callbacks.find(id);
+
+    if (it == g_callbacks.end())
+        return;
+
+    luaL_unref(l, LUA_REGISTRYINDEX, it->second);
+    g_callbacks.erase(it);
+}
+
+
+/**
+ * Create a timer, with the delay and function given as arguments.
+ *
+ * This may be called with either `Timer.every()` or `Timer:every()`.
+ */
+static int add_timer(lua_State * l, bool periodic)
+{
+    int arg = lua_istable(l, 1) ? 2 : 1;
+
+    lua_Number seconds = luaL_checknumber(l, arg);
+    luaL_checktype(l, arg + 1, LUA_TFUNCTION);
+
+    if (seconds < 0)
+        seconds = 0;
+
+    uint64_t delay = (uint64_t)(seconds * 1000);
+
+    /*
+     * A periodic timer which fired on every tick would never let us
+     * sleep, so we don't allow intervals shorter than one.
+     */
+    if (periodic && (delay < TIMER_RESOLUTION))
+        delay = TIMER_RESOLUTION;
+
+    CTimerWheel *wheel = CTimerWheel::instance();
+    int id = wheel->add(CTimerWheel::now(), delay, periodic ? delay : 0);
+
+    lua_pushvalue(l, arg + 1);
+    g_callbacks[id] = luaL_ref(l, LUA_REGISTRYINDEX);
+
+    lua_pushinteger(l, id);
+    return 1;
+}
+
+
+/**
+ * Implementation of Timer.after().
+ *
+ * Call the given function once, after the given number of seconds, and
+ * return the ID of the new timer.
+ */
+int l_CTimer_after(lua_State * l)
+{
+    CLuaLog("l_CTimer_after");
+
+    return (add_timer(l, false));
+}
+
+
+/**
+ * Implementation of Timer.cancel().
+ *
+ * Cancel the timer with the given ID, returning true if it was pending.
+ */
+int l_CTimer_cancel(lua_State * l)
+{
+    CLuaLog("l_CTimer_cancel");
+
+    int arg = lua_istable(l, 1) ? 2 : 1;
+    int id  = luaL_checkinteger(l, arg);
+
+    CTimerWheel *wheel = CTimerWheel::instance();
+    bool found = wheel->cancel(id);
+
+    release_callback(l, id);
+
+    lua_pushboolean(l, found);
+    return 1;
+}
+
+
+/**
+ * Implementation of Timer.count().
+ *
+ * Return the number of pending timers.
+ */
+int l_CTimer_count(lua_State * l)
+{
+    CLuaLog("l_CTimer_count");
+
+    CTimerWheel *wheel = CTimerWheel::instance();
+    lua_pushinteger(l, wheel->size());
+    return 1;
+}
+
+
+/**
+ * Implementation of Timer.every().
+ *
+ * Call the given function every time the given number of seconds have
+ * passed, until it returns `false` or the timer is cancelled.  Returns
+ * the ID of the new timer.
+ */
+int l_CTimer_every(lua_State * l)
+{
+    CLuaLog("l_CTimer_every");
+
+    return (add_timer(l, true));
+}
+
+
+/**
+ * Invoke the callbacks of all the timers which have expired.
+ *
+ * Errors raised by a callback are passed to `on_error`, rather than
+ * cancelling the timer.
+ */
+void RunTimers(lua_State * l)
+{
+    CTimerWheel *wheel = CTimerWheel::instance();
+
+    std::vector < int > due;
+    wheel->expire(CTimerWheel::now(), due);
+
+    for (int id : due)
+    {
+        /*
+         * An earlier callback might have cancelled this timer.
+         */
+        auto it = g_callbacks.find(id);
+
+        if (it == g_callbacks.end())
+            continue;
+
+        lua_rawgeti(l, LUA_REGISTRYINDEX, it->second);
+
+        bool periodic = wheel->exists(id);
+
+        if (! periodic)
+            release_callback(l, id);
+
+        if (lua_pcall(l, 0, 1, 0) != 0)
+        {
+            std::string err = lua_tostring(l, -1);
+            lua_pop(l, 1);
+
+            CLua *lua = CLua::instance();
+            lua->on_error(err);
+            continue;
+        }
+
+        if (periodic && lua_isboolean(l, -1) && ! lua_toboolean(l, -1))
+        {
+            wheel->cancel(id);
+            release_callback(l, id);
+        }
+
+        lua_pop(l, 1);
+    }
+}
+
+
+/**
+ * Export the `Timer` object to Lua.
+ *
+ * Bind the appropriate methods to that object.
+ */
+void InitTimer(lua_State * l)
+{
+    luaL_Reg sFooRegs[] =
+    {
+        {"after", l_CTimer_after},
+        {"cancel", l_CTimer_cancel},
+        {"count", l_CTimer_count},
+        {"every", l_CTimer_every},
+        {NULL, NULL}
+    };
+    luaL_newmetatable(l, "luaL_CTimer");
+
+#if LUA_VERSION_NUM == 501
+    luaL_register(l, NULL, sFooRegs);
+#elif LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+    luaL_setfuncs(l, sFooRegs, 0);
+#else
+#error We are only tested under Lua 5.1, 5.2, or 5.3.
+#endif
+
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -1, "__index");
+    lua_setglobal(l, "Timer");
+}
@@ -0,0 +1,249 @@
+/*
+ * timer_wheel.cc - A timer-wheel for scheduling periodic, and one-off, jobs.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <chrono>
+
+#include "timer_wheel.h"
+
+
+/*
+ * Constructor.
+ */
+CTimerWheel::CTimerWheel() : m_slots(TIMER_SLOTS)
+{
+    m_tick    = 0;
+    m_next_id = 1;
+}
+
+
+/*
+ * Add a timer which will expire `delay` milliseconds after `now`.
+ */
+int CTimerWheel::add(uint64_t now, uint64_t delay, uint64_t interval)
+{
+    timer_entry entry;
+    entry.id       = m_next_id++;
+    entry.deadline = now + delay;
+    entry.interval = interval;
+
+    /*
+     * Start the wheel turning from the first timer, rather than from the
+     * epoch of the clock.
+     */
+    if (m_index.empty() && (m_tick == 0))
+        m_tick = now / TIMER_RESOLUTION;
+
+    insert(entry);
+    return (entry.id);
+}
+
+
+/*
+ * Place the given timer into the slot for its deadline.
+ */
+void CTimerWheel::insert(timer_entry entry)
+{
+    uint64_t tick = entry.deadline / TIMER_RESOLUTION;
+
+    /*
+     * A timer which is already due goes into the current slot, which is
+     * the first we'll look at.
+     */
+    if (tick < m_tick)
+        tick = m_tick;
+
+    size_t slot = tick % m_slots.size();
+
+    m_slots[slot].push_back(entry);
+    m_index[entry.id] = slot;
+}
+
+
+/*
+ * Cancel the given timer.
+ */
+bool CTimerWheel::cancel(int id)
+{
+    auto it = m_index.find(id);
+
+    if (it == m_index.end())
+        return false;
+
+    std::list < timer_entry > &slot = m_slots[it->second];
+
+    for (auto entry = slot.begin(); entry != slot.end(); ++entry)
+    {
+        if (entry->id == id)
+        {
+            slot.erase(entry);
+            break;
+        }
+    }
+
+    m_index.erase(it);
+    return true;
+}
+
+
+/*
+ * Is the given timer still pending?
+ */
+bool CTimerWheel::exists(int id)
+{
+    return (m_index.find(id) != m_index.end());
+}
+
+
+/*
+ * Collect the timers which have expired by `now`.
+ */
+void CTimerWheel::expire(uint64_t now, std::vector < int > &due)
+{
+    uint64_t now_tick = now / TIMER_RESOLUTION;
+
+    /*
+     * The number of slots which have passed - we revisit the current
+     * one, as it might hold timers due later within this tick.
+     */
+    uint64_t count = 1;
+
+    if (now_tick > m_tick)
+        count = std::min < uint64_t > (now_tick - m_tick + 1, m_slots.size());
+
+    std::vector < timer_entry > fired;
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        std::list < timer_entry > &slot = m_slots[(m_tick + i) % m_slots.size()];
+
+        for (auto entry = slot.begin(); entry != slot.end();)
+        {
+            if (entry->deadline <= now)
+            {
+                fired.push_back(*entry);
+                m_index.erase(entry->id);
+                entry = slot.erase(entry);
+            }
+            else
+                ++entry;
+        }
+    }
+
+    if (now_tick > m_tick)
+        m_tick = now_tick;
+
+    std::stable_sort(fired.begin(), fired.end(), [](const timer_entry & a, const timer_entry & b)
+    {
+        return (a.deadline < b.deadline);
+    });
+
+    for (timer_entry entry : fired)
+    {
+        due.push_back(entry.id);
+
+        if (entry.interval == 0)
+            continue;
+
+        /*
+         * If we've fallen far behind, perhaps because the host was
+         * suspended, run a periodic timer once rather than once for
+         * each interval we missed.
+         */
+        entry.deadline += entry.interval;
+
+        if (entry.deadline <= now)
+            entry.deadline = now + entry.interval;
+
+        insert(entry);
+    }
+}
+
+
+/*
+ * The number of milliseconds until the next timer expires.
+ */
+int64_t CTimerWheel::next_deadline(uint64_t now)
+{
+    if (m_index.empty())
+        return -1;
+
+    bool found = false;
+    uint64_t deadline = 0;
+
+    /*
+     * Walk forward from the current slot, looking for a timer due in
+     * this revolution of the wheel.
+     */
+    for (uint64_t i = 0; (i < m_slots.size()) && (! found); i++)
+    {
+        uint64_t end = (m_tick + i + 1) * TIMER_RESOLUTION;
+
+        for (const timer_entry &entry : m_slots[(m_tick + i) % m_slots.size()])
+        {
+            if ((entry.deadline < end) && ((! found) || (entry.deadline < deadline)))
+            {
+                deadline = entry.deadline;
+                found = true;
+            }
+        }
+    }
+
+    /*
+     * Every timer is at least a revolution away, so look at them all.
+     */
+    if (! found)
+    {
+        for (const std::list < timer_entry > &slot : m_slots)
+        {
+            for (const timer_entry &entry : slot)
+            {
+                if ((! found) || (entry.deadline < deadline))
+                {
+                    deadline = entry.deadline;
+                    found = true;
+                }
+            }
+        }
+    }
+
+    if (deadline <= now)
+        return 0;
+
+    return (deadline - now);
+}
+
+
+/*
+ * The number of pending timers.
+ */
+size_t CTimerWheel::size()
+{
+    return (m_index.size());
+}
+
+
+/*
+ * The current time, in milliseconds, from a monotonic clock.
+ */
+uint64_t CTimerWheel::now()
+{
+    auto since = std::chrono::steady_clock::now().time_since_epoch();
+    return (std::chrono::duration_cast<std::chrono::milliseconds>(since).count());
+}
@@ -0,0 +1,149 @@
+/*
+ * timer_wheel.h - A timer-wheel for scheduling periodic, and one-off, jobs.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <list>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "singleton.h"
+
+
+/**
+ * The length of a single tick of the wheel, in milliseconds.
+ */
+#define TIMER_RESOLUTION 50
+
+
+/**
+ * The number of slots in the wheel.  Timers further in the future than
+ * a single revolution wait in their slot for later rounds.
+ */
+#define TIMER_SLOTS 512
+
+
+/**
+ * A hashed timer-wheel.
+ *
+ * Each timer lives in the slot for the tick in which it expires, so
+ * adding and cancelling timers is cheap, and expiring them only visits
+ * the slots which have passed since we last looked.
+ *
+ * Timers are identified by the integers `add` returns; what is done when
+ * they expire is up to the caller.  All times are in milliseconds, and
+ * are passed in explicitly so that the wheel may be tested without
+ * waiting for real time to pass - `CTimerWheel::now()` gives the current
+ * time from a monotonic clock.
+ */
+class CTimerWheel : public Singleton<CTimerWheel>
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CTimerWheel();
+
+    /**
+     * Add a timer which will expire `delay` milliseconds after `now`.
+     *
+     * If `interval` is non-zero the timer is periodic, and will be
+     * rescheduled each time it expires.
+     *
+     * Returns the ID of the new timer.
+     */
+    int add(uint64_t now, uint64_t delay, uint64_t interval = 0);
+
+    /**
+     * Cancel the given timer.  Returns false if it didn't exist.
+     */
+    bool cancel(int id);
+
+    /**
+     * Is the given timer still pending?
+     */
+    bool exists(int id);
+
+    /**
+     * Append the IDs of all the timers which have expired by `now` to the
+     * given vector, in the order of their deadlines.
+     *
+     * One-off timers are removed, periodic ones are rescheduled.
+     */
+    void expire(uint64_t now, std::vector < int > &due);
+
+    /**
+     * The number of milliseconds from `now` until the next timer expires,
+     * zero if one already has, or -1 if there are no timers.
+     */
+    int64_t next_deadline(uint64_t now);
+
+    /**
+     * The number of pending timers.
+     */
+    size_t size();
+
+    /**
+     * The current time, in milliseconds, from a monotonic clock.
+     */
+    static uint64_t now();
+
+private:
+
+    /**
+     * A single timer.
+     */
+    typedef struct _timer_entry
+    {
+        int id;
+        uint64_t deadline;
+        uint64_t interval;
+    } timer_entry;
+
+    /**
+     * Place the given timer into the slot for its deadline.
+     */
+    void insert(timer_entry entry);
+
+private:
+
+    /**
+     * The slots of the wheel.
+     */
+    std::vector < std::list < timer_entry > > m_slots;
+
+    /**
+     * The slot each pending timer lives in, by ID.
+     */
+    std::unordered_map < int, size_t > m_index;
+
+    /**
+     * The tick we have expired timers up to.
+     */
+    uint64_t m_tick;
+
+    /**
+     * The ID of the next timer to be added.
+     */
+    int m_next_id;
+};
@@ -0,0 +1,141 @@
+/*
+ * timer_wheel_test.cc - Test-cases for our timer-wheel.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+#include <cstddef>
+#include <vector>
+
+#include "timer_wheel.h"
+#include "CuTest.h"
+
+
+
+/**
+ * Test one-off timers expire once, in the order of their deadlines.
+ */
+void TestTimerWheelAfter(CuTest * tc)
+{
+    CTimerWheel wheel;
+    std::vector < int > due;
+
+    CuAssertIntEquals(tc, -1, wheel.next_deadline(0));
+
+    int late  = wheel.add(1000, 900);
+    int early = wheel.add(1000, 120);
+
+    CuAssertIntEquals(tc, 2, wheel.size());
+    CuAssertIntEquals(tc, 120, wheel.next_deadline(1000));
+
+    wheel.expire(1100, due);
+    CuAssertIntEquals(tc, 0, due.size());
+
+    /*
+     * Both expire in the same call, earliest first.
+     */
+    wheel.expire(2000, due);
+    CuAssertIntEquals(tc, 2, due.size());
+    CuAssertIntEquals(tc, early, due[0]);
+    CuAssertIntEquals(tc, late, due[1]);
+    CuAssertIntEquals(tc, 0, wheel.size());
+    CuAssertTrue(tc, ! wheel.exists(early));
+
+    /*
+     * A timer due within the current tick isn't lost.
+     */
+    due.clear();
+    wheel.add(2000, 10);
+    wheel.expire(2005, due);
+    CuAssertIntEquals(tc, 0, due.size());
+    wheel.expire(2010, due);
+    CuAssertIntEquals(tc, 1, due.size());
+}
+
+
+/**
+ * Test periodic timers, and cancelling them.
+ */
+void TestTimerWheelEvery(CuTest * tc)
+{
+    CTimerWheel wheel;
+    std::vector < int > due;
+
+    int id = wheel.add(0, 1000, 1000);
+
+    for (int i = 1; i <= 3; i++)
+    {
+        due.clear();
+        wheel.expire(i * 1000, due);
+        CuAssertIntEquals(tc, 1, due.size());
+        CuAssertIntEquals(tc, id, due[0]);
+        CuAssertTrue(tc, wheel.exists(id));
+        CuAssertIntEquals(tc, 1000, wheel.next_deadline(i * 1000));
+    }
+
+    /*
+     * After a long sleep we run once, not once for every missed interval.
+     */
+    due.clear();
+    wheel.expire(60000, due);
+    CuAssertIntEquals(tc, 1, due.size());
+    CuAssertIntEquals(tc, 1000, wheel.next_deadline(60000));
+
+    CuAssertTrue(tc, wheel.cancel(id));
+    CuAssertTrue(tc, ! wheel.cancel(id));
+    CuAssertIntEquals(tc, 0, wheel.size());
+
+    due.clear();
+    wheel.expire(120000, due);
+    CuAssertIntEquals(tc, 0, due.size());
+}
+
+
+/**
+ * Test timers more than a revolution of the wheel away.
+ */
+void TestTimerWheelFar(CuTest * tc)
+{
+    CTimerWheel wheel;
+    std::vector < int > due;
+
+    uint64_t far = (TIMER_SLOTS * TIMER_RESOLUTION) * 3 + 70;
+
+    wheel.add(0, far);
+    CuAssertIntEquals(tc, far, wheel.next_deadline(0));
+
+    /*
+     * Passing its slot in earlier revolutions doesn't expire it.
+     */
+    for (uint64_t now = 0; now < far; now += 1000)
+    {
+        wheel.expire(now, due);
+        CuAssertIntEquals(tc, 0, due.size());
+    }
+
+    wheel.expire(far, due);
+    CuAssertIntEquals(tc, 1, due.size());
+}
+
+
+CuSuite *
+timer_wheel_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestTimerWheelAfter);
+    SUITE_ADD_TEST(suite, TestTimerWheelEvery);
+    SUITE_ADD_TEST(suite, TestTimerWheelFar);
+    return suite;
+}
@@ -19,11 +19,18 @@
 
 #include <cstdlib>
 #include <memory>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "util.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 
 
 /*
@@ -106,3 +113,55 @@ int dsutil_utf8_charlen(const unsigned char  c)
 
     return 1;
 }
+
+
+/*
+ * Return the length of the plain ASCII prefix of the given text.
+ */
+size_t dsutil_ascii_span(const char *text, size_t len)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+
+    /*
+     * The top bit of each byte gives us a mask of the non-ASCII ones.
+     */
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+        int mask = _mm_movemask_epi8(chunk);
+
+        if (mask != 0)
+            return (i + __builtin_ctz(mask));
+    }
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+    for (; i + 16 <= len; i += 16)
+    {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)(text + i));
+
+        if (vmaxvq_u8(chunk) >= 0x80)
+            break;
+    }
+
+#endif
+
+    /*
+     * Eight bytes at a time, with the top bit of each masked.
+     */
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, text + i, sizeof(word));
+
+        if (word & 0x8080808080808080ULL)
+            break;
+    }
+
+    while ((i < len) && ((unsigned char) text[i] < 0x80))
+        i++;
+
+    return (i);
+}
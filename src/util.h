@@ -69,3 +69,12 @@ std::string escape_filename(std::string path);
  * in a UTF-8 string.
  */
 int dsutil_utf8_charlen(const unsigned char  c);
+
+/**
+ * Return the number of bytes at the start of the given text which are
+ * plain ASCII, and so needn't be decoded.
+ *
+ * This examines sixteen bytes at a time with SSE2, or NEON, where they're
+ * available, and eight at a time otherwise.
+ */
+size_t dsutil_ascii_span(const char *text, size_t len);
@@ -121,11 +121,35 @@ void TestEscape(CuTest * tc)
 
 
 
+/**
+ * Test we find the plain ASCII prefix of text, of every length and
+ * alignment.
+ */
+void TestAsciiSpan(CuTest * tc)
+{
+    CuAssertIntEquals(tc, 0, dsutil_ascii_span("", 0));
+
+    std::string text(70, 'x');
+
+    CuAssertIntEquals(tc, 70, dsutil_ascii_span(text.data(), text.size()));
+
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        std::string copy = text;
+        copy[i] = (char) 0xc3;
+
+        CuAssertIntEquals(tc, i, dsutil_ascii_span(copy.data(), copy.size()));
+        CuAssertIntEquals(tc, 0, dsutil_ascii_span(copy.data() + i, copy.size() - i));
+    }
+}
+
+
 CuSuite *
 util_getsuite()
 {
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, TestSplit);
     SUITE_ADD_TEST(suite, TestEscape);
+    SUITE_ADD_TEST(suite, TestAsciiSpan);
     return suite;
 }
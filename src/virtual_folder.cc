@@ -0,0 +1,563 @@
+/*
+ * virtual_folder.cc - A saved search, maintained as its folders change.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <algorithm>
+#include <fnmatch.h>
+#include <sstream>
+#include <stdlib.h>
+
+#include "logger.h"
+#include "maildir.h"
+#include "message_arena.h"
+#include "message_sort.h"
+#include "virtual_folder.h"
+
+
+/*
+ * How often, in seconds, the messages we hold are tested against any
+ * terms which concern their age.
+ */
+#define VIRTUAL_AGE_INTERVAL 60
+
+
+/*
+ * Constructor.
+ */
+CVirtualFolder::CVirtualFolder(std::string name, std::string folders, std::string query)
+{
+    m_name       = name;
+    m_folders    = folders;
+    m_query      = query;
+    m_generation = 1;
+    m_merged_generation = 0;
+    m_tested     = 0;
+    m_dated      = false;
+
+    std::string error;
+    parse(query, m_terms, error);
+
+    for (virtual_term term : m_terms)
+    {
+        if (term.type == VIRTUAL_DAYS)
+            m_dated = true;
+    }
+}
+
+
+/*
+ * Destructor.
+ */
+CVirtualFolder::~CVirtualFolder()
+{
+}
+
+
+/*
+ * Parse the given query into its terms.
+ */
+bool CVirtualFolder::parse(std::string query, std::vector<virtual_term> &terms, std::string &error)
+{
+    terms.clear();
+
+    std::istringstream words(query);
+    std::string word;
+
+    while (words >> word)
+    {
+        virtual_term term;
+        term.type = VIRTUAL_HEADER;
+        term.days = 0;
+
+        std::string lower = word;
+        std::transform(lower.begin(), lower.end(), lower.begin(), tolower);
+
+        if (lower == "all")
+            continue;
+
+        if ((lower == "new") || (lower == "unread"))
+            term.type = VIRTUAL_NEW;
+        else if (lower == "attach")
+            term.type = VIRTUAL_ATTACH;
+        else if (lower == "today")
+        {
+            term.type = VIRTUAL_DAYS;
+            term.days = 1;
+        }
+        else
+        {
+            size_t colon = lower.find(':');
+
+            if ((colon == 0) || (colon == std::string::npos) || (colon + 1 == lower.size()))
+            {
+                error = "Invalid term '" + word + "' - expected 'name:value'.";
+                return false;
+            }
+
+            term.name = lower.substr(0, colon);
+            term.text = lower.substr(colon + 1);
+
+            if (term.name == "days")
+            {
+                term.type = VIRTUAL_DAYS;
+                term.days = atoi(term.text.c_str());
+
+                if (term.days <= 0)
+                {
+                    error = "Invalid term '" + word + "' - expected a number of days.";
+                    return false;
+                }
+            }
+        }
+
+        terms.push_back(term);
+    }
+
+    return true;
+}
+
+
+/*
+ * Our name.
+ */
+std::string CVirtualFolder::name()
+{
+    return (m_name);
+}
+
+
+/*
+ * The pattern of the folders we search.
+ */
+std::string CVirtualFolder::folders()
+{
+    return (m_folders);
+}
+
+
+/*
+ * Our query.
+ */
+std::string CVirtualFolder::query()
+{
+    return (m_query);
+}
+
+
+/*
+ * Does the given maildir match our pattern, or any of them?
+ *
+ * Patterns containing a "/" are matched against the whole path, others
+ * against the name of the folder.
+ */
+bool CVirtualFolder::searches(const std::string &path)
+{
+    std::string p = path;
+
+    while ((p.size() > 1) && (p[p.size() - 1] == '/'))
+        p.erase(p.size() - 1);
+
+    std::string name = p;
+    size_t slash = p.rfind('/');
+
+    if (slash != std::string::npos)
+        name = p.substr(slash + 1);
+
+    std::istringstream patterns(m_folders);
+    std::string pattern;
+
+    while (std::getline(patterns, pattern, ','))
+    {
+        pattern.erase(0, pattern.find_first_not_of(' '));
+        pattern.erase(pattern.find_last_not_of(' ') + 1);
+
+        if (pattern.empty())
+            continue;
+
+        const std::string &subject = (pattern.find('/') == std::string::npos) ? name : p;
+
+        if (fnmatch(pattern.c_str(), subject.c_str(), 0) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*
+ * Set the local maildirs which exist.
+ */
+void CVirtualFolder::set_maildirs(const std::vector<std::string> &paths)
+{
+    std::vector<std::unique_ptr<virtual_source> > sources;
+
+    for (const std::string &path : paths)
+    {
+        if (! searches(path))
+            continue;
+
+        /*
+         * Keep the state of any folder we already search.
+         */
+        auto found = std::find_if(m_sources.begin(), m_sources.end(),
+                                  [&path](const std::unique_ptr<virtual_source> &s)
+        {
+            return (s && (s->path == path));
+        });
+
+        if (found != m_sources.end())
+        {
+            sources.push_back(std::move(*found));
+            continue;
+        }
+
+        std::unique_ptr<virtual_source> source(new virtual_source);
+        source->path    = path;
+        source->scanned = false;
+        source->mtime   = 0;
+        source->dirty   = true;
+        sources.push_back(std::move(source));
+    }
+
+    m_sources.swap(sources);
+    m_generation++;
+}
+
+
+/*
+ * Bring our messages up to date.
+ */
+bool CVirtualFolder::refresh()
+{
+    bool changed = false;
+
+    for (std::unique_ptr<virtual_source> &source : m_sources)
+    {
+        if (! source->scanned)
+        {
+            scan(*source);
+            changed = true;
+            continue;
+        }
+
+        /*
+         * If the folder is watched we need only test what has changed,
+         * otherwise we rescan it when it is modified.
+         */
+        if (source->watcher.is_watching())
+        {
+            std::vector<maildir_change> changes;
+
+            if (! source->watcher.poll(changes))
+            {
+                scan(*source);
+                changed = true;
+            }
+            else if (! changes.empty())
+            {
+                apply(*source, changes);
+                changed = true;
+            }
+
+            continue;
+        }
+
+        CMaildir folder(source->path);
+
+        if (folder.last_modified() != source->mtime)
+        {
+            scan(*source);
+            changed = true;
+        }
+    }
+
+    /*
+     * Messages age out of dated queries without their folders changing.
+     */
+    time_t now = time(NULL);
+
+    if (m_dated && (now - m_tested >= VIRTUAL_AGE_INTERVAL))
+    {
+        m_tested = now;
+
+        for (std::unique_ptr<virtual_source> &source : m_sources)
+        {
+            for (auto it = source->messages.begin(); it != source->messages.end();)
+            {
+                if (matches(it->second, now))
+                    ++it;
+                else
+                {
+                    it = source->messages.erase(it);
+                    source->dirty = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    if (changed)
+        m_generation++;
+
+    return changed;
+}
+
+
+/*
+ * Scan the given folder.
+ */
+void CVirtualFolder::scan(virtual_source &source)
+{
+    CLogger *logger = CLogger::instance();
+    logger->log("maildir", "Searching %s for virtual folder %s.",
+                source.path.c_str(), m_name.c_str());
+
+    /*
+     * Watch before listing, so that nothing which changes while we're
+     * reading the directory is missed.
+     */
+    if (! source.watcher.is_watching())
+        source.watcher.watch(source.path);
+
+    CMaildir folder(source.path);
+    source.mtime   = folder.last_modified();
+    source.scanned = true;
+    source.dirty   = true;
+
+    /*
+     * Seed the headers of new messages from the folder's index, so that
+     * testing them needn't parse them.
+     */
+    CMaildirIndex index;
+    std::string file = CMaildirIndex::index_file(source.path);
+    bool indexed = (! file.empty()) && index.open(file, source.path);
+
+    std::unordered_map<std::string, std::shared_ptr<CMessage> > old;
+    old.swap(source.messages);
+
+    time_t now = time(NULL);
+
+    for (std::shared_ptr<CMessage> msg : folder.getMessages())
+    {
+        std::string path = msg->path();
+        auto found = old.find(path);
+
+        if (found != old.end())
+            msg = found->second;
+        else if (indexed && (msg->inode() != 0))
+        {
+            CHeaderList headers;
+            time_t date = 0;
+            uint32_t attributes = 0;
+            time_t mtime = 0;
+            off_t size = 0;
+
+            if (index.lookup(msg->inode(), path, headers, date, attributes, mtime, size))
+            {
+                msg->seed_headers(headers, true);
+                msg->set_ctime(date);
+                msg->set_stat(mtime, size);
+
+                if (attributes & INDEX_ATTACHMENTS_KNOWN)
+                    msg->set_attachments((attributes & INDEX_ATTACHMENTS) != 0);
+            }
+        }
+
+        if (matches(msg, now))
+            source.messages[path] = msg;
+    }
+}
+
+
+/*
+ * Apply the changes reported by a folder's watcher.
+ */
+void CVirtualFolder::apply(virtual_source &source, std::vector<maildir_change> &changes)
+{
+    std::shared_ptr<CMessageArena> arena;
+    time_t now = time(NULL);
+
+    source.dirty = true;
+
+    for (maildir_change change : changes)
+    {
+        auto found = source.messages.find(change.path);
+
+        if (change.added)
+        {
+            if (found != source.messages.end())
+                continue;
+
+            if (! arena)
+                arena = CMessageArena::folder(source.path);
+
+            std::shared_ptr<CMessage> msg = arena->message(change.path);
+
+            if (matches(msg, now))
+                source.messages[change.path] = msg;
+
+            continue;
+        }
+
+        if (found == source.messages.end())
+            continue;
+
+        std::shared_ptr<CMessage> msg = found->second;
+        source.messages.erase(found);
+
+        /*
+         * If we renamed the message ourselves, changing its flags, it
+         * is still present - though it might no longer match.
+         */
+        if ((msg->path() != change.path) && matches(msg, now))
+            source.messages[msg->path()] = msg;
+    }
+}
+
+
+/*
+ * Does the given message match our query?
+ */
+bool CVirtualFolder::matches(std::shared_ptr<CMessage> msg, time_t now)
+{
+    for (const virtual_term &term : m_terms)
+    {
+        switch (term.type)
+        {
+        case VIRTUAL_NEW:
+            if (! msg->is_new())
+                return false;
+
+            break;
+
+        case VIRTUAL_ATTACH:
+            if (! msg->has_attachments())
+                return false;
+
+            break;
+
+        case VIRTUAL_DAYS:
+        {
+            int64_t date = 0;
+
+            if (! CMessageSort::filename_date(msg, date))
+                date = msg->get_ctime();
+
+            if (date < (int64_t)(now - (time_t) term.days * 60 * 60 * 24))
+                return false;
+
+            break;
+        }
+
+        default:
+        {
+            std::string value = msg->header(term.name);
+            std::transform(value.begin(), value.end(), value.begin(), tolower);
+
+            if (value.find(term.text) == std::string::npos)
+                return false;
+        }
+        }
+    }
+
+    return true;
+}
+
+
+/*
+ * Get the messages which match.
+ */
+CMessageList CVirtualFolder::messages()
+{
+    if (m_merged_generation == m_generation)
+        return (m_merged);
+
+    /*
+     * Sort the messages of those folders which have changed.
+     */
+    std::vector<CMessageList> lists;
+    lists.reserve(m_sources.size());
+
+    for (std::unique_ptr<virtual_source> &source : m_sources)
+    {
+        if (source->dirty)
+        {
+            source->sorted.clear();
+            source->sorted.reserve(source->messages.size());
+
+            for (auto it : source->messages)
+                source->sorted.push_back(it.second);
+
+            CMessageSort::sort(source->sorted, "date");
+            source->dirty = false;
+        }
+
+        lists.push_back(std::move(source->sorted));
+    }
+
+    CMessageSort::merge(lists, "date", m_merged);
+    m_merged_generation = m_generation;
+
+    for (size_t i = 0; i < m_sources.size(); i++)
+        m_sources[i]->sorted = std::move(lists[i]);
+
+    return (m_merged);
+}
+
+
+/*
+ * The number of messages which match.
+ */
+int CVirtualFolder::total_messages()
+{
+    size_t total = 0;
+
+    for (std::unique_ptr<virtual_source> &source : m_sources)
+        total += source->messages.size();
+
+    return ((int) total);
+}
+
+
+/*
+ * The number of messages which match, and are unread.
+ */
+int CVirtualFolder::unread_messages()
+{
+    int unread = 0;
+
+    for (std::unique_ptr<virtual_source> &source : m_sources)
+    {
+        for (auto it : source->messages)
+        {
+            if (it.second->is_new())
+                unread++;
+        }
+    }
+
+    return (unread);
+}
+
+
+/*
+ * Our generation.
+ */
+uint64_t CVirtualFolder::generation()
+{
+    return (m_generation);
+}
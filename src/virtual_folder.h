@@ -0,0 +1,229 @@
+/*
+ * virtual_folder.h - A saved search, maintained as its folders change.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#pragma once
+
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+
+#include "maildir_index.h"
+#include "maildir_watcher.h"
+#include "message.h"
+
+
+/**
+ * A single term of a virtual folder's query.
+ */
+typedef struct _virtual_term
+{
+    /**
+     * One of the `VIRTUAL_*` values.
+     */
+    int type;
+
+    /**
+     * The header to test, and the (lower-cased) text it must contain.
+     */
+    std::string name;
+    std::string text;
+
+    /**
+     * The age, in days, of the oldest message to match.
+     */
+    int days;
+} virtual_term;
+
+
+/**
+ * The types of term.
+ */
+#define VIRTUAL_NEW    0
+#define VIRTUAL_ATTACH 1
+#define VIRTUAL_DAYS   2
+#define VIRTUAL_HEADER 3
+
+
+/**
+ * This class implements a virtual folder: the messages of several local
+ * maildirs which match a query, such as the unread messages in any
+ * folder named "INBOX.*".
+ *
+ * The folders searched are those whose names, or paths if the pattern
+ * contains a "/", match a shell-pattern - or any of several patterns,
+ * separated by commas.  Each is scanned once, seeding
+ * its messages from its maildir-index where possible, after which only
+ * the files reported by its watcher are tested - or, if it can't be
+ * watched, the folder is rescanned when its modification-time changes.
+ * We only hold the messages which match.
+ *
+ * A query is a list of terms, separated by spaces, all of which must
+ * match:
+ *
+ * * `all` matches every message.
+ * * `new`, or `unread`, matches unread messages.
+ * * `attach` matches messages with attachments.
+ * * `today` matches messages from the past day, and `days:N` from the
+ *   past N days.
+ * * `header:text` matches messages whose header contains the text,
+ *   without regard to case, e.g. `from:boss`.
+ */
+class CVirtualFolder
+{
+public:
+
+    /**
+     * Constructor.
+     */
+    CVirtualFolder(std::string name, std::string folders, std::string query);
+
+    /**
+     * Destructor.
+     */
+    ~CVirtualFolder();
+
+    /**
+     * Parse the given query into its terms.
+     *
+     * Returns false, with a description of the problem, if it is invalid.
+     */
+    static bool parse(std::string query, std::vector<virtual_term> &terms, std::string &error);
+
+    /**
+     * Our name, the pattern of the folders we search, and our query.
+     */
+    std::string name();
+    std::string folders();
+    std::string query();
+
+    /**
+     * Does the given maildir path match our pattern of folders?
+     */
+    bool searches(const std::string &path);
+
+    /**
+     * Set the local maildirs which exist, of which we search those which
+     * match our pattern.  The state of any folder we've searched already
+     * is kept.
+     */
+    void set_maildirs(const std::vector<std::string> &paths);
+
+    /**
+     * Bring our messages up to date with their folders, returning true
+     * if they changed.
+     */
+    bool refresh();
+
+    /**
+     * Get the messages which match, ordered by date.
+     *
+     * The messages of each folder are kept sorted, and sorted again only
+     * when that folder changes, so our list is a merge of theirs rather
+     * than a sort of every message.  The result is kept until any
+     * folder changes.
+     */
+    CMessageList messages();
+
+    /**
+     * The number of messages which match, and of those which are unread.
+     */
+    int total_messages();
+    int unread_messages();
+
+    /**
+     * A number which changes whenever our messages do.
+     */
+    uint64_t generation();
+
+private:
+
+    /**
+     * Does the given message match our query?
+     */
+    bool matches(std::shared_ptr<CMessage> msg, time_t now);
+
+    /**
+     * The state of each folder we search.
+     */
+    typedef struct _virtual_source
+    {
+        std::string path;
+        bool scanned;
+        time_t mtime;
+        CMaildirWatcher watcher;
+        std::unordered_map<std::string, std::shared_ptr<CMessage> > messages;
+
+        /*
+         * The messages, ordered by date, unless `dirty`.
+         */
+        CMessageList sorted;
+        bool dirty;
+    } virtual_source;
+
+    /**
+     * Scan the given folder, keeping those of our messages which are
+     * still present.
+     */
+    void scan(virtual_source &source);
+
+    /**
+     * Apply the changes reported by a folder's watcher.
+     */
+    void apply(virtual_source &source, std::vector<maildir_change> &changes);
+
+private:
+
+    /**
+     * Our name, folder-pattern, and query.
+     */
+    std::string m_name;
+    std::string m_folders;
+    std::string m_query;
+
+    /**
+     * The terms of our query, and whether any concern the date.
+     */
+    std::vector<virtual_term> m_terms;
+    bool m_dated;
+
+    /**
+     * The folders we search.
+     */
+    std::vector<std::unique_ptr<virtual_source> > m_sources;
+
+    /**
+     * Incremented whenever our messages change.
+     */
+    uint64_t m_generation;
+
+    /**
+     * Our messages, ordered by date, as of the given generation.
+     */
+    CMessageList m_merged;
+    uint64_t m_merged_generation;
+
+    /**
+     * When dated terms were last tested against the messages we hold.
+     */
+    time_t m_tested;
+};
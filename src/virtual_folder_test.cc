@@ -0,0 +1,241 @@
+/*
+ * virtual_folder_test.cc - Test-cases for our virtual folders.
+ *
+ * This file is part of lumail - http://lumail.org/
+ *
+ * Copyright (c) 2016 by Steve Kemp.  All rights reserved.
+ *
+ **
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 dated June, 1991, or (at your
+ * option) any later version.
+ *
+ * On Debian GNU/Linux systems, the complete text of version 2 of the GNU
+ * General Public License can be found in `/usr/share/common-licenses/GPL-2'
+ */
+
+
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "directory.h"
+#include "file.h"
+#include "virtual_folder.h"
+#include "CuTest.h"
+
+
+/**
+ * Test parsing queries.
+ */
+void TestVirtualQuery(CuTest * tc)
+{
+    std::vector<virtual_term> terms;
+    std::string error;
+
+    CuAssertTrue(tc, CVirtualFolder::parse("", terms, error));
+    CuAssertIntEquals(tc, 0, terms.size());
+
+    CuAssertTrue(tc, CVirtualFolder::parse("all", terms, error));
+    CuAssertIntEquals(tc, 0, terms.size());
+
+    CuAssertTrue(tc, CVirtualFolder::parse("Unread  From:Boss days:30", terms, error));
+    CuAssertIntEquals(tc, 3, terms.size());
+    CuAssertIntEquals(tc, VIRTUAL_NEW, terms[0].type);
+    CuAssertIntEquals(tc, VIRTUAL_HEADER, terms[1].type);
+    CuAssertStrEquals(tc, "from", terms[1].name.c_str());
+    CuAssertStrEquals(tc, "boss", terms[1].text.c_str());
+    CuAssertIntEquals(tc, VIRTUAL_DAYS, terms[2].type);
+    CuAssertIntEquals(tc, 30, terms[2].days);
+
+    CuAssertTrue(tc, CVirtualFolder::parse("today attach", terms, error));
+    CuAssertIntEquals(tc, 2, terms.size());
+    CuAssertIntEquals(tc, 1, terms[0].days);
+    CuAssertIntEquals(tc, VIRTUAL_ATTACH, terms[1].type);
+
+    const char *invalid[] = { "boss", ":boss", "from:", "days:0", "days:x" };
+
+    for (const char *query : invalid)
+    {
+        error = "";
+        CuAssertTrue(tc, ! CVirtualFolder::parse(query, terms, error));
+        CuAssertTrue(tc, ! error.empty());
+    }
+}
+
+
+/**
+ * Test matching the folders we search.
+ */
+void TestVirtualSearches(CuTest * tc)
+{
+    CVirtualFolder names("Inboxes", "INBOX*", "new");
+
+    CuAssertTrue(tc, names.searches("/home/steve/Maildir/INBOX"));
+    CuAssertTrue(tc, names.searches("/home/steve/Maildir/INBOX.work/"));
+    CuAssertTrue(tc, ! names.searches("/home/steve/Maildir/Sent"));
+    CuAssertTrue(tc, ! names.searches("/home/INBOX/Sent"));
+
+    CVirtualFolder paths("Lists", "*/lists/*", "new");
+
+    CuAssertTrue(tc, paths.searches("/home/steve/Maildir/lists/debian"));
+    CuAssertTrue(tc, ! paths.searches("/home/steve/Maildir/INBOX"));
+
+    CVirtualFolder several("Unified", "INBOX, */work/*", "all");
+
+    CuAssertTrue(tc, several.searches("/home/steve/Maildir/INBOX"));
+    CuAssertTrue(tc, several.searches("/home/steve/Maildir/work/INBOX"));
+    CuAssertTrue(tc, ! several.searches("/home/steve/Maildir/INBOX.old"));
+}
+
+
+/**
+ * Create a small message.
+ */
+static void touch(std::string path)
+{
+    std::fstream fs;
+    fs.open(path, std::fstream::out);
+    fs << "Subject: test\n\nBody\n";
+    fs.close();
+}
+
+
+/**
+ * Test our messages being maintained as their folders change.
+ */
+void TestVirtualIncremental(CuTest * tc)
+{
+    char tmpl[] = "/tmp/virtual.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(tmpl) != NULL);
+
+    std::string inbox = std::string(tmpl) + "/INBOX.work";
+    std::string sent  = std::string(tmpl) + "/Sent";
+
+    CDirectory::mkdir_p(inbox + "/cur");
+    CDirectory::mkdir_p(inbox + "/new");
+    CDirectory::mkdir_p(inbox + "/tmp");
+    CDirectory::mkdir_p(sent + "/cur");
+    CDirectory::mkdir_p(sent + "/new");
+    CDirectory::mkdir_p(sent + "/tmp");
+
+    touch(inbox + "/new/1");
+    touch(inbox + "/cur/2:2,S");
+    touch(sent + "/cur/3");
+
+    CVirtualFolder folder("Unread", "INBOX*", "unread");
+
+    std::vector<std::string> maildirs;
+    maildirs.push_back(inbox);
+    maildirs.push_back(sent);
+    folder.set_maildirs(maildirs);
+
+    /*
+     * The first refresh scans the inbox, the sent-folder is ignored.
+     */
+    CuAssertTrue(tc, folder.refresh());
+    CuAssertIntEquals(tc, 1, folder.total_messages());
+    CuAssertIntEquals(tc, 1, folder.unread_messages());
+    CuAssertTrue(tc, ! folder.refresh());
+
+    /*
+     * New messages are found, and read messages leave.
+     */
+    uint64_t generation = folder.generation();
+
+    touch(inbox + "/new/4");
+    CuAssertTrue(tc, rename((inbox + "/cur/2:2,S").c_str(), (inbox + "/cur/2:2,").c_str()) == 0);
+
+    CuAssertTrue(tc, folder.refresh());
+    CuAssertTrue(tc, folder.generation() != generation);
+    CuAssertIntEquals(tc, 3, folder.total_messages());
+
+    CuAssertTrue(tc, rename((inbox + "/new/1").c_str(), (inbox + "/cur/1:2,S").c_str()) == 0);
+    CFile::delete_file(inbox + "/new/4");
+
+    CuAssertTrue(tc, folder.refresh());
+    CuAssertIntEquals(tc, 1, folder.total_messages());
+
+    CMessageList messages = folder.messages();
+    CuAssertIntEquals(tc, 1, messages.size());
+    CuAssertStrEquals(tc, (inbox + "/cur/2:2,").c_str(), messages[0]->path().c_str());
+
+    /*
+     * Cleanup.
+     */
+    std::string cmd = std::string("rm -rf ") + tmpl;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+/**
+ * Test that our messages are merged, by date, from our folders.
+ */
+void TestVirtualMerged(CuTest * tc)
+{
+    char tmpl[] = "/tmp/virtual.XXXXXX";
+    CuAssertTrue(tc, mkdtemp(tmpl) != NULL);
+
+    std::string home = std::string(tmpl) + "/home";
+    std::string work = std::string(tmpl) + "/work";
+
+    for (std::string folder : { home, work })
+    {
+        CDirectory::mkdir_p(folder + "/cur");
+        CDirectory::mkdir_p(folder + "/new");
+        CDirectory::mkdir_p(folder + "/tmp");
+    }
+
+    touch(home + "/cur/1000.a:2,S");
+    touch(home + "/cur/3000.a:2,S");
+    touch(work + "/cur/2000.b:2,S");
+    touch(work + "/cur/4000.b:2,S");
+
+    CVirtualFolder folder("Unified", "home,work", "all");
+
+    std::vector<std::string> maildirs;
+    maildirs.push_back(home);
+    maildirs.push_back(work);
+    folder.set_maildirs(maildirs);
+    folder.refresh();
+
+    CMessageList messages = folder.messages();
+    CuAssertIntEquals(tc, 4, messages.size());
+    CuAssertStrEquals(tc, (home + "/cur/1000.a:2,S").c_str(), messages[0]->path().c_str());
+    CuAssertStrEquals(tc, (work + "/cur/2000.b:2,S").c_str(), messages[1]->path().c_str());
+    CuAssertStrEquals(tc, (home + "/cur/3000.a:2,S").c_str(), messages[2]->path().c_str());
+    CuAssertStrEquals(tc, (work + "/cur/4000.b:2,S").c_str(), messages[3]->path().c_str());
+
+    /*
+     * A message arriving in one folder takes its place amongst the
+     * others.
+     */
+    touch(home + "/new/2500.c");
+    folder.refresh();
+
+    messages = folder.messages();
+    CuAssertIntEquals(tc, 5, messages.size());
+    CuAssertStrEquals(tc, (work + "/cur/2000.b:2,S").c_str(), messages[1]->path().c_str());
+    CuAssertStrEquals(tc, (home + "/new/2500.c").c_str(), messages[2]->path().c_str());
+    CuAssertStrEquals(tc, (home + "/cur/3000.a:2,S").c_str(), messages[3]->path().c_str());
+
+    std::string cmd = std::string("rm -rf ") + tmpl;
+    CuAssertIntEquals(tc, 0, system(cmd.c_str()));
+}
+
+
+CuSuite *
+virtual_folder_getsuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, TestVirtualQuery);
+    SUITE_ADD_TEST(suite, TestVirtualSearches);
+    SUITE_ADD_TEST(suite, TestVirtualIncremental);
+    SUITE_ADD_TEST(suite, TestVirtualMerged);
+    return suite;
+}
@@ -93,6 +93,80 @@ function TestConfig:test_keys ()
   luaunit.assertEquals(#one + 1, #two)
 end
 
+--
+-- Test that subscribed functions see changes to their keys only
+--
+function TestConfig:test_subscribe ()
+
+  local seen = {}
+
+  Config:subscribe("sub.one", function (name, old)
+    table.insert(seen, name .. "=" .. tostring(old))
+  end)
+
+  Config:subscribe("sub.prefix.", function (name, old)
+    table.insert(seen, name)
+  end)
+
+  Config:set("sub.one", "first")
+  Config:set("sub.one", "second")
+  Config:set("sub.two", "ignored")
+  Config:set("sub.prefix.a", 1)
+
+  -- Unchanged values aren't changes
+  Config:set("sub.one", "second")
+
+  luaunit.assertEquals(seen, { "sub.one=nil", "sub.one=first", "sub.prefix.a" })
+
+  -- Returning false unsubscribes
+  local count = 0
+  Config:subscribe("sub.once", function (name, old)
+    count = count + 1
+    return false
+  end)
+
+  Config:set("sub.once", 1)
+  Config:set("sub.once", 2)
+  luaunit.assertEquals(count, 1)
+end
+
+--
+-- Test that batched changes are seen once, afterwards
+--
+function TestConfig:test_batch ()
+
+  local seen = {}
+
+  Config:subscribe("batch.", function (name, old)
+    table.insert(seen, name .. "=" .. tostring(old))
+  end)
+
+  Config:set("batch.one", "a")
+  seen = {}
+
+  Config:batch(function()
+    Config:set("batch.one", "b")
+    Config:set("batch.one", "c")
+    Config:set("batch.two", "d")
+
+    -- Nothing is seen until the batch is done
+    luaunit.assertEquals(#seen, 0)
+    luaunit.assertEquals(Config:get "batch.one", "c")
+  end)
+
+  luaunit.assertEquals(seen, { "batch.one=a", "batch.two=nil" })
+
+  -- Errors are raised once the changes are committed
+  seen = {}
+  local ok = pcall(Config.batch, Config, function()
+    Config:set("batch.one", "e")
+    error("failed")
+  end)
+
+  luaunit.assertEquals(ok, false)
+  luaunit.assertEquals(seen, { "batch.one=c" })
+end
+
 --
 -- Run the tests
 --
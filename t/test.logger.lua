@@ -118,6 +118,39 @@ function TestLogger:test_log_levels ()
   luaunit.assertEquals(File:exists(tmp), false)
 end
 
+--
+-- Test spans are written to our trace-file, and return their results.
+--
+function TestLogger:test_span ()
+
+  -- Spans work without tracing.
+  local a, b = Log:span("untraced", function(x, y) return x + y, "ok" end, 1, 2)
+  luaunit.assertEquals(a, 3)
+  luaunit.assertEquals(b, "ok")
+
+  local tmp = os.tmpname()
+  Config:set("log.trace", tmp)
+
+  Log:span("outer", function()
+    Log:span("inner", function() end)
+  end)
+
+  -- Errors are raised, once the span has been recorded.
+  luaunit.assertError(Log.span, Log, "failing", function() error("bang") end)
+
+  -- Completes the file.
+  Config:set("log.trace", "")
+
+  local content = io.open(tmp):read("*a")
+  luaunit.assertNotNil(string.find(content, '"name":"outer"', 1, true))
+  luaunit.assertNotNil(string.find(content, '"name":"inner"', 1, true))
+  luaunit.assertNotNil(string.find(content, '"name":"failing"', 1, true))
+  luaunit.assertNil(string.find(content, '"name":"untraced"', 1, true))
+  luaunit.assertEquals(string.sub(content, -2), "]\n")
+
+  os.remove(tmp)
+end
+
 --
 -- Run the tests
 --
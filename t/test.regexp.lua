@@ -19,6 +19,8 @@ TestRegexp = {}
 --
 function TestRegexp:test_functions ()
   luaunit.assertIsFunction(Regexp.match)
+  luaunit.assertIsFunction(Regexp.compile)
+  luaunit.assertIsFunction(Regexp.stats)
 end
 
 function TestRegexp:test_basic ()
@@ -77,6 +79,48 @@ function TestRegexp:test_captures ()
 end
 
 
+--
+-- Compiled patterns behave as `match` does.
+--
+function TestRegexp:test_compile ()
+
+  local re = Regexp:compile("^([0-9]+)\\.([0-9]+)$")
+  luaunit.assertEquals(re:pattern(), "^([0-9]+)\\.([0-9]+)$")
+  luaunit.assertEquals(re:captures(), 2)
+
+  local res = re:match("3.14")
+  luaunit.assertIsTable(res)
+  luaunit.assertEquals(res[1], "3")
+  luaunit.assertEquals(res[2], "14")
+
+  local kemp = Regexp.compile("[kh]emp$")
+  luaunit.assertTrue(kemp:match("Steve Kemp"))
+
+  local exact = Regexp:compile("[kh]emp$", { caseless = false })
+  luaunit.assertTrue(exact:match("Steve Kemp") == false)
+
+  local broken, err = Regexp:compile("(unclosed")
+  luaunit.assertNil(broken)
+  luaunit.assertIsString(err)
+end
+
+
+--
+-- Repeated matches are served from the cache.
+--
+function TestRegexp:test_cache ()
+
+  Regexp:match("cached-pattern", "input")
+  local before = Regexp:stats()
+
+  Regexp:match("cached-pattern", "more input")
+  local after = Regexp:stats()
+
+  luaunit.assertEquals(after.hits, before.hits + 1)
+  luaunit.assertEquals(after.misses, before.misses)
+end
+
+
 --
 -- Run the tests
 --
@@ -0,0 +1,61 @@
+--
+-- Configure a sane load-path
+--
+package.path = package.path .. ";t/?.lua;../lib/?.lua;lib/?.lua"
+
+--
+-- Require our unit-testing framework.
+--
+luaunit = require 'luaunit'
+
+--
+-- Holder
+--
+TestTimer = {}
+
+
+--
+-- Basic testing
+--
+function TestTimer:test_functions ()
+  luaunit.assertIsFunction(Timer.after)
+  luaunit.assertIsFunction(Timer.cancel)
+  luaunit.assertIsFunction(Timer.count)
+  luaunit.assertIsFunction(Timer.every)
+end
+
+
+--
+-- Adding and cancelling timers.
+--
+function TestTimer:test_cancel ()
+
+  local count = Timer.count()
+
+  local once  = Timer.after( 60, function() end )
+  local every = Timer:every( 60, function() end )
+
+  luaunit.assertIsNumber(once)
+  luaunit.assertIsNumber(every)
+  luaunit.assertNotEquals(once, every)
+  luaunit.assertEquals(Timer.count(), count + 2)
+
+  luaunit.assertTrue(Timer.cancel(once))
+  luaunit.assertFalse(Timer.cancel(once))
+  luaunit.assertTrue(Timer:cancel(every))
+  luaunit.assertEquals(Timer.count(), count)
+end
+
+
+--
+-- Invalid arguments.
+--
+function TestTimer:test_invalid ()
+  luaunit.assertError(Timer.after, 10)
+  luaunit.assertError(Timer.every, "soon", function() end)
+end
+
+--
+-- Run the tests
+--
+os.exit(luaunit.LuaUnit.run())